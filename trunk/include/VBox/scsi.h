@@ -123,7 +123,12 @@ typedef enum SCSICMD
     SCSI_RELEASE_6                      = 0x17,
     SCSI_RESERVE_10                     = 0x56,
     SCSI_RELEASE_10                     = 0x57,
-    SCSI_READ_BLOCK_LIMITS              = 0x05
+    SCSI_READ_BLOCK_LIMITS              = 0x05,
+    SCSI_WRITE_SAME_10                  = 0x41,
+    SCSI_WRITE_SAME_16                  = 0x93,
+    SCSI_COMPARE_AND_WRITE              = 0x89,
+    SCSI_EXTENDED_COPY                  = 0x83,
+    SCSI_RECEIVE_COPY_RESULTS           = 0x84
 } SCSICMD;
 
 /**
@@ -134,6 +139,14 @@ typedef enum SCSISVCACTIONIN
     SCSI_SVC_ACTION_IN_READ_CAPACITY_16 = 0x10
 } SCSISVCACTIONIN;
 
+/**
+ * Service actions of the RECEIVE COPY RESULTS command.
+ */
+typedef enum SCSIRECVCOPYRESULTSSVCACTION
+{
+    SCSI_RECV_COPY_RESULTS_OPERATING_PARAMETERS = 0x03
+} SCSIRECVCOPYRESULTSSVCACTION;
+
 /* Mode page codes for mode sense/select commands. */
 #define SCSI_MODEPAGE_ERROR_RECOVERY   0x01
 #define SCSI_MODEPAGE_WRITE_PARAMETER  0x05
@@ -191,10 +204,14 @@ typedef enum SCSISVCACTIONIN
 /* Additional sense keys */
 #define SCSI_ASC_NONE                                       0x00
 #define SCSI_ASC_WRITE_ERROR                                0x0c
+#define SCSI_ASC_COPY_TARGET_DEVICE_ERROR                   0x0d
 #define SCSI_ASC_READ_ERROR                                 0x11
+#define SCSI_ASC_PARAMETER_LIST_LENGTH_ERROR                0x1a
+#define SCSI_ASC_MISCOMPARE_DURING_VERIFY                   0x1d
 #define SCSI_ASC_ILLEGAL_OPCODE                             0x20
 #define SCSI_ASC_LOGICAL_BLOCK_OOR                          0x21
 #define SCSI_ASC_INV_FIELD_IN_CMD_PACKET                    0x24
+#define SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST                0x26
 #define SCSI_ASC_WRITE_PROTECTED                            0x27
 #define SCSI_ASC_MEDIUM_MAY_HAVE_CHANGED                    0x28
 #define SCSI_ASC_POWER_ON_RESET_BUS_DEVICE_RESET_OCCURRED   0x29
@@ -214,6 +231,11 @@ typedef enum SCSISVCACTIONIN
 #define SCSI_ASCQ_EOP_EOM_DETECTED                          0x02
 #define SCSI_ASCQ_SETMARK_DETECTED                          0x03
 #define SCSI_ASCQ_BOP_BOM_DETECTED                          0x04
+#define SCSI_ASCQ_COPY_TARGET_DEVICE_NOT_REACHABLE          0x02
+#define SCSI_ASCQ_TOO_MANY_TARGET_DESCRIPTORS               0x06
+#define SCSI_ASCQ_UNSUPPORTED_TARGET_DESCRIPTOR_TYPE_CODE   0x07
+#define SCSI_ASCQ_TOO_MANY_SEGMENT_DESCRIPTORS              0x08
+#define SCSI_ASCQ_UNSUPPORTED_SEGMENT_DESCRIPTOR_TYPE_CODE  0x09
 
 /** @name SCSI_INQUIRY
  * @{
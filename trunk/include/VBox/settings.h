@@ -724,6 +724,9 @@ struct BandwidthGroup
     com::Utf8Str         strName;
     uint64_t             cMaxBytesPerSec;
     BandwidthGroupType_T enmType;
+    com::Utf8Str         strParent;
+    uint64_t             cCeilBytesPerSec;
+    uint32_t             cbBurst;
 };
 
 typedef std::list<BandwidthGroup> BandwidthGroupList;
@@ -654,6 +654,12 @@ VBOXDDU_DECL(int) VDOpen(PVBOXHDD pDisk, const char *pszBackend,
 /**
  * Opens a cache image.
  *
+ * If the cache is not up to date with the last image in the container its
+ * content is discarded, unless the cache is opened read-only. The "WriteMode"
+ * key of the configuration interface in pVDIfsCache selects whether writes
+ * only invalidate cached data ("around", the default) or update the cache
+ * ("through").
+ *
  * @return  VBox status code.
  * @param   pDisk           Pointer to the HDD container which should use the cache image.
  * @param   pszBackend      Name of the cache file backend to use (case insensitive).
@@ -101,7 +101,7 @@ typedef struct GVM
 #ifdef ___GMMR0Internal_h
         struct GMMPERVM     s;
 #endif
-        uint8_t             padding[512];
+        uint8_t             padding[640];
     } gmm;
 
     /** The RAWPCIVM per vm data. */
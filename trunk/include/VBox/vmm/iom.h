@@ -151,8 +151,25 @@ RT_C_DECLS_BEGIN
  * supply bytes (zero them or read them). */
 #define IOMMMIO_FLAGS_DBGSTOP_ON_COMPLICATED_WRITE      UINT32_C(0x00000200)
 
+/** Don't enter the device critical section around the callbacks of this range.
+ * The device serializes accesses to the range itself, using atomics or finer
+ * grained locks, so that several EMTs can be in the handlers at the same time.
+ * Use this for hot registers like doorbells and counters only, the rest of the
+ * device is still protected by the critical section. */
+#define IOMMMIO_FLAGS_NO_DEV_LOCK                       UINT32_C(0x00001000)
+
+/** Mask of valid flags. */
+#define IOMMMIO_FLAGS_VALID_MASK                        UINT32_C(0x00001373)
+/** @} */
+
+/** @name I/O port range flags.
+ * @{ */
+/** Don't enter the device critical section around the callbacks of this range.
+ * Same as IOMMMIO_FLAGS_NO_DEV_LOCK, the callbacks must enter the device
+ * critical section themselves for everything but the hot registers. */
+#define IOMIOPORT_FLAGS_NO_DEV_LOCK                     UINT32_C(0x00000001)
 /** Mask of valid flags. */
-#define IOMMMIO_FLAGS_VALID_MASK                        UINT32_C(0x00000373)
+#define IOMIOPORT_FLAGS_VALID_MASK                      UINT32_C(0x00000001)
 /** @} */
 
 /**
@@ -324,7 +341,7 @@ VMMR3_INT_DECL(int)  IOMR3Term(PVM pVM);
 VMMR3_INT_DECL(int)  IOMR3IOPortRegisterR3(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT PortStart, RTUINT cPorts, RTHCPTR pvUser,
                                            R3PTRTYPE(PFNIOMIOPORTOUT) pfnOutCallback, R3PTRTYPE(PFNIOMIOPORTIN) pfnInCallback,
                                            R3PTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStringCallback, R3PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStringCallback,
-                                           const char *pszDesc);
+                                           uint32_t fFlags, const char *pszDesc);
 VMMR3_INT_DECL(int)  IOMR3IOPortRegisterRC(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT PortStart, RTUINT cPorts, RTRCPTR pvUser,
                                            RCPTRTYPE(PFNIOMIOPORTOUT) pfnOutCallback, RCPTRTYPE(PFNIOMIOPORTIN) pfnInCallback,
                                            RCPTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback, RCPTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback,
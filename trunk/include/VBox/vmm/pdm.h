@@ -31,6 +31,7 @@
 #include <VBox/vmm/pdmcritsect.h>
 #include <VBox/vmm/pdmcritsectrw.h>
 #include <VBox/vmm/pdmthread.h>
+#include <VBox/vmm/pdmworkqueue.h>
 #include <VBox/vmm/pdmifs.h>
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmdev.h>
@@ -29,6 +29,7 @@
 #include <VBox/vmm/pdmqueue.h>
 #include <VBox/vmm/pdmcritsect.h>
 #include <VBox/vmm/pdmthread.h>
+#include <VBox/vmm/pdmworkqueue.h>
 #include <VBox/vmm/pdmifs.h>
 #include <VBox/vmm/pdmins.h>
 #include <VBox/vmm/pdmcommon.h>
@@ -3617,11 +3618,55 @@ typedef struct PDMDEVHLPR3
      */
     DECLR3CALLBACKMEMBER(VMRESUMEREASON, pfnVMGetResumeReason,(PPDMDEVINS pDevIns));
 
+    /**
+     * Creates a work queue running on the shared PDM worker threads.
+     *
+     * The queue is destroyed automatically when the device is destroyed.
+     *
+     * @returns VBox status code.
+     * @param   pDevIns             The device instance.
+     * @param   enmPrio             The queue priority.
+     * @param   iAffinity           Index of the preferred worker, or
+     *                              PDMWORKQUEUE_AFFINITY_ANY.  Taken modulo
+     *                              the worker count.
+     * @param   pfnCallback         The work item callback.
+     * @param   pszName             The queue name, used for statistics.  Must
+     *                              be unique and stay valid while the queue
+     *                              exists.
+     * @param   ppQueue             Where to store the queue handle.
+     * @thread  EMT
+     */
+    DECLR3CALLBACKMEMBER(int, pfnWorkQueueCreate,(PPDMDEVINS pDevIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                                  PFNPDMWORKDEV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue));
+
+    /**
+     * Register a number of I/O ports with a device, taking range flags.
+     *
+     * Same as pfnIOPortRegister, except for the @a fFlags argument.
+     *
+     * @returns VBox status.
+     * @param   pDevIns             The device instance to register the ports with.
+     * @param   Port                First port number in the range.
+     * @param   cPorts              Number of ports to register.
+     * @param   pvUser              User argument.
+     * @param   fFlags              Flags, IOMIOPORT_FLAGS_XXX.  These apply to
+     *                              the RC and R0 handlers of the ports too.
+     * @param   pfnOut              Pointer to function which is gonna handle OUT operations.
+     * @param   pfnIn               Pointer to function which is gonna handle IN operations.
+     * @param   pfnOutStr           Pointer to function which is gonna handle string OUT operations.
+     * @param   pfnInStr            Pointer to function which is gonna handle string IN operations.
+     * @param   pszDesc             Pointer to description string. This must not be freed.
+     * @remarks Caller enters the device critical section prior to invoking the
+     *          registered callback methods, unless IOMIOPORT_FLAGS_NO_DEV_LOCK
+     *          is given.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnIOPortRegisterEx,(PPDMDEVINS pDevIns, RTIOPORT Port, RTIOPORT cPorts, RTHCPTR pvUser, uint32_t fFlags,
+                                                   PFNIOMIOPORTOUT pfnOut, PFNIOMIOPORTIN pfnIn,
+                                                   PFNIOMIOPORTOUTSTRING pfnOutStr, PFNIOMIOPORTINSTRING pfnInStr, const char *pszDesc));
+
 
     /** Space reserved for future members.
      * @{ */
-    DECLR3CALLBACKMEMBER(void, pfnReserved1,(void));
-    DECLR3CALLBACKMEMBER(void, pfnReserved2,(void));
     DECLR3CALLBACKMEMBER(void, pfnReserved3,(void));
     DECLR3CALLBACKMEMBER(void, pfnReserved4,(void));
     DECLR3CALLBACKMEMBER(void, pfnReserved5,(void));
@@ -3828,7 +3873,7 @@ typedef R3PTRTYPE(struct PDMDEVHLPR3 *) PPDMDEVHLPR3;
 typedef R3PTRTYPE(const struct PDMDEVHLPR3 *) PCPDMDEVHLPR3;
 
 /** Current PDMDEVHLPR3 version number. */
-#define PDM_DEVHLPR3_VERSION                    PDM_VERSION_MAKE(0xffe7, 16, 0)
+#define PDM_DEVHLPR3_VERSION                    PDM_VERSION_MAKE(0xffe7, 16, 2)
 
 
 /**
@@ -4511,6 +4556,16 @@ DECLINLINE(int) PDMDevHlpIOPortRegister(PPDMDEVINS pDevIns, RTIOPORT Port, RTIOP
     return pDevIns->pHlpR3->pfnIOPortRegister(pDevIns, Port, cPorts, pvUser, pfnOut, pfnIn, pfnOutStr, pfnInStr, pszDesc);
 }
 
+/**
+ * @copydoc PDMDEVHLPR3::pfnIOPortRegisterEx
+ */
+DECLINLINE(int) PDMDevHlpIOPortRegisterEx(PPDMDEVINS pDevIns, RTIOPORT Port, RTIOPORT cPorts, RTHCPTR pvUser, uint32_t fFlags,
+                                          PFNIOMIOPORTOUT pfnOut, PFNIOMIOPORTIN pfnIn,
+                                          PFNIOMIOPORTOUTSTRING pfnOutStr, PFNIOMIOPORTINSTRING pfnInStr, const char *pszDesc)
+{
+    return pDevIns->pHlpR3->pfnIOPortRegisterEx(pDevIns, Port, cPorts, pvUser, fFlags, pfnOut, pfnIn, pfnOutStr, pfnInStr, pszDesc);
+}
+
 /**
  * @copydoc PDMDEVHLPR3::pfnIOPortRegisterRC
  */
@@ -5176,6 +5231,15 @@ DECLINLINE(int) PDMDevHlpThreadCreate(PPDMDEVINS pDevIns, PPPDMTHREAD ppThread,
     return pDevIns->pHlpR3->pfnThreadCreate(pDevIns, ppThread, pvUser, pfnThread, pfnWakeup, cbStack, enmType, pszName);
 }
 
+/**
+ * @copydoc PDMDEVHLPR3::pfnWorkQueueCreate
+ */
+DECLINLINE(int) PDMDevHlpWorkQueueCreate(PPDMDEVINS pDevIns, PDMWORKPRIO enmPrio, uint32_t iAffinity, PFNPDMWORKDEV pfnCallback,
+                                         const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    return pDevIns->pHlpR3->pfnWorkQueueCreate(pDevIns, enmPrio, iAffinity, pfnCallback, pszName, ppQueue);
+}
+
 /**
  * @copydoc PDMDEVHLPR3::pfnSetAsyncNotification
  */
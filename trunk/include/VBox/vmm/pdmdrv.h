@@ -29,6 +29,7 @@
 #include <VBox/vmm/pdmqueue.h>
 #include <VBox/vmm/pdmcritsect.h>
 #include <VBox/vmm/pdmthread.h>
+#include <VBox/vmm/pdmworkqueue.h>
 #include <VBox/vmm/pdmifs.h>
 #include <VBox/vmm/pdmins.h>
 #include <VBox/vmm/pdmcommon.h>
@@ -1328,9 +1329,29 @@ typedef struct PDMDRVHLPR3
      */
     DECLR3CALLBACKMEMBER(VMRESUMEREASON, pfnVMGetResumeReason,(PPDMDRVINS pDrvIns));
 
+    /**
+     * Creates a work queue running on the shared PDM worker threads.
+     *
+     * The queue is destroyed automatically when the driver is destroyed.
+     *
+     * @returns VBox status code.
+     * @param   pDrvIns             The driver instance.
+     * @param   enmPrio             The queue priority.
+     * @param   iAffinity           Index of the preferred worker, or
+     *                              PDMWORKQUEUE_AFFINITY_ANY.  Taken modulo
+     *                              the worker count.
+     * @param   pfnCallback         The work item callback.
+     * @param   pszName             The queue name, used for statistics.  Must
+     *                              be unique and stay valid while the queue
+     *                              exists.
+     * @param   ppQueue             Where to store the queue handle.
+     * @thread  EMT
+     */
+    DECLR3CALLBACKMEMBER(int, pfnWorkQueueCreate,(PPDMDRVINS pDrvIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                                  PFNPDMWORKDRV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue));
+
     /** @name Space reserved for minor interface changes.
      * @{ */
-    DECLR3CALLBACKMEMBER(void, pfnReserved0,(PPDMDRVINS pDrvIns));
     DECLR3CALLBACKMEMBER(void, pfnReserved1,(PPDMDRVINS pDrvIns));
     DECLR3CALLBACKMEMBER(void, pfnReserved2,(PPDMDRVINS pDrvIns));
     DECLR3CALLBACKMEMBER(void, pfnReserved3,(PPDMDRVINS pDrvIns));
@@ -1346,7 +1367,7 @@ typedef struct PDMDRVHLPR3
     uint32_t                        u32TheEnd;
 } PDMDRVHLPR3;
 /** Current DRVHLP version number. */
-#define PDM_DRVHLPR3_VERSION                    PDM_VERSION_MAKE(0xf0fb, 3, 0)
+#define PDM_DRVHLPR3_VERSION                    PDM_VERSION_MAKE(0xf0fb, 3, 1)
 
 #endif /* IN_RING3 */
 
@@ -1769,6 +1790,15 @@ DECLINLINE(int) PDMDrvHlpThreadCreate(PPDMDRVINS pDrvIns, PPPDMTHREAD ppThread,
     return pDrvIns->pHlpR3->pfnThreadCreate(pDrvIns, ppThread, pvUser, pfnThread, pfnWakeup, cbStack, enmType, pszName);
 }
 
+/**
+ * @copydoc PDMDRVHLPR3::pfnWorkQueueCreate
+ */
+DECLINLINE(int) PDMDrvHlpWorkQueueCreate(PPDMDRVINS pDrvIns, PDMWORKPRIO enmPrio, uint32_t iAffinity, PFNPDMWORKDRV pfnCallback,
+                                         const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    return pDrvIns->pHlpR3->pfnWorkQueueCreate(pDrvIns, enmPrio, iAffinity, pfnCallback, pszName, ppQueue);
+}
+
 # ifdef VBOX_WITH_PDM_ASYNC_COMPLETION
 /**
  * @copydoc PDMDRVHLPR3::pfnAsyncCompletionTemplateCreate
@@ -320,6 +320,40 @@ typedef struct PDMINETWORKUP
      */
     DECLR3CALLBACKMEMBER(void, pfnNotifyLinkChanged,(PPDMINETWORKUP pInterface, PDMNETWORKLINKSTATE enmLinkState));
 
+    /**
+     * Send a frame described by a caller owned scatter/gather buffer.
+     *
+     * This allows the caller to pass data without copying it into a buffer
+     * from PDMINETWORKUP::pfnAllocBuf first, e.g. a device referencing guest
+     * pages directly.  Unlike pfnSendBuf the buffer is not consumed, the driver
+     * must be completely done with it when returning.  The segments must not
+     * be modified.  The buffer may have any number of segments, however the
+     * protocol headers of a GSO frame must be contained in the first one.
+     *
+     * This method is optional, NULL if not implemented.  Must be called within
+     * a pfnBeginXmit / pfnEndXmit session.
+     *
+     * @retval  VINF_SUCCESS on success.
+     * @retval  VERR_NOT_SUPPORTED if the driver cannot handle this particular
+     *          frame this way (e.g. the GSO type).  Nothing has been sent, the
+     *          caller should copy the frame into a pfnAllocBuf buffer and use
+     *          pfnSendBuf instead.
+     * @retval  VERR_NET_DOWN if the NIC is not connected to a network.
+     * @retval  VERR_NET_NO_BUFFER_SPACE if we're out of resources.
+     *
+     * @param   pInterface      Pointer to the interface structure containing the
+     *                          called function pointer.
+     * @param   pSgBuf          The buffer containing the data to send.
+     *                          PDMSCATTERGATHER::cbUsed gives the frame size and
+     *                          PDMSCATTERGATHER::pvUser the GSO context (if any),
+     *                          pvAllocator is ignored.
+     * @param   fOnWorkerThread Set if we're being called on a work thread.  Clear
+     *                          if an EMT.
+     *
+     * @thread  Any, but normally EMT or the XMIT thread.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnSendSg,(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread));
+
     /** @todo Add a callback that informs the driver chain about MAC address changes if we ever implement that.  */
 
 } PDMINETWORKUP;
@@ -340,6 +374,8 @@ typedef struct PDMINETWORKUPR0
     DECLR0CALLBACKMEMBER(void, pfnEndXmit,(PPDMINETWORKUPR0 pInterface));
     /** @copydoc PDMINETWORKUP::pfnSetPromiscuousMode */
     DECLR0CALLBACKMEMBER(void, pfnSetPromiscuousMode,(PPDMINETWORKUPR0 pInterface, bool fPromiscuous));
+    /** @copydoc PDMINETWORKUP::pfnSendSg */
+    DECLR0CALLBACKMEMBER(int,  pfnSendSg,(PPDMINETWORKUPR0 pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread));
 } PDMINETWORKUPR0;
 
 /** Raw-mode context edition of PDMINETWORKUP. */
@@ -358,12 +394,14 @@ typedef struct PDMINETWORKUPRC
     DECLRCCALLBACKMEMBER(void, pfnEndXmit,(PPDMINETWORKUPRC pInterface));
     /** @copydoc PDMINETWORKUP::pfnSetPromiscuousMode */
     DECLRCCALLBACKMEMBER(void, pfnSetPromiscuousMode,(PPDMINETWORKUPRC pInterface, bool fPromiscuous));
+    /** @copydoc PDMINETWORKUP::pfnSendSg */
+    DECLRCCALLBACKMEMBER(int,  pfnSendSg,(PPDMINETWORKUPRC pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread));
 } PDMINETWORKUPRC;
 
 /** PDMINETWORKUP interface ID. */
-#define PDMINETWORKUP_IID                       "67e7e7a8-2594-4649-a1e3-7cee680c6083"
+#define PDMINETWORKUP_IID                       "1f8bb8a9-4fd6-44a6-b5c8-9a1b4e1f2c37"
 /** PDMINETWORKUP interface method names. */
-#define PDMINETWORKUP_SYM_LIST                  "BeginXmit;AllocBuf;FreeBuf;SendBuf;EndXmit;SetPromiscuousMode"
+#define PDMINETWORKUP_SYM_LIST                  "BeginXmit;AllocBuf;FreeBuf;SendBuf;EndXmit;SetPromiscuousMode;SendSg"
 
 
 /** Pointer to a network config port interface */
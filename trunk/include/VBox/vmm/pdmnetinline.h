@@ -578,6 +578,77 @@ DECLINLINE(uint32_t) PDMNetGsoCarveSegment(PCPDMNETWORKGSO pGso, const uint8_t *
 }
 
 
+/**
+ * Carves out the headers of the specified TCP segment without touching the
+ * payload.
+ *
+ * This is for callers which only have the headers of the GSO frame in one
+ * linear chunk and the payload scattered about.  The TCP checksum field is
+ * zeroed and the pseudo header checksum is returned instead, so the caller can
+ * complete it using RTNetIPv4AddTCPChecksum, RTNetIPv4AddDataChecksum on each
+ * payload chunk and RTNetIPv4FinalizeChecksum.
+ *
+ * @returns The offset into the GSO frame of the payload, 0 if @a pGso is not
+ *          a TCP type (UDP fragmentation needs the whole datagram).
+ * @param   pGso                The GSO context data.
+ * @param   pbHdrs              Pointer to the headers of the GSO frame, at
+ *                              least pGso->cbHdrsTotal bytes.  Not modified.
+ * @param   cbFrame             The size of the GSO frame.
+ * @param   iSeg                The segment that we're carving out (0-based).
+ * @param   cSegs               The number of segments in the GSO frame.  Use
+ *                              PDMNetGsoCalcSegmentCount to find this.
+ * @param   pbSegHdrs           Where to return the headers for the segment
+ *                              that's been carved out.  The buffer must be at
+ *                              least pGso->cbHdrs in size, using a 256 byte
+ *                              buffer is a recommended simplification.
+ * @param   pcbSegHdrs          Where to return the size of the returned
+ *                              segment headers.
+ * @param   pcbSegPayload       Where to return the size of the returned
+ *                              segment payload.
+ * @param   pu32PseudoSum       Where to return the 32-bit intermediary pseudo
+ *                              header checksum.
+ */
+DECLINLINE(uint32_t) PDMNetGsoCarveSegmentHdrs(PCPDMNETWORKGSO pGso, const uint8_t *pbHdrs, size_t cbFrame,
+                                               uint32_t iSeg, uint32_t cSegs, uint8_t *pbSegHdrs,
+                                               uint32_t *pcbSegHdrs, uint32_t *pcbSegPayload, uint32_t *pu32PseudoSum)
+{
+    uint32_t const cbSegHdrs    = pdmNetSegHdrLen(pGso, iSeg);
+    uint32_t const cbSegPayload = pdmNetSegPayloadLen(pGso, iSeg, cSegs, (uint32_t)cbFrame);
+    uint32_t       u32PseudoSum;
+
+    Assert(iSeg < cSegs);
+    Assert(cSegs == PDMNetGsoCalcSegmentCount(pGso, cbFrame));
+    Assert(PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame));
+
+    memcpy(pbSegHdrs, pbHdrs, pGso->cbHdrsTotal);
+
+    switch ((PDMNETWORKGSOTYPE)pGso->u8Type)
+    {
+        case PDMNETWORKGSOTYPE_IPV4_TCP:
+            u32PseudoSum = pdmNetGsoUpdateIPv4Hdr(pbSegHdrs, pGso->offHdr1, cbSegPayload, iSeg, cbSegHdrs);
+            break;
+        case PDMNETWORKGSOTYPE_IPV6_TCP:
+            u32PseudoSum = pdmNetGsoUpdateIPv6Hdr(pbSegHdrs, pGso->offHdr1, cbSegPayload, cbSegHdrs,
+                                                  pGso->offHdr2, RTNETIPV4_PROT_TCP);
+            break;
+        case PDMNETWORKGSOTYPE_IPV4_IPV6_TCP:
+            pdmNetGsoUpdateIPv4Hdr(pbSegHdrs, pGso->offHdr1, cbSegPayload, iSeg, cbSegHdrs);
+            u32PseudoSum = pdmNetGsoUpdateIPv6Hdr(pbSegHdrs, pgmNetGsoCalcIpv6Offset(pbSegHdrs, pGso->offHdr1),
+                                                  cbSegPayload, cbSegHdrs, pGso->offHdr2, RTNETIPV4_PROT_TCP);
+            break;
+        default:
+            return 0;
+    }
+    pdmNetGsoUpdateTcpHdr(u32PseudoSum, pbSegHdrs, pGso->offHdr2, NULL, cbSegPayload, iSeg * pGso->cbMaxSeg,
+                          cbSegHdrs, iSeg + 1 == cSegs, PDMNETCSUMTYPE_NONE);
+
+    *pcbSegHdrs    = cbSegHdrs;
+    *pcbSegPayload = cbSegPayload;
+    *pu32PseudoSum = u32PseudoSum;
+    return cbSegHdrs + iSeg * pGso->cbMaxSeg;
+}
+
+
 /**
  * Prepares the GSO frame for direct use without any segmenting.
  *
@@ -41,6 +41,7 @@
 
 #define PDM_NETSHAPER_MIN_BUCKET_SIZE UINT32_C(65536) /**< bytes */
 #define PDM_NETSHAPER_MAX_LATENCY     UINT32_C(100)   /**< milliseconds */
+#define PDM_NETSHAPER_MIN_QUANTUM     UINT32_C(1536)  /**< bytes, deficit round robin quantum floor */
 
 RT_C_DECLS_BEGIN
 
@@ -58,6 +59,9 @@ typedef struct PDMNSFILTER
     bool                                afPadding[HC_ARCH_BITS == 32 ? 3 : 7];
     /** The driver this filter is aggregated into (ring-3). */
     R3PTRTYPE(PPDMINETWORKDOWN)         pIDrvNetR3;
+    /** Deficit round robin counter: the number of bytes the filter may still
+     * transmit while its bandwidth group is congested. */
+    volatile int64_t                    cbDeficit;
 } PDMNSFILTER;
 
 /** Pointer to a PDM filter handle. */
@@ -70,6 +74,7 @@ VMMDECL(bool)       PDMNsAllocateBandwidth(PPDMNSFILTER pFilter, size_t cbTransf
 VMMR3_INT_DECL(int) PDMR3NsAttach(PUVM pUVM, PPDMDRVINS pDrvIns, const char *pcszBwGroup, PPDMNSFILTER pFilter);
 VMMR3_INT_DECL(int) PDMR3NsDetach(PUVM pUVM, PPDMDRVINS pDrvIns, PPDMNSFILTER pFilter);
 VMMR3DECL(int)      PDMR3NsBwGroupSetLimit(PUVM pUVM, const char *pszBwGroup, uint64_t cbPerSecMax);
+VMMR3DECL(int)      PDMR3NsBwGroupSetCeilAndBurst(PUVM pUVM, const char *pszBwGroup, uint64_t cbPerSecCeil, uint32_t cbBurst);
 
 /** @} */
 
@@ -692,10 +692,32 @@ typedef struct PDMIMEDIAEXPORT
     DECLR3CALLBACKMEMBER(void, pfnIoReqStateChanged, (PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
                                                       void *pvIoReqAlloc, PDMMEDIAEXIOREQSTATE enmState));
 
+    /**
+     * Queries the guest memory backing a read or write request as a S/G list so the
+     * callee can transfer the data directly without an intermediate buffer (optional).
+     *
+     * The segments must stay valid and locked until the completion of the request was
+     * notified with PDMIMEDIAEXPORT::pfnIoReqCompleteNotify and must describe the whole
+     * request. The callee falls back to the copy interfaces above if the call fails or
+     * the buffer is not suitably aligned.
+     *
+     * @returns VBox status code.
+     * @retval  VERR_NOT_SUPPORTED if the request can't be described by directly accessible
+     *          memory, the copy interfaces are used then.
+     * @param   pInterface      Pointer to the interface structure containing the called function pointer.
+     * @param   hIoReq          The I/O request handle.
+     * @param   pvIoReqAlloc    The allocator specific memory for this request.
+     * @param   ppaSeg          Where to store the pointer to the array of segments on success.
+     * @param   pcSegs          Where to store the number of segments on success.
+     * @thread  Any thread.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnIoReqQueryBuf, (PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                 void *pvIoReqAlloc, PCRTSGSEG *ppaSeg, unsigned *pcSegs));
+
 } PDMIMEDIAEXPORT;
 
 /** PDMIMEDIAAEXPORT interface ID. */
-#define PDMIMEDIAEXPORT_IID                  "779f38d0-bcaa-4a49-af2b-6f63edd4181a"
+#define PDMIMEDIAEXPORT_IID                  "2ad06e5a-5c3b-4d3e-a9cb-1e0d5a7ec7b3"
 
 
 /** Pointer to an extended media interface. */
@@ -0,0 +1,148 @@
+/** @file
+ * PDM - Pluggable Device Manager, Work Queues.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ *
+ * The contents of this file may alternatively be used under the terms
+ * of the Common Development and Distribution License Version 1.0
+ * (CDDL) only, as it comes in the "COPYING.CDDL" file of the
+ * VirtualBox OSE distribution, in which case the provisions of the
+ * CDDL are applicable instead of those of the GPL.
+ *
+ * You may elect to license modified versions of this file under the
+ * terms and conditions of either the GPL or the CDDL or both.
+ */
+
+#ifndef ___VBox_vmm_pdmworkqueue_h
+#define ___VBox_vmm_pdmworkqueue_h
+
+#include <VBox/cdefs.h>
+#include <VBox/types.h>
+
+RT_C_DECLS_BEGIN
+
+/** @defgroup grp_pdm_workqueue     The PDM Work Queues API
+ * @ingroup grp_pdm
+ *
+ * Work queues let devices and drivers run work (checksumming, DMA copies,
+ * mixing, ...) on a pool of worker threads shared by the whole VM instead of
+ * on an EMT or on a dedicated PDM thread.
+ *
+ * The items of one work queue are executed one at a time in the order they
+ * were posted.  Different queues run in parallel on different workers.  A
+ * device which wants to spread its work over several host CPUs should create
+ * several queues, e.g. one per virtual device queue.
+ *
+ * Each queue has a home worker (the affinity hint) it is normally run by.  An
+ * idle worker steals queues from busy workers.
+ *
+ * The workers are not suspended together with the VM, so the owner must wait
+ * for its queues to become idle (PDMR3WorkQueueWaitIdle) when it's suspended,
+ * reset or powered off if the work items touch guest state.
+ *
+ * @{
+ */
+
+/** Pointer to a PDM work queue. */
+typedef struct PDMWORKQUEUE *PPDMWORKQUEUE;
+/** Pointer to a PDM work queue pointer. */
+typedef PPDMWORKQUEUE *PPPDMWORKQUEUE;
+
+/**
+ * PDM work item core.
+ *
+ * This is embedded in the owner's own work item structure, there is no
+ * allocation involved when posting work.  The item belongs to PDM from the
+ * time it is posted till the callback is invoked.
+ */
+typedef struct PDMWORKITEM
+{
+    /** Pointer to the next item, used by PDM. */
+    R3PTRTYPE(struct PDMWORKITEM *) volatile    pNext;
+} PDMWORKITEM;
+/** Pointer to a PDM work item core. */
+typedef PDMWORKITEM *PPDMWORKITEM;
+
+/**
+ * Work queue priorities.
+ *
+ * Workers pick up ready queues of higher priority first.
+ */
+typedef enum PDMWORKPRIO
+{
+    /** The usual invalid zero entry. */
+    PDMWORKPRIO_INVALID = 0,
+    /** Background work. */
+    PDMWORKPRIO_LOW,
+    /** Normal work. */
+    PDMWORKPRIO_NORMAL,
+    /** Latency sensitive work. */
+    PDMWORKPRIO_HIGH,
+    /** End of valid priorities. */
+    PDMWORKPRIO_END,
+    /** The usual 32-bit hack. */
+    PDMWORKPRIO_32BIT_HACK = 0x7fffffff
+} PDMWORKPRIO;
+
+/** Affinity hint for work queues without a preferred worker. */
+#define PDMWORKQUEUE_AFFINITY_ANY       UINT32_MAX
+
+/**
+ * Work item callback for devices.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pItem       The work item.  The callback may free or repost it.
+ * @remarks The device critical section is NOT entered by PDM.
+ * @thread  A PDM worker thread.
+ */
+typedef DECLCALLBACK(void) FNPDMWORKDEV(PPDMDEVINS pDevIns, PPDMWORKITEM pItem);
+/** Pointer to a FNPDMWORKDEV(). */
+typedef FNPDMWORKDEV *PFNPDMWORKDEV;
+
+/**
+ * Work item callback for drivers.
+ *
+ * @param   pDrvIns     The driver instance.
+ * @param   pItem       The work item.  The callback may free or repost it.
+ * @thread  A PDM worker thread.
+ */
+typedef DECLCALLBACK(void) FNPDMWORKDRV(PPDMDRVINS pDrvIns, PPDMWORKITEM pItem);
+/** Pointer to a FNPDMWORKDRV(). */
+typedef FNPDMWORKDRV *PFNPDMWORKDRV;
+
+/**
+ * Work item callback for internal users.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pItem       The work item.  The callback may free or repost it.
+ * @thread  A PDM worker thread.
+ */
+typedef DECLCALLBACK(void) FNPDMWORKINT(PVM pVM, PPDMWORKITEM pItem);
+/** Pointer to a FNPDMWORKINT(). */
+typedef FNPDMWORKINT *PFNPDMWORKINT;
+
+#ifdef IN_RING3
+VMMR3DECL(int)      PDMR3WorkQueueCreateInternal(PVM pVM, PDMWORKPRIO enmPrio, uint32_t iAffinity, PFNPDMWORKINT pfnCallback,
+                                                 const char *pszName, PPDMWORKQUEUE *ppQueue);
+VMMR3DECL(int)      PDMR3WorkQueueDestroy(PPDMWORKQUEUE pQueue);
+VMMR3DECL(int)      PDMR3WorkQueuePost(PPDMWORKQUEUE pQueue, PPDMWORKITEM pItem);
+VMMR3DECL(int)      PDMR3WorkQueueWaitIdle(PPDMWORKQUEUE pQueue, RTMSINTERVAL cMillies);
+VMMR3DECL(bool)     PDMR3WorkQueueIsIdle(PPDMWORKQUEUE pQueue);
+#endif /* IN_RING3 */
+
+/** @} */
+
+RT_C_DECLS_END
+
+#endif
+
@@ -1093,7 +1093,7 @@ typedef struct VM
 #ifdef ___PGMInternal_h
         struct PGM  s;
 #endif
-        uint8_t     padding[4096*2+6080];      /* multiple of 64 */
+        uint8_t     padding[4096*8+6080];      /* multiple of 64 */
     } pgm;
 
     /** HM part. */
@@ -1174,7 +1174,7 @@ typedef struct VM
 #ifdef ___EMInternal_h
         struct EM   s;
 #endif
-        uint8_t     padding[256];       /* multiple of 64 */
+        uint8_t     padding[320];       /* multiple of 64 */
     } em;
 
     /** TM part. */
@@ -1183,7 +1183,7 @@ typedef struct VM
 #ifdef ___TMInternal_h
         struct TM   s;
 #endif
-        uint8_t     padding[2496];      /* multiple of 64 */
+        uint8_t     padding[2624];      /* multiple of 64 */
     } tm;
 
     /** DBGF part. */
@@ -1282,9 +1282,9 @@ typedef struct VM
 
     /** Padding for aligning the cpu array on a page boundary. */
 #ifdef VBOX_WITH_NEW_APIC
-    uint8_t         abAlignment2[3870];
+    uint8_t         abAlignment2[3678];
 #else
-    uint8_t         abAlignment2[3998];
+    uint8_t         abAlignment2[3806];
 #endif
 
     /* ---- end small stuff ---- */
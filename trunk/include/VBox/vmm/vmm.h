@@ -430,6 +430,8 @@ typedef enum VMMR0OPERATION
     VMMR0_DO_GMM_MAP_UNMAP_CHUNK,
     /** Call GMMR0SeedChunk(). */
     VMMR0_DO_GMM_SEED_CHUNK,
+    /** Call GMMR0SetNumaNode(). */
+    VMMR0_DO_GMM_SET_NUMA_NODE,
     /** Call GMMR0RegisterSharedModule. */
     VMMR0_DO_GMM_REGISTER_SHARED_MODULE,
     /** Call GMMR0UnregisterSharedModule. */
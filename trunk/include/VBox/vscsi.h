@@ -168,6 +168,20 @@ typedef struct VSCSILUNIOCALLBACKS
      */
     DECLR3CALLBACKMEMBER(int, pfnVScsiLunGetFeatureFlags,(VSCSILUN hVScsiLun, void *pvScsiLunUser, uint64_t *pfFeatures));
 
+    /**
+     * Retrieve the UUID of the underlying medium, optional.
+     *
+     * The UUID is used to build a designator for the LUN which is required to make
+     * use of the EXTENDED COPY command.
+     *
+     * @returns VBox status status code.
+     * @param   hVScsiLun       Virtual SCSI LUN handle.
+     * @param   pvScsiLunUser   Opaque user data which may be used to identify the
+     *                          medium.
+     * @param   pUuid           Where to store the UUID of the medium.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnVScsiLunMediumGetUuid,(VSCSILUN hVScsiLun, void *pvScsiLunUser, PRTUUID pUuid));
+
 } VSCSILUNIOCALLBACKS;
 /** Pointer to a virtual SCSI LUN I/O callback table. */
 typedef VSCSILUNIOCALLBACKS *PVSCSILUNIOCALLBACKS;
@@ -125,6 +125,20 @@
 #define E1K_WITH_RXD_CACHE
 /* End of Options ************************************************************/
 
+/** @name Adaptive RX interrupt moderation parameters.
+ * The packet rate thresholds separate the latency classes in the same way the
+ * Intel drivers pick an ITR value (lowest latency, low latency, bulk).
+ * @{ */
+/** Below this rate (packets/sec) RX interrupts are never delayed. */
+#define E1K_RXIM_LOWEST_LATENCY_PPS     UINT32_C(10000)
+/** Below this rate (packets/sec) RX interrupts are at most this far apart. */
+#define E1K_RXIM_LOW_LATENCY_PPS        UINT32_C(50000)
+/** The interrupt interval for the low latency class (nanoseconds, 20000 int/s). */
+#define E1K_RXIM_LOW_LATENCY_NS         UINT32_C(50000)
+/** The default interrupt interval for the bulk class (microseconds, 4000 int/s). */
+#define E1K_RXIM_BULK_DEFAULT_US        UINT32_C(250)
+/** @} */
+
 #ifdef E1K_WITH_TXD_CACHE
 /**
  * E1K_TXD_CACHE_SIZE specifies the maximum number of TX descriptors stored
@@ -323,6 +337,7 @@ static const struct E1kChips
 #define ICR_TXQE            UINT32_C(0x00000002)
 #define ICR_LSC             UINT32_C(0x00000004)
 #define ICR_RXDMT0          UINT32_C(0x00000010)
+#define ICR_RXO             UINT32_C(0x00000040)
 #define ICR_RXT0            UINT32_C(0x00000080)
 #define ICR_TXD_LOW         UINT32_C(0x00008000)
 #define RDTR_FPD            UINT32_C(0x80000000)
@@ -1026,6 +1041,8 @@ struct E1kState_st
     PTMTIMERR3              pLUTimerR3;               /**< Link Up(/Restore) Timer. */
     /** The scatter / gather buffer used for the current outgoing packet - R3. */
     R3PTRTYPE(PPDMSCATTERGATHER) pTxSgR3;
+    /** The direct transmit scatter / gather buffer, NULL if disabled - R3. */
+    R3PTRTYPE(struct E1KTXSG *) pTxSgDirectR3;
 
     PPDMDEVINSR0            pDevInsR0;                   /**< Device instance - R0. */
     R0PTRTYPE(PPDMQUEUE)    pTxQueueR0;                   /**< Transmit queue - R0. */
@@ -1074,6 +1091,19 @@ struct E1kState_st
     PCIDEVICE   pciDevice;
     /** EMT: Last time the interrupt was acknowledged.  */
     uint64_t    u64AckedAt;
+    /** All: Last time an interrupt with RXT0 pending was raised. */
+    uint64_t    u64RxIntAt;
+    /** All: Number of packets received since u64RxIntAt. */
+    uint32_t    cRxIntModPkts;
+    /** All: Smoothed RX packet rate (packets per second). */
+    uint32_t    uRxIntModRate;
+    /** All: Current minimum interval between RX interrupts (nanoseconds). */
+    uint32_t    cNsRxIntModItr;
+    /** Config: Interrupt interval for bulk traffic (nanoseconds). */
+    uint32_t    cNsRxIntModMax;
+    /** Config: Whether adaptive RX interrupt moderation is enabled. */
+    bool        fRxIntMod;
+    bool        afAlignmentRxIntMod[7];
     /** All: Used for eliminating spurious interrupts. */
     bool        fIntRaised;
     /** EMT: false if the cable is disconnected by the GUI. */
@@ -1140,8 +1170,8 @@ struct E1kState_st
     uint8_t     iTxDCurrent;
     /** TX: Will this frame be sent as GSO. */
     bool        fGSO;
-    /** Alignment padding. */
-    bool        fReserved;
+    /** TX: Whether GSO frames may be passed on referencing guest memory. */
+    bool        fTxSgDirect;
     /** TX: Number of bytes in next packet. */
     uint32_t    cbTxAlloc;
 
@@ -1193,6 +1223,16 @@ struct E1kState_st
 
     STAMCOUNTER                         StatReceiveBytes;
     STAMCOUNTER                         StatTransmitBytes;
+    /** Number of packets passed to the RX interrupt moderation. */
+    STAMCOUNTER                         StatRxIntModPackets;
+    /** Number of interrupts raised with RXT0 pending. */
+    STAMCOUNTER                         StatRxIntModInts;
+    /** Number of RX interrupts deferred by the moderation. */
+    STAMCOUNTER                         StatRxIntModDeferred;
+    /** Number of frames sent referencing guest memory. */
+    STAMCOUNTER                         StatTxSgDirect;
+    /** Number of direct frames which had to be copied after all. */
+    STAMCOUNTER                         StatTxSgCopied;
 #if defined(VBOX_WITH_STATISTICS)
     STAMPROFILEADV                      StatMMIOReadRZ;
     STAMPROFILEADV                      StatMMIOReadR3;
@@ -1285,6 +1325,7 @@ typedef E1KSTATE *PE1KSTATE;
 
 /* Forward declarations ******************************************************/
 static int e1kXmitPending(PE1KSTATE pThis, bool fOnWorkerThread);
+static void e1kDescReport(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr);
 
 static int e1kRegReadUnimplemented (PE1KSTATE pThis, uint32_t offset, uint32_t index, uint32_t *pu32Value);
 static int e1kRegWriteUnimplemented(PE1KSTATE pThis, uint32_t offset, uint32_t index, uint32_t u32Value);
@@ -1645,6 +1686,10 @@ static void e1kHardReset(PE1KSTATE pThis)
         e1kCsRxLeave(pThis);
     }
 #endif /* E1K_WITH_RXD_CACHE */
+    pThis->u64RxIntAt     = 0;
+    pThis->cRxIntModPkts  = 0;
+    pThis->uRxIntModRate  = 0;
+    pThis->cNsRxIntModItr = 0;
 }
 
 #endif /* IN_RING3 */
@@ -1863,6 +1908,41 @@ static void e1kPrintTDesc(PE1KSTATE pThis, E1KTXDESC* pDesc, const char* cszDir,
     }
 }
 
+/**
+ * Re-evaluates the RX interrupt interval when an interrupt with RXT0 pending
+ * is raised.
+ *
+ * The packet rate over the interval since the previous RX interrupt is
+ * smoothed and mapped to a latency class: low rates get their interrupts
+ * immediately, bulk traffic gets them every cNsRxIntModMax nanoseconds.
+ *
+ * @param   pThis       The device state structure.
+ * @remarks Caller holds the device critical section.
+ */
+static void e1kRxIntModUpdate(PE1KSTATE pThis)
+{
+    uint64_t const u64Now = TMTimerGet(pThis->CTX_SUFF(pIntTimer));
+    uint64_t const cNs    = TMTimerToNano(pThis->CTX_SUFF(pIntTimer), u64Now - pThis->u64RxIntAt);
+    STAM_REL_COUNTER_INC(&pThis->StatRxIntModInts);
+
+    if (pThis->fRxIntMod && cNs)
+    {
+        uint64_t uRate = (uint64_t)pThis->cRxIntModPkts * RT_NS_1SEC / RT_MAX(cNs, RT_NS_1US);
+        uRate = (3 * (uint64_t)pThis->uRxIntModRate + RT_MIN(uRate, UINT32_MAX)) / 4;
+        pThis->uRxIntModRate = (uint32_t)uRate;
+        if (uRate < E1K_RXIM_LOWEST_LATENCY_PPS)
+            pThis->cNsRxIntModItr = 0;
+        else if (uRate < E1K_RXIM_LOW_LATENCY_PPS)
+            pThis->cNsRxIntModItr = RT_MIN(E1K_RXIM_LOW_LATENCY_NS, pThis->cNsRxIntModMax);
+        else
+            pThis->cNsRxIntModItr = pThis->cNsRxIntModMax;
+        E1kLog2(("%s e1kRxIntModUpdate: %u pkts in %llu ns, rate=%u pps, itr=%u ns\n",
+                 pThis->szPrf, pThis->cRxIntModPkts, cNs, pThis->uRxIntModRate, pThis->cNsRxIntModItr));
+    }
+    pThis->u64RxIntAt    = u64Now;
+    pThis->cRxIntModPkts = 0;
+}
+
 /**
  * Raise interrupt if not masked.
  *
@@ -1925,6 +2005,8 @@ static int e1kRaiseInterrupt(PE1KSTATE pThis, int rcBusy, uint32_t u32IntCause =
                  * there is no need to do it later -- stop the timer.
                  */
                 TMTimerStop(pThis->CTX_SUFF(pIntTimer));
+                if (ICR & ICR_RXT0)
+                    e1kRxIntModUpdate(pThis);
                 E1K_INC_ISTAT_CNT(pThis->uStatInt);
                 STAM_COUNTER_INC(&pThis->StatIntsRaised);
                 /* Got at least one unmasked interrupt cause */
@@ -1947,6 +2029,54 @@ static int e1kRaiseInterrupt(PE1KSTATE pThis, int rcBusy, uint32_t u32IntCause =
     return VINF_SUCCESS;
 }
 
+/**
+ * Signals the guest that a packet was stored in the RX ring (RXT0).
+ *
+ * With adaptive RX interrupt moderation enabled the interrupt is deferred
+ * using the late interrupt timer if the previous RX interrupt was raised less
+ * than the current interval ago.  ICR.RXT0 is set right away, so drivers
+ * polling the ring or ICR are not affected, only the interrupt line is
+ * asserted later.  The moderation never delays interrupts if the guest is
+ * about to run out of RX descriptors.  A non-zero ITR programmed by the guest
+ * is honoured as the minimum interval.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The device state structure.
+ */
+static int e1kRxRaiseInterrupt(PE1KSTATE pThis)
+{
+    E1K_INC_ISTAT_CNT(pThis->uStatIntRx);
+    int rc = e1kCsEnter(pThis, VERR_SEM_BUSY);
+    if (RT_UNLIKELY(rc != VINF_SUCCESS))
+        return rc;
+
+    pThis->cRxIntModPkts++;
+    STAM_REL_COUNTER_INC(&pThis->StatRxIntModPackets);
+
+    uint32_t cNsItr = pThis->fRxIntMod ? pThis->cNsRxIntModItr : 0;
+    if (pThis->fRxIntMod && ITR)
+        cNsItr = RT_MAX(cNsItr, ITR * 256);
+
+    PTMTIMER pTimer = pThis->CTX_SUFF(pIntTimer);
+    uint64_t const u64Due = pThis->u64RxIntAt + TMTimerFromNano(pTimer, cNsItr);
+    if (   !cNsItr
+        || pThis->fIntRaised
+        || (ICR & (ICR_RXDMT0 | ICR_RXO))
+        || TMTimerGet(pTimer) >= u64Due)
+        rc = e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
+    else
+    {
+        ICR |= ICR_RXT0;
+        if (!TMTimerIsActive(pTimer))
+            TMTimerSet(pTimer, u64Due);
+        STAM_REL_COUNTER_INC(&pThis->StatRxIntModDeferred);
+        E1kLog2(("%s e1kRxRaiseInterrupt: deferred by up to %u ns\n", pThis->szPrf, cNsItr));
+    }
+
+    e1kCsLeave(pThis);
+    return rc;
+}
+
 /**
  * Compute the physical address of the descriptor.
  *
@@ -2203,9 +2333,8 @@ static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc,
         else
         {
 #endif
-            /* 0 delay means immediate interrupt */
-            E1K_INC_ISTAT_CNT(pThis->uStatIntRx);
-            e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
+            /* 0 delay means immediate interrupt (unless moderated) */
+            e1kRxRaiseInterrupt(pThis);
 #ifdef E1K_USE_RX_TIMERS
         }
 #endif
@@ -2492,9 +2621,8 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     else
     {
 # endif /* E1K_USE_RX_TIMERS */
-        /* 0 delay means immediate interrupt */
-        E1K_INC_ISTAT_CNT(pThis->uStatIntRx);
-        e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
+        /* 0 delay means immediate interrupt (unless moderated) */
+        e1kRxRaiseInterrupt(pThis);
 # ifdef E1K_USE_RX_TIMERS
     }
 # endif /* E1K_USE_RX_TIMERS */
@@ -3530,6 +3658,248 @@ DECLINLINE(bool) e1kCanDoGso(PE1KSTATE pThis, PCPDMNETWORKGSO pGso, E1KTXDAT con
     }
 }
 
+#if defined(IN_RING3) && defined(E1K_WITH_TXD_CACHE)
+/** The max number of segments in a direct transmit scatter / gather buffer.
+ * The first one holds the headers, the rest reference guest pages. */
+# define E1K_TXSG_MAX_SEGS      64
+
+/**
+ * Direct transmit scatter / gather buffer (ring-3 only).
+ *
+ * Used for GSO frames when the attached driver implements
+ * PDMINETWORKUP::pfnSendSg.  The headers are copied into abHdrs, the payload
+ * is passed on in place, referencing guest pages which stay locked until the
+ * frame has been sent.  Since the guest may reuse a buffer as soon as its
+ * descriptor is done, the write-back of the frame's descriptors is deferred
+ * until then as well.
+ */
+typedef struct E1KTXSG
+{
+    /** Number of page mapping locks in aLocks. */
+    uint32_t            cLocks;
+    /** Number of descriptors in aiDeferred. */
+    uint32_t            cDeferred;
+    /** The page mapping locks. */
+    PGMPAGEMAPLOCK      aLocks[E1K_TXSG_MAX_SEGS];
+    /** Guest addresses of the descriptors awaiting write-back. */
+    RTGCPHYS            aDeferredAddr[E1K_TXD_CACHE_SIZE];
+    /** Indexes into E1KSTATE::aTxDescriptors of the descriptors awaiting
+     * write-back. */
+    uint8_t             aiDeferred[E1K_TXD_CACHE_SIZE];
+    /** Copy of the frame headers, the first segment. */
+    uint8_t             abHdrs[256];
+    /** The GSO context of the frame. */
+    PDMNETWORKGSO       Gso;
+    /** The scatter / gather buffer. */
+    union
+    {
+        PDMSCATTERGATHER    Sg;
+        uint8_t             abPadding[RT_OFFSETOF(PDMSCATTERGATHER, aSegs[E1K_TXSG_MAX_SEGS])];
+    } u;
+} E1KTXSG;
+/** Pointer to a direct transmit scatter / gather buffer. */
+typedef E1KTXSG *PE1KTXSG;
+
+/**
+ * Checks if the given buffer is the direct transmit scatter / gather buffer.
+ *
+ * @returns true / false.
+ * @param   pThis               The device state structure.
+ * @param   pSg                 The scatter / gather buffer.
+ */
+DECLINLINE(bool) e1kR3XmitIsDirectSg(PE1KSTATE pThis, PDMSCATTERGATHER const *pSg)
+{
+    return pSg
+        && pThis->pTxSgDirectR3
+        && pSg == &pThis->pTxSgDirectR3->u.Sg;
+}
+
+/**
+ * Sets up the direct transmit scatter / gather buffer for a GSO frame.
+ *
+ * @param   pThis               The device state structure.
+ */
+static void e1kR3XmitDirectStart(PE1KSTATE pThis)
+{
+    PE1KTXSG pTxSg = pThis->pTxSgDirectR3;
+    Assert(pTxSg->cLocks == 0 && pTxSg->cDeferred == 0);
+
+    pTxSg->Gso = pThis->GsoCtx;
+    PPDMSCATTERGATHER pSg = &pTxSg->u.Sg;
+    pSg->fFlags           = PDMSCATTERGATHER_FLAGS_MAGIC | PDMSCATTERGATHER_FLAGS_OWNER_1;
+    pSg->cbUsed           = 0;
+    pSg->cbAvailable      = pThis->cbTxAlloc;
+    pSg->pvAllocator      = pTxSg;
+    pSg->pvUser           = &pTxSg->Gso;
+    pSg->cSegs            = 1;
+    pSg->aSegs[0].pvSeg   = pTxSg->abHdrs;
+    pSg->aSegs[0].cbSeg   = 0;
+
+    pThis->pTxSgR3 = pSg;
+}
+
+/**
+ * Releases the guest pages referenced by the direct transmit buffer and
+ * writes back the descriptors that were deferred.
+ *
+ * @param   pThis               The device state structure.
+ */
+static void e1kR3XmitDirectRelease(PE1KSTATE pThis)
+{
+    PE1KTXSG   pTxSg   = pThis->pTxSgDirectR3;
+    PPDMDEVINS pDevIns = pThis->pDevInsR3;
+
+    for (uint32_t i = 0; i < pTxSg->cLocks; i++)
+        PDMDevHlpPhysReleasePageMappingLock(pDevIns, &pTxSg->aLocks[i]);
+    pTxSg->cLocks = 0;
+    pTxSg->u.Sg.fFlags = 0;
+
+    for (uint32_t i = 0; i < pTxSg->cDeferred; i++)
+        e1kDescReport(pThis, &pThis->aTxDescriptors[pTxSg->aiDeferred[i]], pTxSg->aDeferredAddr[i]);
+    pTxSg->cDeferred = 0;
+}
+
+/**
+ * Copies the frame in the direct transmit buffer into a buffer from the
+ * driver.
+ *
+ * This is used when we run out of segments, when guest memory cannot be
+ * mapped, or when the driver refuses to send the frame from the direct buffer.
+ * The direct buffer is released and the new one (or NULL on failure) becomes
+ * the current transmit buffer.
+ *
+ * @returns VBox status code.
+ * @param   pThis               The device state structure.
+ */
+static int e1kR3XmitDirectCopy(PE1KSTATE pThis)
+{
+    PE1KTXSG            pTxSg = pThis->pTxSgDirectR3;
+    PPDMSCATTERGATHER   pSg   = &pTxSg->u.Sg;
+    PPDMSCATTERGATHER   pSgNew;
+    PPDMINETWORKUP      pDrv  = pThis->pDrvR3;
+    Assert(pThis->pTxSgR3 == pSg);
+
+    int rc = pDrv ? pDrv->pfnAllocBuf(pDrv, pSg->cbAvailable, &pTxSg->Gso, &pSgNew) : VERR_NET_DOWN;
+    if (RT_SUCCESS(rc))
+    {
+        Assert(pSgNew->cSegs == 1);
+        uint8_t *pbDst = (uint8_t *)pSgNew->aSegs[0].pvSeg;
+        for (size_t i = 0; i < pSg->cSegs; i++)
+        {
+            memcpy(pbDst, pSg->aSegs[i].pvSeg, pSg->aSegs[i].cbSeg);
+            pbDst += pSg->aSegs[i].cbSeg;
+        }
+        pSgNew->cbUsed = pSg->cbUsed;
+        STAM_REL_COUNTER_INC(&pThis->StatTxSgCopied);
+    }
+    else
+    {
+        E1kLog(("%s e1kR3XmitDirectCopy: pfnAllocBuf failed: %Rrc\n", pThis->szPrf, rc));
+        pSgNew = NULL;
+    }
+
+    e1kR3XmitDirectRelease(pThis);
+    pThis->pTxSgR3 = pSgNew;
+    return rc;
+}
+
+/**
+ * Adds a descriptor's buffer to the direct transmit buffer.
+ *
+ * The headers are copied, everything else is mapped.  Falls back on copying
+ * when the guest memory cannot be mapped or we run out of segments.
+ *
+ * @param   pThis               The device state structure.
+ * @param   PhysAddr            The physical address of the descriptor buffer.
+ * @param   cbFragment          Length of descriptor's buffer.
+ */
+static void e1kR3XmitDirectAdd(PE1KSTATE pThis, RTGCPHYS PhysAddr, uint32_t cbFragment)
+{
+    PE1KTXSG            pTxSg   = pThis->pTxSgDirectR3;
+    PPDMSCATTERGATHER   pSg     = &pTxSg->u.Sg;
+    PPDMDEVINS          pDevIns = pThis->pDevInsR3;
+    uint32_t const      cbHdrs  = pTxSg->Gso.cbHdrsTotal;
+    AssertCompile(sizeof(pTxSg->abHdrs) > UINT8_MAX);
+
+    if (pSg->cbUsed < cbHdrs)
+    {
+        uint32_t cbToCopy = RT_MIN(cbHdrs - (uint32_t)pSg->cbUsed, cbFragment);
+        PDMDevHlpPhysRead(pDevIns, PhysAddr, &pTxSg->abHdrs[pSg->cbUsed], cbToCopy);
+        pSg->aSegs[0].cbSeg += cbToCopy;
+        pSg->cbUsed         += cbToCopy;
+        PhysAddr            += cbToCopy;
+        cbFragment          -= cbToCopy;
+    }
+
+    while (cbFragment > 0)
+    {
+        uint32_t const cbPage = PAGE_SIZE - (uint32_t)(PhysAddr & PAGE_OFFSET_MASK);
+        uint32_t const cbThis = RT_MIN(cbFragment, cbPage);
+        void const    *pv;
+        int rc = VERR_BUFFER_OVERFLOW;
+        if (pSg->cSegs < E1K_TXSG_MAX_SEGS)
+            rc = PDMDevHlpPhysGCPhys2CCPtrReadOnly(pDevIns, PhysAddr, 0, &pv, &pTxSg->aLocks[pTxSg->cLocks]);
+        if (RT_FAILURE(rc))
+        {
+            E1kLog(("%s e1kR3XmitDirectAdd: falling back on copying at %RGp: %Rrc\n", pThis->szPrf, PhysAddr, rc));
+            if (RT_SUCCESS(e1kR3XmitDirectCopy(pThis)))
+            {
+                pSg = pThis->pTxSgR3;
+                PDMDevHlpPhysRead(pDevIns, PhysAddr, (uint8_t *)pSg->aSegs[0].pvSeg + pSg->cbUsed, cbFragment);
+                pSg->cbUsed += cbFragment;
+            }
+            return;
+        }
+        pTxSg->cLocks++;
+
+        pSg->aSegs[pSg->cSegs].pvSeg = (void *)pv;
+        pSg->aSegs[pSg->cSegs].cbSeg = cbThis;
+        pSg->cSegs++;
+        pSg->cbUsed += cbThis;
+        PhysAddr    += cbThis;
+        cbFragment  -= cbThis;
+    }
+}
+
+/**
+ * Sends the frame in the direct transmit buffer.
+ *
+ * @returns VBox status code.
+ * @param   pThis               The device state structure.
+ * @param   fOnWorkerThread     Whether we're on a worker thread or an EMT.
+ */
+static int e1kR3XmitDirectSend(PE1KSTATE pThis, bool fOnWorkerThread)
+{
+    PPDMSCATTERGATHER   pSg  = pThis->pTxSgR3;
+    PPDMINETWORKUP      pDrv = pThis->pDrvR3;
+    int                 rc   = VERR_NET_DOWN;
+    Assert(e1kR3XmitIsDirectSg(pThis, pSg));
+
+    if (pDrv && pDrv->pfnSendSg)
+    {
+        STAM_PROFILE_START(&pThis->StatTransmitSendR3, a);
+        rc = pDrv->pfnSendSg(pDrv, pSg, fOnWorkerThread);
+        STAM_PROFILE_STOP(&pThis->StatTransmitSendR3, a);
+        if (rc == VERR_NOT_SUPPORTED)
+        {
+            rc = e1kR3XmitDirectCopy(pThis);
+            if (RT_SUCCESS(rc))
+            {
+                pSg = pThis->pTxSgR3;
+                pThis->pTxSgR3 = NULL;
+                rc = pDrv->pfnSendBuf(pDrv, pSg, fOnWorkerThread);
+            }
+            return rc;
+        }
+        STAM_REL_COUNTER_INC(&pThis->StatTxSgDirect);
+    }
+
+    pThis->pTxSgR3 = NULL;
+    e1kR3XmitDirectRelease(pThis);
+    return rc;
+}
+#endif /* IN_RING3 && E1K_WITH_TXD_CACHE */
+
 /**
  * Frees the current xmit buffer.
  *
@@ -3542,6 +3912,11 @@ static void e1kXmitFreeBuf(PE1KSTATE pThis)
     {
         pThis->CTX_SUFF(pTxSg) = NULL;
 
+#if defined(IN_RING3) && defined(E1K_WITH_TXD_CACHE)
+        if (e1kR3XmitIsDirectSg(pThis, pSg))
+            e1kR3XmitDirectRelease(pThis);
+        else
+#endif
         if (pSg->pvAllocator != pThis)
         {
             PPDMINETWORKUP pDrv = pThis->CTX_SUFF(pDrv);
@@ -3649,6 +4024,23 @@ DECLINLINE(int) e1kXmitAllocBuf(PE1KSTATE pThis, bool fGso)
         PPDMINETWORKUP pDrv = pThis->CTX_SUFF(pDrv);
         if (RT_UNLIKELY(!pDrv))
             return VERR_NET_DOWN;
+#ifdef IN_RING3
+        /*
+         * Pass GSO frames on without copying the payload if the driver can
+         * deal with that.  VLAN tags are inserted into the frame, so those
+         * have to be copied.
+         */
+        if (   fGso
+            && pThis->pTxSgDirectR3
+            && pDrv->pfnSendSg
+            && !pThis->fVTag)
+        {
+            e1kR3XmitDirectStart(pThis);
+            E1kLog3(("%s Using direct buffer for TX packet: cb=%u\n", pThis->szPrf, pThis->cbTxAlloc));
+            pThis->cbTxAlloc = 0;
+            return VINF_SUCCESS;
+        }
+#endif
         int rc = pDrv->pfnAllocBuf(pDrv, pThis->cbTxAlloc, fGso ? &pThis->GsoCtx : NULL, &pSg);
         if (RT_FAILURE(rc))
         {
@@ -3809,7 +4201,12 @@ static void e1kTransmitFrame(PE1KSTATE pThis, bool fOnWorkerThread)
 {
     PPDMSCATTERGATHER   pSg     = pThis->CTX_SUFF(pTxSg);
     uint32_t            cbFrame = pSg ? (uint32_t)pSg->cbUsed : 0;
+#if defined(IN_RING3) && defined(E1K_WITH_TXD_CACHE)
+    bool const          fDirect = e1kR3XmitIsDirectSg(pThis, pSg);
+    Assert(!pSg || pSg->cSegs == 1 || fDirect);
+#else
     Assert(!pSg || pSg->cSegs == 1);
+#endif
 
     if (cbFrame > 70) /* unqualified guess */
         pThis->led.Asserted.s.fWriting = pThis->led.Actual.s.fWriting = 1;
@@ -3883,6 +4280,15 @@ static void e1kTransmitFrame(PE1KSTATE pThis, bool fOnWorkerThread)
      * Dump and send the packet.
      */
     int rc = VERR_NET_DOWN;
+#if defined(IN_RING3) && defined(E1K_WITH_TXD_CACHE)
+    if (fDirect)
+    {
+        /* Only the headers are in the first segment. */
+        e1kPacketDump(pThis, (uint8_t const *)pSg->aSegs[0].pvSeg, pSg->aSegs[0].cbSeg, "--> Outgoing (direct)");
+        rc = e1kR3XmitDirectSend(pThis, fOnWorkerThread);
+    }
+    else
+#endif
     if (pSg && pSg->pvAllocator != pThis)
     {
         e1kPacketDump(pThis, (uint8_t const *)pSg->aSegs[0].pvSeg, cbFrame, "--> Outgoing");
@@ -4365,6 +4771,14 @@ static bool e1kAddToFrame(PE1KSTATE pThis, RTGCPHYS PhysAddr, uint32_t cbFragmen
         return false;
     }
 
+#if defined(IN_RING3) && defined(E1K_WITH_TXD_CACHE)
+    if (e1kR3XmitIsDirectSg(pThis, pTxSg))
+    {
+        Assert(pTxSg->cbUsed == pThis->u16TxPktLen);
+        e1kR3XmitDirectAdd(pThis, PhysAddr, cbFragment);
+    }
+    else
+#endif
     if (RT_LIKELY(pTxSg))
     {
         Assert(pTxSg->cSegs == 1);
@@ -4458,6 +4872,36 @@ static void e1kDescReport(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr)
     }
 }
 
+#ifdef E1K_WITH_TXD_CACHE
+/**
+ * Write back a data descriptor, deferring it while its buffer may still be
+ * referenced by the direct transmit buffer.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pDesc       Pointer to the descriptor in the TX descriptor cache.
+ * @param   addr        Physical address of the descriptor in guest memory.
+ * @thread  E1000_TX
+ */
+DECLINLINE(void) e1kXmitDescReport(PE1KSTATE pThis, E1KTXDESC *pDesc, RTGCPHYS addr)
+{
+# ifdef IN_RING3
+    if (e1kR3XmitIsDirectSg(pThis, pThis->pTxSgR3))
+    {
+        PE1KTXSG pTxSg = pThis->pTxSgDirectR3;
+        Assert(pTxSg->cDeferred < RT_ELEMENTS(pTxSg->aiDeferred));
+        if (RT_LIKELY(pTxSg->cDeferred < RT_ELEMENTS(pTxSg->aiDeferred)))
+        {
+            pTxSg->aiDeferred[pTxSg->cDeferred]    = (uint8_t)(pDesc - &pThis->aTxDescriptors[0]);
+            pTxSg->aDeferredAddr[pTxSg->cDeferred] = addr;
+            pTxSg->cDeferred++;
+            return;
+        }
+    }
+# endif
+    e1kDescReport(pThis, pDesc, addr);
+}
+#endif /* E1K_WITH_TXD_CACHE */
+
 #ifndef E1K_WITH_TXD_CACHE
 
 /**
@@ -4828,7 +5272,7 @@ static int e1kXmitDesc(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr,
                     rc = e1kFallbackAddToFrame(pThis, pDesc, fOnWorkerThread);
                 }
             }
-            e1kDescReport(pThis, pDesc, addr);
+            e1kXmitDescReport(pThis, pDesc, addr);
             STAM_PROFILE_ADV_STOP(&pThis->CTX_SUFF_Z(StatTransmit), a);
             break;
         }
@@ -6819,6 +7263,13 @@ static DECLCALLBACK(int) e1kLoadDone(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
     {
         e1kR3LinkDownTemp(pThis);
     }
+
+    /* The late interrupt timer isn't saved, re-arm it in case an interrupt
+       was deferred by the RX interrupt moderation when the state was saved. */
+    if (   pThis->fRxIntMod
+        && (ICR & IMS)
+        && !pThis->fIntRaised)
+        e1kArmTimer(pThis, pThis->CTX_SUFF(pIntTimer), pThis->cNsRxIntModMax / RT_NS_1US);
     return VINF_SUCCESS;
 }
 
@@ -7336,6 +7787,11 @@ static DECLCALLBACK(int) e1kR3Destruct(PPDMDEVINS pDevIns)
         PDMR3CritSectDelete(&pThis->csRx);
         PDMR3CritSectDelete(&pThis->cs);
     }
+    if (pThis->pTxSgDirectR3)
+    {
+        PDMDevHlpMMHeapFree(pDevIns, pThis->pTxSgDirectR3);
+        pThis->pTxSgDirectR3 = NULL;
+    }
     return VINF_SUCCESS;
 }
 
@@ -7472,7 +7928,8 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
      */
     if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "AdapterType\0"
                                     "LineSpeed\0" "GCEnabled\0" "R0Enabled\0"
-                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"))
+                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"
+                                    "RxIntModeration\0" "RxIntModerationMaxDelay\0" "TxSgDirect\0"))
         return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
                                 N_("Invalid configuration for E1000 device"));
 
@@ -7527,6 +7984,43 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     else if (pThis->cMsLinkUpDelay == 0)
         LogRel(("%s WARNING! Link up delay is disabled!\n", pThis->szPrf));
 
+    /** @cfgm{/Devices/e1000/X/Config/RxIntModeration, bool, true}
+     * Whether to coalesce RX interrupts depending on the packet rate. */
+    rc = CFGMR3QueryBoolDef(pCfg, "RxIntModeration", &pThis->fRxIntMod, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'RxIntModeration'"));
+    /** @cfgm{/Devices/e1000/X/Config/RxIntModerationMaxDelay, uint32_t, 250}
+     * The interval between RX interrupts for bulk traffic in microseconds. */
+    uint32_t cUsRxIntModMax;
+    rc = CFGMR3QueryU32Def(pCfg, "RxIntModerationMaxDelay", &cUsRxIntModMax, E1K_RXIM_BULK_DEFAULT_US);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'RxIntModerationMaxDelay'"));
+    if (cUsRxIntModMax > 10000)
+        return PDMDEV_SET_ERROR(pDevIns, VERR_OUT_OF_RANGE,
+                                N_("Configuration error: 'RxIntModerationMaxDelay' must not exceed 10000 us"));
+    pThis->cNsRxIntModMax = cUsRxIntModMax * RT_NS_1US;
+    if (!pThis->cNsRxIntModMax)
+        pThis->fRxIntMod = false;
+
+#ifdef E1K_WITH_TXD_CACHE
+    /** @cfgm{/Devices/e1000/X/Config/TxSgDirect, bool, true}
+     * Whether to pass GSO frames to drivers implementing
+     * PDMINETWORKUP::pfnSendSg while referencing the payload in guest memory,
+     * instead of copying it. */
+    rc = CFGMR3QueryBoolDef(pCfg, "TxSgDirect", &pThis->fTxSgDirect, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'TxSgDirect'"));
+    if (pThis->fTxSgDirect)
+    {
+        pThis->pTxSgDirectR3 = (PE1KTXSG)PDMDevHlpMMHeapAllocZ(pDevIns, sizeof(E1KTXSG));
+        if (!pThis->pTxSgDirectR3)
+            return VERR_NO_MEMORY;
+    }
+#endif
+
     E1kLog(("%s Chip=%s LinkUpDelay=%ums EthernetCRC=%s GSO=%s R0=%s GC=%s\n", pThis->szPrf,
             g_Chips[pThis->eChip].pcszName, pThis->cMsLinkUpDelay,
             pThis->fEthernetCRC ? "on" : "off",
@@ -7728,7 +8222,14 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitBytes,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data transmitted",         "/Public/Net/E1k%u/BytesTransmitted", iInstance);
 
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveBytes,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data received",            "/Devices/E1k%d/ReceiveBytes", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatRxIntModPackets,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Packets seen by RX int moderation",  "/Devices/E1k%d/RxIntMod/Packets", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatRxIntModInts,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Interrupts raised with RXT0 pending", "/Devices/E1k%d/RxIntMod/Interrupts", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatRxIntModDeferred,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "RX interrupts deferred",             "/Devices/E1k%d/RxIntMod/Deferred", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->uRxIntModRate,          STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Smoothed RX packet rate (pps)",      "/Devices/E1k%d/RxIntMod/PacketRate", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->cNsRxIntModItr,         STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_NS,             "Current RX interrupt interval",      "/Devices/E1k%d/RxIntMod/Interval", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitBytes,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data transmitted",         "/Devices/E1k%d/TransmitBytes", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTxSgDirect,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Frames sent referencing guest memory", "/Devices/E1k%d/TxSg/Direct", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTxSgCopied,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Direct frames copied after all",     "/Devices/E1k%d/TxSg/Copied", iInstance);
 
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatMMIOReadRZ,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling MMIO reads in RZ",         "/Devices/E1k%d/MMIO/ReadRZ", iInstance);
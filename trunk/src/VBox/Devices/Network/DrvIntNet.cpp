@@ -104,12 +104,14 @@ typedef struct DRVINTNET
     PPDMDRVINSR0                    pDrvInsR0;
     /** Pointer to the communication buffer (ring-0). */
     R0PTRTYPE(PINTNETBUF)           pBufR0;
+#if HC_ARCH_BITS == 32
+    RTR0PTR                         R0PtrAlignment;
+#endif
 
     /** The network interface for the raw-mode context. */
     PDMINETWORKUPRC                 INetworkUpRC;
     /** Pointer to the driver instance. */
     PPDMDRVINSRC                    pDrvInsRC;
-    RTRCPTR                         RCPtrAlignment;
 
     /** The transmit lock. */
     PDMCRITSECT                     XmitLock;
@@ -554,6 +556,20 @@ PDMBOTHCBDECL(void) drvIntNetUp_SetPromiscuousMode(PPDMINETWORKUP pInterface, bo
     AssertRC(rc);
 }
 
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendSg}
+ *
+ * Frames have to be copied into the shared send ring anyway, so there is
+ * nothing to gain from taking the caller's buffer.  Only present to fill the
+ * ring-0 interface table, the ring-3 one leaves the method NULL.
+ */
+PDMBOTHCBDECL(int) drvIntNetUp_SendSg(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    NOREF(pInterface); NOREF(pSgBuf); NOREF(fOnWorkerThread);
+    return VERR_NOT_SUPPORTED;
+}
+
 #ifdef IN_RING3
 
 /**
@@ -224,6 +224,29 @@ AssertCompileMemberAlignment(DRVNAT, StatNATRecvWakeups, 8);
 /** Pointer to the NAT driver instance data. */
 typedef DRVNAT *PDRVNAT;
 
+/**
+ * GSO frame buffer handed out by drvNATNetworkUp_AllocBuf.
+ *
+ * The segments of TCP GSO frames are carved out in place and lent to slirp as
+ * external mbuf storage, so the frame must stay around until the last segment
+ * mbuf referencing it is freed.  This is tracked by cRefs.
+ */
+typedef struct DRVNATGSOBUF
+{
+    /** The GSO context (must be first, pvUser of the S/G buffer points here). */
+    PDMNETWORKGSO           Gso;
+    /** Reference counter: one for the S/G buffer and one per segment mbuf. */
+    volatile uint32_t       cRefs;
+    /** Number of entries in aSegRefs. */
+    uint32_t                cSegsMax;
+    /** Pointer to the frame data (follows aSegRefs). */
+    uint8_t                *pbFrame;
+    /** Reference counters of the segment mbufs (EXT_EXTREF), one per segment. */
+    volatile uint32_t       aSegRefs[1];
+} DRVNATGSOBUF;
+/** Pointer to a NAT GSO frame buffer. */
+typedef DRVNATGSOBUF *PDRVNATGSOBUF;
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -361,6 +384,30 @@ done_unlocked:
     STAM_PROFILE_STOP(&pThis->StatNATRecv, a);
 }
 
+/**
+ * Releases a reference to a GSO frame buffer, freeing it when it was the last.
+ *
+ * @param   pGsoBuf             The GSO frame buffer.
+ */
+static void drvNATGsoBufRelease(PDRVNATGSOBUF pGsoBuf)
+{
+    uint32_t cRefs = ASMAtomicDecU32(&pGsoBuf->cRefs);
+    Assert(cRefs < _64K);
+    if (!cRefs)
+        RTMemFree(pGsoBuf);
+}
+
+/**
+ * @callback_method_impl{FNSLIRPEXTMFREE,
+ *      Called by slirp when it frees a GSO segment mbuf created by
+ *      drvNATSendWorker.}
+ */
+static void drvNATGsoSegFree(void *pvBuf, void *pvUser)
+{
+    NOREF(pvBuf);
+    drvNATGsoBufRelease((PDRVNATGSOBUF)pvUser);
+}
+
 /**
  * Frees a S/G buffer allocated by drvNATNetworkUp_AllocBuf.
  *
@@ -379,9 +426,9 @@ static void drvNATFreeSgBuf(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
     }
     else if (pSgBuf->pvUser)
     {
-        RTMemFree(pSgBuf->aSegs[0].pvSeg);
+        /* Segment mbufs still queued inside slirp keep the frame alive. */
+        drvNATGsoBufRelease((PDRVNATGSOBUF)pSgBuf->pvUser);
         pSgBuf->aSegs[0].pvSeg = NULL;
-        RTMemFree(pSgBuf->pvUser);
         pSgBuf->pvUser = NULL;
     }
     RTMemFree(pSgBuf);
@@ -414,37 +461,71 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
         {
             /*
              * GSO frame, need to segment it.
+             *
+             * For TCP the segments are carved out in place (PDMNetGsoCarveSegmentQD)
+             * and the mbufs handed to slirp merely reference the frame, so the
+             * payload isn't copied.  The in place carving puts the headers of a
+             * segment on top of the tail of the previous one, so this is only
+             * safe if slirp is done with the previous segment, i.e. didn't queue
+             * it for reassembly.  Segments following a queued one, the first
+             * segment (its header is the prototype) and UDP fragments (they all
+             * end up in the IP reassembly queue) are copied into separate mbufs.
              */
             /** @todo Make the NAT engine grok large frames?  Could be more efficient... */
-#if 0 /* this is for testing PDMNetGsoCarveSegmentQD. */
+            PDRVNATGSOBUF   pGsoBuf  = (PDRVNATGSOBUF)pSgBuf->pvUser;
+            uint8_t        *pbFrame  = (uint8_t *)pSgBuf->aSegs[0].pvSeg;
+            PCPDMNETWORKGSO pGso     = &pGsoBuf->Gso;
+            uint32_t const  cSegs    = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+            bool const      fInPlace =    (   pGso->u8Type == PDMNETWORKGSOTYPE_IPV4_TCP
+                                           || pGso->u8Type == PDMNETWORKGSOTYPE_IPV6_TCP
+                                           || pGso->u8Type == PDMNETWORKGSOTYPE_IPV4_IPV6_TCP)
+                                       && pGso->cbMaxSeg >= pGso->cbHdrsTotal
+                                       && cSegs <= pGsoBuf->cSegsMax;
             uint8_t         abHdrScratch[256];
-#endif
-            uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
-            PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
-            uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
-            for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+            bool            fPrevInFlight = true; /* segment 0 is always copied */
+            if (fInPlace)
+                memcpy(abHdrScratch, pbFrame, pGso->cbHdrsSeg);
+
+            for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
             {
-                size_t cbSeg;
-                void  *pvSeg;
-                m = slirp_ext_m_get(pThis->pNATState, pGso->cbHdrsTotal + pGso->cbMaxSeg, &pvSeg, &cbSeg);
-                if (!m)
-                    break;
-
-#if 1
-                uint32_t cbPayload, cbHdrs;
-                uint32_t offPayload = PDMNetGsoCarveSegment(pGso, pbFrame, pSgBuf->cbUsed,
-                                                            iSeg, cSegs, (uint8_t *)pvSeg, &cbHdrs, &cbPayload);
-                memcpy((uint8_t *)pvSeg + cbHdrs, pbFrame + offPayload, cbPayload);
-
-                slirp_input(pThis->pNATState, m, cbPayload + cbHdrs);
-#else
-                uint32_t cbSegFrame;
-                void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
-                                                           iSeg, cSegs, &cbSegFrame);
-                memcpy((uint8_t *)pvSeg, pvSegFrame, cbSegFrame);
+                if (fInPlace && !fPrevInFlight)
+                {
+                    uint32_t cbSegFrame;
+                    void    *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, pSgBuf->cbUsed, abHdrScratch,
+                                                                  iSeg, cSegs, &cbSegFrame);
+                    ASMAtomicIncU32(&pGsoBuf->cRefs);
+                    m = slirp_ext_m_attach(pThis->pNATState, pvSegFrame, cbSegFrame, &pGsoBuf->aSegRefs[iSeg],
+                                           drvNATGsoSegFree, pGsoBuf);
+                    if (!m)
+                    {
+                        drvNATGsoBufRelease(pGsoBuf);
+                        break;
+                    }
+                    STAM_COUNTER_INC(&pThis->StatNATGsoSegZeroCopy);
 
-                slirp_input(pThis->pNATState, m, cbSegFrame);
-#endif
+                    /* slirp is single threaded, so once slirp_input returns the
+                       segment mbuf is either freed or queued somewhere. */
+                    uint32_t const cRefsBefore = ASMAtomicReadU32(&pGsoBuf->cRefs);
+                    slirp_input(pThis->pNATState, m, cbSegFrame);
+                    fPrevInFlight = ASMAtomicReadU32(&pGsoBuf->cRefs) == cRefsBefore;
+                }
+                else
+                {
+                    size_t cbSeg;
+                    void  *pvSeg;
+                    m = slirp_ext_m_get(pThis->pNATState, pGso->cbHdrsTotal + pGso->cbMaxSeg, &pvSeg, &cbSeg);
+                    if (!m)
+                        break;
+
+                    uint32_t cbPayload, cbHdrs;
+                    uint32_t offPayload = PDMNetGsoCarveSegment(pGso, pbFrame, pSgBuf->cbUsed,
+                                                                iSeg, cSegs, (uint8_t *)pvSeg, &cbHdrs, &cbPayload);
+                    memcpy((uint8_t *)pvSeg + cbHdrs, pbFrame + offPayload, cbPayload);
+                    STAM_COUNTER_INC(&pThis->StatNATGsoSegCopied);
+
+                    slirp_input(pThis->pNATState, m, cbPayload + cbHdrs);
+                    fPrevInFlight = false;
+                }
             }
         }
     }
@@ -527,17 +608,28 @@ static DECLCALLBACK(int) drvNATNetworkUp_AllocBuf(PPDMINETWORKUP pInterface, siz
             return VERR_INVALID_PARAMETER;
         }
 
-        pSgBuf->pvUser      = RTMemDup(pGso, sizeof(*pGso));
-        pSgBuf->pvAllocator = NULL;
-        pSgBuf->aSegs[0].cbSeg = RT_ALIGN_Z(cbMin, 16);
-        pSgBuf->aSegs[0].pvSeg = RTMemAlloc(pSgBuf->aSegs[0].cbSeg);
-        if (!pSgBuf->pvUser || !pSgBuf->aSegs[0].pvSeg)
+        /*
+         * The GSO context, the segment reference counters and the frame are
+         * allocated in one go, see DRVNATGSOBUF.
+         */
+        size_t const   cbFrame  = RT_ALIGN_Z(cbMin, 16);
+        uint32_t const cSegsMax = RT_MAX(PDMNetGsoCalcSegmentCount(pGso, cbFrame), 1);
+        size_t const   offFrame = RT_ALIGN_Z(RT_OFFSETOF(DRVNATGSOBUF, aSegRefs[cSegsMax]), 16);
+        PDRVNATGSOBUF  pGsoBuf  = (PDRVNATGSOBUF)RTMemAlloc(offFrame + cbFrame);
+        if (!pGsoBuf)
         {
-            RTMemFree(pSgBuf->aSegs[0].pvSeg);
-            RTMemFree(pSgBuf->pvUser);
             RTMemFree(pSgBuf);
             return VERR_TRY_AGAIN;
         }
+        pGsoBuf->Gso      = *pGso;
+        pGsoBuf->cRefs    = 1;
+        pGsoBuf->cSegsMax = cSegsMax;
+        pGsoBuf->pbFrame  = (uint8_t *)pGsoBuf + offFrame;
+
+        pSgBuf->pvUser      = pGsoBuf;
+        pSgBuf->pvAllocator = NULL;
+        pSgBuf->aSegs[0].cbSeg = cbFrame;
+        pSgBuf->aSegs[0].pvSeg = pGsoBuf->pbFrame;
     }
 
     /*
@@ -194,6 +194,20 @@ PDMBOTHCBDECL(void) drvNetShaperUp_SetPromiscuousMode(PPDMINETWORKUP pInterface,
 }
 
 
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendSg}
+ *
+ * Bandwidth is charged in pfnAllocBuf before the caller assembles a frame, so
+ * callers have to go that way.  Only present to fill the ring-0 interface
+ * table, the ring-3 one leaves the method NULL.
+ */
+PDMBOTHCBDECL(int) drvNetShaperUp_SendSg(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    NOREF(pInterface); NOREF(pSgBuf); NOREF(fOnWorkerThread);
+    return VERR_NOT_SUPPORTED;
+}
+
+
 #ifdef IN_RING3
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnNotifyLinkChanged}
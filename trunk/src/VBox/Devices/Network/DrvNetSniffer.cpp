@@ -22,12 +22,18 @@
 #define LOG_GROUP LOG_GROUP_DRV_NAT
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmnetifs.h>
+#include <VBox/vmm/pdmnetinline.h>
 
 #include <VBox/log.h>
+#include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/critsect.h>
+#include <iprt/ctype.h>
 #include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/process.h>
+#include <iprt/semaphore.h>
 #include <iprt/string.h>
 #include <iprt/time.h>
 #include <iprt/uuid.h>
@@ -38,9 +44,100 @@
 #include "VBoxDD.h"
 
 
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The default snap length (max bytes captured per frame). */
+#define DRVNETSNIFFER_SNAPLEN_DEFAULT       UINT32_C(65535)
+/** The smallest snap length we accept. */
+#define DRVNETSNIFFER_SNAPLEN_MIN           UINT32_C(64)
+/** The default capture ring size in bytes. */
+#define DRVNETSNIFFER_RING_SIZE_DEFAULT     UINT32_C(0x00800000)
+/** The minimum number of records in the capture ring. */
+#define DRVNETSNIFFER_RING_RECS_MIN         UINT32_C(16)
+/** The max number of terms in a capture filter. */
+#define DRVNETSNIFFER_MAX_FILTER_TERMS      16
+
+/** @name DRVNETSNIFFERREC::fFlags
+ * @{ */
+/** The frame was sent by the device above us. */
+#define DRVNETSNIFFER_REC_F_OUTBOUND        RT_BIT_32(0)
+/** The frame was received from the driver below us. */
+#define DRVNETSNIFFER_REC_F_INBOUND         RT_BIT_32(1)
+/** The frame is a GSO frame, DRVNETSNIFFERREC::Gso is valid. */
+#define DRVNETSNIFFER_REC_F_GSO             RT_BIT_32(2)
+/** @} */
+
+
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
 *********************************************************************************************************************************/
+/**
+ * Capture filter term operations.
+ */
+typedef enum DRVNETSNIFFERFLTOP
+{
+    kDrvNetSnifferFltOp_Invalid = 0,
+    /** Match the EtherType (after any VLAN tag). */
+    kDrvNetSnifferFltOp_EtherType,
+    /** Match frames carrying an 802.1Q tag. */
+    kDrvNetSnifferFltOp_Vlan,
+    /** Match the IPv4 protocol / IPv6 next header field. */
+    kDrvNetSnifferFltOp_IpProto,
+    /** Match the IPv4 source or destination address. */
+    kDrvNetSnifferFltOp_Host,
+    /** Match the TCP or UDP source or destination port. */
+    kDrvNetSnifferFltOp_Port
+} DRVNETSNIFFERFLTOP;
+
+/**
+ * A capture filter term.
+ *
+ * The filter is a list of terms in disjunctive normal form: terms are and'ed
+ * together until a term with fNewGroup set starts the next alternative.
+ */
+typedef struct DRVNETSNIFFERFLTTERM
+{
+    /** The operation. */
+    DRVNETSNIFFERFLTOP      enmOp;
+    /** Negate the result. */
+    bool                    fNegate;
+    /** This term starts a new 'or' group. */
+    bool                    fNewGroup;
+    /** The value to compare with (host byte order). */
+    uint32_t                uValue;
+} DRVNETSNIFFERFLTTERM;
+/** Pointer to a const capture filter term. */
+typedef DRVNETSNIFFERFLTTERM const *PCDRVNETSNIFFERFLTTERM;
+
+/**
+ * A capture ring record.
+ *
+ * The ring is a bounded multi-producer single-consumer queue of fixed size
+ * records.  A record is free for the producer claiming ring index i when uSeq
+ * equals i and ready for the writer when uSeq equals i + 1.  The writer hands
+ * it back for the next lap by setting uSeq to i + cRecs.
+ */
+typedef struct DRVNETSNIFFERREC
+{
+    /** The sequence number, see above. */
+    uint64_t volatile       uSeq;
+    /** The time stamp relative to DRVNETSNIFFER::StartNanoTS. */
+    uint64_t                cNsTS;
+    /** The original size of the frame. */
+    uint32_t                cbFrame;
+    /** The number of bytes captured. */
+    uint32_t                cbData;
+    /** DRVNETSNIFFER_REC_F_XXX. */
+    uint32_t                fFlags;
+    /** The GSO context if DRVNETSNIFFER_REC_F_GSO is set. */
+    PDMNETWORKGSO           Gso;
+    /** The captured bytes (DRVNETSNIFFER::cbSnapLen). */
+    uint8_t                 abData[1];
+} DRVNETSNIFFERREC;
+/** Pointer to a capture ring record. */
+typedef DRVNETSNIFFERREC *PDRVNETSNIFFERREC;
+
 /**
  * Block driver instance data.
  *
@@ -65,10 +162,8 @@ typedef struct DRVNETSNIFFER
     PPDMINETWORKUP          pIBelowNet;
     /** The filename. */
     char                    szFilename[RTPATH_MAX];
-    /** The filehandle. */
+    /** The filehandle, only used by the writer thread after construction. */
     RTFILE                  hFile;
-    /** The lock serializing the file access. */
-    RTCRITSECT              Lock;
     /** The NanoTS delta we pass to the pcap writers. */
     uint64_t                StartNanoTS;
     /** Pointer to the driver instance. */
@@ -76,9 +171,428 @@ typedef struct DRVNETSNIFFER
     /** For when we're the leaf driver. */
     RTCRITSECT              XmitLock;
 
+    /** The capture ring (cRecs records of cbRec bytes). */
+    uint8_t                *pbRing;
+    /** The size of a ring record. */
+    uint32_t                cbRec;
+    /** The number of records in the ring (power of two). */
+    uint32_t                cRecs;
+    /** The next ring index to claim by a producer. */
+    uint64_t volatile       iRecHead;
+    /** The next ring index the writer thread consumes. */
+    uint64_t                iRecTail;
+    /** The max number of bytes captured per frame. */
+    uint32_t                cbSnapLen;
+    /** Whether to write pcapng instead of pcap. */
+    bool                    fPcapng;
+    /** Set by the writer thread when it's about to sleep. */
+    bool volatile           fWriterSleeping;
+    /** Event semaphore the writer thread sleeps on. */
+    RTSEMEVENT              hEvtWriter;
+    /** The writer thread. */
+    PPDMTHREAD              pWriterThread;
+    /** Scratch buffer for carving GSO segments (cbSnapLen bytes). */
+    uint8_t                *pbScratch;
+
+    /** Rotate the file after it exceeds this size, 0 if disabled. */
+    uint64_t                cbMaxFile;
+    /** Rotate the file after this many milliseconds, 0 if disabled. */
+    uint64_t                cMsRotate;
+    /** The number of rotated files to keep, 0 for all. */
+    uint32_t                cMaxFiles;
+    /** The index of the current file when rotating. */
+    uint32_t                iFile;
+    /** When the current file was opened (RTTimeMilliTS). */
+    uint64_t                msFileOpened;
+
+    /** The number of terms in the capture filter, 0 for capturing all frames. */
+    uint32_t                cFilterTerms;
+    /** The capture filter terms. */
+    DRVNETSNIFFERFLTTERM    aFilterTerms[DRVNETSNIFFER_MAX_FILTER_TERMS];
+
+    /** Number of frames queued for writing. */
+    STAMCOUNTER             StatCaptured;
+    /** Number of frames rejected by the capture filter. */
+    STAMCOUNTER             StatFiltered;
+    /** Number of frames dropped because the capture ring was full. */
+    STAMCOUNTER             StatDropped;
+    /** Number of files rotated. */
+    STAMCOUNTER             StatRotations;
 } DRVNETSNIFFER, *PDRVNETSNIFFER;
 
 
+/**
+ * Evaluates a single capture filter term.
+ *
+ * @returns true if the term matches (before negation).
+ * @param   pTerm           The term.
+ * @param   pbFrame         The start of the frame.
+ * @param   cbFrame         The number of contiguous bytes at pbFrame.
+ */
+static bool drvNetSnifferFilterTerm(PCDRVNETSNIFFERFLTTERM pTerm, uint8_t const *pbFrame, size_t cbFrame)
+{
+    if (cbFrame < sizeof(RTNETETHERHDR))
+        return false;
+
+    uint32_t offL3     = sizeof(RTNETETHERHDR);
+    uint16_t uEtherType = RT_MAKE_U16(pbFrame[13], pbFrame[12]);
+    bool     fVlan      = uEtherType == RTNET_ETHERTYPE_VLAN;
+    if (fVlan)
+    {
+        if (cbFrame < sizeof(RTNETETHERHDR) + 4)
+            return false;
+        uEtherType = RT_MAKE_U16(pbFrame[17], pbFrame[16]);
+        offL3 += 4;
+    }
+
+    switch (pTerm->enmOp)
+    {
+        case kDrvNetSnifferFltOp_EtherType:
+            return uEtherType == pTerm->uValue;
+        case kDrvNetSnifferFltOp_Vlan:
+            return fVlan;
+        default:
+            break;
+    }
+
+    /*
+     * Locate the transport header.  IPv6 extension headers aren't walked.
+     */
+    uint8_t const *pbL3 = pbFrame + offL3;
+    uint32_t       cbL3 = (uint32_t)cbFrame - offL3;
+    uint8_t        uProto;
+    uint32_t       offL4;
+    bool           fFirstFrag = true;
+    if (uEtherType == RTNET_ETHERTYPE_IPV4)
+    {
+        if (cbL3 < RTNETIPV4_MIN_LEN)
+            return false;
+        uProto     = pbL3[9];
+        offL4      = (pbL3[0] & 0xf) * 4;
+        fFirstFrag = (RT_MAKE_U16(pbL3[7], pbL3[6]) & 0x1fff /* fragment offset */) == 0;
+        if (pTerm->enmOp == kDrvNetSnifferFltOp_Host)
+            return RT_MAKE_U32_FROM_U8(pbL3[15], pbL3[14], pbL3[13], pbL3[12]) == pTerm->uValue
+                || RT_MAKE_U32_FROM_U8(pbL3[19], pbL3[18], pbL3[17], pbL3[16]) == pTerm->uValue;
+    }
+    else if (uEtherType == RTNET_ETHERTYPE_IPV6)
+    {
+        if (cbL3 < sizeof(RTNETIPV6))
+            return false;
+        uProto = pbL3[6];
+        offL4  = sizeof(RTNETIPV6);
+    }
+    else
+        return false;
+
+    switch (pTerm->enmOp)
+    {
+        case kDrvNetSnifferFltOp_IpProto:
+            return uProto == pTerm->uValue;
+        case kDrvNetSnifferFltOp_Port:
+            if (   (uProto != RTNETIPV4_PROT_TCP && uProto != RTNETIPV4_PROT_UDP)
+                || !fFirstFrag
+                || cbL3 < offL4 + 4)
+                return false;
+            return RT_MAKE_U16(pbL3[offL4 + 1], pbL3[offL4])     == pTerm->uValue
+                || RT_MAKE_U16(pbL3[offL4 + 3], pbL3[offL4 + 2]) == pTerm->uValue;
+        default:
+            return false;
+    }
+}
+
+
+/**
+ * Checks whether the capture filter accepts a frame.
+ *
+ * @returns true if the frame should be captured.
+ * @param   pThis           The sniffer instance.
+ * @param   pbFrame         The start of the frame.
+ * @param   cbFrame         The number of contiguous bytes at pbFrame.
+ */
+static bool drvNetSnifferFilter(PDRVNETSNIFFER pThis, uint8_t const *pbFrame, size_t cbFrame)
+{
+    uint32_t const cTerms = pThis->cFilterTerms;
+    if (!cTerms)
+        return true;
+
+    bool fGroup = true;
+    for (uint32_t i = 0; i < cTerms; i++)
+    {
+        PCDRVNETSNIFFERFLTTERM pTerm = &pThis->aFilterTerms[i];
+        if (pTerm->fNewGroup)
+        {
+            if (fGroup)
+                return true;
+            fGroup = true;
+        }
+        else if (!fGroup)
+            continue;
+        fGroup = drvNetSnifferFilterTerm(pTerm, pbFrame, cbFrame) != pTerm->fNegate;
+    }
+    return fGroup;
+}
+
+
+/**
+ * Parses the capture filter expression.
+ *
+ * The syntax is a simplified subset of the pcap-filter language:
+ * @verbatim
+ *      filter  := group { "or" group }
+ *      group   := term { ["and"] term }
+ *      term    := ["not"] primitive
+ *      primitive := "ether proto" N | "ip" | "ip6" | "arp" | "vlan"
+ *                 | "ip proto" N | "tcp" | "udp" | "icmp" | "icmp6"
+ *                 | "host" A.B.C.D | "port" N
+ * @endverbatim
+ *
+ * @returns VBox status code.
+ * @param   pThis           The sniffer instance.
+ * @param   pszFilter       The filter expression, modified.
+ */
+static int drvNetSnifferParseFilter(PDRVNETSNIFFER pThis, char *pszFilter)
+{
+    bool fNewGroup = false;
+    bool fNegate   = false;
+    bool fWantTerm = false;
+    char *psz      = pszFilter;
+    for (;;)
+    {
+        /* Get the next word. */
+        psz = RTStrStripL(psz);
+        if (!*psz)
+            break;
+        char *pszWord = psz;
+        while (*psz && !RT_C_IS_SPACE(*psz))
+            psz++;
+        if (*psz)
+            *psz++ = '\0';
+
+        if (!RTStrICmp(pszWord, "or"))
+        {
+            if (!pThis->cFilterTerms || fWantTerm)
+                return VERR_INVALID_PARAMETER;
+            fNewGroup = fWantTerm = true;
+            continue;
+        }
+        if (!RTStrICmp(pszWord, "and"))
+        {
+            if (!pThis->cFilterTerms || fWantTerm)
+                return VERR_INVALID_PARAMETER;
+            fWantTerm = true;
+            continue;
+        }
+        if (!RTStrICmp(pszWord, "not"))
+        {
+            fNegate   = !fNegate;
+            fWantTerm = true;
+            continue;
+        }
+
+        if (pThis->cFilterTerms >= RT_ELEMENTS(pThis->aFilterTerms))
+            return VERR_TOO_MUCH_DATA;
+        DRVNETSNIFFERFLTTERM *pTerm = &pThis->aFilterTerms[pThis->cFilterTerms];
+
+        /* Keywords taking an argument. */
+        char *pszArg = NULL;
+        if (   !RTStrICmp(pszWord, "ether")
+            || (!RTStrICmp(pszWord, "ip") && !RTStrNICmp(RTStrStripL(psz), "proto", 5) && RT_C_IS_SPACE(RTStrStripL(psz)[5]))
+            || !RTStrICmp(pszWord, "host")
+            || !RTStrICmp(pszWord, "port"))
+        {
+            if (!RTStrICmp(pszWord, "ether") || !RTStrICmp(pszWord, "ip"))
+            {
+                /* Skip the "proto" word. */
+                psz = RTStrStripL(psz);
+                if (RTStrNICmp(psz, "proto", 5) || !RT_C_IS_SPACE(psz[5]))
+                    return VERR_INVALID_PARAMETER;
+                psz += 5;
+            }
+            psz = RTStrStripL(psz);
+            pszArg = psz;
+            while (*psz && !RT_C_IS_SPACE(*psz))
+                psz++;
+            if (*psz)
+                *psz++ = '\0';
+            if (!*pszArg)
+                return VERR_INVALID_PARAMETER;
+        }
+
+        int rc = VINF_SUCCESS;
+        if (!RTStrICmp(pszWord, "ether"))
+        {
+            uint16_t u16;
+            rc = RTStrToUInt16Full(pszArg, 0, &u16);
+            pTerm->enmOp  = kDrvNetSnifferFltOp_EtherType;
+            pTerm->uValue = u16;
+        }
+        else if (pszArg && !RTStrICmp(pszWord, "ip"))
+        {
+            uint8_t u8;
+            rc = RTStrToUInt8Full(pszArg, 0, &u8);
+            pTerm->enmOp  = kDrvNetSnifferFltOp_IpProto;
+            pTerm->uValue = u8;
+        }
+        else if (!RTStrICmp(pszWord, "host"))
+        {
+            RTNETADDRIPV4 Addr;
+            rc = RTNetStrToIPv4Addr(pszArg, &Addr);
+            pTerm->enmOp  = kDrvNetSnifferFltOp_Host;
+            pTerm->uValue = RT_N2H_U32(Addr.u);
+        }
+        else if (!RTStrICmp(pszWord, "port"))
+        {
+            uint16_t u16;
+            rc = RTStrToUInt16Full(pszArg, 0, &u16);
+            pTerm->enmOp  = kDrvNetSnifferFltOp_Port;
+            pTerm->uValue = u16;
+        }
+        else if (!RTStrICmp(pszWord, "ip"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_EtherType;
+            pTerm->uValue = RTNET_ETHERTYPE_IPV4;
+        }
+        else if (!RTStrICmp(pszWord, "ip6"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_EtherType;
+            pTerm->uValue = RTNET_ETHERTYPE_IPV6;
+        }
+        else if (!RTStrICmp(pszWord, "arp"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_EtherType;
+            pTerm->uValue = RTNET_ETHERTYPE_ARP;
+        }
+        else if (!RTStrICmp(pszWord, "vlan"))
+            pTerm->enmOp  = kDrvNetSnifferFltOp_Vlan;
+        else if (!RTStrICmp(pszWord, "tcp"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_IpProto;
+            pTerm->uValue = RTNETIPV4_PROT_TCP;
+        }
+        else if (!RTStrICmp(pszWord, "udp"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_IpProto;
+            pTerm->uValue = RTNETIPV4_PROT_UDP;
+        }
+        else if (!RTStrICmp(pszWord, "icmp"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_IpProto;
+            pTerm->uValue = RTNETIPV4_PROT_ICMP;
+        }
+        else if (!RTStrICmp(pszWord, "icmp6"))
+        {
+            pTerm->enmOp  = kDrvNetSnifferFltOp_IpProto;
+            pTerm->uValue = RTNETIPV6_PROT_ICMPV6;
+        }
+        else
+            rc = VERR_INVALID_PARAMETER;
+        if (rc != VINF_SUCCESS)
+            return RT_FAILURE(rc) ? rc : VERR_INVALID_PARAMETER;
+
+        pTerm->fNegate   = fNegate;
+        pTerm->fNewGroup = fNewGroup;
+        pThis->cFilterTerms++;
+        fNegate = fNewGroup = fWantTerm = false;
+    }
+
+    return fWantTerm ? VERR_INVALID_PARAMETER : VINF_SUCCESS;
+}
+
+
+/**
+ * Gets the capture ring record for a ring index.
+ */
+DECLINLINE(PDRVNETSNIFFERREC) drvNetSnifferRec(PDRVNETSNIFFER pThis, uint64_t iRec)
+{
+    return (PDRVNETSNIFFERREC)(pThis->pbRing + (size_t)(iRec & (pThis->cRecs - 1)) * pThis->cbRec);
+}
+
+
+/**
+ * Queues a frame for the writer thread.
+ *
+ * This is called on the transmit and receive paths and must not block.  When
+ * the ring is full the frame is not captured.
+ *
+ * @param   pThis           The sniffer instance.
+ * @param   paSegs          The segments making up the frame.
+ * @param   cSegs           The number of segments.
+ * @param   cbFrame         The size of the frame.
+ * @param   pGso            The GSO context, NULL if not a GSO frame.
+ * @param   fFlags          DRVNETSNIFFER_REC_F_INBOUND or
+ *                          DRVNETSNIFFER_REC_F_OUTBOUND.
+ */
+static void drvNetSnifferCapture(PDRVNETSNIFFER pThis, PCPDMDATASEG paSegs, uint32_t cSegs, size_t cbFrame,
+                                 PCPDMNETWORKGSO pGso, uint32_t fFlags)
+{
+    if (!drvNetSnifferFilter(pThis, (uint8_t const *)paSegs[0].pvSeg, RT_MIN(paSegs[0].cbSeg, cbFrame)))
+    {
+        STAM_REL_COUNTER_INC(&pThis->StatFiltered);
+        return;
+    }
+
+    /*
+     * Claim a record.
+     */
+    PDRVNETSNIFFERREC pRec;
+    uint64_t          iRec = ASMAtomicReadU64(&pThis->iRecHead);
+    for (;;)
+    {
+        pRec = drvNetSnifferRec(pThis, iRec);
+        uint64_t const uSeq = ASMAtomicReadU64(&pRec->uSeq);
+        if (uSeq == iRec)
+        {
+            if (ASMAtomicCmpXchgExU64(&pThis->iRecHead, iRec + 1, iRec, &iRec))
+                break;
+        }
+        else if (uSeq < iRec)
+        {
+            STAM_REL_COUNTER_INC(&pThis->StatDropped);
+            return;
+        }
+        else
+            iRec = ASMAtomicReadU64(&pThis->iRecHead);
+    }
+
+    /*
+     * Fill it and hand it to the writer.
+     */
+    pRec->cNsTS   = RTTimeNanoTS() - pThis->StartNanoTS;
+    pRec->cbFrame = (uint32_t)cbFrame;
+    pRec->fFlags  = fFlags;
+    if (pGso)
+    {
+        pRec->Gso     = *pGso;
+        pRec->fFlags |= DRVNETSNIFFER_REC_F_GSO;
+    }
+
+    size_t const cbData = RT_MIN(cbFrame, pThis->cbSnapLen);
+    size_t       offData = 0;
+    for (uint32_t iSeg = 0; iSeg < cSegs && offData < cbData; iSeg++)
+    {
+        size_t const cbCopy = RT_MIN(paSegs[iSeg].cbSeg, cbData - offData);
+        memcpy(&pRec->abData[offData], paSegs[iSeg].pvSeg, cbCopy);
+        offData += cbCopy;
+    }
+    pRec->cbData = (uint32_t)offData;
+
+    ASMAtomicWriteU64(&pRec->uSeq, iRec + 1);
+    STAM_REL_COUNTER_INC(&pThis->StatCaptured);
+
+    if (ASMAtomicXchgBool(&pThis->fWriterSleeping, false))
+        RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
+/**
+ * Queues a frame described by a S/G buffer for the writer thread.
+ */
+DECLINLINE(void) drvNetSnifferCaptureSg(PDRVNETSNIFFER pThis, PDMSCATTERGATHER const *pSgBuf)
+{
+    drvNetSnifferCapture(pThis, &pSgBuf->aSegs[0], (uint32_t)pSgBuf->cSegs, pSgBuf->cbUsed,
+                         (PCPDMNETWORKGSO)pSgBuf->pvUser, DRVNETSNIFFER_REC_F_OUTBOUND);
+}
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -132,23 +646,32 @@ static DECLCALLBACK(int) drvNetSnifferUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
         return VERR_NET_DOWN;
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    if (!pSgBuf->pvUser)
-        PcapFileFrame(pThis->hFile, pThis->StartNanoTS,
-                      pSgBuf->aSegs[0].pvSeg,
-                      pSgBuf->cbUsed,
-                      RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    else
-        PcapFileGsoFrame(pThis->hFile, pThis->StartNanoTS, (PCPDMNETWORKGSO)pSgBuf->pvUser,
-                         pSgBuf->aSegs[0].pvSeg,
-                         pSgBuf->cbUsed,
-                         RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    RTCritSectLeave(&pThis->Lock);
+    drvNetSnifferCaptureSg(pThis, pSgBuf);
 
     return pThis->pIBelowNet->pfnSendBuf(pThis->pIBelowNet, pSgBuf, fOnWorkerThread);
 }
 
 
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendSg}
+ */
+static DECLCALLBACK(int) drvNetSnifferUp_SendSg(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkUp);
+    if (RT_UNLIKELY(!pThis->pIBelowNet))
+        return VERR_NET_DOWN;
+    if (!pThis->pIBelowNet->pfnSendSg) /* Raced a re-attach. */
+        return VERR_NOT_SUPPORTED;
+
+    /* The caller falls back on pfnSendBuf if the driver below declines, so
+       only capture what was actually sent.  The buffer is still ours. */
+    int rc = pThis->pIBelowNet->pfnSendSg(pThis->pIBelowNet, pSgBuf, fOnWorkerThread);
+    if (RT_SUCCESS(rc))
+        drvNetSnifferCaptureSg(pThis, pSgBuf);
+    return rc;
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -205,22 +728,13 @@ static DECLCALLBACK(int) drvNetSnifferDown_Receive(PPDMINETWORKDOWN pInterface,
     PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkDown);
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    PcapFileFrame(pThis->hFile, pThis->StartNanoTS, pvBuf, cb, cb);
-    RTCritSectLeave(&pThis->Lock);
+    PDMDATASEG Seg;
+    Seg.pvSeg = (void *)pvBuf;
+    Seg.cbSeg = cb;
+    drvNetSnifferCapture(pThis, &Seg, 1, cb, NULL, DRVNETSNIFFER_REC_F_INBOUND);
 
     /* pass up */
-    int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvBuf, cb);
-#if 0
-    RTCritSectEnter(&pThis->Lock);
-    u64TS = RTTimeProgramNanoTS();
-    Hdr.ts_sec = (uint32_t)(u64TS / 1000000000);
-    Hdr.ts_usec = (uint32_t)((u64TS / 1000) % 1000000);
-    Hdr.incl_len = 0;
-    RTFileWrite(pThis->hFile, &Hdr, sizeof(Hdr), NULL);
-    RTCritSectLeave(&pThis->Lock);
-#endif
-    return rc;
+    return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvBuf, cb);
 }
 
 
@@ -276,6 +790,208 @@ static DECLCALLBACK(int) drvNetSnifferDownCfg_SetLinkState(PPDMINETWORKCONFIG pI
 }
 
 
+/**
+ * Opens the current capture file and writes the file header.
+ *
+ * When rotating, the file index is inserted in front of the file name suffix
+ * and the oldest file is deleted if more than cMaxFiles would be left.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The sniffer instance.
+ * @param   pszName         Where to return the file name.
+ * @param   cbName          The size of the name buffer.
+ */
+static int drvNetSnifferOpenFile(PDRVNETSNIFFER pThis, char *pszName, size_t cbName)
+{
+    int rc;
+    if (pThis->cbMaxFile || pThis->cMsRotate)
+    {
+        const char *pszSuffix = RTPathSuffix(pThis->szFilename);
+        size_t      cchBase   = pszSuffix ? (size_t)(pszSuffix - pThis->szFilename) : strlen(pThis->szFilename);
+        if (!pszSuffix)
+            pszSuffix = "";
+        if (pThis->cMaxFiles && pThis->iFile > pThis->cMaxFiles)
+        {
+            RTStrPrintf(pszName, cbName, "%.*s-%05u%s", (int)cchBase, pThis->szFilename, pThis->iFile - pThis->cMaxFiles, pszSuffix);
+            RTFileDelete(pszName);
+        }
+        rc = RTStrPrintf(pszName, cbName, "%.*s-%05u%s", (int)cchBase, pThis->szFilename, pThis->iFile, pszSuffix) < cbName - 1
+           ? VINF_SUCCESS : VERR_FILENAME_TOO_LONG;
+    }
+    else
+        rc = RTStrCopy(pszName, cbName, pThis->szFilename);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    rc = RTFileOpen(&pThis->hFile, pszName, RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    if (RT_FAILURE(rc))
+        return rc;
+    pThis->msFileOpened = RTTimeMilliTS();
+
+    /*
+     * Write the header.  For pcap this includes a dummy frame at offset 0,0
+     * so get the current time.
+     */
+    if (pThis->fPcapng)
+        PcapngFileHdr(pThis->hFile, pThis->cbSnapLen);
+    else
+        PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Switches to the next capture file if the current one is too big or too old.
+ *
+ * @param   pThis           The sniffer instance.
+ */
+static void drvNetSnifferRotateIfNeeded(PDRVNETSNIFFER pThis)
+{
+    if (pThis->hFile == NIL_RTFILE)
+        return;
+    if (   (!pThis->cbMaxFile || RTFileTell(pThis->hFile) < pThis->cbMaxFile)
+        && (!pThis->cMsRotate || RTTimeMilliTS() - pThis->msFileOpened < pThis->cMsRotate))
+        return;
+
+    RTFileClose(pThis->hFile);
+    pThis->hFile = NIL_RTFILE;
+    pThis->iFile++;
+    STAM_REL_COUNTER_INC(&pThis->StatRotations);
+
+    char szName[RTPATH_MAX];
+    int rc = drvNetSnifferOpenFile(pThis, szName, sizeof(szName));
+    if (RT_FAILURE(rc))
+        LogRel(("NetSniffer#%u: Failed to open '%s': %Rrc, capture stopped\n", pThis->pDrvIns->iInstance, szName, rc));
+}
+
+
+/**
+ * Writes a frame to the capture file in the configured format.
+ */
+static void drvNetSnifferWriteFrame(PDRVNETSNIFFER pThis, uint64_t cNsTS, const void *pvData, size_t cbData,
+                                    size_t cbFrame, uint32_t fFlags)
+{
+    if (pThis->fPcapng)
+        PcapngFileFrameAt(pThis->hFile, cNsTS, pvData, cbData, cbFrame,
+                            fFlags & DRVNETSNIFFER_REC_F_INBOUND  ? PCAPNG_EPB_FLAGS_INBOUND
+                          : fFlags & DRVNETSNIFFER_REC_F_OUTBOUND ? PCAPNG_EPB_FLAGS_OUTBOUND : 0);
+    else
+        PcapFileFrameAt(pThis->hFile, cNsTS, pvData, cbData, cbFrame);
+}
+
+
+/**
+ * Writes a capture record to the file.
+ *
+ * Fully captured GSO frames are written as the segments they would have
+ * been sent as, just like PcapFileGsoFrame does.  Truncated ones are
+ * written as is.
+ *
+ * @param   pThis           The sniffer instance.
+ * @param   pRec            The record.
+ */
+static void drvNetSnifferWriteRec(PDRVNETSNIFFER pThis, PDRVNETSNIFFERREC pRec)
+{
+    if (pThis->hFile == NIL_RTFILE)
+        return;
+
+    if (   (pRec->fFlags & DRVNETSNIFFER_REC_F_GSO)
+        && pRec->cbData == pRec->cbFrame
+        && PDMNetGsoIsValid(&pRec->Gso, sizeof(pRec->Gso), pRec->cbFrame))
+    {
+        uint32_t const cSegs = PDMNetGsoCalcSegmentCount(&pRec->Gso, pRec->cbFrame);
+        for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+        {
+            uint32_t cbSegPayload, cbHdrs;
+            uint32_t offSegPayload = PDMNetGsoCarveSegment(&pRec->Gso, pRec->abData, pRec->cbFrame, iSeg, cSegs,
+                                                           pThis->pbScratch, &cbHdrs, &cbSegPayload);
+            memcpy(pThis->pbScratch + cbHdrs, &pRec->abData[offSegPayload], cbSegPayload);
+            drvNetSnifferWriteFrame(pThis, pRec->cNsTS, pThis->pbScratch, cbHdrs + cbSegPayload,
+                                    cbHdrs + cbSegPayload, pRec->fFlags);
+        }
+    }
+    else
+        drvNetSnifferWriteFrame(pThis, pRec->cNsTS, pRec->abData, pRec->cbData, pRec->cbFrame, pRec->fFlags);
+
+    if (pThis->cbMaxFile)
+        drvNetSnifferRotateIfNeeded(pThis);
+}
+
+
+/**
+ * Writes all records queued in the capture ring.
+ *
+ * @returns true if anything was written.
+ * @param   pThis           The sniffer instance.
+ * @thread  The writer thread or the destructor after it was terminated.
+ */
+static bool drvNetSnifferDrain(PDRVNETSNIFFER pThis)
+{
+    bool fWritten = false;
+    for (;;)
+    {
+        uint64_t const    iRec = pThis->iRecTail;
+        PDRVNETSNIFFERREC pRec = drvNetSnifferRec(pThis, iRec);
+        if (ASMAtomicReadU64(&pRec->uSeq) != iRec + 1)
+            break;
+
+        drvNetSnifferWriteRec(pThis, pRec);
+
+        ASMAtomicWriteU64(&pRec->uSeq, iRec + pThis->cRecs);
+        pThis->iRecTail = iRec + 1;
+        fWritten = true;
+    }
+    return fWritten;
+}
+
+
+/**
+ * Checks whether the writer has nothing to do.
+ */
+DECLINLINE(bool) drvNetSnifferIsRingEmpty(PDRVNETSNIFFER pThis)
+{
+    return ASMAtomicReadU64(&drvNetSnifferRec(pThis, pThis->iRecTail)->uSeq) != pThis->iRecTail + 1;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADDRV, The capture file writer thread.}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        drvNetSnifferDrain(pThis);
+        if (pThis->cMsRotate)
+            drvNetSnifferRotateIfNeeded(pThis);
+
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, true);
+        if (drvNetSnifferIsRingEmpty(pThis))
+            RTSemEventWait(pThis->hEvtWriter, pThis->cMsRotate ? (RTMSINTERVAL)RT_MIN(pThis->cMsRotate, RT_MS_1SEC) : RT_INDEFINITE_WAIT);
+        ASMAtomicWriteBool(&pThis->fWriterSleeping, false);
+    }
+
+    drvNetSnifferDrain(pThis);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDRV}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterWakeUp(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+    NOREF(pThread);
+    return RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
 /**
  * @interface_method_impl{PDMIBASE,pfnQueryInterface}
  */
@@ -291,6 +1007,22 @@ static DECLCALLBACK(void *) drvNetSnifferQueryInterface(PPDMIBASE pInterface, co
 }
 
 
+/**
+ * Offers pfnSendSg to the driver above only when the driver below implements
+ * it, otherwise callers would be made to build frames which then get copied
+ * into a pfnAllocBuf buffer anyway.
+ *
+ * @param   pThis       The sniffer instance data.
+ */
+static void drvNetSnifferUpdateSendSg(PDRVNETSNIFFER pThis)
+{
+    if (pThis->pIBelowNet && pThis->pIBelowNet->pfnSendSg)
+        pThis->INetworkUp.pfnSendSg = drvNetSnifferUp_SendSg;
+    else
+        pThis->INetworkUp.pfnSendSg = NULL;
+}
+
+
 /**
  * @interface_method_impl{PDMDRVREG,pfnDetach}
  */
@@ -301,6 +1033,7 @@ static DECLCALLBACK(void) drvNetSnifferDetach(PPDMDRVINS pDrvIns, uint32_t fFlag
     LogFlow(("drvNetSnifferDetach: pDrvIns: %p, fFlags: %u\n", pDrvIns, fFlags));
     RTCritSectEnter(&pThis->XmitLock);
     pThis->pIBelowNet = NULL;
+    drvNetSnifferUpdateSendSg(pThis);
     RTCritSectLeave(&pThis->XmitLock);
 }
 
@@ -338,6 +1071,7 @@ static DECLCALLBACK(int) drvNetSnifferAttach(PPDMDRVINS pDrvIns, uint32_t fFlags
     }
     else
         AssertMsgFailed(("Failed to attach to driver below! rc=%Rrc\n", rc));
+    drvNetSnifferUpdateSendSg(pThis);
 
     RTCritSectLeave(&pThis->XmitLock);
     return VINF_SUCCESS;
@@ -352,8 +1086,27 @@ static DECLCALLBACK(void) drvNetSnifferDestruct(PPDMDRVINS pDrvIns)
     PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
-    if (RTCritSectIsInitialized(&pThis->Lock))
-        RTCritSectDelete(&pThis->Lock);
+    /*
+     * Stop the writer thread, it drains the ring before terminating.
+     */
+    if (pThis->pWriterThread)
+    {
+        int rc = PDMR3ThreadDestroy(pThis->pWriterThread, NULL);
+        AssertRC(rc);
+        pThis->pWriterThread = NULL;
+    }
+    if (pThis->pbRing)
+        drvNetSnifferDrain(pThis);
+
+    if (pThis->StatDropped.c)
+        LogRel(("NetSniffer#%u: %llu frames were not captured because the capture ring was full\n",
+                pDrvIns->iInstance, pThis->StatDropped.c));
+
+    if (pThis->hEvtWriter != NIL_RTSEMEVENT)
+    {
+        RTSemEventDestroy(pThis->hEvtWriter);
+        pThis->hEvtWriter = NIL_RTSEMEVENT;
+    }
 
     if (RTCritSectIsInitialized(&pThis->XmitLock))
         RTCritSectDelete(&pThis->XmitLock);
@@ -363,6 +1116,14 @@ static DECLCALLBACK(void) drvNetSnifferDestruct(PPDMDRVINS pDrvIns)
         RTFileClose(pThis->hFile);
         pThis->hFile = NIL_RTFILE;
     }
+
+    if (pThis->pbRing)
+    {
+        RTMemPageFree(pThis->pbRing, (size_t)pThis->cRecs * pThis->cbRec);
+        pThis->pbRing = NULL;
+    }
+    RTMemFree(pThis->pbScratch);
+    pThis->pbScratch = NULL;
 }
 
 
@@ -381,6 +1142,7 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
      */
     pThis->pDrvIns                                  = pDrvIns;
     pThis->hFile                                    = NIL_RTFILE;
+    pThis->hEvtWriter                               = NIL_RTSEMEVENT;
     /* The pcap file *must* start at time offset 0,0. */
     pThis->StartNanoTS                              = RTTimeNanoTS() - RTTimeProgramNanoTS();
     /* IBase */
@@ -393,6 +1155,7 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     pThis->INetworkUp.pfnEndXmit                    = drvNetSnifferUp_EndXmit;
     pThis->INetworkUp.pfnSetPromiscuousMode         = drvNetSnifferUp_SetPromiscuousMode;
     pThis->INetworkUp.pfnNotifyLinkChanged          = drvNetSnifferUp_NotifyLinkChanged;
+    /* pfnSendSg is only offered when the driver below has it, see drvNetSnifferUpdateSendSg. */
     /* INetworkDown */
     pThis->INetworkDown.pfnWaitReceiveAvail         = drvNetSnifferDown_WaitReceiveAvail;
     pThis->INetworkDown.pfnReceive                  = drvNetSnifferDown_Receive;
@@ -405,15 +1168,20 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     /*
      * Create the locks.
      */
-    int rc = RTCritSectInit(&pThis->Lock);
-    AssertRCReturn(rc, rc);
-    rc = RTCritSectInit(&pThis->XmitLock);
+    int rc = RTCritSectInit(&pThis->XmitLock);
     AssertRCReturn(rc, rc);
 
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "File\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "File\0"
+                                    "Format\0"
+                                    "SnapLen\0"
+                                    "RingSize\0"
+                                    "MaxFileSize\0"
+                                    "RotateInterval\0"
+                                    "MaxFiles\0"
+                                    "Filter\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     if (CFGMR3GetFirstChild(pCfg))
@@ -437,6 +1205,76 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         return rc;
     }
 
+    /** @cfgm{Format, string, "pcap"}
+     * The capture file format, "pcap" or "pcapng".  Only pcapng records the
+     * direction of the frames. */
+    char szFormat[16];
+    rc = CFGMR3QueryStringDef(pCfg, "Format", szFormat, sizeof(szFormat), "pcap");
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"Format\" value"));
+    if (!RTStrICmp(szFormat, "pcapng"))
+        pThis->fPcapng = true;
+    else if (RTStrICmp(szFormat, "pcap"))
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: Unknown NetSniffer format \"%s\""), szFormat);
+
+    /** @cfgm{SnapLen, uint32_t, 65535}
+     * The max number of bytes to capture of each frame.  Frames are copied into
+     * the capture ring on the send and receive paths, so keeping this small
+     * (e.g. 128 for headers only) reduces the overhead considerably. */
+    rc = CFGMR3QueryU32Def(pCfg, "SnapLen", &pThis->cbSnapLen, DRVNETSNIFFER_SNAPLEN_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"SnapLen\" value"));
+    pThis->cbSnapLen = RT_MAX(pThis->cbSnapLen, DRVNETSNIFFER_SNAPLEN_MIN);
+    pThis->cbSnapLen = RT_MIN(pThis->cbSnapLen, DRVNETSNIFFER_SNAPLEN_DEFAULT);
+
+    /** @cfgm{RingSize, uint32_t, 8MB}
+     * The size of the capture ring in bytes.  Frames captured while the ring is
+     * full are dropped (see the Dropped statistics counter). */
+    uint32_t cbRing;
+    rc = CFGMR3QueryU32Def(pCfg, "RingSize", &cbRing, DRVNETSNIFFER_RING_SIZE_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RingSize\" value"));
+
+    /** @cfgm{MaxFileSize, uint64_t, 0}
+     * Start a new capture file once the current one exceeds this many bytes.
+     * When rotating, the files are numbered, e.g. VBox-00001.pcap.  0 disables
+     * rotation by size. */
+    rc = CFGMR3QueryU64Def(pCfg, "MaxFileSize", &pThis->cbMaxFile, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"MaxFileSize\" value"));
+
+    /** @cfgm{RotateInterval, uint32_t, 0}
+     * Start a new capture file after this many seconds.  0 disables rotation
+     * by time. */
+    uint32_t cSecsRotate;
+    rc = CFGMR3QueryU32Def(pCfg, "RotateInterval", &cSecsRotate, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RotateInterval\" value"));
+    pThis->cMsRotate = (uint64_t)cSecsRotate * RT_MS_1SEC;
+
+    /** @cfgm{MaxFiles, uint32_t, 0}
+     * The number of capture files to keep when rotating, the oldest ones are
+     * deleted.  0 keeps all files. */
+    rc = CFGMR3QueryU32Def(pCfg, "MaxFiles", &pThis->cMaxFiles, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"MaxFiles\" value"));
+
+    /** @cfgm{Filter, string, ""}
+     * Only capture frames matching this expression.  It's a small subset of the
+     * pcap-filter language, e.g. "tcp and port 80 or arp", evaluated on the
+     * send and receive paths before anything is copied.  See
+     * drvNetSnifferParseFilter for the syntax.  Empty captures everything. */
+    char *pszFilter = NULL;
+    rc = CFGMR3QueryStringAllocDef(pCfg, "Filter", &pszFilter, "");
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"Filter\" value"));
+    rc = drvNetSnifferParseFilter(pThis, pszFilter);
+    MMR3HeapFree(pszFilter);
+    if (RT_FAILURE(rc))
+        return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
+                                   N_("Configuration error: Invalid NetSniffer filter expression"));
+
     /*
      * Query the network port interface.
      */
@@ -457,6 +1295,22 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         return VERR_PDM_MISSING_INTERFACE_ABOVE;
     }
 
+    /*
+     * Allocate the capture ring.  The record count is rounded down to a power
+     * of two so ring indexes can be masked.
+     */
+    pThis->cbRec = RT_ALIGN_32(RT_UOFFSETOF(DRVNETSNIFFERREC, abData) + pThis->cbSnapLen, 64);
+    uint32_t cRecs = RT_MAX(cbRing / pThis->cbRec, DRVNETSNIFFER_RING_RECS_MIN);
+    while (cRecs & (cRecs - 1))
+        cRecs &= cRecs - 1;
+    pThis->cRecs  = cRecs;
+    pThis->pbRing = (uint8_t *)RTMemPageAllocZ((size_t)cRecs * pThis->cbRec);
+    pThis->pbScratch = (uint8_t *)RTMemAlloc(pThis->cbSnapLen);
+    if (!pThis->pbRing || !pThis->pbScratch)
+        return VERR_NO_MEMORY;
+    for (uint32_t i = 0; i < cRecs; i++)
+        drvNetSnifferRec(pThis, i)->uSeq = i;
+
     /*
      * Query the network connector interface.
      */
@@ -479,31 +1333,46 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         AssertMsgFailed(("Failed to attach to driver below! rc=%Rrc\n", rc));
         return rc;
     }
+    drvNetSnifferUpdateSendSg(pThis);
 
     /*
-     * Open output file / pipe.
+     * Open output file / pipe and write the header.
      */
-    rc = RTFileOpen(&pThis->hFile, pThis->szFilename,
-                    RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    pThis->iFile = 1;
+    char szName[RTPATH_MAX];
+    rc = drvNetSnifferOpenFile(pThis, szName, sizeof(szName));
     if (RT_FAILURE(rc))
         return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
-                                   N_("Netsniffer cannot open '%s' for writing. The directory must exist and it must be writable for the current user"), pThis->szFilename);
+                                   N_("Netsniffer cannot open '%s' for writing. The directory must exist and it must be writable for the current user"), szName);
 
-    char *pszPathReal = RTPathRealDup(pThis->szFilename);
+    char *pszPathReal = RTPathRealDup(szName);
     if (pszPathReal)
     {
         LogRel(("NetSniffer: Sniffing to '%s'\n", pszPathReal));
         RTStrFree(pszPathReal);
     }
     else
-        LogRel(("NetSniffer: Sniffing to '%s'\n", pThis->szFilename));
+        LogRel(("NetSniffer: Sniffing to '%s'\n", szName));
+    LogRel(("NetSniffer: %s, snap length %u, %u ring records, %u filter terms\n",
+            pThis->fPcapng ? "pcapng" : "pcap", pThis->cbSnapLen, pThis->cRecs, pThis->cFilterTerms));
+
+    /*
+     * Start the writer thread.
+     */
+    rc = RTSemEventCreate(&pThis->hEvtWriter);
+    AssertRCReturn(rc, rc);
+    rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pWriterThread, pThis, drvNetSnifferWriterThread,
+                               drvNetSnifferWriterWakeUp, 0, RTTHREADTYPE_IO, "NetSniff");
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("NetSniffer: Failed to create the writer thread"));
 
     /*
-     * Write pcap header.
-     * Some time has gone by since capturing pThis->StartNanoTS so get the
-     * current time again.
+     * Statistics.
      */
-    PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatCaptured,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of frames captured.",                     "/Drivers/NetSniffer%u/Captured", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatFiltered,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of frames rejected by the filter.",       "/Drivers/NetSniffer%u/Filtered", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatDropped,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of frames dropped, the ring was full.",   "/Drivers/NetSniffer%u/Dropped", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRotations, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of capture file rotations.",              "/Drivers/NetSniffer%u/Rotations", pDrvIns->iInstance);
 
     return VINF_SUCCESS;
 }
@@ -28,8 +28,10 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/ctype.h>
+#include <iprt/err.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/path.h>
 #include <iprt/pipe.h>
 #include <iprt/semaphore.h>
@@ -43,6 +45,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
 #ifdef RT_OS_SOLARIS
 # include <sys/stat.h>
 # include <sys/ethernet.h>
@@ -117,6 +120,8 @@ typedef struct DRVTAP
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of packets sent straight from a caller owned S/G buffer. */
+    STAMCOUNTER             StatPktSentSg;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -144,6 +149,13 @@ static int              SolarisTAPAttach(PDRVTAP pThis);
 #endif
 
 
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The max number of I/O vector entries drvTAPNetworkUp_SendSg uses per frame. */
+#define DRVTAP_MAX_IOVECS       64
+
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -285,6 +297,143 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
 }
 
 
+/**
+ * Fills in I/O vector entries for a range of a scatter / gather buffer.
+ *
+ * @returns Number of entries used, 0 if @a cIovMax isn't sufficient or the
+ *          range is out of bounds.
+ * @param   pSgBuf          The scatter / gather buffer.
+ * @param   off             The offset into the buffer to start at.
+ * @param   cb              The number of bytes.
+ * @param   paIov           Where to store the I/O vector entries.
+ * @param   cIovMax         The max number of entries to use.
+ */
+static unsigned drvTAPSgToIoVec(PDMSCATTERGATHER const *pSgBuf, size_t off, size_t cb, struct iovec *paIov, unsigned cIovMax)
+{
+    unsigned cIov = 0;
+    for (size_t iSeg = 0; iSeg < pSgBuf->cSegs && cb > 0; iSeg++)
+    {
+        size_t const cbSeg = pSgBuf->aSegs[iSeg].cbSeg;
+        if (off >= cbSeg)
+        {
+            off -= cbSeg;
+            continue;
+        }
+        if (cIov >= cIovMax)
+            return 0;
+        size_t const cbThis = RT_MIN(cbSeg - off, cb);
+        paIov[cIov].iov_base = (uint8_t *)pSgBuf->aSegs[iSeg].pvSeg + off;
+        paIov[cIov].iov_len  = cbThis;
+        cIov++;
+        cb  -= cbThis;
+        off  = 0;
+    }
+    return cb == 0 ? cIov : 0;
+}
+
+
+/**
+ * Writes an I/O vector to the TAP device.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The TAP driver instance.
+ * @param   paIov           The I/O vector.
+ * @param   cIov            Number of entries.
+ */
+static int drvTAPWriteIoVec(PDRVTAP pThis, struct iovec *paIov, unsigned cIov)
+{
+    ssize_t cbWritten = writev((int)RTFileToNative(pThis->hFileDevice), paIov, (int)cIov);
+    if (cbWritten < 0)
+        return RTErrConvertFromErrno(errno);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendSg}
+ */
+static DECLCALLBACK(int) drvTAPNetworkUp_SendSg(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    PDRVTAP pThis = PDMINETWORKUP_2_DRVTAP(pInterface);
+    NOREF(fOnWorkerThread);
+    AssertPtr(pSgBuf);
+    Assert((pSgBuf->fFlags & PDMSCATTERGATHER_FLAGS_MAGIC_MASK) == PDMSCATTERGATHER_FLAGS_MAGIC);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+
+    /*
+     * Check that we can deal with the frame before doing anything.
+     */
+    struct iovec    aIov[DRVTAP_MAX_IOVECS];
+    unsigned        cIov = 0;
+    PCPDMNETWORKGSO pGso = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+    if (!pGso)
+    {
+        cIov = drvTAPSgToIoVec(pSgBuf, 0, pSgBuf->cbUsed, aIov, RT_ELEMENTS(aIov));
+        if (!cIov)
+            return VERR_NOT_SUPPORTED;
+    }
+    else if (   pSgBuf->aSegs[0].cbSeg < pGso->cbHdrsTotal
+             || (   pGso->u8Type != PDMNETWORKGSOTYPE_IPV4_TCP
+                 && pGso->u8Type != PDMNETWORKGSOTYPE_IPV6_TCP
+                 && pGso->u8Type != PDMNETWORKGSOTYPE_IPV4_IPV6_TCP))
+        return VERR_NOT_SUPPORTED;
+
+    STAM_COUNTER_INC(&pThis->StatPktSent);
+    STAM_COUNTER_INC(&pThis->StatPktSentSg);
+    STAM_COUNTER_ADD(&pThis->StatPktSentBytes, pSgBuf->cbUsed);
+    STAM_PROFILE_START(&pThis->StatTransmit, a);
+
+    /* Set an FTM checkpoint as this operation changes the state permanently. */
+    PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
+
+    int rc;
+    if (!pGso)
+        rc = drvTAPWriteIoVec(pThis, aIov, cIov);
+    else
+    {
+        /*
+         * Carve out the segments here so the payload can be written straight
+         * from the caller's buffer.  Only the headers are constructed, and the
+         * TCP checksum is calculated over the scattered payload.
+         */
+        uint8_t         abHdrs[256];
+        uint8_t const  *pbHdrs = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
+        uint32_t const  cSegs  = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+        rc = VINF_SUCCESS;
+        for (uint32_t iSeg = 0; iSeg < cSegs && RT_SUCCESS(rc); iSeg++)
+        {
+            uint32_t cbSegHdrs, cbSegPayload, u32Sum;
+            uint32_t offPayload = PDMNetGsoCarveSegmentHdrs(pGso, pbHdrs, pSgBuf->cbUsed, iSeg, cSegs, abHdrs,
+                                                            &cbSegHdrs, &cbSegPayload, &u32Sum);
+            aIov[0].iov_base = abHdrs;
+            aIov[0].iov_len  = cbSegHdrs;
+            cIov = drvTAPSgToIoVec(pSgBuf, offPayload, cbSegPayload, &aIov[1], RT_ELEMENTS(aIov) - 1);
+            if (!cIov)
+            {
+                AssertMsgFailed(("offPayload=%#x cbSegPayload=%#x cSegs=%u\n", offPayload, cbSegPayload, pSgBuf->cSegs));
+                rc = VERR_INVALID_PARAMETER;
+                break;
+            }
+
+            PRTNETTCP pTcpHdr = (PRTNETTCP)&abHdrs[pGso->offHdr2];
+            bool      fOdd    = false;
+            u32Sum = RTNetIPv4AddTCPChecksum(pTcpHdr, u32Sum);
+            for (unsigned i = 1; i <= cIov; i++)
+                u32Sum = RTNetIPv4AddDataChecksum(aIov[i].iov_base, aIov[i].iov_len, u32Sum, &fOdd);
+            pTcpHdr->th_sum = RTNetIPv4FinalizeChecksum(u32Sum);
+
+            rc = drvTAPWriteIoVec(pThis, aIov, cIov + 1);
+        }
+    }
+
+    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
+    AssertRC(rc);
+    if (RT_FAILURE(rc))
+        rc = rc == VERR_NO_MEMORY ? VERR_NET_NO_BUFFER_SPACE : VERR_NET_DOWN;
+    return rc;
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -870,6 +1019,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     pThis->INetworkUp.pfnEndXmit                = drvTAPNetworkUp_EndXmit;
     pThis->INetworkUp.pfnSetPromiscuousMode     = drvTAPNetworkUp_SetPromiscuousMode;
     pThis->INetworkUp.pfnNotifyLinkChanged      = drvTAPNetworkUp_NotifyLinkChanged;
+    pThis->INetworkUp.pfnSendSg                 = drvTAPNetworkUp_SendSg;
 
 #ifdef VBOX_WITH_STATISTICS
     /*
@@ -879,6 +1029,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentSg,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of packets sent from caller owned S/G buffers.", "/Drivers/TAP%d/Packets/SentSg", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -255,3 +255,184 @@ int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
     return VINF_SUCCESS;
 }
 
+
+
+/**
+ * Writes a frame with a given time stamp to a file.
+ *
+ * Unlike PcapFileFrame this doesn't sample the time itself, so it can be used
+ * for frames which were captured some time before they get written.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   cNsTS           The time stamp of the frame relative to the start
+ *                          of the capture, in nanoseconds.
+ * @param   pvData          The captured part of the frame.
+ * @param   cbData          The number of bytes captured.
+ * @param   cbFrame         The original size of the frame.
+ */
+int PcapFileFrameAt(RTFILE File, uint64_t cNsTS, const void *pvData, size_t cbData, size_t cbFrame)
+{
+    struct pcaprec_hdr Hdr;
+    Hdr.ts_sec   = (uint32_t)(cNsTS / 1000000000);
+    Hdr.ts_usec  = (uint32_t)((cNsTS / 1000) % 1000000);
+    Hdr.incl_len = (uint32_t)RT_MIN(cbData, cbFrame);
+    Hdr.orig_len = (uint32_t)cbFrame;
+    int rc1 = RTFileWrite(File, &Hdr, sizeof(Hdr), NULL);
+    int rc2 = RTFileWrite(File, pvData, Hdr.incl_len, NULL);
+    return RT_SUCCESS(rc1) ? rc2 : rc1;
+}
+
+
+/*
+ * pcapng (https://github.com/pcapng/pcapng) blocks.  We only write one
+ * section with a single ethernet interface using nanosecond time stamps.
+ */
+
+/** pcapng section header block type. */
+#define PCAPNG_BT_SHB               UINT32_C(0x0a0d0d0a)
+/** pcapng interface description block type. */
+#define PCAPNG_BT_IDB               UINT32_C(0x00000001)
+/** pcapng enhanced packet block type. */
+#define PCAPNG_BT_EPB               UINT32_C(0x00000006)
+/** pcapng byte order magic. */
+#define PCAPNG_BYTE_ORDER_MAGIC     UINT32_C(0x1a2b3c4d)
+
+/** pcapng section header block (without options). */
+struct pcapng_shb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_SHB */
+    uint32_t    block_len;      /* total block length */
+    uint32_t    byte_order;     /* PCAPNG_BYTE_ORDER_MAGIC */
+    uint16_t    version_major;  /* = 1 */
+    uint16_t    version_minor;  /* = 0 */
+    uint32_t    section_len_lo; /* = 0xffffffff, not specified */
+    uint32_t    section_len_hi; /* = 0xffffffff, not specified */
+    uint32_t    block_len2;     /* total block length */
+};
+
+/** pcapng interface description block with the if_tsresol option. */
+struct pcapng_idb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_IDB */
+    uint32_t    block_len;      /* total block length */
+    uint16_t    link_type;      /* data link type = 1 */
+    uint16_t    reserved;       /* = 0 */
+    uint32_t    snaplen;        /* max length of captured packets, in octets */
+    uint16_t    opt_tsresol;    /* if_tsresol = 9 */
+    uint16_t    opt_tsresol_len;/* = 1 */
+    uint8_t     tsresol;        /* = 9, i.e. 10^-9 seconds */
+    uint8_t     pad[3];
+    uint32_t    opt_end;        /* opt_endofopt */
+    uint32_t    block_len2;     /* total block length */
+};
+
+/** pcapng enhanced packet block header, followed by the padded packet data. */
+struct pcapng_epb_hdr
+{
+    uint32_t    block_type;     /* PCAPNG_BT_EPB */
+    uint32_t    block_len;      /* total block length */
+    uint32_t    if_id;          /* interface = 0 */
+    uint32_t    ts_high;        /* time stamp, upper 32 bits */
+    uint32_t    ts_low;         /* time stamp, lower 32 bits */
+    uint32_t    cap_len;        /* number of octets of packet saved in file */
+    uint32_t    orig_len;       /* actual length of packet */
+};
+
+/** pcapng enhanced packet block trailer with the epb_flags option. */
+struct pcapng_epb_tail
+{
+    uint16_t    opt_flags;      /* epb_flags = 2 */
+    uint16_t    opt_flags_len;  /* = 4 */
+    uint32_t    flags;          /* PCAPNG_EPB_FLAGS_XXX */
+    uint32_t    opt_end;        /* opt_endofopt */
+    uint32_t    block_len2;     /* total block length */
+};
+
+
+/**
+ * Writes the pcapng section header and interface description blocks.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   cbSnapLen       The max number of bytes captured per frame.
+ */
+int PcapngFileHdr(RTFILE File, uint32_t cbSnapLen)
+{
+    struct pcapng_shb Shb;
+    RT_ZERO(Shb);
+    Shb.block_type     = PCAPNG_BT_SHB;
+    Shb.block_len      = sizeof(Shb);
+    Shb.byte_order     = PCAPNG_BYTE_ORDER_MAGIC;
+    Shb.version_major  = 1;
+    Shb.version_minor  = 0;
+    Shb.section_len_lo = UINT32_MAX;
+    Shb.section_len_hi = UINT32_MAX;
+    Shb.block_len2     = sizeof(Shb);
+    AssertCompile(sizeof(Shb) == 28);
+
+    struct pcapng_idb Idb;
+    RT_ZERO(Idb);
+    Idb.block_type      = PCAPNG_BT_IDB;
+    Idb.block_len       = sizeof(Idb);
+    Idb.link_type       = 1;
+    Idb.snaplen         = cbSnapLen;
+    Idb.opt_tsresol     = 9;
+    Idb.opt_tsresol_len = 1;
+    Idb.tsresol         = 9;
+    Idb.block_len2      = sizeof(Idb);
+    AssertCompile(sizeof(Idb) == 32);
+
+    int rc = RTFileWrite(File, &Shb, sizeof(Shb), NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, &Idb, sizeof(Idb), NULL);
+    return rc;
+}
+
+
+/**
+ * Writes a frame with a given time stamp to a pcapng file.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   cNsTS           The time stamp of the frame relative to the start
+ *                          of the capture, in nanoseconds.
+ * @param   pvData          The captured part of the frame.
+ * @param   cbData          The number of bytes captured.
+ * @param   cbFrame         The original size of the frame.
+ * @param   fFlags          PCAPNG_EPB_FLAGS_INBOUND, PCAPNG_EPB_FLAGS_OUTBOUND
+ *                          or 0 if the direction is unknown.
+ */
+int PcapngFileFrameAt(RTFILE File, uint64_t cNsTS, const void *pvData, size_t cbData, size_t cbFrame, uint32_t fFlags)
+{
+    static const uint8_t s_abPad[4] = { 0, 0, 0, 0 };
+    uint32_t const cbIncl = (uint32_t)RT_MIN(cbData, cbFrame);
+    uint32_t const cbPad  = RT_ALIGN_32(cbIncl, 4) - cbIncl;
+
+    struct pcapng_epb_hdr  Hdr;
+    struct pcapng_epb_tail Tail;
+    Hdr.block_type     = PCAPNG_BT_EPB;
+    Hdr.block_len      = (uint32_t)(sizeof(Hdr) + cbIncl + cbPad + sizeof(Tail));
+    Hdr.if_id          = 0;
+    Hdr.ts_high        = (uint32_t)(cNsTS >> 32);
+    Hdr.ts_low         = (uint32_t)cNsTS;
+    Hdr.cap_len        = cbIncl;
+    Hdr.orig_len       = (uint32_t)cbFrame;
+    Tail.opt_flags     = 2;
+    Tail.opt_flags_len = 4;
+    Tail.flags         = fFlags;
+    Tail.opt_end       = 0;
+    Tail.block_len2    = Hdr.block_len;
+
+    int rc = RTFileWrite(File, &Hdr, sizeof(Hdr), NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, pvData, cbIncl, NULL);
+    if (RT_SUCCESS(rc) && cbPad)
+        rc = RTFileWrite(File, s_abPad, cbPad, NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, &Tail, sizeof(Tail), NULL);
+    return rc;
+}
@@ -32,6 +32,16 @@ int PcapFileHdr(RTFILE File, uint64_t StartNanoTS);
 int PcapFileFrame(RTFILE File, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax);
 int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                      const void *pvFrame, size_t cbFrame, size_t cbSegMax);
+int PcapFileFrameAt(RTFILE File, uint64_t cNsTS, const void *pvData, size_t cbData, size_t cbFrame);
+
+/** @name Enhanced packet block direction flags for PcapngFileFrameAt.
+ * @{ */
+#define PCAPNG_EPB_FLAGS_INBOUND    UINT32_C(0x00000001)
+#define PCAPNG_EPB_FLAGS_OUTBOUND   UINT32_C(0x00000002)
+/** @} */
+
+int PcapngFileHdr(RTFILE File, uint32_t cbSnapLen);
+int PcapngFileFrameAt(RTFILE File, uint64_t cNsTS, const void *pvData, size_t cbData, size_t cbFrame, uint32_t fFlags);
 
 RT_C_DECLS_END
 
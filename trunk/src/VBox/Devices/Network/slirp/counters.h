@@ -119,6 +119,8 @@ DRV_PROFILE_COUNTER(NATRecvWait,"Time spent in NATRecv worker in waiting of free
 DRV_COUNTING_COUNTER(QueuePktSent, "counting packet sent via PDM Queue");
 DRV_COUNTING_COUNTER(QueuePktDropped, "counting packet drops by PDM Queue");
 DRV_COUNTING_COUNTER(ConsumerFalse, "counting consumer's reject number to process the queue's item");
+DRV_COUNTING_COUNTER(NATGsoSegZeroCopy, "counting GSO segments handed to slirp in place");
+DRV_COUNTING_COUNTER(NATGsoSegCopied, "counting GSO segments copied into a separate mbuf");
 # endif
 #endif /*!COUNTERS_INIT*/
 
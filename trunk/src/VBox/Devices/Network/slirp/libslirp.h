@@ -163,6 +163,17 @@ void slirp_register_external_event(PNATState pData, HANDLE hEvent, int index);
 #endif /* RT_OS_WINDOWS */
 
 struct mbuf *slirp_ext_m_get(PNATState pData, size_t cbMin, void **ppvBuf, size_t *pcbBuf);
+/**
+ * Callback for releasing storage attached with slirp_ext_m_attach.
+ *
+ * @param   pvBuf       The buffer passed to slirp_ext_m_attach.
+ * @param   pvUser      The user argument passed to slirp_ext_m_attach.
+ */
+typedef void FNSLIRPEXTMFREE(void *pvBuf, void *pvUser);
+/** Pointer to a FNSLIRPEXTMFREE. */
+typedef FNSLIRPEXTMFREE *PFNSLIRPEXTMFREE;
+struct mbuf *slirp_ext_m_attach(PNATState pData, void *pvBuf, size_t cbBuf, volatile uint32_t *pcRefs,
+                                PFNSLIRPEXTMFREE pfnFree, void *pvUser);
 void slirp_ext_m_free(PNATState pData, struct mbuf *, uint8_t *pu8Buf);
 
 /*
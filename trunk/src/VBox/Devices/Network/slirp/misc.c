@@ -520,6 +520,28 @@ struct mbuf *slirp_ext_m_get(PNATState pData, size_t cbMin, void **ppvBuf, size_
     return m;
 }
 
+struct mbuf *slirp_ext_m_attach(PNATState pData, void *pvBuf, size_t cbBuf, volatile uint32_t *pcRefs,
+                                PFNSLIRPEXTMFREE pfnFree, void *pvUser)
+{
+    struct mbuf *m;
+    LogFlowFunc(("ENTER: pvBuf:%p, cbBuf:%d, pcRefs:%p, pfnFree:%p, pvUser:%p\n", pvBuf, cbBuf, pcRefs, pfnFree, pvUser));
+    Assert(pvBuf && pcRefs && pfnFree);
+
+    m = m_gethdr(pData, M_NOWAIT, MT_HEADER);
+    if (m == NULL)
+    {
+        LogFlowFunc(("LEAVE: NULL\n"));
+        return NULL;
+    }
+
+    /* The storage belongs to the caller, we only borrow it (EXT_EXTREF). */
+    m->m_ext.ref_cnt = pcRefs;
+    m_extadd(pData, m, (caddr_t)pvBuf, (u_int)cbBuf, pfnFree, pvUser, 0, EXT_EXTREF);
+    m->m_len = cbBuf;
+    LogFlowFunc(("LEAVE: %p\n", m));
+    return m;
+}
+
 void slirp_ext_m_free(PNATState pData, struct mbuf *m, uint8_t *pu8Buf)
 {
 
@@ -272,7 +272,10 @@ typedef struct HPET
     /** Whether we emulate ICH9 HPET (different frequency & timer count). */
     bool                        fIch9;
     /** Size alignment padding. */
-    uint8_t                     abPadding0[7];
+    uint8_t                     abPadding0[3];
+    /** Sequence counter for lock-free main counter reads.  Odd while
+     * u64HpetCounter, u64HpetOffset or HPET_CFG_ENABLE are being changed. */
+    uint32_t volatile           u32CounterSeq;
 } HPET;
 
 
@@ -312,6 +315,57 @@ DECLINLINE(uint64_t) hpetGetTicks(HPET const *pThis)
                          + pThis->u64HpetOffset);
 }
 
+/**
+ * Reads the main counter without taking any locks.
+ *
+ * The writers bump u32CounterSeq before and after changing the counter state
+ * (see hpetCounterUpdateBegin), so we just retry if it changed under us.
+ *
+ * @returns The main counter value.
+ * @param   pThis           The HPET state.
+ */
+static uint64_t hpetGetCounterLockless(HPET *pThis)
+{
+    for (;;)
+    {
+        uint32_t const uSeq = ASMAtomicReadU32(&pThis->u32CounterSeq);
+        if (!(uSeq & 1))
+        {
+            uint64_t u64Ticks;
+            if (ASMAtomicReadU64((uint64_t volatile *)&pThis->u64HpetConfig) & HPET_CFG_ENABLE)
+                u64Ticks = hpetGetTicks(pThis);
+            else
+                u64Ticks = ASMAtomicReadU64((uint64_t volatile *)&pThis->u64HpetCounter);
+            if (ASMAtomicReadU32(&pThis->u32CounterSeq) == uSeq)
+                return u64Ticks;
+        }
+        ASMNopPause();
+    }
+}
+
+/**
+ * Starts updating the main counter state (u64HpetCounter, u64HpetOffset or
+ * HPET_CFG_ENABLE), making lock-free readers retry.
+ *
+ * @param   pThis           The HPET state.
+ * @remarks Caller must own the device lock.
+ */
+DECLINLINE(void) hpetCounterUpdateBegin(HPET *pThis)
+{
+    Assert(PDMCritSectIsOwner(&pThis->CritSect));
+    ASMAtomicIncU32(&pThis->u32CounterSeq);
+}
+
+/**
+ * Ends an update started by hpetCounterUpdateBegin.
+ *
+ * @param   pThis           The HPET state.
+ */
+DECLINLINE(void) hpetCounterUpdateEnd(HPET *pThis)
+{
+    ASMAtomicIncU32(&pThis->u32CounterSeq);
+}
+
 DECLINLINE(uint64_t) hpetUpdateMasked(uint64_t u64NewValue, uint64_t u64OldValue, uint64_t u64Mask)
 {
     u64NewValue &= u64Mask;
@@ -660,15 +714,7 @@ static int hpetConfigRegRead32(HPET *pThis, uint32_t idxReg, uint32_t *pu32Value
         case HPET_COUNTER:
         case HPET_COUNTER + 4:
         {
-            DEVHPET_LOCK_BOTH_RETURN(pThis, VINF_IOM_R3_MMIO_READ);
-
-            uint64_t u64Ticks;
-            if (pThis->u64HpetConfig & HPET_CFG_ENABLE)
-                u64Ticks = hpetGetTicks(pThis);
-            else
-                u64Ticks = pThis->u64HpetCounter;
-
-            DEVHPET_UNLOCK_BOTH(pThis);
+            uint64_t u64Ticks = hpetGetCounterLockless(pThis);
 
             /** @todo is it correct? */
             u32Value = (idxReg == HPET_COUNTER) ? (uint32_t)u64Ticks : (uint32_t)(u64Ticks >> 32);
@@ -746,15 +792,16 @@ static int hpetConfigRegWrite32(HPET *pThis, uint32_t idxReg, uint32_t u32NewVal
                 }
             }
 
-            pThis->u64HpetConfig = hpetUpdateMasked(u32NewValue, iOldValue, HPET_CFG_WRITE_MASK);
-
             uint32_t const cTimers = HPET_CAP_GET_TIMERS(pThis->u32Capabilities);
             if (hpetBitJustSet(iOldValue, u32NewValue, HPET_CFG_ENABLE))
             {
 /** @todo Only get the time stamp once when reprogramming? */
                 /* Enable main counter and interrupt generation. */
+                hpetCounterUpdateBegin(pThis);
                 pThis->u64HpetOffset = hpetTicksToNs(pThis, pThis->u64HpetCounter)
                                      - TMTimerGet(pThis->aTimers[0].CTX_SUFF(pTimer));
+                pThis->u64HpetConfig = hpetUpdateMasked(u32NewValue, iOldValue, HPET_CFG_WRITE_MASK);
+                hpetCounterUpdateEnd(pThis);
                 for (uint32_t i = 0; i < cTimers; i++)
                     if (pThis->aTimers[i].u64Cmp != hpetInvalidValue(&pThis->aTimers[i]))
                         hpetProgramTimer(&pThis->aTimers[i]);
@@ -762,10 +809,15 @@ static int hpetConfigRegWrite32(HPET *pThis, uint32_t idxReg, uint32_t u32NewVal
             else if (hpetBitJustCleared(iOldValue, u32NewValue, HPET_CFG_ENABLE))
             {
                 /* Halt main counter and disable interrupt generation. */
+                hpetCounterUpdateBegin(pThis);
                 pThis->u64HpetCounter = hpetGetTicks(pThis);
+                pThis->u64HpetConfig = hpetUpdateMasked(u32NewValue, iOldValue, HPET_CFG_WRITE_MASK);
+                hpetCounterUpdateEnd(pThis);
                 for (uint32_t i = 0; i < cTimers; i++)
                     TMTimerStop(pThis->aTimers[i].CTX_SUFF(pTimer));
             }
+            else
+                pThis->u64HpetConfig = hpetUpdateMasked(u32NewValue, iOldValue, HPET_CFG_WRITE_MASK);
 
             DEVHPET_UNLOCK_BOTH(pThis);
             break;
@@ -803,7 +855,9 @@ static int hpetConfigRegWrite32(HPET *pThis, uint32_t idxReg, uint32_t u32NewVal
         case HPET_COUNTER:
         {
             DEVHPET_LOCK_RETURN(pThis, VINF_IOM_R3_MMIO_WRITE);
+            hpetCounterUpdateBegin(pThis);
             pThis->u64HpetCounter = RT_MAKE_U64(u32NewValue, RT_HI_U32(pThis->u64HpetCounter));
+            hpetCounterUpdateEnd(pThis);
             Log(("write HPET_COUNTER: %#x -> %llx\n", u32NewValue, pThis->u64HpetCounter));
             DEVHPET_UNLOCK(pThis);
             break;
@@ -812,7 +866,9 @@ static int hpetConfigRegWrite32(HPET *pThis, uint32_t idxReg, uint32_t u32NewVal
         case HPET_COUNTER + 4:
         {
             DEVHPET_LOCK_RETURN(pThis, VINF_IOM_R3_MMIO_WRITE);
+            hpetCounterUpdateBegin(pThis);
             pThis->u64HpetCounter = RT_MAKE_U64(RT_LO_U32(pThis->u64HpetCounter), u32NewValue);
+            hpetCounterUpdateEnd(pThis);
             Log(("write HPET_COUNTER + 4: %#x -> %llx\n", u32NewValue, pThis->u64HpetCounter));
             DEVHPET_UNLOCK(pThis);
             break;
@@ -870,13 +926,9 @@ PDMBOTHCBDECL(int)  hpetMMIORead(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS GCPh
         if (idxReg == HPET_COUNTER)
         {
             /* When reading HPET counter we must read it in a single read,
-               to avoid unexpected time jumps on 32-bit overflow. */
-            DEVHPET_LOCK_BOTH_RETURN(pThis, VINF_IOM_R3_MMIO_READ);
-            if (pThis->u64HpetConfig & HPET_CFG_ENABLE)
-                pValue->u = hpetGetTicks(pThis);
-            else
-                pValue->u = pThis->u64HpetCounter;
-            DEVHPET_UNLOCK_BOTH(pThis);
+               to avoid unexpected time jumps on 32-bit overflow.  This is
+               done without locking as it's frequently polled by all CPUs. */
+            pValue->u = hpetGetCounterLockless(pThis);
             rc = VINF_SUCCESS;
         }
         else
@@ -1397,7 +1449,7 @@ static DECLCALLBACK(int) hpetR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFG
      * addresses and sizes.
      */
     rc = PDMDevHlpMMIORegister(pDevIns, HPET_BASE, HPET_BAR_SIZE, pThis,
-                               IOMMMIO_FLAGS_READ_DWORD_QWORD | IOMMMIO_FLAGS_WRITE_ONLY_DWORD_QWORD,
+                               IOMMMIO_FLAGS_READ_DWORD_QWORD | IOMMMIO_FLAGS_WRITE_ONLY_DWORD_QWORD | IOMMMIO_FLAGS_NO_DEV_LOCK,
                                hpetMMIOWrite, hpetMMIORead, "HPET Memory");
     AssertRCReturn(rc, rc);
 
@@ -319,6 +319,10 @@ typedef struct AHCIREQ
     RTGCPHYS                   GCPhysPrdtl;
     /** Number of entries in the PRDTL. */
     unsigned                   cPrdtlEntries;
+    /** PRDTL entry the last copy through the extended media interface ended in. */
+    unsigned                   iPrdtlCursor;
+    /** Offset into the guest buffer the cursor entry starts at. */
+    uint32_t                   offPrdtlCursor;
     /** Data direction. */
     AHCITXDIR                  enmTxDir;
     /** Start offset. */
@@ -337,6 +341,9 @@ typedef struct AHCIREQ
     size_t                     cbAlloc;
     /** Number of times we had too much memory allocated for the request. */
     unsigned                   cAllocTooMuch;
+    /** The I/O request handle if the request is processed through the
+     * extended media interface, NULL otherwise. */
+    PDMMEDIAEXIOREQ            hIoReq;
     /** Data dependent on the transfer direction. */
     union
     {
@@ -377,6 +384,7 @@ typedef struct DEVPORTNOTIFIERQUEUEITEM
  * @implements PDMIBASE
  * @implements PDMIMEDIAPORT
  * @implements PDMIMEDIAASYNCPORT
+ * @implements PDMIMEDIAEXPORT
  * @implements PDMIMOUNTNOTIFY
  */
 typedef struct AHCIPort
@@ -425,8 +433,9 @@ typedef struct AHCIPort
     uint32_t                        regSERR;
     /** Serial ATA Active. */
     volatile uint32_t               regSACT;
-    /** Command Issue. */
-    uint32_t                        regCI;
+    /** Command Issue.  Updated atomically as the doorbell is written without
+     * holding any lock. */
+    volatile uint32_t               regCI;
 
     /** Current number of active tasks. */
     volatile uint32_t               cTasksActive;
@@ -510,12 +519,17 @@ typedef struct AHCIPort
     R3PTRTYPE(PPDMIMEDIAASYNC)      pDrvMediaAsync;
     /** Pointer to the attached driver's mount interface. */
     R3PTRTYPE(PPDMIMOUNT)           pDrvMount;
+    /** Pointer to the attached driver's extended media interface, only set
+     * if it is used for the data transfers of this port. */
+    R3PTRTYPE(PPDMIMEDIAEX)         pDrvMediaEx;
     /** The base interface. */
     PDMIBASE                        IBase;
     /** The block port interface. */
     PDMIMEDIAPORT                   IPort;
     /** The optional block async port interface. */
     PDMIMEDIAASYNCPORT              IPortAsync;
+    /** The extended media port interface. */
+    PDMIMEDIAEXPORT                 IMediaExPort;
     /** The mount notify interface. */
     PDMIMOUNTNOTIFY                 IMountNotify;
     /** Physical geometry of this image. */
@@ -568,8 +582,8 @@ typedef struct AHCIPort
     char                            szInquiryRevision[AHCI_ATAPI_INQUIRY_REVISION_LENGTH+1];
     /** Error counter */
     uint32_t                        cErrors;
-
-    uint32_t                        u32Alignment5;
+    /** The I/O request ID to use for the next request of the extended media interface. */
+    uint32_t                        u32IoReqIdNext;
 
     /** Critical section protecting the global free list. */
     RTCRITSECT                      CritSectReqsFree;
@@ -836,6 +850,8 @@ AssertCompileSize(SGLEntry, 16);
 #define AHCI_PORT_IS_PSS       RT_BIT(1)
 #define AHCI_PORT_IS_DHRS      RT_BIT(0)
 #define AHCI_PORT_IS_READONLY  0xfd8000af /* Readonly mask including reserved bits. */
+/** Command completion events which are subject to command completion coalescing. */
+#define AHCI_PORT_IS_CCC_MASK  (AHCI_PORT_IS_DHRS | AHCI_PORT_IS_PSS | AHCI_PORT_IS_DSS | AHCI_PORT_IS_SDBS | AHCI_PORT_IS_DPS)
 
 #define AHCI_PORT_IE_CPDE      RT_BIT(31)
 #define AHCI_PORT_IE_TFEE      RT_BIT(30)
@@ -963,7 +979,7 @@ static size_t ahciCopyFromPrdtl(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq,
                                 void *pvBuf, size_t cbBuf);
 static bool ahciCancelActiveTasks(PAHCIPort pAhciPort, PAHCIREQ pAhciReqExcept);
 static void ahciReqMemFree(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, bool fForceFree);
-static void ahciR3PortCachedReqsFree(PAHCIPort pAhciPort);
+static void ahciR3PortCachedReqsMemFree(PAHCIPort pAhciPort);
 #endif
 RT_C_DECLS_END
 
@@ -1018,6 +1034,20 @@ static void ahciHbaClearInterrupt(PAHCI pAhci)
     PDMDevHlpPCISetIrq(pAhci->CTX_SUFF(pDevIns), 0, 0);
 }
 
+/**
+ * Asserts the command completion coalescing interrupt and resets the
+ * coalescing state. The caller must hold the HBA lock.
+ */
+static void ahciHbaCccSetInterrupt(PAHCI pAhci)
+{
+    Log(("%s: Fire CCC interrupt after %u completions\n", __FUNCTION__, pAhci->uCccCurrentNr));
+
+    pAhci->uCccCurrentNr = 0;
+    ASMAtomicOrU32((volatile uint32_t *)&pAhci->u32PortsInterrupted, RT_BIT_32(pAhci->uCccPortNr));
+    if (!(pAhci->u32PortsInterrupted & ~RT_BIT_32(pAhci->uCccPortNr)))
+        PDMDevHlpPCISetIrq(pAhci->CTX_SUFF(pDevIns), 0, 1);
+}
+
 /**
  * Updates the IRQ level and sets port bit in the global interrupt status register of the HBA.
  */
@@ -1031,22 +1061,25 @@ static int ahciHbaSetInterrupt(PAHCI pAhci, uint8_t iPort, int rcBusy)
 
     if (pAhci->regHbaCtrl & AHCI_HBA_CTRL_IE)
     {
-        if ((pAhci->regHbaCccCtl & AHCI_HBA_CCC_CTL_EN) && (pAhci->regHbaCccPorts & (1 << iPort)))
+        /*
+         * Only command completions of the selected ports are coalesced, any other
+         * enabled event (errors, hotplug, etc.) is reported immediately.
+         */
+        if (   (pAhci->regHbaCccCtl & AHCI_HBA_CCC_CTL_EN)
+            && (pAhci->regHbaCccPorts & RT_BIT_32(iPort))
+            && !(  ASMAtomicReadU32(&pAhci->ahciPort[iPort].regIS) & pAhci->ahciPort[iPort].regIE
+                 & ~AHCI_PORT_IS_CCC_MASK))
         {
             pAhci->uCccCurrentNr++;
-            if (pAhci->uCccCurrentNr >= pAhci->uCccNr)
+            if (   pAhci->uCccNr
+                && pAhci->uCccCurrentNr >= pAhci->uCccNr)
             {
-                /* Reset command completion coalescing state. */
-                TMTimerSetMillies(pAhci->CTX_SUFF(pHbaCccTimer), pAhci->uCccTimeout);
-                pAhci->uCccCurrentNr = 0;
-
-                pAhci->u32PortsInterrupted |= (1 << pAhci->uCccPortNr);
-                if (!(pAhci->u32PortsInterrupted & ~(1 << pAhci->uCccPortNr)))
-                {
-                    Log(("P%u: %s: Fire interrupt\n", iPort, __FUNCTION__));
-                    PDMDevHlpPCISetIrq(pAhci->CTX_SUFF(pDevIns), 0, 1);
-                }
+                /* Count threshold reached, the timeout starts again with the next completion. */
+                TMTimerStop(pAhci->CTX_SUFF(pHbaCccTimer));
+                ahciHbaCccSetInterrupt(pAhci);
             }
+            else if (pAhci->uCccCurrentNr == 1)
+                TMTimerSetMillies(pAhci->CTX_SUFF(pHbaCccTimer), pAhci->uCccTimeout);
         }
         else
         {
@@ -1075,9 +1108,18 @@ static int ahciHbaSetInterrupt(PAHCI pAhci, uint8_t iPort, int rcBusy)
 static DECLCALLBACK(void) ahciCccTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void *pvUser)
 {
     PAHCI pAhci = (PAHCI)pvUser;
+    NOREF(pDevIns); NOREF(pTimer);
 
-    int rc = ahciHbaSetInterrupt(pAhci, pAhci->uCccPortNr, VERR_IGNORED);
+    int rc = PDMCritSectEnter(&pAhci->lock, VERR_IGNORED);
     AssertRC(rc);
+
+    /* The timer is armed on the first completion so there is always something to report unless CCC was disabled meanwhile. */
+    if (   (pAhci->regHbaCtrl & AHCI_HBA_CTRL_IE)
+        && (pAhci->regHbaCccCtl & AHCI_HBA_CCC_CTL_EN)
+        && pAhci->uCccCurrentNr)
+        ahciHbaCccSetInterrupt(pAhci);
+
+    PDMCritSectLeave(&pAhci->lock);
 }
 
 /**
@@ -1163,6 +1205,13 @@ static void ahciIoThreadKick(PAHCI pAhci, PAHCIPort pAhciPort)
 #endif
 }
 
+/**
+ * Write to the port command issue register (the doorbell).
+ *
+ * This is called without any lock held, several EMTs may ring the doorbell of
+ * the same port at the same time.  So regCI is only changed atomically and a
+ * command slot is handed to the I/O thread by the EMT which set it in regCI.
+ */
 static int PortCmdIssue_w(PAHCI ahci, PAHCIPort pAhciPort, uint32_t iReg, uint32_t u32Value)
 {
     uint32_t uCIValue;
@@ -1171,17 +1220,21 @@ static int PortCmdIssue_w(PAHCI ahci, PAHCIPort pAhciPort, uint32_t iReg, uint32
 
     /* Update the CI register first. */
     uCIValue = ASMAtomicXchgU32(&pAhciPort->u32TasksFinished, 0);
-    pAhciPort->regCI &= ~uCIValue;
+    ASMAtomicAndU32(&pAhciPort->regCI, ~uCIValue);
+
+    /*
+     * Mark the new tasks as busy, leaving out those which are already
+     * marked busy.  The guest shouldn't write already busy tasks actually.
+     */
+    uint32_t uCIOld;
+    do
+        uCIOld = ASMAtomicReadU32(&pAhciPort->regCI);
+    while (!ASMAtomicCmpXchgU32(&pAhciPort->regCI, uCIOld | u32Value, uCIOld));
+    u32Value &= ~uCIOld;
 
     if (   (pAhciPort->regCMD & AHCI_PORT_CMD_CR)
         && u32Value > 0)
     {
-        /*
-         * Clear all tasks which are already marked as busy. The guest
-         * shouldn't write already busy tasks actually.
-         */
-        u32Value &= ~pAhciPort->regCI;
-
         ASMAtomicOrU32(&pAhciPort->u32TasksNew, u32Value);
 
         /* Send a notification to R3 if u32TasksNew was 0 before our write. */
@@ -1189,8 +1242,6 @@ static int PortCmdIssue_w(PAHCI ahci, PAHCIPort pAhciPort, uint32_t iReg, uint32
             ahciIoThreadKick(ahci, pAhciPort);
     }
 
-    pAhciPort->regCI |= u32Value;
-
     return VINF_SUCCESS;
 }
 
@@ -1202,9 +1253,9 @@ static int PortCmdIssue_r(PAHCI ahci, PAHCIPort pAhciPort, uint32_t iReg, uint32
 
     ahciLog(("%s: read regCI=%#010x uCIValue=%#010x\n", __FUNCTION__, pAhciPort->regCI, uCIValue));
 
-    pAhciPort->regCI &= ~uCIValue;
+    ASMAtomicAndU32(&pAhciPort->regCI, ~uCIValue);
 
-    *pu32Value = pAhciPort->regCI;
+    *pu32Value = ASMAtomicReadU32(&pAhciPort->regCI);
 
     return VINF_SUCCESS;
 }
@@ -1891,21 +1942,33 @@ static int HbaCccCtl_w(PAHCI ahci, uint32_t iReg, uint32_t u32Value)
          __FUNCTION__, AHCI_HBA_CCC_CTL_TV_GET(u32Value), AHCI_HBA_CCC_CTL_CC_GET(u32Value),
          AHCI_HBA_CCC_CTL_INT_GET(u32Value), (u32Value & AHCI_HBA_CCC_CTL_EN)));
 
-    ahci->regHbaCccCtl = u32Value;
-    ahci->uCccTimeout  = AHCI_HBA_CCC_CTL_TV_GET(u32Value);
-    ahci->uCccPortNr   = AHCI_HBA_CCC_CTL_INT_GET(u32Value);
-    ahci->uCccNr       = AHCI_HBA_CCC_CTL_CC_GET(u32Value);
+    int rc = PDMCritSectEnter(&ahci->lock, VINF_IOM_R3_MMIO_WRITE);
+    if (rc != VINF_SUCCESS)
+        return rc;
 
-    if (u32Value & AHCI_HBA_CCC_CTL_EN)
+    /*
+     * The timeout and count can only be changed while coalescing is disabled,
+     * the interrupt vector is chosen by the HBA and read only.
+     */
+    if (!(ahci->regHbaCccCtl & AHCI_HBA_CCC_CTL_EN))
     {
-        /* Arm the timer */
-        TMTimerSetMillies(ahci->CTX_SUFF(pHbaCccTimer), ahci->uCccTimeout);
+        ahci->uCccTimeout  = AHCI_HBA_CCC_CTL_TV_GET(u32Value);
+        ahci->uCccNr       = AHCI_HBA_CCC_CTL_CC_GET(u32Value);
     }
-    else
+
+    ahci->regHbaCccCtl = AHCI_HBA_CCC_CTL_TV_SET(ahci->uCccTimeout)
+                       | AHCI_HBA_CCC_CTL_CC_SET(ahci->uCccNr)
+                       | AHCI_HBA_CCC_CTL_INT_SET(ahci->uCccPortNr)
+                       | (u32Value & AHCI_HBA_CCC_CTL_EN);
+
+    /* The timer is armed with the first coalesced completion. */
+    if (!(u32Value & AHCI_HBA_CCC_CTL_EN))
     {
         TMTimerStop(ahci->CTX_SUFF(pHbaCccTimer));
+        ahci->uCccCurrentNr = 0;
     }
 
+    PDMCritSectLeave(&ahci->lock);
     return VINF_SUCCESS;
 }
 
@@ -1930,7 +1993,7 @@ static int HbaCccPorts_w(PAHCI ahci, uint32_t iReg, uint32_t u32Value)
 {
     Log(("%s: write u32Value=%#010x\n", __FUNCTION__, u32Value));
 
-    ahci->regHbaCccPorts = u32Value;
+    ahci->regHbaCccPorts = u32Value & ahci->regHbaPi;
 
     return VINF_SUCCESS;
 }
@@ -2137,12 +2200,9 @@ static void ahciHBAReset(PAHCI pThis)
     LogRel(("AHCI#%u: Reset the HBA\n", pThis->CTX_SUFF(pDevIns)->iInstance));
 
     /* Stop the CCC timer. */
-    if (pThis->regHbaCccCtl & AHCI_HBA_CCC_CTL_EN)
-    {
-        rc = TMTimerStop(pThis->CTX_SUFF(pHbaCccTimer));
-        if (RT_FAILURE(rc))
-            AssertMsgFailed(("%s: Failed to stop timer!\n", __FUNCTION__));
-    }
+    rc = TMTimerStop(pThis->CTX_SUFF(pHbaCccTimer));
+    if (RT_FAILURE(rc))
+        AssertMsgFailed(("%s: Failed to stop timer!\n", __FUNCTION__));
 
     /* Reset every port */
     for (i = 0; i < pThis->cPortsImpl; i++)
@@ -2165,11 +2225,14 @@ static void ahciHBAReset(PAHCI pThis)
     pThis->regHbaCtrl     = AHCI_HBA_CTRL_AE;
     pThis->regHbaPi       = ahciGetPortsImplemented(pThis->cPortsImpl);
     pThis->regHbaVs       = AHCI_HBA_VS_MJR | AHCI_HBA_VS_MNR;
-    pThis->regHbaCccCtl   = 0;
     pThis->regHbaCccPorts = 0;
-    pThis->uCccTimeout    = 0;
-    pThis->uCccPortNr     = 0;
-    pThis->uCccNr         = 0;
+    pThis->uCccTimeout    = 1;
+    pThis->uCccPortNr     = pThis->cPortsImpl; /* First unimplemented port. */
+    pThis->uCccNr         = 1;
+    pThis->uCccCurrentNr  = 0;
+    pThis->regHbaCccCtl   =   AHCI_HBA_CCC_CTL_TV_SET(pThis->uCccTimeout)
+                            | AHCI_HBA_CCC_CTL_CC_SET(pThis->uCccNr)
+                            | AHCI_HBA_CCC_CTL_INT_SET(pThis->uCccPortNr);
 
     /* Clear pending interrupts. */
     pThis->regHbaIs            = 0;
@@ -2530,7 +2593,7 @@ static DECLCALLBACK(int) ahciR3MMIOMap(PPCIDEVICE pPciDev, /*unsigned*/ int iReg
     /** @todo change this to IOMMMIO_FLAGS_WRITE_ONLY_DWORD once EM/IOM starts
      * handling 2nd DWORD failures on split accesses correctly. */
     rc = PDMDevHlpMMIORegister(pDevIns, GCPhysAddress, cb, NULL /*pvUser*/,
-                               IOMMMIO_FLAGS_READ_DWORD | IOMMMIO_FLAGS_WRITE_ONLY_DWORD_QWORD,
+                               IOMMMIO_FLAGS_READ_DWORD | IOMMMIO_FLAGS_WRITE_ONLY_DWORD_QWORD | IOMMMIO_FLAGS_NO_DEV_LOCK,
                                ahciMMIOWrite, ahciMMIORead, "AHCI");
     if (RT_FAILURE(rc))
         return rc;
@@ -2672,6 +2735,7 @@ static DECLCALLBACK(void *) ahciR3PortQueryInterface(PPDMIBASE pInterface, const
     PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBASE, &pAhciPort->IBase);
     PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAPORT, &pAhciPort->IPort);
     PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAASYNCPORT, &pAhciPort->IPortAsync);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAEXPORT, &pAhciPort->IMediaExPort);
     PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMOUNTNOTIFY, &pAhciPort->IMountNotify);
     return NULL;
 }
@@ -4663,7 +4727,7 @@ static AHCITXDIR atapiParseCmdVirtualATAPI(PAHCIPort pAhciPort, PAHCIREQ pAhciRe
                      * because the driver providing I/O memory allocation interface
                      * is about to be destroyed.
                      */
-                    ahciR3PortCachedReqsFree(pAhciPort);
+                    ahciR3PortCachedReqsMemFree(pAhciPort);
 
                     /*
                      * Also make sure that the current request has no memory allocated
@@ -5620,6 +5684,98 @@ static size_t ahciCopyFromPrdtl(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq,
     return cbCopied;
 }
 
+/**
+ * Copies data between the S/G buffer set up by the guest and the given S/G buffer
+ * starting at the given offset into the guest buffer.
+ *
+ * The driver copies the data in chunks with increasing offsets, so the entry the
+ * previous copy ended in is remembered in the request to avoid walking the PRDTL
+ * from the start for every chunk.
+ *
+ * @returns Amount of bytes copied.
+ * @param   pDevIns        Pointer to the device instance data.
+ * @param   pAhciReq       AHCI request structure.
+ * @param   offPrdtl       Offset into the guest buffer to start copying at.
+ * @param   pSgBuf         The S/G buffer to copy from or to.
+ * @param   cbCopy         Amount of bytes to copy.
+ * @param   fToGuest       Flag whether to copy from the S/G buffer into the guest buffer
+ *                         or the other way around.
+ */
+static size_t ahciR3PrdtlCopySgBuf(PPDMDEVINS pDevIns, PAHCIREQ pAhciReq, uint32_t offPrdtl,
+                                   PRTSGBUF pSgBuf, size_t cbCopy, bool fToGuest)
+{
+    SGLEntry aPrdtlEntries[32];
+    size_t cbCopied = 0;
+
+    /* Start over if the offset is before the cursor. */
+    if (offPrdtl < pAhciReq->offPrdtlCursor)
+    {
+        pAhciReq->iPrdtlCursor   = 0;
+        pAhciReq->offPrdtlCursor = 0;
+    }
+
+    unsigned iPrdtl = pAhciReq->iPrdtlCursor;
+    uint32_t offEntry = pAhciReq->offPrdtlCursor; /* Guest buffer offset of entry iPrdtl. */
+    RTGCPHYS GCPhysPrdtl = pAhciReq->GCPhysPrdtl + iPrdtl * sizeof(SGLEntry);
+    unsigned cPrdtlEntries = pAhciReq->cPrdtlEntries - RT_MIN(iPrdtl, pAhciReq->cPrdtlEntries);
+
+    offPrdtl -= offEntry;
+
+    while (   cPrdtlEntries
+           && cbCopy)
+    {
+        uint32_t cPrdtlEntriesRead = RT_MIN(cPrdtlEntries, RT_ELEMENTS(aPrdtlEntries));
+
+        PDMDevHlpPhysRead(pDevIns, GCPhysPrdtl, &aPrdtlEntries[0], cPrdtlEntriesRead * sizeof(SGLEntry));
+
+        for (uint32_t i = 0; (i < cPrdtlEntriesRead) && cbCopy; i++)
+        {
+            RTGCPHYS GCPhysAddrDataBase = AHCI_RTGCPHYS_FROM_U32(aPrdtlEntries[i].u32DBAUp, aPrdtlEntries[i].u32DBA);
+            uint32_t cbThisEntry = (aPrdtlEntries[i].u32DescInf & SGLENTRY_DESCINF_DBC) + 1;
+
+            /* Remember where this entry starts, the next chunk most likely continues here. */
+            pAhciReq->iPrdtlCursor   = iPrdtl;
+            pAhciReq->offPrdtlCursor = offEntry;
+            iPrdtl++;
+            offEntry += cbThisEntry;
+
+            /* Skip entries before the start offset. */
+            if (offPrdtl >= cbThisEntry)
+            {
+                offPrdtl -= cbThisEntry;
+                continue;
+            }
+
+            GCPhysAddrDataBase += offPrdtl;
+            size_t cbThisCopy = RT_MIN(cbThisEntry - offPrdtl, cbCopy);
+            offPrdtl = 0;
+
+            while (cbThisCopy)
+            {
+                size_t cbSeg = cbThisCopy;
+                void *pvSeg = RTSgBufGetNextSegment(pSgBuf, &cbSeg);
+                if (!pvSeg)
+                    return cbCopied;
+
+                if (fToGuest)
+                    PDMDevHlpPCIPhysWrite(pDevIns, GCPhysAddrDataBase, pvSeg, cbSeg);
+                else
+                    PDMDevHlpPhysRead(pDevIns, GCPhysAddrDataBase, pvSeg, cbSeg);
+
+                GCPhysAddrDataBase += cbSeg;
+                cbThisCopy         -= cbSeg;
+                cbCopy             -= cbSeg;
+                cbCopied           += cbSeg;
+            }
+        }
+
+        GCPhysPrdtl   += cPrdtlEntriesRead * sizeof(SGLEntry);
+        cPrdtlEntries -= cPrdtlEntriesRead;
+    }
+
+    return cbCopied;
+}
+
 /**
  * Allocate I/O memory and copies the guest buffer for writes.
  *
@@ -5664,6 +5820,10 @@ static void ahciIoBufFree(PAHCIPort pAhciPort, PAHCIREQ pAhciReq,
               || pAhciReq->enmTxDir == AHCITXDIR_WRITE,
               ("Freeing I/O memory for a non I/O request is not allowed\n"));
 
+    /* The data was transfered directly by the driver below, nothing to do. */
+    if (pAhciReq->hIoReq)
+        return;
+
     if (   pAhciReq->enmTxDir == AHCITXDIR_READ
         && fCopyToGuest)
     {
@@ -5691,6 +5851,50 @@ static void ahciIoBufFree(PAHCIPort pAhciPort, PAHCIREQ pAhciReq,
 }
 
 
+/**
+ * Fills the free list of the given port with a request for every command slot
+ * so the I/O path doesn't need to allocate memory for them.
+ *
+ * @returns VBox status code.
+ * @param   pAhciPort    The AHCI port.
+ */
+static int ahciR3PortReqsPoolCreate(PAHCIPort pAhciPort)
+{
+    for (unsigned i = 0; i < AHCI_NR_COMMAND_SLOTS; i++)
+    {
+        PAHCIREQ pAhciReq = (PAHCIREQ)RTMemAllocZ(sizeof(AHCIREQ));
+        if (!pAhciReq)
+            return VERR_NO_MEMORY;
+
+        pAhciReq->enmTxState = AHCITXSTATE_FREE;
+        RTListAppend(pAhciPort->pListReqsFree, &pAhciReq->NodeList);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Frees the I/O buffers of all cached tasks on the given port but keeps the
+ * tasks itself for later use.
+ *
+ * @returns nothing.
+ * @param   pAhciPort    The AHCI port.
+ */
+static void ahciR3PortCachedReqsMemFree(PAHCIPort pAhciPort)
+{
+    if (pAhciPort->pListReqsFree)
+    {
+        PAHCIREQ pReq = NULL;
+
+        RTCritSectEnter(&pAhciPort->CritSectReqsFree);
+        RTListForEach(pAhciPort->pListReqsFree, pReq, AHCIREQ, NodeList)
+        {
+            ahciReqMemFree(pAhciPort, pReq, true /* fForceFree */);
+        }
+        RTCritSectLeave(&pAhciPort->CritSectReqsFree);
+    }
+}
+
 /**
  * Free all cached tasks on the given port.
  *
@@ -5958,6 +6162,8 @@ static void ahciTrimRangesDestroy(PAHCIREQ pAhciReq)
 {
     AssertReturnVoid(pAhciReq->enmTxDir == AHCITXDIR_TRIM);
     RTMemFree(pAhciReq->u.Trim.paRanges);
+    pAhciReq->u.Trim.paRanges = NULL;
+    pAhciReq->u.Trim.cRanges  = 0;
 }
 
 /**
@@ -6223,6 +6429,13 @@ static bool ahciTransferComplete(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, int rcR
         ASMAtomicDecU32(&pAhciPort->cTasksActive);
     }
 
+    /* The I/O request of the driver is not needed anymore, even if the request is kept for the error log page. */
+    if (pAhciReq->hIoReq)
+    {
+        pAhciPort->pDrvMediaEx->pfnIoReqFree(pAhciPort->pDrvMediaEx, pAhciReq->hIoReq);
+        pAhciReq->hIoReq = NULL;
+    }
+
     if (pAhciPort->cTasksActive == 0 && pAhciPort->pAhciR3->fSignalIdle)
         PDMDevHlpAsyncNotificationCompleted(pAhciPort->pDevInsR3);
 
@@ -6255,6 +6468,87 @@ static DECLCALLBACK(int) ahciR3TransferCompleteNotify(PPDMIMEDIAASYNCPORT pInter
     return VINF_SUCCESS;
 }
 
+/* -=-=-=-=- IMediaExPort -=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCompleteNotify}
+ */
+static DECLCALLBACK(int) ahciR3IoReqCompleteNotify(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                   void *pvIoReqAlloc, int rcReq)
+{
+    PAHCIPort pAhciPort = RT_FROM_MEMBER(pInterface, AHCIPort, IMediaExPort);
+    PAHCIREQ pAhciReq = *(PAHCIREQ *)pvIoReqAlloc;
+
+    ahciLog(("%s: pInterface=%p hIoReq=%p uTag=%u\n",
+             __FUNCTION__, pInterface, hIoReq, pAhciReq->uTag));
+    Assert(pAhciReq->hIoReq == hIoReq); NOREF(hIoReq);
+
+    ahciTransferComplete(pAhciPort, pAhciReq, rcReq);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyFromBuf}
+ */
+static DECLCALLBACK(int) ahciR3IoReqCopyFromBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                void *pvIoReqAlloc, uint32_t offDst, PRTSGBUF pSgBuf,
+                                                size_t cbCopy)
+{
+    PAHCIPort pAhciPort = RT_FROM_MEMBER(pInterface, AHCIPort, IMediaExPort);
+    PAHCIREQ pAhciReq = *(PAHCIREQ *)pvIoReqAlloc;
+    NOREF(hIoReq);
+
+    /*
+     * Don't touch guest memory for a canceled request, the guest might use it for
+     * other things already because it doesn't know about that task anymore.
+     */
+    if (   ASMAtomicReadPtrT(&pAhciPort->aActiveTasks[pAhciReq->uTag], PAHCIREQ) != pAhciReq
+        || ASMAtomicReadBool(&pAhciPort->fPortReset))
+        return VINF_SUCCESS;
+
+    size_t cbCopied = ahciR3PrdtlCopySgBuf(pAhciPort->CTX_SUFF(pDevIns), pAhciReq, offDst, pSgBuf, cbCopy,
+                                           true /* fToGuest */);
+    if (cbCopied < cbCopy)
+        pAhciReq->fFlags |= AHCI_REQ_OVERFLOW;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyToBuf}
+ */
+static DECLCALLBACK(int) ahciR3IoReqCopyToBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                              void *pvIoReqAlloc, uint32_t offSrc, PRTSGBUF pSgBuf,
+                                              size_t cbCopy)
+{
+    PAHCIPort pAhciPort = RT_FROM_MEMBER(pInterface, AHCIPort, IMediaExPort);
+    PAHCIREQ pAhciReq = *(PAHCIREQ *)pvIoReqAlloc;
+    NOREF(hIoReq);
+
+    /*
+     * A too small guest buffer results in the overflow status like with the
+     * intermediate buffer, the remaining data is undefined.
+     */
+    size_t cbCopied = ahciR3PrdtlCopySgBuf(pAhciPort->CTX_SUFF(pDevIns), pAhciReq, offSrc, pSgBuf, cbCopy,
+                                           false /* fToGuest */);
+    if (cbCopied < cbCopy)
+        pAhciReq->fFlags |= AHCI_REQ_OVERFLOW;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqStateChanged}
+ */
+static DECLCALLBACK(void) ahciR3IoReqStateChanged(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                  void *pvIoReqAlloc, PDMMEDIAEXIOREQSTATE enmState)
+{
+    /* Requests are not suspended by the driver, recoverable errors are handled by the redo logic of the port. */
+    NOREF(pInterface); NOREF(hIoReq); NOREF(pvIoReqAlloc); NOREF(enmState);
+    AssertMsgFailed(("Unexpected state change to %d\n", enmState));
+}
+
 /**
  * Process an non read/write ATA command.
  *
@@ -6496,7 +6790,7 @@ static AHCITXDIR ahciProcessCmd(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, uint8_t
                                 ahciReqMemFree(pAhciPort, pTaskErr, true /* fForceFree */);
 
                             /* Finally free the error task state structure because it is completely unused now. */
-                            RTMemFree(pTaskErr);
+                            ahciR3ReqFree(pAhciPort, pTaskErr);
                         }
 
                         /*
@@ -6627,6 +6921,8 @@ static bool ahciPortTaskGetCommandFis(PAHCIPort pAhciPort, PAHCIREQ pAhciReq)
 
     pAhciReq->GCPhysPrdtl = AHCI_RTGCPHYS_FROM_U32(pAhciReq->cmdHdr.u32CmdTblAddrUp, pAhciReq->cmdHdr.u32CmdTblAddr) + AHCI_CMDHDR_PRDT_OFFSET;
     pAhciReq->cPrdtlEntries = AHCI_CMDHDR_PRDTL_ENTRIES(pAhciReq->cmdHdr.u32DescInf);
+    pAhciReq->iPrdtlCursor = 0;
+    pAhciReq->offPrdtlCursor = 0;
 
 #ifdef LOG_ENABLED
     /* Print some infos about the FIS. */
@@ -6666,7 +6962,51 @@ static bool ahciR3ReqSubmit(PAHCIPort pAhciPort, PAHCIREQ pAhciReq, AHCITXDIR en
     int rc = VINF_SUCCESS;
     bool fReqCanceled = false;
 
-    if (pAhciPort->fAsyncInterface)
+    if (pAhciPort->pDrvMediaEx)
+    {
+        PPDMIMEDIAEX pIf = pAhciPort->pDrvMediaEx;
+        void *pvIoReqAlloc = NULL;
+
+        VBOXDD_AHCI_REQ_SUBMIT(pAhciReq, pAhciReq->enmTxDir, pAhciReq->uOffset, pAhciReq->cbTransfer);
+        VBOXDD_AHCI_REQ_SUBMIT_TIMESTAMP(pAhciReq, pAhciReq->tsStart);
+
+        /* The ID only needs to be unique among the outstanding requests of this port. */
+        rc = pIf->pfnIoReqAlloc(pIf, &pAhciReq->hIoReq, &pvIoReqAlloc, pAhciPort->u32IoReqIdNext++,
+                                PDMIMEDIAEX_F_DEFAULT);
+        if (RT_SUCCESS(rc))
+        {
+            *(PAHCIREQ *)pvIoReqAlloc = pAhciReq;
+
+            if (enmTxDir == AHCITXDIR_FLUSH)
+                rc = pIf->pfnIoReqFlush(pIf, pAhciReq->hIoReq);
+            else if (enmTxDir == AHCITXDIR_TRIM)
+            {
+                rc = ahciTrimRangesCreate(pAhciPort, pAhciReq);
+                if (RT_SUCCESS(rc))
+                {
+                    pAhciPort->Led.Asserted.s.fWriting = pAhciPort->Led.Actual.s.fWriting = 1;
+                    rc = pIf->pfnIoReqDiscard(pIf, pAhciReq->hIoReq, pAhciReq->u.Trim.paRanges,
+                                              pAhciReq->u.Trim.cRanges);
+                }
+            }
+            else if (enmTxDir == AHCITXDIR_READ)
+            {
+                pAhciPort->Led.Asserted.s.fReading = pAhciPort->Led.Actual.s.fReading = 1;
+                rc = pIf->pfnIoReqRead(pIf, pAhciReq->hIoReq, pAhciReq->uOffset, pAhciReq->cbTransfer);
+            }
+            else
+            {
+                pAhciPort->Led.Asserted.s.fWriting = pAhciPort->Led.Actual.s.fWriting = 1;
+                rc = pIf->pfnIoReqWrite(pIf, pAhciReq->hIoReq, pAhciReq->uOffset, pAhciReq->cbTransfer);
+            }
+        }
+        else
+            pAhciReq->hIoReq = NULL;
+
+        if (rc != VINF_PDM_MEDIAEX_IOREQ_IN_PROGRESS)
+            fReqCanceled = ahciTransferComplete(pAhciPort, pAhciReq, rc);
+    }
+    else if (pAhciPort->fAsyncInterface)
     {
         VBOXDD_AHCI_REQ_SUBMIT(pAhciReq, pAhciReq->enmTxDir, pAhciReq->uOffset, pAhciReq->cbTransfer);
         VBOXDD_AHCI_REQ_SUBMIT_TIMESTAMP(pAhciReq, pAhciReq->tsStart);
@@ -6929,6 +7269,7 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
             {
                 pAhciReq->uTag          = idx;
                 pAhciReq->fFlags        = 0;
+                pAhciReq->hIoReq        = NULL;
 
                 bool fContinue = ahciR3CmdPrepare(pAhciPort, pAhciReq);
                 if (fContinue)
@@ -6943,7 +7284,11 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
                         {
                             STAM_REL_COUNTER_INC(&pAhciPort->StatDMA);
 
-                            rc = ahciIoBufAllocate(pAhciPort, pAhciReq, pAhciReq->cbTransfer);
+                            /* The extended media interface copies the data itself. */
+                            if (!pAhciPort->pDrvMediaEx)
+                                rc = ahciIoBufAllocate(pAhciPort, pAhciReq, pAhciReq->cbTransfer);
+                            else
+                                rc = VINF_SUCCESS;
                             if (RT_FAILURE(rc))
                             {
                                 /* In case we can't allocate enough memory fail the request with an overflow error. */
@@ -6971,6 +7316,7 @@ static DECLCALLBACK(int) ahciAsyncIOLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
                 AHCIREQ Req;
                 Req.uTag   = idx;
                 Req.fFlags = AHCI_REQ_IS_ON_STACK;
+                Req.hIoReq = NULL;
 
                 bool fContinue = ahciR3CmdPrepare(pAhciPort, &Req);
                 if (fContinue)
@@ -7629,8 +7975,8 @@ static DECLCALLBACK(void) ahciR3UnmountNotify(PPDMIMOUNTNOTIFY pInterface)
     PAHCIPort pAhciPort = PDMIMOUNTNOTIFY_2_PAHCIPORT(pInterface);
     Log(("%s:\n", __FUNCTION__));
 
-    /* Free all cached I/O tasks. */
-    ahciR3PortCachedReqsFree(pAhciPort);
+    /* Free the I/O buffers of all cached tasks, the tasks are kept for the next medium. */
+    ahciR3PortCachedReqsMemFree(pAhciPort);
 
     pAhciPort->cTotalSectors = 0;
 
@@ -7712,6 +8058,31 @@ static int ahciR3ConfigureLUN(PPDMDEVINS pDevIns, PAHCIPort pAhciPort)
                                    N_("AHCI initialisation error: Failed to allocate memory for free request list"));
 
     RTListInit(pAhciPort->pListReqsFree);
+    rc = ahciR3PortReqsPoolCreate(pAhciPort);
+    if (RT_FAILURE(rc))
+        return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                   N_("AHCI initialisation error: Failed to allocate the request pool"));
+
+    /*
+     * Use the extended media interface for the data transfers of disks if available,
+     * the data is copied straight between the guest buffer and the driver then.
+     * CD/DVD drives need the intermediate buffer for the sector format conversions.
+     */
+    pAhciPort->pDrvMediaEx = NULL;
+    if (   enmType == PDMMEDIATYPE_HARD_DISK
+        && pAhciPort->pDrvMediaAsync)
+    {
+        PPDMIMEDIAEX pDrvMediaEx = PDMIBASE_QUERY_INTERFACE(pAhciPort->pDrvBase, PDMIMEDIAEX);
+        if (pDrvMediaEx)
+        {
+            rc = pDrvMediaEx->pfnIoReqAllocSizeSet(pDrvMediaEx, sizeof(PAHCIREQ));
+            if (RT_FAILURE(rc))
+                return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                           N_("AHCI configuration error: LUN#%u: Failed to set I/O request size!"),
+                                           pAhciPort->iLUN);
+            pAhciPort->pDrvMediaEx = pDrvMediaEx;
+        }
+    }
 
     if (pAhciPort->fATAPI)
     {
@@ -7776,11 +8147,11 @@ static DECLCALLBACK(bool) ahciR3IsAsyncSuspendOrPowerOffDone(PPDMDEVINS pDevIns)
     PAHCI pThis = PDMINS_2_DATA(pDevIns, PAHCI);
     ASMAtomicWriteBool(&pThis->fSignalIdle, false);
     /*
-     * Free all cached tasks here, not possible on destruct because the driver
-     * is destroyed before us.
+     * Free the I/O buffers of all cached tasks here, not possible on destruct because
+     * the driver is destroyed before us. The tasks are kept for the next resume.
      */
     for (unsigned iPort = 0; iPort < pThis->cPortsImpl; iPort++)
-        ahciR3PortCachedReqsFree(&pThis->ahciPort[iPort]);
+        ahciR3PortCachedReqsMemFree(&pThis->ahciPort[iPort]);
     return true;
 }
 
@@ -7797,11 +8168,11 @@ static void ahciR3SuspendOrPowerOff(PPDMDEVINS pDevIns)
     else
     {
         /*
-         * Free all cached tasks here, not possible on destruct because the driver
-         * is destroyed before us.
+         * Free the I/O buffers of all cached tasks here, not possible on destruct because
+         * the driver is destroyed before us. The tasks are kept for the next resume.
          */
         for (unsigned iPort = 0; iPort < pThis->cPortsImpl; iPort++)
-            ahciR3PortCachedReqsFree(&pThis->ahciPort[iPort]);
+            ahciR3PortCachedReqsMemFree(&pThis->ahciPort[iPort]);
 
         ASMAtomicWriteBool(&pThis->fSignalIdle, false);
     }
@@ -8050,6 +8421,7 @@ static DECLCALLBACK(void) ahciR3Detach(PPDMDEVINS pDevIns, unsigned iLUN, uint32
     pAhciPort->pDrvBase = NULL;
     pAhciPort->pDrvMedia = NULL;
     pAhciPort->pDrvMediaAsync = NULL;
+    pAhciPort->pDrvMediaEx = NULL;
 }
 
 /**
@@ -8269,7 +8641,11 @@ static DECLCALLBACK(int) ahciR3Destruct(PPDMDEVINS pDevIns)
             }
 
             if (RTCritSectIsInitialized(&pAhciPort->CritSectReqsFree))
+            {
+                /* The I/O buffers were freed during power off already. */
+                ahciR3PortCachedReqsFree(pAhciPort);
                 RTCritSectDelete(&pAhciPort->CritSectReqsFree);
+            }
 
 #ifdef VBOX_STRICT
             for (uint32_t i = 0; i < AHCI_NR_COMMAND_SLOTS; i++)
@@ -8565,6 +8941,10 @@ static DECLCALLBACK(int) ahciR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFG
          */
         pAhciPort->IBase.pfnQueryInterface              = ahciR3PortQueryInterface;
         pAhciPort->IPortAsync.pfnTransferCompleteNotify = ahciR3TransferCompleteNotify;
+        pAhciPort->IMediaExPort.pfnIoReqCompleteNotify  = ahciR3IoReqCompleteNotify;
+        pAhciPort->IMediaExPort.pfnIoReqCopyFromBuf     = ahciR3IoReqCopyFromBuf;
+        pAhciPort->IMediaExPort.pfnIoReqCopyToBuf       = ahciR3IoReqCopyToBuf;
+        pAhciPort->IMediaExPort.pfnIoReqStateChanged    = ahciR3IoReqStateChanged;
         pAhciPort->IPort.pfnQueryDeviceLocation         = ahciR3PortQueryDeviceLocation;
         pAhciPort->IMountNotify.pfnMountNotify          = ahciR3MountNotify;
         pAhciPort->IMountNotify.pfnUnmountNotify        = ahciR3UnmountNotify;
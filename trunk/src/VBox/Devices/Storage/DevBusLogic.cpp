@@ -1109,8 +1109,11 @@ static int buslogicR3HwReset(PBUSLOGIC pBusLogic, bool fResetIO)
     pBusLogic->uMailboxIncomingPositionCurrent = 0;
 
     /* Clear any active/pending interrupts. */
+    int rc = PDMCritSectEnter(&pBusLogic->CritSectIntr, VINF_SUCCESS);
+    AssertRC(rc);
     pBusLogic->uPendingIntr = 0;
     buslogicClearInterrupt(pBusLogic);
+    PDMCritSectLeave(&pBusLogic->CritSectIntr);
 
     /* Guest-initiated HBA reset does not affect ISA port I/O. */
     if (fResetIO)
@@ -1143,9 +1146,13 @@ static void buslogicCommandComplete(PBUSLOGIC pBusLogic, bool fSuppressIrq)
     /* Modify I/O address does not generate an interrupt. */
     if (pBusLogic->uOperationCode != BUSLOGICCOMMAND_EXECUTE_MAILBOX_COMMAND)
     {
-        /* Notify that the command is complete. */
+        /* Notify that the command is complete.  The interrupt acknowledge
+           doesn't take the device lock, so CritSectIntr is needed here. */
         pBusLogic->regStatus &= ~BL_STAT_DIRRDY;
+        int rc = PDMCritSectEnter(&pBusLogic->CritSectIntr, VINF_SUCCESS);
+        AssertRC(rc);
         buslogicSetInterrupt(pBusLogic, fSuppressIrq, BL_INTR_CMDC);
+        PDMCritSectLeave(&pBusLogic->CritSectIntr);
     }
 
     pBusLogic->uOperationCode = 0xff;
@@ -2433,6 +2440,9 @@ PDMBOTHCBDECL(int) buslogicMMIOWrite(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS
 /**
  * Port I/O Handler for IN operations.
  *
+ * The I/O ports are registered with IOMIOPORT_FLAGS_NO_DEV_LOCK, so this
+ * enters the device lock itself for all but the interrupt register.
+ *
  * @returns VBox status code.
  *
  * @param   pDevIns     The device instance.
@@ -2448,7 +2458,18 @@ PDMBOTHCBDECL(int) buslogicIOPortRead(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT
 
     Assert(cb == 1);
 
-    return buslogicRegisterRead(pBusLogic, iRegister, pu32);
+    /* The interrupt service routine reads the interrupt register, which is a
+       plain byte read. */
+    if (iRegister == BUSLOGIC_REGISTER_INTERRUPT)
+        return buslogicRegisterRead(pBusLogic, iRegister, pu32);
+
+    int rc = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_READ);
+    if (rc == VINF_SUCCESS)
+    {
+        rc = buslogicRegisterRead(pBusLogic, iRegister, pu32);
+        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+    }
+    return rc;
 }
 
 /**
@@ -2471,7 +2492,28 @@ PDMBOTHCBDECL(int) buslogicIOPortWrite(PPDMDEVINS pDevIns, void *pvUser, RTIOPOR
 
     Assert(cb == 1);
 
-    rc = buslogicRegisterWrite(pBusLogic, iRegister, (uint8_t)uVal);
+    /*
+     * Every vCPU submitting I/O rings the mailbox doorbell and acknowledges
+     * the interrupts, which would all serialize on the device lock.  The
+     * doorbell only uses atomics and the queue, the acknowledge only needs
+     * CritSectIntr, so those are done without the device lock.  Everything
+     * else (resets and the command state machine) takes it here.
+     */
+    if (   (   iRegister == BUSLOGIC_REGISTER_COMMAND
+            && uVal == BUSLOGICCOMMAND_EXECUTE_MAILBOX_COMMAND
+            && ASMAtomicUoReadU8(&pBusLogic->uOperationCode) == 0xff)
+        || (   iRegister == BUSLOGIC_REGISTER_CONTROL
+            && !(uVal & (BL_CTRL_RHARD | BL_CTRL_RSOFT))))
+        rc = buslogicRegisterWrite(pBusLogic, iRegister, uVal);
+    else
+    {
+        rc = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_WRITE);
+        if (rc == VINF_SUCCESS)
+        {
+            rc = buslogicRegisterWrite(pBusLogic, iRegister, uVal);
+            PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        }
+    }
 
     Log2(("#%d %s: pvUser=%#p cb=%d u32=%#x Port=%#x rc=%Rrc\n",
           pDevIns->iInstance, __FUNCTION__, pvUser, cb, u32, Port, rc));
@@ -2679,10 +2721,11 @@ static int buslogicR3RegisterISARange(PBUSLOGIC pBusLogic, uint8_t uBaseCode)
             if (uNewBase)
             {
                 /* Register the new range if requested. */
-                rc = PDMDevHlpIOPortRegister(pBusLogic->CTX_SUFF(pDevIns), uNewBase, 4, NULL,
-                                             buslogicIOPortWrite, buslogicIOPortRead,
-                                             NULL, NULL,
-                                             "BusLogic ISA");
+                rc = PDMDevHlpIOPortRegisterEx(pBusLogic->CTX_SUFF(pDevIns), uNewBase, 4, NULL,
+                                               IOMIOPORT_FLAGS_NO_DEV_LOCK,
+                                               buslogicIOPortWrite, buslogicIOPortRead,
+                                               NULL, NULL,
+                                               "BusLogic ISA");
                 if (RT_SUCCESS(rc))
                 {
                     pBusLogic->IOISABase = uNewBase;
@@ -2801,8 +2844,8 @@ static DECLCALLBACK(int) buslogicR3MmioMap(PPCIDEVICE pPciDev, /*unsigned*/ int
     }
     else if (enmType == PCI_ADDRESS_SPACE_IO)
     {
-        rc = PDMDevHlpIOPortRegister(pDevIns, (RTIOPORT)GCPhysAddress, 32,
-                                     NULL, buslogicIOPortWrite, buslogicIOPortRead, NULL, NULL, "BusLogic PCI");
+        rc = PDMDevHlpIOPortRegisterEx(pDevIns, (RTIOPORT)GCPhysAddress, 32, NULL, IOMIOPORT_FLAGS_NO_DEV_LOCK,
+                                       buslogicIOPortWrite, buslogicIOPortRead, NULL, NULL, "BusLogic PCI");
         if (RT_FAILURE(rc))
             return rc;
 
@@ -0,0 +1,4992 @@
+/* $Id$ */
+/** @file
+ * DevNVMe - NVM Express controller device.
+ *
+ * Implements the NVM Express specification 1.2.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_dev_nvme   NVMe - NVM Express Controller Emulation.
+ *
+ * This component implements an NVM Express storage controller with one
+ * namespace per attached medium.
+ *
+ * The guest talks to the controller through pairs of submission and completion
+ * queues living in guest memory.  The admin queue pair is set up through the
+ * controller registers, the I/O queue pairs are created with admin commands.
+ * A guest driver usually creates one I/O queue pair per CPU and assigns an
+ * MSI-X vector to every completion queue.
+ *
+ * New commands are announced by writing the submission queue tail doorbell.
+ * The doorbell write is handled in R0 (or R3) without taking any lock: it
+ * updates the tail index and kicks the worker thread the queue is assigned to.
+ * In RC the kick is forwarded to R3 through a PDM queue.  All other register
+ * accesses are rare and done in R3.
+ *
+ * The submission queues are distributed over a configurable number of worker
+ * threads.  A worker fetches the new commands of its queues, translates them
+ * into PDMIMEDIAEX requests and hands them to the driver below, which completes
+ * them asynchronously.  A submission queue is only ever processed by the worker
+ * it is assigned to, so fetching needs no locking.  Completion entries are
+ * posted from whatever thread completes the request, serialized by a mutex per
+ * completion queue.  There is no per controller lock on the I/O path.
+ *
+ * The device keeps its own worker threads instead of using PDM work queues.
+ * Those would serialize each submission queue just as well, but work can only
+ * be posted to them from R3, so every doorbell write would have to leave R0.
+ * The own workers are woken straight from R0 through a support driver event.
+ *
+ * When a completion queue is full the completion entries are parked on a
+ * waiting list until the guest consumes entries.  If the waiting list grows too
+ * long the workers stop fetching commands from submission queues feeding that
+ * completion queue.
+ *
+ * Interrupts are signalled per completion queue vector and can be coalesced
+ * (aggregation threshold and time) as configured with the Interrupt Coalescing
+ * feature.  The admin completion queue is never coalesced.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_DEV_NVME
+#include <VBox/vmm/pdmdev.h>
+#include <VBox/vmm/pdmstorageifs.h>
+#include <VBox/vmm/pdmqueue.h>
+#include <VBox/vmm/pdmthread.h>
+#include <VBox/vmm/pdmcritsect.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/msi.h>
+#include <VBox/sup.h>
+#include <iprt/assert.h>
+#include <iprt/asm.h>
+#include <iprt/string.h>
+#include <iprt/list.h>
+#ifdef IN_RING3
+# include <iprt/mem.h>
+# include <iprt/param.h>
+# include <iprt/thread.h>
+# include <iprt/semaphore.h>
+# include <iprt/critsect.h>
+# include <iprt/sg.h>
+# include <iprt/time.h>
+# include <iprt/uuid.h>
+#endif
+#include "VBoxDD.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The current saved state version. */
+#define NVME_SAVED_STATE_VERSION                1
+
+/** Size of the register MMIO region (registers and doorbells). */
+#define NVME_MMIO_SIZE                          _16K
+/** Size of the index/data pair I/O port region. */
+#define NVME_IDX_DATA_SIZE                      8
+
+/** Maximum number of queues (including the admin queue) of each type. */
+#define NVME_QUEUES_MAX                         256
+/** Default number of queues (including the admin queue) of each type. */
+#define NVME_QUEUES_DEFAULT                     64
+/** Maximum number of entries of a queue. */
+#define NVME_QUEUE_ENTRIES_MAX                  _64K
+/** Default maximum number of entries of a queue. */
+#define NVME_QUEUE_ENTRIES_DEFAULT              1024
+/** Maximum number of namespaces. */
+#define NVME_NAMESPACES_MAX                     255
+/** Maximum number of worker threads. */
+#define NVME_WRK_THRDS_MAX                      64
+/** Default number of worker threads. */
+#define NVME_WRK_THRDS_DEFAULT                  4
+/** Default maximum number of parked completion entries per completion queue. */
+#define NVME_COMP_QUEUE_WAITERS_DEFAULT         256
+/** Maximum number of outstanding Asynchronous Event Requests. */
+#define NVME_ASYNC_EVT_REQS_MAX                 16
+/** Default number of outstanding Asynchronous Event Requests. */
+#define NVME_ASYNC_EVT_REQS_DEFAULT             4
+/** Maximum number of interrupt vectors (limited by the MSI-X implementation). */
+#define NVME_INTR_VECS_MAX                      VBOX_MSIX_MAX_ENTRIES
+/** Default controller ready timeout in 500ms units. */
+#define NVME_TIMEOUT_DEFAULT                    20
+/** Number of commands fetched from one submission queue before the worker
+ * moves on to the next queue (round robin arbitration burst). */
+#define NVME_SUBM_QUEUE_BURST                   32
+/** Maximum data transfer size as a power of two of the minimum page size. */
+#define NVME_MDTS                               6
+/** Minimum memory page size. */
+#define NVME_PAGE_SIZE_MIN                      _4K
+/** Maximum PRP entries of a command (the first entry may be unaligned). */
+#define NVME_PRPS_MAX                           (RT_BIT_32(NVME_MDTS) + 1)
+/** Maximum number of Dataset Management ranges. */
+#define NVME_DSM_RANGES_MAX                     256
+/** Maximum number of entries in the Changed Namespace List log page. */
+#define NVME_CHANGED_NS_LIST_MAX                1024
+
+/** Length of the configurable identification strings (without termination). */
+#define NVME_SERIAL_NUMBER_LENGTH               20
+#define NVME_MODEL_NUMBER_LENGTH                40
+#define NVME_FIRMWARE_REVISION_LENGTH           8
+
+/** Offset of the MSI-X capability in the PCI configuration space. */
+#define NVME_PCI_MSIX_CAP_OFFSET                0x80
+/** The PCI region of the MSI-X table. */
+#define NVME_PCI_MSIX_BAR                       4
+
+/** @name Controller registers.
+ * @{ */
+#define NVME_REG_CAP                            0x00
+#define NVME_REG_VS                             0x08
+#define NVME_REG_INTMS                          0x0c
+#define NVME_REG_INTMC                          0x10
+#define NVME_REG_CC                             0x14
+#define NVME_REG_CSTS                           0x1c
+#define NVME_REG_NSSR                           0x20
+#define NVME_REG_AQA                            0x24
+#define NVME_REG_ASQ                            0x28
+#define NVME_REG_ACQ                            0x30
+/** The first doorbell register (SQ 0 tail). */
+#define NVME_REG_DBL_FIRST                      0x1000
+/** @} */
+
+/** @name Controller capabilities (CAP).
+ * @{ */
+#define NVME_CAP_CQR                            RT_BIT_64(16)
+#define NVME_CAP_TO_SHIFT                       24
+#define NVME_CAP_DSTRD_SHIFT                    32
+#define NVME_CAP_CSS_NVM                        RT_BIT_64(37)
+#define NVME_CAP_MPSMIN_SHIFT                   48
+#define NVME_CAP_MPSMAX_SHIFT                   52
+/** Maximum supported memory page size (64K) as a power of two of 4K. */
+#define NVME_CAP_MPSMAX                         4
+/** @} */
+
+/** The implemented version (1.2). */
+#define NVME_VS_1_2                             UINT32_C(0x00010200)
+
+/** @name Controller configuration (CC).
+ * @{ */
+#define NVME_CC_EN                              RT_BIT_32(0)
+#define NVME_CC_CSS_GET(a_u32)                  (((a_u32) >> 4) & 0x7)
+#define NVME_CC_MPS_GET(a_u32)                  (((a_u32) >> 7) & 0xf)
+#define NVME_CC_AMS_GET(a_u32)                  (((a_u32) >> 11) & 0x7)
+#define NVME_CC_SHN_GET(a_u32)                  (((a_u32) >> 14) & 0x3)
+#define NVME_CC_IOSQES_GET(a_u32)               (((a_u32) >> 16) & 0xf)
+#define NVME_CC_IOCQES_GET(a_u32)               (((a_u32) >> 20) & 0xf)
+/** @} */
+
+/** @name Controller status (CSTS).
+ * @{ */
+#define NVME_CSTS_RDY                           RT_BIT_32(0)
+#define NVME_CSTS_CFS                           RT_BIT_32(1)
+#define NVME_CSTS_SHST_SHIFT                    2
+#define NVME_CSTS_SHST_NORMAL                   0
+#define NVME_CSTS_SHST_COMPLETE                 2
+/** @} */
+
+/** @name Admin queue attributes (AQA).
+ * @{ */
+#define NVME_AQA_ASQS_GET(a_u32)                ((a_u32) & 0xfff)
+#define NVME_AQA_ACQS_GET(a_u32)                (((a_u32) >> 16) & 0xfff)
+#define NVME_AQA_VALID_MASK                     UINT32_C(0x0fff0fff)
+/** @} */
+
+/** Submission and completion queue entry sizes (as a power of two). */
+#define NVME_SQES                               6
+#define NVME_CQES                               4
+
+/** @name Admin command opcodes.
+ * @{ */
+#define NVME_ADM_DELETE_IO_SQ                   0x00
+#define NVME_ADM_CREATE_IO_SQ                   0x01
+#define NVME_ADM_GET_LOG_PAGE                   0x02
+#define NVME_ADM_DELETE_IO_CQ                   0x04
+#define NVME_ADM_CREATE_IO_CQ                   0x05
+#define NVME_ADM_IDENTIFY                       0x06
+#define NVME_ADM_ABORT                          0x08
+#define NVME_ADM_SET_FEATURES                   0x09
+#define NVME_ADM_GET_FEATURES                   0x0a
+#define NVME_ADM_ASYNC_EVT_REQ                  0x0c
+/** @} */
+
+/** @name NVM command set opcodes.
+ * @{ */
+#define NVME_NVM_FLUSH                          0x00
+#define NVME_NVM_WRITE                          0x01
+#define NVME_NVM_READ                           0x02
+#define NVME_NVM_DSM                            0x09
+/** @} */
+
+/** @name Feature identifiers.
+ * @{ */
+#define NVME_FEAT_ARBITRATION                   0x01
+#define NVME_FEAT_POWER_MGMT                    0x02
+#define NVME_FEAT_TEMP_THRESHOLD                0x04
+#define NVME_FEAT_ERR_RECOVERY                  0x05
+#define NVME_FEAT_VOLATILE_WC                   0x06
+#define NVME_FEAT_NUM_QUEUES                    0x07
+#define NVME_FEAT_INTR_COALESCING               0x08
+#define NVME_FEAT_INTR_VEC_CFG                  0x09
+#define NVME_FEAT_WRITE_ATOMICITY               0x0a
+#define NVME_FEAT_ASYNC_EVT_CFG                 0x0b
+/** @} */
+
+/** @name Log page identifiers.
+ * @{ */
+#define NVME_LOG_ERROR_INFO                     0x01
+#define NVME_LOG_SMART_HEALTH                   0x02
+#define NVME_LOG_FIRMWARE_SLOT                  0x03
+#define NVME_LOG_CHANGED_NS_LIST                0x04
+/** @} */
+
+/** @name Identify CNS values.
+ * @{ */
+#define NVME_IDENTIFY_CNS_NAMESPACE             0x00
+#define NVME_IDENTIFY_CNS_CONTROLLER            0x01
+#define NVME_IDENTIFY_CNS_ACTIVE_NS_LIST        0x02
+/** @} */
+
+/** @name Asynchronous event information (completion dword 0).
+ * @{ */
+#define NVME_ASYNC_EVT_TYPE_NOTICE              0x02
+#define NVME_ASYNC_EVT_INFO_NS_ATTR_CHANGED     0x00
+/** Async event configuration bit enabling namespace attribute notices. */
+#define NVME_ASYNC_EVT_CFG_NS_ATTR              RT_BIT_32(8)
+/** @} */
+
+/** @name Completion status, status code type in bits 10:8 and status code in bits 7:0.
+ * @{ */
+#define NVME_STATUS_MAKE(a_uSct, a_uSc)         ((uint16_t)(((a_uSct) << 8) | (a_uSc)))
+#define NVME_STATUS_DNR                         RT_BIT(14)
+#define NVME_STATUS_SUCCESS                     NVME_STATUS_MAKE(0, 0x00)
+#define NVME_STATUS_INVALID_OPCODE              NVME_STATUS_MAKE(0, 0x01)
+#define NVME_STATUS_INVALID_FIELD               NVME_STATUS_MAKE(0, 0x02)
+#define NVME_STATUS_CMD_ID_CONFLICT             NVME_STATUS_MAKE(0, 0x03)
+#define NVME_STATUS_DATA_XFER_ERROR             NVME_STATUS_MAKE(0, 0x04)
+#define NVME_STATUS_INTERNAL_ERROR              NVME_STATUS_MAKE(0, 0x06)
+#define NVME_STATUS_ABORT_REQUESTED             NVME_STATUS_MAKE(0, 0x07)
+#define NVME_STATUS_ABORT_SQ_DELETED            NVME_STATUS_MAKE(0, 0x08)
+#define NVME_STATUS_INVALID_NS                  NVME_STATUS_MAKE(0, 0x0b)
+#define NVME_STATUS_CMD_SEQ_ERROR               NVME_STATUS_MAKE(0, 0x0c)
+#define NVME_STATUS_INVALID_PRP_OFFSET          NVME_STATUS_MAKE(0, 0x13)
+#define NVME_STATUS_LBA_OUT_OF_RANGE            NVME_STATUS_MAKE(0, 0x80)
+#define NVME_STATUS_NS_NOT_READY                NVME_STATUS_MAKE(0, 0x82)
+#define NVME_STATUS_CQ_INVALID                  NVME_STATUS_MAKE(1, 0x00)
+#define NVME_STATUS_QID_INVALID                 NVME_STATUS_MAKE(1, 0x01)
+#define NVME_STATUS_QUEUE_SIZE_INVALID          NVME_STATUS_MAKE(1, 0x02)
+#define NVME_STATUS_ASYNC_EVT_LIMIT             NVME_STATUS_MAKE(1, 0x05)
+#define NVME_STATUS_INTR_VEC_INVALID            NVME_STATUS_MAKE(1, 0x08)
+#define NVME_STATUS_LOG_PAGE_INVALID            NVME_STATUS_MAKE(1, 0x09)
+#define NVME_STATUS_QUEUE_DELETION_INVALID      NVME_STATUS_MAKE(1, 0x0c)
+#define NVME_STATUS_FEAT_NOT_SAVEABLE           NVME_STATUS_MAKE(1, 0x0d)
+#define NVME_STATUS_WRITE_TO_RO                 NVME_STATUS_MAKE(1, 0x82)
+#define NVME_STATUS_WRITE_FAULT                 NVME_STATUS_MAKE(2, 0x80)
+#define NVME_STATUS_UNRECOVERED_READ_ERROR      NVME_STATUS_MAKE(2, 0x81)
+/** @} */
+
+/** Makes the I/O request ID used for aborting a command. */
+#define NVME_IOREQ_ID_MAKE(a_idSq, a_u16Cid)    (((PDMMEDIAEXIOREQID)(a_idSq) << 16) | (a_u16Cid))
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+
+/**
+ * Submission queue entry (command).
+ */
+typedef struct NVMECMD
+{
+    /** Dword 0: Opcode (7:0), fused operation (9:8), PSDT (15:14), command identifier (31:16). */
+    uint32_t                        u32Cdw0;
+    /** Namespace identifier. */
+    uint32_t                        u32Nsid;
+    /** Reserved. */
+    uint64_t                        u64Rsvd;
+    /** Metadata pointer. */
+    uint64_t                        u64Mptr;
+    /** PRP entry 1. */
+    uint64_t                        u64Prp1;
+    /** PRP entry 2. */
+    uint64_t                        u64Prp2;
+    /** Command dwords 10 to 15. */
+    uint32_t                        au32Cdw[6];
+} NVMECMD;
+AssertCompileSize(NVMECMD, RT_BIT_32(NVME_SQES));
+/** Pointer to a command. */
+typedef NVMECMD *PNVMECMD;
+/** Pointer to a const command. */
+typedef const NVMECMD *PCNVMECMD;
+
+/** @name Command dword accessors.
+ * @{ */
+#define NVME_CMD_OPC(a_pCmd)                    ((uint8_t)((a_pCmd)->u32Cdw0 & 0xff))
+#define NVME_CMD_FUSE(a_pCmd)                   (((a_pCmd)->u32Cdw0 >> 8) & 0x3)
+#define NVME_CMD_PSDT(a_pCmd)                   (((a_pCmd)->u32Cdw0 >> 14) & 0x3)
+#define NVME_CMD_CID(a_pCmd)                    ((uint16_t)((a_pCmd)->u32Cdw0 >> 16))
+#define NVME_CMD_CDW(a_pCmd, a_iDw)             ((a_pCmd)->au32Cdw[(a_iDw) - 10])
+/** @} */
+
+/**
+ * Completion queue entry.
+ */
+typedef struct NVMECQE
+{
+    /** Command specific dword 0. */
+    uint32_t                        u32Dw0;
+    /** Reserved. */
+    uint32_t                        u32Rsvd;
+    /** Submission queue head pointer. */
+    uint16_t                        u16SqHead;
+    /** Submission queue identifier. */
+    uint16_t                        u16SqId;
+    /** Command identifier. */
+    uint16_t                        u16Cid;
+    /** Phase tag (bit 0) and status field (15:1). */
+    uint16_t                        u16Status;
+} NVMECQE;
+AssertCompileSize(NVMECQE, RT_BIT_32(NVME_CQES));
+
+/**
+ * Queue state.
+ */
+typedef enum NVMEQUEUESTATE
+{
+    /** The queue does not exist. */
+    NVMEQUEUESTATE_INVALID = 0,
+    /** The queue was created and is in use. */
+    NVMEQUEUESTATE_ALLOCATED,
+    /** The queue is being deleted and waits for outstanding commands. */
+    NVMEQUEUESTATE_DELETING,
+    /** 32bit hack. */
+    NVMEQUEUESTATE_32BIT_HACK = 0x7fffffff
+} NVMEQUEUESTATE;
+
+/**
+ * Queue type.
+ */
+typedef enum NVMEQUEUETYPE
+{
+    /** Invalid type. */
+    NVMEQUEUETYPE_INVALID = 0,
+    /** Submission queue. */
+    NVMEQUEUETYPE_SUBMISSION,
+    /** Completion queue. */
+    NVMEQUEUETYPE_COMPLETION,
+    /** 32bit hack. */
+    NVMEQUEUETYPE_32BIT_HACK = 0x7fffffff
+} NVMEQUEUETYPE;
+
+/**
+ * Submission queue priority.
+ */
+typedef enum NVMEQUEUESUBMPRIO
+{
+    /** Invalid priority. */
+    NVMEQUEUESUBMPRIO_INVALID = 0,
+    /** Urgent. */
+    NVMEQUEUESUBMPRIO_URGENT,
+    /** High. */
+    NVMEQUEUESUBMPRIO_HIGH,
+    /** Medium. */
+    NVMEQUEUESUBMPRIO_MEDIUM,
+    /** Low. */
+    NVMEQUEUESUBMPRIO_LOW,
+    /** 32bit hack. */
+    NVMEQUEUESUBMPRIO_32BIT_HACK = 0x7fffffff
+} NVMEQUEUESUBMPRIO;
+
+/**
+ * Common queue header.
+ */
+typedef struct NVMEQUEUEHDR
+{
+    /** The queue identifier. */
+    uint16_t                        u16Id;
+    /** Flag whether the queue is physically contiguous. */
+    bool                            fPhysCont;
+    /** Alignment. */
+    bool                            afAlignment0[1];
+    /** Number of entries. */
+    uint32_t                        cEntries;
+    /** The queue state. */
+    volatile NVMEQUEUESTATE         enmState;
+    /** The queue type. */
+    NVMEQUEUETYPE                   enmType;
+    /** Guest physical base address of the queue. */
+    RTGCPHYS                        GCPhysBase;
+    /** Size of one entry in bytes. */
+    uint32_t                        cbEntry;
+    /** Head index, updated by the consumer. */
+    volatile uint32_t               idxHead;
+    /** Tail index, updated by the producer. */
+    volatile uint32_t               idxTail;
+    /** Alignment. */
+    uint32_t                        u32Alignment1;
+} NVMEQUEUEHDR;
+AssertCompileSizeAlignment(NVMEQUEUEHDR, 8);
+/** Pointer to a queue header. */
+typedef NVMEQUEUEHDR *PNVMEQUEUEHDR;
+
+/** Pointer to a worker thread. */
+typedef struct NVMEWRKTHRD *PNVMEWRKTHRD;
+
+/**
+ * Submission queue.
+ *
+ * The array of submission queues lives in the hyper heap because the doorbell
+ * is written in all contexts.
+ */
+typedef struct NVMEQUEUESUBM
+{
+    /** The common queue header. The guest owns the tail, the worker the head. */
+    NVMEQUEUEHDR                    Hdr;
+    /** The completion queue the completions are posted to. */
+    uint16_t                        u16CompletionQueueId;
+    /** Command identifier of a pending Delete I/O Submission Queue command. */
+    uint16_t                        u16CidDelete;
+    /** The queue priority. */
+    NVMEQUEUESUBMPRIO               enmPriority;
+    /** The event semaphore of the worker thread the queue is assigned to. */
+    SUPSEMEVENT                     hEvtProcess;
+    /** The worker thread the queue is assigned to. */
+    R3PTRTYPE(PNVMEWRKTHRD)         pWrkThrdR3;
+    /** Node for the list of queues assigned to the worker thread. */
+    RTLISTNODER3                    NdLstWrkThrdAssgnd;
+    /** Number of active references: commands in flight plus a worker
+     * processing the queue. */
+    volatile uint32_t               cReqsActive;
+    /** Alignment. */
+    uint32_t                        u32Alignment0;
+} NVMEQUEUESUBM;
+AssertCompileSizeAlignment(NVMEQUEUESUBM, 8);
+/** Pointer to a submission queue. */
+typedef NVMEQUEUESUBM *PNVMEQUEUESUBM;
+
+/**
+ * Completion entry waiting for room in a full completion queue.
+ */
+typedef struct NVMECOMPWAITER
+{
+    /** Node for the waiting list. */
+    RTLISTNODE                      NdLstWait;
+    /** The completion entry (without the phase tag). */
+    NVMECQE                         Cqe;
+} NVMECOMPWAITER;
+/** Pointer to a waiting completion entry. */
+typedef NVMECOMPWAITER *PNVMECOMPWAITER;
+
+/**
+ * Completion queue.
+ */
+typedef struct NVMEQUEUECOMP
+{
+    /** The common queue header. The device owns the tail, the guest the head. */
+    NVMEQUEUEHDR                    Hdr;
+    /** Flag whether interrupts are enabled for this queue. */
+    bool                            fIntrEnabled;
+    /** The current phase tag. */
+    bool                            fPhase;
+    /** Alignment. */
+    bool                            afAlignment0[2];
+    /** The interrupt vector. */
+    uint32_t                        u32IntrVec;
+    /** Number of submission queues using this completion queue. */
+    volatile uint32_t               cSubmQueuesRef;
+    /** Number of completion entries on the waiting list. */
+    volatile uint32_t               cWaiters;
+    /** List of completion entries waiting for room - NVMECOMPWAITER. */
+    RTLISTANCHORR3                  LstCompletionsWaiting;
+    /** Mutex serializing the posting of completion entries. */
+    RTSEMFASTMUTEX                  hMtx;
+} NVMEQUEUECOMP;
+AssertCompileSizeAlignment(NVMEQUEUECOMP, 8);
+/** Pointer to a completion queue. */
+typedef NVMEQUEUECOMP *PNVMEQUEUECOMP;
+
+/**
+ * Interrupt vector state.
+ */
+typedef struct NVMEINTRVEC
+{
+    /** Number of interrupt events held back by coalescing. */
+    volatile uint32_t               cEvtsPending;
+    /** Flag whether coalescing is disabled for this vector. */
+    bool                            fCoalescingDisabled;
+    /** Alignment. */
+    bool                            afAlignment0[3];
+    /** Virtual timestamp of the first held back event. */
+    volatile uint64_t               tsEvtFirst;
+} NVMEINTRVEC;
+AssertCompileSizeAlignment(NVMEINTRVEC, 8);
+
+/**
+ * Controller state.
+ */
+typedef enum NVMESTATE
+{
+    /** Invalid state. */
+    NVMESTATE_INVALID = 0,
+    /** The controller is disabled (CC.EN = 0, CSTS.RDY = 0). */
+    NVMESTATE_INIT,
+    /** The controller is enabled and processes commands. */
+    NVMESTATE_READY,
+    /** CC.EN was cleared, waiting for outstanding commands before CSTS.RDY
+     * is cleared. */
+    NVMESTATE_RESETTING,
+    /** Fatal controller error (CSTS.CFS = 1). */
+    NVMESTATE_FATAL,
+    /** 32bit hack. */
+    NVMESTATE_32BIT_HACK = 0x7fffffff
+} NVMESTATE;
+
+/** Pointer to the controller state. */
+typedef struct NVME *PNVME;
+
+/**
+ * Namespace - one per attached medium.
+ */
+typedef struct NVMENAMESPACE
+{
+    /** The namespace identifier (LUN + 1). */
+    uint32_t                        u32Id;
+    /** The LUN. */
+    uint32_t                        iLUN;
+    /** Pointer to the controller. */
+    R3PTRTYPE(PNVME)                pNvmeR3;
+    /** Our base interface. */
+    PDMIBASE                        IBase;
+    /** Media port interface. */
+    PDMIMEDIAPORT                   IPort;
+    /** Extended media port interface. */
+    PDMIMEDIAEXPORT                 IMediaExPort;
+    /** Pointer to the attached driver's base interface. */
+    R3PTRTYPE(PPDMIBASE)            pDrvBase;
+    /** Pointer to the attached driver's media interface. */
+    R3PTRTYPE(PPDMIMEDIA)           pDrvMedia;
+    /** Pointer to the attached driver's extended media interface. */
+    R3PTRTYPE(PPDMIMEDIAEX)         pDrvMediaEx;
+    /** Number of sectors. */
+    uint64_t                        cSectors;
+    /** Sector size in bytes. */
+    uint32_t                        cbSector;
+    /** Flag whether the medium is read-only. */
+    bool                            fReadOnly;
+    /** Flag whether the medium supports discarding ranges. */
+    bool                            fDiscard;
+    /** Alignment. */
+    bool                            afAlignment0[2];
+    /** The status LED state for this namespace. */
+    PDMLED                          Led;
+    /** Release statistics: number of bytes read. */
+    STAMCOUNTER                     StatBytesRead;
+    /** Release statistics: number of bytes written. */
+    STAMCOUNTER                     StatBytesWritten;
+    /** Release statistics: number of read commands. */
+    STAMCOUNTER                     StatReqsRead;
+    /** Release statistics: number of write commands. */
+    STAMCOUNTER                     StatReqsWrite;
+    /** Release statistics: number of flush commands. */
+    STAMCOUNTER                     StatReqsFlush;
+    /** Release statistics: number of dataset management commands. */
+    STAMCOUNTER                     StatReqsDsm;
+    /** Release statistics: number of transfers done directly on guest memory. */
+    STAMCOUNTER                     StatReqsDirect;
+} NVMENAMESPACE;
+/** Pointer to a namespace. */
+typedef NVMENAMESPACE *PNVMENAMESPACE;
+
+/**
+ * Worker thread processing submission queues.
+ */
+typedef struct NVMEWRKTHRD
+{
+    /** Node for the list of worker threads. */
+    RTLISTNODE                      NdLstWrkThrds;
+    /** Pointer to the controller. */
+    PNVME                           pNvme;
+    /** The PDM thread. */
+    PPDMTHREAD                      pThrd;
+    /** The event semaphore the thread waits on. */
+    SUPSEMEVENT                     hEvtProcess;
+    /** Critical section protecting the list of assigned submission queues. */
+    RTCRITSECT                      CritSectLstSubm;
+    /** List of assigned submission queues - NVMEQUEUESUBM. */
+    RTLISTANCHOR                    LstSubmQueues;
+    /** Number of assigned submission queues. */
+    uint32_t                        cSubmQueues;
+    /** The worker index. */
+    uint32_t                        idWrkThrd;
+} NVMEWRKTHRD;
+
+/**
+ * I/O request data, allocated by the driver below as part of every request.
+ */
+typedef struct NVMEIOREQ
+{
+    /** The submission queue identifier. */
+    uint16_t                        u16SqId;
+    /** The command identifier. */
+    uint16_t                        u16Cid;
+    /** Total transfer size in bytes. */
+    uint32_t                        cbTransfer;
+    /** The command, kept for the saved state. */
+    NVMECMD                         Cmd;
+    /** Number of valid PRP entries. */
+    uint32_t                        cPrps;
+    /** Number of guest pages locked for direct access by the driver below. */
+    uint32_t                        cPageLocks;
+    /** The data pointers. */
+    RTGCPHYS                        aGCPhysPrps[NVME_PRPS_MAX];
+    /** The page mapping locks, cPageLocks entries valid. */
+    PGMPAGEMAPLOCK                  aPageLocks[NVME_PRPS_MAX];
+    /** The S/G list describing the locked guest memory. */
+    RTSGSEG                         aSegs[NVME_PRPS_MAX];
+} NVMEIOREQ;
+/** Pointer to the I/O request data. */
+typedef NVMEIOREQ *PNVMEIOREQ;
+
+/**
+ * Item for waking up a worker from RC.
+ */
+typedef struct NVMEWAKEQUEUEITEM
+{
+    /** The core part owned by the queue manager. */
+    PDMQUEUEITEMCORE                Core;
+    /** The submission queue identifier which got new commands. */
+    uint16_t                        u16SqId;
+} NVMEWAKEQUEUEITEM;
+/** Pointer to a wake queue item. */
+typedef NVMEWAKEQUEUEITEM *PNVMEWAKEQUEUEITEM;
+
+/**
+ * NVMe controller instance data.
+ */
+typedef struct NVME
+{
+    /** The PCI device structure. */
+    PCIDEVICE                       PciDev;
+    /** Pointer to the device instance - R3 ptr */
+    PPDMDEVINSR3                    pDevInsR3;
+    /** Pointer to the device instance - R0 ptr */
+    PPDMDEVINSR0                    pDevInsR0;
+    /** Pointer to the device instance - RC ptr. */
+    PPDMDEVINSRC                    pDevInsRC;
+
+#if HC_ARCH_BITS == 64
+    uint32_t                        Alignment0;
+#endif
+
+    /** Status LUN: The base interface. */
+    PDMIBASE                        IBase;
+    /** Status LUN: Leds interface. */
+    PDMILEDPORTS                    ILeds;
+    /** Status LUN: Partner of ILeds. */
+    R3PTRTYPE(PPDMILEDCONNECTORS)   pLedsConnector;
+    /** The support driver session handle. */
+    R3R0PTRTYPE(PSUPDRVSESSION)     pSupDrvSession;
+
+    /** Base address of the MMIO region. */
+    RTGCPHYS                        GCPhysMMIO;
+    /** Base address of the index/data pair I/O ports. */
+    RTIOPORT                        IOPortBase;
+    /** Alignment. */
+    uint16_t                        u16Alignment1;
+
+    /** Maximum number of submission queues (including the admin queue). */
+    uint32_t                        cQueuesSubmMax;
+    /** Maximum number of completion queues (including the admin queue). */
+    uint32_t                        cQueuesCompMax;
+    /** Maximum number of entries per queue. */
+    uint32_t                        cQueueEntriesMax;
+    /** Controller ready timeout in 500ms units (CAP.TO). */
+    uint32_t                        cTimeoutMax;
+    /** Maximum number of worker threads. */
+    uint32_t                        cWrkThrdsMax;
+    /** Maximum number of parked completion entries per completion queue. */
+    uint32_t                        cCompQueuesWaitersMax;
+    /** Number of namespaces (NN). */
+    uint32_t                        cNamespaces;
+    /** Number of I/O submission queues granted by the Number of Queues feature. */
+    uint32_t                        cQueuesSubmAlloc;
+    /** Number of I/O completion queues granted by the Number of Queues feature. */
+    uint32_t                        cQueuesCompAlloc;
+    /** Number of interrupt vectors available (MSI-X vectors or 1 for pin based). */
+    uint32_t                        cIntrVecs;
+
+    /** The serial number. */
+    char                            aszSerialNumber[NVME_SERIAL_NUMBER_LENGTH + 1];
+    /** The model number. */
+    char                            aszModelNumber[NVME_MODEL_NUMBER_LENGTH + 1];
+    /** The firmware revision. */
+    char                            aszFirmwareRevision[NVME_FIRMWARE_REVISION_LENGTH + 1];
+    /** Flag whether RC is enabled. */
+    bool                            fRCEnabled;
+    /** Flag whether R0 is enabled. */
+    bool                            fR0Enabled;
+    /** Flag whether the last CC write had EN set. */
+    bool                            fCcEnabled;
+    /** Flag whether MSI-X could be registered. */
+    bool                            fMsixSupported;
+    /** Alignment. */
+    bool                            afAlignment2[3];
+
+    /** The controller state. */
+    volatile NVMESTATE              enmState;
+    /** Interrupt mask (INTMS/INTMC), only used for pin based interrupts. */
+    volatile uint32_t               u32IntrMask;
+    /** Interrupt status per vector, only used for pin based interrupts. */
+    volatile uint32_t               u32IntrSts;
+    /** Alignment. */
+    uint32_t                        u32Alignment3;
+    /** Interrupt vector states. */
+    NVMEINTRVEC                     aIntrVecs[NVME_INTR_VECS_MAX];
+    /** Critical section serializing the pin based interrupt level. */
+    PDMCRITSECT                     CritSectIntx;
+
+    /** I/O completion queue entry size in bytes (CC.IOCQES), 0 if not set. */
+    uint32_t                        u32IoCompletionQueueEntrySize;
+    /** I/O submission queue entry size in bytes (CC.IOSQES), 0 if not set. */
+    uint32_t                        u32IoSubmissionQueueEntrySize;
+    /** The last shutdown notification written (CC.SHN). */
+    uint32_t                        uShutdwnNotifierLast;
+    /** The shutdown status (CSTS.SHST). */
+    uint32_t                        uShutdwnStatus;
+    /** Arbitration mechanism selected (CC.AMS). */
+    uint32_t                        uAmsSet;
+    /** Memory page size selected (CC.MPS). */
+    uint32_t                        uMpsSet;
+    /** I/O command set selected (CC.CSS). */
+    uint32_t                        uCssSet;
+    /** The current register index for the index/data pair access. */
+    uint32_t                        u32RegIdx;
+    /** The memory page size in bytes derived from CC.MPS. */
+    uint32_t                        cbPage;
+    /** Admin queue attributes (AQA). */
+    uint32_t                        u32RegAqa;
+    /** Admin submission queue base address (ASQ). */
+    uint64_t                        u64RegAsq;
+    /** Admin completion queue base address (ACQ). */
+    uint64_t                        u64RegAcq;
+
+    /** @name Current feature values.
+     * @{ */
+    uint32_t                        u32FeatArbitration;
+    uint32_t                        u32FeatPowerMgmt;
+    uint32_t                        u32FeatTempThreshold;
+    uint32_t                        u32FeatErrRecovery;
+    uint32_t                        u32FeatAsyncEvtCfg;
+    /** Aggregation threshold (number of entries minus 1). */
+    uint8_t                         cIntrCoalescingThreshold;
+    /** Aggregation time in 100us units. */
+    uint8_t                         cIntrCoalescingTime;
+    /** Volatile write cache enabled. */
+    bool                            fFeatVolatileWc;
+    /** Write atomicity normal disabled. */
+    bool                            fFeatWriteAtomicity;
+    /** @} */
+
+    /** Submission queues indexed by the identifier - R3 ptr. */
+    R3PTRTYPE(PNVMEQUEUESUBM)       paQueuesSubmR3;
+    /** Completion queues indexed by the identifier - R3 ptr. */
+    R3PTRTYPE(PNVMEQUEUECOMP)       paQueuesCompR3;
+    /** Submission queues indexed by the identifier - R0 ptr. */
+    R0PTRTYPE(PNVMEQUEUESUBM)       paQueuesSubmR0;
+    /** Completion queues indexed by the identifier - R0 ptr. */
+    R0PTRTYPE(PNVMEQUEUECOMP)       paQueuesCompR0;
+    /** Submission queues indexed by the identifier - RC ptr. */
+    RCPTRTYPE(PNVMEQUEUESUBM)       paQueuesSubmRC;
+    /** Completion queues indexed by the identifier - RC ptr. */
+    RCPTRTYPE(PNVMEQUEUECOMP)       paQueuesCompRC;
+
+    /** Queue to wake up workers from RC - R3 ptr. */
+    R3PTRTYPE(PPDMQUEUE)            pWakeQueueR3;
+    /** Queue to wake up workers from RC - R0 ptr. */
+    R0PTRTYPE(PPDMQUEUE)            pWakeQueueR0;
+    /** Queue to wake up workers from RC - RC ptr. */
+    RCPTRTYPE(PPDMQUEUE)            pWakeQueueRC;
+    /** Alignment. */
+    uint32_t                        u32Alignment4;
+
+    /** Timer for the interrupt coalescing aggregation time - R3 ptr. */
+    PTMTIMERR3                      pIntrCoalescingTimerR3;
+
+    /** Maximum number of outstanding Asynchronous Event Requests. */
+    uint32_t                        cAsyncEvtReqsMax;
+    /** Number of outstanding Asynchronous Event Requests. */
+    uint32_t                        cAsyncEvtReqsCur;
+    /** Critical section protecting the asynchronous event state. */
+    RTCRITSECT                      CritSectAsyncEvtReqs;
+    /** Command identifiers of the outstanding Asynchronous Event Requests. */
+    R3PTRTYPE(uint16_t *)           paAsyncEvtReqCids;
+    /** Flag whether a namespace attribute changed event is pending. */
+    bool                            fAsyncEvtNsChangedPending;
+    /** Flag whether namespace attribute changed events are masked until the
+     * Changed Namespace List log page is read. */
+    bool                            fAsyncEvtNsChangedMasked;
+    /** Alignment. */
+    bool                            afAlignment5[6];
+    /** Bitmap of changed namespaces (index = NSID - 1). */
+    uint32_t                        bmNsChanged[(NVME_NAMESPACES_MAX + 31) / 32];
+
+    /** The namespaces - R3 ptr. */
+    R3PTRTYPE(PNVMENAMESPACE)       paNamespaces;
+
+    /** Number of worker threads created. */
+    uint32_t                        cWrkThrdsCur;
+    /** Number of worker threads currently processing queues. */
+    volatile uint32_t               cWrkThrdsActive;
+    /** List of worker threads - NVMEWRKTHRD. */
+    RTLISTANCHORR3                  LstWrkThrds;
+    /** Critical section protecting the worker thread assignments. */
+    RTCRITSECT                      CritSectWrkThrds;
+    /** Flag whether the workers have to signal when they become idle. */
+    volatile bool                   fSignalIdle;
+    /** Alignment. */
+    bool                            afAlignment6[7];
+
+    /** Release statistics: number of interrupts raised. */
+    STAMCOUNTER                     StatIntrsRaised;
+    /** Release statistics: number of interrupts saved by coalescing. */
+    STAMCOUNTER                     StatIntrsCoalesced;
+    /** Release statistics: number of completion entries parked on a full queue. */
+    STAMCOUNTER                     StatCompQueueFull;
+    /** Release statistics: number of times a worker stopped fetching because of
+     * too many parked completion entries. */
+    STAMCOUNTER                     StatSubmQueueThrottled;
+#ifdef VBOX_WITH_STATISTICS
+    /** Statistics: submission queue doorbell writes. */
+    STAMCOUNTER                     StatDoorbellSubm;
+    /** Statistics: completion queue doorbell writes. */
+    STAMCOUNTER                     StatDoorbellComp;
+    /** Statistics: register accesses forwarded to ring-3. */
+    STAMCOUNTER                     StatRegToR3;
+#endif
+} NVME;
+AssertCompileMemberAlignment(NVME, aIntrVecs, 8);
+AssertCompileMemberAlignment(NVME, CritSectIntx, 8);
+AssertCompileMemberAlignment(NVME, StatIntrsRaised, 8);
+
+#ifndef VBOX_DEVICE_STRUCT_TESTCASE
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+RT_C_DECLS_BEGIN
+PDMBOTHCBDECL(int) nvmeMMIOWrite(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS GCPhysAddr, void const *pv, unsigned cb);
+PDMBOTHCBDECL(int) nvmeMMIORead(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS GCPhysAddr, void *pv, unsigned cb);
+PDMBOTHCBDECL(int) nvmeIdxDataWrite(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t u32, unsigned cb);
+PDMBOTHCBDECL(int) nvmeIdxDataRead(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t *pu32, unsigned cb);
+RT_C_DECLS_END
+
+#ifdef IN_RING3
+static void nvmeR3RegCcWrite(PNVME pThis, uint32_t u32Value);
+static void nvmeR3RegIntMaskWrite(PNVME pThis, uint32_t u32Value, bool fSet);
+static bool nvmeR3CtrlResetFinalize(PNVME pThis, bool fForce);
+static void nvmeR3CompQueueHeadUpdated(PNVME pThis, PNVMEQUEUECOMP pCq);
+#endif
+
+
+/**
+ * Returns whether MSI-X is enabled by the guest.
+ *
+ * @returns true if MSI-X is enabled, false if pin based interrupts are used.
+ * @param   pThis       The NVMe controller instance.
+ */
+DECLINLINE(bool) nvmeIsMsixEnabled(PNVME pThis)
+{
+    return    pThis->fMsixSupported
+           && RT_BOOL(  PCIDevGetWord(&pThis->PciDev, NVME_PCI_MSIX_CAP_OFFSET + VBOX_MSIX_CAP_MESSAGE_CONTROL)
+                      & VBOX_PCI_MSIX_FLAGS_ENABLE);
+}
+
+/**
+ * Returns the controller capabilities register value.
+ *
+ * @returns CAP register value.
+ * @param   pThis       The NVMe controller instance.
+ */
+DECLINLINE(uint64_t) nvmeRegCapGet(PNVME pThis)
+{
+    return   (uint64_t)(pThis->cQueueEntriesMax - 1)
+           | NVME_CAP_CQR
+           | ((uint64_t)(pThis->cTimeoutMax & 0xff) << NVME_CAP_TO_SHIFT)
+           | NVME_CAP_CSS_NVM
+           | ((uint64_t)NVME_CAP_MPSMAX << NVME_CAP_MPSMAX_SHIFT);
+}
+
+/**
+ * Reads a controller register.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   offReg      The register offset.
+ * @param   pu32Value   Where to store the register value.
+ */
+static int nvmeRegRead(PNVME pThis, uint32_t offReg, uint32_t *pu32Value)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t u32Value = 0;
+
+    switch (offReg)
+    {
+        case NVME_REG_CAP:
+            u32Value = RT_LO_U32(nvmeRegCapGet(pThis));
+            break;
+        case NVME_REG_CAP + 4:
+            u32Value = RT_HI_U32(nvmeRegCapGet(pThis));
+            break;
+        case NVME_REG_VS:
+            u32Value = NVME_VS_1_2;
+            break;
+        case NVME_REG_INTMS:
+        case NVME_REG_INTMC:
+            u32Value = ASMAtomicReadU32(&pThis->u32IntrMask);
+            break;
+        case NVME_REG_CC:
+        {
+            u32Value =   (pThis->fCcEnabled ? NVME_CC_EN : 0)
+                       | (pThis->uCssSet << 4)
+                       | (pThis->uMpsSet << 7)
+                       | (pThis->uAmsSet << 11)
+                       | (pThis->uShutdwnNotifierLast << 14);
+            if (pThis->u32IoSubmissionQueueEntrySize)
+                u32Value |= (uint32_t)(ASMBitFirstSetU32(pThis->u32IoSubmissionQueueEntrySize) - 1) << 16;
+            if (pThis->u32IoCompletionQueueEntrySize)
+                u32Value |= (uint32_t)(ASMBitFirstSetU32(pThis->u32IoCompletionQueueEntrySize) - 1) << 20;
+            break;
+        }
+        case NVME_REG_CSTS:
+        {
+            NVMESTATE enmState = (NVMESTATE)ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState);
+            if (enmState == NVMESTATE_RESETTING)
+            {
+                /* The guest polls for RDY to clear, try to finish the reset. */
+#ifdef IN_RING3
+                nvmeR3CtrlResetFinalize(pThis, false /*fForce*/);
+                enmState = (NVMESTATE)ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState);
+#else
+                STAM_COUNTER_INC(&pThis->StatRegToR3);
+                return VINF_IOM_R3_MMIO_READ;
+#endif
+            }
+
+            u32Value = pThis->uShutdwnStatus << NVME_CSTS_SHST_SHIFT;
+            if (   enmState == NVMESTATE_READY
+                || enmState == NVMESTATE_RESETTING)
+                u32Value |= NVME_CSTS_RDY;
+            else if (enmState == NVMESTATE_FATAL)
+                u32Value |= NVME_CSTS_CFS;
+            break;
+        }
+        case NVME_REG_AQA:
+            u32Value = pThis->u32RegAqa;
+            break;
+        case NVME_REG_ASQ:
+            u32Value = RT_LO_U32(pThis->u64RegAsq);
+            break;
+        case NVME_REG_ASQ + 4:
+            u32Value = RT_HI_U32(pThis->u64RegAsq);
+            break;
+        case NVME_REG_ACQ:
+            u32Value = RT_LO_U32(pThis->u64RegAcq);
+            break;
+        case NVME_REG_ACQ + 4:
+            u32Value = RT_HI_U32(pThis->u64RegAcq);
+            break;
+        default:
+            /* NSSR (not supported), reserved registers and doorbells read as zero. */
+            break;
+    }
+
+    Log3(("nvmeRegRead: offReg=%#x -> %#RX32\n", offReg, u32Value));
+    *pu32Value = u32Value;
+    return rc;
+}
+
+/**
+ * Handles a write to a doorbell register.
+ *
+ * This is the hot path of the device and can be handled in all contexts
+ * without taking any lock.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   offReg      The register offset.
+ * @param   u32Value    The value written.
+ */
+static int nvmeDoorbellWrite(PNVME pThis, uint32_t offReg, uint32_t u32Value)
+{
+    uint32_t idxDbl = (offReg - NVME_REG_DBL_FIRST) / sizeof(uint32_t);
+    uint32_t idQueue = idxDbl / 2;
+
+    if (RT_UNLIKELY(ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState) != NVMESTATE_READY))
+    {
+        Log(("nvmeDoorbellWrite: Controller not ready, ignoring doorbell write %#x\n", offReg));
+        return VINF_SUCCESS;
+    }
+
+    if (!(idxDbl & 1))
+    {
+        /* Submission queue tail doorbell. */
+        if (RT_UNLIKELY(idQueue >= pThis->cQueuesSubmMax))
+            return VINF_SUCCESS;
+
+        PNVMEQUEUESUBM pSq = &pThis->CTX_SUFF(paQueuesSubm)[idQueue];
+        if (RT_UNLIKELY(   ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) != NVMEQUEUESTATE_ALLOCATED
+                        || u32Value >= pSq->Hdr.cEntries))
+        {
+            Log(("nvmeDoorbellWrite: Invalid write to submission queue %u tail: %#RX32\n", idQueue, u32Value));
+            return VINF_SUCCESS;
+        }
+
+        STAM_COUNTER_INC(&pThis->StatDoorbellSubm);
+        ASMAtomicWriteU32(&pSq->Hdr.idxTail, u32Value);
+
+#ifdef IN_RC
+        /* Can't signal the worker from RC, let R3 do it. */
+        PNVMEWAKEQUEUEITEM pItem = (PNVMEWAKEQUEUEITEM)PDMQueueAlloc(pThis->CTX_SUFF(pWakeQueue));
+        AssertMsg(pItem, ("Allocating item for queue failed\n"));
+        if (pItem)
+        {
+            pItem->u16SqId = (uint16_t)idQueue;
+            PDMQueueInsert(pThis->CTX_SUFF(pWakeQueue), (PPDMQUEUEITEMCORE)pItem);
+        }
+#else
+        int rc = SUPSemEventSignal(pThis->pSupDrvSession, pSq->hEvtProcess);
+        AssertRC(rc);
+#endif
+    }
+    else
+    {
+        /* Completion queue head doorbell. */
+        if (RT_UNLIKELY(idQueue >= pThis->cQueuesCompMax))
+            return VINF_SUCCESS;
+
+        PNVMEQUEUECOMP pCq = &pThis->CTX_SUFF(paQueuesComp)[idQueue];
+        if (RT_UNLIKELY(   ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) != NVMEQUEUESTATE_ALLOCATED
+                        || u32Value >= pCq->Hdr.cEntries))
+        {
+            Log(("nvmeDoorbellWrite: Invalid write to completion queue %u head: %#RX32\n", idQueue, u32Value));
+            return VINF_SUCCESS;
+        }
+
+        /*
+         * The head must be published before checking for parked entries, see
+         * nvmeR3CompQueuePost() for the other side.
+         */
+        ASMAtomicWriteU32(&pCq->Hdr.idxHead, u32Value);
+#ifndef IN_RING3
+        /*
+         * Parked completion entries have to be posted and the pin based interrupt
+         * level depends on the queue state, both is done in R3. Writing the same
+         * head again there is harmless.
+         */
+        if (   ASMAtomicReadU32(&pCq->cWaiters)
+            || !nvmeIsMsixEnabled(pThis))
+        {
+            STAM_COUNTER_INC(&pThis->StatRegToR3);
+            return VINF_IOM_R3_MMIO_WRITE;
+        }
+#endif
+
+        STAM_COUNTER_INC(&pThis->StatDoorbellComp);
+#ifdef IN_RING3
+        nvmeR3CompQueueHeadUpdated(pThis, pCq);
+#endif
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Writes a controller register.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   offReg      The register offset.
+ * @param   u32Value    The value to write.
+ */
+static int nvmeRegWrite(PNVME pThis, uint32_t offReg, uint32_t u32Value)
+{
+    Log3(("nvmeRegWrite: offReg=%#x u32Value=%#RX32\n", offReg, u32Value));
+
+    if (offReg >= NVME_REG_DBL_FIRST)
+        return nvmeDoorbellWrite(pThis, offReg, u32Value);
+
+#ifndef IN_RING3
+    /* Everything else is rare and changes the controller state, leave it to R3. */
+    STAM_COUNTER_INC(&pThis->StatRegToR3);
+    return VINF_IOM_R3_MMIO_WRITE;
+#else
+    switch (offReg)
+    {
+        case NVME_REG_INTMS:
+            nvmeR3RegIntMaskWrite(pThis, u32Value, true /*fSet*/);
+            break;
+        case NVME_REG_INTMC:
+            nvmeR3RegIntMaskWrite(pThis, u32Value, false /*fSet*/);
+            break;
+        case NVME_REG_CC:
+            nvmeR3RegCcWrite(pThis, u32Value);
+            break;
+        case NVME_REG_AQA:
+            if (!pThis->fCcEnabled)
+                pThis->u32RegAqa = u32Value & NVME_AQA_VALID_MASK;
+            break;
+        case NVME_REG_ASQ:
+            if (!pThis->fCcEnabled)
+                pThis->u64RegAsq = RT_MAKE_U64(u32Value & ~(uint32_t)PAGE_OFFSET_MASK, RT_HI_U32(pThis->u64RegAsq));
+            break;
+        case NVME_REG_ASQ + 4:
+            if (!pThis->fCcEnabled)
+                pThis->u64RegAsq = RT_MAKE_U64(RT_LO_U32(pThis->u64RegAsq), u32Value);
+            break;
+        case NVME_REG_ACQ:
+            if (!pThis->fCcEnabled)
+                pThis->u64RegAcq = RT_MAKE_U64(u32Value & ~(uint32_t)PAGE_OFFSET_MASK, RT_HI_U32(pThis->u64RegAcq));
+            break;
+        case NVME_REG_ACQ + 4:
+            if (!pThis->fCcEnabled)
+                pThis->u64RegAcq = RT_MAKE_U64(RT_LO_U32(pThis->u64RegAcq), u32Value);
+            break;
+        default:
+            /* CAP, VS, CSTS and NSSR (subsystem reset not supported) are read-only here. */
+            break;
+    }
+
+    return VINF_SUCCESS;
+#endif
+}
+
+/**
+ * Memory mapped I/O Handler for read operations.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      User argument.
+ * @param   GCPhysAddr  Physical address (in GC) where the read starts.
+ * @param   pv          Where to store the result.
+ * @param   cb          Number of bytes read.
+ */
+PDMBOTHCBDECL(int) nvmeMMIORead(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS GCPhysAddr, void *pv, unsigned cb)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    uint32_t offReg = (uint32_t)(GCPhysAddr - pThis->GCPhysMMIO);
+    NOREF(pvUser);
+    Assert(cb == 4 || cb == 8);
+    Assert(!(offReg & (cb - 1)));
+
+    int rc = nvmeRegRead(pThis, offReg, (uint32_t *)pv);
+    if (   rc == VINF_SUCCESS
+        && cb == 8)
+        rc = nvmeRegRead(pThis, offReg + 4, (uint32_t *)pv + 1);
+
+    Log2(("#%d nvmeMMIORead: pv=%p:{%.*Rhxs} cb=%d GCPhysAddr=%RGp rc=%Rrc\n",
+          pDevIns->iInstance, pv, cb, pv, cb, GCPhysAddr, rc));
+    return rc;
+}
+
+/**
+ * Memory mapped I/O Handler for write operations.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      User argument.
+ * @param   GCPhysAddr  Physical address (in GC) where the write starts.
+ * @param   pv          Where to fetch the result.
+ * @param   cb          Number of bytes to write.
+ */
+PDMBOTHCBDECL(int) nvmeMMIOWrite(PPDMDEVINS pDevIns, void *pvUser, RTGCPHYS GCPhysAddr, void const *pv, unsigned cb)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    uint32_t offReg = (uint32_t)(GCPhysAddr - pThis->GCPhysMMIO);
+    NOREF(pvUser);
+    Assert(cb == 4 || cb == 8);
+    Assert(!(offReg & (cb - 1)));
+
+    Log2(("#%d nvmeMMIOWrite: pv=%p:{%.*Rhxs} cb=%d GCPhysAddr=%RGp\n", pDevIns->iInstance, pv, cb, pv, cb, GCPhysAddr));
+
+    /*
+     * Break up 64 bits writes into two dword writes.  Only the doorbells are
+     * handled outside of R3 and they are dwords, so a qword write to another
+     * register is either passed to R3 as a whole or done completely here.
+     */
+    if (cb == 8)
+    {
+#ifndef IN_RING3
+        if (offReg < NVME_REG_DBL_FIRST)
+        {
+            STAM_COUNTER_INC(&pThis->StatRegToR3);
+            return VINF_IOM_R3_MMIO_WRITE;
+        }
+#endif
+        int rc = nvmeRegWrite(pThis, offReg, *(uint32_t const *)pv);
+        if (rc == VINF_SUCCESS)
+            rc = nvmeRegWrite(pThis, offReg + 4, *((uint32_t const *)pv + 1));
+        return rc;
+    }
+
+    return nvmeRegWrite(pThis, offReg, *(uint32_t const *)pv);
+}
+
+/**
+ * I/O port handler for writes to the index/data register pair.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      User argument.
+ * @param   Port        Port address where the write starts.
+ * @param   u32         The value to write.
+ * @param   cb          Number of bytes to write.
+ */
+PDMBOTHCBDECL(int) nvmeIdxDataWrite(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t u32, unsigned cb)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    unsigned iReg = (Port - pThis->IOPortBase) / 4;
+    int rc = VINF_SUCCESS;
+    NOREF(pvUser);
+
+    Assert(cb == 4);
+
+    if (iReg == 0)
+    {
+        /* Write the index register. */
+        pThis->u32RegIdx = u32;
+    }
+    else
+    {
+        Assert(iReg == 1);
+        if (pThis->u32RegIdx < NVME_MMIO_SIZE && !(pThis->u32RegIdx & 3))
+        {
+            rc = nvmeRegWrite(pThis, pThis->u32RegIdx, u32);
+            if (rc == VINF_IOM_R3_MMIO_WRITE)
+                rc = VINF_IOM_R3_IOPORT_WRITE;
+        }
+    }
+
+    Log2(("#%d nvmeIdxDataWrite: u32=%#RX32 cb=%d Port=%#x rc=%Rrc\n", pDevIns->iInstance, u32, cb, Port, rc));
+    return rc;
+}
+
+/**
+ * I/O port handler for reads from the index/data register pair.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pvUser      User argument.
+ * @param   Port        Port address where the read starts.
+ * @param   pu32        Where to store the result.
+ * @param   cb          Number of bytes read.
+ */
+PDMBOTHCBDECL(int) nvmeIdxDataRead(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t *pu32, unsigned cb)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    unsigned iReg = (Port - pThis->IOPortBase) / 4;
+    int rc = VINF_SUCCESS;
+    NOREF(pvUser);
+
+    Assert(cb == 4);
+
+    if (iReg == 0)
+    {
+        /* Read the index register. */
+        *pu32 = pThis->u32RegIdx;
+    }
+    else
+    {
+        Assert(iReg == 1);
+        if (pThis->u32RegIdx < NVME_MMIO_SIZE && !(pThis->u32RegIdx & 3))
+        {
+            rc = nvmeRegRead(pThis, pThis->u32RegIdx, pu32);
+            if (rc == VINF_IOM_R3_MMIO_READ)
+                rc = VINF_IOM_R3_IOPORT_READ;
+        }
+        else
+            *pu32 = UINT32_C(0xffffffff);
+    }
+
+    Log2(("#%d nvmeIdxDataRead: u32=%#RX32 cb=%d Port=%#x rc=%Rrc\n", pDevIns->iInstance, *pu32, cb, Port, rc));
+    return rc;
+}
+
+#ifdef IN_RING3
+
+/* -=-=-=-=-=- Interrupt handling -=-=-=-=-=- */
+
+/**
+ * Updates the pin based interrupt level.
+ *
+ * The interrupt is asserted as long as a completion queue with interrupts
+ * enabled holds entries the guest has not consumed yet and vector 0 is
+ * not masked.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3IntxUpdate(PNVME pThis)
+{
+    PDMCritSectEnter(&pThis->CritSectIntx, VERR_IGNORED);
+
+    bool fPending = false;
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax && !fPending; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+
+        if (   ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) == NVMEQUEUESTATE_ALLOCATED
+            && pCq->fIntrEnabled
+            && ASMAtomicReadU32(&pCq->Hdr.idxHead) != ASMAtomicReadU32(&pCq->Hdr.idxTail))
+            fPending = true;
+    }
+
+    ASMAtomicWriteU32(&pThis->u32IntrSts, fPending ? RT_BIT_32(0) : 0);
+    if (fPending && !(ASMAtomicReadU32(&pThis->u32IntrMask) & RT_BIT_32(0)))
+    {
+        STAM_REL_COUNTER_INC(&pThis->StatIntrsRaised);
+        PDMDevHlpPCISetIrq(pThis->CTX_SUFF(pDevIns), 0, PDM_IRQ_LEVEL_HIGH);
+    }
+    else
+        PDMDevHlpPCISetIrq(pThis->CTX_SUFF(pDevIns), 0, PDM_IRQ_LEVEL_LOW);
+
+    PDMCritSectLeave(&pThis->CritSectIntx);
+}
+
+/**
+ * Sends the MSI-X message for the given vector.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   iVec        The interrupt vector.
+ */
+DECLINLINE(void) nvmeR3IntrVecFire(PNVME pThis, uint32_t iVec)
+{
+    STAM_REL_COUNTER_INC(&pThis->StatIntrsRaised);
+    PDMDevHlpPCISetIrq(pThis->CTX_SUFF(pDevIns), iVec, PDM_IRQ_LEVEL_HIGH);
+}
+
+/**
+ * Signals the interrupt of the given completion queue after new entries
+ * were posted, honoring the interrupt coalescing configuration.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCq         The completion queue.
+ */
+static void nvmeR3IntrSignal(PNVME pThis, PNVMEQUEUECOMP pCq)
+{
+    if (!pCq->fIntrEnabled)
+        return;
+
+    if (!nvmeIsMsixEnabled(pThis))
+    {
+        nvmeR3IntxUpdate(pThis);
+        return;
+    }
+
+    uint32_t     iVec        = pCq->u32IntrVec;
+    NVMEINTRVEC *pVec        = &pThis->aIntrVecs[iVec];
+    uint8_t      cThreshold  = pThis->cIntrCoalescingThreshold;
+    uint8_t      cTime       = pThis->cIntrCoalescingTime;
+
+    /* The admin completion queue vector is never coalesced. */
+    if (   iVec != 0
+        && !pVec->fCoalescingDisabled
+        && cThreshold
+        && cTime)
+    {
+        uint32_t cEvtsPending = ASMAtomicIncU32(&pVec->cEvtsPending);
+        if (cEvtsPending <= cThreshold)
+        {
+            if (cEvtsPending == 1)
+            {
+                PTMTIMER pTimer = pThis->pIntrCoalescingTimerR3;
+                ASMAtomicWriteU64(&pVec->tsEvtFirst, TMTimerGet(pTimer));
+                if (!TMTimerIsActive(pTimer))
+                    TMTimerSetMicro(pTimer, cTime * 100);
+            }
+            STAM_REL_COUNTER_INC(&pThis->StatIntrsCoalesced);
+            return;
+        }
+
+        /* Threshold reached, whoever resets the counter sends the interrupt. */
+        if (!ASMAtomicXchgU32(&pVec->cEvtsPending, 0))
+            return;
+    }
+
+    nvmeR3IntrVecFire(pThis, iVec);
+}
+
+/**
+ * Interrupt coalescing timer, sends the interrupts of all vectors whose
+ * aggregation time expired.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pTimer      The timer handle.
+ * @param   pvUser      The NVMe controller instance.
+ */
+static DECLCALLBACK(void) nvmeR3IntrCoalescingTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void *pvUser)
+{
+    PNVME    pThis      = (PNVME)pvUser;
+    uint64_t tsNow      = TMTimerGet(pTimer);
+    uint64_t cTicksAggr = TMTimerFromMicro(pTimer, pThis->cIntrCoalescingTime * 100);
+    uint64_t tsNext     = UINT64_MAX;
+    NOREF(pDevIns);
+
+    for (uint32_t iVec = 1; iVec < pThis->cIntrVecs; iVec++)
+    {
+        NVMEINTRVEC *pVec = &pThis->aIntrVecs[iVec];
+
+        if (!ASMAtomicReadU32(&pVec->cEvtsPending))
+            continue;
+
+        uint64_t tsDeadline = ASMAtomicReadU64(&pVec->tsEvtFirst) + cTicksAggr;
+        if (tsDeadline <= tsNow)
+        {
+            if (ASMAtomicXchgU32(&pVec->cEvtsPending, 0))
+                nvmeR3IntrVecFire(pThis, iVec);
+        }
+        else
+            tsNext = RT_MIN(tsNext, tsDeadline);
+    }
+
+    if (tsNext != UINT64_MAX)
+        TMTimerSet(pTimer, tsNext);
+}
+
+/**
+ * Sends all interrupts held back by coalescing.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3IntrCoalescingFlush(PNVME pThis)
+{
+    for (uint32_t iVec = 1; iVec < pThis->cIntrVecs; iVec++)
+        if (ASMAtomicXchgU32(&pThis->aIntrVecs[iVec].cEvtsPending, 0))
+            nvmeR3IntrVecFire(pThis, iVec);
+}
+
+/**
+ * Handles a write to the INTMS or INTMC register.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   u32Value    The value written.
+ * @param   fSet        Flag whether the mask bits are set (INTMS) or cleared (INTMC).
+ */
+static void nvmeR3RegIntMaskWrite(PNVME pThis, uint32_t u32Value, bool fSet)
+{
+    /* The registers must not be used with MSI-X. */
+    if (nvmeIsMsixEnabled(pThis))
+        return;
+
+    if (fSet)
+        ASMAtomicOrU32(&pThis->u32IntrMask, u32Value);
+    else
+        ASMAtomicAndU32(&pThis->u32IntrMask, ~u32Value);
+    nvmeR3IntxUpdate(pThis);
+}
+
+
+/* -=-=-=-=-=- Completion queues -=-=-=-=-=- */
+
+/**
+ * Returns whether the given completion queue is full.
+ *
+ * @returns true if there is no room for another entry.
+ * @param   pCq         The completion queue.
+ */
+DECLINLINE(bool) nvmeR3CompQueueIsFull(PNVMEQUEUECOMP pCq)
+{
+    return (pCq->Hdr.idxTail + 1) % pCq->Hdr.cEntries == ASMAtomicReadU32(&pCq->Hdr.idxHead);
+}
+
+/**
+ * Writes a completion entry to the tail of the completion queue.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCq         The completion queue, caller holds the mutex.
+ * @param   pCqe        The completion entry without the phase tag.
+ */
+static void nvmeR3CompQueueEntryWrite(PNVME pThis, PNVMEQUEUECOMP pCq, const NVMECQE *pCqe)
+{
+    NVMECQE  Cqe    = *pCqe;
+    uint32_t idxTail = pCq->Hdr.idxTail;
+
+    Cqe.u16Status = (uint16_t)((pCqe->u16Status << 1) | (pCq->fPhase ? 1 : 0));
+    PDMDevHlpPCIPhysWrite(pThis->CTX_SUFF(pDevIns), pCq->Hdr.GCPhysBase + (RTGCPHYS)idxTail * pCq->Hdr.cbEntry,
+                          &Cqe, sizeof(Cqe));
+
+    idxTail = (idxTail + 1) % pCq->Hdr.cEntries;
+    if (!idxTail)
+        pCq->fPhase = !pCq->fPhase;
+    ASMAtomicWriteU32(&pCq->Hdr.idxTail, idxTail);
+}
+
+/**
+ * Kicks all worker threads.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3WrkThrdsKickAll(PNVME pThis)
+{
+    PNVMEWRKTHRD pIt;
+    RTListForEach(&pThis->LstWrkThrds, pIt, NVMEWRKTHRD, NdLstWrkThrds)
+    {
+        int rc = SUPSemEventSignal(pThis->pSupDrvSession, pIt->hEvtProcess);
+        AssertRC(rc);
+    }
+}
+
+/**
+ * Posts parked completion entries to the given completion queue while it has
+ * room.
+ *
+ * @returns Flag whether at least one entry was posted.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCq         The completion queue, caller holds the mutex.
+ * @param   pfKick      Where to store whether the worker threads have to be kicked
+ *                      because they stopped fetching commands.
+ */
+static bool nvmeR3CompQueueWaitersPost(PNVME pThis, PNVMEQUEUECOMP pCq, bool *pfKick)
+{
+    bool fPosted = false;
+    uint32_t cWaitersOld = pCq->cWaiters;
+
+    while (   pCq->cWaiters
+           && !nvmeR3CompQueueIsFull(pCq))
+    {
+        PNVMECOMPWAITER pWaiter = RTListGetFirst(&pCq->LstCompletionsWaiting, NVMECOMPWAITER, NdLstWait);
+        RTListNodeRemove(&pWaiter->NdLstWait);
+        nvmeR3CompQueueEntryWrite(pThis, pCq, &pWaiter->Cqe);
+        ASMAtomicDecU32(&pCq->cWaiters);
+        RTMemFree(pWaiter);
+        fPosted = true;
+    }
+
+    /* Workers stop fetching when too many entries are parked, get them going again. */
+    *pfKick =    cWaitersOld >= pThis->cCompQueuesWaitersMax
+              && pCq->cWaiters < pThis->cCompQueuesWaitersMax;
+    return fPosted;
+}
+
+/**
+ * Posts a completion entry to the given completion queue, parking it if
+ * the queue is full.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCq         The completion queue.
+ * @param   pCqe        The completion entry without the phase tag.
+ */
+static void nvmeR3CompQueuePost(PNVME pThis, PNVMEQUEUECOMP pCq, const NVMECQE *pCqe)
+{
+    bool fIntr = false;
+    bool fKick = false;
+
+    RTSemFastMutexRequest(pCq->hMtx);
+    if (   ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState) == NVMESTATE_READY
+        && ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) == NVMEQUEUESTATE_ALLOCATED)
+    {
+        if (   !pCq->cWaiters
+            && !nvmeR3CompQueueIsFull(pCq))
+        {
+            nvmeR3CompQueueEntryWrite(pThis, pCq, pCqe);
+            fIntr = true;
+        }
+        else
+        {
+            PNVMECOMPWAITER pWaiter = (PNVMECOMPWAITER)RTMemAlloc(sizeof(NVMECOMPWAITER));
+            if (pWaiter)
+            {
+                pWaiter->Cqe = *pCqe;
+                RTListAppend(&pCq->LstCompletionsWaiting, &pWaiter->NdLstWait);
+                ASMAtomicIncU32(&pCq->cWaiters);
+                STAM_REL_COUNTER_INC(&pThis->StatCompQueueFull);
+
+                /*
+                 * The head doorbell is written without the mutex and checks for parked
+                 * entries only afterwards, so the guest might have made room after the
+                 * check above but before the entry got parked. Check again, otherwise
+                 * the entry and all following ones would be stuck.
+                 */
+                fIntr = nvmeR3CompQueueWaitersPost(pThis, pCq, &fKick);
+            }
+            else
+                LogRel(("NVMe#%u: Out of memory parking completion for command %#x of SQ %u, dropped\n",
+                        pThis->CTX_SUFF(pDevIns)->iInstance, pCqe->u16Cid, pCqe->u16SqId));
+        }
+    }
+    else
+        Log(("nvmeR3CompQueuePost: Dropping completion for command %#x of SQ %u\n", pCqe->u16Cid, pCqe->u16SqId));
+    RTSemFastMutexRelease(pCq->hMtx);
+
+    if (fIntr)
+        nvmeR3IntrSignal(pThis, pCq);
+    if (fKick)
+        nvmeR3WrkThrdsKickAll(pThis);
+}
+
+/**
+ * Frees all parked completion entries of the given completion queue.
+ *
+ * @returns nothing.
+ * @param   pCq         The completion queue, caller holds the mutex.
+ */
+static void nvmeR3CompQueueWaitersFree(PNVMEQUEUECOMP pCq)
+{
+    PNVMECOMPWAITER pIt, pItNext;
+    RTListForEachSafe(&pCq->LstCompletionsWaiting, pIt, pItNext, NVMECOMPWAITER, NdLstWait)
+    {
+        RTListNodeRemove(&pIt->NdLstWait);
+        RTMemFree(pIt);
+    }
+    ASMAtomicWriteU32(&pCq->cWaiters, 0);
+}
+
+/**
+ * Called after the guest updated the head of a completion queue.
+ *
+ * Posts parked entries and updates the pin based interrupt.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCq         The completion queue.
+ */
+static void nvmeR3CompQueueHeadUpdated(PNVME pThis, PNVMEQUEUECOMP pCq)
+{
+    bool fIntr = false;
+    bool fKick = false;
+
+    /*
+     * The new head was published before reading the waiter count. A poster parking
+     * an entry concurrently rechecks the head after incrementing the count, so
+     * either we see the waiter here or it sees the room we made.
+     */
+    if (ASMAtomicReadU32(&pCq->cWaiters))
+    {
+        RTSemFastMutexRequest(pCq->hMtx);
+        fIntr = nvmeR3CompQueueWaitersPost(pThis, pCq, &fKick);
+        RTSemFastMutexRelease(pCq->hMtx);
+    }
+
+    if (fIntr)
+        nvmeR3IntrSignal(pThis, pCq);
+    else if (!nvmeIsMsixEnabled(pThis))
+        nvmeR3IntxUpdate(pThis);
+
+    if (fKick)
+        nvmeR3WrkThrdsKickAll(pThis);
+}
+
+
+/* -=-=-=-=-=- Submission queues and worker assignment -=-=-=-=-=- */
+
+/**
+ * Posts the completion of a command.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue the command was fetched from.
+ * @param   u16Cid      The command identifier.
+ * @param   u16Status   The status (NVME_STATUS_XXX).
+ * @param   u32Dw0      Command specific dword 0.
+ */
+static void nvmeR3CmdComplete(PNVME pThis, PNVMEQUEUESUBM pSq, uint16_t u16Cid, uint16_t u16Status, uint32_t u32Dw0)
+{
+    NVMECQE Cqe;
+
+    Cqe.u32Dw0    = u32Dw0;
+    Cqe.u32Rsvd   = 0;
+    Cqe.u16SqHead = (uint16_t)ASMAtomicReadU32(&pSq->Hdr.idxHead);
+    Cqe.u16SqId   = pSq->Hdr.u16Id;
+    Cqe.u16Cid    = u16Cid;
+    Cqe.u16Status = u16Status;
+
+    Log2(("nvmeR3CmdComplete: SQ=%u CID=%#x Status=%#x Dw0=%#RX32\n", pSq->Hdr.u16Id, u16Cid, u16Status, u32Dw0));
+    nvmeR3CompQueuePost(pThis, &pThis->paQueuesCompR3[pSq->u16CompletionQueueId], &Cqe);
+}
+
+/**
+ * Assigns a submission queue to the least loaded worker thread.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue.
+ */
+static void nvmeR3WrkThrdAssignSq(PNVME pThis, PNVMEQUEUESUBM pSq)
+{
+    RTCritSectEnter(&pThis->CritSectWrkThrds);
+
+    PNVMEWRKTHRD pWrkThrd = NULL;
+    PNVMEWRKTHRD pIt;
+    RTListForEach(&pThis->LstWrkThrds, pIt, NVMEWRKTHRD, NdLstWrkThrds)
+    {
+        if (   !pWrkThrd
+            || pIt->cSubmQueues < pWrkThrd->cSubmQueues)
+            pWrkThrd = pIt;
+    }
+    AssertPtr(pWrkThrd);
+
+    pSq->pWrkThrdR3  = pWrkThrd;
+    pSq->hEvtProcess = pWrkThrd->hEvtProcess;
+
+    RTCritSectEnter(&pWrkThrd->CritSectLstSubm);
+    RTListAppend(&pWrkThrd->LstSubmQueues, &pSq->NdLstWrkThrdAssgnd);
+    pWrkThrd->cSubmQueues++;
+    RTCritSectLeave(&pWrkThrd->CritSectLstSubm);
+
+    RTCritSectLeave(&pThis->CritSectWrkThrds);
+    Log(("NVMe: Assigned SQ %u to worker %u\n", pSq->Hdr.u16Id, pWrkThrd->idWrkThrd));
+}
+
+/**
+ * Removes a submission queue from its worker thread.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue.
+ */
+static void nvmeR3WrkThrdRemoveSq(PNVME pThis, PNVMEQUEUESUBM pSq)
+{
+    PNVMEWRKTHRD pWrkThrd = pSq->pWrkThrdR3;
+    if (!pWrkThrd)
+        return;
+
+    RTCritSectEnter(&pThis->CritSectWrkThrds);
+    RTCritSectEnter(&pWrkThrd->CritSectLstSubm);
+    RTListNodeRemove(&pSq->NdLstWrkThrdAssgnd);
+    pWrkThrd->cSubmQueues--;
+    RTCritSectLeave(&pWrkThrd->CritSectLstSubm);
+    RTCritSectLeave(&pThis->CritSectWrkThrds);
+
+    pSq->pWrkThrdR3 = NULL;
+}
+
+/**
+ * Completes the deferred deletion of a submission queue.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue which is now unused.
+ */
+static void nvmeR3SubmQueueDeleteComplete(PNVME pThis, PNVMEQUEUESUBM pSq)
+{
+    Log(("NVMe: SQ %u deleted\n", pSq->Hdr.u16Id));
+    ASMAtomicDecU32(&pThis->paQueuesCompR3[pSq->u16CompletionQueueId].cSubmQueuesRef);
+    nvmeR3CmdComplete(pThis, &pThis->paQueuesSubmR3[0], pSq->u16CidDelete, NVME_STATUS_SUCCESS, 0);
+}
+
+/**
+ * Drops a reference to a submission queue, completing a pending
+ * deletion when it was the last one.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue.
+ */
+static void nvmeR3SubmQueueRelease(PNVME pThis, PNVMEQUEUESUBM pSq)
+{
+    if (   !ASMAtomicDecU32(&pSq->cReqsActive)
+        && ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) == NVMEQUEUESTATE_DELETING
+        && ASMAtomicCmpXchgU32((volatile uint32_t *)&pSq->Hdr.enmState, NVMEQUEUESTATE_INVALID, NVMEQUEUESTATE_DELETING))
+        nvmeR3SubmQueueDeleteComplete(pThis, pSq);
+}
+
+
+/* -=-=-=-=-=- PRP handling -=-=-=-=-=- */
+
+/**
+ * Builds the list of PRP entries describing a data transfer.
+ *
+ * @returns NVMe status code.
+ * @param   pThis           The NVMe controller instance.
+ * @param   u64Prp1         PRP entry 1 of the command.
+ * @param   u64Prp2         PRP entry 2 of the command.
+ * @param   cbTransfer      Size of the transfer in bytes.
+ * @param   paGCPhysPrps    Where to store the PRP entries, NVME_PRPS_MAX entries big.
+ * @param   pcPrps          Where to store the number of PRP entries.
+ */
+static uint16_t nvmeR3PrpListBuild(PNVME pThis, uint64_t u64Prp1, uint64_t u64Prp2, uint32_t cbTransfer,
+                                   RTGCPHYS *paGCPhysPrps, uint32_t *pcPrps)
+{
+    uint32_t cbPage   = pThis->cbPage;
+    uint32_t offFirst = (uint32_t)(u64Prp1 & (cbPage - 1));
+    uint32_t cbFirst  = cbPage - offFirst;
+    uint32_t cPrps    = 1;
+
+    if (u64Prp1 & 0x3)
+        return NVME_STATUS_INVALID_PRP_OFFSET;
+
+    if (cbTransfer > cbFirst)
+        cPrps += (cbTransfer - cbFirst + cbPage - 1) / cbPage;
+    AssertReturn(cPrps <= NVME_PRPS_MAX, NVME_STATUS_INVALID_FIELD);
+
+    paGCPhysPrps[0] = u64Prp1;
+    if (cPrps == 2)
+    {
+        if (u64Prp2 & (cbPage - 1))
+            return NVME_STATUS_INVALID_PRP_OFFSET;
+        paGCPhysPrps[1] = u64Prp2;
+    }
+    else if (cPrps > 2)
+    {
+        /* PRP entry 2 points to a list, the last entry of a full list page chains to the next page. */
+        RTGCPHYS GCPhysList = u64Prp2;
+        uint32_t idxPrp = 1;
+
+        if (GCPhysList & 0x7)
+            return NVME_STATUS_INVALID_PRP_OFFSET;
+
+        while (idxPrp < cPrps)
+        {
+            uint32_t cEntriesPage = (cbPage - (uint32_t)(GCPhysList & (cbPage - 1))) / sizeof(uint64_t);
+            uint32_t cLeft        = cPrps - idxPrp;
+            uint32_t cRead        = cLeft <= cEntriesPage ? cLeft : cEntriesPage - 1;
+
+            PDMDevHlpPCIPhysRead(pThis->CTX_SUFF(pDevIns), GCPhysList, &paGCPhysPrps[idxPrp], cRead * sizeof(uint64_t));
+            for (uint32_t i = idxPrp; i < idxPrp + cRead; i++)
+                if (paGCPhysPrps[i] & (cbPage - 1))
+                    return NVME_STATUS_INVALID_PRP_OFFSET;
+            idxPrp += cRead;
+
+            if (idxPrp < cPrps)
+            {
+                uint64_t u64Next = 0;
+                PDMDevHlpPCIPhysRead(pThis->CTX_SUFF(pDevIns), GCPhysList + cRead * sizeof(uint64_t),
+                                     &u64Next, sizeof(u64Next));
+                if (u64Next & 0x7)
+                    return NVME_STATUS_INVALID_PRP_OFFSET;
+                GCPhysList = u64Next;
+            }
+        }
+    }
+
+    *pcPrps = cPrps;
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Copies data between guest memory described by a PRP list and a S/G buffer.
+ *
+ * @returns Number of bytes copied.
+ * @param   pThis           The NVMe controller instance.
+ * @param   paGCPhysPrps    The PRP entries.
+ * @param   cPrps           Number of PRP entries.
+ * @param   offData         Offset into the transfer to start at.
+ * @param   pSgBuf          The S/G buffer.
+ * @param   cbCopy          Number of bytes to copy.
+ * @param   fToGuest        Flag whether to copy from the S/G buffer to the guest
+ *                          or the other way around.
+ */
+static size_t nvmeR3PrpCopy(PNVME pThis, const RTGCPHYS *paGCPhysPrps, uint32_t cPrps, uint32_t offData,
+                            PRTSGBUF pSgBuf, size_t cbCopy, bool fToGuest)
+{
+    PPDMDEVINS pDevIns  = pThis->CTX_SUFF(pDevIns);
+    uint32_t   cbPage   = pThis->cbPage;
+    uint32_t   cbFirst  = cbPage - (uint32_t)(paGCPhysPrps[0] & (cbPage - 1));
+    uint32_t   idxPrp;
+    uint32_t   offPrp;
+    size_t     cbCopied = 0;
+
+    if (offData < cbFirst)
+    {
+        idxPrp = 0;
+        offPrp = offData;
+    }
+    else
+    {
+        idxPrp = 1 + (offData - cbFirst) / cbPage;
+        offPrp = (offData - cbFirst) % cbPage;
+    }
+
+    while (   cbCopy
+           && idxPrp < cPrps)
+    {
+        RTGCPHYS GCPhys = paGCPhysPrps[idxPrp] + offPrp;
+        size_t   cbThis = RT_MIN((idxPrp == 0 ? cbFirst : cbPage) - offPrp, cbCopy);
+
+        while (cbThis)
+        {
+            size_t cbSeg = cbThis;
+            void *pvSeg = RTSgBufGetNextSegment(pSgBuf, &cbSeg);
+            if (!pvSeg)
+                return cbCopied;
+
+            if (fToGuest)
+                PDMDevHlpPCIPhysWrite(pDevIns, GCPhys, pvSeg, cbSeg);
+            else
+                PDMDevHlpPCIPhysRead(pDevIns, GCPhys, pvSeg, cbSeg);
+
+            GCPhys   += cbSeg;
+            cbThis   -= cbSeg;
+            cbCopy   -= cbSeg;
+            cbCopied += cbSeg;
+        }
+
+        idxPrp++;
+        offPrp = 0;
+    }
+
+    return cbCopied;
+}
+
+/**
+ * Copies a flat buffer to the guest using the PRP entries of the given command.
+ *
+ * @returns NVMe status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pCmd        The command.
+ * @param   pvBuf       The data to copy.
+ * @param   cbBuf       Size of the data in bytes.
+ */
+static uint16_t nvmeR3CmdCopyToGuest(PNVME pThis, PCNVMECMD pCmd, const void *pvBuf, uint32_t cbBuf)
+{
+    RTGCPHYS aGCPhysPrps[NVME_PRPS_MAX];
+    uint32_t cPrps = 0;
+
+    uint16_t u16Status = nvmeR3PrpListBuild(pThis, pCmd->u64Prp1, pCmd->u64Prp2, cbBuf, &aGCPhysPrps[0], &cPrps);
+    if (u16Status == NVME_STATUS_SUCCESS)
+    {
+        RTSGSEG Seg;
+        RTSGBUF SgBuf;
+
+        Seg.pvSeg = (void *)pvBuf;
+        Seg.cbSeg = cbBuf;
+        RTSgBufInit(&SgBuf, &Seg, 1);
+        size_t cbCopied = nvmeR3PrpCopy(pThis, &aGCPhysPrps[0], cPrps, 0 /*offData*/, &SgBuf, cbBuf, true /*fToGuest*/);
+        if (cbCopied != cbBuf)
+            u16Status = NVME_STATUS_DATA_XFER_ERROR;
+    }
+
+    return u16Status;
+}
+
+
+/* -=-=-=-=-=- Admin commands -=-=-=-=-=- */
+
+/** Internal status returned by command handlers completing the command later. */
+#define NVME_STATUS_DEFERRED                    UINT16_MAX
+
+DECLINLINE(void) nvmeR3BufSetU16(uint8_t *pbBuf, uint32_t off, uint16_t u16)
+{
+    pbBuf[off]     = RT_BYTE1(u16);
+    pbBuf[off + 1] = RT_BYTE2(u16);
+}
+
+DECLINLINE(void) nvmeR3BufSetU32(uint8_t *pbBuf, uint32_t off, uint32_t u32)
+{
+    nvmeR3BufSetU16(pbBuf, off,     RT_LO_U16(u32));
+    nvmeR3BufSetU16(pbBuf, off + 2, RT_HI_U16(u32));
+}
+
+DECLINLINE(void) nvmeR3BufSetU64(uint8_t *pbBuf, uint32_t off, uint64_t u64)
+{
+    nvmeR3BufSetU32(pbBuf, off,     RT_LO_U32(u64));
+    nvmeR3BufSetU32(pbBuf, off + 4, RT_HI_U32(u64));
+}
+
+/**
+ * Copies a string into a space padded identify data field.
+ */
+DECLINLINE(void) nvmeR3BufSetStr(uint8_t *pbBuf, uint32_t off, const char *psz, size_t cchField)
+{
+    size_t cch = RT_MIN(strlen(psz), cchField);
+    memset(&pbBuf[off], ' ', cchField);
+    memcpy(&pbBuf[off], psz, cch);
+}
+
+/**
+ * Returns whether any I/O queue exists.
+ *
+ * @returns true if at least one I/O submission or completion queue is not invalid.
+ * @param   pThis       The NVMe controller instance.
+ */
+static bool nvmeR3IoQueuesExist(PNVME pThis)
+{
+    for (uint32_t i = 1; i < pThis->cQueuesSubmMax; i++)
+        if (ASMAtomicReadU32((volatile uint32_t *)&pThis->paQueuesSubmR3[i].Hdr.enmState) != NVMEQUEUESTATE_INVALID)
+            return true;
+    for (uint32_t i = 1; i < pThis->cQueuesCompMax; i++)
+        if (ASMAtomicReadU32((volatile uint32_t *)&pThis->paQueuesCompR3[i].Hdr.enmState) != NVMEQUEUESTATE_INVALID)
+            return true;
+    return false;
+}
+
+/**
+ * Sends a pending asynchronous event if there is an outstanding
+ * Asynchronous Event Request command.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3AsyncEvtProcess(PNVME pThis)
+{
+    bool     fComplete = false;
+    uint16_t u16Cid    = 0;
+
+    RTCritSectEnter(&pThis->CritSectAsyncEvtReqs);
+    if (   pThis->fAsyncEvtNsChangedPending
+        && !pThis->fAsyncEvtNsChangedMasked
+        && (pThis->u32FeatAsyncEvtCfg & NVME_ASYNC_EVT_CFG_NS_ATTR)
+        && pThis->cAsyncEvtReqsCur)
+    {
+        u16Cid = pThis->paAsyncEvtReqCids[--pThis->cAsyncEvtReqsCur];
+        /* Masked until the host reads the Changed Namespace List log page. */
+        pThis->fAsyncEvtNsChangedPending = false;
+        pThis->fAsyncEvtNsChangedMasked  = true;
+        fComplete = true;
+    }
+    RTCritSectLeave(&pThis->CritSectAsyncEvtReqs);
+
+    if (fComplete)
+        nvmeR3CmdComplete(pThis, &pThis->paQueuesSubmR3[0], u16Cid, NVME_STATUS_SUCCESS,
+                            NVME_ASYNC_EVT_TYPE_NOTICE
+                          | (NVME_ASYNC_EVT_INFO_NS_ATTR_CHANGED << 8)
+                          | (NVME_LOG_CHANGED_NS_LIST << 16));
+}
+
+/**
+ * Records a namespace change and notifies the guest if possible.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pNs         The namespace which changed.
+ */
+static void nvmeR3NamespaceChanged(PNVME pThis, PNVMENAMESPACE pNs)
+{
+    RTCritSectEnter(&pThis->CritSectAsyncEvtReqs);
+    ASMBitSet(&pThis->bmNsChanged[0], pNs->iLUN);
+    pThis->fAsyncEvtNsChangedPending = true;
+    RTCritSectLeave(&pThis->CritSectAsyncEvtReqs);
+
+    nvmeR3AsyncEvtProcess(pThis);
+}
+
+/**
+ * Create I/O Completion Queue command.
+ */
+static uint16_t nvmeR3AdmCreateIoCq(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t idQueue  = NVME_CMD_CDW(pCmd, 10) & 0xffff;
+    uint32_t cEntries = (NVME_CMD_CDW(pCmd, 10) >> 16) + 1;
+    bool     fPhysCont = RT_BOOL(NVME_CMD_CDW(pCmd, 11) & RT_BIT_32(0));
+    bool     fIntrEnabled = RT_BOOL(NVME_CMD_CDW(pCmd, 11) & RT_BIT_32(1));
+    uint32_t u32IntrVec = NVME_CMD_CDW(pCmd, 11) >> 16;
+
+    if (   !idQueue
+        || idQueue >= pThis->cQueuesCompMax
+        || idQueue > pThis->cQueuesCompAlloc)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+
+    PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[idQueue];
+    if (ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) != NVMEQUEUESTATE_INVALID)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+    if (   cEntries < 2
+        || cEntries > pThis->cQueueEntriesMax)
+        return NVME_STATUS_QUEUE_SIZE_INVALID | NVME_STATUS_DNR;
+    if (   !fPhysCont
+        || (pCmd->u64Prp1 & (pThis->cbPage - 1))
+        || pThis->u32IoCompletionQueueEntrySize != sizeof(NVMECQE))
+        return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    if (   fIntrEnabled
+        && u32IntrVec >= pThis->cIntrVecs)
+        return NVME_STATUS_INTR_VEC_INVALID | NVME_STATUS_DNR;
+
+    pCq->Hdr.u16Id      = (uint16_t)idQueue;
+    pCq->Hdr.fPhysCont  = fPhysCont;
+    pCq->Hdr.cEntries   = cEntries;
+    pCq->Hdr.enmType    = NVMEQUEUETYPE_COMPLETION;
+    pCq->Hdr.GCPhysBase = pCmd->u64Prp1;
+    pCq->Hdr.cbEntry    = sizeof(NVMECQE);
+    pCq->Hdr.idxHead    = 0;
+    pCq->Hdr.idxTail    = 0;
+    pCq->fIntrEnabled   = fIntrEnabled;
+    pCq->fPhase         = true;
+    pCq->u32IntrVec     = fIntrEnabled ? u32IntrVec : 0;
+    pCq->cSubmQueuesRef = 0;
+    pCq->cWaiters       = 0;
+    RTListInit(&pCq->LstCompletionsWaiting);
+    ASMAtomicWriteU32((volatile uint32_t *)&pCq->Hdr.enmState, NVMEQUEUESTATE_ALLOCATED);
+
+    Log(("NVMe: Created CQ %u with %u entries at %RGp (vector %u%s)\n", idQueue, cEntries, pCq->Hdr.GCPhysBase,
+         pCq->u32IntrVec, fIntrEnabled ? "" : ", interrupts disabled"));
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Create I/O Submission Queue command.
+ */
+static uint16_t nvmeR3AdmCreateIoSq(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t idQueue   = NVME_CMD_CDW(pCmd, 10) & 0xffff;
+    uint32_t cEntries  = (NVME_CMD_CDW(pCmd, 10) >> 16) + 1;
+    bool     fPhysCont = RT_BOOL(NVME_CMD_CDW(pCmd, 11) & RT_BIT_32(0));
+    uint32_t uPrio     = (NVME_CMD_CDW(pCmd, 11) >> 1) & 0x3;
+    uint32_t idCq      = NVME_CMD_CDW(pCmd, 11) >> 16;
+
+    if (   !idQueue
+        || idQueue >= pThis->cQueuesSubmMax
+        || idQueue > pThis->cQueuesSubmAlloc)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+
+    PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[idQueue];
+    if (ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) != NVMEQUEUESTATE_INVALID)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+    if (   cEntries < 2
+        || cEntries > pThis->cQueueEntriesMax)
+        return NVME_STATUS_QUEUE_SIZE_INVALID | NVME_STATUS_DNR;
+    if (   !fPhysCont
+        || (pCmd->u64Prp1 & (pThis->cbPage - 1))
+        || pThis->u32IoSubmissionQueueEntrySize != sizeof(NVMECMD))
+        return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    if (   !idCq
+        || idCq >= pThis->cQueuesCompMax
+        || ASMAtomicReadU32((volatile uint32_t *)&pThis->paQueuesCompR3[idCq].Hdr.enmState) != NVMEQUEUESTATE_ALLOCATED)
+        return NVME_STATUS_CQ_INVALID | NVME_STATUS_DNR;
+
+    pSq->Hdr.u16Id            = (uint16_t)idQueue;
+    pSq->Hdr.fPhysCont        = fPhysCont;
+    pSq->Hdr.cEntries         = cEntries;
+    pSq->Hdr.enmType          = NVMEQUEUETYPE_SUBMISSION;
+    pSq->Hdr.GCPhysBase       = pCmd->u64Prp1;
+    pSq->Hdr.cbEntry          = sizeof(NVMECMD);
+    pSq->Hdr.idxHead          = 0;
+    pSq->Hdr.idxTail          = 0;
+    pSq->u16CompletionQueueId = (uint16_t)idCq;
+    pSq->u16CidDelete         = 0;
+    pSq->enmPriority          = (NVMEQUEUESUBMPRIO)(uPrio + NVMEQUEUESUBMPRIO_URGENT);
+    pSq->cReqsActive          = 0;
+    ASMAtomicIncU32(&pThis->paQueuesCompR3[idCq].cSubmQueuesRef);
+
+    /* The worker event must be valid before the doorbell accepts writes. */
+    nvmeR3WrkThrdAssignSq(pThis, pSq);
+    ASMAtomicWriteU32((volatile uint32_t *)&pSq->Hdr.enmState, NVMEQUEUESTATE_ALLOCATED);
+
+    Log(("NVMe: Created SQ %u with %u entries at %RGp for CQ %u\n", idQueue, cEntries, pSq->Hdr.GCPhysBase, idCq));
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Delete I/O Submission Queue command.
+ *
+ * The command completes once all commands fetched from the queue completed.
+ */
+static uint16_t nvmeR3AdmDeleteIoSq(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t idQueue = NVME_CMD_CDW(pCmd, 10) & 0xffff;
+
+    if (   !idQueue
+        || idQueue >= pThis->cQueuesSubmMax)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+
+    PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[idQueue];
+
+    ASMAtomicIncU32(&pSq->cReqsActive);
+    if (!ASMAtomicCmpXchgU32((volatile uint32_t *)&pSq->Hdr.enmState, NVMEQUEUESTATE_DELETING, NVMEQUEUESTATE_ALLOCATED))
+    {
+        nvmeR3SubmQueueRelease(pThis, pSq);
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+    }
+
+    pSq->u16CidDelete = NVME_CMD_CID(pCmd);
+    nvmeR3WrkThrdRemoveSq(pThis, pSq);
+    nvmeR3SubmQueueRelease(pThis, pSq);
+    return NVME_STATUS_DEFERRED;
+}
+
+/**
+ * Delete I/O Completion Queue command.
+ */
+static uint16_t nvmeR3AdmDeleteIoCq(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t idQueue = NVME_CMD_CDW(pCmd, 10) & 0xffff;
+
+    if (   !idQueue
+        || idQueue >= pThis->cQueuesCompMax)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+
+    PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[idQueue];
+    if (ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) != NVMEQUEUESTATE_ALLOCATED)
+        return NVME_STATUS_QID_INVALID | NVME_STATUS_DNR;
+    if (ASMAtomicReadU32(&pCq->cSubmQueuesRef))
+        return NVME_STATUS_QUEUE_DELETION_INVALID | NVME_STATUS_DNR;
+
+    RTSemFastMutexRequest(pCq->hMtx);
+    ASMAtomicWriteU32((volatile uint32_t *)&pCq->Hdr.enmState, NVMEQUEUESTATE_INVALID);
+    nvmeR3CompQueueWaitersFree(pCq);
+    RTSemFastMutexRelease(pCq->hMtx);
+
+    if (!nvmeIsMsixEnabled(pThis))
+        nvmeR3IntxUpdate(pThis);
+
+    Log(("NVMe: Deleted CQ %u\n", idQueue));
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Fills in the Identify Controller data structure.
+ */
+static void nvmeR3IdentifyController(PNVME pThis, uint8_t *pbBuf)
+{
+    bool fDiscard = false;
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+        if (pThis->paNamespaces[i].pDrvMediaEx && pThis->paNamespaces[i].fDiscard)
+            fDiscard = true;
+
+    nvmeR3BufSetU16(pbBuf,    0, 0x80ee);                   /* VID */
+    nvmeR3BufSetU16(pbBuf,    2, 0x80ee);                   /* SSVID */
+    nvmeR3BufSetStr(pbBuf,    4, pThis->aszSerialNumber, NVME_SERIAL_NUMBER_LENGTH);
+    nvmeR3BufSetStr(pbBuf,   24, pThis->aszModelNumber, NVME_MODEL_NUMBER_LENGTH);
+    nvmeR3BufSetStr(pbBuf,   64, pThis->aszFirmwareRevision, NVME_FIRMWARE_REVISION_LENGTH);
+    pbBuf[72] = 6;                                          /* RAB */
+    pbBuf[73] = 0x27;                                       /* IEEE OUI 08:00:27 */
+    pbBuf[74] = 0x00;
+    pbBuf[75] = 0x08;
+    pbBuf[77] = NVME_MDTS;                                  /* MDTS */
+    nvmeR3BufSetU32(pbBuf,   80, NVME_VS_1_2);              /* VER */
+    nvmeR3BufSetU32(pbBuf,   92, RT_BIT_32(8));             /* OAES: Namespace attribute notices */
+    pbBuf[258] = 3;                                         /* ACL */
+    pbBuf[259] = (uint8_t)(pThis->cAsyncEvtReqsMax - 1);    /* AERL */
+    pbBuf[260] = 0x03;                                      /* FRMW: one read-only slot */
+    nvmeR3BufSetU16(pbBuf,  266, 0x157);                    /* WCTEMP */
+    nvmeR3BufSetU16(pbBuf,  268, 0x175);                    /* CCTEMP */
+    pbBuf[512] = (NVME_SQES << 4) | NVME_SQES;              /* SQES */
+    pbBuf[513] = (NVME_CQES << 4) | NVME_CQES;              /* CQES */
+    nvmeR3BufSetU32(pbBuf,  516, pThis->cNamespaces);       /* NN */
+    nvmeR3BufSetU16(pbBuf,  520, fDiscard ? RT_BIT(2) : 0); /* ONCS: Dataset Management */
+    pbBuf[525] = 1;                                         /* VWC */
+    nvmeR3BufSetU16(pbBuf, 2048, 2500);                     /* PSD0: MP (25W) */
+}
+
+/**
+ * Identify command.
+ */
+static uint16_t nvmeR3AdmIdentify(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t uCns     = NVME_CMD_CDW(pCmd, 10) & 0xff;
+    uint16_t u16Status = NVME_STATUS_SUCCESS;
+    uint8_t *pbBuf    = (uint8_t *)RTMemTmpAllocZ(_4K);
+
+    if (!pbBuf)
+        return NVME_STATUS_INTERNAL_ERROR;
+
+    switch (uCns)
+    {
+        case NVME_IDENTIFY_CNS_NAMESPACE:
+        {
+            if (   !pCmd->u32Nsid
+                || pCmd->u32Nsid > pThis->cNamespaces)
+            {
+                u16Status = NVME_STATUS_INVALID_NS | NVME_STATUS_DNR;
+                break;
+            }
+
+            /* Inactive namespaces return a zeroed structure. */
+            PNVMENAMESPACE pNs = &pThis->paNamespaces[pCmd->u32Nsid - 1];
+            if (pNs->pDrvMediaEx)
+            {
+                nvmeR3BufSetU64(pbBuf,  0, pNs->cSectors);  /* NSZE */
+                nvmeR3BufSetU64(pbBuf,  8, pNs->cSectors);  /* NCAP */
+                nvmeR3BufSetU64(pbBuf, 16, pNs->cSectors);  /* NUSE */
+                nvmeR3BufSetU32(pbBuf, 128, (uint32_t)(ASMBitFirstSetU32(pNs->cbSector) - 1) << 16); /* LBAF0.LBADS */
+            }
+            break;
+        }
+        case NVME_IDENTIFY_CNS_CONTROLLER:
+            nvmeR3IdentifyController(pThis, pbBuf);
+            break;
+        case NVME_IDENTIFY_CNS_ACTIVE_NS_LIST:
+        {
+            uint32_t off = 0;
+            for (uint32_t i = 0; i < pThis->cNamespaces && off < _4K; i++)
+            {
+                PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+                if (   pNs->pDrvMediaEx
+                    && pNs->u32Id > pCmd->u32Nsid)
+                {
+                    nvmeR3BufSetU32(pbBuf, off, pNs->u32Id);
+                    off += sizeof(uint32_t);
+                }
+            }
+            break;
+        }
+        default:
+            u16Status = NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    }
+
+    if (u16Status == NVME_STATUS_SUCCESS)
+        u16Status = nvmeR3CmdCopyToGuest(pThis, pCmd, pbBuf, _4K);
+
+    RTMemTmpFree(pbBuf);
+    return u16Status;
+}
+
+/**
+ * Get Log Page command.
+ */
+static uint16_t nvmeR3AdmGetLogPage(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint32_t uLid  = NVME_CMD_CDW(pCmd, 10) & 0xff;
+    uint32_t cbLog = (((NVME_CMD_CDW(pCmd, 10) >> 16) & 0xfff) + 1) * sizeof(uint32_t);
+    uint16_t u16Status = NVME_STATUS_SUCCESS;
+    bool     fAsyncEvtProcess = false;
+
+    /* Everything beyond the log page itself reads as zero. */
+    uint8_t *pbBuf = (uint8_t *)RTMemTmpAllocZ(RT_MAX(cbLog, _4K));
+    if (!pbBuf)
+        return NVME_STATUS_INTERNAL_ERROR;
+
+    switch (uLid)
+    {
+        case NVME_LOG_ERROR_INFO:
+            /* No errors recorded. */
+            break;
+        case NVME_LOG_SMART_HEALTH:
+        {
+            uint64_t cbRead = 0, cbWritten = 0, cReqsRead = 0, cReqsWrite = 0;
+            for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+            {
+                PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+                cbRead     += pNs->StatBytesRead.c;
+                cbWritten  += pNs->StatBytesWritten.c;
+                cReqsRead  += pNs->StatReqsRead.c;
+                cReqsWrite += pNs->StatReqsWrite.c;
+            }
+
+            nvmeR3BufSetU16(pbBuf,   1, 0x143);             /* Composite temperature (323K) */
+            pbBuf[3] = 100;                                 /* Available spare */
+            pbBuf[4] = 10;                                  /* Available spare threshold */
+            /* Data units are thousands of 512 byte units, rounded up. */
+            nvmeR3BufSetU64(pbBuf,  32, (cbRead + 512000 - 1) / 512000);
+            nvmeR3BufSetU64(pbBuf,  48, (cbWritten + 512000 - 1) / 512000);
+            nvmeR3BufSetU64(pbBuf,  64, cReqsRead);
+            nvmeR3BufSetU64(pbBuf,  80, cReqsWrite);
+            nvmeR3BufSetU64(pbBuf, 112, 1);                 /* Power cycles */
+            break;
+        }
+        case NVME_LOG_FIRMWARE_SLOT:
+            pbBuf[0] = 1;                                   /* AFI: slot 1 active */
+            nvmeR3BufSetStr(pbBuf, 8, pThis->aszFirmwareRevision, NVME_FIRMWARE_REVISION_LENGTH);
+            break;
+        case NVME_LOG_CHANGED_NS_LIST:
+        {
+            uint32_t off = 0;
+
+            RTCritSectEnter(&pThis->CritSectAsyncEvtReqs);
+            for (uint32_t i = 0; i < pThis->cNamespaces && off < _4K; i++)
+                if (ASMBitTestAndClear(&pThis->bmNsChanged[0], i))
+                {
+                    nvmeR3BufSetU32(pbBuf, off, i + 1);
+                    off += sizeof(uint32_t);
+                }
+            /* Reading the log page unmasks the notice. */
+            pThis->fAsyncEvtNsChangedMasked = false;
+            fAsyncEvtProcess = pThis->fAsyncEvtNsChangedPending;
+            RTCritSectLeave(&pThis->CritSectAsyncEvtReqs);
+            break;
+        }
+        default:
+            u16Status = NVME_STATUS_LOG_PAGE_INVALID | NVME_STATUS_DNR;
+    }
+
+    if (u16Status == NVME_STATUS_SUCCESS)
+        u16Status = nvmeR3CmdCopyToGuest(pThis, pCmd, pbBuf, cbLog);
+
+    RTMemTmpFree(pbBuf);
+
+    if (fAsyncEvtProcess)
+        nvmeR3AsyncEvtProcess(pThis);
+    return u16Status;
+}
+
+/**
+ * Returns the current or default value of a feature.
+ *
+ * @returns NVMe status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   uFid        The feature identifier.
+ * @param   u32Cdw11    Command dword 11 (feature specific parameter).
+ * @param   fDefault    Flag whether to return the default value.
+ * @param   pu32Dw0     Where to store the value.
+ */
+static uint16_t nvmeR3FeatGet(PNVME pThis, uint32_t uFid, uint32_t u32Cdw11, bool fDefault, uint32_t *pu32Dw0)
+{
+    switch (uFid)
+    {
+        case NVME_FEAT_ARBITRATION:
+            *pu32Dw0 = fDefault ? 0 : pThis->u32FeatArbitration;
+            break;
+        case NVME_FEAT_POWER_MGMT:
+            *pu32Dw0 = fDefault ? 0 : pThis->u32FeatPowerMgmt;
+            break;
+        case NVME_FEAT_TEMP_THRESHOLD:
+            *pu32Dw0 = fDefault ? 0x157 : pThis->u32FeatTempThreshold;
+            break;
+        case NVME_FEAT_ERR_RECOVERY:
+            *pu32Dw0 = fDefault ? 0 : pThis->u32FeatErrRecovery;
+            break;
+        case NVME_FEAT_VOLATILE_WC:
+            *pu32Dw0 = fDefault ? 1 : pThis->fFeatVolatileWc;
+            break;
+        case NVME_FEAT_NUM_QUEUES:
+            if (fDefault)
+                *pu32Dw0 = ((pThis->cQueuesCompMax - 2) << 16) | (pThis->cQueuesSubmMax - 2);
+            else
+                *pu32Dw0 = ((pThis->cQueuesCompAlloc - 1) << 16) | (pThis->cQueuesSubmAlloc - 1);
+            break;
+        case NVME_FEAT_INTR_COALESCING:
+            *pu32Dw0 = fDefault ? 0 : (pThis->cIntrCoalescingTime << 8) | pThis->cIntrCoalescingThreshold;
+            break;
+        case NVME_FEAT_INTR_VEC_CFG:
+        {
+            uint32_t iVec = u32Cdw11 & 0xffff;
+            if (iVec >= pThis->cIntrVecs)
+                return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+            *pu32Dw0 = iVec;
+            if (   iVec == 0
+                || (!fDefault && pThis->aIntrVecs[iVec].fCoalescingDisabled))
+                *pu32Dw0 |= RT_BIT_32(16);
+            break;
+        }
+        case NVME_FEAT_WRITE_ATOMICITY:
+            *pu32Dw0 = fDefault ? 0 : pThis->fFeatWriteAtomicity;
+            break;
+        case NVME_FEAT_ASYNC_EVT_CFG:
+            *pu32Dw0 = fDefault ? 0 : pThis->u32FeatAsyncEvtCfg;
+            break;
+        default:
+            return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    }
+
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Resets all features to their default values.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3FeatReset(PNVME pThis)
+{
+    pThis->u32FeatArbitration       = 0;
+    pThis->u32FeatPowerMgmt         = 0;
+    pThis->u32FeatTempThreshold     = 0x157;
+    pThis->u32FeatErrRecovery       = 0;
+    pThis->u32FeatAsyncEvtCfg       = 0;
+    pThis->cIntrCoalescingThreshold = 0;
+    pThis->cIntrCoalescingTime      = 0;
+    pThis->fFeatVolatileWc          = true;
+    pThis->fFeatWriteAtomicity      = false;
+    pThis->cQueuesSubmAlloc         = pThis->cQueuesSubmMax - 1;
+    pThis->cQueuesCompAlloc         = pThis->cQueuesCompMax - 1;
+    for (uint32_t i = 0; i < RT_ELEMENTS(pThis->aIntrVecs); i++)
+    {
+        pThis->aIntrVecs[i].fCoalescingDisabled = false;
+        ASMAtomicWriteU32(&pThis->aIntrVecs[i].cEvtsPending, 0);
+        ASMAtomicWriteU64(&pThis->aIntrVecs[i].tsEvtFirst, 0);
+    }
+}
+
+/**
+ * Get Features command.
+ */
+static uint16_t nvmeR3AdmGetFeatures(PNVME pThis, PCNVMECMD pCmd, uint32_t *pu32Dw0)
+{
+    uint32_t uFid = NVME_CMD_CDW(pCmd, 10) & 0xff;
+    uint32_t uSel = (NVME_CMD_CDW(pCmd, 10) >> 8) & 0x7;
+
+    switch (uSel)
+    {
+        case 0: /* Current */
+            return nvmeR3FeatGet(pThis, uFid, NVME_CMD_CDW(pCmd, 11), false /*fDefault*/, pu32Dw0);
+        case 1: /* Default */
+        case 2: /* Saved, nothing is saveable so this is the default. */
+            return nvmeR3FeatGet(pThis, uFid, NVME_CMD_CDW(pCmd, 11), true /*fDefault*/, pu32Dw0);
+        case 3: /* Supported capabilities: changeable, not saveable, not namespace specific. */
+        {
+            uint32_t u32Dummy;
+            uint16_t u16Status = nvmeR3FeatGet(pThis, uFid, NVME_CMD_CDW(pCmd, 11), true /*fDefault*/, &u32Dummy);
+            if (u16Status == NVME_STATUS_SUCCESS)
+                *pu32Dw0 = RT_BIT_32(2);
+            return u16Status;
+        }
+        default:
+            return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    }
+}
+
+/**
+ * Set Features command.
+ */
+static uint16_t nvmeR3AdmSetFeatures(PNVME pThis, PCNVMECMD pCmd, uint32_t *pu32Dw0)
+{
+    uint32_t uFid     = NVME_CMD_CDW(pCmd, 10) & 0xff;
+    uint32_t u32Cdw11 = NVME_CMD_CDW(pCmd, 11);
+
+    if (NVME_CMD_CDW(pCmd, 10) & RT_BIT_32(31))
+        return NVME_STATUS_FEAT_NOT_SAVEABLE | NVME_STATUS_DNR;
+
+    switch (uFid)
+    {
+        case NVME_FEAT_ARBITRATION:
+            pThis->u32FeatArbitration = u32Cdw11;
+            break;
+        case NVME_FEAT_POWER_MGMT:
+            /* Only power state 0 is supported. */
+            if (u32Cdw11 & 0x1f)
+                return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+            pThis->u32FeatPowerMgmt = u32Cdw11;
+            break;
+        case NVME_FEAT_TEMP_THRESHOLD:
+            pThis->u32FeatTempThreshold = u32Cdw11;
+            break;
+        case NVME_FEAT_ERR_RECOVERY:
+            pThis->u32FeatErrRecovery = u32Cdw11;
+            break;
+        case NVME_FEAT_VOLATILE_WC:
+            pThis->fFeatVolatileWc = RT_BOOL(u32Cdw11 & RT_BIT_32(0));
+            break;
+        case NVME_FEAT_NUM_QUEUES:
+        {
+            uint32_t cSqReq = (u32Cdw11 & 0xffff) + 1;
+            uint32_t cCqReq = (u32Cdw11 >> 16) + 1;
+
+            if (nvmeR3IoQueuesExist(pThis))
+                return NVME_STATUS_CMD_SEQ_ERROR | NVME_STATUS_DNR;
+            if (   cSqReq > UINT16_MAX
+                || cCqReq > UINT16_MAX)
+                return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+
+            pThis->cQueuesSubmAlloc = RT_MIN(cSqReq, pThis->cQueuesSubmMax - 1);
+            pThis->cQueuesCompAlloc = RT_MIN(cCqReq, pThis->cQueuesCompMax - 1);
+            *pu32Dw0 = ((pThis->cQueuesCompAlloc - 1) << 16) | (pThis->cQueuesSubmAlloc - 1);
+            break;
+        }
+        case NVME_FEAT_INTR_COALESCING:
+            pThis->cIntrCoalescingThreshold = (uint8_t)(u32Cdw11 & 0xff);
+            pThis->cIntrCoalescingTime      = (uint8_t)((u32Cdw11 >> 8) & 0xff);
+            /* Don't keep anything back when coalescing was switched off. */
+            if (!pThis->cIntrCoalescingThreshold || !pThis->cIntrCoalescingTime)
+                nvmeR3IntrCoalescingFlush(pThis);
+            break;
+        case NVME_FEAT_INTR_VEC_CFG:
+        {
+            uint32_t iVec = u32Cdw11 & 0xffff;
+            if (iVec >= pThis->cIntrVecs)
+                return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+            pThis->aIntrVecs[iVec].fCoalescingDisabled = RT_BOOL(u32Cdw11 & RT_BIT_32(16));
+            break;
+        }
+        case NVME_FEAT_WRITE_ATOMICITY:
+            pThis->fFeatWriteAtomicity = RT_BOOL(u32Cdw11 & RT_BIT_32(0));
+            break;
+        case NVME_FEAT_ASYNC_EVT_CFG:
+            pThis->u32FeatAsyncEvtCfg = u32Cdw11;
+            nvmeR3AsyncEvtProcess(pThis);
+            break;
+        default:
+            return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    }
+
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Abort command.
+ */
+static uint16_t nvmeR3AdmAbort(PNVME pThis, PCNVMECMD pCmd, uint32_t *pu32Dw0)
+{
+    uint32_t idSq   = NVME_CMD_CDW(pCmd, 10) & 0xffff;
+    uint32_t u32Cid = NVME_CMD_CDW(pCmd, 10) >> 16;
+    bool     fAborted = false;
+
+    /* Admin commands complete synchronously and can't be aborted. */
+    if (idSq)
+    {
+        for (uint32_t i = 0; i < pThis->cNamespaces && !fAborted; i++)
+        {
+            PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+            if (pNs->pDrvMediaEx)
+            {
+                int rc = pNs->pDrvMediaEx->pfnIoReqCancel(pNs->pDrvMediaEx, NVME_IOREQ_ID_MAKE(idSq, u32Cid));
+                fAborted = RT_SUCCESS(rc);
+            }
+        }
+    }
+
+    /* Bit 0 is cleared if the command was aborted. */
+    *pu32Dw0 = fAborted ? 0 : 1;
+    return NVME_STATUS_SUCCESS;
+}
+
+/**
+ * Asynchronous Event Request command.
+ */
+static uint16_t nvmeR3AdmAsyncEvtReq(PNVME pThis, PCNVMECMD pCmd)
+{
+    uint16_t u16Status = NVME_STATUS_DEFERRED;
+
+    RTCritSectEnter(&pThis->CritSectAsyncEvtReqs);
+    if (pThis->cAsyncEvtReqsCur < pThis->cAsyncEvtReqsMax)
+        pThis->paAsyncEvtReqCids[pThis->cAsyncEvtReqsCur++] = NVME_CMD_CID(pCmd);
+    else
+        u16Status = NVME_STATUS_ASYNC_EVT_LIMIT | NVME_STATUS_DNR;
+    RTCritSectLeave(&pThis->CritSectAsyncEvtReqs);
+
+    if (u16Status == NVME_STATUS_DEFERRED)
+        nvmeR3AsyncEvtProcess(pThis);
+    return u16Status;
+}
+
+/**
+ * Processes a command from the admin submission queue.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The admin submission queue.
+ * @param   pCmd        The command.
+ */
+static void nvmeR3AdmCmdProcess(PNVME pThis, PNVMEQUEUESUBM pSq, PCNVMECMD pCmd)
+{
+    uint16_t u16Status;
+    uint32_t u32Dw0 = 0;
+
+    Log(("NVMe: Admin command %#x CID=%#x NSID=%#x CDW10=%#RX32 CDW11=%#RX32\n",
+         NVME_CMD_OPC(pCmd), NVME_CMD_CID(pCmd), pCmd->u32Nsid, NVME_CMD_CDW(pCmd, 10), NVME_CMD_CDW(pCmd, 11)));
+
+    if (   NVME_CMD_FUSE(pCmd)
+        || NVME_CMD_PSDT(pCmd))
+        u16Status = NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    else
+    {
+        switch (NVME_CMD_OPC(pCmd))
+        {
+            case NVME_ADM_DELETE_IO_SQ:
+                u16Status = nvmeR3AdmDeleteIoSq(pThis, pCmd);
+                break;
+            case NVME_ADM_CREATE_IO_SQ:
+                u16Status = nvmeR3AdmCreateIoSq(pThis, pCmd);
+                break;
+            case NVME_ADM_GET_LOG_PAGE:
+                u16Status = nvmeR3AdmGetLogPage(pThis, pCmd);
+                break;
+            case NVME_ADM_DELETE_IO_CQ:
+                u16Status = nvmeR3AdmDeleteIoCq(pThis, pCmd);
+                break;
+            case NVME_ADM_CREATE_IO_CQ:
+                u16Status = nvmeR3AdmCreateIoCq(pThis, pCmd);
+                break;
+            case NVME_ADM_IDENTIFY:
+                u16Status = nvmeR3AdmIdentify(pThis, pCmd);
+                break;
+            case NVME_ADM_ABORT:
+                u16Status = nvmeR3AdmAbort(pThis, pCmd, &u32Dw0);
+                break;
+            case NVME_ADM_SET_FEATURES:
+                u16Status = nvmeR3AdmSetFeatures(pThis, pCmd, &u32Dw0);
+                break;
+            case NVME_ADM_GET_FEATURES:
+                u16Status = nvmeR3AdmGetFeatures(pThis, pCmd, &u32Dw0);
+                break;
+            case NVME_ADM_ASYNC_EVT_REQ:
+                u16Status = nvmeR3AdmAsyncEvtReq(pThis, pCmd);
+                break;
+            default:
+                u16Status = NVME_STATUS_INVALID_OPCODE | NVME_STATUS_DNR;
+        }
+    }
+
+    if (u16Status != NVME_STATUS_DEFERRED)
+        nvmeR3CmdComplete(pThis, pSq, NVME_CMD_CID(pCmd), u16Status, u32Dw0);
+}
+
+
+/* -=-=-=-=-=- I/O commands -=-=-=-=-=- */
+
+/**
+ * Checks the given I/O command and sets up the data transfer.
+ *
+ * @returns NVMe status code.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pNs         The namespace the command is for.
+ * @param   pIoReq      The request data with the command filled in.
+ */
+static uint16_t nvmeR3IoReqPrepare(PNVME pThis, PNVMENAMESPACE pNs, PNVMEIOREQ pIoReq)
+{
+    PCNVMECMD pCmd = &pIoReq->Cmd;
+    uint64_t  cbTransfer;
+
+    pIoReq->cbTransfer = 0;
+    pIoReq->cPrps      = 0;
+    pIoReq->cPageLocks = 0;
+
+    switch (NVME_CMD_OPC(pCmd))
+    {
+        case NVME_NVM_READ:
+        case NVME_NVM_WRITE:
+        {
+            uint64_t uLba  = RT_MAKE_U64(NVME_CMD_CDW(pCmd, 10), NVME_CMD_CDW(pCmd, 11));
+            uint32_t cLbas = (NVME_CMD_CDW(pCmd, 12) & 0xffff) + 1;
+
+            if (   uLba >= pNs->cSectors
+                || cLbas > pNs->cSectors - uLba)
+                return NVME_STATUS_LBA_OUT_OF_RANGE | NVME_STATUS_DNR;
+            if (   NVME_CMD_OPC(pCmd) == NVME_NVM_WRITE
+                && pNs->fReadOnly)
+                return NVME_STATUS_WRITE_TO_RO | NVME_STATUS_DNR;
+
+            cbTransfer = (uint64_t)cLbas * pNs->cbSector;
+            break;
+        }
+        case NVME_NVM_FLUSH:
+            return NVME_STATUS_SUCCESS;
+        case NVME_NVM_DSM:
+        {
+            /* Only deallocation does something, the other attributes are hints. */
+            if (   !(NVME_CMD_CDW(pCmd, 11) & RT_BIT_32(2))
+                || !pNs->fDiscard)
+                return NVME_STATUS_SUCCESS;
+
+            cbTransfer = ((NVME_CMD_CDW(pCmd, 10) & 0xff) + 1) * 16;
+            break;
+        }
+        default:
+            return NVME_STATUS_INVALID_OPCODE | NVME_STATUS_DNR;
+    }
+
+    if (cbTransfer > (NVME_PAGE_SIZE_MIN << NVME_MDTS))
+        return NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+
+    pIoReq->cbTransfer = (uint32_t)cbTransfer;
+    return nvmeR3PrpListBuild(pThis, pCmd->u64Prp1, pCmd->u64Prp2, pIoReq->cbTransfer,
+                              &pIoReq->aGCPhysPrps[0], &pIoReq->cPrps);
+}
+
+/**
+ * Reads the ranges of a Dataset Management command and starts the discard.
+ *
+ * @returns VBox status code, VINF_PDM_MEDIAEX_IOREQ_IN_PROGRESS if the request
+ *          completes asynchronously.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pNs         The namespace.
+ * @param   hIoReq      The request handle.
+ * @param   pIoReq      The request data.
+ */
+static int nvmeR3IoReqDiscard(PNVME pThis, PNVMENAMESPACE pNs, PDMMEDIAEXIOREQ hIoReq, PNVMEIOREQ pIoReq)
+{
+    uint32_t  cRangesMax = pIoReq->cbTransfer / 16;
+    uint8_t  *pbRanges   = (uint8_t *)RTMemTmpAlloc(pIoReq->cbTransfer);
+    PRTRANGE  paRanges   = (PRTRANGE)RTMemTmpAlloc(cRangesMax * sizeof(RTRANGE));
+    int       rc         = VINF_SUCCESS;
+
+    if (pbRanges && paRanges)
+    {
+        RTSGSEG Seg;
+        RTSGBUF SgBuf;
+        unsigned cRanges = 0;
+
+        Seg.pvSeg = pbRanges;
+        Seg.cbSeg = pIoReq->cbTransfer;
+        RTSgBufInit(&SgBuf, &Seg, 1);
+        nvmeR3PrpCopy(pThis, &pIoReq->aGCPhysPrps[0], pIoReq->cPrps, 0 /*offData*/, &SgBuf,
+                      pIoReq->cbTransfer, false /*fToGuest*/);
+
+        for (uint32_t i = 0; i < cRangesMax; i++)
+        {
+            uint8_t *pbRange = &pbRanges[i * 16];
+            uint32_t cLbas   = RT_MAKE_U32_FROM_U8(pbRange[4], pbRange[5], pbRange[6], pbRange[7]);
+            uint64_t uLba    = RT_MAKE_U64(RT_MAKE_U32_FROM_U8(pbRange[8], pbRange[9], pbRange[10], pbRange[11]),
+                                           RT_MAKE_U32_FROM_U8(pbRange[12], pbRange[13], pbRange[14], pbRange[15]));
+
+            /* Ranges outside of the namespace are ignored, deallocation is only a hint. */
+            if (   cLbas
+                && uLba < pNs->cSectors
+                && cLbas <= pNs->cSectors - uLba)
+            {
+                paRanges[cRanges].offStart = uLba * pNs->cbSector;
+                paRanges[cRanges].cbRange  = (size_t)cLbas * pNs->cbSector;
+                cRanges++;
+            }
+        }
+
+        if (cRanges)
+            rc = pNs->pDrvMediaEx->pfnIoReqDiscard(pNs->pDrvMediaEx, hIoReq, paRanges, cRanges);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    if (pbRanges)
+        RTMemTmpFree(pbRanges);
+    if (paRanges)
+        RTMemTmpFree(paRanges);
+    return rc;
+}
+
+/**
+ * Releases the guest pages locked for direct access by the driver below.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pIoReq      The request data.
+ */
+static void nvmeR3IoReqPagesRelease(PNVME pThis, PNVMEIOREQ pIoReq)
+{
+    PPDMDEVINS pDevIns = pThis->CTX_SUFF(pDevIns);
+
+    for (uint32_t i = 0; i < pIoReq->cPageLocks; i++)
+        PDMDevHlpPhysReleasePageMappingLock(pDevIns, &pIoReq->aPageLocks[i]);
+    pIoReq->cPageLocks = 0;
+}
+
+/**
+ * Completes an I/O request.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pNs         The namespace.
+ * @param   hIoReq      The request handle.
+ * @param   pIoReq      The request data.
+ * @param   rcReq       The status of the request.
+ */
+static void nvmeR3IoReqComplete(PNVME pThis, PNVMENAMESPACE pNs, PDMMEDIAEXIOREQ hIoReq, PNVMEIOREQ pIoReq, int rcReq)
+{
+    uint16_t u16SqId    = pIoReq->u16SqId;
+    uint16_t u16Cid     = pIoReq->u16Cid;
+    uint8_t  bOpc       = NVME_CMD_OPC(&pIoReq->Cmd);
+    uint32_t cbTransfer = pIoReq->cbTransfer;
+    uint16_t u16Status  = NVME_STATUS_SUCCESS;
+
+    if (RT_FAILURE(rcReq))
+    {
+        if (rcReq == VERR_PDM_MEDIAEX_IOREQ_CANCELED)
+            u16Status = NVME_STATUS_ABORT_REQUESTED;
+        else
+        {
+            u16Status = bOpc == NVME_NVM_READ ? NVME_STATUS_UNRECOVERED_READ_ERROR : NVME_STATUS_WRITE_FAULT;
+            LogRelMax(10, ("NVMe#%u: NSID %u: %s command %#x of SQ %u failed with %Rrc\n",
+                           pThis->CTX_SUFF(pDevIns)->iInstance, pNs->u32Id,
+                           bOpc == NVME_NVM_READ ? "Read" : bOpc == NVME_NVM_WRITE ? "Write" : bOpc == NVME_NVM_FLUSH ? "Flush" : "DSM",
+                           u16Cid, u16SqId, rcReq));
+        }
+    }
+
+    switch (bOpc)
+    {
+        case NVME_NVM_READ:
+            pNs->Led.Actual.s.fReading = 0;
+            if (RT_SUCCESS(rcReq))
+                STAM_REL_COUNTER_ADD(&pNs->StatBytesRead, cbTransfer);
+            break;
+        case NVME_NVM_WRITE:
+            pNs->Led.Actual.s.fWriting = 0;
+            if (RT_SUCCESS(rcReq))
+                STAM_REL_COUNTER_ADD(&pNs->StatBytesWritten, cbTransfer);
+            break;
+        default:
+            break;
+    }
+
+    /* Free before posting, the guest may reuse the command identifier immediately. */
+    nvmeR3IoReqPagesRelease(pThis, pIoReq);
+    pNs->pDrvMediaEx->pfnIoReqFree(pNs->pDrvMediaEx, hIoReq);
+
+    PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[u16SqId];
+    if (ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) == NVMEQUEUESTATE_ALLOCATED)
+        nvmeR3CmdComplete(pThis, pSq, u16Cid, u16Status, 0);
+    nvmeR3SubmQueueRelease(pThis, pSq);
+
+    if (ASMAtomicReadBool(&pThis->fSignalIdle))
+        PDMDevHlpAsyncNotificationCompleted(pThis->pDevInsR3);
+}
+
+/**
+ * Hands a prepared I/O request to the driver below.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pNs         The namespace.
+ * @param   hIoReq      The request handle.
+ * @param   pIoReq      The prepared request data.
+ */
+static void nvmeR3IoReqSubmit(PNVME pThis, PNVMENAMESPACE pNs, PDMMEDIAEXIOREQ hIoReq, PNVMEIOREQ pIoReq)
+{
+    PPDMIMEDIAEX pIf  = pNs->pDrvMediaEx;
+    PCNVMECMD    pCmd = &pIoReq->Cmd;
+    uint64_t     off  = RT_MAKE_U64(NVME_CMD_CDW(pCmd, 10), NVME_CMD_CDW(pCmd, 11)) * pNs->cbSector;
+    int          rc   = VINF_SUCCESS;
+
+    switch (NVME_CMD_OPC(pCmd))
+    {
+        case NVME_NVM_READ:
+            STAM_REL_COUNTER_INC(&pNs->StatReqsRead);
+            pNs->Led.Asserted.s.fReading = pNs->Led.Actual.s.fReading = 1;
+            rc = pIf->pfnIoReqRead(pIf, hIoReq, off, pIoReq->cbTransfer);
+            break;
+        case NVME_NVM_WRITE:
+            STAM_REL_COUNTER_INC(&pNs->StatReqsWrite);
+            pNs->Led.Asserted.s.fWriting = pNs->Led.Actual.s.fWriting = 1;
+            rc = pIf->pfnIoReqWrite(pIf, hIoReq, off, pIoReq->cbTransfer);
+            break;
+        case NVME_NVM_FLUSH:
+            STAM_REL_COUNTER_INC(&pNs->StatReqsFlush);
+            rc = pIf->pfnIoReqFlush(pIf, hIoReq);
+            break;
+        case NVME_NVM_DSM:
+            STAM_REL_COUNTER_INC(&pNs->StatReqsDsm);
+            if (pIoReq->cbTransfer)
+                rc = nvmeR3IoReqDiscard(pThis, pNs, hIoReq, pIoReq);
+            break;
+        default:
+            AssertMsgFailed(("Invalid opcode %#x\n", NVME_CMD_OPC(pCmd)));
+    }
+
+    if (rc != VINF_PDM_MEDIAEX_IOREQ_IN_PROGRESS)
+        nvmeR3IoReqComplete(pThis, pNs, hIoReq, pIoReq, rc);
+}
+
+/**
+ * Processes a command from an I/O submission queue.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pSq         The submission queue.
+ * @param   pCmd        The command.
+ */
+static void nvmeR3IoCmdProcess(PNVME pThis, PNVMEQUEUESUBM pSq, PCNVMECMD pCmd)
+{
+    uint16_t u16Cid = NVME_CMD_CID(pCmd);
+    uint16_t u16Status;
+
+    Log2(("NVMe: I/O command %#x CID=%#x SQ=%u NSID=%#x\n", NVME_CMD_OPC(pCmd), u16Cid, pSq->Hdr.u16Id, pCmd->u32Nsid));
+
+    if (   NVME_CMD_FUSE(pCmd)
+        || NVME_CMD_PSDT(pCmd))
+        u16Status = NVME_STATUS_INVALID_FIELD | NVME_STATUS_DNR;
+    else if (   !pCmd->u32Nsid
+             || pCmd->u32Nsid > pThis->cNamespaces
+             || !pThis->paNamespaces[pCmd->u32Nsid - 1].pDrvMediaEx)
+        u16Status = NVME_STATUS_INVALID_NS | NVME_STATUS_DNR;
+    else
+    {
+        PNVMENAMESPACE  pNs          = &pThis->paNamespaces[pCmd->u32Nsid - 1];
+        PPDMIMEDIAEX    pIf          = pNs->pDrvMediaEx;
+        PDMMEDIAEXIOREQ hIoReq       = NULL;
+        void           *pvIoReqAlloc = NULL;
+
+        int rc = pIf->pfnIoReqAlloc(pIf, &hIoReq, &pvIoReqAlloc, NVME_IOREQ_ID_MAKE(pSq->Hdr.u16Id, u16Cid),
+                                    PDMIMEDIAEX_F_SUSPEND_ON_RECOVERABLE_ERR);
+        if (RT_SUCCESS(rc))
+        {
+            PNVMEIOREQ pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+
+            pIoReq->u16SqId = pSq->Hdr.u16Id;
+            pIoReq->u16Cid  = u16Cid;
+            pIoReq->Cmd     = *pCmd;
+            u16Status = nvmeR3IoReqPrepare(pThis, pNs, pIoReq);
+            if (u16Status == NVME_STATUS_SUCCESS)
+            {
+                ASMAtomicIncU32(&pSq->cReqsActive);
+                nvmeR3IoReqSubmit(pThis, pNs, hIoReq, pIoReq);
+                return;
+            }
+
+            pIf->pfnIoReqFree(pIf, hIoReq);
+        }
+        else if (rc == VERR_PDM_MEDIAEX_IOREQID_CONFLICT)
+            u16Status = NVME_STATUS_CMD_ID_CONFLICT | NVME_STATUS_DNR;
+        else
+            u16Status = NVME_STATUS_INTERNAL_ERROR;
+    }
+
+    nvmeR3CmdComplete(pThis, pSq, u16Cid, u16Status, 0);
+}
+
+
+/* -=-=-=-=-=- Worker threads -=-=-=-=-=- */
+
+/**
+ * Fetches and processes new commands from the given submission queue.
+ *
+ * @returns true if any command was processed.
+ * @param   pThis       The NVMe controller instance.
+ * @param   pWrkThrd    The calling worker thread.
+ * @param   idSq        The submission queue identifier.
+ */
+static bool nvmeR3SubmQueueProcess(PNVME pThis, PNVMEWRKTHRD pWrkThrd, uint16_t idSq)
+{
+    PNVMEQUEUESUBM pSq        = &pThis->paQueuesSubmR3[idSq];
+    bool           fProcessed = false;
+
+    /* The reference keeps a pending deletion from completing under our feet. */
+    ASMAtomicIncU32(&pSq->cReqsActive);
+    if (   ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) == NVMEQUEUESTATE_ALLOCATED
+        && pSq->pWrkThrdR3 == pWrkThrd)
+    {
+        PNVMEQUEUECOMP pCq     = &pThis->paQueuesCompR3[pSq->u16CompletionQueueId];
+        uint32_t       cBudget = NVME_SUBM_QUEUE_BURST;
+        uint32_t       idxHead = pSq->Hdr.idxHead;
+        uint32_t       idxTail = ASMAtomicReadU32(&pSq->Hdr.idxTail);
+        NVMECMD        aCmds[8];
+
+        while (   idxHead != idxTail
+               && cBudget
+               && ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState) == NVMESTATE_READY
+               && !ASMAtomicReadBool(&pThis->fSignalIdle))
+        {
+            /* Stop fetching while the completion queue can't take the results. */
+            if (ASMAtomicReadU32(&pCq->cWaiters) >= pThis->cCompQueuesWaitersMax)
+            {
+                STAM_REL_COUNTER_INC(&pThis->StatSubmQueueThrottled);
+                break;
+            }
+
+            /* Read as many contiguous entries as possible at once. */
+            uint32_t cCmds = idxTail > idxHead ? idxTail - idxHead : pSq->Hdr.cEntries - idxHead;
+            cCmds = RT_MIN(cCmds, RT_MIN(cBudget, RT_ELEMENTS(aCmds)));
+            PDMDevHlpPCIPhysRead(pThis->CTX_SUFF(pDevIns), pSq->Hdr.GCPhysBase + (RTGCPHYS)idxHead * sizeof(NVMECMD),
+                                 &aCmds[0], cCmds * sizeof(NVMECMD));
+
+            for (uint32_t i = 0; i < cCmds; i++)
+            {
+                idxHead = (idxHead + 1) % pSq->Hdr.cEntries;
+                ASMAtomicWriteU32(&pSq->Hdr.idxHead, idxHead);
+
+                if (idSq == 0)
+                    nvmeR3AdmCmdProcess(pThis, pSq, &aCmds[i]);
+                else
+                    nvmeR3IoCmdProcess(pThis, pSq, &aCmds[i]);
+            }
+
+            cBudget   -= cCmds;
+            fProcessed = true;
+            idxTail    = ASMAtomicReadU32(&pSq->Hdr.idxTail);
+        }
+    }
+    nvmeR3SubmQueueRelease(pThis, pSq);
+
+    return fProcessed;
+}
+
+/**
+ * Worker thread loop processing the assigned submission queues.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The thread structure.
+ */
+static DECLCALLBACK(int) nvmeR3WrkThrdLoop(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PNVMEWRKTHRD pWrkThrd   = (PNVMEWRKTHRD)pThread->pvUser;
+    PNVME        pThis      = pWrkThrd->pNvme;
+    bool         fProcessed = false;
+    uint16_t     au16SqIds[NVME_QUEUES_MAX];
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        /* Only wait when the last round found nothing to do, the queues are processed round robin. */
+        if (!fProcessed)
+        {
+            int rc = SUPSemEventWaitNoResume(pThis->pSupDrvSession, pWrkThrd->hEvtProcess, RT_INDEFINITE_WAIT);
+            AssertLogRelMsgReturn(RT_SUCCESS(rc) || rc == VERR_INTERRUPTED, ("%Rrc\n", rc), rc);
+            if (RT_UNLIKELY(pThread->enmState != PDMTHREADSTATE_RUNNING))
+                break;
+        }
+
+        fProcessed = false;
+        ASMAtomicIncU32(&pThis->cWrkThrdsActive);
+
+        if (   !ASMAtomicReadBool(&pThis->fSignalIdle)
+            && ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState) == NVMESTATE_READY)
+        {
+            uint32_t       cSqs = 0;
+            PNVMEQUEUESUBM pIt;
+
+            RTCritSectEnter(&pWrkThrd->CritSectLstSubm);
+            RTListForEach(&pWrkThrd->LstSubmQueues, pIt, NVMEQUEUESUBM, NdLstWrkThrdAssgnd)
+                au16SqIds[cSqs++] = pIt->Hdr.u16Id;
+            RTCritSectLeave(&pWrkThrd->CritSectLstSubm);
+
+            for (uint32_t i = 0; i < cSqs; i++)
+                fProcessed |= nvmeR3SubmQueueProcess(pThis, pWrkThrd, au16SqIds[i]);
+        }
+
+        if (   !ASMAtomicDecU32(&pThis->cWrkThrdsActive)
+            && ASMAtomicReadBool(&pThis->fSignalIdle))
+            PDMDevHlpAsyncNotificationCompleted(pDevIns);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Unblocks a worker thread so it can respond to a state change.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The thread structure.
+ */
+static DECLCALLBACK(int) nvmeR3WrkThrdWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PNVMEWRKTHRD pWrkThrd = (PNVMEWRKTHRD)pThread->pvUser;
+    NOREF(pDevIns);
+
+    /* The event is already gone when the thread is destroyed after the destructor ran. */
+    if (pWrkThrd->hEvtProcess == NIL_SUPSEMEVENT)
+        return VINF_SUCCESS;
+    return SUPSemEventSignal(pWrkThrd->pNvme->pSupDrvSession, pWrkThrd->hEvtProcess);
+}
+
+/**
+ * Consumer for the wake queue, kicks the worker of a submission queue
+ * after a doorbell write in RC.
+ *
+ * @returns true.
+ * @param   pDevIns     The device instance.
+ * @param   pItem       The item.
+ */
+static DECLCALLBACK(bool) nvmeR3WakeQueueConsumer(PPDMDEVINS pDevIns, PPDMQUEUEITEMCORE pItem)
+{
+    PNVME              pThis     = PDMINS_2_DATA(pDevIns, PNVME);
+    PNVMEWAKEQUEUEITEM pWakeItem = (PNVMEWAKEQUEUEITEM)pItem;
+    PNVMEQUEUESUBM     pSq       = &pThis->paQueuesSubmR3[pWakeItem->u16SqId];
+
+    if (ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState) == NVMEQUEUESTATE_ALLOCATED)
+    {
+        int rc = SUPSemEventSignal(pThis->pSupDrvSession, pSq->hEvtProcess);
+        AssertRC(rc);
+    }
+
+    return true;
+}
+
+
+/* -=-=-=-=-=- Controller state -=-=-=-=-=- */
+
+/**
+ * Enables the controller, setting up the admin queue pair.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ */
+static void nvmeR3CtrlEnable(PNVME pThis)
+{
+    uint32_t cSqEntries = NVME_AQA_ASQS_GET(pThis->u32RegAqa) + 1;
+    uint32_t cCqEntries = NVME_AQA_ACQS_GET(pThis->u32RegAqa) + 1;
+
+    /* The guest should wait for RDY to clear before enabling again. */
+    if (   ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState) == NVMESTATE_RESETTING
+        && !nvmeR3CtrlResetFinalize(pThis, false /*fForce*/))
+    {
+        LogRel(("NVMe#%u: Controller enabled while a reset is still in progress\n", pThis->pDevInsR3->iInstance));
+        ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_FATAL);
+        return;
+    }
+
+    if (   cSqEntries < 2
+        || cCqEntries < 2
+        || cSqEntries > pThis->cQueueEntriesMax
+        || cCqEntries > pThis->cQueueEntriesMax
+        || pThis->uMpsSet > NVME_CAP_MPSMAX
+        || pThis->uCssSet != 0
+        || pThis->uAmsSet != 0
+        || !pThis->u64RegAsq
+        || !pThis->u64RegAcq)
+    {
+        LogRel(("NVMe#%u: Invalid controller configuration (AQA=%#RX32 MPS=%u CSS=%u AMS=%u ASQ=%#RX64 ACQ=%#RX64)\n",
+                pThis->pDevInsR3->iInstance, pThis->u32RegAqa, pThis->uMpsSet, pThis->uCssSet, pThis->uAmsSet,
+                pThis->u64RegAsq, pThis->u64RegAcq));
+        ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_FATAL);
+        return;
+    }
+
+    pThis->cbPage = NVME_PAGE_SIZE_MIN << pThis->uMpsSet;
+
+    PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[0];
+    pCq->Hdr.u16Id      = 0;
+    pCq->Hdr.fPhysCont  = true;
+    pCq->Hdr.cEntries   = cCqEntries;
+    pCq->Hdr.enmType    = NVMEQUEUETYPE_COMPLETION;
+    pCq->Hdr.GCPhysBase = pThis->u64RegAcq;
+    pCq->Hdr.cbEntry    = sizeof(NVMECQE);
+    pCq->Hdr.idxHead    = 0;
+    pCq->Hdr.idxTail    = 0;
+    pCq->fIntrEnabled   = true;
+    pCq->fPhase         = true;
+    pCq->u32IntrVec     = 0;
+    pCq->cSubmQueuesRef = 1;
+    pCq->cWaiters       = 0;
+    RTListInit(&pCq->LstCompletionsWaiting);
+    ASMAtomicWriteU32((volatile uint32_t *)&pCq->Hdr.enmState, NVMEQUEUESTATE_ALLOCATED);
+
+    PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[0];
+    pSq->Hdr.u16Id            = 0;
+    pSq->Hdr.fPhysCont        = true;
+    pSq->Hdr.cEntries         = cSqEntries;
+    pSq->Hdr.enmType          = NVMEQUEUETYPE_SUBMISSION;
+    pSq->Hdr.GCPhysBase       = pThis->u64RegAsq;
+    pSq->Hdr.cbEntry          = sizeof(NVMECMD);
+    pSq->Hdr.idxHead          = 0;
+    pSq->Hdr.idxTail          = 0;
+    pSq->u16CompletionQueueId = 0;
+    pSq->u16CidDelete         = 0;
+    pSq->enmPriority          = NVMEQUEUESUBMPRIO_URGENT;
+    nvmeR3WrkThrdAssignSq(pThis, pSq);
+    ASMAtomicWriteU32((volatile uint32_t *)&pSq->Hdr.enmState, NVMEQUEUESTATE_ALLOCATED);
+
+    ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_READY);
+    LogRel(("NVMe#%u: Controller enabled (admin queues %u/%u entries, page size %u)\n",
+            pThis->pDevInsR3->iInstance, cSqEntries, cCqEntries, pThis->cbPage));
+}
+
+/**
+ * Finishes a controller reset, invalidating all queues.
+ *
+ * @returns true if the reset finished, false if commands are still outstanding.
+ * @param   pThis       The NVMe controller instance.
+ * @param   fForce      Flag whether to reset even with outstanding commands,
+ *                      only valid if the VM is quiesced.
+ */
+static bool nvmeR3CtrlResetFinalize(PNVME pThis, bool fForce)
+{
+    if (!fForce)
+    {
+        if (ASMAtomicReadU32(&pThis->cWrkThrdsActive))
+            return false;
+        for (uint32_t i = 0; i < pThis->cQueuesSubmMax; i++)
+            if (ASMAtomicReadU32(&pThis->paQueuesSubmR3[i].cReqsActive))
+                return false;
+    }
+
+    for (uint32_t i = 0; i < pThis->cQueuesSubmMax; i++)
+    {
+        PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[i];
+        nvmeR3WrkThrdRemoveSq(pThis, pSq);
+        ASMAtomicWriteU32((volatile uint32_t *)&pSq->Hdr.enmState, NVMEQUEUESTATE_INVALID);
+    }
+
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+        RTSemFastMutexRequest(pCq->hMtx);
+        if (ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) != NVMEQUEUESTATE_INVALID)
+        {
+            ASMAtomicWriteU32((volatile uint32_t *)&pCq->Hdr.enmState, NVMEQUEUESTATE_INVALID);
+            nvmeR3CompQueueWaitersFree(pCq);
+        }
+        ASMAtomicWriteU32(&pCq->cSubmQueuesRef, 0);
+        RTSemFastMutexRelease(pCq->hMtx);
+    }
+
+    /* Outstanding asynchronous event requests are dropped. */
+    RTCritSectEnter(&pThis->CritSectAsyncEvtReqs);
+    pThis->cAsyncEvtReqsCur          = 0;
+    pThis->fAsyncEvtNsChangedPending = false;
+    pThis->fAsyncEvtNsChangedMasked  = false;
+    RTCritSectLeave(&pThis->CritSectAsyncEvtReqs);
+
+    TMTimerStop(pThis->pIntrCoalescingTimerR3);
+    nvmeR3FeatReset(pThis);
+
+    PDMCritSectEnter(&pThis->CritSectIntx, VERR_IGNORED);
+    ASMAtomicWriteU32(&pThis->u32IntrMask, 0);
+    ASMAtomicWriteU32(&pThis->u32IntrSts, 0);
+    PDMDevHlpPCISetIrq(pThis->pDevInsR3, 0, PDM_IRQ_LEVEL_LOW);
+    PDMCritSectLeave(&pThis->CritSectIntx);
+
+    ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_INIT);
+    Log(("NVMe#%u: Controller reset finished\n", pThis->pDevInsR3->iInstance));
+    return true;
+}
+
+/**
+ * Handles a write to the controller configuration register.
+ *
+ * @returns nothing.
+ * @param   pThis       The NVMe controller instance.
+ * @param   u32Value    The value written.
+ */
+static void nvmeR3RegCcWrite(PNVME pThis, uint32_t u32Value)
+{
+    bool     fEnable = RT_BOOL(u32Value & NVME_CC_EN);
+    uint32_t uSqes   = NVME_CC_IOSQES_GET(u32Value);
+    uint32_t uCqes   = NVME_CC_IOCQES_GET(u32Value);
+    uint32_t uShn    = NVME_CC_SHN_GET(u32Value);
+
+    Log(("NVMe#%u: CC=%#RX32\n", pThis->pDevInsR3->iInstance, u32Value));
+
+    /* These are only writable while the controller is disabled. */
+    if (!pThis->fCcEnabled)
+    {
+        pThis->uCssSet = NVME_CC_CSS_GET(u32Value);
+        pThis->uMpsSet = NVME_CC_MPS_GET(u32Value);
+        pThis->uAmsSet = NVME_CC_AMS_GET(u32Value);
+    }
+    pThis->u32IoSubmissionQueueEntrySize = uSqes ? RT_BIT_32(uSqes) : 0;
+    pThis->u32IoCompletionQueueEntrySize = uCqes ? RT_BIT_32(uCqes) : 0;
+
+    if (uShn != pThis->uShutdwnNotifierLast)
+    {
+        /* Nothing is cached in the controller, the shutdown is complete immediately. */
+        pThis->uShutdwnNotifierLast = uShn;
+        pThis->uShutdwnStatus       = uShn ? NVME_CSTS_SHST_COMPLETE : NVME_CSTS_SHST_NORMAL;
+        if (uShn)
+            LogRel(("NVMe#%u: Shutdown notification\n", pThis->pDevInsR3->iInstance));
+    }
+
+    if (fEnable && !pThis->fCcEnabled)
+    {
+        pThis->fCcEnabled = true;
+        nvmeR3CtrlEnable(pThis);
+    }
+    else if (!fEnable && pThis->fCcEnabled)
+    {
+        /* Wait for outstanding commands, the guest polls CSTS.RDY which finishes the reset. */
+        pThis->fCcEnabled = false;
+        ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_RESETTING);
+        nvmeR3CtrlResetFinalize(pThis, false /*fForce*/);
+    }
+}
+
+
+
+/* -=-=-=-=-=- Namespace port interfaces -=-=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) nvmeR3NsQueryInterface(PPDMIBASE pInterface, const char *pszIID)
+{
+    PNVMENAMESPACE pNs = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IBase);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBASE, &pNs->IBase);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAPORT, &pNs->IPort);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAEXPORT, &pNs->IMediaExPort);
+    return NULL;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAPORT,pfnQueryDeviceLocation}
+ */
+static DECLCALLBACK(int) nvmeR3NsQueryDeviceLocation(PPDMIMEDIAPORT pInterface, const char **ppcszController,
+                                                     uint32_t *piInstance, uint32_t *piLUN)
+{
+    PNVMENAMESPACE pNs     = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IPort);
+    PPDMDEVINS     pDevIns = pNs->pNvmeR3->pDevInsR3;
+
+    AssertPtrReturn(ppcszController, VERR_INVALID_POINTER);
+    AssertPtrReturn(piInstance, VERR_INVALID_POINTER);
+    AssertPtrReturn(piLUN, VERR_INVALID_POINTER);
+
+    *ppcszController = pDevIns->pReg->szName;
+    *piInstance      = pDevIns->iInstance;
+    *piLUN           = pNs->iLUN;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCompleteNotify}
+ */
+static DECLCALLBACK(int) nvmeR3IoReqCompleteNotify(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                   void *pvIoReqAlloc, int rcReq)
+{
+    PNVMENAMESPACE pNs = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IMediaExPort);
+
+    nvmeR3IoReqComplete(pNs->pNvmeR3, pNs, hIoReq, (PNVMEIOREQ)pvIoReqAlloc, rcReq);
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyFromBuf}
+ */
+static DECLCALLBACK(int) nvmeR3IoReqCopyFromBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                void *pvIoReqAlloc, uint32_t offDst, PRTSGBUF pSgBuf,
+                                                size_t cbCopy)
+{
+    PNVMENAMESPACE pNs    = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IMediaExPort);
+    PNVMEIOREQ     pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+    NOREF(hIoReq);
+
+    if (   offDst > pIoReq->cbTransfer
+        || cbCopy > pIoReq->cbTransfer - offDst)
+        return VERR_PDM_MEDIAEX_IOBUF_OVERFLOW;
+
+    size_t cbCopied = nvmeR3PrpCopy(pNs->pNvmeR3, &pIoReq->aGCPhysPrps[0], pIoReq->cPrps, offDst,
+                                    pSgBuf, cbCopy, true /*fToGuest*/);
+    return cbCopied == cbCopy ? VINF_SUCCESS : VERR_PDM_MEDIAEX_IOBUF_OVERFLOW;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyToBuf}
+ */
+static DECLCALLBACK(int) nvmeR3IoReqCopyToBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                              void *pvIoReqAlloc, uint32_t offSrc, PRTSGBUF pSgBuf,
+                                              size_t cbCopy)
+{
+    PNVMENAMESPACE pNs    = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IMediaExPort);
+    PNVMEIOREQ     pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+    NOREF(hIoReq);
+
+    if (   offSrc > pIoReq->cbTransfer
+        || cbCopy > pIoReq->cbTransfer - offSrc)
+        return VERR_PDM_MEDIAEX_IOBUF_UNDERRUN;
+
+    size_t cbCopied = nvmeR3PrpCopy(pNs->pNvmeR3, &pIoReq->aGCPhysPrps[0], pIoReq->cPrps, offSrc,
+                                    pSgBuf, cbCopy, false /*fToGuest*/);
+    return cbCopied == cbCopy ? VINF_SUCCESS : VERR_PDM_MEDIAEX_IOBUF_UNDERRUN;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQueryBuf}
+ */
+static DECLCALLBACK(int) nvmeR3IoReqQueryBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                             void *pvIoReqAlloc, PCRTSGSEG *ppaSeg, unsigned *pcSegs)
+{
+    PNVMENAMESPACE pNs     = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IMediaExPort);
+    PNVME          pThis   = pNs->pNvmeR3;
+    PPDMDEVINS     pDevIns = pThis->CTX_SUFF(pDevIns);
+    PNVMEIOREQ     pIoReq  = (PNVMEIOREQ)pvIoReqAlloc;
+    bool           fRead   = NVME_CMD_OPC(&pIoReq->Cmd) == NVME_NVM_READ;
+    uint32_t       cbLeft  = pIoReq->cbTransfer;
+    unsigned       cSegs   = 0;
+    int            rc      = VINF_SUCCESS;
+    NOREF(hIoReq);
+
+    /*
+     * A PRP entry must map to exactly one page of the host so the guest memory can be locked
+     * entry by entry. Bus mastering is checked here because the direct mapping bypasses it.
+     */
+    if (   pThis->cbPage != PAGE_SIZE
+        || !PCIDevIsBusmaster(&pThis->PciDev))
+        return VERR_NOT_SUPPORTED;
+
+    Assert(!pIoReq->cPageLocks);
+    for (uint32_t idxPrp = 0; idxPrp < pIoReq->cPrps && cbLeft; idxPrp++)
+    {
+        RTGCPHYS GCPhys  = pIoReq->aGCPhysPrps[idxPrp];
+        uint32_t offPage = (uint32_t)(GCPhys & PAGE_OFFSET_MASK);
+        uint32_t cbThis  = RT_MIN(PAGE_SIZE - offPage, cbLeft);
+        void    *pvPage  = NULL;
+
+        if (fRead)
+            rc = PDMDevHlpPhysGCPhys2CCPtr(pDevIns, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK, 0, &pvPage,
+                                           &pIoReq->aPageLocks[pIoReq->cPageLocks]);
+        else
+            rc = PDMDevHlpPhysGCPhys2CCPtrReadOnly(pDevIns, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK, 0,
+                                                   (const void **)&pvPage, &pIoReq->aPageLocks[pIoReq->cPageLocks]);
+        if (RT_FAILURE(rc))
+            break;
+        pIoReq->cPageLocks++;
+
+        /* Merge with the previous segment if the host mapping happens to be contiguous. */
+        uint8_t *pbSeg = (uint8_t *)pvPage + offPage;
+        if (   cSegs
+            && (uint8_t *)pIoReq->aSegs[cSegs - 1].pvSeg + pIoReq->aSegs[cSegs - 1].cbSeg == pbSeg)
+            pIoReq->aSegs[cSegs - 1].cbSeg += cbThis;
+        else
+        {
+            pIoReq->aSegs[cSegs].pvSeg = pbSeg;
+            pIoReq->aSegs[cSegs].cbSeg = cbThis;
+            cSegs++;
+        }
+        cbLeft -= cbThis;
+    }
+
+    if (   RT_FAILURE(rc)
+        || cbLeft)
+    {
+        /* MMIO or otherwise special memory, let the driver use the copy interface. */
+        nvmeR3IoReqPagesRelease(pThis, pIoReq);
+        return VERR_NOT_SUPPORTED;
+    }
+
+    STAM_REL_COUNTER_INC(&pNs->StatReqsDirect);
+    *ppaSeg = &pIoReq->aSegs[0];
+    *pcSegs = cSegs;
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqStateChanged}
+ */
+static DECLCALLBACK(void) nvmeR3IoReqStateChanged(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                  void *pvIoReqAlloc, PDMMEDIAEXIOREQSTATE enmState)
+{
+    PNVMENAMESPACE pNs    = RT_FROM_MEMBER(pInterface, NVMENAMESPACE, IMediaExPort);
+    PNVMEIOREQ     pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+    NOREF(hIoReq); NOREF(pNs); NOREF(pIoReq); NOREF(enmState);
+
+    /* The request stays active from the guest's point of view, nothing to do. */
+    Log(("NVMe: NSID %u: Command %#x of SQ %u changed state to %d\n",
+         pNs->u32Id, pIoReq->u16Cid, pIoReq->u16SqId, enmState));
+}
+
+
+/* -=-=-=-=-=- Status LUN -=-=-=-=-=- */
+
+/**
+ * Gets the pointer to the status LED of a unit.
+ *
+ * @returns VBox status code.
+ * @param   pInterface      Pointer to the interface structure containing the called function pointer.
+ * @param   iLUN            The unit which status LED we desire.
+ * @param   ppLed           Where to store the LED pointer.
+ */
+static DECLCALLBACK(int) nvmeR3Status_QueryStatusLed(PPDMILEDPORTS pInterface, unsigned iLUN, PPDMLED *ppLed)
+{
+    PNVME pThis = RT_FROM_MEMBER(pInterface, NVME, ILeds);
+
+    if (iLUN < pThis->cNamespaces)
+    {
+        *ppLed = &pThis->paNamespaces[iLUN].Led;
+        Assert((*ppLed)->u32Magic == PDMLED_MAGIC);
+        return VINF_SUCCESS;
+    }
+    return VERR_PDM_LUN_NOT_FOUND;
+}
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) nvmeR3Status_QueryInterface(PPDMIBASE pInterface, const char *pszIID)
+{
+    PNVME pThis = RT_FROM_MEMBER(pInterface, NVME, IBase);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBASE, &pThis->IBase);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMILEDPORTS, &pThis->ILeds);
+    return NULL;
+}
+
+
+/* -=-=-=-=-=- Namespace attachment -=-=-=-=-=- */
+
+/**
+ * Configures a namespace after a driver was attached to its LUN.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pNs         The namespace.
+ */
+static int nvmeR3NsConfigure(PPDMDEVINS pDevIns, PNVMENAMESPACE pNs)
+{
+    PPDMIMEDIA   pDrvMedia   = PDMIBASE_QUERY_INTERFACE(pNs->pDrvBase, PDMIMEDIA);
+    PPDMIMEDIAEX pDrvMediaEx = PDMIBASE_QUERY_INTERFACE(pNs->pDrvBase, PDMIMEDIAEX);
+
+    AssertMsgReturn(pDrvMedia,
+                    ("NVMe configuration error: LUN#%u misses the basic media interface!\n", pNs->iLUN),
+                    VERR_PDM_MISSING_INTERFACE);
+    AssertMsgReturn(pDrvMediaEx,
+                    ("NVMe configuration error: LUN#%u misses the extended media interface!\n", pNs->iLUN),
+                    VERR_PDM_MISSING_INTERFACE);
+
+    if (pDrvMedia->pfnGetType(pDrvMedia) != PDMMEDIATYPE_HARD_DISK)
+        return PDMDevHlpVMSetError(pDevIns, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                   N_("NVMe configuration error: LUN#%u is not a hard disk"), pNs->iLUN);
+
+    int rc = pDrvMediaEx->pfnIoReqAllocSizeSet(pDrvMediaEx, sizeof(NVMEIOREQ));
+    if (RT_FAILURE(rc))
+        return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                   N_("NVMe configuration error: LUN#%u: Failed to set I/O request size"), pNs->iLUN);
+
+    uint32_t cbSector = pDrvMedia->pfnGetSectorSize(pDrvMedia);
+    if (   cbSector < 512
+        || !RT_IS_POWER_OF_TWO(cbSector))
+        return PDMDevHlpVMSetError(pDevIns, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                   N_("NVMe configuration error: LUN#%u has an unsupported sector size of %u bytes"),
+                                   pNs->iLUN, cbSector);
+
+    pNs->pDrvMedia = pDrvMedia;
+    pNs->cbSector  = cbSector;
+    pNs->cSectors  = pDrvMedia->pfnGetSize(pDrvMedia) / cbSector;
+    pNs->fReadOnly = pDrvMedia->pfnIsReadOnly(pDrvMedia);
+    pNs->fDiscard  = pDrvMedia->pfnDiscard != NULL;
+
+    LogRel(("NVMe#%u: NSID %u: %llu sectors of %u bytes%s%s\n", pDevIns->iInstance, pNs->u32Id,
+            pNs->cSectors, pNs->cbSector, pNs->fReadOnly ? ", read-only" : "",
+            pNs->fDiscard ? ", deallocation supported" : ""));
+
+    /* Set last, the workers use it to decide whether the namespace is active. */
+    ASMAtomicWritePtr(&pNs->pDrvMediaEx, pDrvMediaEx);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Detach notification.
+ *
+ * The namespace becomes inactive, the guest is notified through the
+ * Namespace Attribute Changed event when hot unplugged.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   iLUN        The logical unit which is being detached.
+ * @param   fFlags      Flags, combination of the PDMDEVATT_FLAGS_* \#defines.
+ */
+static DECLCALLBACK(void) nvmeR3Detach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    AssertMsgReturnVoid(iLUN < pThis->cNamespaces, ("iLUN=%u\n", iLUN));
+    PNVMENAMESPACE pNs = &pThis->paNamespaces[iLUN];
+
+    Log(("%s: iLUN=%u\n", __FUNCTION__, iLUN));
+
+    ASMAtomicWriteNullPtr(&pNs->pDrvMediaEx);
+    pNs->pDrvMedia = NULL;
+    pNs->pDrvBase  = NULL;
+    pNs->cSectors  = 0;
+    pNs->cbSector  = 0;
+    pNs->fReadOnly = false;
+    pNs->fDiscard  = false;
+
+    if (!(fFlags & PDM_TACH_FLAGS_NOT_HOT_PLUG))
+        nvmeR3NamespaceChanged(pThis, pNs);
+}
+
+/**
+ * Attach command.
+ *
+ * This is called when a medium is hot plugged into a namespace.
+ * The VM is suspended at this point.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   iLUN        The logical unit which is being attached.
+ * @param   fFlags      Flags, combination of the PDMDEVATT_FLAGS_* \#defines.
+ */
+static DECLCALLBACK(int) nvmeR3Attach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    AssertMsgReturn(iLUN < pThis->cNamespaces, ("iLUN=%u\n", iLUN), VERR_PDM_LUN_NOT_FOUND);
+    PNVMENAMESPACE pNs = &pThis->paNamespaces[iLUN];
+
+    Log(("%s: iLUN=%u\n", __FUNCTION__, iLUN));
+
+    /* the usual paranoia */
+    AssertRelease(!pNs->pDrvBase);
+    AssertRelease(!pNs->pDrvMediaEx);
+
+    int rc = PDMDevHlpDriverAttach(pDevIns, iLUN, &pNs->IBase, &pNs->pDrvBase, NULL);
+    if (RT_SUCCESS(rc))
+        rc = nvmeR3NsConfigure(pDevIns, pNs);
+    else
+        AssertMsgFailed(("Failed to attach LUN#%u. rc=%Rrc\n", iLUN, rc));
+
+    if (RT_FAILURE(rc))
+    {
+        pNs->pDrvBase  = NULL;
+        pNs->pDrvMedia = NULL;
+    }
+    else if (!(fFlags & PDM_TACH_FLAGS_NOT_HOT_PLUG))
+        nvmeR3NamespaceChanged(pThis, pNs);
+
+    return rc;
+}
+
+
+/* -=-=-=-=-=- Saved State -=-=-=-=-=- */
+
+/**
+ * @callback_method_impl{FNSSMDEVLIVEEXEC}
+ */
+static DECLCALLBACK(int) nvmeR3LiveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uPass)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    NOREF(uPass);
+
+    /* config. */
+    SSMR3PutU32(pSSM, pThis->cQueuesSubmMax);
+    SSMR3PutU32(pSSM, pThis->cQueuesCompMax);
+    SSMR3PutU32(pSSM, pThis->cQueueEntriesMax);
+    SSMR3PutU32(pSSM, pThis->cIntrVecs);
+    SSMR3PutU32(pSSM, pThis->cNamespaces);
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+        SSMR3PutBool(pSSM, pThis->paNamespaces[i].pDrvBase != NULL);
+
+    return VINF_SSM_DONT_CALL_AGAIN;
+}
+
+/**
+ * @callback_method_impl{FNSSMDEVSAVEEXEC}
+ */
+static DECLCALLBACK(int) nvmeR3SaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    /* config */
+    nvmeR3LiveExec(pDevIns, pSSM, SSM_PASS_FINAL);
+
+    /* Controller registers and features. */
+    SSMR3PutU32(pSSM, pThis->enmState);
+    SSMR3PutBool(pSSM, pThis->fCcEnabled);
+    SSMR3PutU32(pSSM, pThis->u32IoCompletionQueueEntrySize);
+    SSMR3PutU32(pSSM, pThis->u32IoSubmissionQueueEntrySize);
+    SSMR3PutU32(pSSM, pThis->uShutdwnNotifierLast);
+    SSMR3PutU32(pSSM, pThis->uShutdwnStatus);
+    SSMR3PutU32(pSSM, pThis->uAmsSet);
+    SSMR3PutU32(pSSM, pThis->uMpsSet);
+    SSMR3PutU32(pSSM, pThis->uCssSet);
+    SSMR3PutU32(pSSM, pThis->u32RegIdx);
+    SSMR3PutU32(pSSM, pThis->cbPage);
+    SSMR3PutU32(pSSM, pThis->u32RegAqa);
+    SSMR3PutU64(pSSM, pThis->u64RegAsq);
+    SSMR3PutU64(pSSM, pThis->u64RegAcq);
+    SSMR3PutU32(pSSM, pThis->u32IntrMask);
+    SSMR3PutU32(pSSM, pThis->u32IntrSts);
+    SSMR3PutU32(pSSM, pThis->cQueuesSubmAlloc);
+    SSMR3PutU32(pSSM, pThis->cQueuesCompAlloc);
+    SSMR3PutU32(pSSM, pThis->u32FeatArbitration);
+    SSMR3PutU32(pSSM, pThis->u32FeatPowerMgmt);
+    SSMR3PutU32(pSSM, pThis->u32FeatTempThreshold);
+    SSMR3PutU32(pSSM, pThis->u32FeatErrRecovery);
+    SSMR3PutU32(pSSM, pThis->u32FeatAsyncEvtCfg);
+    SSMR3PutU8(pSSM, pThis->cIntrCoalescingThreshold);
+    SSMR3PutU8(pSSM, pThis->cIntrCoalescingTime);
+    SSMR3PutBool(pSSM, pThis->fFeatVolatileWc);
+    SSMR3PutBool(pSSM, pThis->fFeatWriteAtomicity);
+
+    /* Interrupt vectors. */
+    for (uint32_t i = 0; i < pThis->cIntrVecs; i++)
+    {
+        SSMR3PutBool(pSSM, pThis->aIntrVecs[i].fCoalescingDisabled);
+        SSMR3PutU32(pSSM, pThis->aIntrVecs[i].cEvtsPending);
+        SSMR3PutU64(pSSM, pThis->aIntrVecs[i].tsEvtFirst);
+    }
+    TMR3TimerSave(pThis->pIntrCoalescingTimerR3, pSSM);
+
+    /* Completion queues including the parked entries. */
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+
+        SSMR3PutU32(pSSM, pCq->Hdr.enmState);
+        if (pCq->Hdr.enmState == NVMEQUEUESTATE_INVALID)
+            continue;
+
+        SSMR3PutBool(pSSM, pCq->Hdr.fPhysCont);
+        SSMR3PutU32(pSSM, pCq->Hdr.cEntries);
+        SSMR3PutGCPhys(pSSM, pCq->Hdr.GCPhysBase);
+        SSMR3PutU32(pSSM, pCq->Hdr.idxHead);
+        SSMR3PutU32(pSSM, pCq->Hdr.idxTail);
+        SSMR3PutBool(pSSM, pCq->fIntrEnabled);
+        SSMR3PutBool(pSSM, pCq->fPhase);
+        SSMR3PutU32(pSSM, pCq->u32IntrVec);
+        SSMR3PutU32(pSSM, pCq->cSubmQueuesRef);
+        SSMR3PutU32(pSSM, pCq->cWaiters);
+
+        PNVMECOMPWAITER pIt;
+        RTListForEach(&pCq->LstCompletionsWaiting, pIt, NVMECOMPWAITER, NdLstWait)
+            SSMR3PutMem(pSSM, &pIt->Cqe, sizeof(pIt->Cqe));
+    }
+
+    /* Submission queues. */
+    for (uint32_t i = 0; i < pThis->cQueuesSubmMax; i++)
+    {
+        PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[i];
+
+        SSMR3PutU32(pSSM, pSq->Hdr.enmState);
+        if (pSq->Hdr.enmState == NVMEQUEUESTATE_INVALID)
+            continue;
+
+        SSMR3PutBool(pSSM, pSq->Hdr.fPhysCont);
+        SSMR3PutU32(pSSM, pSq->Hdr.cEntries);
+        SSMR3PutGCPhys(pSSM, pSq->Hdr.GCPhysBase);
+        SSMR3PutU32(pSSM, pSq->Hdr.idxHead);
+        SSMR3PutU32(pSSM, pSq->Hdr.idxTail);
+        SSMR3PutU16(pSSM, pSq->u16CompletionQueueId);
+        SSMR3PutU16(pSSM, pSq->u16CidDelete);
+        SSMR3PutU32(pSSM, pSq->enmPriority);
+    }
+
+    /* Asynchronous events. */
+    SSMR3PutU32(pSSM, pThis->cAsyncEvtReqsCur);
+    for (uint32_t i = 0; i < pThis->cAsyncEvtReqsCur; i++)
+        SSMR3PutU16(pSSM, pThis->paAsyncEvtReqCids[i]);
+    SSMR3PutBool(pSSM, pThis->fAsyncEvtNsChangedPending);
+    SSMR3PutBool(pSSM, pThis->fAsyncEvtNsChangedMasked);
+    SSMR3PutMem(pSSM, &pThis->bmNsChanged[0], sizeof(pThis->bmNsChanged));
+
+    /*
+     * Requests suspended by the driver because of a recoverable error, they
+     * are restarted when the VM resumes after loading the state.
+     */
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+    {
+        PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+        PPDMIMEDIAEX   pIf = pNs->pDrvMediaEx;
+
+        if (!pIf)
+            continue;
+
+        uint32_t cReqsSuspended = pIf->pfnIoReqGetSuspendedCount(pIf);
+        if (!cReqsSuspended)
+            continue;
+
+        PDMMEDIAEXIOREQ hIoReq       = NULL;
+        void           *pvIoReqAlloc = NULL;
+        int rc = pIf->pfnIoReqQuerySuspendedStart(pIf, &hIoReq, &pvIoReqAlloc);
+        while (RT_SUCCESS(rc) && cReqsSuspended--)
+        {
+            PNVMEIOREQ pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+
+            SSMR3PutU32(pSSM, i);
+            SSMR3PutU16(pSSM, pIoReq->u16SqId);
+            SSMR3PutMem(pSSM, &pIoReq->Cmd, sizeof(pIoReq->Cmd));
+            rc = pIf->pfnIoReqSuspendedSave(pIf, pSSM, hIoReq);
+            if (RT_SUCCESS(rc) && cReqsSuspended)
+                rc = pIf->pfnIoReqQuerySuspendedNext(pIf, hIoReq, &hIoReq, &pvIoReqAlloc);
+        }
+        AssertRCReturn(rc, rc);
+    }
+
+    return SSMR3PutU32(pSSM, UINT32_MAX); /* sanity/terminator */
+}
+
+/**
+ * @callback_method_impl{FNSSMDEVLOADEXEC}
+ */
+static DECLCALLBACK(int) nvmeR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    PNVME    pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    uint32_t u32;
+    int      rc;
+
+    if (uVersion != NVME_SAVED_STATE_VERSION)
+        return VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION;
+
+    /* Verify config. */
+    static const char *s_apszCfgNames[] = { "QueuesMax (submission)", "QueuesMax (completion)", "QueueEntriesMax",
+                                            "MSI-X vectors", "NamespacesMax" };
+    uint32_t const au32Cfg[] = { pThis->cQueuesSubmMax, pThis->cQueuesCompMax, pThis->cQueueEntriesMax,
+                                 pThis->cIntrVecs, pThis->cNamespaces };
+    for (uint32_t i = 0; i < RT_ELEMENTS(au32Cfg); i++)
+    {
+        rc = SSMR3GetU32(pSSM, &u32);
+        AssertRCReturn(rc, rc);
+        if (u32 != au32Cfg[i])
+            return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("Config mismatch: %s - saved=%u config=%u"),
+                                    s_apszCfgNames[i], u32, au32Cfg[i]);
+    }
+
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+    {
+        bool fInUse;
+        rc = SSMR3GetBool(pSSM, &fInUse);
+        AssertRCReturn(rc, rc);
+        if (fInUse != (pThis->paNamespaces[i].pDrvBase != NULL))
+            return SSMR3SetCfgError(pSSM, RT_SRC_POS,
+                                    N_("The %s VM is missing a device on namespace %u. Please make sure the source and target VMs have compatible storage configurations"),
+                                    fInUse ? "target" : "source", i + 1);
+    }
+
+    if (uPass != SSM_PASS_FINAL)
+        return VINF_SUCCESS;
+
+    /* Start from a clean controller, this drops all queues. */
+    nvmeR3CtrlResetFinalize(pThis, true /*fForce*/);
+
+    /* Controller registers and features. */
+    SSMR3GetU32(pSSM, (uint32_t *)&pThis->enmState);
+    SSMR3GetBool(pSSM, &pThis->fCcEnabled);
+    SSMR3GetU32(pSSM, &pThis->u32IoCompletionQueueEntrySize);
+    SSMR3GetU32(pSSM, &pThis->u32IoSubmissionQueueEntrySize);
+    SSMR3GetU32(pSSM, &pThis->uShutdwnNotifierLast);
+    SSMR3GetU32(pSSM, &pThis->uShutdwnStatus);
+    SSMR3GetU32(pSSM, &pThis->uAmsSet);
+    SSMR3GetU32(pSSM, &pThis->uMpsSet);
+    SSMR3GetU32(pSSM, &pThis->uCssSet);
+    SSMR3GetU32(pSSM, &pThis->u32RegIdx);
+    SSMR3GetU32(pSSM, &pThis->cbPage);
+    SSMR3GetU32(pSSM, &pThis->u32RegAqa);
+    SSMR3GetU64(pSSM, &pThis->u64RegAsq);
+    SSMR3GetU64(pSSM, &pThis->u64RegAcq);
+    SSMR3GetU32(pSSM, (uint32_t *)&pThis->u32IntrMask);
+    SSMR3GetU32(pSSM, (uint32_t *)&pThis->u32IntrSts);
+    SSMR3GetU32(pSSM, &pThis->cQueuesSubmAlloc);
+    SSMR3GetU32(pSSM, &pThis->cQueuesCompAlloc);
+    SSMR3GetU32(pSSM, &pThis->u32FeatArbitration);
+    SSMR3GetU32(pSSM, &pThis->u32FeatPowerMgmt);
+    SSMR3GetU32(pSSM, &pThis->u32FeatTempThreshold);
+    SSMR3GetU32(pSSM, &pThis->u32FeatErrRecovery);
+    SSMR3GetU32(pSSM, &pThis->u32FeatAsyncEvtCfg);
+    SSMR3GetU8(pSSM, &pThis->cIntrCoalescingThreshold);
+    SSMR3GetU8(pSSM, &pThis->cIntrCoalescingTime);
+    SSMR3GetBool(pSSM, &pThis->fFeatVolatileWc);
+    rc = SSMR3GetBool(pSSM, &pThis->fFeatWriteAtomicity);
+    AssertRCReturn(rc, rc);
+
+    if (   pThis->cQueuesSubmAlloc >= pThis->cQueuesSubmMax
+        || pThis->cQueuesCompAlloc >= pThis->cQueuesCompMax
+        || (pThis->cbPage & (pThis->cbPage - 1)))
+        return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+    /* Interrupt vectors. */
+    for (uint32_t i = 0; i < pThis->cIntrVecs; i++)
+    {
+        SSMR3GetBool(pSSM, &pThis->aIntrVecs[i].fCoalescingDisabled);
+        SSMR3GetU32(pSSM, (uint32_t *)&pThis->aIntrVecs[i].cEvtsPending);
+        SSMR3GetU64(pSSM, (uint64_t *)&pThis->aIntrVecs[i].tsEvtFirst);
+    }
+    rc = TMR3TimerLoad(pThis->pIntrCoalescingTimerR3, pSSM);
+    AssertRCReturn(rc, rc);
+
+    /* Completion queues. */
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+        uint32_t       cWaiters;
+
+        rc = SSMR3GetU32(pSSM, &u32);
+        AssertRCReturn(rc, rc);
+        if (u32 == NVMEQUEUESTATE_INVALID)
+            continue;
+        if (u32 != NVMEQUEUESTATE_ALLOCATED)
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+        pCq->Hdr.u16Id   = (uint16_t)i;
+        pCq->Hdr.enmType = NVMEQUEUETYPE_COMPLETION;
+        pCq->Hdr.cbEntry = sizeof(NVMECQE);
+        SSMR3GetBool(pSSM, &pCq->Hdr.fPhysCont);
+        SSMR3GetU32(pSSM, &pCq->Hdr.cEntries);
+        SSMR3GetGCPhys(pSSM, &pCq->Hdr.GCPhysBase);
+        SSMR3GetU32(pSSM, (uint32_t *)&pCq->Hdr.idxHead);
+        SSMR3GetU32(pSSM, (uint32_t *)&pCq->Hdr.idxTail);
+        SSMR3GetBool(pSSM, &pCq->fIntrEnabled);
+        SSMR3GetBool(pSSM, &pCq->fPhase);
+        SSMR3GetU32(pSSM, &pCq->u32IntrVec);
+        SSMR3GetU32(pSSM, (uint32_t *)&pCq->cSubmQueuesRef);
+        rc = SSMR3GetU32(pSSM, &cWaiters);
+        AssertRCReturn(rc, rc);
+
+        if (   pCq->Hdr.cEntries < 2
+            || pCq->Hdr.cEntries > pThis->cQueueEntriesMax
+            || pCq->Hdr.idxHead >= pCq->Hdr.cEntries
+            || pCq->Hdr.idxTail >= pCq->Hdr.cEntries
+            || pCq->u32IntrVec >= pThis->cIntrVecs)
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+        RTListInit(&pCq->LstCompletionsWaiting);
+        pCq->cWaiters = 0;
+        while (cWaiters--)
+        {
+            PNVMECOMPWAITER pWaiter = (PNVMECOMPWAITER)RTMemAlloc(sizeof(NVMECOMPWAITER));
+            if (!pWaiter)
+                return VERR_NO_MEMORY;
+
+            rc = SSMR3GetMem(pSSM, &pWaiter->Cqe, sizeof(pWaiter->Cqe));
+            RTListAppend(&pCq->LstCompletionsWaiting, &pWaiter->NdLstWait);
+            pCq->cWaiters++;
+            AssertRCReturn(rc, rc);
+        }
+
+        ASMAtomicWriteU32((volatile uint32_t *)&pCq->Hdr.enmState, NVMEQUEUESTATE_ALLOCATED);
+    }
+
+    /* Submission queues. */
+    for (uint32_t i = 0; i < pThis->cQueuesSubmMax; i++)
+    {
+        PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[i];
+
+        pSq->cReqsActive = 0;
+
+        rc = SSMR3GetU32(pSSM, &u32);
+        AssertRCReturn(rc, rc);
+        if (u32 == NVMEQUEUESTATE_INVALID)
+            continue;
+        if (   u32 != NVMEQUEUESTATE_ALLOCATED
+            && u32 != NVMEQUEUESTATE_DELETING)
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+        pSq->Hdr.u16Id   = (uint16_t)i;
+        pSq->Hdr.enmType = NVMEQUEUETYPE_SUBMISSION;
+        pSq->Hdr.cbEntry = sizeof(NVMECMD);
+        SSMR3GetBool(pSSM, &pSq->Hdr.fPhysCont);
+        SSMR3GetU32(pSSM, &pSq->Hdr.cEntries);
+        SSMR3GetGCPhys(pSSM, &pSq->Hdr.GCPhysBase);
+        SSMR3GetU32(pSSM, (uint32_t *)&pSq->Hdr.idxHead);
+        SSMR3GetU32(pSSM, (uint32_t *)&pSq->Hdr.idxTail);
+        SSMR3GetU16(pSSM, &pSq->u16CompletionQueueId);
+        SSMR3GetU16(pSSM, &pSq->u16CidDelete);
+        rc = SSMR3GetU32(pSSM, (uint32_t *)&pSq->enmPriority);
+        AssertRCReturn(rc, rc);
+
+        if (   pSq->Hdr.cEntries < 2
+            || pSq->Hdr.cEntries > pThis->cQueueEntriesMax
+            || pSq->Hdr.idxHead >= pSq->Hdr.cEntries
+            || pSq->Hdr.idxTail >= pSq->Hdr.cEntries
+            || pSq->u16CompletionQueueId >= pThis->cQueuesCompMax)
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+        /* Queues being deleted are not processed anymore, only waiting for their requests. */
+        if (u32 == NVMEQUEUESTATE_ALLOCATED)
+            nvmeR3WrkThrdAssignSq(pThis, pSq);
+        ASMAtomicWriteU32((volatile uint32_t *)&pSq->Hdr.enmState, u32);
+    }
+
+    /* Asynchronous events. */
+    rc = SSMR3GetU32(pSSM, &pThis->cAsyncEvtReqsCur);
+    AssertRCReturn(rc, rc);
+    if (pThis->cAsyncEvtReqsCur > pThis->cAsyncEvtReqsMax)
+        return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+    for (uint32_t i = 0; i < pThis->cAsyncEvtReqsCur; i++)
+        SSMR3GetU16(pSSM, &pThis->paAsyncEvtReqCids[i]);
+    SSMR3GetBool(pSSM, &pThis->fAsyncEvtNsChangedPending);
+    SSMR3GetBool(pSSM, &pThis->fAsyncEvtNsChangedMasked);
+    rc = SSMR3GetMem(pSSM, &pThis->bmNsChanged[0], sizeof(pThis->bmNsChanged));
+    AssertRCReturn(rc, rc);
+
+    /* Suspended requests. */
+    for (;;)
+    {
+        uint32_t iNs;
+        uint16_t u16SqId;
+        NVMECMD  Cmd;
+
+        rc = SSMR3GetU32(pSSM, &iNs);
+        AssertRCReturn(rc, rc);
+        if (iNs == UINT32_MAX)
+            break;
+
+        SSMR3GetU16(pSSM, &u16SqId);
+        rc = SSMR3GetMem(pSSM, &Cmd, sizeof(Cmd));
+        AssertRCReturn(rc, rc);
+
+        if (   iNs >= pThis->cNamespaces
+            || !pThis->paNamespaces[iNs].pDrvMediaEx
+            || u16SqId == 0
+            || u16SqId >= pThis->cQueuesSubmMax
+            || pThis->paQueuesSubmR3[u16SqId].Hdr.enmState == NVMEQUEUESTATE_INVALID)
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+
+        PNVMENAMESPACE  pNs          = &pThis->paNamespaces[iNs];
+        PPDMIMEDIAEX    pIf          = pNs->pDrvMediaEx;
+        PNVMEQUEUESUBM  pSq          = &pThis->paQueuesSubmR3[u16SqId];
+        PDMMEDIAEXIOREQ hIoReq       = NULL;
+        void           *pvIoReqAlloc = NULL;
+
+        rc = pIf->pfnIoReqAlloc(pIf, &hIoReq, &pvIoReqAlloc, NVME_IOREQ_ID_MAKE(u16SqId, NVME_CMD_CID(&Cmd)),
+                                PDMIMEDIAEX_F_SUSPEND_ON_RECOVERABLE_ERR);
+        AssertRCReturn(rc, rc);
+
+        PNVMEIOREQ pIoReq = (PNVMEIOREQ)pvIoReqAlloc;
+        pIoReq->u16SqId = u16SqId;
+        pIoReq->u16Cid  = NVME_CMD_CID(&Cmd);
+        pIoReq->Cmd     = Cmd;
+        if (nvmeR3IoReqPrepare(pThis, pNs, pIoReq) != NVME_STATUS_SUCCESS)
+        {
+            pIf->pfnIoReqFree(pIf, hIoReq);
+            return VERR_SSM_DATA_UNIT_FORMAT_CHANGED;
+        }
+
+        rc = pIf->pfnIoReqSuspendedLoad(pIf, pSSM, hIoReq);
+        AssertRCReturn(rc, rc);
+        ASMAtomicIncU32(&pSq->cReqsActive);
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/* -=-=-=-=-=- Debug info -=-=-=-=-=- */
+
+/**
+ * @callback_method_impl{FNDBGFHANDLERDEV}
+ */
+static DECLCALLBACK(void) nvmeR3Info(PPDMDEVINS pDevIns, PCDBGFINFOHLP pHlp, const char *pszArgs)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    static const char *s_apszStates[] = { "INVALID", "INIT", "READY", "RESETTING", "FATAL" };
+    NOREF(pszArgs);
+
+    NVMESTATE enmState = (NVMESTATE)ASMAtomicReadU32((volatile uint32_t *)&pThis->enmState);
+    pHlp->pfnPrintf(pHlp,
+                    "%s#%d: mmio=%RGp state=%s vectors=%u%s workers=%u GC=%RTbool R0=%RTbool\n",
+                    pDevIns->pReg->szName, pDevIns->iInstance, pThis->GCPhysMMIO,
+                    (unsigned)enmState < RT_ELEMENTS(s_apszStates) ? s_apszStates[enmState] : "<invalid>",
+                    pThis->cIntrVecs, nvmeIsMsixEnabled(pThis) ? " (MSI-X)" : "",
+                    pThis->cWrkThrdsCur, pThis->fRCEnabled, pThis->fR0Enabled);
+    pHlp->pfnPrintf(pHlp, "AQA=%#RX32 ASQ=%#RX64 ACQ=%#RX64 MPS=%u IOSQES=%u IOCQES=%u\n",
+                    pThis->u32RegAqa, pThis->u64RegAsq, pThis->u64RegAcq, pThis->uMpsSet,
+                    pThis->u32IoSubmissionQueueEntrySize, pThis->u32IoCompletionQueueEntrySize);
+    pHlp->pfnPrintf(pHlp, "Queues granted: %u submission, %u completion\n",
+                    pThis->cQueuesSubmAlloc, pThis->cQueuesCompAlloc);
+
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+        if (ASMAtomicReadU32((volatile uint32_t *)&pCq->Hdr.enmState) == NVMEQUEUESTATE_INVALID)
+            continue;
+        pHlp->pfnPrintf(pHlp, "CQ %3u: base=%RGp entries=%u head=%u tail=%u phase=%u vector=%u%s waiters=%u\n",
+                        i, pCq->Hdr.GCPhysBase, pCq->Hdr.cEntries, pCq->Hdr.idxHead, pCq->Hdr.idxTail,
+                        pCq->fPhase, pCq->u32IntrVec, pCq->fIntrEnabled ? "" : " (disabled)", pCq->cWaiters);
+    }
+
+    for (uint32_t i = 0; i < pThis->cQueuesSubmMax; i++)
+    {
+        PNVMEQUEUESUBM pSq = &pThis->paQueuesSubmR3[i];
+        uint32_t enmSqState = ASMAtomicReadU32((volatile uint32_t *)&pSq->Hdr.enmState);
+        if (enmSqState == NVMEQUEUESTATE_INVALID)
+            continue;
+        pHlp->pfnPrintf(pHlp, "SQ %3u: base=%RGp entries=%u head=%u tail=%u cq=%u worker=%d active=%u%s\n",
+                        i, pSq->Hdr.GCPhysBase, pSq->Hdr.cEntries, pSq->Hdr.idxHead, pSq->Hdr.idxTail,
+                        pSq->u16CompletionQueueId, pSq->pWrkThrdR3 ? (int)pSq->pWrkThrdR3->idWrkThrd : -1,
+                        pSq->cReqsActive, enmSqState == NVMEQUEUESTATE_DELETING ? " (deleting)" : "");
+    }
+
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+    {
+        PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+        if (!pNs->pDrvMediaEx)
+            continue;
+        pHlp->pfnPrintf(pHlp, "NSID %3u: sectors=%llu sector-size=%u read-only=%RTbool dealloc=%RTbool\n",
+                        pNs->u32Id, pNs->cSectors, pNs->cbSector, pNs->fReadOnly, pNs->fDiscard);
+    }
+}
+
+
+/* -=-=-=-=-=- VM state changes -=-=-=-=-=- */
+
+/**
+ * Checks whether all outstanding I/O is finished.
+ *
+ * @returns true if quiesced, false if busy.
+ * @param   pDevIns     The device instance.
+ */
+static bool nvmeR3AllAsyncIOIsFinished(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    if (ASMAtomicReadU32(&pThis->cWrkThrdsActive))
+        return false;
+
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+    {
+        PPDMIMEDIAEX pIf = pThis->paNamespaces[i].pDrvMediaEx;
+        if (   pIf
+            && pIf->pfnIoReqGetActiveCount(pIf))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Callback employed by nvmeR3Suspend and nvmeR3PowerOff.
+ *
+ * @returns true if we've quiesced, false if we're still working.
+ * @param   pDevIns     The device instance.
+ */
+static DECLCALLBACK(bool) nvmeR3IsAsyncSuspendOrPowerOffDone(PPDMDEVINS pDevIns)
+{
+    if (!nvmeR3AllAsyncIOIsFinished(pDevIns))
+        return false;
+
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+    return true;
+}
+
+/**
+ * Common worker for nvmeR3Suspend and nvmeR3PowerOff.
+ */
+static void nvmeR3SuspendOrPowerOff(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    ASMAtomicWriteBool(&pThis->fSignalIdle, true);
+    if (!nvmeR3AllAsyncIOIsFinished(pDevIns))
+        PDMDevHlpSetAsyncNotification(pDevIns, nvmeR3IsAsyncSuspendOrPowerOffDone);
+    else
+        ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+}
+
+/**
+ * Suspend notification.
+ *
+ * @param   pDevIns     The device instance data.
+ */
+static DECLCALLBACK(void) nvmeR3Suspend(PPDMDEVINS pDevIns)
+{
+    Log(("nvmeR3Suspend\n"));
+    nvmeR3SuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * Resume notification.
+ *
+ * @param   pDevIns     The device instance data.
+ */
+static DECLCALLBACK(void) nvmeR3Resume(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    Log(("nvmeR3Resume\n"));
+
+    /* Pick up commands the guest submitted while the workers were told to stop. */
+    nvmeR3WrkThrdsKickAll(pThis);
+}
+
+/**
+ * Poweroff notification.
+ *
+ * @param   pDevIns Pointer to the device instance
+ */
+static DECLCALLBACK(void) nvmeR3PowerOff(PPDMDEVINS pDevIns)
+{
+    Log(("nvmeR3PowerOff\n"));
+    nvmeR3SuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * Common reset worker.
+ *
+ * @param   pDevIns     The device instance data.
+ */
+static void nvmeR3ResetCommon(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    pThis->fCcEnabled                    = false;
+    pThis->u32IoCompletionQueueEntrySize = 0;
+    pThis->u32IoSubmissionQueueEntrySize = 0;
+    pThis->uShutdwnNotifierLast          = 0;
+    pThis->uShutdwnStatus                = NVME_CSTS_SHST_NORMAL;
+    pThis->uAmsSet                       = 0;
+    pThis->uMpsSet                       = 0;
+    pThis->uCssSet                       = 0;
+    pThis->u32RegIdx                     = 0;
+    pThis->cbPage                        = NVME_PAGE_SIZE_MIN;
+    pThis->u32RegAqa                     = 0;
+    pThis->u64RegAsq                     = 0;
+    pThis->u64RegAcq                     = 0;
+    pThis->cQueuesSubmAlloc              = 0;
+    pThis->cQueuesCompAlloc              = 0;
+
+    ASMAtomicWriteU32((volatile uint32_t *)&pThis->enmState, NVMESTATE_RESETTING);
+    nvmeR3CtrlResetFinalize(pThis, true /*fForce*/);
+
+    RT_ZERO(pThis->bmNsChanged);
+}
+
+/**
+ * Callback employed by nvmeR3Reset.
+ *
+ * @returns true if we've quiesced, false if we're still working.
+ * @param   pDevIns     The device instance.
+ */
+static DECLCALLBACK(bool) nvmeR3IsAsyncResetDone(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    if (!nvmeR3AllAsyncIOIsFinished(pDevIns))
+        return false;
+    ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+
+    nvmeR3ResetCommon(pDevIns);
+    return true;
+}
+
+/**
+ * Reset notification.
+ *
+ * @param   pDevIns     The device instance data.
+ */
+static DECLCALLBACK(void) nvmeR3Reset(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+
+    ASMAtomicWriteBool(&pThis->fSignalIdle, true);
+    if (!nvmeR3AllAsyncIOIsFinished(pDevIns))
+        PDMDevHlpSetAsyncNotification(pDevIns, nvmeR3IsAsyncResetDone);
+    else
+    {
+        ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+        nvmeR3ResetCommon(pDevIns);
+    }
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnRelocate}
+ */
+static DECLCALLBACK(void) nvmeR3Relocate(PPDMDEVINS pDevIns, RTGCINTPTR offDelta)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    PVM   pVM   = PDMDevHlpGetVM(pDevIns);
+
+    pThis->pDevInsRC      += offDelta;
+    pThis->pWakeQueueRC    = PDMQueueRCPtr(pThis->pWakeQueueR3);
+    pThis->paQueuesSubmRC  = MMHyperR3ToRC(pVM, pThis->paQueuesSubmR3);
+    pThis->paQueuesCompRC  = MMHyperR3ToRC(pVM, pThis->paQueuesCompR3);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnDestruct}
+ */
+static DECLCALLBACK(int) nvmeR3Destruct(PPDMDEVINS pDevIns)
+{
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    PDMDEV_CHECK_VERSIONS_RETURN_QUIET(pDevIns);
+
+    /*
+     * The worker threads are suspended at this point and will not enter
+     * this module again. PDM destroys them after we return, so the thread
+     * structures must stay alive.
+     */
+    PNVMEWRKTHRD pWrkThrd;
+    RTListForEach(&pThis->LstWrkThrds, pWrkThrd, NVMEWRKTHRD, NdLstWrkThrds)
+    {
+        if (pWrkThrd->hEvtProcess != NIL_SUPSEMEVENT)
+        {
+            SUPSemEventClose(pThis->pSupDrvSession, pWrkThrd->hEvtProcess);
+            pWrkThrd->hEvtProcess = NIL_SUPSEMEVENT;
+        }
+
+        if (RTCritSectIsInitialized(&pWrkThrd->CritSectLstSubm))
+            RTCritSectDelete(&pWrkThrd->CritSectLstSubm);
+    }
+
+    if (pThis->paQueuesCompR3)
+    {
+        for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+        {
+            PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+            if (pCq->hMtx != NIL_RTSEMFASTMUTEX)
+            {
+                nvmeR3CompQueueWaitersFree(pCq);
+                RTSemFastMutexDestroy(pCq->hMtx);
+                pCq->hMtx = NIL_RTSEMFASTMUTEX;
+            }
+        }
+    }
+
+    if (RTCritSectIsInitialized(&pThis->CritSectWrkThrds))
+        RTCritSectDelete(&pThis->CritSectWrkThrds);
+    if (RTCritSectIsInitialized(&pThis->CritSectAsyncEvtReqs))
+        RTCritSectDelete(&pThis->CritSectAsyncEvtReqs);
+    if (PDMCritSectIsInitialized(&pThis->CritSectIntx))
+        PDMR3CritSectDelete(&pThis->CritSectIntx);
+
+    return VINF_SUCCESS;
+}
+
+
+/* -=-=-=-=-=- PCI regions -=-=-=-=-=- */
+
+/**
+ * @callback_method_impl{FNPCIIOREGIONMAP, Maps the register space.}
+ */
+static DECLCALLBACK(int) nvmeR3MMIOMap(PPCIDEVICE pPciDev, /*unsigned*/ int iRegion, RTGCPHYS GCPhysAddress,
+                                       uint32_t cb, PCIADDRESSSPACE enmType)
+{
+    PPDMDEVINS pDevIns = pPciDev->pDevIns;
+    PNVME      pThis   = PDMINS_2_DATA(pDevIns, PNVME);
+    NOREF(iRegion); NOREF(enmType);
+
+    Log2(("%s: registering MMIO area at GCPhysAddr=%RGp cb=%u\n", __FUNCTION__, GCPhysAddress, cb));
+
+    int rc = PDMDevHlpMMIORegister(pDevIns, GCPhysAddress, cb, NULL /*pvUser*/,
+                                   IOMMMIO_FLAGS_READ_DWORD_QWORD | IOMMMIO_FLAGS_WRITE_ONLY_DWORD_QWORD
+                                   | IOMMMIO_FLAGS_NO_DEV_LOCK,
+                                   nvmeMMIOWrite, nvmeMMIORead, "NVMe");
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (pThis->fR0Enabled)
+    {
+        rc = PDMDevHlpMMIORegisterR0(pDevIns, GCPhysAddress, cb, NIL_RTR0PTR /*pvUser*/, "nvmeMMIOWrite", "nvmeMMIORead");
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    if (pThis->fRCEnabled)
+    {
+        rc = PDMDevHlpMMIORegisterRC(pDevIns, GCPhysAddress, cb, NIL_RTRCPTR /*pvUser*/, "nvmeMMIOWrite", "nvmeMMIORead");
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    pThis->GCPhysMMIO = GCPhysAddress;
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNPCIIOREGIONMAP, Maps the index/data register pair.}
+ */
+static DECLCALLBACK(int) nvmeR3IdxDataIORangeMap(PPCIDEVICE pPciDev, /*unsigned*/ int iRegion, RTGCPHYS GCPhysAddress,
+                                                 uint32_t cb, PCIADDRESSSPACE enmType)
+{
+    PPDMDEVINS pDevIns = pPciDev->pDevIns;
+    PNVME      pThis   = PDMINS_2_DATA(pDevIns, PNVME);
+    NOREF(iRegion);
+
+    Log2(("%s: registering index/data ports at GCPhysAddr=%RGp cb=%u\n", __FUNCTION__, GCPhysAddress, cb));
+
+    Assert(enmType == PCI_ADDRESS_SPACE_IO);
+
+    int rc = PDMDevHlpIOPortRegister(pDevIns, (RTIOPORT)GCPhysAddress, cb, NULL,
+                                     nvmeIdxDataWrite, nvmeIdxDataRead, NULL, NULL, "NVMe IDX/DATA");
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (pThis->fR0Enabled)
+    {
+        rc = PDMDevHlpIOPortRegisterR0(pDevIns, (RTIOPORT)GCPhysAddress, cb, 0,
+                                       "nvmeIdxDataWrite", "nvmeIdxDataRead", NULL, NULL, "NVMe IDX/DATA");
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    if (pThis->fRCEnabled)
+    {
+        rc = PDMDevHlpIOPortRegisterRC(pDevIns, (RTIOPORT)GCPhysAddress, cb, 0,
+                                       "nvmeIdxDataWrite", "nvmeIdxDataRead", NULL, NULL, "NVMe IDX/DATA");
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    pThis->IOPortBase = (RTIOPORT)GCPhysAddress;
+    return rc;
+}
+
+
+/* -=-=-=-=-=- Construction -=-=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnConstruct}
+ */
+static DECLCALLBACK(int) nvmeR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGMNODE pCfg)
+{
+    PNVME      pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    PVM        pVM   = PDMDevHlpGetVM(pDevIns);
+    PPDMIBASE  pBase;
+    int        rc;
+    PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
+
+    /*
+     * Initialize the instance data (everything touched by the destructor need
+     * to be initialized here!).
+     */
+    pThis->pDevInsR3      = pDevIns;
+    pThis->pDevInsR0      = PDMDEVINS_2_R0PTR(pDevIns);
+    pThis->pDevInsRC      = PDMDEVINS_2_RCPTR(pDevIns);
+    pThis->pSupDrvSession = PDMDevHlpGetSupDrvSession(pDevIns);
+    pThis->enmState       = NVMESTATE_INIT;
+    pThis->cbPage         = NVME_PAGE_SIZE_MIN;
+    pThis->uShutdwnStatus = NVME_CSTS_SHST_NORMAL;
+    RTListInit(&pThis->LstWrkThrds);
+
+    /*
+     * Validate and read configuration.
+     */
+    if (!CFGMR3AreValuesValid(pCfg, "GCEnabled\0"
+                                    "R0Enabled\0"
+                                    "QueuesMax\0"
+                                    "QueueEntriesMax\0"
+                                    "CtrlTimeout\0"
+                                    "WorkerThreadsMax\0"
+                                    "CompletionQueueWaitersMax\0"
+                                    "AsyncEvtReqsMax\0"
+                                    "NamespacesMax\0"
+                                    "SerialNumber\0"
+                                    "ModelNumber\0"
+                                    "FirmwareRevision\0"))
+        return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
+                                N_("NVMe configuration error: unknown option specified"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "GCEnabled", &pThis->fRCEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read GCEnabled as boolean"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "R0Enabled", &pThis->fR0Enabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read R0Enabled as boolean"));
+
+    /** @cfgm{QueuesMax, uint32_t, 64}
+     * Number of queue pairs supported including the admin queue pair. The guest
+     * usually creates one I/O queue pair per CPU. */
+    rc = CFGMR3QueryU32Def(pCfg, "QueuesMax", &pThis->cQueuesSubmMax, NVME_QUEUES_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read QueuesMax as integer"));
+    if (   pThis->cQueuesSubmMax < 2
+        || pThis->cQueuesSubmMax > NVME_QUEUES_MAX)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: QueuesMax=%u must be between 2 and %u"),
+                                   pThis->cQueuesSubmMax, NVME_QUEUES_MAX);
+    pThis->cQueuesCompMax = pThis->cQueuesSubmMax;
+
+    /** @cfgm{QueueEntriesMax, uint32_t, 1024}
+     * Maximum number of entries of a single queue (CAP.MQES + 1). */
+    rc = CFGMR3QueryU32Def(pCfg, "QueueEntriesMax", &pThis->cQueueEntriesMax, NVME_QUEUE_ENTRIES_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read QueueEntriesMax as integer"));
+    if (   pThis->cQueueEntriesMax < 2
+        || pThis->cQueueEntriesMax > NVME_QUEUE_ENTRIES_MAX)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: QueueEntriesMax=%u must be between 2 and %u"),
+                                   pThis->cQueueEntriesMax, NVME_QUEUE_ENTRIES_MAX);
+
+    /** @cfgm{CtrlTimeout, uint32_t, 20}
+     * Controller ready timeout reported to the guest in 500ms units. */
+    rc = CFGMR3QueryU32Def(pCfg, "CtrlTimeout", &pThis->cTimeoutMax, NVME_TIMEOUT_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read CtrlTimeout as integer"));
+    if (   pThis->cTimeoutMax < 1
+        || pThis->cTimeoutMax > 255)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: CtrlTimeout=%u must be between 1 and 255"),
+                                   pThis->cTimeoutMax);
+
+    /** @cfgm{WorkerThreadsMax, uint32_t, 4}
+     * Number of worker threads the submission queues are distributed over. */
+    rc = CFGMR3QueryU32Def(pCfg, "WorkerThreadsMax", &pThis->cWrkThrdsMax, NVME_WRK_THRDS_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read WorkerThreadsMax as integer"));
+    if (   pThis->cWrkThrdsMax < 1
+        || pThis->cWrkThrdsMax > NVME_WRK_THRDS_MAX)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: WorkerThreadsMax=%u must be between 1 and %u"),
+                                   pThis->cWrkThrdsMax, NVME_WRK_THRDS_MAX);
+
+    /** @cfgm{CompletionQueueWaitersMax, uint32_t, 256}
+     * Number of completion entries parked on a full completion queue before
+     * the workers stop fetching new commands for it. */
+    rc = CFGMR3QueryU32Def(pCfg, "CompletionQueueWaitersMax", &pThis->cCompQueuesWaitersMax, NVME_COMP_QUEUE_WAITERS_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read CompletionQueueWaitersMax as integer"));
+    if (pThis->cCompQueuesWaitersMax < 1)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: CompletionQueueWaitersMax=%u should be at least 1"),
+                                   pThis->cCompQueuesWaitersMax);
+
+    /** @cfgm{AsyncEvtReqsMax, uint32_t, 4}
+     * Number of outstanding Asynchronous Event Request commands (AERL + 1). */
+    rc = CFGMR3QueryU32Def(pCfg, "AsyncEvtReqsMax", &pThis->cAsyncEvtReqsMax, NVME_ASYNC_EVT_REQS_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read AsyncEvtReqsMax as integer"));
+    if (   pThis->cAsyncEvtReqsMax < 1
+        || pThis->cAsyncEvtReqsMax > NVME_ASYNC_EVT_REQS_MAX)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: AsyncEvtReqsMax=%u must be between 1 and %u"),
+                                   pThis->cAsyncEvtReqsMax, NVME_ASYNC_EVT_REQS_MAX);
+
+    /** @cfgm{NamespacesMax, uint32_t, 1}
+     * Number of namespaces, namespace N is backed by the medium attached to LUN N-1. */
+    rc = CFGMR3QueryU32Def(pCfg, "NamespacesMax", &pThis->cNamespaces, 1);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read NamespacesMax as integer"));
+    if (   pThis->cNamespaces < 1
+        || pThis->cNamespaces > NVME_NAMESPACES_MAX)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NVMe configuration error: NamespacesMax=%u must be between 1 and %u"),
+                                   pThis->cNamespaces, NVME_NAMESPACES_MAX);
+
+    /** @cfgm{SerialNumber, string, VBOX-NVME-<instance>}
+     * The serial number reported in the Identify Controller data. */
+    char szSerialDef[NVME_SERIAL_NUMBER_LENGTH + 1];
+    RTStrPrintf(szSerialDef, sizeof(szSerialDef), "VBOX-NVME-%04u", iInstance);
+    rc = CFGMR3QueryStringDef(pCfg, "SerialNumber", pThis->aszSerialNumber, sizeof(pThis->aszSerialNumber),
+                              szSerialDef);
+    if (RT_FAILURE(rc))
+    {
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_INVALID_PARAMETER,
+                                    N_("NVMe configuration error: \"SerialNumber\" is longer than 20 bytes"));
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read \"SerialNumber\" as string"));
+    }
+
+    rc = CFGMR3QueryStringDef(pCfg, "ModelNumber", pThis->aszModelNumber, sizeof(pThis->aszModelNumber),
+                              "ORCL-VBOX-NVME-VER12");
+    if (RT_FAILURE(rc))
+    {
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_INVALID_PARAMETER,
+                                    N_("NVMe configuration error: \"ModelNumber\" is longer than 40 bytes"));
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read \"ModelNumber\" as string"));
+    }
+
+    rc = CFGMR3QueryStringDef(pCfg, "FirmwareRevision", pThis->aszFirmwareRevision, sizeof(pThis->aszFirmwareRevision),
+                              "1.0");
+    if (RT_FAILURE(rc))
+    {
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_INVALID_PARAMETER,
+                                    N_("NVMe configuration error: \"FirmwareRevision\" is longer than 8 bytes"));
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe configuration error: failed to read \"FirmwareRevision\" as string"));
+    }
+
+    Log(("%s: QueuesMax=%u QueueEntriesMax=%u WorkerThreadsMax=%u NamespacesMax=%u\n", __FUNCTION__,
+         pThis->cQueuesSubmMax, pThis->cQueueEntriesMax, pThis->cWrkThrdsMax, pThis->cNamespaces));
+
+    /*
+     * PCI configuration space.
+     */
+    PCIDevSetVendorId    (&pThis->PciDev, 0x80ee); /* Oracle */
+    PCIDevSetDeviceId    (&pThis->PciDev, 0x4e56); /* "NV" */
+    PCIDevSetCommand     (&pThis->PciDev, 0x0000);
+    PCIDevSetRevisionId  (&pThis->PciDev, 0x00);
+    PCIDevSetClassProg   (&pThis->PciDev, 0x02);   /* NVM Express */
+    PCIDevSetClassSub    (&pThis->PciDev, 0x08);   /* Non-volatile memory controller */
+    PCIDevSetClassBase   (&pThis->PciDev, 0x01);   /* Mass storage controller */
+    PCIDevSetInterruptLine(&pThis->PciDev, 0x00);
+    PCIDevSetInterruptPin (&pThis->PciDev, 0x01);
+#ifdef VBOX_WITH_MSI_DEVICES
+    PCIDevSetStatus      (&pThis->PciDev, VBOX_PCI_STATUS_CAP_LIST);
+    PCIDevSetCapabilityList(&pThis->PciDev, NVME_PCI_MSIX_CAP_OFFSET);
+#endif
+
+    /*
+     * Register the PCI device, it's I/O regions.
+     */
+    rc = PDMDevHlpSetDeviceCritSect(pDevIns, PDMDevHlpCritSectGetNop(pDevIns));
+    if (RT_FAILURE(rc))
+        return rc;
+
+    rc = PDMDevHlpPCIRegister(pDevIns, &pThis->PciDev);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pThis->cIntrVecs      = 1;
+    pThis->fMsixSupported = false;
+#ifdef VBOX_WITH_MSI_DEVICES
+    PDMMSIREG MsiReg;
+    RT_ZERO(MsiReg);
+    MsiReg.cMsixVectors    = (uint16_t)RT_MIN(pThis->cQueuesCompMax, NVME_INTR_VECS_MAX);
+    MsiReg.iMsixCapOffset  = NVME_PCI_MSIX_CAP_OFFSET;
+    MsiReg.iMsixNextOffset = 0x00;
+    MsiReg.iMsixBar        = NVME_PCI_MSIX_BAR;
+    rc = PDMDevHlpPCIRegisterMsi(pDevIns, &MsiReg);
+    if (RT_SUCCESS(rc))
+    {
+        pThis->cIntrVecs      = MsiReg.cMsixVectors;
+        pThis->fMsixSupported = true;
+    }
+    else
+    {
+        /* That's OK, we can work with the pin based interrupt. */
+        PCIDevSetCapabilityList(&pThis->PciDev, 0x0);
+        LogRel(("NVMe#%u: Failed to register MSI-X (%Rrc), using the pin based interrupt\n", iInstance, rc));
+    }
+#endif
+
+    rc = PDMDevHlpPCIIORegionRegister(pDevIns, 0, NVME_MMIO_SIZE,
+                                      (PCIADDRESSSPACE)(PCI_ADDRESS_SPACE_MEM | PCI_ADDRESS_SPACE_BAR64), nvmeR3MMIOMap);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe cannot register PCI memory region for registers"));
+
+    rc = PDMDevHlpPCIIORegionRegister(pDevIns, 2, NVME_IDX_DATA_SIZE, PCI_ADDRESS_SPACE_IO, nvmeR3IdxDataIORangeMap);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("NVMe cannot register PCI I/O region for the index/data pair"));
+
+    /*
+     * The queue arrays are accessed by the doorbell handlers in all contexts.
+     */
+    rc = MMHyperAlloc(pVM, pThis->cQueuesSubmMax * sizeof(NVMEQUEUESUBM), 1, MM_TAG_PDM_DEVICE_USER,
+                      (void **)&pThis->paQueuesSubmR3);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to allocate memory for the submission queues"));
+    pThis->paQueuesSubmR0 = MMHyperR3ToR0(pVM, pThis->paQueuesSubmR3);
+    pThis->paQueuesSubmRC = MMHyperR3ToRC(pVM, pThis->paQueuesSubmR3);
+
+    rc = MMHyperAlloc(pVM, pThis->cQueuesCompMax * sizeof(NVMEQUEUECOMP), 1, MM_TAG_PDM_DEVICE_USER,
+                      (void **)&pThis->paQueuesCompR3);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to allocate memory for the completion queues"));
+    pThis->paQueuesCompR0 = MMHyperR3ToR0(pVM, pThis->paQueuesCompR3);
+    pThis->paQueuesCompRC = MMHyperR3ToRC(pVM, pThis->paQueuesCompR3);
+
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+        pThis->paQueuesCompR3[i].hMtx = NIL_RTSEMFASTMUTEX;
+    for (uint32_t i = 0; i < pThis->cQueuesCompMax; i++)
+    {
+        PNVMEQUEUECOMP pCq = &pThis->paQueuesCompR3[i];
+        RTListInit(&pCq->LstCompletionsWaiting);
+        rc = RTSemFastMutexCreate(&pCq->hMtx);
+        if (RT_FAILURE(rc))
+            return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to create completion queue mutex"));
+    }
+
+    /*
+     * Locks.
+     */
+    rc = PDMDevHlpCritSectInit(pDevIns, &pThis->CritSectIntx, RT_SRC_POS, "NVMe#%uIntx", iInstance);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to create the interrupt critical section"));
+
+    rc = RTCritSectInit(&pThis->CritSectAsyncEvtReqs);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to create critical section"));
+
+    rc = RTCritSectInit(&pThis->CritSectWrkThrds);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to create critical section"));
+
+    pThis->paAsyncEvtReqCids = (uint16_t *)PDMDevHlpMMHeapAllocZ(pDevIns, pThis->cAsyncEvtReqsMax * sizeof(uint16_t));
+    if (!pThis->paAsyncEvtReqCids)
+        return VERR_NO_MEMORY;
+
+    /* Create the timer for the interrupt coalescing feature. */
+    rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, nvmeR3IntrCoalescingTimer, pThis,
+                                TMTIMER_FLAGS_NO_CRIT_SECT, "NVMe Intr Coalescing Timer", &pThis->pIntrCoalescingTimerR3);
+    if (RT_FAILURE(rc))
+    {
+        AssertMsgFailed(("pfnTMTimerCreate -> %Rrc\n", rc));
+        return rc;
+    }
+
+    /*
+     * Create the wake up queue.
+     *
+     * We need 2 items for every submission queue because of SMP races.
+     */
+    rc = PDMDevHlpQueueCreate(pDevIns, sizeof(NVMEWAKEQUEUEITEM), pThis->cQueuesSubmMax * 2, 0,
+                              nvmeR3WakeQueueConsumer, true, "NVMe-Wake", &pThis->pWakeQueueR3);
+    if (RT_FAILURE(rc))
+        return rc;
+    pThis->pWakeQueueR0 = PDMQueueR0Ptr(pThis->pWakeQueueR3);
+    pThis->pWakeQueueRC = PDMQueueRCPtr(pThis->pWakeQueueR3);
+
+    nvmeR3FeatReset(pThis);
+
+    /*
+     * Worker threads.
+     */
+    for (uint32_t i = 0; i < pThis->cWrkThrdsMax; i++)
+    {
+        char szName[24];
+        RTStrPrintf(szName, sizeof(szName), "NVMe%u-W%u", iInstance, i);
+
+        PNVMEWRKTHRD pWrkThrd = (PNVMEWRKTHRD)PDMDevHlpMMHeapAllocZ(pDevIns, sizeof(NVMEWRKTHRD));
+        if (!pWrkThrd)
+            return VERR_NO_MEMORY;
+
+        pWrkThrd->pNvme       = pThis;
+        pWrkThrd->idWrkThrd   = i;
+        pWrkThrd->hEvtProcess = NIL_SUPSEMEVENT;
+        RTListInit(&pWrkThrd->LstSubmQueues);
+
+        rc = RTCritSectInit(&pWrkThrd->CritSectLstSubm);
+        if (RT_FAILURE(rc))
+            return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe: Failed to create critical section"));
+        RTListAppend(&pThis->LstWrkThrds, &pWrkThrd->NdLstWrkThrds);
+
+        rc = SUPSemEventCreate(pThis->pSupDrvSession, &pWrkThrd->hEvtProcess);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("NVMe: Failed to create SUP event semaphore"));
+
+        rc = PDMDevHlpThreadCreate(pDevIns, &pWrkThrd->pThrd, pWrkThrd, nvmeR3WrkThrdLoop,
+                                   nvmeR3WrkThrdWakeUp, 0, RTTHREADTYPE_IO, szName);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("NVMe: Failed to create worker thread %s"), szName);
+        pThis->cWrkThrdsCur++;
+    }
+
+    /*
+     * Namespaces, attach drivers to every LUN.
+     */
+    pThis->paNamespaces = (PNVMENAMESPACE)PDMDevHlpMMHeapAllocZ(pDevIns, pThis->cNamespaces * sizeof(NVMENAMESPACE));
+    if (!pThis->paNamespaces)
+        return VERR_NO_MEMORY;
+
+    for (uint32_t i = 0; i < pThis->cNamespaces; i++)
+    {
+        PNVMENAMESPACE pNs = &pThis->paNamespaces[i];
+        char szName[24];
+        RTStrPrintf(szName, sizeof(szName), "Namespace%u", i + 1);
+
+        pNs->u32Id                                   = i + 1;
+        pNs->iLUN                                    = i;
+        pNs->pNvmeR3                                 = pThis;
+        pNs->Led.u32Magic                            = PDMLED_MAGIC;
+        pNs->IBase.pfnQueryInterface                 = nvmeR3NsQueryInterface;
+        pNs->IPort.pfnQueryDeviceLocation            = nvmeR3NsQueryDeviceLocation;
+        pNs->IMediaExPort.pfnIoReqCompleteNotify     = nvmeR3IoReqCompleteNotify;
+        pNs->IMediaExPort.pfnIoReqCopyFromBuf        = nvmeR3IoReqCopyFromBuf;
+        pNs->IMediaExPort.pfnIoReqCopyToBuf          = nvmeR3IoReqCopyToBuf;
+        pNs->IMediaExPort.pfnIoReqStateChanged       = nvmeR3IoReqStateChanged;
+        pNs->IMediaExPort.pfnIoReqQueryBuf           = nvmeR3IoReqQueryBuf;
+
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatBytesRead, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data read.", "/Devices/NVMe%u/Namespace%u/ReadBytes", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatBytesWritten, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data written.", "/Devices/NVMe%u/Namespace%u/WrittenBytes", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatReqsRead, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of read commands.", "/Devices/NVMe%u/Namespace%u/Reads", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatReqsWrite, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of write commands.", "/Devices/NVMe%u/Namespace%u/Writes", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatReqsFlush, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of flush commands.", "/Devices/NVMe%u/Namespace%u/Flushes", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatReqsDsm, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of dataset management commands.", "/Devices/NVMe%u/Namespace%u/Dsm", iInstance, i + 1);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pNs->StatReqsDirect, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of transfers without an intermediate buffer.", "/Devices/NVMe%u/Namespace%u/DirectTransfers", iInstance, i + 1);
+
+        rc = PDMDevHlpDriverAttach(pDevIns, pNs->iLUN, &pNs->IBase, &pNs->pDrvBase, szName);
+        if (RT_SUCCESS(rc))
+        {
+            rc = nvmeR3NsConfigure(pDevIns, pNs);
+            if (RT_FAILURE(rc))
+            {
+                Log(("%s: Failed to configure %s.\n", __FUNCTION__, szName));
+                return rc;
+            }
+        }
+        else if (rc == VERR_PDM_NO_ATTACHED_DRIVER)
+        {
+            pNs->pDrvBase = NULL;
+            rc = VINF_SUCCESS;
+            LogRel(("NVMe#%u: %s: No driver attached\n", iInstance, szName));
+        }
+        else
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("NVMe: Failed to attach drive to %s"), szName);
+    }
+
+    /*
+     * Attach status driver (optional).
+     */
+    pThis->IBase.pfnQueryInterface = nvmeR3Status_QueryInterface;
+    pThis->ILeds.pfnQueryStatusLed = nvmeR3Status_QueryStatusLed;
+    rc = PDMDevHlpDriverAttach(pDevIns, PDM_STATUS_LUN, &pThis->IBase, &pBase, "Status Port");
+    if (RT_SUCCESS(rc))
+        pThis->pLedsConnector = PDMIBASE_QUERY_INTERFACE(pBase, PDMILEDCONNECTORS);
+    else if (rc != VERR_PDM_NO_ATTACHED_DRIVER)
+    {
+        AssertMsgFailed(("Failed to attach to status driver. rc=%Rrc\n", rc));
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("NVMe cannot attach to status driver"));
+    }
+
+    rc = PDMDevHlpSSMRegisterEx(pDevIns, NVME_SAVED_STATE_VERSION, sizeof(*pThis), NULL,
+                                NULL, nvmeR3LiveExec, NULL,
+                                NULL, nvmeR3SaveExec, NULL,
+                                NULL, nvmeR3LoadExec, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Register the info item and statistics.
+     */
+    char szTmp[128];
+    RTStrPrintf(szTmp, sizeof(szTmp), "%s%d", pDevIns->pReg->szName, pDevIns->iInstance);
+    PDMDevHlpDBGFInfoRegister(pDevIns, szTmp, "NVMe info", nvmeR3Info);
+
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntrsRaised, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of interrupts raised.", "/Devices/NVMe%u/IntrsRaised", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntrsCoalesced, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of interrupts saved by coalescing.", "/Devices/NVMe%u/IntrsCoalesced", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatCompQueueFull, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of completion entries parked on a full completion queue.", "/Devices/NVMe%u/CompQueueFull", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatSubmQueueThrottled, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of times command fetching stopped because of parked completions.", "/Devices/NVMe%u/SubmQueueThrottled", iInstance);
+#ifdef VBOX_WITH_STATISTICS
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatDoorbellSubm, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of submission queue doorbell writes.", "/Devices/NVMe%u/DoorbellSubm", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatDoorbellComp, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of completion queue doorbell writes.", "/Devices/NVMe%u/DoorbellComp", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatRegToR3, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of register accesses forwarded to ring-3.", "/Devices/NVMe%u/RegToR3", iInstance);
+#endif
+
+    LogRel(("NVMe#%u: %u queue pairs with %u entries, %u worker threads, %u interrupt vector(s)%s\n",
+            iInstance, pThis->cQueuesSubmMax, pThis->cQueueEntriesMax, pThis->cWrkThrdsCur,
+            pThis->cIntrVecs, pThis->fMsixSupported ? " (MSI-X)" : ""));
+    return VINF_SUCCESS;
+}
+
+/**
+ * The device registration structure.
+ */
+const PDMDEVREG g_DeviceNVMe =
+{
+    /* u32Version */
+    PDM_DEVREG_VERSION,
+    /* szName */
+    "nvme",
+    /* szRCMod */
+    "VBoxDDRC.rc",
+    /* szR0Mod */
+    "VBoxDDR0.r0",
+    /* pszDescription */
+    "Non-Volatile Memory Express (NVMe) Controller.\n",
+    /* fFlags */
+    PDM_DEVREG_FLAGS_DEFAULT_BITS | PDM_DEVREG_FLAGS_RC | PDM_DEVREG_FLAGS_R0 |
+    PDM_DEVREG_FLAGS_FIRST_SUSPEND_NOTIFICATION | PDM_DEVREG_FLAGS_FIRST_POWEROFF_NOTIFICATION |
+    PDM_DEVREG_FLAGS_FIRST_RESET_NOTIFICATION,
+    /* fClass */
+    PDM_DEVREG_CLASS_STORAGE,
+    /* cMaxInstances */
+    ~0U,
+    /* cbInstance */
+    sizeof(NVME),
+    /* pfnConstruct */
+    nvmeR3Construct,
+    /* pfnDestruct */
+    nvmeR3Destruct,
+    /* pfnRelocate */
+    nvmeR3Relocate,
+    /* pfnMemSetup */
+    NULL,
+    /* pfnPowerOn */
+    NULL,
+    /* pfnReset */
+    nvmeR3Reset,
+    /* pfnSuspend */
+    nvmeR3Suspend,
+    /* pfnResume */
+    nvmeR3Resume,
+    /* pfnAttach */
+    nvmeR3Attach,
+    /* pfnDetach */
+    nvmeR3Detach,
+    /* pfnQueryInterface. */
+    NULL,
+    /* pfnInitComplete */
+    NULL,
+    /* pfnPowerOff */
+    nvmeR3PowerOff,
+    /* pfnSoftReset */
+    NULL,
+    /* u32VersionEnd */
+    PDM_DEVREG_VERSION
+};
+
+#endif /* IN_RING3 */
+#endif /* !VBOX_DEVICE_STRUCT_TESTCASE */
@@ -255,6 +255,14 @@ static DECLCALLBACK(int) drvscsiGetSectorSize(VSCSILUN hVScsiLun, void *pvScsiLu
 
     return VINF_SUCCESS;
 }
+
+static DECLCALLBACK(int) drvscsiGetUuid(VSCSILUN hVScsiLun, void *pvScsiLunUser, PRTUUID pUuid)
+{
+    PDRVSCSI pThis = (PDRVSCSI)pvScsiLunUser;
+
+    return pThis->pDrvMedia->pfnGetUuid(pThis->pDrvMedia, pUuid);
+}
+
 static DECLCALLBACK(int) drvscsiSetLock(VSCSILUN hVScsiLun, void *pvScsiLunUser, bool fLocked)
 {
     PDRVSCSI pThis = (PDRVSCSI)pvScsiLunUser;
@@ -1011,6 +1019,7 @@ static DECLCALLBACK(int) drvscsiConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, ui
     pThis->VScsiIoCallbacks.pfnVScsiLunReqTransferEnqueue  = drvscsiReqTransferEnqueue;
     pThis->VScsiIoCallbacks.pfnVScsiLunGetFeatureFlags     = drvscsiGetFeatureFlags;
     pThis->VScsiIoCallbacks.pfnVScsiLunMediumSetLock       = drvscsiSetLock;
+    pThis->VScsiIoCallbacks.pfnVScsiLunMediumGetUuid       = drvscsiGetUuid;
 
     rc = VSCSIDeviceCreate(&pThis->hVScsiDevice, drvscsiVScsiReqCompleted, pThis);
     AssertMsgReturn(RT_SUCCESS(rc), ("Failed to create VSCSI device rc=%Rrc\n", rc), rc);
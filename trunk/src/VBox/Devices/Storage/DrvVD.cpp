@@ -206,6 +206,9 @@ typedef struct PDMMEDIAEXIOREQINT
             size_t                        cbReqLeft;
             /** Size of the allocated I/O buffer. */
             size_t                        cbIoBuf;
+            /** Flag whether the S/G buffer references the memory of the request owner
+             * directly instead of a buffer from the I/O buffer manager. */
+            bool                          fDirectBuf;
             /** I/O buffer descriptor. */
             IOBUFDESC                     IoBuf;
         } ReadWrite;
@@ -378,6 +381,10 @@ typedef struct VBOXDISK
     RTMEMCACHE               hIoReqCache;
     /** I/O buffer manager. */
     IOBUFMGR                 hIoBufMgr;
+    /** Flag whether to transfer data directly from/to the memory of the
+     * request owner if it supports PDMIMEDIAEXPORT::pfnIoReqQueryBuf.
+     * Off unless enabled with the "IoBufDirect" key. */
+    bool                     fIoBufDirect;
     /** Active request counter. */
     volatile uint32_t        cIoReqsActive;
     /** Bins for allocated requests. */
@@ -2812,6 +2819,10 @@ DECLINLINE(int) drvvdMediaExIoReqBufSync(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT pI
     /* Make sure the buffer is reset. */
     RTSgBufReset(&pIoReq->ReadWrite.IoBuf.SgBuf);
 
+    /* Nothing to copy if we operate on the memory of the request owner. */
+    if (pIoReq->ReadWrite.fDirectBuf)
+        return VINF_SUCCESS;
+
     if (fToIoBuf)
         rc = pThis->pDrvMediaExPort->pfnIoReqCopyToBuf(pThis->pDrvMediaExPort, pIoReq, &pIoReq->abAlloc[0],
                                                        pIoReq->ReadWrite.cbReq - pIoReq->ReadWrite.cbReqLeft,
@@ -2989,6 +3000,50 @@ static int drvvdMediaExIoReqCompleteWorker(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT
 }
 
 
+/**
+ * Tries to set up the S/G buffer of the given request with the memory of the request owner,
+ * avoiding the intermediate buffer and the copies.
+ *
+ * @returns Flag whether the memory of the request owner is used.
+ * @param   pThis     VBox disk container instance data.
+ * @param   pIoReq    I/O request to set up.
+ * @param   cb        Size of the request.
+ *
+ * @note Encrypted images need the intermediate buffer because the data is
+ *       transformed in place. The segments must be aligned to a sector
+ *       so they can be handed to the host with caching disabled.
+ */
+static bool drvvdMediaExIoReqBufQueryDirect(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT pIoReq, size_t cb)
+{
+    if (   !pThis->fIoBufDirect
+        || pThis->pCfgCrypto
+        || !pThis->pDrvMediaExPort->pfnIoReqQueryBuf)
+        return false;
+
+    PCRTSGSEG paSeg = NULL;
+    unsigned  cSegs = 0;
+    int rc = pThis->pDrvMediaExPort->pfnIoReqQueryBuf(pThis->pDrvMediaExPort, pIoReq, &pIoReq->abAlloc[0],
+                                                      &paSeg, &cSegs);
+    if (RT_FAILURE(rc))
+        return false;
+
+    size_t cbSegs = 0;
+    for (unsigned i = 0; i < cSegs; i++)
+    {
+        if (   ((uintptr_t)paSeg[i].pvSeg & 511)
+            || (paSeg[i].cbSeg & 511))
+            return false;
+        cbSegs += paSeg[i].cbSeg;
+    }
+    if (cbSegs != cb)
+        return false;
+
+    RTSgBufInit(&pIoReq->ReadWrite.IoBuf.SgBuf, paSeg, cSegs);
+    pIoReq->ReadWrite.cbIoBuf    = cb;
+    pIoReq->ReadWrite.fDirectBuf = true;
+    return true;
+}
+
 /**
  * Allocates a memory buffer suitable for I/O for the given request.
  *
@@ -3001,6 +3056,10 @@ static int drvvdMediaExIoReqCompleteWorker(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT
  */
 DECLINLINE(int) drvvdMediaExIoReqBufAlloc(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT pIoReq, size_t cb)
 {
+    pIoReq->ReadWrite.fDirectBuf = false;
+    if (drvvdMediaExIoReqBufQueryDirect(pThis, pIoReq, cb))
+        return VINF_SUCCESS;
+
     int rc = IOBUFMgrAllocBuf(pThis->hIoBufMgr, &pIoReq->ReadWrite.IoBuf, cb, &pIoReq->ReadWrite.cbIoBuf);
     if (rc == VERR_NO_MEMORY)
     {
@@ -3084,6 +3143,13 @@ DECLINLINE(void) drvvdMediaExIoReqBufFree(PVBOXDISK pThis, PPDMMEDIAEXIOREQINT p
     if (   pIoReq->enmType == PDMMEDIAEXIOREQTYPE_READ
         || pIoReq->enmType == PDMMEDIAEXIOREQTYPE_WRITE)
     {
+        /* The memory of the request owner is released by the owner. */
+        if (pIoReq->ReadWrite.fDirectBuf)
+        {
+            pIoReq->ReadWrite.fDirectBuf = false;
+            return;
+        }
+
         IOBUFMgrFreeBuf(&pIoReq->ReadWrite.IoBuf);
 
         if (ASMAtomicReadU32(&pThis->cIoReqsWaiting) > 0)
@@ -3654,9 +3720,11 @@ static DECLCALLBACK(int) drvvdIoReqSuspendedLoad(PPDMIMEDIAEX pInterface, PSSMHA
 
             /*
              * Try to allocate enough I/O buffer, if this fails for some reason put it onto the
-             * waitign list instead of the redo list.
+             * waitign list instead of the redo list. The memory of the request owner is not
+             * locked anymore after a restore so the intermediate buffer is always used here.
              */
-            pIoReq->ReadWrite.cbIoBuf = 0;
+            pIoReq->ReadWrite.cbIoBuf    = 0;
+            pIoReq->ReadWrite.fDirectBuf = false;
             rc = IOBUFMgrAllocBuf(pThis->hIoBufMgr, &pIoReq->ReadWrite.IoBuf, pIoReq->ReadWrite.cbReqLeft,
                                   &pIoReq->ReadWrite.cbIoBuf);
             if (rc == VERR_NO_MEMORY)
@@ -4204,6 +4272,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     pThis->pIfSecKey                    = NULL;
     pThis->hIoReqCache                  = NIL_RTMEMCACHE;
     pThis->hIoBufMgr                    = NIL_IOBUFMGR;
+    pThis->fIoBufDirect                 = false;
 
     for (unsigned i = 0; i < RT_ELEMENTS(pThis->aIoReqAllocBins); i++)
         pThis->aIoReqAllocBins[i].hMtxLstIoReqAlloc = NIL_RTSEMFASTMUTEX;
@@ -4344,7 +4413,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           "CachePath\0CacheFormat\0Discard\0InformAboutZeroBlocks\0"
                                           "SkipConsistencyChecks\0"
                                           "Locked\0BIOSVisible\0Cylinders\0Heads\0Sectors\0Mountable\0"
-                                          "EmptyDrive\0IoBufMax\0"
+                                          "EmptyDrive\0IoBufMax\0IoBufDirect\0"
 #if defined(VBOX_PERIODIC_FLUSH) || defined(VBOX_IGNORE_FLUSH)
                                           "FlushInterval\0IgnoreFlush\0IgnoreFlushAsync\0"
 #endif /* !(VBOX_PERIODIC_FLUSH || VBOX_IGNORE_FLUSH) */
@@ -4618,6 +4687,11 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             rc = CFGMR3QueryU32Def(pCfg, "IoBufMax", &cbIoBufMax, 5 * _1M);
             if (RT_FAILURE(rc))
                 return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Failed to query \"IoBufMax\" from the config"));
+
+            /* The direct path is opt-in until more controllers implement pfnIoReqQueryBuf. */
+            rc = CFGMR3QueryBoolDef(pCfg, "IoBufDirect", &pThis->fIoBufDirect, false);
+            if (RT_FAILURE(rc))
+                return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Failed to query \"IoBufDirect\" from the config"));
         }
 
         PCFGMNODE pParent = CFGMR3GetChild(pCurNode, "Parent");
@@ -120,6 +120,26 @@ typedef struct VSCSIREQINT
     void                *pvVScsiReqUser;
 } VSCSIREQINT;
 
+/**
+ * Completion callback for I/O requests a LUN issues to carry out a command
+ * which needs more than one I/O request.
+ *
+ * The callback either queues the next I/O request or completes the SCSI request.
+ *
+ * @returns nothing.
+ * @param   pVScsiLun       The LUN the I/O request was issued for.
+ * @param   pVScsiReq       The SCSI request the I/O request belongs to.
+ * @param   enmTxDir        Transfer direction of the completed I/O request.
+ * @param   rcIoReq         Status code the I/O request completed with.
+ * @param   fRedoPossible   Flag whether it is possible to redo the request.
+ * @param   pvUser          Opaque user data given when the I/O request was queued.
+ */
+typedef DECLCALLBACK(void) FNVSCSIIOREQCOMPLETED(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                 VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                 bool fRedoPossible, void *pvUser);
+/** Pointer to an I/O request completion callback. */
+typedef FNVSCSIIOREQCOMPLETED *PFNVSCSIIOREQCOMPLETED;
+
 /**
  * Virtual SCSI I/O request.
  */
@@ -131,6 +151,10 @@ typedef struct VSCSIIOREQINT
     PVSCSILUNINT           pVScsiLun;
     /** Transfer direction */
     VSCSIIOREQTXDIR        enmTxDir;
+    /** Completion callback, NULL to complete the SCSI request directly. */
+    PFNVSCSIIOREQCOMPLETED pfnIoReqCompleted;
+    /** Opaque user data for the completion callback. */
+    void                  *pvUser;
     /** Direction dependent data. */
     union
     {
@@ -342,6 +366,27 @@ int vscsiIoReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
                               VSCSIIOREQTXDIR enmTxDir, uint64_t uOffset,
                               size_t cbTransfer);
 
+/**
+ * Enqueue a new data transfer request using the given buffer instead of the
+ * one of the SCSI request.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLun         The LUN instance which issued the request.
+ * @param   pVScsiReq         The virtual SCSI request associated with the transfer.
+ * @param   enmTxDir          Transfer direction.
+ * @param   uOffset           Start offset of the transfer.
+ * @param   paSeg             The segments to transfer from or to.
+ * @param   cSeg              Number of segments.
+ * @param   cbTransfer        Number of bytes to transfer.
+ * @param   pfnIoReqCompleted Completion callback, NULL to complete the SCSI request
+ *                            when the I/O request completes.
+ * @param   pvUser            Opaque user data for the completion callback.
+ */
+int vscsiIoReqTransferEnqueueEx(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                VSCSIIOREQTXDIR enmTxDir, uint64_t uOffset,
+                                PCRTSGSEG paSeg, unsigned cSeg, size_t cbTransfer,
+                                PFNVSCSIIOREQCOMPLETED pfnIoReqCompleted, void *pvUser);
+
 /**
  * Enqueue a new unmap request.
  *
@@ -362,6 +407,19 @@ int vscsiIoReqUnmapEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
  */
 uint32_t vscsiIoReqOutstandingCountGet(PVSCSILUNINT pVScsiLun);
 
+/**
+ * Completes the SCSI request with the status of the last I/O request issued for it.
+ *
+ * @returns nothing.
+ * @param   pVScsiLun       The LUN the request is for.
+ * @param   pVScsiReq       The SCSI request to complete.
+ * @param   enmTxDir        Transfer direction of the I/O request.
+ * @param   rcIoReq         Status code the I/O request completed with.
+ * @param   fRedoPossible   Flag whether it is possible to redo the request.
+ */
+void vscsiIoReqScsiReqComplete(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                               VSCSIIOREQTXDIR enmTxDir, int rcIoReq, bool fRedoPossible);
+
 /**
  * Wrapper for the get medium size I/O callback.
  *
@@ -404,6 +462,23 @@ DECLINLINE(int) vscsiLunMediumSetLock(PVSCSILUNINT pVScsiLun, bool fLocked)
                                                                      fLocked);
 }
 
+/**
+ * Wrapper for the get medium UUID I/O callback.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if the callback is not implemented.
+ * @param   pVScsiLun   The LUN.
+ * @param   pUuid       Where to store the UUID on success.
+ */
+DECLINLINE(int) vscsiLunMediumGetUuid(PVSCSILUNINT pVScsiLun, PRTUUID pUuid)
+{
+    if (!pVScsiLun->pVScsiLunIoCallbacks->pfnVScsiLunMediumGetUuid)
+        return VERR_NOT_SUPPORTED;
+    return pVScsiLun->pVScsiLunIoCallbacks->pfnVScsiLunMediumGetUuid(pVScsiLun,
+                                                                     pVScsiLun->pvVScsiLunUser,
+                                                                     pUuid);
+}
+
 /**
  * Wrapper for the I/O request enqueue I/O callback.
  *
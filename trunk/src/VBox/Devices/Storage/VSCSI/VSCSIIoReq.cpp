@@ -54,6 +54,17 @@ int vscsiIoReqFlushEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
 int vscsiIoReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
                               VSCSIIOREQTXDIR enmTxDir, uint64_t uOffset,
                               size_t cbTransfer)
+{
+    return vscsiIoReqTransferEnqueueEx(pVScsiLun, pVScsiReq, enmTxDir, uOffset,
+                                       pVScsiReq->SgBuf.paSegs, pVScsiReq->SgBuf.cSegs,
+                                       cbTransfer, NULL /* pfnIoReqCompleted */, NULL /* pvUser */);
+}
+
+
+int vscsiIoReqTransferEnqueueEx(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                VSCSIIOREQTXDIR enmTxDir, uint64_t uOffset,
+                                PCRTSGSEG paSeg, unsigned cSeg, size_t cbTransfer,
+                                PFNVSCSIIOREQCOMPLETED pfnIoReqCompleted, void *pvUser)
 {
     int rc = VINF_SUCCESS;
     PVSCSIIOREQINT pVScsiIoReq = NULL;
@@ -65,13 +76,15 @@ int vscsiIoReqTransferEnqueue(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
     if (!pVScsiIoReq)
         return VERR_NO_MEMORY;
 
-    pVScsiIoReq->pVScsiReq       = pVScsiReq;
-    pVScsiIoReq->pVScsiLun       = pVScsiLun;
-    pVScsiIoReq->enmTxDir        = enmTxDir;
-    pVScsiIoReq->u.Io.uOffset    = uOffset;
-    pVScsiIoReq->u.Io.cbTransfer = cbTransfer;
-    pVScsiIoReq->u.Io.paSeg      = pVScsiReq->SgBuf.paSegs;
-    pVScsiIoReq->u.Io.cSeg       = pVScsiReq->SgBuf.cSegs;
+    pVScsiIoReq->pVScsiReq         = pVScsiReq;
+    pVScsiIoReq->pVScsiLun         = pVScsiLun;
+    pVScsiIoReq->enmTxDir          = enmTxDir;
+    pVScsiIoReq->pfnIoReqCompleted = pfnIoReqCompleted;
+    pVScsiIoReq->pvUser            = pvUser;
+    pVScsiIoReq->u.Io.uOffset      = uOffset;
+    pVScsiIoReq->u.Io.cbTransfer   = cbTransfer;
+    pVScsiIoReq->u.Io.paSeg        = paSeg;
+    pVScsiIoReq->u.Io.cSeg         = cSeg;
 
     ASMAtomicIncU32(&pVScsiLun->IoReq.cReqOutstanding);
 
@@ -124,25 +137,11 @@ uint32_t vscsiIoReqOutstandingCountGet(PVSCSILUNINT pVScsiLun)
 }
 
 
-VBOXDDU_DECL(int) VSCSIIoReqCompleted(VSCSIIOREQ hVScsiIoReq, int rcIoReq, bool fRedoPossible)
+void vscsiIoReqScsiReqComplete(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                               VSCSIIOREQTXDIR enmTxDir, int rcIoReq, bool fRedoPossible)
 {
-    PVSCSIIOREQINT pVScsiIoReq = hVScsiIoReq;
-    PVSCSILUNINT pVScsiLun;
-    PVSCSIREQINT pVScsiReq;
     int rcReq = SCSI_STATUS_OK;
 
-    AssertPtrReturn(pVScsiIoReq, VERR_INVALID_HANDLE);
-
-    LogFlowFunc(("hVScsiIoReq=%#p rcIoReq=%Rrc\n", hVScsiIoReq, rcIoReq));
-
-    pVScsiLun = pVScsiIoReq->pVScsiLun;
-    pVScsiReq = pVScsiIoReq->pVScsiReq;
-
-    AssertMsg(pVScsiLun->IoReq.cReqOutstanding > 0,
-              ("Unregistered I/O request completed\n"));
-
-    ASMAtomicDecU32(&pVScsiLun->IoReq.cReqOutstanding);
-
     if (RT_SUCCESS(rcIoReq))
         rcReq = vscsiLunReqSenseOkSet(pVScsiLun, pVScsiReq);
     else if (!fRedoPossible)
@@ -150,7 +149,7 @@ VBOXDDU_DECL(int) VSCSIIoReqCompleted(VSCSIIOREQ hVScsiIoReq, int rcIoReq, bool
         /** @todo Not 100% correct for the write case as the 0x00 ASCQ for write errors
          * is not used for SBC devices. */
         rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_MEDIUM_ERROR,
-                                         pVScsiIoReq->enmTxDir == VSCSIIOREQTXDIR_READ
+                                         enmTxDir == VSCSIIOREQTXDIR_READ
                                          ? SCSI_ASC_READ_ERROR
                                          : SCSI_ASC_WRITE_ERROR,
                                          0x00);
@@ -158,14 +157,46 @@ VBOXDDU_DECL(int) VSCSIIoReqCompleted(VSCSIIOREQ hVScsiIoReq, int rcIoReq, bool
     else
         rcReq = SCSI_STATUS_CHECK_CONDITION;
 
-    if (pVScsiIoReq->enmTxDir == VSCSIIOREQTXDIR_UNMAP)
+    /* Notify completion of the SCSI request. */
+    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, fRedoPossible, rcIoReq);
+}
+
+
+VBOXDDU_DECL(int) VSCSIIoReqCompleted(VSCSIIOREQ hVScsiIoReq, int rcIoReq, bool fRedoPossible)
+{
+    PVSCSIIOREQINT pVScsiIoReq = hVScsiIoReq;
+    PVSCSILUNINT pVScsiLun;
+    PVSCSIREQINT pVScsiReq;
+    VSCSIIOREQTXDIR enmTxDir;
+    PFNVSCSIIOREQCOMPLETED pfnIoReqCompleted;
+    void *pvUser;
+
+    AssertPtrReturn(pVScsiIoReq, VERR_INVALID_HANDLE);
+
+    LogFlowFunc(("hVScsiIoReq=%#p rcIoReq=%Rrc\n", hVScsiIoReq, rcIoReq));
+
+    pVScsiLun         = pVScsiIoReq->pVScsiLun;
+    pVScsiReq         = pVScsiIoReq->pVScsiReq;
+    enmTxDir          = pVScsiIoReq->enmTxDir;
+    pfnIoReqCompleted = pVScsiIoReq->pfnIoReqCompleted;
+    pvUser            = pVScsiIoReq->pvUser;
+
+    AssertMsg(pVScsiLun->IoReq.cReqOutstanding > 0,
+              ("Unregistered I/O request completed\n"));
+
+    ASMAtomicDecU32(&pVScsiLun->IoReq.cReqOutstanding);
+
+    if (enmTxDir == VSCSIIOREQTXDIR_UNMAP)
         RTMemFree(pVScsiIoReq->u.Unmap.paRanges);
 
     /* Free the I/O request */
     RTMemFree(pVScsiIoReq);
 
-    /* Notify completion of the SCSI request. */
-    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, fRedoPossible, rcIoReq);
+    /* Let the LUN continue with multi request commands, complete the SCSI request otherwise. */
+    if (pfnIoReqCompleted)
+        pfnIoReqCompleted(pVScsiLun, pVScsiReq, enmTxDir, rcIoReq, fRedoPossible, pvUser);
+    else
+        vscsiIoReqScsiReqComplete(pVScsiLun, pVScsiReq, enmTxDir, rcIoReq, fRedoPossible);
 
     return VINF_SUCCESS;
 }
@@ -27,13 +27,36 @@
 #include <iprt/cdefs.h>
 #include <iprt/asm.h>
 #include <iprt/assert.h>
+#include <iprt/critsect.h>
 #include <iprt/mem.h>
 #include <iprt/string.h>
+#include <iprt/uuid.h>
 
 #include "VSCSIInternal.h"
 
 /** Maximum of amount of LBAs to unmap with one command. */
 #define VSCSI_UNMAP_LBAS_MAX(a_cbSector) ((10*_1M) / a_cbSector)
+/** Maximum of amount of LBAs to write with one WRITE SAME command. */
+#define VSCSI_WRITE_SAME_LBAS_MAX(a_cbSector) ((_1G) / a_cbSector)
+/** Size of the buffer holding the repeated WRITE SAME pattern. */
+#define VSCSI_WRITE_SAME_BUF_SIZE _1M
+/** Maximum of amount of LBAs to compare and write with one command. */
+#define VSCSI_CMP_WRITE_LBAS_MAX 16
+/** Maximum number of target descriptors in an EXTENDED COPY parameter list. */
+#define VSCSI_XCOPY_TGT_DESC_MAX 8
+/** Maximum number of segment descriptors in an EXTENDED COPY parameter list. */
+#define VSCSI_XCOPY_SEG_DESC_MAX 32
+/** Size of a target descriptor. */
+#define VSCSI_XCOPY_TGT_DESC_SIZE 32
+/** Size of a block device to block device segment descriptor. */
+#define VSCSI_XCOPY_SEG_DESC_B2B_SIZE 28
+/** Maximum length of the target and segment descriptor lists. */
+#define VSCSI_XCOPY_DESC_LIST_LENGTH_MAX \
+    (VSCSI_XCOPY_TGT_DESC_MAX * VSCSI_XCOPY_TGT_DESC_SIZE + VSCSI_XCOPY_SEG_DESC_MAX * VSCSI_XCOPY_SEG_DESC_B2B_SIZE)
+/** Maximum number of bytes to copy with one segment descriptor. */
+#define VSCSI_XCOPY_SEG_LENGTH_MAX (32 * _1M)
+/** Size of the buffer used to copy the data. */
+#define VSCSI_XCOPY_BUF_SIZE _1M
 
 /**
  * SBC LUN instance
@@ -48,10 +71,659 @@ typedef struct VSCSILUNSBC
     uint64_t       cSectors;
     /** VPD page pool. */
     VSCSIVPDPOOL   VpdPagePool;
+    /** Flag whether the LUN has a designator, requires the medium UUID. */
+    bool           fDesignator;
+    /** T10 vendor ID based designation descriptor of the LUN, reported in the
+     * device identification page and used to match EXTENDED COPY targets. */
+    uint8_t        abDesignator[VSCSI_VPD_DEVID_DESIGNATOR_T10_SIZE];
+    /** Critical section protecting the COMPARE AND WRITE state. */
+    RTCRITSECT     CritSectCmpWrite;
+    /** Flag whether a COMPARE AND WRITE command is being processed. */
+    bool           fCmpWriteActive;
+    /** COMPARE AND WRITE commands waiting for the active one to finish (VSCSISBCCMPWRITE). */
+    RTLISTANCHOR   LstCmpWriteWaiting;
 } VSCSILUNSBC;
 /** Pointer to a SBC LUN instance */
 typedef VSCSILUNSBC *PVSCSILUNSBC;
 
+/**
+ * WRITE SAME command state.
+ */
+typedef struct VSCSISBCWRITESAME
+{
+    /** Buffer filled with the pattern. */
+    void          *pvBuf;
+    /** Number of segments. */
+    unsigned       cSegs;
+    /** Segment array, all segments refer to the pattern buffer - variable. */
+    RTSGSEG        aSegs[1];
+} VSCSISBCWRITESAME;
+/** Pointer to a WRITE SAME command state. */
+typedef VSCSISBCWRITESAME *PVSCSISBCWRITESAME;
+
+/**
+ * COMPARE AND WRITE command state.
+ */
+typedef struct VSCSISBCCMPWRITE
+{
+    /** Node for the list of waiting commands. */
+    RTLISTNODE     NdWaiting;
+    /** The SCSI request. */
+    PVSCSIREQINT   pVScsiReq;
+    /** Start offset on the medium. */
+    uint64_t       uOffset;
+    /** Number of bytes to compare and write. */
+    size_t         cbCmpWrite;
+    /** Segment for the current I/O request. */
+    RTSGSEG        Seg;
+    /** The verify data, the write data and the medium content, in that order - variable. */
+    uint8_t        abData[1];
+} VSCSISBCCMPWRITE;
+/** Pointer to a COMPARE AND WRITE command state. */
+typedef VSCSISBCCMPWRITE *PVSCSISBCCMPWRITE;
+
+/**
+ * EXTENDED COPY segment.
+ */
+typedef struct VSCSISBCXCOPYSEG
+{
+    /** First LBA to copy from. */
+    uint64_t       uLbaSrc;
+    /** First LBA to copy to. */
+    uint64_t       uLbaDst;
+    /** Number of blocks to copy. */
+    uint32_t       cBlocks;
+} VSCSISBCXCOPYSEG;
+
+/**
+ * EXTENDED COPY command state.
+ */
+typedef struct VSCSISBCXCOPY
+{
+    /** The SCSI request. */
+    PVSCSIREQINT     pVScsiReq;
+    /** Number of segments. */
+    unsigned         cSegs;
+    /** Current segment. */
+    unsigned         iSeg;
+    /** Number of blocks of the current segment copied so far. */
+    uint32_t         iBlock;
+    /** Number of blocks being copied with the current I/O requests. */
+    uint32_t         cBlocksChunk;
+    /** Size of the copy buffer. */
+    size_t           cbBuf;
+    /** Segment for the current I/O request, covers the copy buffer. */
+    RTSGSEG          Seg;
+    /** The segments to copy. */
+    VSCSISBCXCOPYSEG aSegs[VSCSI_XCOPY_SEG_DESC_MAX];
+} VSCSISBCXCOPY;
+/** Pointer to an EXTENDED COPY command state. */
+typedef VSCSISBCXCOPY *PVSCSISBCXCOPY;
+
+/**
+ * Completes the request of a command which ran out of resources.
+ *
+ * @returns nothing.
+ * @param   pVScsiLun    The LUN.
+ * @param   pVScsiReq    The SCSI request to complete.
+ */
+static void vscsiLunSbcReqCompleteNoResources(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq)
+{
+    int rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_SYSTEM_RESOURCE_FAILURE,
+                                         SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+}
+
+/**
+ * @callback_method_impl{FNVSCSIIOREQCOMPLETED, WRITE SAME}
+ */
+static DECLCALLBACK(void) vscsiLunSbcWriteSameCompleted(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                        VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                        bool fRedoPossible, void *pvUser)
+{
+    PVSCSISBCWRITESAME pWriteSame = (PVSCSISBCWRITESAME)pvUser;
+
+    RTMemFree(pWriteSame->pvBuf);
+    RTMemFree(pWriteSame);
+    vscsiIoReqScsiReqComplete(pVScsiLun, pVScsiReq, enmTxDir, rcIoReq, fRedoPossible);
+}
+
+/**
+ * Processes a WRITE SAME(10) or WRITE SAME(16) command.
+ *
+ * The pattern is written with a single I/O request whose segments all refer to the
+ * same buffer, so only one logical block is transferred from the guest. Requests
+ * with the UNMAP bit set are turned into a discard if the medium supports it.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The SCSI request, completed by this function.
+ */
+static int vscsiLunSbcReqWriteSame(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq)
+{
+    PVSCSILUNINT pVScsiLun = &pVScsiLunSbc->Core;
+    uint32_t cbSector = pVScsiLunSbc->cbSector;
+    bool fUnmap = RT_BOOL(pVScsiReq->pbCDB[1] & 0x08);
+    bool fNoData = false;
+    uint64_t uLbaStart;
+    uint32_t cSectors;
+    int rc = VINF_SUCCESS;
+    int rcReq = SCSI_STATUS_OK;
+
+    if (pVScsiReq->pbCDB[0] == SCSI_WRITE_SAME_10)
+    {
+        uLbaStart = vscsiBE2HU32(&pVScsiReq->pbCDB[2]);
+        cSectors  = vscsiBE2HU16(&pVScsiReq->pbCDB[7]);
+    }
+    else
+    {
+        uLbaStart = vscsiBE2HU64(&pVScsiReq->pbCDB[2]);
+        cSectors  = vscsiBE2HU32(&pVScsiReq->pbCDB[10]);
+        fNoData   = RT_BOOL(pVScsiReq->pbCDB[1] & 0x01);
+    }
+
+    LogFlow(("%s: uLbaStart=%llu cSectors=%u fUnmap=%RTbool fNoData=%RTbool\n",
+             __FUNCTION__, uLbaStart, cSectors, fUnmap, fNoData));
+
+    if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_READONLY)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED, 0x00);
+    else if (   (pVScsiReq->pbCDB[1] & 0x10) /* Anchoring is not supported. */
+             || !cSectors                    /* We report WSNZ. */
+             || cSectors > VSCSI_WRITE_SAME_LBAS_MAX(cbSector))
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+    else if (uLbaStart + cSectors > pVScsiLunSbc->cSectors)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LOGICAL_BLOCK_OOR, 0x00);
+    else if (fUnmap && (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_UNMAP))
+    {
+        /* We don't report LBPRZ, so the content of unmapped blocks is undefined and the pattern doesn't matter. */
+        PRTRANGE pRange = (PRTRANGE)RTMemAllocZ(sizeof(RTRANGE));
+        if (pRange)
+        {
+            pRange->offStart = uLbaStart * cbSector;
+            pRange->cbRange  = (size_t)cSectors * cbSector;
+            rc = vscsiIoReqUnmapEnqueue(pVScsiLun, pVScsiReq, pRange, 1);
+            if (RT_FAILURE(rc))
+                RTMemFree(pRange);
+            return rc;
+        }
+
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_SYSTEM_RESOURCE_FAILURE,
+                                         SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+    }
+    else
+    {
+        size_t cbTotal = (size_t)cSectors * cbSector;
+        size_t cbBuf = RT_MIN(cbTotal, (VSCSI_WRITE_SAME_BUF_SIZE / cbSector) * cbSector);
+        unsigned cSegs = (unsigned)((cbTotal + cbBuf - 1) / cbBuf);
+        PVSCSISBCWRITESAME pWriteSame = (PVSCSISBCWRITESAME)RTMemAllocZ(RT_OFFSETOF(VSCSISBCWRITESAME, aSegs[cSegs]));
+        uint8_t *pbBuf = (uint8_t *)RTMemAlloc(cbBuf);
+
+        if (pWriteSame && pbBuf)
+        {
+            /* Fetch the pattern and replicate it over the whole buffer. */
+            if (fNoData)
+                memset(pbBuf, 0, cbBuf);
+            else if (RTSgBufCopyToBuf(&pVScsiReq->SgBuf, pbBuf, cbSector) == cbSector)
+            {
+                for (size_t off = cbSector; off < cbBuf; off += cbSector)
+                    memcpy(pbBuf + off, pbBuf, cbSector);
+            }
+            else
+                rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+
+            if (rcReq == SCSI_STATUS_OK)
+            {
+                pWriteSame->pvBuf = pbBuf;
+                pWriteSame->cSegs = cSegs;
+                for (unsigned i = 0; i < cSegs; i++)
+                {
+                    pWriteSame->aSegs[i].pvSeg = pbBuf;
+                    pWriteSame->aSegs[i].cbSeg = RT_MIN(cbBuf, cbTotal - i * cbBuf);
+                }
+
+                rc = vscsiIoReqTransferEnqueueEx(pVScsiLun, pVScsiReq, VSCSIIOREQTXDIR_WRITE, uLbaStart * cbSector,
+                                                 &pWriteSame->aSegs[0], cSegs, cbTotal,
+                                                 vscsiLunSbcWriteSameCompleted, pWriteSame);
+                if (RT_SUCCESS(rc))
+                    return rc;
+            }
+        }
+        else
+            rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_SYSTEM_RESOURCE_FAILURE,
+                                             SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+
+        RTMemFree(pbBuf);
+        RTMemFree(pWriteSame);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(void) vscsiLunSbcCmpWriteCompleted(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                       VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                       bool fRedoPossible, void *pvUser);
+
+/**
+ * Starts reading the current medium content for the given COMPARE AND WRITE command.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pCmpWrite       The COMPARE AND WRITE command state.
+ */
+static int vscsiLunSbcCmpWriteRead(PVSCSILUNSBC pVScsiLunSbc, PVSCSISBCCMPWRITE pCmpWrite)
+{
+    pCmpWrite->Seg.pvSeg = &pCmpWrite->abData[2 * pCmpWrite->cbCmpWrite];
+    pCmpWrite->Seg.cbSeg = pCmpWrite->cbCmpWrite;
+    return vscsiIoReqTransferEnqueueEx(&pVScsiLunSbc->Core, pCmpWrite->pVScsiReq, VSCSIIOREQTXDIR_READ,
+                                       pCmpWrite->uOffset, &pCmpWrite->Seg, 1, pCmpWrite->cbCmpWrite,
+                                       vscsiLunSbcCmpWriteCompleted, pCmpWrite);
+}
+
+/**
+ * Frees the state of the finished COMPARE AND WRITE command and starts the next
+ * waiting one.
+ *
+ * @returns nothing.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pCmpWrite       The COMPARE AND WRITE command state of the finished command.
+ */
+static void vscsiLunSbcCmpWriteFinish(PVSCSILUNSBC pVScsiLunSbc, PVSCSISBCCMPWRITE pCmpWrite)
+{
+    RTMemFree(pCmpWrite);
+
+    for (;;)
+    {
+        RTCritSectEnter(&pVScsiLunSbc->CritSectCmpWrite);
+        pCmpWrite = RTListGetFirst(&pVScsiLunSbc->LstCmpWriteWaiting, VSCSISBCCMPWRITE, NdWaiting);
+        if (pCmpWrite)
+            RTListNodeRemove(&pCmpWrite->NdWaiting);
+        else
+            pVScsiLunSbc->fCmpWriteActive = false;
+        RTCritSectLeave(&pVScsiLunSbc->CritSectCmpWrite);
+
+        if (   !pCmpWrite
+            || RT_SUCCESS(vscsiLunSbcCmpWriteRead(pVScsiLunSbc, pCmpWrite)))
+            break;
+
+        vscsiLunSbcReqCompleteNoResources(&pVScsiLunSbc->Core, pCmpWrite->pVScsiReq);
+        RTMemFree(pCmpWrite);
+    }
+}
+
+/**
+ * @callback_method_impl{FNVSCSIIOREQCOMPLETED, COMPARE AND WRITE}
+ */
+static DECLCALLBACK(void) vscsiLunSbcCmpWriteCompleted(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                       VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                       bool fRedoPossible, void *pvUser)
+{
+    PVSCSILUNSBC pVScsiLunSbc = (PVSCSILUNSBC)pVScsiLun;
+    PVSCSISBCCMPWRITE pCmpWrite = (PVSCSISBCCMPWRITE)pvUser;
+
+    if (   RT_SUCCESS(rcIoReq)
+        && enmTxDir == VSCSIIOREQTXDIR_READ)
+    {
+        const uint8_t *pbVerify = &pCmpWrite->abData[0];
+        const uint8_t *pbMedium = &pCmpWrite->abData[2 * pCmpWrite->cbCmpWrite];
+
+        if (!memcmp(pbVerify, pbMedium, pCmpWrite->cbCmpWrite))
+        {
+            pCmpWrite->Seg.pvSeg = &pCmpWrite->abData[pCmpWrite->cbCmpWrite];
+            pCmpWrite->Seg.cbSeg = pCmpWrite->cbCmpWrite;
+            int rc = vscsiIoReqTransferEnqueueEx(pVScsiLun, pVScsiReq, VSCSIIOREQTXDIR_WRITE,
+                                                 pCmpWrite->uOffset, &pCmpWrite->Seg, 1, pCmpWrite->cbCmpWrite,
+                                                 vscsiLunSbcCmpWriteCompleted, pCmpWrite);
+            if (RT_SUCCESS(rc))
+                return;
+
+            vscsiLunSbcReqCompleteNoResources(pVScsiLun, pVScsiReq);
+        }
+        else
+        {
+            /* The information field holds the offset of the first byte which differs. */
+            uint32_t offMiscompare = 0;
+            while (pbVerify[offMiscompare] == pbMedium[offMiscompare])
+                offMiscompare++;
+
+            int rcReq = vscsiLunReqSenseErrorInfoSet(pVScsiLun, pVScsiReq, SCSI_SENSE_MISCOMPARE,
+                                                     SCSI_ASC_MISCOMPARE_DURING_VERIFY, 0x00, offMiscompare);
+            vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+        }
+    }
+    else
+        vscsiIoReqScsiReqComplete(pVScsiLun, pVScsiReq, enmTxDir, rcIoReq, fRedoPossible);
+
+    vscsiLunSbcCmpWriteFinish(pVScsiLunSbc, pCmpWrite);
+}
+
+/**
+ * Processes a COMPARE AND WRITE command.
+ *
+ * Commands are serialized against each other on the LUN so the compare and the
+ * following write are atomic from the view of other COMPARE AND WRITE commands.
+ * Ordinary writes to the same blocks are not held back.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The SCSI request, completed by this function.
+ */
+static int vscsiLunSbcReqCmpWrite(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq)
+{
+    PVSCSILUNINT pVScsiLun = &pVScsiLunSbc->Core;
+    uint64_t uLbaStart = vscsiBE2HU64(&pVScsiReq->pbCDB[2]);
+    uint32_t cSectors = pVScsiReq->pbCDB[13];
+    int rcReq = SCSI_STATUS_OK;
+
+    LogFlow(("%s: uLbaStart=%llu cSectors=%u\n", __FUNCTION__, uLbaStart, cSectors));
+
+    if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_READONLY)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED, 0x00);
+    else if (cSectors > VSCSI_CMP_WRITE_LBAS_MAX)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+    else if (uLbaStart + cSectors > pVScsiLunSbc->cSectors)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LOGICAL_BLOCK_OOR, 0x00);
+    else if (!cSectors)
+        rcReq = vscsiLunReqSenseOkSet(pVScsiLun, pVScsiReq); /* A 0 transfer length is not an error. */
+    else
+    {
+        size_t cbCmpWrite = (size_t)cSectors * pVScsiLunSbc->cbSector;
+        PVSCSISBCCMPWRITE pCmpWrite = (PVSCSISBCCMPWRITE)RTMemAllocZ(RT_OFFSETOF(VSCSISBCCMPWRITE, abData[3 * cbCmpWrite]));
+        if (pCmpWrite)
+        {
+            /* The data out buffer holds the verify data followed by the write data. */
+            if (RTSgBufCopyToBuf(&pVScsiReq->SgBuf, &pCmpWrite->abData[0], 2 * cbCmpWrite) == 2 * cbCmpWrite)
+            {
+                bool fWait;
+
+                pCmpWrite->pVScsiReq  = pVScsiReq;
+                pCmpWrite->uOffset    = uLbaStart * pVScsiLunSbc->cbSector;
+                pCmpWrite->cbCmpWrite = cbCmpWrite;
+
+                RTCritSectEnter(&pVScsiLunSbc->CritSectCmpWrite);
+                fWait = pVScsiLunSbc->fCmpWriteActive;
+                if (fWait)
+                    RTListAppend(&pVScsiLunSbc->LstCmpWriteWaiting, &pCmpWrite->NdWaiting);
+                else
+                    pVScsiLunSbc->fCmpWriteActive = true;
+                RTCritSectLeave(&pVScsiLunSbc->CritSectCmpWrite);
+
+                if (   !fWait
+                    && RT_FAILURE(vscsiLunSbcCmpWriteRead(pVScsiLunSbc, pCmpWrite)))
+                {
+                    vscsiLunSbcReqCompleteNoResources(pVScsiLun, pVScsiReq);
+                    vscsiLunSbcCmpWriteFinish(pVScsiLunSbc, pCmpWrite);
+                }
+                return VINF_SUCCESS;
+            }
+
+            rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+            RTMemFree(pCmpWrite);
+        }
+        else
+            rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_SYSTEM_RESOURCE_FAILURE,
+                                             SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+    }
+
+    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(void) vscsiLunSbcXCopyCompleted(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                    VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                    bool fRedoPossible, void *pvUser);
+
+/**
+ * Frees the given EXTENDED COPY command state.
+ *
+ * @returns nothing.
+ * @param   pXCopy          The EXTENDED COPY command state.
+ */
+static void vscsiLunSbcXCopyFree(PVSCSISBCXCOPY pXCopy)
+{
+    RTMemFree(pXCopy->Seg.pvSeg);
+    RTMemFree(pXCopy);
+}
+
+/**
+ * Copies the next chunk of an EXTENDED COPY command or completes the command if
+ * everything was copied.
+ *
+ * @returns nothing.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pXCopy          The EXTENDED COPY command state.
+ */
+static void vscsiLunSbcXCopyNext(PVSCSILUNSBC pVScsiLunSbc, PVSCSISBCXCOPY pXCopy)
+{
+    PVSCSIREQINT pVScsiReq = pXCopy->pVScsiReq;
+
+    while (   pXCopy->iSeg < pXCopy->cSegs
+           && pXCopy->iBlock == pXCopy->aSegs[pXCopy->iSeg].cBlocks)
+    {
+        pXCopy->iSeg++;
+        pXCopy->iBlock = 0;
+    }
+
+    if (pXCopy->iSeg < pXCopy->cSegs)
+    {
+        VSCSISBCXCOPYSEG *pSeg = &pXCopy->aSegs[pXCopy->iSeg];
+
+        pXCopy->cBlocksChunk = RT_MIN(pSeg->cBlocks - pXCopy->iBlock, (uint32_t)(pXCopy->cbBuf / pVScsiLunSbc->cbSector));
+        pXCopy->Seg.cbSeg    = (size_t)pXCopy->cBlocksChunk * pVScsiLunSbc->cbSector;
+
+        int rc = vscsiIoReqTransferEnqueueEx(&pVScsiLunSbc->Core, pVScsiReq, VSCSIIOREQTXDIR_READ,
+                                             (pSeg->uLbaSrc + pXCopy->iBlock) * pVScsiLunSbc->cbSector,
+                                             &pXCopy->Seg, 1, pXCopy->Seg.cbSeg,
+                                             vscsiLunSbcXCopyCompleted, pXCopy);
+        if (RT_FAILURE(rc))
+        {
+            vscsiLunSbcXCopyFree(pXCopy);
+            vscsiLunSbcReqCompleteNoResources(&pVScsiLunSbc->Core, pVScsiReq);
+        }
+    }
+    else
+    {
+        vscsiLunSbcXCopyFree(pXCopy);
+        int rcReq = vscsiLunReqSenseOkSet(&pVScsiLunSbc->Core, pVScsiReq);
+        vscsiDeviceReqComplete(pVScsiLunSbc->Core.pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+    }
+}
+
+/**
+ * @callback_method_impl{FNVSCSIIOREQCOMPLETED, EXTENDED COPY}
+ */
+static DECLCALLBACK(void) vscsiLunSbcXCopyCompleted(PVSCSILUNINT pVScsiLun, PVSCSIREQINT pVScsiReq,
+                                                    VSCSIIOREQTXDIR enmTxDir, int rcIoReq,
+                                                    bool fRedoPossible, void *pvUser)
+{
+    PVSCSILUNSBC pVScsiLunSbc = (PVSCSILUNSBC)pVScsiLun;
+    PVSCSISBCXCOPY pXCopy = (PVSCSISBCXCOPY)pvUser;
+
+    if (RT_FAILURE(rcIoReq))
+    {
+        vscsiLunSbcXCopyFree(pXCopy);
+        vscsiIoReqScsiReqComplete(pVScsiLun, pVScsiReq, enmTxDir, rcIoReq, fRedoPossible);
+    }
+    else if (enmTxDir == VSCSIIOREQTXDIR_READ)
+    {
+        VSCSISBCXCOPYSEG *pSeg = &pXCopy->aSegs[pXCopy->iSeg];
+        int rc = vscsiIoReqTransferEnqueueEx(pVScsiLun, pVScsiReq, VSCSIIOREQTXDIR_WRITE,
+                                             (pSeg->uLbaDst + pXCopy->iBlock) * pVScsiLunSbc->cbSector,
+                                             &pXCopy->Seg, 1, pXCopy->Seg.cbSeg,
+                                             vscsiLunSbcXCopyCompleted, pXCopy);
+        if (RT_FAILURE(rc))
+        {
+            vscsiLunSbcXCopyFree(pXCopy);
+            vscsiLunSbcReqCompleteNoResources(pVScsiLun, pVScsiReq);
+        }
+    }
+    else
+    {
+        pXCopy->iBlock += pXCopy->cBlocksChunk;
+        vscsiLunSbcXCopyNext(pVScsiLunSbc, pXCopy);
+    }
+}
+
+/**
+ * Parses the parameter list of an EXTENDED COPY command.
+ *
+ * Only copies within the LUN itself are supported, so every target descriptor
+ * must be an identification descriptor carrying the designator of this LUN.
+ *
+ * @returns SCSI status code, SCSI_STATUS_OK if the parameter list is valid.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The SCSI request.
+ * @param   pbParams        The parameter list.
+ * @param   cbParams        Size of the parameter list in bytes.
+ * @param   pXCopy          The EXTENDED COPY command state to fill in.
+ */
+static int vscsiLunSbcXCopyParse(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq,
+                                 const uint8_t *pbParams, size_t cbParams, PVSCSISBCXCOPY pXCopy)
+{
+    PVSCSILUNINT pVScsiLun = &pVScsiLunSbc->Core;
+    uint32_t cbTgtDescs = vscsiBE2HU16(&pbParams[2]);
+    uint32_t cbSegDescs = vscsiBE2HU32(&pbParams[8]);
+    uint32_t cbInline   = vscsiBE2HU32(&pbParams[12]);
+
+    if (   (uint64_t)16 + cbTgtDescs + cbSegDescs + cbInline > cbParams
+        || cbTgtDescs % VSCSI_XCOPY_TGT_DESC_SIZE)
+        return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_PARAMETER_LIST_LENGTH_ERROR, 0x00);
+    if (cbInline)
+        return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST, 0x00);
+
+    unsigned cTgtDescs = cbTgtDescs / VSCSI_XCOPY_TGT_DESC_SIZE;
+    if (cTgtDescs > VSCSI_XCOPY_TGT_DESC_MAX)
+        return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST,
+                                        SCSI_ASCQ_TOO_MANY_TARGET_DESCRIPTORS);
+
+    const uint8_t *pbDesc = &pbParams[16];
+    for (unsigned i = 0; i < cTgtDescs; i++, pbDesc += VSCSI_XCOPY_TGT_DESC_SIZE)
+    {
+        if (pbDesc[0] != 0xe4)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST,
+                                            SCSI_ASCQ_UNSUPPORTED_TARGET_DESCRIPTOR_TYPE_CODE);
+
+        /* The LU ID type must select the designator, the target must not be a null device. */
+        if (   (pbDesc[1] & 0xe0)
+            || (pbDesc[1] & 0x1f) != SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS
+            || vscsiBE2HU24(&pbDesc[29]) != pVScsiLunSbc->cbSector)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST, 0x00);
+
+        if (   !pVScsiLunSbc->fDesignator
+            || memcmp(&pbDesc[4], &pVScsiLunSbc->abDesignator[0], sizeof(pVScsiLunSbc->abDesignator)))
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_COPY_ABORTED, SCSI_ASC_COPY_TARGET_DEVICE_ERROR,
+                                            SCSI_ASCQ_COPY_TARGET_DEVICE_NOT_REACHABLE);
+    }
+
+    uint32_t offSegDesc = 0;
+    pXCopy->cSegs = 0;
+    while (offSegDesc < cbSegDescs)
+    {
+        if (pbDesc[0] != 0x02)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST,
+                                            SCSI_ASCQ_UNSUPPORTED_SEGMENT_DESCRIPTOR_TYPE_CODE);
+        if (   cbSegDescs - offSegDesc < VSCSI_XCOPY_SEG_DESC_B2B_SIZE
+            || vscsiBE2HU16(&pbDesc[2]) + 4 != VSCSI_XCOPY_SEG_DESC_B2B_SIZE)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_PARAMETER_LIST_LENGTH_ERROR, 0x00);
+        if (pXCopy->cSegs == VSCSI_XCOPY_SEG_DESC_MAX)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST,
+                                            SCSI_ASCQ_TOO_MANY_SEGMENT_DESCRIPTORS);
+
+        VSCSISBCXCOPYSEG *pSeg = &pXCopy->aSegs[pXCopy->cSegs];
+        pSeg->cBlocks = vscsiBE2HU16(&pbDesc[10]);
+        pSeg->uLbaSrc = vscsiBE2HU64(&pbDesc[12]);
+        pSeg->uLbaDst = vscsiBE2HU64(&pbDesc[20]);
+
+        if (   vscsiBE2HU16(&pbDesc[4]) >= cTgtDescs
+            || vscsiBE2HU16(&pbDesc[6]) >= cTgtDescs
+            || (uint64_t)pSeg->cBlocks * pVScsiLunSbc->cbSector > VSCSI_XCOPY_SEG_LENGTH_MAX)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_PARAMETER_LIST, 0x00);
+        if (   pSeg->uLbaSrc >= pVScsiLunSbc->cSectors
+            || pSeg->uLbaDst >= pVScsiLunSbc->cSectors
+            || pSeg->cBlocks > pVScsiLunSbc->cSectors - pSeg->uLbaSrc
+            || pSeg->cBlocks > pVScsiLunSbc->cSectors - pSeg->uLbaDst)
+            return vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_COPY_ABORTED, SCSI_ASC_LOGICAL_BLOCK_OOR, 0x00);
+
+        pXCopy->cSegs++;
+        offSegDesc += VSCSI_XCOPY_SEG_DESC_B2B_SIZE;
+        pbDesc     += VSCSI_XCOPY_SEG_DESC_B2B_SIZE;
+    }
+
+    return SCSI_STATUS_OK;
+}
+
+/**
+ * Processes an EXTENDED COPY (LID1) command.
+ *
+ * The data is copied by the LUN itself through an intermediate buffer without
+ * involving the guest.
+ *
+ * @returns VBox status code.
+ * @param   pVScsiLunSbc    The SBC LUN instance.
+ * @param   pVScsiReq       The SCSI request, completed by this function.
+ */
+static int vscsiLunSbcReqExtendedCopy(PVSCSILUNSBC pVScsiLunSbc, PVSCSIREQINT pVScsiReq)
+{
+    PVSCSILUNINT pVScsiLun = &pVScsiLunSbc->Core;
+    uint32_t cbParams = vscsiBE2HU32(&pVScsiReq->pbCDB[10]);
+    int rcReq = SCSI_STATUS_OK;
+
+    LogFlow(("%s: cbParams=%u\n", __FUNCTION__, cbParams));
+
+    if (pVScsiReq->pbCDB[1] & 0x1f) /* Only the LID1 variant is supported. */
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+    else if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_READONLY)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED, 0x00);
+    else if (!cbParams)
+        rcReq = vscsiLunReqSenseOkSet(pVScsiLun, pVScsiReq); /* Nothing to copy is not an error. */
+    else if (   cbParams < 16
+             || cbParams > 16 + VSCSI_XCOPY_DESC_LIST_LENGTH_MAX)
+        rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_PARAMETER_LIST_LENGTH_ERROR, 0x00);
+    else
+    {
+        PVSCSISBCXCOPY pXCopy = (PVSCSISBCXCOPY)RTMemAllocZ(sizeof(VSCSISBCXCOPY));
+        uint8_t *pbParams = (uint8_t *)RTMemAlloc(cbParams);
+
+        if (pXCopy && pbParams)
+        {
+            if (RTSgBufCopyToBuf(&pVScsiReq->SgBuf, pbParams, cbParams) == cbParams)
+                rcReq = vscsiLunSbcXCopyParse(pVScsiLunSbc, pVScsiReq, pbParams, cbParams, pXCopy);
+            else
+                rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST,
+                                                 SCSI_ASC_PARAMETER_LIST_LENGTH_ERROR, 0x00);
+            RTMemFree(pbParams);
+
+            if (rcReq == SCSI_STATUS_OK)
+            {
+                pXCopy->pVScsiReq = pVScsiReq;
+                pXCopy->cbBuf     = (VSCSI_XCOPY_BUF_SIZE / pVScsiLunSbc->cbSector) * pVScsiLunSbc->cbSector;
+                pXCopy->Seg.pvSeg = RTMemAlloc(pXCopy->cbBuf);
+                if (pXCopy->Seg.pvSeg)
+                {
+                    vscsiLunSbcXCopyNext(pVScsiLunSbc, pXCopy);
+                    return VINF_SUCCESS;
+                }
+
+                rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR,
+                                                 SCSI_ASC_SYSTEM_RESOURCE_FAILURE, SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+            }
+            RTMemFree(pXCopy);
+        }
+        else
+        {
+            RTMemFree(pbParams);
+            RTMemFree(pXCopy);
+            rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_HARDWARE_ERROR, SCSI_ASC_SYSTEM_RESOURCE_FAILURE,
+                                             SCSI_ASCQ_SYSTEM_BUFFER_FULL);
+        }
+    }
+
+    vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
+    return VINF_SUCCESS;
+}
+
 static DECLCALLBACK(int) vscsiLunSbcInit(PVSCSILUNINT pVScsiLun)
 {
     PVSCSILUNSBC pVScsiLunSbc = (PVSCSILUNSBC)pVScsiLun;
@@ -70,30 +742,62 @@ static DECLCALLBACK(int) vscsiLunSbcInit(PVSCSILUNINT pVScsiLun)
     if (RT_SUCCESS(rc))
         rc = vscsiVpdPagePoolInit(&pVScsiLunSbc->VpdPagePool);
 
+    if (RT_SUCCESS(rc))
+    {
+        RTListInit(&pVScsiLunSbc->LstCmpWriteWaiting);
+        rc = RTCritSectInit(&pVScsiLunSbc->CritSectCmpWrite);
+    }
+
+    /*
+     * Build a T10 vendor ID based designator from the medium UUID if available,
+     * EXTENDED COPY can't be used without a designator.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        RTUUID Uuid;
+        int rc2 = vscsiLunMediumGetUuid(pVScsiLun, &Uuid);
+        if (   RT_SUCCESS(rc2)
+            && !RTUuidIsNull(&Uuid))
+        {
+            char szId[13];
+
+            RTStrPrintHexBytes(&szId[0], sizeof(szId), &Uuid.au8[10], 6, RTSTRPRINTHEXBYTES_F_UPPER);
+            pVScsiLunSbc->abDesignator[0] = 0x02; /* ASCII code set. */
+            pVScsiLunSbc->abDesignator[1] = 0x01; /* Logical unit association, T10 vendor ID based. */
+            pVScsiLunSbc->abDesignator[2] = 0x00;
+            pVScsiLunSbc->abDesignator[3] = VSCSI_VPD_DEVID_DESIGNATOR_T10_SIZE - 4;
+            memcpy(&pVScsiLunSbc->abDesignator[4], "VBOX    ", 8);
+            memcpy(&pVScsiLunSbc->abDesignator[12], &szId[0], 12);
+            pVScsiLunSbc->fDesignator = true;
+        }
+    }
+
     /* Create device identification page - mandatory. */
     if (RT_SUCCESS(rc))
     {
         PVSCSIVPDPAGEDEVID pDevIdPage;
+        size_t cbDesignator = pVScsiLunSbc->fDesignator ? sizeof(pVScsiLunSbc->abDesignator) : 0;
 
         rc = vscsiVpdPagePoolAllocNewPage(&pVScsiLunSbc->VpdPagePool, VSCSI_VPD_DEVID_NUMBER,
-                                          VSCSI_VPD_DEVID_SIZE, (uint8_t **)&pDevIdPage);
+                                          VSCSI_VPD_DEVID_SIZE + cbDesignator, (uint8_t **)&pDevIdPage);
         if (RT_SUCCESS(rc))
         {
-            /** @todo: Not conforming to the SPC spec but Solaris needs at least a stub to work. */
+            /** @todo: Without a medium UUID this is only a stub, not conforming to the SPC spec
+             *         but Solaris needs at least that to work. */
             pDevIdPage->u5PeripheralDeviceType = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
             pDevIdPage->u3PeripheralQualifier  = SCSI_INQUIRY_DATA_PERIPHERAL_QUALIFIER_CONNECTED;
-            pDevIdPage->u16PageLength          = RT_H2BE_U16(0x0);
+            pDevIdPage->u16PageLength          = RT_H2BE_U16((uint16_t)cbDesignator);
+            if (cbDesignator)
+                memcpy((uint8_t *)pDevIdPage + VSCSI_VPD_DEVID_SIZE, &pVScsiLunSbc->abDesignator[0], cbDesignator);
             cVpdPages++;
         }
     }
 
-    if (   RT_SUCCESS(rc)
-        && (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_UNMAP))
+    /* Create the block limits page, always present for the COMPARE AND WRITE and WRITE SAME limits. */
+    if (RT_SUCCESS(rc))
     {
         PVSCSIVPDPAGEBLOCKLIMITS pBlkPage;
-        PVSCSIVPDPAGEBLOCKPROV   pBlkProvPage;
 
-        /* Create the page and fill it. */
         rc = vscsiVpdPagePoolAllocNewPage(&pVScsiLunSbc->VpdPagePool, VSCSI_VPD_BLOCK_LIMITS_NUMBER,
                                           VSCSI_VPD_BLOCK_LIMITS_SIZE, (uint8_t **)&pBlkPage);
         if (RT_SUCCESS(rc))
@@ -101,31 +805,41 @@ static DECLCALLBACK(int) vscsiLunSbcInit(PVSCSILUNINT pVScsiLun)
                 pBlkPage->u5PeripheralDeviceType       = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
                 pBlkPage->u3PeripheralQualifier        = SCSI_INQUIRY_DATA_PERIPHERAL_QUALIFIER_CONNECTED;
                 pBlkPage->u16PageLength                = RT_H2BE_U16(0x3c);
-                pBlkPage->u8MaxCmpWriteLength          = 0;
+                pBlkPage->fWsnz                        = 0x01;
+                pBlkPage->u8MaxCmpWriteLength          = VSCSI_CMP_WRITE_LBAS_MAX;
                 pBlkPage->u16OptTrfLengthGran          = 0;
                 pBlkPage->u32MaxTrfLength              = 0;
                 pBlkPage->u32OptTrfLength              = 0;
                 pBlkPage->u32MaxPreXdTrfLength         = 0;
-                pBlkPage->u32MaxUnmapLbaCount          = RT_H2BE_U32(VSCSI_UNMAP_LBAS_MAX(pVScsiLunSbc->cbSector));
-                pBlkPage->u32MaxUnmapBlkDescCount      = UINT32_C(0xffffffff);
+                if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_UNMAP)
+                {
+                    pBlkPage->u32MaxUnmapLbaCount      = RT_H2BE_U32(VSCSI_UNMAP_LBAS_MAX(pVScsiLunSbc->cbSector));
+                    pBlkPage->u32MaxUnmapBlkDescCount  = UINT32_C(0xffffffff);
+                }
                 pBlkPage->u32OptUnmapGranularity       = 0;
                 pBlkPage->u32UnmapGranularityAlignment = 0;
+                pBlkPage->u64MaxWriteSameLength        = RT_H2BE_U64((uint64_t)VSCSI_WRITE_SAME_LBAS_MAX(pVScsiLunSbc->cbSector));
                 cVpdPages++;
         }
+    }
 
+    if (   RT_SUCCESS(rc)
+        && (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_UNMAP))
+    {
+        PVSCSIVPDPAGEBLOCKPROV pBlkProvPage;
+
+        rc = vscsiVpdPagePoolAllocNewPage(&pVScsiLunSbc->VpdPagePool, VSCSI_VPD_BLOCK_PROV_NUMBER,
+                                          VSCSI_VPD_BLOCK_PROV_SIZE, (uint8_t **)&pBlkProvPage);
         if (RT_SUCCESS(rc))
         {
-            rc = vscsiVpdPagePoolAllocNewPage(&pVScsiLunSbc->VpdPagePool, VSCSI_VPD_BLOCK_PROV_NUMBER,
-                                              VSCSI_VPD_BLOCK_PROV_SIZE, (uint8_t **)&pBlkProvPage);
-            if (RT_SUCCESS(rc))
-            {
-                pBlkProvPage->u5PeripheralDeviceType = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
-                pBlkProvPage->u3PeripheralQualifier  = SCSI_INQUIRY_DATA_PERIPHERAL_QUALIFIER_CONNECTED;
-                pBlkProvPage->u16PageLength          = RT_H2BE_U16(0x4);
-                pBlkProvPage->u8ThresholdExponent    = 1;
-                pBlkProvPage->fLBPU                  = true;
-                cVpdPages++;
-            }
+            pBlkProvPage->u5PeripheralDeviceType = SCSI_INQUIRY_DATA_PERIPHERAL_DEVICE_TYPE_DIRECT_ACCESS;
+            pBlkProvPage->u3PeripheralQualifier  = SCSI_INQUIRY_DATA_PERIPHERAL_QUALIFIER_CONNECTED;
+            pBlkProvPage->u16PageLength          = RT_H2BE_U16(0x4);
+            pBlkProvPage->u8ThresholdExponent    = 1;
+            pBlkProvPage->fLBPU                  = true;
+            pBlkProvPage->fLBPWS                 = true;
+            pBlkProvPage->fLBPWS10               = true;
+            cVpdPages++;
         }
     }
 
@@ -162,12 +876,10 @@ static DECLCALLBACK(int) vscsiLunSbcInit(PVSCSILUNINT pVScsiLun)
             pVpdPages->u16PageLength          = RT_H2BE_U16(cVpdPages);
 
             pVpdPages->abVpdPages[idxVpdPage++] = VSCSI_VPD_DEVID_NUMBER;
+            pVpdPages->abVpdPages[idxVpdPage++] = VSCSI_VPD_BLOCK_LIMITS_NUMBER;
 
             if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_UNMAP)
-            {
-                pVpdPages->abVpdPages[idxVpdPage++] = VSCSI_VPD_BLOCK_LIMITS_NUMBER;
                 pVpdPages->abVpdPages[idxVpdPage++] = VSCSI_VPD_BLOCK_PROV_NUMBER;
-            }
 
             if (pVScsiLun->fFeatures & VSCSI_LUN_FEATURE_NON_ROTATIONAL)
                 pVpdPages->abVpdPages[idxVpdPage++] = VSCSI_VPD_BLOCK_CHARACTERISTICS_NUMBER;
@@ -186,6 +898,10 @@ static DECLCALLBACK(int) vscsiLunSbcDestroy(PVSCSILUNINT pVScsiLun)
 
     vscsiVpdPagePoolDestroy(&pVScsiLunSbc->VpdPagePool);
 
+    Assert(RTListIsEmpty(&pVScsiLunSbc->LstCmpWriteWaiting));
+    if (RTCritSectIsInitialized(&pVScsiLunSbc->CritSectCmpWrite))
+        RTCritSectDelete(&pVScsiLunSbc->CritSectCmpWrite);
+
     return VINF_SUCCESS;
 }
 
@@ -197,6 +913,7 @@ static DECLCALLBACK(int) vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQ
     uint64_t uLbaStart = 0;
     uint32_t cSectorTransfer = 0;
     VSCSIIOREQTXDIR enmTxDir = VSCSIIOREQTXDIR_INVALID;
+    bool fReqInProgress = false; /* Set if the request gets completed elsewhere. */
 
     switch(pVScsiReq->pbCDB[0])
     {
@@ -516,7 +1233,10 @@ static DECLCALLBACK(int) vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQ
                             }
 
                             if (rcReq == SCSI_STATUS_OK)
+                            {
                                 rc = vscsiIoReqUnmapEnqueue(pVScsiLun, pVScsiReq, paRanges, cBlkDesc);
+                                fReqInProgress = true;
+                            }
                             if (   rcReq != SCSI_STATUS_OK
                                 || RT_FAILURE(rc))
                                 RTMemFree(paRanges);
@@ -536,6 +1256,53 @@ static DECLCALLBACK(int) vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQ
 
             break;
         }
+        case SCSI_WRITE_SAME_10:
+        case SCSI_WRITE_SAME_16:
+        {
+            rc = vscsiLunSbcReqWriteSame(pVScsiLunSbc, pVScsiReq);
+            fReqInProgress = true;
+            break;
+        }
+        case SCSI_COMPARE_AND_WRITE:
+        {
+            rc = vscsiLunSbcReqCmpWrite(pVScsiLunSbc, pVScsiReq);
+            fReqInProgress = true;
+            break;
+        }
+        case SCSI_EXTENDED_COPY:
+        {
+            rc = vscsiLunSbcReqExtendedCopy(pVScsiLunSbc, pVScsiReq);
+            fReqInProgress = true;
+            break;
+        }
+        case SCSI_RECEIVE_COPY_RESULTS:
+        {
+            if ((pVScsiReq->pbCDB[1] & 0x1f) == SCSI_RECV_COPY_RESULTS_OPERATING_PARAMETERS)
+            {
+                uint8_t aReply[46];
+
+                memset(aReply, 0, sizeof(aReply));
+                vscsiH2BEU32(&aReply[0], sizeof(aReply) - 4);
+                aReply[4] = 0x01; /* SNLID, commands without a list identifier are supported. */
+                vscsiH2BEU16(&aReply[8], VSCSI_XCOPY_TGT_DESC_MAX);
+                vscsiH2BEU16(&aReply[10], VSCSI_XCOPY_SEG_DESC_MAX);
+                vscsiH2BEU32(&aReply[12], VSCSI_XCOPY_DESC_LIST_LENGTH_MAX);
+                vscsiH2BEU32(&aReply[16], VSCSI_XCOPY_SEG_LENGTH_MAX);
+                /* No inline, held or stream data. */
+                vscsiH2BEU16(&aReply[34], 0xff); /* Total concurrent copies. */
+                aReply[36] = 0xff; /* Maximum concurrent copies. */
+                aReply[37] = ASMBitLastSetU32(pVScsiLunSbc->cbSector) - 1; /* Data segment granularity (log 2). */
+                aReply[43] = 2; /* Number of implemented descriptor type codes following. */
+                aReply[44] = 0x02; /* Block device to block device segment descriptor. */
+                aReply[45] = 0xe4; /* Identification target descriptor. */
+
+                RTSgBufCopyFromBuf(&pVScsiReq->SgBuf, aReply, sizeof(aReply));
+                rcReq = vscsiLunReqSenseOkSet(pVScsiLun, pVScsiReq);
+            }
+            else
+                rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INV_FIELD_IN_CMD_PACKET, 0x00);
+            break;
+        }
         default:
             //AssertMsgFailed(("Command %#x [%s] not implemented\n", pRequest->pbCDB[0], SCSICmdText(pRequest->pbCDB[0])));
             rcReq = vscsiLunReqSenseErrorSet(pVScsiLun, pVScsiReq, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_ILLEGAL_OPCODE, 0x00);
@@ -574,7 +1341,7 @@ static DECLCALLBACK(int) vscsiLunSbcReqProcess(PVSCSILUNINT pVScsiLun, PVSCSIREQ
         /* Enqueue flush */
         rc = vscsiIoReqFlushEnqueue(pVScsiLun, pVScsiReq);
     }
-    else if (pVScsiReq->pbCDB[0] !=  SCSI_UNMAP) /* Request completed */
+    else if (!fReqInProgress) /* Request completed */
         vscsiDeviceReqComplete(pVScsiLun->pVScsiDevice, pVScsiReq, rcReq, false, VINF_SUCCESS);
 
     return rc;
@@ -23,6 +23,8 @@
 #define VSCSI_VPD_DEVID_NUMBER 0x83
 /** VPD device identification size. */
 #define VSCSI_VPD_DEVID_SIZE   4
+/** Size of a T10 vendor ID based designation descriptor following the device identification page header. */
+#define VSCSI_VPD_DEVID_DESIGNATOR_T10_SIZE 24
 /**
  * Device identification VPD page data.
  */
@@ -124,8 +126,8 @@ typedef struct VSCSIVPDPAGEBLOCKLIMITS
     unsigned u8PageCode             : 8;
     /** Page size (Big endian) */
     unsigned u16PageLength          : 16;
-    /** Reserved. */
-    uint8_t  u8Reserved;
+    /** WRITE SAME non zero (bit 0), remaining bits reserved. */
+    uint8_t  fWsnz;
     /** Maximum compare and write length. */
     uint8_t  u8MaxCmpWriteLength;
     /** Optimal transfer length granularity. */
@@ -144,8 +146,10 @@ typedef struct VSCSIVPDPAGEBLOCKLIMITS
     uint32_t u32OptUnmapGranularity;
     /** UNMAP granularity alignment. */
     uint32_t u32UnmapGranularityAlignment;
+    /** Maximum WRITE SAME length. */
+    uint64_t u64MaxWriteSameLength;
     /** Reserved. */
-    uint8_t  abReserved[28];
+    uint8_t  abReserved[20];
 } VSCSIVPDPAGEBLOCKLIMITS;
 #pragma pack()
 AssertCompileSize(VSCSIVPDPAGEBLOCKLIMITS, VSCSI_VPD_BLOCK_LIMITS_SIZE);
@@ -177,8 +181,10 @@ typedef struct VSCSIVPDPAGEBLOCKPROV
     /** Anchored LBAs supported. */
     unsigned fAncSup                : 1;
     /** Reserved. */
-    unsigned u4Reserved             : 4;
-    /** WRITE SAME command supported. */
+    unsigned u3Reserved             : 3;
+    /** WRITE SAME(10) command with the UNMAP bit supported. */
+    unsigned fLBPWS10               : 1;
+    /** WRITE SAME(16) command with the UNMAP bit supported. */
     unsigned fLBPWS                 : 1;
     /** UNMAP command supported. */
     unsigned fLBPU                  : 1;
@@ -0,0 +1,431 @@
+/* $Id$ */
+/** @file
+ * tstDevNVMe.cpp - Testcase for the PRP handling and the completion queues of the NVMe controller.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "../DevNVMe.cpp" /* Must include the source directly to get at the static functions. */
+
+#include <iprt/initterm.h>
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Size of the faked guest memory. */
+#define TST_GUEST_MEM_SIZE          _1M
+/** Guest physical address of the completion queue. */
+#define TST_CQ_BASE                 UINT32_C(0x80000)
+/** Number of completions posted by the race test. */
+#define TST_RACE_COMPLETIONS        _256K
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The test handle. */
+static RTTEST           g_hTest;
+/** The faked guest memory. */
+static uint8_t         *g_pbGuestMem;
+/** Serializes accesses to the faked guest memory between the device and the guest. */
+static RTCRITSECT       g_CritSectMem;
+/** Number of interrupts raised by the device. */
+static volatile uint32_t g_cIrqs;
+/** The faked device helpers. */
+static PDMDEVHLPR3      g_tstDevHlp;
+
+
+/** @interface_method_impl{PDMDEVHLPR3,pfnPCIPhysRead} */
+static DECLCALLBACK(int) tstDevHlpPCIPhysRead(PPDMDEVINS pDevIns, RTGCPHYS GCPhys, void *pvBuf, size_t cbRead)
+{
+    NOREF(pDevIns);
+    RTTEST_CHECK_RET(g_hTest, GCPhys < TST_GUEST_MEM_SIZE && cbRead <= TST_GUEST_MEM_SIZE - GCPhys,
+                     VERR_PGM_PHYS_PAGE_RESERVED);
+    RTCritSectEnter(&g_CritSectMem);
+    memcpy(pvBuf, &g_pbGuestMem[GCPhys], cbRead);
+    RTCritSectLeave(&g_CritSectMem);
+    return VINF_SUCCESS;
+}
+
+
+/** @interface_method_impl{PDMDEVHLPR3,pfnPCIPhysWrite} */
+static DECLCALLBACK(int) tstDevHlpPCIPhysWrite(PPDMDEVINS pDevIns, RTGCPHYS GCPhys, const void *pvBuf, size_t cbWrite)
+{
+    NOREF(pDevIns);
+    RTTEST_CHECK_RET(g_hTest, GCPhys < TST_GUEST_MEM_SIZE && cbWrite <= TST_GUEST_MEM_SIZE - GCPhys,
+                     VERR_PGM_PHYS_PAGE_RESERVED);
+    RTCritSectEnter(&g_CritSectMem);
+    memcpy(&g_pbGuestMem[GCPhys], pvBuf, cbWrite);
+    RTCritSectLeave(&g_CritSectMem);
+    return VINF_SUCCESS;
+}
+
+
+/** @interface_method_impl{PDMDEVHLPR3,pfnPCISetIrq} */
+static DECLCALLBACK(void) tstDevHlpPCISetIrq(PPDMDEVINS pDevIns, int iIrq, int iLevel)
+{
+    NOREF(pDevIns); NOREF(iIrq);
+    if (iLevel == PDM_IRQ_LEVEL_HIGH)
+        ASMAtomicIncU32(&g_cIrqs);
+}
+
+
+/**
+ * Writes a 64bit value to the faked guest memory.
+ */
+static void tstGuestWriteU64(RTGCPHYS GCPhys, uint64_t u64)
+{
+    tstDevHlpPCIPhysWrite(NULL, GCPhys, &u64, sizeof(u64));
+}
+
+
+/**
+ * Creates a controller instance which is just complete enough for the tested
+ * code paths: ready, MSI-X enabled and one completion queue.
+ *
+ * @returns Pointer to the controller instance, NULL on failure.
+ * @param   cCqEntries      Number of entries of the completion queue.
+ */
+static PNVME tstNvmeCreate(uint32_t cCqEntries)
+{
+    PPDMDEVINS pDevIns = (PPDMDEVINS)RTMemAllocZ(RT_OFFSETOF(PDMDEVINS, achInstanceData[sizeof(NVME)]));
+    RTTEST_CHECK_RET(g_hTest, pDevIns, NULL);
+    pDevIns->u32Version       = PDM_DEVINS_VERSION;
+    pDevIns->pHlpR3           = &g_tstDevHlp;
+    pDevIns->pvInstanceDataR3 = &pDevIns->achInstanceData[0];
+
+    PNVME pThis = PDMINS_2_DATA(pDevIns, PNVME);
+    pThis->pDevInsR3             = pDevIns;
+    pThis->enmState              = NVMESTATE_READY;
+    pThis->cbPage                = NVME_PAGE_SIZE_MIN;
+    pThis->cQueuesCompMax        = 1;
+    pThis->cCompQueuesWaitersMax = 2;
+    pThis->fMsixSupported        = true;
+    PCIDevSetWord(&pThis->PciDev, NVME_PCI_MSIX_CAP_OFFSET + VBOX_MSIX_CAP_MESSAGE_CONTROL, VBOX_PCI_MSIX_FLAGS_ENABLE);
+    RTListInit(&pThis->LstWrkThrds);
+
+    PNVMEQUEUECOMP pCq = (PNVMEQUEUECOMP)RTMemAllocZ(sizeof(NVMEQUEUECOMP));
+    RTTEST_CHECK_RET(g_hTest, pCq, NULL);
+    pCq->Hdr.cEntries   = cCqEntries;
+    pCq->Hdr.cbEntry    = sizeof(NVMECQE);
+    pCq->Hdr.GCPhysBase = TST_CQ_BASE;
+    pCq->Hdr.enmState   = NVMEQUEUESTATE_ALLOCATED;
+    pCq->fIntrEnabled   = true;
+    pCq->fPhase         = true;
+    RTListInit(&pCq->LstCompletionsWaiting);
+    RTTESTI_CHECK_RC_OK(RTSemFastMutexCreate(&pCq->hMtx));
+    pThis->paQueuesCompR3 = pCq;
+
+    return pThis;
+}
+
+
+/**
+ * Destroys a controller instance created by tstNvmeCreate().
+ */
+static void tstNvmeDestroy(PNVME pThis)
+{
+    PNVMEQUEUECOMP pCq = pThis->paQueuesCompR3;
+    nvmeR3CompQueueWaitersFree(pCq);
+    RTSemFastMutexDestroy(pCq->hMtx);
+    RTMemFree(pCq);
+    RTMemFree(pThis->pDevInsR3);
+}
+
+
+/**
+ * Posts a completion with the given command identifier to the completion queue.
+ */
+static void tstCompPost(PNVME pThis, uint16_t u16Cid)
+{
+    NVMECQE Cqe;
+    RT_ZERO(Cqe);
+    Cqe.u16Cid    = u16Cid;
+    Cqe.u16Status = NVME_STATUS_INVALID_FIELD;
+    nvmeR3CompQueuePost(pThis, pThis->paQueuesCompR3, &Cqe);
+}
+
+
+/**
+ * Reads the completion queue entry at the given index the way the guest does.
+ */
+static NVMECQE tstCompRead(uint32_t idx)
+{
+    NVMECQE Cqe;
+    tstDevHlpPCIPhysRead(NULL, TST_CQ_BASE + idx * sizeof(NVMECQE), &Cqe, sizeof(Cqe));
+    return Cqe;
+}
+
+
+/**
+ * Writes the head doorbell of the completion queue the way the guest does.
+ */
+static void tstCompHeadWrite(PNVME pThis, uint32_t idxHead)
+{
+    int rc = nvmeDoorbellWrite(pThis, NVME_REG_DBL_FIRST + sizeof(uint32_t) /* CQ 0 head */, idxHead);
+    RTTESTI_CHECK_RC(rc, VINF_SUCCESS);
+}
+
+
+static void tstPrpList(PNVME pThis)
+{
+    RTGCPHYS aGCPhysPrps[NVME_PRPS_MAX];
+    uint32_t cPrps = 0;
+
+    RTTestSub(g_hTest, "PRP list");
+
+    /* One page, PRP entry 2 is not used. */
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x1000, 0xdead, _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_SUCCESS);
+    RTTESTI_CHECK(cPrps == 1 && aGCPhysPrps[0] == 0x1000);
+
+    /* Offset into the first page makes the transfer cross into a second page. */
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x1800, 0x3000, _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_SUCCESS);
+    RTTESTI_CHECK(cPrps == 2 && aGCPhysPrps[0] == 0x1800 && aGCPhysPrps[1] == 0x3000);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x1800, 0x3010, _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_INVALID_PRP_OFFSET);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x1802, 0x3000, _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_INVALID_PRP_OFFSET);
+
+    /* More than two pages, PRP entry 2 points to a list. */
+    tstGuestWriteU64(0x10000, 0x21000);
+    tstGuestWriteU64(0x10008, 0x22000);
+    tstGuestWriteU64(0x10010, 0x23000);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x20004, 0x10000, 3 * _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_SUCCESS);
+    RTTESTI_CHECK(   cPrps == 4
+                  && aGCPhysPrps[0] == 0x20004
+                  && aGCPhysPrps[1] == 0x21000
+                  && aGCPhysPrps[2] == 0x22000
+                  && aGCPhysPrps[3] == 0x23000);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x20000, 0x10004, 3 * _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_INVALID_PRP_OFFSET);
+    tstGuestWriteU64(0x10008, 0x22008);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x20000, 0x10000, 3 * _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_INVALID_PRP_OFFSET);
+
+    /* The list starts two entries before the end of a page, the last one chains to the next list page. */
+    tstGuestWriteU64(0x10ff0, 0x31000);
+    tstGuestWriteU64(0x10ff8, 0x12000);
+    for (uint32_t i = 0; i < 7; i++)
+        tstGuestWriteU64(0x12000 + i * sizeof(uint64_t), 0x32000 + i * _4K);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x30000, 0x10ff0, 9 * _4K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_SUCCESS);
+    RTTESTI_CHECK(cPrps == 9);
+    for (uint32_t i = 0; i < RT_MIN(cPrps, 9); i++)
+        RTTESTI_CHECK_MSG(aGCPhysPrps[i] == 0x30000 + i * _4K, ("PRP %u: %RGp\n", i, aGCPhysPrps[i]));
+}
+
+
+static void tstPrpCopy(PNVME pThis)
+{
+    RTGCPHYS aGCPhysPrps[NVME_PRPS_MAX];
+    uint32_t cPrps = 0;
+    uint8_t  abBuf[_4K];
+
+    RTTestSub(g_hTest, "PRP copy");
+
+    /* Three pages scattered backwards through guest memory, the first one starts in the middle of a page. */
+    tstGuestWriteU64(0x10000, 0x41000);
+    tstGuestWriteU64(0x10008, 0x40000);
+    RTTESTI_CHECK(nvmeR3PrpListBuild(pThis, 0x42800, 0x10000, 2 * _4K + _2K, &aGCPhysPrps[0], &cPrps) == NVME_STATUS_SUCCESS);
+    RTTESTI_CHECK_RETV(cPrps == 3);
+
+    RTCritSectEnter(&g_CritSectMem);
+    for (uint32_t off = 0; off < _2K; off++)
+        g_pbGuestMem[0x42800 + off] = (uint8_t)(off / 256);
+    for (uint32_t off = 0; off < _4K; off++)
+    {
+        g_pbGuestMem[0x41000 + off] = (uint8_t)((_2K + off) / 256);
+        g_pbGuestMem[0x40000 + off] = (uint8_t)((_2K + _4K + off) / 256);
+    }
+    RTCritSectLeave(&g_CritSectMem);
+
+    /* Read a page sized chunk from every offset crossing a PRP boundary. */
+    static const uint32_t s_aoffData[] = { 0, _1K, _2K - 1, _2K, _4K, _4K + _2K - 16 };
+    for (uint32_t i = 0; i < RT_ELEMENTS(s_aoffData); i++)
+    {
+        uint32_t offData = s_aoffData[i];
+        size_t   cbCopy  = RT_MIN(sizeof(abBuf), 2 * _4K + _2K - offData);
+        RTSGSEG  Seg     = { &abBuf[0], sizeof(abBuf) };
+        RTSGBUF  SgBuf;
+
+        RTSgBufInit(&SgBuf, &Seg, 1);
+        RT_ZERO(abBuf);
+        size_t cbCopied = nvmeR3PrpCopy(pThis, &aGCPhysPrps[0], cPrps, offData, &SgBuf, cbCopy, false /*fToGuest*/);
+        RTTESTI_CHECK_MSG(cbCopied == cbCopy, ("offData=%#x: cbCopied=%#zx\n", offData, cbCopied));
+        for (uint32_t off = 0; off < cbCopied; off++)
+            if (abBuf[off] != (uint8_t)((offData + off) / 256))
+            {
+                RTTestIFailed("offData=%#x: byte %#x is %#x\n", offData, off, abBuf[off]);
+                break;
+            }
+    }
+}
+
+
+static void tstCompQueueFull(PNVME pThis)
+{
+    PNVMEQUEUECOMP pCq = pThis->paQueuesCompR3;
+
+    RTTestSub(g_hTest, "Completion queue full");
+
+    /* A queue with 4 entries holds 3 completions. */
+    uint32_t cIrqsStart = g_cIrqs;
+    for (uint16_t u16Cid = 1; u16Cid <= 3; u16Cid++)
+        tstCompPost(pThis, u16Cid);
+    RTTESTI_CHECK(g_cIrqs - cIrqsStart == 3);
+    RTTESTI_CHECK(pCq->Hdr.idxTail == 3 && pCq->cWaiters == 0);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        NVMECQE Cqe = tstCompRead(i);
+        RTTESTI_CHECK_MSG(   Cqe.u16Cid == i + 1
+                          && Cqe.u16Status == ((NVME_STATUS_INVALID_FIELD << 1) | 1),
+                          ("Entry %u: cid=%#x status=%#x\n", i, Cqe.u16Cid, Cqe.u16Status));
+    }
+
+    /* The next two get parked without an interrupt. */
+    tstCompPost(pThis, 4);
+    tstCompPost(pThis, 5);
+    RTTESTI_CHECK(g_cIrqs - cIrqsStart == 3);
+    RTTESTI_CHECK(pCq->Hdr.idxTail == 3 && pCq->cWaiters == 2);
+
+    /* Consuming all entries posts the parked ones, the second wraps and flips the phase. */
+    tstCompHeadWrite(pThis, 3);
+    RTTESTI_CHECK(g_cIrqs - cIrqsStart == 4);
+    RTTESTI_CHECK(pCq->Hdr.idxTail == 1 && pCq->cWaiters == 0 && !pCq->fPhase);
+    NVMECQE Cqe = tstCompRead(3);
+    RTTESTI_CHECK(Cqe.u16Cid == 4 && (Cqe.u16Status & 1));
+    Cqe = tstCompRead(0);
+    RTTESTI_CHECK(Cqe.u16Cid == 5 && !(Cqe.u16Status & 1));
+
+    /* Completions are dropped once the controller is reset. */
+    pThis->enmState = NVMESTATE_RESETTING;
+    tstCompPost(pThis, 6);
+    RTTESTI_CHECK(pCq->Hdr.idxTail == 1 && pCq->cWaiters == 0);
+    pThis->enmState = NVMESTATE_READY;
+}
+
+
+/**
+ * The guest side of the race test, consumes completions as they show up and
+ * writes the head doorbell after every entry.
+ */
+static DECLCALLBACK(int) tstCompRaceGuest(RTTHREAD hThread, void *pvUser)
+{
+    PNVME          pThis    = (PNVME)pvUser;
+    PNVMEQUEUECOMP pCq      = pThis->paQueuesCompR3;
+    uint32_t       idxHead  = pCq->Hdr.idxHead;
+    bool           fPhase   = pCq->fPhase;
+    uint32_t       cSeen    = 0;
+    uint64_t       tsLast   = RTTimeMilliTS();
+    NOREF(hThread);
+
+    while (cSeen < TST_RACE_COMPLETIONS)
+    {
+        NVMECQE Cqe = tstCompRead(idxHead);
+        if (RT_BOOL(Cqe.u16Status & 1) != fPhase)
+        {
+            /* Nothing new, a stuck parked entry shows up as a timeout here. */
+            if (RTTimeMilliTS() - tsLast > 10 * RT_MS_1SEC)
+            {
+                RTTestIFailed("No completion for 10s after %u of %u, %u parked\n",
+                              cSeen, TST_RACE_COMPLETIONS, ASMAtomicReadU32(&pCq->cWaiters));
+                return VERR_TIMEOUT;
+            }
+            RTThreadYield();
+            continue;
+        }
+
+        if (Cqe.u16Cid != (uint16_t)cSeen)
+        {
+            RTTestIFailed("Completion %u has command identifier %#x\n", cSeen, Cqe.u16Cid);
+            return VERR_INTERNAL_ERROR;
+        }
+
+        cSeen++;
+        idxHead = (idxHead + 1) % pCq->Hdr.cEntries;
+        if (!idxHead)
+            fPhase = !fPhase;
+        tstCompHeadWrite(pThis, idxHead);
+        tsLast = RTTimeMilliTS();
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+static void tstCompQueueRace(PNVME pThis)
+{
+    RTTestSub(g_hTest, "Completion queue head doorbell vs. parking race");
+
+    /*
+     * The guest consumes entries on its own thread while we post them as fast
+     * as possible, so entries are parked and unparked all the time. Each one
+     * has to arrive, in order.
+     */
+    RTTHREAD hThrdGuest;
+    int rc = RTThreadCreate(&hThrdGuest, tstCompRaceGuest, pThis, 0, RTTHREADTYPE_DEFAULT,
+                            RTTHREADFLAGS_WAITABLE, "tstNvmeGuest");
+    RTTESTI_CHECK_RC_OK_RETV(rc);
+
+    for (uint32_t i = 0; i < TST_RACE_COMPLETIONS; i++)
+        tstCompPost(pThis, (uint16_t)i);
+
+    int rcThrd = VERR_INTERNAL_ERROR;
+    rc = RTThreadWait(hThrdGuest, RT_MS_1MIN, &rcThrd);
+    RTTESTI_CHECK_RC_OK(rc);
+    RTTESTI_CHECK_RC_OK(rcThrd);
+    RTTestIValue("Completions parked", pThis->StatCompQueueFull.c, RTTESTUNIT_OCCURRENCES);
+}
+
+
+int main(int argc, char *argv[])
+{
+    NOREF(argc); NOREF(argv);
+
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstDevNVMe", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    g_tstDevHlp.u32Version      = PDM_DEVHLPR3_VERSION;
+    g_tstDevHlp.pfnPCIPhysRead  = tstDevHlpPCIPhysRead;
+    g_tstDevHlp.pfnPCIPhysWrite = tstDevHlpPCIPhysWrite;
+    g_tstDevHlp.pfnPCISetIrq    = tstDevHlpPCISetIrq;
+    g_tstDevHlp.u32TheEnd       = PDM_DEVHLPR3_VERSION;
+
+    g_pbGuestMem = (uint8_t *)RTMemAllocZ(TST_GUEST_MEM_SIZE);
+    RTTESTI_CHECK_RET(g_pbGuestMem, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RC_OK_RET(RTCritSectInit(&g_CritSectMem), RTTestSummaryAndDestroy(g_hTest));
+
+    PNVME pThis = tstNvmeCreate(4);
+    if (pThis)
+    {
+        tstPrpList(pThis);
+        tstPrpCopy(pThis);
+        tstCompQueueFull(pThis);
+        tstNvmeDestroy(pThis);
+    }
+
+    /* A small queue so it's full most of the time. */
+    pThis = tstNvmeCreate(8);
+    if (pThis)
+    {
+        tstCompQueueRace(pThis);
+        tstNvmeDestroy(pThis);
+    }
+
+    RTCritSectDelete(&g_CritSectMem);
+    RTMemFree(g_pbGuestMem);
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -1932,6 +1932,7 @@ int main()
     GEN_CHECK_OFF(HPET, u64HpetCounter);
     GEN_CHECK_OFF(HPET, CritSect);
     GEN_CHECK_OFF(HPET, fIch9);
+    GEN_CHECK_OFF(HPET, u32CounterSeq);
 
     GEN_CHECK_SIZE(HPETTIMER);
     GEN_CHECK_OFF(HPETTIMER, pTimerR3);
@@ -914,6 +914,18 @@ static int parseExportOptions(const char *psz, com::SafeArray<ExportOptions_T> *
                 options->push_back(ExportOptions_StripAllNonNATMACs);
             else if (!RTStrNICmp(psz, "nomacsbutnat", len))
                 options->push_back(ExportOptions_StripAllNonNATMACs);
+            else if (!RTStrNICmp(psz, "CompressionStore", len))
+                options->push_back(ExportOptions_CompressionStore);
+            else if (!RTStrNICmp(psz, "nocompression", len))
+                options->push_back(ExportOptions_CompressionStore);
+            else if (!RTStrNICmp(psz, "CompressionFast", len))
+                options->push_back(ExportOptions_CompressionFast);
+            else if (!RTStrNICmp(psz, "fastcompression", len))
+                options->push_back(ExportOptions_CompressionFast);
+            else if (!RTStrNICmp(psz, "CompressionMax", len))
+                options->push_back(ExportOptions_CompressionMax);
+            else if (!RTStrNICmp(psz, "maxcompression", len))
+                options->push_back(ExportOptions_CompressionMax);
             else
                 rc = VERR_PARSE_ERROR;
         }
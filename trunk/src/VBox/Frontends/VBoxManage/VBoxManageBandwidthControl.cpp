@@ -190,12 +190,18 @@ static RTEXITCODE handleBandwidthControlSet(HandlerArg *a, ComPtr<IBandwidthCont
     HRESULT rc = S_OK;
     static const RTGETOPTDEF g_aBWCtlAddOptions[] =
         {
-            { "--limit",  'l', RTGETOPT_REQ_STRING }
+            { "--limit",  'l', RTGETOPT_REQ_STRING },
+            { "--parent", 'p', RTGETOPT_REQ_STRING },
+            { "--ceil",   'c', RTGETOPT_REQ_STRING },
+            { "--burst",  'b', RTGETOPT_REQ_UINT32 }
         };
 
 
     Bstr name(a->argv[2]);
     int64_t cMaxBytesPerSec = INT64_MAX;
+    int64_t cCeilBytesPerSec = INT64_MAX;
+    const char *pszParent = NULL;
+    uint32_t cbBurst = UINT32_MAX;
 
     int c;
     RTGETOPTUNION ValueUnion;
@@ -224,6 +230,34 @@ static RTEXITCODE handleBandwidthControlSet(HandlerArg *a, ComPtr<IBandwidthCont
                 break;
             }
 
+            case 'p': // parent, empty to remove it
+            {
+                pszParent = ValueUnion.psz;
+                break;
+            }
+
+            case 'c': // ceiling
+            {
+                if (ValueUnion.psz)
+                {
+                    const char *pcszError = parseLimit(ValueUnion.psz, &cCeilBytesPerSec);
+                    if (pcszError)
+                    {
+                        errorArgument(pcszError);
+                        return RTEXITCODE_FAILURE;
+                    }
+                }
+                else
+                    rc = E_FAIL;
+                break;
+            }
+
+            case 'b': // burst size in bytes
+            {
+                cbBurst = ValueUnion.u32;
+                break;
+            }
+
             default:
             {
                 errorGetOpt(USAGE_BANDWIDTHCONTROL, c, &ValueUnion);
@@ -233,15 +267,24 @@ static RTEXITCODE handleBandwidthControlSet(HandlerArg *a, ComPtr<IBandwidthCont
         }
     }
 
+    if (FAILED(rc))
+        return RTEXITCODE_FAILURE;
 
-    if (cMaxBytesPerSec != INT64_MAX)
+    if (   cMaxBytesPerSec != INT64_MAX
+        || cCeilBytesPerSec != INT64_MAX
+        || pszParent
+        || cbBurst != UINT32_MAX)
     {
         ComPtr<IBandwidthGroup> bwGroup;
         CHECK_ERROR2I_RET(bwCtrl, GetBandwidthGroup(name.raw(), bwGroup.asOutParam()), RTEXITCODE_FAILURE);
-        if (SUCCEEDED(rc))
-        {
+        if (pszParent)
+            CHECK_ERROR2I_RET(bwGroup, COMSETTER(Parent)(Bstr(pszParent).raw()), RTEXITCODE_FAILURE);
+        if (cCeilBytesPerSec != INT64_MAX)
+            CHECK_ERROR2I_RET(bwGroup, COMSETTER(CeilBytesPerSec)((LONG64)cCeilBytesPerSec), RTEXITCODE_FAILURE);
+        if (cbBurst != UINT32_MAX)
+            CHECK_ERROR2I_RET(bwGroup, COMSETTER(BurstBytes)(cbBurst), RTEXITCODE_FAILURE);
+        if (cMaxBytesPerSec != INT64_MAX)
             CHECK_ERROR2I_RET(bwGroup, COMSETTER(MaxBytesPerSec)((LONG64)cMaxBytesPerSec), RTEXITCODE_FAILURE);
-        }
     }
 
     return RTEXITCODE_SUCCESS;
@@ -312,7 +355,7 @@ RTEXITCODE handleBandwidthControl(HandlerArg *a)
 
     if (a->argc < 2)
         return errorSyntax(USAGE_BANDWIDTHCONTROL, "Too few parameters");
-    else if (a->argc > 7)
+    else if (a->argc > 11)
         return errorSyntax(USAGE_BANDWIDTHCONTROL, "Too many parameters");
 
     /* try to find the given machine */
@@ -932,7 +932,9 @@ void printUsage(USAGECATEGORY fCategory, uint32_t fSubCategory, PRTSTREAM pStrm)
                      "                            [--legacy09|--ovf09|--ovf10|--ovf20]\n"
                      "                            [--manifest]\n"
                      "                            [--iso]\n"
-                     "                            [--options manifest|iso|nomacs|nomacsbutnat]\n"
+                     "                            [--options manifest|iso|nomacs|nomacsbutnat|\n"
+                     "                                       nocompression|fastcompression|\n"
+                     "                                       maxcompression]\n"
                      "                            [--vsys <number of virtual system>]\n"
                      "                                    [--product <product name>]\n"
                      "                                    [--producturl <product url>]\n"
@@ -1104,7 +1106,10 @@ void printUsage(USAGECATEGORY fCategory, uint32_t fSubCategory, PRTSTREAM pStrm)
                      "                            add <name> --type disk|network\n"
                      "                                --limit <megabytes per second>[k|m|g|K|M|G] |\n"
                      "                            set <name>\n"
-                     "                                --limit <megabytes per second>[k|m|g|K|M|G] |\n"
+                     "                                [--limit <megabytes per second>[k|m|g|K|M|G]]\n"
+                     "                                [--parent <name>]\n"
+                     "                                [--ceil <megabytes per second>[k|m|g|K|M|G]]\n"
+                     "                                [--burst <bytes>] |\n"
                      "                            remove <name> |\n"
                      "                            list [--machinereadable]\n"
                      "                            (limit units: k=kilobit, m=megabit, g=gigabit,\n"
@@ -204,6 +204,7 @@ struct Appliance::Data
     /** @} */
 
     bool                fExportISOImages;// when 1 the ISO images are exported
+    Utf8Str             strExportCompressionLevel; // VD compression level for exported disks, empty for default
 
     RTCList<ImportOptions_T> optListImport;
     RTCList<ExportOptions_T> optListExport;
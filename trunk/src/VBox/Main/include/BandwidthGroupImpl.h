@@ -49,11 +49,15 @@ public:
     void i_unshare();
     void i_reference();
     void i_release();
+    void i_loadShaping(const settings::BandwidthGroup &data);
 
     ComObjPtr<BandwidthGroup> i_getPeer() { return m->pPeer; }
     const Utf8Str &i_getName() const { return m->bd->mData.strName; }
     BandwidthGroupType_T i_getType() const { return m->bd->mData.enmType; }
     LONG64 i_getMaxBytesPerSec() const { return m->bd->mData.cMaxBytesPerSec; }
+    const Utf8Str &i_getParent() const { return m->bd->mData.strParent; }
+    LONG64 i_getCeilBytesPerSec() const { return m->bd->mData.cCeilBytesPerSec; }
+    ULONG i_getBurstBytes() const { return m->bd->mData.cbBurst; }
     ULONG i_getReferences() const { return m->bd->cReferences; }
 
 private:
@@ -64,6 +68,12 @@ private:
     HRESULT getReference(ULONG *aReferences);
     HRESULT getMaxBytesPerSec(LONG64 *aMaxBytesPerSec);
     HRESULT setMaxBytesPerSec(LONG64 MaxBytesPerSec);
+    HRESULT getParent(com::Utf8Str &aParent);
+    HRESULT setParent(const com::Utf8Str &aParent);
+    HRESULT getCeilBytesPerSec(LONG64 *aCeilBytesPerSec);
+    HRESULT setCeilBytesPerSec(LONG64 aCeilBytesPerSec);
+    HRESULT getBurstBytes(ULONG *aBurstBytes);
+    HRESULT setBurstBytes(ULONG aBurstBytes);
 
     ////////////////////////////////////////////////////////////////////////////////
     ////
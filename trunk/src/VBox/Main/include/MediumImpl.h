@@ -205,6 +205,7 @@ public:
     HRESULT i_exportFile(const char *aFilename,
                          const ComObjPtr<MediumFormat> &aFormat,
                          MediumVariant_T aVariant,
+                         const Utf8Str &aCompressionLevel,
                          SecretKeyStore *pKeyStore,
                          PVDINTERFACEIO aVDImageIOIf, void *aVDImageIOUser,
                          const ComObjPtr<Progress> &aProgress);
@@ -324,6 +325,12 @@ private:
                                                  size_t *pcbValue);
     static DECLCALLBACK(int) i_vdConfigQuery(void *pvUser, const char *pszName,
                                              char *pszValue, size_t cchValue);
+    static DECLCALLBACK(bool) i_vdExportConfigAreKeysValid(void *pvUser,
+                                                           const char *pszzValid);
+    static DECLCALLBACK(int) i_vdExportConfigQuerySize(void *pvUser, const char *pszName,
+                                                       size_t *pcbValue);
+    static DECLCALLBACK(int) i_vdExportConfigQuery(void *pvUser, const char *pszName,
+                                                   char *pszValue, size_t cchValue);
     static DECLCALLBACK(int) i_vdTcpSocketCreate(uint32_t fFlags, PVDSOCKET pSock);
     static DECLCALLBACK(int) i_vdTcpSocketDestroy(VDSOCKET Sock);
     static DECLCALLBACK(int) i_vdTcpClientConnect(VDSOCKET Sock, const char *pszAddress, uint32_t uPort,
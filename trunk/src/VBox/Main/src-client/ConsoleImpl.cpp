@@ -5604,7 +5604,17 @@ HRESULT Console::i_onBandwidthGroupChange(IBandwidthGroup *aBandwidthGroup)
                     vrc = PDMR3AsyncCompletionBwMgrSetMaxForFile(ptrVM.rawUVM(), Utf8Str(strName).c_str(), (uint32_t)cMax);
 #ifdef VBOX_WITH_NETSHAPER
                 else if (enmType == BandwidthGroupType_Network)
-                    vrc = PDMR3NsBwGroupSetLimit(ptrVM.rawUVM(), Utf8Str(strName).c_str(), cMax);
+                {
+                    LONG64 cCeil;
+                    ULONG cbBurst;
+                    rc = aBandwidthGroup->COMGETTER(CeilBytesPerSec)(&cCeil);
+                    if (SUCCEEDED(rc))
+                        rc = aBandwidthGroup->COMGETTER(BurstBytes)(&cbBurst);
+                    if (SUCCEEDED(rc))
+                        vrc = PDMR3NsBwGroupSetCeilAndBurst(ptrVM.rawUVM(), Utf8Str(strName).c_str(), cCeil, cbBurst);
+                    if (RT_SUCCESS(vrc) && SUCCEEDED(rc))
+                        vrc = PDMR3NsBwGroupSetLimit(ptrVM.rawUVM(), Utf8Str(strName).c_str(), cMax);
+                }
                 else
                     rc = E_NOTIMPL;
 #endif /* VBOX_WITH_NETSHAPER */
@@ -1366,9 +1366,22 @@ int Console::i_configConstructorInner(PUVM pUVM, PVM pVM, AutoWriteLock *pAlock)
             else if (enmType == BandwidthGroupType_Network)
             {
                 /* Network bandwidth groups. */
+                Bstr strParent;
+                LONG64 cCeilBytesPerSec;
+                ULONG cbBurst;
+                hrc = bwGroups[i]->COMGETTER(Parent)(strParent.asOutParam());               H();
+                hrc = bwGroups[i]->COMGETTER(CeilBytesPerSec)(&cCeilBytesPerSec);           H();
+                hrc = bwGroups[i]->COMGETTER(BurstBytes)(&cbBurst);                         H();
+
                 PCFGMNODE pBwGroup;
                 InsertConfigNode(pNetworkBwGroups, Utf8Str(strName).c_str(), &pBwGroup);
                 InsertConfigInteger(pBwGroup, "Max", cMaxBytesPerSec);
+                if (!strParent.isEmpty())
+                    InsertConfigString(pBwGroup, "Parent", strParent);
+                if (cCeilBytesPerSec)
+                    InsertConfigInteger(pBwGroup, "Ceil", cCeilBytesPerSec);
+                if (cbBurst)
+                    InsertConfigInteger(pBwGroup, "Burst", cbBurst);
             }
 #endif /* VBOX_WITH_NETSHAPER */
         }
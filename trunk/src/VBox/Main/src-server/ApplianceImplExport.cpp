@@ -639,6 +639,29 @@ HRESULT Appliance::write(const com::Utf8Str &aFormat,
 
     m->fExportISOImages = m->optListExport.contains(ExportOptions_ExportDVDImages);
 
+    /* The disk images are written as streamOptimized VMDKs, pass the level
+     * on to the VD backend doing the compression. */
+    unsigned cCompressionOptions = 0;
+    m->strExportCompressionLevel.setNull();
+    if (m->optListExport.contains(ExportOptions_CompressionStore))
+    {
+        m->strExportCompressionLevel = "store";
+        cCompressionOptions++;
+    }
+    if (m->optListExport.contains(ExportOptions_CompressionFast))
+    {
+        m->strExportCompressionLevel = "fast";
+        cCompressionOptions++;
+    }
+    if (m->optListExport.contains(ExportOptions_CompressionMax))
+    {
+        m->strExportCompressionLevel = "max";
+        cCompressionOptions++;
+    }
+    if (cCompressionOptions > 1)
+        return setError(E_INVALIDARG,
+                        tr("Only one compression option can be given for the export"));
+
     if (!m->fExportISOImages)/* remove all ISO images from VirtualSystemDescription */
     {
         list< ComObjPtr<VirtualSystemDescription> >::const_iterator it;
@@ -2214,6 +2237,7 @@ HRESULT Appliance::i_writeFSImpl(TaskOVF *pTask, AutoWriteLockBase& writeLock, P
                     rc = pSourceDisk->i_exportFile(strTargetFilePath.c_str(),
                                                    format,
                                                    MediumVariant_VmdkStreamOptimized,
+                                                   m->strExportCompressionLevel,
                                                    m->m_pSecretKeyStore,
                                                    pIfIo,
                                                    pStorage,
@@ -438,6 +438,14 @@ HRESULT BandwidthControl::deleteBandwidthGroup(const com::Utf8Str &aName)
         return setError(VBOX_E_OBJECT_IN_USE,
                         tr("The bandwidth group '%s' is still in use"), aName.c_str());
 
+    for (BandwidthGroupList::const_iterator it = m->llBandwidthGroups->begin();
+         it != m->llBandwidthGroups->end();
+         ++it)
+        if ((*it)->i_getParent() == aName)
+            return setError(VBOX_E_OBJECT_IN_USE,
+                            tr("The bandwidth group '%s' is the parent of '%s'"),
+                            aName.c_str(), (*it)->i_getName().c_str());
+
     /* We can remove it now. */
     m->pParent->i_setModified(Machine::IsModified_BandwidthControl);
     m->llBandwidthGroups.backup();
@@ -502,6 +510,11 @@ HRESULT BandwidthControl::i_loadSettings(const settings::IOSettings &data)
         const settings::BandwidthGroup &gr = *it;
         rc = createBandwidthGroup(gr.strName, gr.enmType, gr.cMaxBytesPerSec);
         if (FAILED(rc)) break;
+
+        ComObjPtr<BandwidthGroup> group;
+        rc = i_getBandwidthGroupByName(gr.strName, group, true /* aSetError */);
+        if (FAILED(rc)) break;
+        group->i_loadShaping(gr);
     }
 
     return rc;
@@ -525,6 +538,9 @@ HRESULT BandwidthControl::i_saveSettings(settings::IOSettings &data)
         group.strName      = (*it)->i_getName();
         group.enmType      = (*it)->i_getType();
         group.cMaxBytesPerSec = (*it)->i_getMaxBytesPerSec();
+        group.strParent    = (*it)->i_getParent();
+        group.cCeilBytesPerSec = (*it)->i_getCeilBytesPerSec();
+        group.cbBurst      = (*it)->i_getBurstBytes();
 
         data.llBandwidthGroups.push_back(group);
     }
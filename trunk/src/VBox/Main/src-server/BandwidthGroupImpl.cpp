@@ -20,6 +20,7 @@
 #include "MachineImpl.h"
 #include "Global.h"
 
+#include "AutoStateDep.h"
 #include "AutoCaller.h"
 #include "Logging.h"
 
@@ -250,6 +251,117 @@ HRESULT BandwidthGroup::setMaxBytesPerSec(LONG64 aMaxBytesPerSec)
     return S_OK;
 }
 
+HRESULT BandwidthGroup::getParent(com::Utf8Str &aParent)
+{
+    AutoReadLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    aParent = m->bd->mData.strParent;
+
+    return S_OK;
+}
+
+HRESULT BandwidthGroup::setParent(const com::Utf8Str &aParent)
+{
+    /* the hierarchy is linked when the VM starts, it cannot change at runtime */
+    ComObjPtr<Machine> pMachine = m->pParent->i_getMachine();
+    AutoMutableOrSavedStateDependency adep(pMachine);
+    if (FAILED(adep.rc())) return adep.rc();
+
+    if (aParent.isNotEmpty())
+    {
+        if (m->bd->mData.enmType != BandwidthGroupType_Network)
+            return setError(E_INVALIDARG,
+                            tr("Only network bandwidth groups can have a parent"));
+
+        /* The parent must exist, be a network group and must not be a descendant of this one. */
+        AutoReadLock ctrlLock(m->pParent COMMA_LOCKVAL_SRC_POS);
+        Utf8Str strCur = aParent;
+        for (unsigned cDepth = 0; strCur.isNotEmpty(); cDepth++)
+        {
+            if (   strCur == m->bd->mData.strName
+                || cDepth >= 16)
+                return setError(E_INVALIDARG,
+                                tr("Bandwidth group '%s' cannot be its own ancestor"),
+                                m->bd->mData.strName.c_str());
+
+            ComObjPtr<BandwidthGroup> pGroup;
+            HRESULT rc = m->pParent->i_getBandwidthGroupByName(strCur, pGroup, false /* aSetError */);
+            if (FAILED(rc))
+                return setError(VBOX_E_OBJECT_NOT_FOUND,
+                                tr("Could not find a bandwidth group named '%s'"),
+                                strCur.c_str());
+            if (pGroup->i_getType() != BandwidthGroupType_Network)
+                return setError(E_INVALIDARG,
+                                tr("The bandwidth group '%s' is not a network bandwidth group"),
+                                strCur.c_str());
+            strCur = pGroup->i_getParent();
+        }
+    }
+
+    pMachine->i_setModifiedLock(Machine::IsModified_BandwidthControl);
+
+    AutoWriteLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    m->bd.backup();
+    m->bd->mData.strParent = aParent;
+
+    return S_OK;
+}
+
+HRESULT BandwidthGroup::getCeilBytesPerSec(LONG64 *aCeilBytesPerSec)
+{
+    AutoReadLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    *aCeilBytesPerSec = m->bd->mData.cCeilBytesPerSec;
+
+    return S_OK;
+}
+
+HRESULT BandwidthGroup::setCeilBytesPerSec(LONG64 aCeilBytesPerSec)
+{
+    if (aCeilBytesPerSec < 0)
+        return setError(E_INVALIDARG,
+                        tr("Bandwidth group ceiling cannot be negative"));
+
+    AutoWriteLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    m->bd.backup();
+    m->bd->mData.cCeilBytesPerSec = aCeilBytesPerSec;
+
+    /* inform direct session if any. */
+    ComObjPtr<Machine> pMachine = m->pParent->i_getMachine();
+    alock.release();
+    pMachine->i_setModifiedLock(Machine::IsModified_BandwidthControl);
+    pMachine->i_onBandwidthGroupChange(this);
+
+    return S_OK;
+}
+
+HRESULT BandwidthGroup::getBurstBytes(ULONG *aBurstBytes)
+{
+    AutoReadLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    *aBurstBytes = m->bd->mData.cbBurst;
+
+    return S_OK;
+}
+
+HRESULT BandwidthGroup::setBurstBytes(ULONG aBurstBytes)
+{
+    AutoWriteLock alock(this COMMA_LOCKVAL_SRC_POS);
+
+    m->bd.backup();
+    m->bd->mData.cbBurst = aBurstBytes;
+
+    /* inform direct session if any. */
+    ComObjPtr<Machine> pMachine = m->pParent->i_getMachine();
+    alock.release();
+    pMachine->i_setModifiedLock(Machine::IsModified_BandwidthControl);
+    pMachine->i_onBandwidthGroupChange(this);
+
+    return S_OK;
+}
+
 // public methods only for internal purposes
 /////////////////////////////////////////////////////////////////////////////
 
@@ -341,3 +453,15 @@ void BandwidthGroup::i_release()
     m->bd->cReferences--;
 }
 
+/**
+ * Takes over the network shaping parameters from the settings when loading
+ * the machine, without validating the parent (it may be listed later).
+ */
+void BandwidthGroup::i_loadShaping(const settings::BandwidthGroup &data)
+{
+    AutoWriteLock wl(this COMMA_LOCKVAL_SRC_POS);
+    m->bd->mData.strParent        = data.strParent;
+    m->bd->mData.cCeilBytesPerSec = data.cCeilBytesPerSec;
+    m->bd->mData.cbBurst          = data.cbBurst;
+}
+
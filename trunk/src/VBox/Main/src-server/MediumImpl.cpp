@@ -571,6 +571,7 @@ public:
                const char *aFilename,
                MediumFormat *aFormat,
                MediumVariant_T aVariant,
+               const Utf8Str &aCompressionLevel,
                SecretKeyStore *pSecretKeyStore,
                VDINTERFACEIO *aVDImageIOIf,
                void *aVDImageIOUser,
@@ -581,6 +582,7 @@ public:
           mFilename(aFilename),
           mFormat(aFormat),
           mVariant(aVariant),
+          mCompressionLevel(aCompressionLevel),
           m_pSecretKeyStore(pSecretKeyStore),
           mfKeepSourceMediumLockList(fKeepSourceMediumLockList)
     {
@@ -594,6 +596,20 @@ public:
                                      sizeof(VDINTERFACEIO), &mVDImageIfaces);
             AssertRCReturnVoidStmt(vrc, mRC = E_FAIL);
         }
+
+        /* The target backend picks the compression level up from the config
+         * interface. It shadows the one of the medium, so forward the rest. */
+        if (!mCompressionLevel.isEmpty())
+        {
+            mVDIfConfig.pfnAreKeysValid = i_vdExportConfigAreKeysValid;
+            mVDIfConfig.pfnQuerySize    = i_vdExportConfigQuerySize;
+            mVDIfConfig.pfnQuery        = i_vdExportConfigQuery;
+            mVDIfConfig.pfnQueryBytes   = NULL;
+            int vrc = VDInterfaceAdd(&mVDIfConfig.Core, "Medium::vdInterfaceConfigExport",
+                                     VDINTERFACETYPE_CONFIG, this,
+                                     sizeof(VDINTERFACECONFIG), &mVDImageIfaces);
+            AssertRCReturnVoidStmt(vrc, mRC = E_FAIL);
+        }
     }
 
     ~ExportTask()
@@ -606,7 +622,9 @@ public:
     Utf8Str mFilename;
     ComObjPtr<MediumFormat> mFormat;
     MediumVariant_T mVariant;
+    Utf8Str mCompressionLevel;
     PVDINTERFACE mVDImageIfaces;
+    VDINTERFACECONFIG mVDIfConfig;
     SecretKeyStore *m_pSecretKeyStore;
 
 private:
@@ -5727,6 +5745,8 @@ HRESULT Medium::i_fixParentUuidOfChildren(MediumLockList *pChildrenToReparent)
  * @param aFormat               Medium format for creating @a aFilename.
  * @param aVariant              Which exact image format variant to use
  *                              for the destination image.
+ * @param aCompressionLevel     Compression level for formats which compress
+ *                              the data, empty for the backend default.
  * @param pKeyStore             The optional key store for decrypting the data
  *                              for encrypted media during the export.
  * @param aVDImageIOCallbacks   Pointer to the callback table for a
@@ -5739,6 +5759,7 @@ HRESULT Medium::i_fixParentUuidOfChildren(MediumLockList *pChildrenToReparent)
 HRESULT Medium::i_exportFile(const char *aFilename,
                              const ComObjPtr<MediumFormat> &aFormat,
                              MediumVariant_T aVariant,
+                             const Utf8Str &aCompressionLevel,
                              SecretKeyStore *pKeyStore,
                              PVDINTERFACEIO aVDImageIOIf, void *aVDImageIOUser,
                              const ComObjPtr<Progress> &aProgress)
@@ -5781,7 +5802,7 @@ HRESULT Medium::i_exportFile(const char *aFilename,
 
         /* setup task object to carry out the operation asynchronously */
         pTask = new Medium::ExportTask(this, aProgress, aFilename, aFormat,
-                                       aVariant, pKeyStore, aVDImageIOIf,
+                                       aVariant, aCompressionLevel, pKeyStore, aVDImageIOIf,
                                        aVDImageIOUser, pSourceMediumLockList);
         rc = pTask->rc();
         AssertComRC(rc);
@@ -7218,6 +7239,57 @@ DECLCALLBACK(int) Medium::i_vdConfigQuery(void *pvUser,
     return VINF_SUCCESS;
 }
 
+/* static */
+DECLCALLBACK(bool) Medium::i_vdExportConfigAreKeysValid(void *pvUser,
+                                                        const char *pszzValid)
+{
+    Medium::ExportTask *pTask = static_cast<Medium::ExportTask *>(pvUser);
+    AssertReturn(pTask != NULL, false);
+
+    return i_vdConfigAreKeysValid(pTask->mMedium, pszzValid);
+}
+
+/* static */
+DECLCALLBACK(int) Medium::i_vdExportConfigQuerySize(void *pvUser,
+                                                    const char *pszName,
+                                                    size_t *pcbValue)
+{
+    AssertReturn(VALID_PTR(pcbValue), VERR_INVALID_POINTER);
+
+    Medium::ExportTask *pTask = static_cast<Medium::ExportTask *>(pvUser);
+    AssertReturn(pTask != NULL, VERR_GENERAL_FAILURE);
+
+    if (strcmp(pszName, "CompressionLevel"))
+        return i_vdConfigQuerySize(pTask->mMedium, pszName, pcbValue);
+
+    *pcbValue = pTask->mCompressionLevel.length() + 1 /* include terminator */;
+
+    return VINF_SUCCESS;
+}
+
+/* static */
+DECLCALLBACK(int) Medium::i_vdExportConfigQuery(void *pvUser,
+                                                const char *pszName,
+                                                char *pszValue,
+                                                size_t cchValue)
+{
+    AssertReturn(VALID_PTR(pszValue), VERR_INVALID_POINTER);
+
+    Medium::ExportTask *pTask = static_cast<Medium::ExportTask *>(pvUser);
+    AssertReturn(pTask != NULL, VERR_GENERAL_FAILURE);
+
+    if (strcmp(pszName, "CompressionLevel"))
+        return i_vdConfigQuery(pTask->mMedium, pszName, pszValue, cchValue);
+
+    const Utf8Str &value = pTask->mCompressionLevel;
+    if (value.length() >= cchValue)
+        return VERR_CFGM_NOT_ENOUGH_SPACE;
+
+    memcpy(pszValue, value.c_str(), value.length() + 1);
+
+    return VINF_SUCCESS;
+}
+
 DECLCALLBACK(int) Medium::i_vdTcpSocketCreate(uint32_t fFlags, PVDSOCKET pSock)
 {
     PVDSOCKETINT pSocketInt = NULL;
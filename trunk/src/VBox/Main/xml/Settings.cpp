@@ -2607,7 +2607,9 @@ bool Cpu::operator==(const Cpu &c) const
  */
 BandwidthGroup::BandwidthGroup() :
     cMaxBytesPerSec(0),
-    enmType(BandwidthGroupType_Null)
+    enmType(BandwidthGroupType_Null),
+    cCeilBytesPerSec(0),
+    cbBurst(0)
 {
 }
 
@@ -2621,7 +2623,10 @@ bool BandwidthGroup::operator==(const BandwidthGroup &i) const
     return (this == &i)
         || (   strName      == i.strName
             && cMaxBytesPerSec == i.cMaxBytesPerSec
-            && enmType      == i.enmType);
+            && enmType      == i.enmType
+            && strParent    == i.strParent
+            && cCeilBytesPerSec == i.cCeilBytesPerSec
+            && cbBurst      == i.cbBurst);
 }
 
 /**
@@ -4367,6 +4372,9 @@ void MachineConfigFile::readHardware(const xml::ElementNode &elmHardware,
                         pelmBandwidthGroup->getAttributeValue("maxMbPerSec", gr.cMaxBytesPerSec);
                         gr.cMaxBytesPerSec *= _1M;
                     }
+                    pelmBandwidthGroup->getAttributeValue("parent", gr.strParent);
+                    pelmBandwidthGroup->getAttributeValue("ceilBytesPerSec", gr.cCeilBytesPerSec);
+                    pelmBandwidthGroup->getAttributeValue("burstBytes", gr.cbBurst);
                     hw.ioSettings.llBandwidthGroups.push_back(gr);
                 }
             }
@@ -6036,6 +6044,15 @@ void MachineConfigFile::buildHardwareXML(xml::ElementNode &elmParent,
                     pelmThis->setAttribute("maxBytesPerSec", gr.cMaxBytesPerSec);
                 else
                     pelmThis->setAttribute("maxMbPerSec", gr.cMaxBytesPerSec / _1M);
+                if (m->sv >= SettingsVersion_v1_16)
+                {
+                    if (gr.strParent.isNotEmpty())
+                        pelmThis->setAttribute("parent", gr.strParent);
+                    if (gr.cCeilBytesPerSec)
+                        pelmThis->setAttribute("ceilBytesPerSec", gr.cCeilBytesPerSec);
+                    if (gr.cbBurst)
+                        pelmThis->setAttribute("burstBytes", gr.cbBurst);
+                }
             }
         }
     }
@@ -6797,7 +6814,8 @@ void MachineConfigFile::bumpSettingsVersionIfNeeded()
     if (m->sv < SettingsVersion_v1_16)
     {
         // VirtualBox 5.1 adds a NVMe storage controller, paravirt debug
-        // options, cpu profile, APIC settings (CPU capability and BIOS).
+        // options, cpu profile, APIC settings (CPU capability and BIOS)
+        // and nested network bandwidth groups.
 
         if (   hardwareMachine.strParavirtDebug.isNotEmpty()
             || (!hardwareMachine.strCpuProfile.equals("host") && hardwareMachine.strCpuProfile.isNotEmpty())
@@ -6821,6 +6839,20 @@ void MachineConfigFile::bumpSettingsVersionIfNeeded()
                 return;
             }
         }
+
+        for (BandwidthGroupList::const_iterator it = hardwareMachine.ioSettings.llBandwidthGroups.begin();
+             it != hardwareMachine.ioSettings.llBandwidthGroups.end();
+             ++it)
+        {
+            const BandwidthGroup &gr = *it;
+            if (   gr.strParent.isNotEmpty()
+                || gr.cCeilBytesPerSec
+                || gr.cbBurst)
+            {
+                m->sv = SettingsVersion_v1_16;
+                return;
+            }
+        }
     }
 
     if (m->sv < SettingsVersion_v1_15)
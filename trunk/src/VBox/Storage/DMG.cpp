@@ -29,8 +29,14 @@
 #include <iprt/alloca.h>
 #include <iprt/assert.h>
 #include <iprt/base64.h>
+#include <iprt/critsect.h>
 #include <iprt/ctype.h>
+#include <iprt/list.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/req.h>
+#include <iprt/semaphore.h>
+#include <iprt/sg.h>
 #include <iprt/string.h>
 #include <iprt/zip.h>
 #include <iprt/formats/xar.h>
@@ -41,6 +47,15 @@
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
 *********************************************************************************************************************************/
+/** Number of decompressed chunks kept in the cache. */
+#define DMG_CHUNK_CACHE_ENTRIES     16
+/** Number of compressed chunks decompressed ahead of a sequential reader. */
+#define DMG_CHUNK_READ_AHEAD        4
+/** Maximum number of decompression worker threads. */
+#define DMG_DECOMP_THREADS_MAX      4
+/** Maximum number of compressed bytes read in one go. */
+#define DMG_COMP_READ_SIZE_MAX      _2M
+
 #if 0
 /** @def VBOX_WITH_DIRECT_XAR_ACCESS
  * When defined, we will use RTVfs to access the XAR file instead of going
@@ -217,12 +232,20 @@ AssertCompileSize(DMGBLKXDESC, 40);
 typedef DMGBLKXDESC *PDMGBLKXDESC;
 typedef const DMGBLKXDESC *PCDMGBLKXDESC;
 
+/** Zero filled data type. */
+#define DMGBLKXDESC_TYPE_ZERO       0
 /** Raw image data type. */
 #define DMGBLKXDESC_TYPE_RAW        1
 /** Ignore type. */
 #define DMGBLKXDESC_TYPE_IGNORE     2
+/** Compressed with Apple Data Compression (ADC) type. */
+#define DMGBLKXDESC_TYPE_ADC        UINT32_C(0x80000004)
 /** Compressed with zlib type. */
 #define DMGBLKXDESC_TYPE_ZLIB       UINT32_C(0x80000005)
+/** Compressed with bzip2 type. */
+#define DMGBLKXDESC_TYPE_BZLIB      UINT32_C(0x80000006)
+/** Compressed with LZFSE type. */
+#define DMGBLKXDESC_TYPE_LZFSE      UINT32_C(0x80000007)
 /** Comment type. */
 #define DMGBLKXDESC_TYPE_COMMENT    UINT32_C(0x7ffffffe)
 /** Terminator type. */
@@ -280,10 +303,12 @@ typedef enum DMGEXTENTTYPE
     DMGEXTENTTYPE_NULL = 0,
     /** Raw image data. */
     DMGEXTENTTYPE_RAW,
-    /** Zero extent, reads return 0 and writes have no effect. */
-    DMGEXTENTTYPE_ZERO,
     /** Compressed extent - compression method ZLIB. */
     DMGEXTENTTYPE_COMP_ZLIB,
+    /** Compressed extent - compression method ADC. */
+    DMGEXTENTTYPE_COMP_ADC,
+    /** Compressed extent - compression method LZFSE. */
+    DMGEXTENTTYPE_COMP_LZFSE,
     /** 32bit hack. */
     DMGEXTENTTYPE_32BIT_HACK = 0x7fffffff
 } DMGEXTENTTYPE, *PDMGEXTENTTYPE;
@@ -303,10 +328,93 @@ typedef struct DMGEXTENT
     uint64_t             offFileStart;
     /** Number of bytes for the extent data in the file. */
     uint64_t             cbFile;
+    /** Index of the first extent of the group of compressed extents read
+     * together, all requests for any of them read the same file range so
+     * they share a pending metadata transfer instead of overlapping it. */
+    unsigned             idxExtentRead;
 } DMGEXTENT;
 /** Pointer to an DMG extent. */
 typedef DMGEXTENT *PDMGEXTENT;
 
+/**
+ * State of a decompressed chunk cache entry.
+ */
+typedef enum DMGCHUNKSTATE
+{
+    /** The entry is unused. */
+    DMGCHUNKSTATE_FREE = 0,
+    /** The extent is being decompressed into the entry. */
+    DMGCHUNKSTATE_LOADING,
+    /** The entry holds the decompressed data of the extent. */
+    DMGCHUNKSTATE_VALID,
+    /** 32bit hack. */
+    DMGCHUNKSTATE_32BIT_HACK = 0x7fffffff
+} DMGCHUNKSTATE;
+
+/**
+ * Compressed data of one or more consecutive extents, shared by the chunk
+ * cache entries decompressing them.
+ */
+typedef struct DMGCOMPBUF
+{
+    /** Reference counter. */
+    volatile uint32_t    cRefs;
+    /** Offset in the image file the data starts at. */
+    uint64_t             offFile;
+    /** Number of bytes of compressed data. */
+    size_t               cbData;
+    /** The compressed data - variable size. */
+    uint8_t              abData[1];
+} DMGCOMPBUF;
+/** Pointer to a compressed data buffer. */
+typedef DMGCOMPBUF *PDMGCOMPBUF;
+
+/**
+ * Asynchronous read waiting for a chunk which is being decompressed.
+ */
+typedef struct DMGCHUNKWAITER
+{
+    /** Node for the list of waiters of the chunk. */
+    RTLISTNODE           NdWaiters;
+    /** The I/O context to complete. */
+    PVDIOCTX             pIoCtx;
+    /** Offset into the decompressed chunk to start copying from. */
+    size_t               offChunk;
+    /** Number of bytes to copy. */
+    size_t               cbRead;
+    /** Number of segments in the array. */
+    unsigned             cSegs;
+    /** The I/O context segments to copy the data to - variable size. */
+    RTSGSEG              aSegs[1];
+} DMGCHUNKWAITER;
+/** Pointer to a chunk waiter. */
+typedef DMGCHUNKWAITER *PDMGCHUNKWAITER;
+
+/**
+ * Decompressed chunk cache entry.
+ */
+typedef struct DMGCHUNK
+{
+    /** The extent whose data is (going to be) held by this entry. */
+    PDMGEXTENT           pExtent;
+    /** State of the entry. */
+    DMGCHUNKSTATE        enmState;
+    /** Flag whether the entry was loaded by the read-ahead and not read yet. */
+    bool                 fReadAhead;
+    /** The compressed data while the entry is in the loading state. */
+    PDMGCOMPBUF          pCompBuf;
+    /** The buffer holding the decompressed data. */
+    uint8_t             *pbData;
+    /** Size of the buffer. */
+    size_t               cbAlloc;
+    /** Access stamp for the LRU replacement. */
+    uint64_t             uLastUse;
+    /** List of asynchronous reads waiting for the decompression to finish. */
+    RTLISTANCHOR         ListWaiters;
+} DMGCHUNK;
+/** Pointer to a decompressed chunk cache entry. */
+typedef DMGCHUNK *PDMGCHUNK;
+
 /**
  * VirtualBox Apple Disk Image (DMG) interpreter instance data.
  */
@@ -364,12 +472,32 @@ typedef struct DMGIMAGE
     /** Index of the last accessed extent. */
     unsigned            idxExtentLast;
 
-    /** Extent which owns the data in the buffer. */
-    PDMGEXTENT          pExtentDecomp;
-    /** Buffer holding the decompressed data for a extent. */
-    void               *pvDecompExtent;
-    /** Size of the buffer. */
-    size_t              cbDecompExtent;
+    /** Number of compressed extents in the image. */
+    unsigned            cExtentsComp;
+    /** Critical section protecting the chunk cache, the decompression
+     * workers access it concurrently with the I/O thread. */
+    RTCRITSECT          CritSectChunks;
+    /** Event signalled whenever a chunk finished loading. */
+    RTSEMEVENTMULTI     hEvtChunkLoaded;
+    /** Worker thread pool decompressing chunks, NIL_RTREQPOOL if
+     * everything is decompressed on the I/O thread. */
+    RTREQPOOL           hReqPoolDecomp;
+    /** The decompressed chunk cache. */
+    DMGCHUNK            aChunks[DMG_CHUNK_CACHE_ENTRIES];
+    /** Monotonic access counter for the chunk cache LRU. */
+    uint64_t            uChunkUse;
+    /** Number of chunks currently being decompressed. */
+    unsigned            cChunksLoading;
+    /** Offset following the last read, for sequential access detection. */
+    uint64_t            offReadNext;
+    /** Number of chunk cache hits. */
+    uint64_t            cChunkHits;
+    /** Number of chunk cache misses. */
+    uint64_t            cChunkMisses;
+    /** Number of chunks decompressed ahead of the reader. */
+    uint64_t            cChunkReadAhead;
+    /** Number of read-ahead chunks which were read before being evicted. */
+    uint64_t            cChunkReadAheadHits;
 } DMGIMAGE;
 /** Pointer to an instance of the DMG Image Interpreter. */
 typedef DMGIMAGE *PDMGIMAGE;
@@ -383,12 +511,10 @@ typedef DMGIMAGE *PDMGIMAGE;
 /** State for the input callout of the inflate reader. */
 typedef struct DMGINFLATESTATE
 {
-    /* Image this operation relates to. */
-    PDMGIMAGE pImage;
-    /* Total size of the data to read. */
+    /* The compressed data. */
+    const uint8_t *pbSrc;
+    /* Total size of the compressed data. */
     size_t    cbSize;
-    /* Offset in the file to read. */
-    uint64_t  uFileOffset;
     /* Current read position. */
     ssize_t   iOffset;
 } DMGINFLATESTATE;
@@ -415,6 +541,24 @@ typedef struct DMGINFLATESTATE
         } \
     } while (0)
 
+/** Upper limit for the compressed and decompressed size of a chunk, protects
+ * against overly large allocations with corrupted images. */
+#define DMG_CHUNK_SIZE_MAX          _64M
+
+/** @name LZFSE block magics (little endian).
+ * @{ */
+/** End of stream. */
+#define DMG_LZFSE_MAGIC_EOS         UINT32_C(0x24787662) /* bvx$ */
+/** Uncompressed block. */
+#define DMG_LZFSE_MAGIC_RAW         UINT32_C(0x2d787662) /* bvx- */
+/** LZFSE compressed block, uncompressed tables. */
+#define DMG_LZFSE_MAGIC_V1          UINT32_C(0x31787662) /* bvx1 */
+/** LZFSE compressed block, compressed tables. */
+#define DMG_LZFSE_MAGIC_V2          UINT32_C(0x32787662) /* bvx2 */
+/** LZVN compressed block. */
+#define DMG_LZFSE_MAGIC_LZVN        UINT32_C(0x6e787662) /* bvxn */
+/** @} */
+
 
 /*********************************************************************************************************************************
 *   Static Variables                                                                                                             *
@@ -508,7 +652,7 @@ static int dmgWrapFileGetSize(PDMGIMAGE pThis, uint64_t *pcbFile)
 
 
 
-static DECLCALLBACK(int) dmgFileInflateHelper(void *pvUser, void *pvBuf, size_t cbBuf, size_t *pcbBuf)
+static DECLCALLBACK(int) dmgInflateHelper(void *pvUser, void *pvBuf, size_t cbBuf, size_t *pcbBuf)
 {
     DMGINFLATESTATE *pInflateState = (DMGINFLATESTATE *)pvUser;
 
@@ -521,36 +665,29 @@ static DECLCALLBACK(int) dmgFileInflateHelper(void *pvUser, void *pvBuf, size_t
         pInflateState->iOffset = 0;
         return VINF_SUCCESS;
     }
-    cbBuf = RT_MIN(cbBuf, pInflateState->cbSize);
-    int rc = dmgWrapFileReadSync(pInflateState->pImage, pInflateState->uFileOffset, pvBuf, cbBuf);
-    if (RT_FAILURE(rc))
-        return rc;
-    pInflateState->uFileOffset += cbBuf;
+    cbBuf = RT_MIN(cbBuf, pInflateState->cbSize - (size_t)pInflateState->iOffset);
+    memcpy(pvBuf, pInflateState->pbSrc + pInflateState->iOffset, cbBuf);
     pInflateState->iOffset += cbBuf;
-    pInflateState->cbSize -= cbBuf;
     Assert(pcbBuf);
     *pcbBuf = cbBuf;
     return VINF_SUCCESS;
 }
 
 /**
- * Internal: read from a file and inflate the compressed data,
- * distinguishing between async and normal operation
+ * Internal: inflate zlib compressed data from memory.
  */
-DECLINLINE(int) dmgFileInflateSync(PDMGIMAGE pImage, uint64_t uOffset, size_t cbToRead,
-                                   void *pvBuf, size_t cbBuf)
+DECLINLINE(int) dmgInflate(const uint8_t *pbSrc, size_t cbSrc, void *pvBuf, size_t cbBuf)
 {
     int rc;
     PRTZIPDECOMP pZip = NULL;
     DMGINFLATESTATE InflateState;
     size_t cbActuallyRead;
 
-    InflateState.pImage      = pImage;
-    InflateState.cbSize      = cbToRead;
-    InflateState.uFileOffset = uOffset;
-    InflateState.iOffset     = -1;
+    InflateState.pbSrc   = pbSrc;
+    InflateState.cbSize  = cbSrc;
+    InflateState.iOffset = -1;
 
-    rc = RTZipDecompCreate(&pZip, &InflateState, dmgFileInflateHelper);
+    rc = RTZipDecompCreate(&pZip, &InflateState, dmgInflateHelper);
     if (RT_FAILURE(rc))
         return rc;
     rc = RTZipDecompress(pZip, pvBuf, cbBuf, &cbActuallyRead);
@@ -562,6 +699,731 @@ DECLINLINE(int) dmgFileInflateSync(PDMGIMAGE pImage, uint64_t uOffset, size_t cb
     return rc;
 }
 
+/**
+ * Decompresses an ADC (Apple Data Compression) compressed chunk.
+ *
+ * @returns VBox status code.
+ * @param   pbSrc       The compressed data.
+ * @param   cbSrc       Size of the compressed data.
+ * @param   pbDst       Where to store the decompressed data.
+ * @param   cbDst       Size of the decompressed chunk.
+ */
+static int dmgAdcDecompress(const uint8_t *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t cbDst)
+{
+    size_t offSrc = 0;
+    size_t offDst = 0;
+
+    while (   offSrc < cbSrc
+           && offDst < cbDst)
+    {
+        uint8_t bOp = pbSrc[offSrc];
+
+        if (bOp & 0x80)
+        {
+            /* Literal run: 1LLLLLLL */
+            size_t cbRun = (bOp & 0x7f) + 1;
+            if (   cbRun > cbSrc - offSrc - 1
+                || cbRun > cbDst - offDst)
+                return VERR_ZIP_CORRUPTED;
+            memcpy(&pbDst[offDst], &pbSrc[offSrc + 1], cbRun);
+            offSrc += cbRun + 1;
+            offDst += cbRun;
+        }
+        else
+        {
+            size_t cbMatch;
+            size_t offBack;
+
+            if (bOp & 0x40)
+            {
+                /* Three byte match: 01LLLLLL DDDDDDDD DDDDDDDD */
+                if (cbSrc - offSrc < 3)
+                    return VERR_ZIP_CORRUPTED;
+                cbMatch = (bOp & 0x3f) + 4;
+                offBack = ((size_t)pbSrc[offSrc + 1] << 8) | pbSrc[offSrc + 2];
+                offSrc += 3;
+            }
+            else
+            {
+                /* Two byte match: 00LLLLDD DDDDDDDD */
+                if (cbSrc - offSrc < 2)
+                    return VERR_ZIP_CORRUPTED;
+                cbMatch = ((bOp & 0x3f) >> 2) + 3;
+                offBack = ((size_t)(bOp & 0x3) << 8) | pbSrc[offSrc + 1];
+                offSrc += 2;
+            }
+
+            /* The distance is biased by one and the match may overlap the output. */
+            if (   offBack >= offDst
+                || cbMatch > cbDst - offDst)
+                return VERR_ZIP_CORRUPTED;
+            const uint8_t *pbMatch = &pbDst[offDst - offBack - 1];
+            for (size_t i = 0; i < cbMatch; i++)
+                pbDst[offDst + i] = pbMatch[i];
+            offDst += cbMatch;
+        }
+    }
+
+    return offDst == cbDst ? VINF_SUCCESS : VERR_ZIP_CORRUPTED;
+}
+
+/**
+ * Decompresses a LZVN compressed block of a LZFSE stream.
+ *
+ * @returns VBox status code.
+ * @param   pbSrc       The compressed block payload.
+ * @param   cbSrc       Size of the payload.
+ * @param   pbDst       The start of the decompressed stream, matches may
+ *                      reference data of previous blocks.
+ * @param   offDst      Where the block starts in the decompressed stream.
+ * @param   offDstEnd   Where the block ends in the decompressed stream.
+ */
+static int dmgLzvnDecompress(const uint8_t *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t offDst, size_t offDstEnd)
+{
+    size_t offSrc  = 0;
+    size_t offDist = 0; /* Match distance, reused by some opcodes. */
+
+    for (;;)
+    {
+        if (offSrc >= cbSrc)
+            return VERR_ZIP_CORRUPTED;
+
+        uint8_t const bOp = pbSrc[offSrc];
+        uint8_t const b1  = offSrc + 1 < cbSrc ? pbSrc[offSrc + 1] : 0;
+        uint8_t const b2  = offSrc + 2 < cbSrc ? pbSrc[offSrc + 2] : 0;
+        size_t cbOp;
+        size_t cbLit   = 0;
+        size_t cbMatch = 0;
+
+        if (bOp == 0x06)
+            break; /* End of stream. */
+        else if (bOp == 0x0e || bOp == 0x16)
+            cbOp = 1; /* Nop. */
+        else if (bOp >= 0xf0)
+        {
+            /* Match with previous distance: 1111MMMM or 11110000 MMMMMMMM */
+            cbOp    = bOp == 0xf0 ? 2 : 1;
+            cbMatch = bOp == 0xf0 ? (size_t)b1 + 16 : bOp & 0xf;
+        }
+        else if (bOp >= 0xe0)
+        {
+            /* Literal: 1110LLLL or 11100000 LLLLLLLL */
+            cbOp  = bOp == 0xe0 ? 2 : 1;
+            cbLit = bOp == 0xe0 ? (size_t)b1 + 16 : bOp & 0xf;
+        }
+        else if (bOp >= 0xa0 && bOp < 0xc0)
+        {
+            /* Medium distance: 101LLMMM DDDDDDMM DDDDDDDD */
+            uint16_t u16 = RT_MAKE_U16(b1, b2);
+            cbOp    = 3;
+            cbLit   = (bOp >> 3) & 0x3;
+            cbMatch = (((bOp & 0x7) << 2) | (u16 & 0x3)) + 3;
+            offDist = u16 >> 2;
+        }
+        else if (   (bOp >= 0x70 && bOp < 0x80)
+                 || (bOp < 0x40 && (bOp & 0x7) == 6))
+            return VERR_ZIP_CORRUPTED; /* Undefined opcode. */
+        else
+        {
+            /* LLMMM110 (previous distance), LLMMM111 (large distance) or LLMMMDDD DDDDDDDD (small distance) */
+            if ((bOp & 0x7) == 6)
+                cbOp = 1;
+            else if ((bOp & 0x7) == 7)
+            {
+                cbOp    = 3;
+                offDist = RT_MAKE_U16(b1, b2);
+            }
+            else
+            {
+                cbOp    = 2;
+                offDist = ((size_t)(bOp & 0x7) << 8) | b1;
+            }
+            cbLit   = bOp >> 6;
+            cbMatch = ((bOp >> 3) & 0x7) + 3;
+        }
+
+        /* Literals come first and follow the opcode directly. */
+        if (   cbOp + cbLit > cbSrc - offSrc
+            || cbLit > offDstEnd - offDst)
+            return VERR_ZIP_CORRUPTED;
+        memcpy(&pbDst[offDst], &pbSrc[offSrc + cbOp], cbLit);
+        offSrc += cbOp + cbLit;
+        offDst += cbLit;
+
+        if (cbMatch)
+        {
+            if (   !offDist
+                || offDist > offDst
+                || cbMatch > offDstEnd - offDst)
+                return VERR_ZIP_CORRUPTED;
+            for (size_t i = 0; i < cbMatch; i++, offDst++)
+                pbDst[offDst] = pbDst[offDst - offDist];
+        }
+    }
+
+    return offDst == offDstEnd ? VINF_SUCCESS : VERR_ZIP_CORRUPTED;
+}
+
+/**
+ * Decompresses a LZFSE compressed chunk.
+ *
+ * Only uncompressed and LZVN blocks are supported, blocks using the FSE
+ * entropy coder are rejected.
+ *
+ * @returns VBox status code.
+ * @param   pbSrc       The compressed data.
+ * @param   cbSrc       Size of the compressed data.
+ * @param   pbDst       Where to store the decompressed data.
+ * @param   cbDst       Size of the decompressed chunk.
+ */
+static int dmgLzfseDecompress(const uint8_t *pbSrc, size_t cbSrc, uint8_t *pbDst, size_t cbDst)
+{
+    size_t offSrc = 0;
+    size_t offDst = 0;
+
+    for (;;)
+    {
+        if (cbSrc - offSrc < sizeof(uint32_t))
+            return VERR_ZIP_CORRUPTED;
+
+        uint32_t u32Magic = RT_LE2H_U32(*(const uint32_t *)&pbSrc[offSrc]);
+        if (u32Magic == DMG_LZFSE_MAGIC_EOS)
+            break;
+        else if (u32Magic == DMG_LZFSE_MAGIC_RAW)
+        {
+            if (cbSrc - offSrc < 2 * sizeof(uint32_t))
+                return VERR_ZIP_CORRUPTED;
+            uint32_t cbRaw = RT_LE2H_U32(*(const uint32_t *)&pbSrc[offSrc + 4]);
+            if (   cbRaw > cbSrc - offSrc - 2 * sizeof(uint32_t)
+                || cbRaw > cbDst - offDst)
+                return VERR_ZIP_CORRUPTED;
+            memcpy(&pbDst[offDst], &pbSrc[offSrc + 2 * sizeof(uint32_t)], cbRaw);
+            offSrc += 2 * sizeof(uint32_t) + cbRaw;
+            offDst += cbRaw;
+        }
+        else if (u32Magic == DMG_LZFSE_MAGIC_LZVN)
+        {
+            if (cbSrc - offSrc < 3 * sizeof(uint32_t))
+                return VERR_ZIP_CORRUPTED;
+            uint32_t cbRaw     = RT_LE2H_U32(*(const uint32_t *)&pbSrc[offSrc + 4]);
+            uint32_t cbPayload = RT_LE2H_U32(*(const uint32_t *)&pbSrc[offSrc + 8]);
+            if (   cbPayload > cbSrc - offSrc - 3 * sizeof(uint32_t)
+                || cbRaw > cbDst - offDst)
+                return VERR_ZIP_CORRUPTED;
+            int rc = dmgLzvnDecompress(&pbSrc[offSrc + 3 * sizeof(uint32_t)], cbPayload,
+                                       pbDst, offDst, offDst + cbRaw);
+            if (RT_FAILURE(rc))
+                return rc;
+            offSrc += 3 * sizeof(uint32_t) + cbPayload;
+            offDst += cbRaw;
+        }
+        else if (   u32Magic == DMG_LZFSE_MAGIC_V1
+                 || u32Magic == DMG_LZFSE_MAGIC_V2)
+        {
+            LogRelMax(10, ("DMG: LZFSE blocks using the FSE entropy coder are not supported\n"));
+            return VERR_NOT_SUPPORTED;
+        }
+        else
+            return VERR_ZIP_CORRUPTED;
+    }
+
+    return offDst == cbDst ? VINF_SUCCESS : VERR_ZIP_CORRUPTED;
+}
+
+/**
+ * Returns whether the given extent holds compressed data.
+ */
+DECLINLINE(bool) dmgExtentIsCompressed(PDMGEXTENT pExtent)
+{
+    return    pExtent->enmType == DMGEXTENTTYPE_COMP_ZLIB
+           || pExtent->enmType == DMGEXTENTTYPE_COMP_ADC
+           || pExtent->enmType == DMGEXTENTTYPE_COMP_LZFSE;
+}
+
+/**
+ * Decompresses the data of the given compressed extent.
+ *
+ * @returns VBox status code.
+ * @param   pExtent     The compressed extent.
+ * @param   pbSrc       The compressed data of the extent.
+ * @param   pbBuf       Where to store the decompressed data, must be large
+ *                      enough to hold the whole extent.
+ *
+ * @note Runs on the I/O thread and on the decompression workers, must not
+ *       touch the image file or any mutable image state.
+ */
+static int dmgExtentDecompress(PDMGEXTENT pExtent, const uint8_t *pbSrc, uint8_t *pbBuf)
+{
+    size_t cbExtent = (size_t)DMG_BLOCK2BYTE(pExtent->cSectorsExtent);
+    size_t cbFile   = (size_t)pExtent->cbFile;
+    int rc;
+
+    switch (pExtent->enmType)
+    {
+        case DMGEXTENTTYPE_COMP_ZLIB:
+            rc = dmgInflate(pbSrc, cbFile, pbBuf, cbExtent);
+            break;
+        case DMGEXTENTTYPE_COMP_ADC:
+            rc = dmgAdcDecompress(pbSrc, cbFile, pbBuf, cbExtent);
+            break;
+        case DMGEXTENTTYPE_COMP_LZFSE:
+            rc = dmgLzfseDecompress(pbSrc, cbFile, pbBuf, cbExtent);
+            break;
+        default:
+            AssertMsgFailed(("Invalid extent type %d\n", pExtent->enmType));
+            rc = VERR_INTERNAL_ERROR;
+    }
+
+    return rc;
+}
+
+/**
+ * Releases a reference to a compressed data buffer, freeing it when the last
+ * one is gone.
+ *
+ * @param   pCompBuf    The buffer to release.
+ */
+static void dmgCompBufRelease(PDMGCOMPBUF pCompBuf)
+{
+    if (!ASMAtomicDecU32(&pCompBuf->cRefs))
+        RTMemFree(pCompBuf);
+}
+
+/**
+ * Looks up the chunk cache entry for the given extent.
+ *
+ * @returns Pointer to the entry or NULL if the extent is not in the cache.
+ * @param   pThis       DMG instance data.
+ * @param   pExtent     The extent to look for.
+ *
+ * @note Caller must own the chunk cache critical section.
+ */
+static PDMGCHUNK dmgChunkLookup(PDMGIMAGE pThis, PDMGEXTENT pExtent)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aChunks); i++)
+        if (   pThis->aChunks[i].enmState != DMGCHUNKSTATE_FREE
+            && pThis->aChunks[i].pExtent == pExtent)
+            return &pThis->aChunks[i];
+
+    return NULL;
+}
+
+/**
+ * Picks a chunk cache entry for the given extent and puts it into the loading
+ * state, evicting the least recently used entry if necessary.
+ *
+ * @returns Pointer to the entry or NULL if all entries are being loaded or
+ *          there is not enough memory.
+ * @param   pThis       DMG instance data.
+ * @param   pExtent     The extent to load.
+ * @param   pCompBuf    The buffer holding the compressed data of the extent,
+ *                      the entry keeps a reference until it is loaded.
+ *
+ * @note Caller must own the chunk cache critical section.
+ */
+static PDMGCHUNK dmgChunkAlloc(PDMGIMAGE pThis, PDMGEXTENT pExtent, PDMGCOMPBUF pCompBuf)
+{
+    PDMGCHUNK pChunk = NULL;
+
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aChunks); i++)
+    {
+        PDMGCHUNK pCur = &pThis->aChunks[i];
+
+        if (pCur->enmState == DMGCHUNKSTATE_FREE)
+        {
+            pChunk = pCur;
+            break;
+        }
+        else if (   pCur->enmState == DMGCHUNKSTATE_VALID
+                 && (   !pChunk
+                     || pCur->uLastUse < pChunk->uLastUse))
+            pChunk = pCur;
+    }
+
+    if (pChunk)
+    {
+        size_t cbExtent = (size_t)DMG_BLOCK2BYTE(pExtent->cSectorsExtent);
+
+        pChunk->enmState   = DMGCHUNKSTATE_FREE;
+        pChunk->pExtent    = NULL;
+        pChunk->fReadAhead = false;
+        if (pChunk->cbAlloc < cbExtent)
+        {
+            RTMemFree(pChunk->pbData);
+            pChunk->cbAlloc = 0;
+            pChunk->pbData = (uint8_t *)RTMemAlloc(cbExtent);
+            if (!pChunk->pbData)
+                return NULL;
+            pChunk->cbAlloc = cbExtent;
+        }
+
+        Assert(   pExtent->offFileStart >= pCompBuf->offFile
+               && pExtent->offFileStart + pExtent->cbFile <= pCompBuf->offFile + pCompBuf->cbData);
+        ASMAtomicIncU32(&pCompBuf->cRefs);
+        pChunk->pCompBuf = pCompBuf;
+        pChunk->pExtent  = pExtent;
+        pChunk->enmState = DMGCHUNKSTATE_LOADING;
+        pChunk->uLastUse = ++pThis->uChunkUse;
+        pThis->cChunksLoading++;
+    }
+
+    return pChunk;
+}
+
+/**
+ * Decompresses the extent of a chunk cache entry in the loading state and
+ * completes all asynchronous reads waiting for it.
+ *
+ * @returns VBox status code of the decompression.
+ * @param   pThis       DMG instance data.
+ * @param   pChunk      The chunk cache entry to load.
+ *
+ * @note Must be called without owning the chunk cache critical section.
+ */
+static int dmgChunkLoad(PDMGIMAGE pThis, PDMGCHUNK pChunk)
+{
+    PDMGCOMPBUF pCompBuf = pChunk->pCompBuf;
+    PDMGEXTENT  pExtent  = pChunk->pExtent;
+
+    pChunk->pCompBuf = NULL;
+    int rc = dmgExtentDecompress(pExtent, &pCompBuf->abData[pExtent->offFileStart - pCompBuf->offFile],
+                                 pChunk->pbData);
+    dmgCompBufRelease(pCompBuf);
+
+    /*
+     * Complete the waiters outside of the critical section, the entry can't
+     * be evicted while it is in the loading state.
+     */
+    RTCritSectEnter(&pThis->CritSectChunks);
+    while (!RTListIsEmpty(&pChunk->ListWaiters))
+    {
+        RTLISTANCHOR ListWaiters;
+        RTListInit(&ListWaiters);
+        RTListMove(&ListWaiters, &pChunk->ListWaiters);
+        RTCritSectLeave(&pThis->CritSectChunks);
+
+        PDMGCHUNKWAITER pWaiter, pWaiterNext;
+        RTListForEachSafe(&ListWaiters, pWaiter, pWaiterNext, DMGCHUNKWAITER, NdWaiters)
+        {
+            if (RT_SUCCESS(rc))
+            {
+                RTSGBUF SgBuf;
+                RTSgBufInit(&SgBuf, &pWaiter->aSegs[0], pWaiter->cSegs);
+                RTSgBufCopyFromBuf(&SgBuf, pChunk->pbData + pWaiter->offChunk, pWaiter->cbRead);
+            }
+            pThis->pIfIoXxx->pfnIoCtxCompleted(pThis->pIfIoXxx->Core.pvUser, pWaiter->pIoCtx,
+                                               rc, pWaiter->cbRead);
+            RTMemFree(pWaiter);
+        }
+
+        RTCritSectEnter(&pThis->CritSectChunks);
+    }
+
+    if (RT_SUCCESS(rc))
+        pChunk->enmState = DMGCHUNKSTATE_VALID;
+    else
+    {
+        LogRel(("DMG: Decompressing the chunk at offset %llu of '%s' failed with %Rrc\n",
+                pChunk->pExtent->offFileStart, pThis->pszFilename, rc));
+        pChunk->enmState = DMGCHUNKSTATE_FREE;
+        pChunk->pExtent  = NULL;
+    }
+    pThis->cChunksLoading--;
+    RTCritSectLeave(&pThis->CritSectChunks);
+
+    RTSemEventMultiSignal(pThis->hEvtChunkLoaded);
+    return rc;
+}
+
+/**
+ * Decompression worker thread callback.
+ *
+ * @param   pThis       DMG instance data.
+ * @param   pChunk      The chunk cache entry to load.
+ */
+static DECLCALLBACK(void) dmgChunkLoadWorker(PDMGIMAGE pThis, PDMGCHUNK pChunk)
+{
+    dmgChunkLoad(pThis, pChunk);
+}
+
+/**
+ * Hands a chunk cache entry in the loading state to the decompression workers.
+ *
+ * @returns true if a worker will load the entry, false if the caller has to.
+ * @param   pThis       DMG instance data.
+ * @param   pChunk      The chunk cache entry to load.
+ */
+static bool dmgChunkLoadAsync(PDMGIMAGE pThis, PDMGCHUNK pChunk)
+{
+    if (pThis->hReqPoolDecomp == NIL_RTREQPOOL)
+        return false;
+
+    int rc = RTReqPoolCallVoidNoWait(pThis->hReqPoolDecomp, (PFNRT)dmgChunkLoadWorker, 2, pThis, pChunk);
+    return RT_SUCCESS(rc);
+}
+
+/**
+ * Queues an asynchronous read on a chunk cache entry in the loading state.
+ *
+ * @returns VBox status code.
+ * @param   pThis       DMG instance data.
+ * @param   pChunk      The chunk cache entry being loaded.
+ * @param   pIoCtx      The I/O context to complete once the data is there.
+ * @param   offChunk    Offset into the chunk to start reading from.
+ * @param   cbRead      Number of bytes to read.
+ *
+ * @note Caller must own the chunk cache critical section.
+ */
+static int dmgChunkAddWaiter(PDMGIMAGE pThis, PDMGCHUNK pChunk, PVDIOCTX pIoCtx,
+                             size_t offChunk, size_t cbRead)
+{
+    unsigned cSegs = 0;
+
+    /* Get the number of segments first. */
+    vdIfIoIntIoCtxSegArrayCreate(pThis->pIfIoXxx, pIoCtx, NULL, &cSegs, cbRead);
+
+    PDMGCHUNKWAITER pWaiter = (PDMGCHUNKWAITER)RTMemAllocZ(RT_OFFSETOF(DMGCHUNKWAITER, aSegs[cSegs]));
+    if (!pWaiter)
+        return VERR_NO_MEMORY;
+
+    pWaiter->pIoCtx   = pIoCtx;
+    pWaiter->offChunk = offChunk;
+    pWaiter->cbRead   = cbRead;
+    pWaiter->cSegs    = cSegs;
+    size_t cbSegs = vdIfIoIntIoCtxSegArrayCreate(pThis->pIfIoXxx, pIoCtx, &pWaiter->aSegs[0],
+                                                 &pWaiter->cSegs, cbRead);
+    Assert(cbSegs == cbRead); NOREF(cbSegs);
+
+    RTListAppend(&pChunk->ListWaiters, &pWaiter->NdWaiters);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Hands the other extents of a compressed data read to the decompression
+ * workers for a sequential reader.
+ *
+ * @param   pThis       DMG instance data.
+ * @param   pCompBuf    The compressed data.
+ * @param   idxExtent   Index of the first extent covered by the data.
+ * @param   cExtents    Number of extents covered by the data.
+ * @param   pExtent     The extent currently read, it is loaded by the caller.
+ *
+ * @note Caller must own the chunk cache critical section.
+ */
+static void dmgChunkReadAhead(PDMGIMAGE pThis, PDMGCOMPBUF pCompBuf, unsigned idxExtent, unsigned cExtents,
+                              PDMGEXTENT pExtent)
+{
+    for (unsigned i = 0;
+            i < cExtents
+         && pThis->cChunksLoading <= DMG_CHUNK_READ_AHEAD;
+         i++)
+    {
+        PDMGEXTENT pExtentAhead = &pThis->paExtents[idxExtent + i];
+
+        if (   pExtentAhead == pExtent
+            || dmgChunkLookup(pThis, pExtentAhead))
+            continue;
+
+        PDMGCHUNK pChunk = dmgChunkAlloc(pThis, pExtentAhead, pCompBuf);
+        if (!pChunk)
+            break;
+
+        if (!dmgChunkLoadAsync(pThis, pChunk))
+        {
+            dmgCompBufRelease(pChunk->pCompBuf);
+            pChunk->pCompBuf = NULL;
+            pChunk->enmState = DMGCHUNKSTATE_FREE;
+            pChunk->pExtent  = NULL;
+            pThis->cChunksLoading--;
+            break;
+        }
+
+        pChunk->fReadAhead = true;
+        pThis->cChunkReadAhead++;
+    }
+}
+
+/**
+ * Reads the compressed data of the read group the given extent belongs to
+ * into a new buffer.
+ *
+ * The data is read on the calling thread which is the I/O thread for
+ * asynchronous requests. The decompression workers must not access the image
+ * file, the I/O interface can handle only one synchronous request at a time.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_NOT_ENOUGH_METADATA if the data is still being read, the
+ *          request is restarted when it is available.
+ * @param   pThis       DMG instance data.
+ * @param   pExtent     The compressed extent to read.
+ * @param   pIoCtx      The I/O context of the request.
+ * @param   ppCompBuf   Where to store the buffer holding the compressed data
+ *                      on success, the caller owns a reference to it.
+ * @param   pcExtents   Where to store the number of extents in the group.
+ *
+ * @note Caller must own the chunk cache critical section, it is left while
+ *       reading.
+ */
+static int dmgCompBufRead(PDMGIMAGE pThis, PDMGEXTENT pExtent, PVDIOCTX pIoCtx,
+                          PDMGCOMPBUF *ppCompBuf, unsigned *pcExtents)
+{
+    unsigned idxExtent = pExtent->idxExtentRead;
+    unsigned cExtents  = 1;
+
+    while (   idxExtent + cExtents < pThis->cExtents
+           && pThis->paExtents[idxExtent + cExtents].idxExtentRead == idxExtent)
+        cExtents++;
+
+    PDMGEXTENT pExtentFirst = &pThis->paExtents[idxExtent];
+    PDMGEXTENT pExtentLast  = &pThis->paExtents[idxExtent + cExtents - 1];
+    size_t cbRead = (size_t)(pExtentLast->offFileStart + pExtentLast->cbFile - pExtentFirst->offFileStart);
+
+    PDMGCOMPBUF pCompBuf = (PDMGCOMPBUF)RTMemAlloc(RT_OFFSETOF(DMGCOMPBUF, abData[cbRead]));
+    if (!pCompBuf)
+        return VERR_NO_MEMORY;
+
+    pCompBuf->cRefs   = 1;
+    pCompBuf->offFile = pExtentFirst->offFileStart;
+    pCompBuf->cbData  = cbRead;
+
+    RTCritSectLeave(&pThis->CritSectChunks);
+    int rc;
+    if (pThis->hDmgFileInXar == NIL_RTVFSFILE)
+    {
+        PVDMETAXFER pMetaXfer = NULL;
+
+        rc = vdIfIoIntFileReadMeta(pThis->pIfIoXxx, pThis->pStorage, pCompBuf->offFile, &pCompBuf->abData[0],
+                                   cbRead, pIoCtx, &pMetaXfer, NULL, NULL);
+        if (RT_SUCCESS(rc))
+            vdIfIoIntMetaXferRelease(pThis->pIfIoXxx, pMetaXfer);
+    }
+    else
+        rc = RTVfsFileReadAt(pThis->hDmgFileInXar, pCompBuf->offFile, &pCompBuf->abData[0], cbRead, NULL);
+    RTCritSectEnter(&pThis->CritSectChunks);
+
+    if (RT_SUCCESS(rc))
+    {
+        *ppCompBuf = pCompBuf;
+        *pcExtents = cExtents;
+    }
+    else
+        RTMemFree(pCompBuf);
+
+    return rc;
+}
+
+/**
+ * Reads data from a compressed extent through the chunk cache.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_IOCTX_HALT if the I/O context is completed by a
+ *          decompression worker later.
+ * @retval  VERR_VD_NOT_ENOUGH_METADATA if the compressed data is still being
+ *          read.
+ * @param   pThis       DMG instance data.
+ * @param   pExtent     The compressed extent to read from.
+ * @param   offExtent   Offset into the decompressed extent.
+ * @param   pIoCtx      The I/O context to read into.
+ * @param   cbToRead    Number of bytes to read.
+ * @param   fSequential Flag whether the read continues the previous one.
+ */
+static int dmgReadCompressed(PDMGIMAGE pThis, PDMGEXTENT pExtent, size_t offExtent,
+                             PVDIOCTX pIoCtx, size_t cbToRead, bool fSequential)
+{
+    bool fSync   = vdIfIoIntIoCtxIsSynchronous(pThis->pIfIoXxx, pIoCtx);
+    bool fLoaded = false;
+    PDMGCOMPBUF pCompBuf = NULL;
+    unsigned cExtentsRead = 0;
+    int rc = VINF_SUCCESS;
+
+    RTCritSectEnter(&pThis->CritSectChunks);
+    for (;;)
+    {
+        PDMGCHUNK pChunk = dmgChunkLookup(pThis, pExtent);
+
+        if (!pChunk)
+        {
+            /* Read the compressed data here, the workers only decompress it. */
+            if (!pCompBuf)
+            {
+                rc = dmgCompBufRead(pThis, pExtent, pIoCtx, &pCompBuf, &cExtentsRead);
+                if (RT_FAILURE(rc))
+                    break;
+                continue;
+            }
+
+            pChunk = dmgChunkAlloc(pThis, pExtent, pCompBuf);
+            if (pChunk)
+            {
+                pThis->cChunkMisses++;
+                fLoaded = true;
+
+                /* Synchronous requests decompress on this thread instead of idling. */
+                bool fLoadAsync = !fSync && dmgChunkLoadAsync(pThis, pChunk);
+
+                /* The rest of the group was read anyway, decompress it for a sequential reader. */
+                if (fSequential)
+                    dmgChunkReadAhead(pThis, pCompBuf, pExtent->idxExtentRead, cExtentsRead, pExtent);
+
+                if (!fLoadAsync)
+                {
+                    RTCritSectLeave(&pThis->CritSectChunks);
+                    rc = dmgChunkLoad(pThis, pChunk);
+                    RTCritSectEnter(&pThis->CritSectChunks);
+                    if (RT_FAILURE(rc))
+                        break;
+                    continue;
+                }
+            }
+            else if (!pThis->cChunksLoading)
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
+        }
+        else if (pChunk->enmState == DMGCHUNKSTATE_VALID)
+        {
+            if (!fLoaded)
+                pThis->cChunkHits++;
+            if (pChunk->fReadAhead)
+            {
+                pThis->cChunkReadAheadHits++;
+                pChunk->fReadAhead = false;
+            }
+            pChunk->uLastUse = ++pThis->uChunkUse;
+            vdIfIoIntIoCtxCopyTo(pThis->pIfIoXxx, pIoCtx, pChunk->pbData + offExtent, cbToRead);
+            break;
+        }
+
+        /* The chunk is being loaded by a worker, let it complete the request. */
+        if (   pChunk
+            && !fSync)
+        {
+            rc = dmgChunkAddWaiter(pThis, pChunk, pIoCtx, offExtent, cbToRead);
+            if (RT_SUCCESS(rc))
+            {
+                if (!fLoaded)
+                    pThis->cChunkHits++;
+                rc = VERR_VD_IOCTX_HALT;
+                break;
+            }
+            rc = VINF_SUCCESS;
+        }
+
+        /* Wait for the chunk or any other one to finish loading and try again. */
+        RTSemEventMultiReset(pThis->hEvtChunkLoaded);
+        RTCritSectLeave(&pThis->CritSectChunks);
+        RTSemEventMultiWait(pThis->hEvtChunkLoaded, RT_INDEFINITE_WAIT);
+        RTCritSectEnter(&pThis->CritSectChunks);
+    }
+
+    RTCritSectLeave(&pThis->CritSectChunks);
+
+    if (pCompBuf)
+        dmgCompBufRelease(pCompBuf);
+    return rc;
+}
+
 /**
  * Swaps endian.
  * @param   pUdif       The structure.
@@ -820,6 +1682,26 @@ static int dmgFreeImage(PDMGIMAGE pThis, bool fDelete)
      * not signalled as an error. After all nothing bad happens. */
     if (pThis)
     {
+        if (RTCritSectIsInitialized(&pThis->CritSectChunks))
+        {
+            /* Wait for the read ahead workers to finish before closing the
+             * file they read from and tearing down the cache. */
+            RTCritSectEnter(&pThis->CritSectChunks);
+            while (pThis->cChunksLoading)
+            {
+                RTSemEventMultiReset(pThis->hEvtChunkLoaded);
+                RTCritSectLeave(&pThis->CritSectChunks);
+                RTSemEventMultiWait(pThis->hEvtChunkLoaded, RT_INDEFINITE_WAIT);
+                RTCritSectEnter(&pThis->CritSectChunks);
+            }
+            RTCritSectLeave(&pThis->CritSectChunks);
+
+            if (pThis->cChunkMisses)
+                LogRel(("DMG: Chunk cache of '%s': %llu hits, %llu misses, %llu read ahead (%llu used)\n",
+                        pThis->pszFilename, pThis->cChunkHits, pThis->cChunkMisses,
+                        pThis->cChunkReadAhead, pThis->cChunkReadAheadHits));
+        }
+
         RTVfsFileRelease(pThis->hDmgFileInXar);
         pThis->hDmgFileInXar = NIL_RTVFSFILE;
 
@@ -859,11 +1741,40 @@ static int dmgFreeImage(PDMGIMAGE pThis, bool fDelete)
         if (fDelete && pThis->pszFilename)
             vdIfIoIntFileDelete(pThis->pIfIoXxx, pThis->pszFilename);
 
-        if (pThis->pvDecompExtent)
+        if (pThis->hReqPoolDecomp != NIL_RTREQPOOL)
         {
-            RTMemFree(pThis->pvDecompExtent);
-            pThis->pvDecompExtent = NULL;
-            pThis->cbDecompExtent = 0;
+            RTReqPoolRelease(pThis->hReqPoolDecomp);
+            pThis->hReqPoolDecomp = NIL_RTREQPOOL;
+        }
+
+        for (unsigned i = 0; i < RT_ELEMENTS(pThis->aChunks); i++)
+        {
+            Assert(RTListIsEmpty(&pThis->aChunks[i].ListWaiters));
+            if (pThis->aChunks[i].pbData)
+            {
+                RTMemFree(pThis->aChunks[i].pbData);
+                pThis->aChunks[i].pbData  = NULL;
+                pThis->aChunks[i].cbAlloc = 0;
+            }
+            pThis->aChunks[i].enmState = DMGCHUNKSTATE_FREE;
+            pThis->aChunks[i].pExtent  = NULL;
+        }
+
+        if (pThis->hEvtChunkLoaded != NIL_RTSEMEVENTMULTI)
+        {
+            RTSemEventMultiDestroy(pThis->hEvtChunkLoaded);
+            pThis->hEvtChunkLoaded = NIL_RTSEMEVENTMULTI;
+        }
+
+        if (RTCritSectIsInitialized(&pThis->CritSectChunks))
+            RTCritSectDelete(&pThis->CritSectChunks);
+
+        if (pThis->paExtents)
+        {
+            RTMemFree(pThis->paExtents);
+            pThis->paExtents   = NULL;
+            pThis->cExtents    = 0;
+            pThis->cExtentsMax = 0;
         }
     }
 
@@ -1306,30 +2217,51 @@ static int dmgExtentCreateFromBlkxDesc(PDMGIMAGE pThis, uint64_t uSectorPart, PD
 
     if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_RAW)
         enmExtentTypeNew = DMGEXTENTTYPE_RAW;
-    else if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_IGNORE)
-        enmExtentTypeNew = DMGEXTENTTYPE_ZERO;
     else if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_ZLIB)
         enmExtentTypeNew = DMGEXTENTTYPE_COMP_ZLIB;
+    else if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_ADC)
+        enmExtentTypeNew = DMGEXTENTTYPE_COMP_ADC;
+    else if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_BZLIB)
+        return vdIfError(pThis->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                         N_("DMG: Image '%s' contains bzip2 compressed chunks which are not supported"),
+                         pThis->pszFilename);
+    else if (pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_LZFSE)
+        enmExtentTypeNew = DMGEXTENTTYPE_COMP_LZFSE;
+    else if (   pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_ZERO
+             || pBlkxDesc->u32Type == DMGBLKXDESC_TYPE_IGNORE)
+    {
+        /* Zero and ignored ranges don't get an extent, reads of sectors not
+         * covered by any extent report the block as free. */
+        return VINF_SUCCESS;
+    }
     else
     {
-        AssertMsgFailed(("This method supports only raw or zero extents!\n"));
+        AssertMsgFailed(("This method supports only raw, zero or compressed extents!\n"));
         return VERR_NOT_SUPPORTED;
     }
 
-    /** @todo: Merge raw extents if possible to save memory. */
-#if 0
-    pExtentNew = pThis->pExtentLast;
+    if (   enmExtentTypeNew != DMGEXTENTTYPE_RAW
+        && (   pBlkxDesc->cbData > DMG_CHUNK_SIZE_MAX
+            || DMG_BLOCK2BYTE(pBlkxDesc->u64SectorCount) > DMG_CHUNK_SIZE_MAX))
+    {
+        DMG_PRINTF(("DMG: Compressed chunk with %llu sectors and %llu bytes exceeds the limit\n",
+                    pBlkxDesc->u64SectorCount, pBlkxDesc->cbData));
+        return VERR_VD_DMG_INVALID_HEADER;
+    }
+
+    /* Merge raw extents which are contiguous on the device and in the file to save memory. */
+    pExtentNew = pThis->cExtents ? &pThis->paExtents[pThis->cExtents - 1] : NULL;
     if (   pExtentNew
         && pExtentNew->enmType == enmExtentTypeNew
         && enmExtentTypeNew == DMGEXTENTTYPE_RAW
-        && pExtentNew->uSectorExtent + pExtentNew->cSectorsExtent == offDevice + pBlkxDesc->u64SectorStart * DMG_SECTOR_SIZE;
-        && pExtentNew->offFileStart + pExtentNew->cbExtent == pBlkxDesc->offData)
+        && pExtentNew->uSectorExtent + pExtentNew->cSectorsExtent == uSectorPart + pBlkxDesc->u64SectorStart
+        && pExtentNew->offFileStart + pExtentNew->cbFile == pBlkxDesc->offData)
     {
         /* Increase the last extent. */
-        pExtentNew->cbExtent += pBlkxDesc->cbData;
+        pExtentNew->cSectorsExtent += pBlkxDesc->u64SectorCount;
+        pExtentNew->cbFile         += pBlkxDesc->cbData;
     }
     else
-#endif
     {
         if (pThis->cExtentsMax == pThis->cExtents)
         {
@@ -1355,12 +2287,54 @@ static int dmgExtentCreateFromBlkxDesc(PDMGIMAGE pThis, uint64_t uSectorPart, PD
             pExtentNew->cSectorsExtent = pBlkxDesc->u64SectorCount;
             pExtentNew->offFileStart   = pBlkxDesc->offData;
             pExtentNew->cbFile         = pBlkxDesc->cbData;
+            pExtentNew->idxExtentRead  = pThis->cExtents - 1;
+
+            if (enmExtentTypeNew != DMGEXTENTTYPE_RAW)
+                pThis->cExtentsComp++;
         }
     }
 
     return rc;
 }
 
+/**
+ * Groups compressed extents which follow each other in the image file so
+ * they are read with a single request.
+ *
+ * @param   pThis          DMG instance data.
+ */
+static void dmgExtentsGroupReads(PDMGIMAGE pThis)
+{
+    unsigned idxExtent = 0;
+
+    while (idxExtent < pThis->cExtents)
+    {
+        PDMGEXTENT pExtentFirst = &pThis->paExtents[idxExtent];
+        uint64_t cbRead = pExtentFirst->cbFile;
+        unsigned cExtents = 1;
+
+        if (dmgExtentIsCompressed(pExtentFirst))
+        {
+            while (   idxExtent + cExtents < pThis->cExtents
+                   && cExtents < DMG_CHUNK_READ_AHEAD)
+            {
+                PDMGEXTENT pExtent = &pThis->paExtents[idxExtent + cExtents];
+
+                if (   !dmgExtentIsCompressed(pExtent)
+                    || pExtent->offFileStart != pExtentFirst->offFileStart + cbRead
+                    || cbRead + pExtent->cbFile > DMG_COMP_READ_SIZE_MAX)
+                    break;
+
+                pExtent->idxExtentRead = idxExtent;
+                cbRead += pExtent->cbFile;
+                cExtents++;
+            }
+        }
+
+        idxExtent += cExtents;
+    }
+}
+
 /**
  * Find the extent for the given sector number.
  */
@@ -1390,7 +2364,7 @@ static PDMGEXTENT dmgExtentGetFromOffset(PDMGIMAGE pThis, uint64_t uSector)
         else if (uSector >= pExtentCur->uSectorExtent + pExtentCur->cSectorsExtent)
         {
             /* Search right from the current extent. */
-            idxMin = idxCur;
+            idxMin = idxCur + 1;
         }
         else
         {
@@ -1408,6 +2382,36 @@ static PDMGEXTENT dmgExtentGetFromOffset(PDMGIMAGE pThis, uint64_t uSector)
     return pExtent;
 }
 
+/**
+ * Returns the number of sectors starting at the given one which are not
+ * covered by any extent.
+ *
+ * @returns Number of free sectors until the next extent or the end of the image.
+ * @param   pThis          DMG instance data.
+ * @param   uSector        The first sector, must not be covered by an extent.
+ */
+static uint64_t dmgExtentGetFreeSectors(PDMGIMAGE pThis, uint64_t uSector)
+{
+    unsigned idxMin = 0;
+    unsigned idxMax = pThis->cExtents;
+
+    /* Find the first extent starting after the given sector. */
+    while (idxMin < idxMax)
+    {
+        unsigned idxCur = idxMin + (idxMax - idxMin) / 2;
+
+        if (pThis->paExtents[idxCur].uSectorExtent <= uSector)
+            idxMin = idxCur + 1;
+        else
+            idxMax = idxCur;
+    }
+
+    if (idxMin < pThis->cExtents)
+        return pThis->paExtents[idxMin].uSectorExtent - uSector;
+
+    return pThis->Ftr.cSectors - uSector;
+}
+
 /**
  * Goes through the BLKX structure and creates the necessary extents.
  */
@@ -1422,9 +2426,13 @@ static int dmgBlkxParse(PDMGIMAGE pThis, PDMGBLKX pBlkx)
 
         switch (pBlkxDesc->u32Type)
         {
+            case DMGBLKXDESC_TYPE_ZERO:
             case DMGBLKXDESC_TYPE_RAW:
             case DMGBLKXDESC_TYPE_IGNORE:
+            case DMGBLKXDESC_TYPE_ADC:
             case DMGBLKXDESC_TYPE_ZLIB:
+            case DMGBLKXDESC_TYPE_BZLIB:
+            case DMGBLKXDESC_TYPE_LZFSE:
             {
                 rc = dmgExtentCreateFromBlkxDesc(pThis, pBlkx->cSectornumberFirst, pBlkxDesc);
                 break;
@@ -1560,8 +2568,13 @@ static DECLCALLBACK(int) dmgOpenImage(PDMGIMAGE pThis, unsigned uOpenFlags)
     pThis->pIfIoXxx = VDIfIoIntGet(pThis->pVDIfsImage);
     pThis->hDmgFileInXar = NIL_RTVFSFILE;
     pThis->hXarFss = NIL_RTVFSFSSTREAM;
+    pThis->hEvtChunkLoaded = NIL_RTSEMEVENTMULTI;
+    pThis->hReqPoolDecomp = NIL_RTREQPOOL;
     AssertPtrReturn(pThis->pIfIoXxx, VERR_INVALID_PARAMETER);
 
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aChunks); i++)
+        RTListInit(&pThis->aChunks[i].ListWaiters);
+
     int rc = vdIfIoIntFileOpen(pThis->pIfIoXxx, pThis->pszFilename,
                                VDOpenFlagsToFileOpenFlags(uOpenFlags, false /* fCreate */),
                                &pThis->pStorage);
@@ -1701,6 +2714,29 @@ static DECLCALLBACK(int) dmgOpenImage(PDMGIMAGE pThis, unsigned uOpenFlags)
     }
     RTMemFree(pszXml);
 
+    /*
+     * Decompress chunks on worker threads so the I/O thread stays free and
+     * sequential readers find the following chunks ready.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        dmgExtentsGroupReads(pThis);
+        rc = RTCritSectInit(&pThis->CritSectChunks);
+    }
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventMultiCreate(&pThis->hEvtChunkLoaded);
+    if (   RT_SUCCESS(rc)
+        && pThis->cExtentsComp)
+    {
+        uint32_t cThreads = RT_MAX(1, RT_MIN(RTMpGetOnlineCount(), DMG_DECOMP_THREADS_MAX));
+        int rc2 = RTReqPoolCreate(cThreads, 10 * RT_MS_1SEC, UINT32_MAX, 0, "DmgDecomp", &pThis->hReqPoolDecomp);
+        if (RT_FAILURE(rc2))
+        {
+            LogRel(("DMG: Failed to create the decompression thread pool (%Rrc), decompressing on the I/O thread\n", rc2));
+            pThis->hReqPoolDecomp = NIL_RTREQPOOL;
+        }
+    }
+
     if (RT_FAILURE(rc))
         dmgFreeImage(pThis, false);
     return rc;
@@ -1823,8 +2859,7 @@ static DECLCALLBACK(int) dmgOpen(const char *pszFilename, unsigned uOpenFlags,
      * simple backend and can expect the caller to be the only user and already
      * have validate what it passes thru to us.
      */
-    if (   !(uOpenFlags & VD_OPEN_FLAGS_READONLY)
-        || (uOpenFlags & VD_OPEN_FLAGS_ASYNC_IO))
+    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
     {
         LogFlowFunc(("Unsupported flag(s): %#x\n", uOpenFlags));
         return VERR_INVALID_PARAMETER;
@@ -1932,52 +2967,35 @@ static DECLCALLBACK(int) dmgRead(void *pBackendData, uint64_t uOffset,  size_t c
                 rc = dmgWrapFileReadUser(pThis, pExtent->offFileStart + DMG_BLOCK2BYTE(uExtentRel), pIoCtx, cbToRead);
                 break;
             }
-            case DMGEXTENTTYPE_ZERO:
-            {
-                vdIfIoIntIoCtxSet(pThis->pIfIoXxx, pIoCtx, 0, cbToRead);
-                break;
-            }
             case DMGEXTENTTYPE_COMP_ZLIB:
+            case DMGEXTENTTYPE_COMP_ADC:
+            case DMGEXTENTTYPE_COMP_LZFSE:
             {
-                if (pThis->pExtentDecomp != pExtent)
-                {
-                    if (DMG_BLOCK2BYTE(pExtent->cSectorsExtent) > pThis->cbDecompExtent)
-                    {
-                        if (RT_LIKELY(pThis->pvDecompExtent))
-                            RTMemFree(pThis->pvDecompExtent);
-
-                        pThis->pvDecompExtent = RTMemAllocZ(DMG_BLOCK2BYTE(pExtent->cSectorsExtent));
-                        if (!pThis->pvDecompExtent)
-                            rc = VERR_NO_MEMORY;
-                        else
-                            pThis->cbDecompExtent = DMG_BLOCK2BYTE(pExtent->cSectorsExtent);
-                    }
-
-                    if (RT_SUCCESS(rc))
-                    {
-                        rc = dmgFileInflateSync(pThis, pExtent->offFileStart, pExtent->cbFile,
-                                                pThis->pvDecompExtent,
-                                                RT_MIN(pThis->cbDecompExtent, DMG_BLOCK2BYTE(pExtent->cSectorsExtent)));
-                        if (RT_SUCCESS(rc))
-                            pThis->pExtentDecomp = pExtent;
-                    }
-                }
-
-                if (RT_SUCCESS(rc))
-                    vdIfIoIntIoCtxCopyTo(pThis->pIfIoXxx, pIoCtx,
-                                         (uint8_t *)pThis->pvDecompExtent + DMG_BLOCK2BYTE(uExtentRel),
-                                         cbToRead);
+                rc = dmgReadCompressed(pThis, pExtent, (size_t)DMG_BLOCK2BYTE(uExtentRel), pIoCtx, cbToRead,
+                                       uOffset == pThis->offReadNext);
                 break;
             }
             default:
                 AssertMsgFailed(("Invalid extent type\n"));
         }
 
-        if (RT_SUCCESS(rc))
+        if (   RT_SUCCESS(rc)
+            || rc == VERR_VD_IOCTX_HALT)
+        {
             *pcbActuallyRead = cbToRead;
+            pThis->offReadNext = uOffset + cbToRead;
+        }
     }
     else
-        rc = VERR_INVALID_PARAMETER;
+    {
+        /* Not covered by any extent, the range is either zeroed or ignored. */
+        uint64_t cSectorsFree = dmgExtentGetFreeSectors(pThis, DMG_BYTE2BLOCK(uOffset));
+
+        cbToRead = RT_MIN(cbToRead, DMG_BLOCK2BYTE(cSectorsFree));
+        *pcbActuallyRead = cbToRead;
+        pThis->offReadNext = uOffset + cbToRead;
+        rc = VERR_VD_BLOCK_FREE;
+    }
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2486,7 +3504,7 @@ const VBOXHDDBACKEND g_DmgBackend =
     /* cbSize */
     sizeof(VBOXHDDBACKEND),
     /* uBackendCaps */
-    VD_CAP_FILE | VD_CAP_VFS,
+    VD_CAP_FILE | VD_CAP_VFS | VD_CAP_ASYNC,
     /* paFileExtensions */
     s_aDmgFileExtensions,
     /* paConfigInfo */
@@ -108,10 +108,13 @@ typedef enum SCSIDEVTYPE
 /** Mask to extract the CmdQue bit out of the seventh byte of the INQUIRY response. */
 #define SCSI_INQUIRY_CMDQUE_MASK 0x02
 
-/** Maximum PDU payload size we can handle in one piece. Greater or equal than
- * s_iscsiConfigDefaultWriteSplit. */
+/** Maximum PDU payload size we can handle in one piece. */
 #define ISCSI_DATA_LENGTH_MAX _256K
 
+/** Maximum burst length we propose to the target, i.e. the maximum amount of
+ * data transferred in one sequence of Data-In or Data-Out PDUs. */
+#define ISCSI_BURST_LENGTH_MAX _1M
+
 /** Maximum PDU size we can handle in one piece. */
 #define ISCSI_RECV_PDU_BUFFER_SIZE (ISCSI_DATA_LENGTH_MAX + ISCSI_BHS_SIZE)
 
@@ -226,7 +229,10 @@ typedef enum ISCSIOPCODE
 #define ISCSI_SG_SEGMENTS_MAX 4
 
 /** Number of entries in the command table. */
-#define ISCSI_CMD_WAITING_ENTRIES 32
+#define ISCSI_CMD_WAITING_ENTRIES 128
+
+/** Maximum number of sessions opened to the same target. */
+#define ISCSI_SESSIONS_MAX 8
 
 /**
  * iSCSI login status class. */
@@ -428,6 +434,11 @@ typedef struct ISCSICMD
     void                 *pvUser;
     /** Command to execute. */
     ISCSICMDTYPE          enmCmdType;
+    /** Flag whether the completion is deferred until the Data-Out PDU
+     * currently on the wire was sent completely. */
+    bool                  fCompletionDeferred;
+    /** Status code for the deferred completion. */
+    int                   rcCmdDeferred;
     /** Command type dependent data. */
     union
     {
@@ -466,6 +477,12 @@ typedef struct ISCSIPDUTX
     size_t      cbSgLeft;
     /** The iSCSI command this PDU belongs to. */
     PISCSICMD   pIScsiCmd;
+    /** Flag whether the PDU can be sent regardless of the command window
+     * (immediate PDUs and Data-Out PDUs solicited by an R2T). */
+    bool        fImmediate;
+    /** Flag whether this is a Data-Out PDU. The data is referenced directly
+     * from the I2T segments of the command, so the PDU must not outlive it. */
+    bool        fDataOut;
     /** Number of segments in the request segments array. */
     unsigned    cISCSIReq;
     /** The request segments - variable in size. */
@@ -532,6 +549,14 @@ typedef struct ISCSIIMAGE
     uint32_t            cbSendDataLength;
     /** Negotiated maximum data length when receiving from target. */
     uint32_t            cbRecvDataLength;
+    /** Negotiated maximum amount of unsolicited data for a write command. */
+    uint32_t            cbFirstBurstLength;
+    /** Negotiated maximum amount of data the target may solicit with one R2T. */
+    uint32_t            cbMaxBurstLength;
+    /** Flag whether the target requires an R2T before any Data-Out PDU (InitialR2T). */
+    bool                fInitialR2T;
+    /** Flag whether write commands may carry immediate data (ImmediateData). */
+    bool                fImmediateData;
 
     /** Current state of the connection/session. */
     ISCSISTATE          state;
@@ -575,6 +600,8 @@ typedef struct ISCSIIMAGE
 
     /** Head of request queue */
     PISCSICMD           pScsiReqQueue;
+    /** Tail of request queue */
+    PISCSICMD           pScsiReqQueueTail;
     /** Mutex protecting the request queue from concurrent access. */
     RTSEMMUTEX          MutexReqQueue;
     /** I/O thread. */
@@ -610,6 +637,14 @@ typedef struct ISCSIIMAGE
 
     /** Release log counter. */
     unsigned            cLogRelErrors;
+
+    /** Number of sessions to the target, including this one. */
+    uint32_t            cSessions;
+    /** Array of the additional sessions (cSessions - 1 entries), only set for
+     * the first session which is the one handed to the VD layer. */
+    PISCSIIMAGE         *papSessions;
+    /** Number of asynchronous requests outstanding on this session. */
+    volatile uint32_t   cReqsActive;
 } ISCSIIMAGE;
 
 
@@ -626,8 +661,9 @@ static const char *s_iscsiConfigDefaultLUN = "0";
 /** Default timeout, 10 seconds. */
 static const char *s_iscsiConfigDefaultTimeout = "10000";
 
-/** Default write split value, less or equal to ISCSI_DATA_LENGTH_MAX. */
-static const char *s_iscsiConfigDefaultWriteSplit = "262144";
+/** Default write split value. Writes exceeding the negotiated first burst length
+ * are transferred with Data-Out PDUs if the I/O thread is used. */
+static const char *s_iscsiConfigDefaultWriteSplit = "1048576";
 
 /** Default host IP stack. */
 static const char *s_iscsiConfigDefaultHostIPStack = "1";
@@ -635,6 +671,9 @@ static const char *s_iscsiConfigDefaultHostIPStack = "1";
 /** Default dump malformed packet configuration value. */
 static const char *s_iscsiConfigDefaultDumpMalformedPackets = "0";
 
+/** Default number of sessions to the target. */
+static const char *s_iscsiConfigDefaultSessions = "1";
+
 /** Description of all accepted config parameters. */
 static const VDCONFIGINFO s_iscsiConfigInfo[] =
 {
@@ -651,6 +690,7 @@ static const VDCONFIGINFO s_iscsiConfigInfo[] =
     { "Timeout",              s_iscsiConfigDefaultTimeout,               VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { "HostIPStack",          s_iscsiConfigDefaultHostIPStack,           VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { "DumpMalformedPackets", s_iscsiConfigDefaultDumpMalformedPackets,  VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { "Sessions",             s_iscsiConfigDefaultSessions,              VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
     { NULL,                   NULL,                                      VDCFGVALUETYPE_INTEGER, 0 }
 };
 
@@ -670,6 +710,9 @@ static int iscsiRecvPDUProcess(PISCSIIMAGE pImage, PISCSIRES paRes, uint32_t cnR
 static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd);
 static int iscsiRecvPDUUpdateRequest(PISCSIIMAGE pImage, PISCSIRES paRes, uint32_t cnRes);
 static void iscsiCmdComplete(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, int rcCmd);
+static void iscsiCmdCompleteNotify(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, int rcCmd);
+static int iscsiFreeImage(PISCSIIMAGE pImage, bool fDelete);
+static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags);
 static int iscsiTextAddKeyValue(uint8_t *pbBuf, size_t cbBuf, size_t *pcbBufCurr, const char *pcszKey, const char *pcszValue, size_t cbValue);
 static int iscsiTextGetKeyValue(const uint8_t *pbBuf, size_t cbBuf, const char *pcszKey, const char **ppcszValue);
 static int iscsiStrToBinary(const char *pcszValue, uint8_t *pbValue, size_t *pcbValue);
@@ -1233,8 +1276,15 @@ static DECLCALLBACK(int) iscsiAttach(void *pvUser)
     bool fParameterNeg = true;;
     pImage->cbRecvDataLength = ISCSI_DATA_LENGTH_MAX;
     pImage->cbSendDataLength = RT_MIN(ISCSI_DATA_LENGTH_MAX, pImage->cbWriteSplit);
+    pImage->cbFirstBurstLength = ISCSI_DATA_LENGTH_MAX;
+    pImage->cbMaxBurstLength = ISCSI_BURST_LENGTH_MAX;
+    /* The defaults from RFC 3720 apply if the target doesn't answer. */
+    pImage->fInitialR2T = true;
+    pImage->fImmediateData = true;
     char szMaxDataLength[16];
     RTStrPrintf(szMaxDataLength, sizeof(szMaxDataLength), "%u", ISCSI_DATA_LENGTH_MAX);
+    char szMaxBurstLength[16];
+    RTStrPrintf(szMaxBurstLength, sizeof(szMaxBurstLength), "%u", ISCSI_BURST_LENGTH_MAX);
     ISCSIPARAMETER aParameterNeg[] =
     {
         { "HeaderDigest", "None", 0 },
@@ -1243,7 +1293,7 @@ static DECLCALLBACK(int) iscsiAttach(void *pvUser)
         { "InitialR2T", "No", 0 },
         { "ImmediateData", "Yes", 0 },
         { "MaxRecvDataSegmentLength", szMaxDataLength, 0 },
-        { "MaxBurstLength", szMaxDataLength, 0 },
+        { "MaxBurstLength", szMaxBurstLength, 0 },
         { "FirstBurstLength", szMaxDataLength, 0 },
         { "DefaultTime2Wait", "0", 0 },
         { "DefaultTime2Retain", "60", 0 },
@@ -2402,11 +2452,13 @@ static int iscsiSendPDUAsync(PISCSIIMAGE pImage)
          * If there is no PDU active, get the first one from the list.
          * Check that we are allowed to transfer the PDU by comparing the
          * command sequence number and the maximum sequence number allowed by the target.
+         * Immediate PDUs and solicited data are not subject to the command window.
          */
         if (!pImage->pIScsiPDUTxCur)
         {
             if (   !pImage->pIScsiPDUTxHead
-                || serial_number_greater(pImage->pIScsiPDUTxHead->CmdSN, pImage->MaxCmdSN))
+                || (   !pImage->pIScsiPDUTxHead->fImmediate
+                    && serial_number_greater(pImage->pIScsiPDUTxHead->CmdSN, pImage->MaxCmdSN)))
                 break;
 
             pImage->pIScsiPDUTxCur = pImage->pIScsiPDUTxHead;
@@ -2426,13 +2478,22 @@ static int iscsiSendPDUAsync(PISCSIIMAGE pImage)
             if (!pImage->pIScsiPDUTxCur->cbSgLeft)
             {
                 /* PDU completed, free it and place the command on the waiting for response list. */
-                if (pImage->pIScsiPDUTxCur->pIScsiCmd)
+                PISCSIPDUTX pIScsiPDUTx = pImage->pIScsiPDUTxCur;
+                PISCSICMD pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
+
+                pImage->pIScsiPDUTxCur = NULL;
+                if (pIScsiCmd && !pIScsiPDUTx->fDataOut)
                 {
                     LogFlow(("Sent complete PDU, placing on waiting list\n"));
-                    iscsiCmdInsert(pImage, pImage->pIScsiPDUTxCur->pIScsiCmd);
+                    iscsiCmdInsert(pImage, pIScsiCmd);
                 }
-                RTMemFree(pImage->pIScsiPDUTxCur);
-                pImage->pIScsiPDUTxCur = NULL;
+                else if (pIScsiCmd && pIScsiCmd->fCompletionDeferred)
+                {
+                    /* The target completed the command while the data was still on the wire. */
+                    LogFlow(("Sent last Data-Out PDU of completed command %#p\n", pIScsiCmd));
+                    iscsiCmdCompleteNotify(pImage, pIScsiCmd, pIScsiCmd->rcCmdDeferred);
+                }
+                RTMemFree(pIScsiPDUTx);
             }
         }
     } while (   RT_SUCCESS(rc)
@@ -2570,6 +2631,7 @@ static int iscsiRecvPDUProcess(PISCSIIMAGE pImage, PISCSIRES paRes, uint32_t cnR
                     pIScsiPDUTx->aISCSIReq[cnISCSIReq].cbSeg = sizeof(pIScsiPDUTx->aBHS);
                     cnISCSIReq++;
                     pIScsiPDUTx->cbSgLeft = sizeof(pIScsiPDUTx->aBHS);
+                    pIScsiPDUTx->fImmediate = true;
                     RTSgBufInit(&pIScsiPDUTx->SgBuf, pIScsiPDUTx->aISCSIReq, cnISCSIReq);
 
                     /*
@@ -2584,6 +2646,11 @@ static int iscsiRecvPDUProcess(PISCSIIMAGE pImage, PISCSIRES paRes, uint32_t cnR
                     if (!pImage->pIScsiPDUTxCur)
                         rc = iscsiSendPDUAsync(pImage);
                 }
+                else if (!pImage->pIScsiPDUTxCur)
+                {
+                    /* The target might have opened the command window, send waiting PDUs. */
+                    rc = iscsiSendPDUAsync(pImage);
+                }
             }
         } while (0);
     }
@@ -2674,8 +2741,15 @@ static int iscsiValidatePDU(PISCSIRES paRes, uint32_t cnRes)
                 ||  (RT_N2H_U32(pcrgResBHS[4]) != ISCSI_TASK_TAG_RSVD))
                 return VERR_PARSE_ERROR;
             break;
-        case ISCSIOP_SCSI_TASKMGMT_RES:
         case ISCSIOP_R2T:
+            /* R2Ts must have the final bit set, must not contain any data and
+             * must request at least one byte. */
+            if (    ((hw0 & ISCSI_FINAL_BIT) == 0)
+                ||  (RT_N2H_U32(pcrgResBHS[1]) != 0)
+                ||  (RT_N2H_U32(pcrgResBHS[11]) == 0))
+                return VERR_PARSE_ERROR;
+            break;
+        case ISCSIOP_SCSI_TASKMGMT_RES:
         case ISCSIOP_REJECT:
         default:
             /* Do some logging, ignore PDU. */
@@ -2691,15 +2765,194 @@ static int iscsiValidatePDU(PISCSIRES paRes, uint32_t cnRes)
 }
 
 
+/**
+ * Allocates a new PDU to transfer and sets up the S/G list for the BHS and the
+ * given range of the initiator to target data of the SCSI request.
+ *
+ * The data segment references the request buffers directly, nothing is copied.
+ *
+ * @returns Pointer to the new PDU or NULL if out of memory.
+ * @param   pImage      iSCSI connection state to use.
+ * @param   pScsiReq    The SCSI request the data belongs to.
+ * @param   offData     Start offset of the data segment in the I2T data.
+ * @param   cbData      Size of the data segment, 0 if the PDU carries no data.
+ */
+static PISCSIPDUTX iscsiPDUTxAlloc(PISCSIIMAGE pImage, PSCSIREQ pScsiReq, size_t offData, size_t cbData)
+{
+    RTSGBUF SgBuf;
+    unsigned cSegs = 0;
+
+    if (cbData)
+    {
+        RTSgBufInit(&SgBuf, pScsiReq->paI2TSegs, pScsiReq->cI2TSegs);
+        RTSgBufAdvance(&SgBuf, offData);
+        RTSgBufSegArrayCreate(&SgBuf, NULL, &cSegs, cbData);
+    }
+
+    /* The additional segments are for the BHS and the padding. */
+    PISCSIPDUTX pIScsiPDU = (PISCSIPDUTX)RTMemAllocZ(RT_OFFSETOF(ISCSIPDUTX, aISCSIReq[cSegs + 2]));
+    if (pIScsiPDU)
+    {
+        unsigned cnISCSIReq = 0;
+
+        pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = sizeof(pIScsiPDU->aBHS);
+        pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = pIScsiPDU->aBHS;
+        pIScsiPDU->cbSgLeft = sizeof(pIScsiPDU->aBHS);
+        cnISCSIReq++;
+        /* Padding is not necessary for the BHS. */
+
+        if (cbData)
+        {
+            size_t cbSegs = RTSgBufSegArrayCreate(&SgBuf, &pIScsiPDU->aISCSIReq[cnISCSIReq], &cSegs, cbData);
+            Assert(cbSegs == cbData); NOREF(cbSegs);
+            cnISCSIReq += cSegs;
+            pIScsiPDU->cbSgLeft += cbData;
+
+            /* Add padding if necessary. */
+            if (cbData & 3)
+            {
+                pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = &pImage->aPadding[0];
+                pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = 4 - (cbData & 3);
+                pIScsiPDU->cbSgLeft += pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg;
+                cnISCSIReq++;
+            }
+        }
+
+        pIScsiPDU->cISCSIReq = cnISCSIReq;
+        RTSgBufInit(&pIScsiPDU->SgBuf, pIScsiPDU->aISCSIReq, cnISCSIReq);
+    }
+
+    return pIScsiPDU;
+}
+
+/**
+ * Prepares the Data-Out PDUs transferring the given range of the initiator to
+ * target data of a command and adds them to the list.
+ *
+ * Unsolicited data directly follows the command PDU and shares its command
+ * sequence number. Data solicited by an R2T isn't subject to the command window
+ * and is put in front of the PDUs of other commands because the target is waiting
+ * for it, but behind any PDU of the same command still queued to keep the data
+ * sequence in order.
+ *
+ * @returns VBox status code.
+ * @param   pImage      iSCSI connection state to use.
+ * @param   pIScsiCmd   The command the data belongs to.
+ * @param   Ttt         The target transfer tag from the R2T,
+ *                      ISCSI_TASK_TAG_RSVD for unsolicited data.
+ * @param   offData     Start offset of the data in the I2T data.
+ * @param   cbData      Amount of data to transfer.
+ */
+static int iscsiPDUTxDataOut(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, uint32_t Ttt, size_t offData, size_t cbData)
+{
+    PSCSIREQ pScsiReq = pIScsiCmd->CmdType.ScsiReq.pScsiReq;
+    PISCSIPDUTX pIScsiPDUHead = NULL;
+    PISCSIPDUTX pIScsiPDUTail = NULL;
+    bool fSolicited = Ttt != ISCSI_TASK_TAG_RSVD;
+    uint32_t DataSN = 0;
+
+    LogFlowFunc(("pImage=%#p pIScsiCmd=%#p Ttt=%#x offData=%zu cbData=%zu\n",
+                 pImage, pIScsiCmd, Ttt, offData, cbData));
+
+    while (cbData)
+    {
+        size_t cbThisPDU = RT_MIN(cbData, pImage->cbSendDataLength);
+        PISCSIPDUTX pIScsiPDU = iscsiPDUTxAlloc(pImage, pScsiReq, offData, cbThisPDU);
+        if (!pIScsiPDU)
+        {
+            while (pIScsiPDUHead)
+            {
+                pIScsiPDU = pIScsiPDUHead;
+                pIScsiPDUHead = pIScsiPDU->pNext;
+                RTMemFree(pIScsiPDU);
+            }
+            return VERR_NO_MEMORY;
+        }
+
+        uint32_t *paReqBHS = pIScsiPDU->aBHS;
+        paReqBHS[0] = RT_H2N_U32(ISCSIOP_SCSI_DATA_OUT | (cbThisPDU == cbData ? ISCSI_FINAL_BIT : 0));
+        paReqBHS[1] = RT_H2N_U32((uint32_t)cbThisPDU & 0xffffff); /* TotalAHSLength=0 */
+        paReqBHS[2] = RT_H2N_U32(pImage->LUN >> 32);
+        paReqBHS[3] = RT_H2N_U32(pImage->LUN & 0xffffffff);
+        paReqBHS[4] = pIScsiCmd->Itt;
+        paReqBHS[5] = Ttt;
+        paReqBHS[6] = 0;            /* reserved */
+        paReqBHS[7] = RT_H2N_U32(pImage->ExpStatSN);
+        paReqBHS[8] = 0;            /* reserved */
+        paReqBHS[9] = RT_H2N_U32(DataSN);
+        paReqBHS[10] = RT_H2N_U32((uint32_t)offData);
+        paReqBHS[11] = 0;           /* reserved */
+
+        pIScsiPDU->pIScsiCmd  = pIScsiCmd;
+        pIScsiPDU->fDataOut   = true;
+        pIScsiPDU->fImmediate = fSolicited;
+        if (!fSolicited)
+            pIScsiPDU->CmdSN = pImage->CmdSN - 1; /* The command was queued right before, see iscsiPDUTxPrepare(). */
+
+        if (!pIScsiPDUHead)
+            pIScsiPDUHead = pIScsiPDU;
+        else
+            pIScsiPDUTail->pNext = pIScsiPDU;
+        pIScsiPDUTail = pIScsiPDU;
+
+        DataSN++;
+        offData += cbThisPDU;
+        cbData  -= cbThisPDU;
+    }
+
+    /* Link the PDUs to the list. */
+    if (pIScsiPDUHead)
+    {
+        if (fSolicited)
+        {
+            /* Find the last PDU of the command still waiting in the list. */
+            PISCSIPDUTX pIScsiPDUPrev = NULL;
+            for (PISCSIPDUTX pIt = pImage->pIScsiPDUTxHead; pIt; pIt = pIt->pNext)
+                if (pIt->pIScsiCmd == pIScsiCmd)
+                    pIScsiPDUPrev = pIt;
+
+            if (pIScsiPDUPrev)
+            {
+                pIScsiPDUTail->pNext = pIScsiPDUPrev->pNext;
+                pIScsiPDUPrev->pNext = pIScsiPDUHead;
+                if (pImage->pIScsiPDUTxTail == pIScsiPDUPrev)
+                    pImage->pIScsiPDUTxTail = pIScsiPDUTail;
+            }
+            else
+            {
+                pIScsiPDUTail->pNext = pImage->pIScsiPDUTxHead;
+                pImage->pIScsiPDUTxHead = pIScsiPDUHead;
+                if (!pImage->pIScsiPDUTxTail)
+                    pImage->pIScsiPDUTxTail = pIScsiPDUTail;
+            }
+        }
+        else
+        {
+            if (!pImage->pIScsiPDUTxHead)
+                pImage->pIScsiPDUTxHead = pIScsiPDUHead;
+            else
+                pImage->pIScsiPDUTxTail->pNext = pIScsiPDUHead;
+            pImage->pIScsiPDUTxTail = pIScsiPDUTail;
+        }
+    }
+
+    return VINF_SUCCESS;
+}
+
 /**
  * Prepares a PDU to transfer for the given command and adds it to the list.
+ *
+ * Write data exceeding what can be sent as immediate data is sent in unsolicited
+ * Data-Out PDUs up to the first burst length if the target allows it, the rest
+ * is transferred when the target asks for it with an R2T.
  */
 static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
 {
     int rc = VINF_SUCCESS;
     uint32_t *paReqBHS;
     size_t cbData = 0;
-    size_t cbSegs = 0;
+    size_t cbImmediate = 0;
+    size_t cbUnsolicited = 0;
     PSCSIREQ pScsiReq;
     PISCSIPDUTX pIScsiPDU = NULL;
 
@@ -2713,28 +2966,30 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     if (pScsiReq->cT2ISegs)
         RTSgBufInit(&pScsiReq->SgBufT2I, pScsiReq->paT2ISegs, pScsiReq->cT2ISegs);
 
-    /*
-     * Allocate twice as much entries as required for padding (worst case).
-     * The additional segment is for the BHS.
-     */
-    size_t cI2TSegs = 2*(pScsiReq->cI2TSegs + 1);
-    pIScsiPDU = (PISCSIPDUTX)RTMemAllocZ(RT_OFFSETOF(ISCSIPDUTX, aISCSIReq[cI2TSegs]));
-    if (!pIScsiPDU)
-        return VERR_NO_MEMORY;
-
-    pIScsiPDU->pIScsiCmd = pIScsiCmd;
-
     if (pScsiReq->enmXfer == SCSIXFER_FROM_TARGET)
         cbData = (uint32_t)pScsiReq->cbT2IData;
     else
+    {
         cbData = (uint32_t)pScsiReq->cbI2TData;
 
+        if (pImage->fImmediateData)
+            cbImmediate = RT_MIN(cbData, RT_MIN(pImage->cbSendDataLength, pImage->cbFirstBurstLength));
+        if (!pImage->fInitialR2T)
+            cbUnsolicited = RT_MIN(cbData, pImage->cbFirstBurstLength) - cbImmediate;
+    }
+
+    pIScsiPDU = iscsiPDUTxAlloc(pImage, pScsiReq, 0, cbImmediate);
+    if (!pIScsiPDU)
+        return VERR_NO_MEMORY;
+
+    pIScsiPDU->pIScsiCmd = pIScsiCmd;
+
     paReqBHS = pIScsiPDU->aBHS;
 
-    /* Setup the BHS. */
-    paReqBHS[0] = RT_H2N_U32(  ISCSI_FINAL_BIT | ISCSI_TASK_ATTR_SIMPLE | ISCSIOP_SCSI_CMD
-                             | (pScsiReq->enmXfer << 21)); /* I=0,F=1,Attr=Simple */
-    paReqBHS[1] = RT_H2N_U32(0x00000000 | ((uint32_t)pScsiReq->cbI2TData & 0xffffff)); /* TotalAHSLength=0 */
+    /* Setup the BHS, the final bit is cleared if unsolicited Data-Out PDUs follow. */
+    paReqBHS[0] = RT_H2N_U32(  (cbUnsolicited ? 0 : ISCSI_FINAL_BIT) | ISCSI_TASK_ATTR_SIMPLE | ISCSIOP_SCSI_CMD
+                             | (pScsiReq->enmXfer << 21)); /* I=0,Attr=Simple */
+    paReqBHS[1] = RT_H2N_U32(0x00000000 | ((uint32_t)cbImmediate & 0xffffff)); /* TotalAHSLength=0 */
     paReqBHS[2] = RT_H2N_U32(pImage->LUN >> 32);
     paReqBHS[3] = RT_H2N_U32(pImage->LUN & 0xffffffff);
     paReqBHS[4] = pIScsiCmd->Itt;
@@ -2746,45 +3001,15 @@ static int iscsiPDUTxPrepare(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     pIScsiPDU->CmdSN = pImage->CmdSN;
     pImage->CmdSN++;
 
-    /* Setup the S/G buffers. */
-    uint32_t cnISCSIReq = 0;
-    pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = sizeof(pIScsiPDU->aBHS);
-    pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = pIScsiPDU->aBHS;
-    cnISCSIReq++;
-    cbSegs = sizeof(pIScsiPDU->aBHS);
-    /* Padding is not necessary for the BHS. */
-
-    if (pScsiReq->cbI2TData)
-    {
-        for (unsigned cSeg = 0; cSeg < pScsiReq->cI2TSegs; cSeg++)
-        {
-            Assert(cnISCSIReq < cI2TSegs);
-            pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = pScsiReq->paI2TSegs[cSeg].cbSeg;
-            pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = pScsiReq->paI2TSegs[cSeg].pvSeg;
-            cbSegs += pScsiReq->paI2TSegs[cSeg].cbSeg;
-            cnISCSIReq++;
-
-            /* Add padding if necessary. */
-            if (pScsiReq->paI2TSegs[cSeg].cbSeg & 3)
-            {
-                Assert(cnISCSIReq < cI2TSegs);
-                pIScsiPDU->aISCSIReq[cnISCSIReq].pvSeg = &pImage->aPadding[0];
-                pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg = 4 - (pScsiReq->paI2TSegs[cSeg].cbSeg & 3);
-                cbSegs += pIScsiPDU->aISCSIReq[cnISCSIReq].cbSeg;
-                cnISCSIReq++;
-            }
-        }
-    }
-
-    pIScsiPDU->cISCSIReq = cnISCSIReq;
-    pIScsiPDU->cbSgLeft  = cbSegs;
-    RTSgBufInit(&pIScsiPDU->SgBuf, pIScsiPDU->aISCSIReq, cnISCSIReq);
-
     /* Link the PDU to the list. */
     iscsiPDUTxAdd(pImage, pIScsiPDU, false /* fFront */);
 
+    if (cbUnsolicited)
+        rc = iscsiPDUTxDataOut(pImage, pIScsiCmd, ISCSI_TASK_TAG_RSVD, cbImmediate, cbUnsolicited);
+
     /* Start transfer of a PDU if there is no one active at the moment. */
-    if (!pImage->pIScsiPDUTxCur)
+    if (   RT_SUCCESS(rc)
+        && !pImage->pIScsiPDUTxCur)
         rc = iscsiSendPDUAsync(pImage);
 
     return rc;
@@ -2894,6 +3119,33 @@ static int iscsiRecvPDUUpdateRequest(PISCSIIMAGE pImage, PISCSIRES paRes, uint32
                 }
             }
         }
+        else if (cmd == ISCSIOP_R2T)
+        {
+            /* The target is ready to receive (more) data for a write command. */
+            uint32_t offData = RT_N2H_U32(paResBHS[10]);
+            uint32_t cbData  = RT_N2H_U32(paResBHS[11]);
+
+            if (   pScsiReq->enmXfer != SCSIXFER_TO_TARGET
+                || offData > pScsiReq->cbI2TData
+                || cbData > pScsiReq->cbI2TData - offData
+                || cbData > pImage->cbMaxBurstLength)
+                rc = VERR_PARSE_ERROR;
+            else
+            {
+                /*
+                 * The caller kicks off sending the queued PDUs. If the data can't be
+                 * sent the target would wait forever, so fail the command. A late
+                 * response from the target for the ITT is dropped as unknown.
+                 */
+                int rc2 = iscsiPDUTxDataOut(pImage, pIScsiCmd, paResBHS[5], offData, cbData);
+                if (RT_FAILURE(rc2))
+                {
+                    iscsiLogRel(pImage, "iSCSI: Preparing the Data-Out PDUs for target %s failed %Rrc\n",
+                                pImage->pszTargetName, rc2);
+                    iscsiCmdComplete(pImage, pIScsiCmd, rc2);
+                }
+            }
+        }
         else
             rc = VERR_PARSE_ERROR;
     }
@@ -3118,6 +3370,8 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
     const char *pcszMaxRecvDataSegmentLength = NULL;
     const char *pcszMaxBurstLength = NULL;
     const char *pcszFirstBurstLength = NULL;
+    const char *pcszInitialR2T = NULL;
+    const char *pcszImmediateData = NULL;
     rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "MaxRecvDataSegmentLength", &pcszMaxRecvDataSegmentLength);
     if (rc == VERR_INVALID_NAME)
         rc = VINF_SUCCESS;
@@ -3129,6 +3383,16 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
     if (RT_FAILURE(rc))
         return VERR_PARSE_ERROR;
     rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "FirstBurstLength", &pcszFirstBurstLength);
+    if (rc == VERR_INVALID_NAME)
+        rc = VINF_SUCCESS;
+    if (RT_FAILURE(rc))
+        return VERR_PARSE_ERROR;
+    rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "InitialR2T", &pcszInitialR2T);
+    if (rc == VERR_INVALID_NAME)
+        rc = VINF_SUCCESS;
+    if (RT_FAILURE(rc))
+        return VERR_PARSE_ERROR;
+    rc = iscsiTextGetKeyValue(pbBuf, cbBuf, "ImmediateData", &pcszImmediateData);
     if (rc == VERR_INVALID_NAME)
         rc = VINF_SUCCESS;
     if (RT_FAILURE(rc))
@@ -3142,18 +3406,25 @@ static int iscsiUpdateParameters(PISCSIIMAGE pImage, const uint8_t *pbBuf, size_
     }
     if (pcszMaxBurstLength)
     {
-        uint32_t cb = pImage->cbSendDataLength;
+        uint32_t cb = pImage->cbMaxBurstLength;
         rc = RTStrToUInt32Full(pcszMaxBurstLength, 0, &cb);
         AssertRC(rc);
-        pImage->cbSendDataLength = RT_MIN(pImage->cbSendDataLength, cb);
+        pImage->cbMaxBurstLength = RT_MIN(pImage->cbMaxBurstLength, cb);
     }
     if (pcszFirstBurstLength)
     {
-        uint32_t cb = pImage->cbSendDataLength;
+        uint32_t cb = pImage->cbFirstBurstLength;
         rc = RTStrToUInt32Full(pcszFirstBurstLength, 0, &cb);
         AssertRC(rc);
-        pImage->cbSendDataLength = RT_MIN(pImage->cbSendDataLength, cb);
+        pImage->cbFirstBurstLength = RT_MIN(pImage->cbFirstBurstLength, cb);
     }
+    /* The first burst can't exceed the maximum burst length. */
+    pImage->cbFirstBurstLength = RT_MIN(pImage->cbFirstBurstLength, pImage->cbMaxBurstLength);
+    /* InitialR2T is negotiated with the OR function, ImmediateData with the AND function. */
+    if (pcszInitialR2T)
+        pImage->fInitialR2T = !strcmp(pcszInitialR2T, "Yes");
+    if (pcszImmediateData)
+        pImage->fImmediateData = !strcmp(pcszImmediateData, "Yes");
     return VINF_SUCCESS;
 }
 
@@ -3226,6 +3497,8 @@ DECLINLINE(PISCSICMD) iscsiCmdGet(PISCSIIMAGE pImage)
     if (pIScsiCmd)
     {
         pImage->pScsiReqQueue = pIScsiCmd->pNext;
+        if (!pImage->pScsiReqQueue)
+            pImage->pScsiReqQueueTail = NULL;
         pIScsiCmd->pNext = NULL;
     }
 
@@ -3244,8 +3517,13 @@ DECLINLINE(int) iscsiCmdPut(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd)
     int rc = RTSemMutexRequest(pImage->MutexReqQueue, RT_INDEFINITE_WAIT);
     AssertRC(rc);
 
-    pIScsiCmd->pNext = pImage->pScsiReqQueue;
-    pImage->pScsiReqQueue = pIScsiCmd;
+    /* Keep the submission order, the I/O thread issues the commands in that order. */
+    pIScsiCmd->pNext = NULL;
+    if (!pImage->pScsiReqQueue)
+        pImage->pScsiReqQueue = pIScsiCmd;
+    else
+        pImage->pScsiReqQueueTail->pNext = pIScsiCmd;
+    pImage->pScsiReqQueueTail = pIScsiCmd;
 
     rc = RTSemMutexRelease(pImage->MutexReqQueue);
     AssertRC(rc);
@@ -3267,6 +3545,67 @@ static void iscsiCmdComplete(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, int rcCmd)
     /* Remove from the table first. */
     iscsiCmdRemove(pImage, pIScsiCmd->Itt);
 
+    /*
+     * The target may complete a write (with an error) before it got all the data.
+     * Drop the Data-Out PDUs of the command which are still queued, they reference
+     * the data buffer of the request directly.
+     */
+    PISCSIPDUTX pIScsiPDUPrev = NULL;
+    PISCSIPDUTX pIScsiPDUTx = pImage->pIScsiPDUTxHead;
+    while (pIScsiPDUTx)
+    {
+        PISCSIPDUTX pIScsiPDUNext = pIScsiPDUTx->pNext;
+
+        if (pIScsiPDUTx->pIScsiCmd == pIScsiCmd)
+        {
+            Assert(pIScsiPDUTx->fDataOut);
+            if (pIScsiPDUPrev)
+                pIScsiPDUPrev->pNext = pIScsiPDUNext;
+            else
+                pImage->pIScsiPDUTxHead = pIScsiPDUNext;
+            if (pImage->pIScsiPDUTxTail == pIScsiPDUTx)
+                pImage->pIScsiPDUTxTail = pIScsiPDUPrev;
+            RTMemFree(pIScsiPDUTx);
+        }
+        else
+            pIScsiPDUPrev = pIScsiPDUTx;
+
+        pIScsiPDUTx = pIScsiPDUNext;
+    }
+
+    /*
+     * A partially sent PDU can't be dropped without breaking the stream,
+     * complete the command after it went out completely.
+     */
+    pIScsiPDUTx = pImage->pIScsiPDUTxCur;
+    if (   pIScsiPDUTx
+        && pIScsiPDUTx->pIScsiCmd == pIScsiCmd)
+    {
+        Assert(pIScsiPDUTx->fDataOut);
+        if (   pIScsiPDUTx->SgBuf.idxSeg == 0
+            && pIScsiPDUTx->SgBuf.pvSegCur == &pIScsiPDUTx->aBHS[0])
+        {
+            /* Nothing was sent yet (the socket would have blocked). */
+            pImage->pIScsiPDUTxCur = NULL;
+            RTMemFree(pIScsiPDUTx);
+        }
+        else
+        {
+            pIScsiCmd->fCompletionDeferred = true;
+            pIScsiCmd->rcCmdDeferred       = rcCmd;
+            return;
+        }
+    }
+
+    iscsiCmdCompleteNotify(pImage, pIScsiCmd, rcCmd);
+}
+
+/**
+ * Internal. - Notifies the issuer about the completion of the command
+ *             and frees the command structure.
+ */
+static void iscsiCmdCompleteNotify(PISCSIIMAGE pImage, PISCSICMD pIScsiCmd, int rcCmd)
+{
     /* Call completion callback. */
     pIScsiCmd->pfnComplete(pImage, rcCmd, pIScsiCmd->pvUser);
 
@@ -3309,7 +3648,8 @@ static void iscsiReattach(PISCSIIMAGE pImage)
 
         pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
 
-        if (pIScsiCmd)
+        /* The commands of Data-Out PDUs were sent already and are on the waiting list. */
+        if (pIScsiCmd && !pIScsiPDUTx->fDataOut)
         {
             /* Place on command list. */
             pIScsiCmd->pNext = pIScsiCmdHead;
@@ -3329,11 +3669,13 @@ static void iscsiReattach(PISCSIIMAGE pImage)
         pImage->pIScsiPDUTxCur = NULL;
         pIScsiCmd = pIScsiPDUTx->pIScsiCmd;
 
-        if (pIScsiCmd)
+        if (pIScsiCmd && !pIScsiPDUTx->fDataOut)
         {
             pIScsiCmd->pNext = pIScsiCmdHead;
             pIScsiCmdHead = pIScsiCmd;
         }
+        else if (pIScsiCmd && pIScsiCmd->fCompletionDeferred)
+            iscsiCmdCompleteNotify(pImage, pIScsiCmd, pIScsiCmd->rcCmdDeferred);
         RTMemFree(pIScsiPDUTx);
     }
 
@@ -3707,6 +4049,8 @@ static DECLCALLBACK(void) iscsiCommandAsyncComplete(PISCSIIMAGE pImage, int rcRe
 
     if (fComplete)
     {
+        ASMAtomicDecU32(&pImage->cReqsActive);
+
         if (pScsiReq->enmXfer == SCSIXFER_FROM_TARGET)
             cbTransfered = pScsiReq->cbT2IData;
         else if (pScsiReq->enmXfer == SCSIXFER_TO_TARGET)
@@ -3724,6 +4068,127 @@ static DECLCALLBACK(void) iscsiCommandAsyncComplete(PISCSIIMAGE pImage, int rcRe
 }
 
 
+/**
+ * Internal. Closes all additional sessions to the target.
+ *
+ * @param   pImage      The first session.
+ */
+static void iscsiSessionsDestroy(PISCSIIMAGE pImage)
+{
+    if (pImage->papSessions)
+    {
+        for (uint32_t i = 0; i < pImage->cSessions - 1; i++)
+        {
+            PISCSIIMAGE pSession = pImage->papSessions[i];
+            if (pSession)
+            {
+                iscsiFreeImage(pSession, false /* fDelete */);
+                RTMemFree(pSession);
+            }
+        }
+
+        RTMemFree(pImage->papSessions);
+        pImage->papSessions = NULL;
+        pImage->cSessions   = 1;
+    }
+}
+
+/**
+ * Internal. Opens the additional sessions to the target if configured.
+ *
+ * Each session logs in with its own ISID (see iscsiTransportConnect()), has its
+ * own connection and I/O thread and thus its own command window. Asynchronous
+ * reads and writes are spread over the sessions, everything else stays on the
+ * first session. Targets limiting the number of sessions per initiator are
+ * dealt with by using as many sessions as could be opened.
+ *
+ * @param   pImage      The first session.
+ */
+static void iscsiSessionsCreate(PISCSIIMAGE pImage)
+{
+    if (   pImage->cSessions <= 1
+        || !pImage->fExtendedSelectSupported
+        || !(pImage->uOpenFlags & VD_OPEN_FLAGS_ASYNC_IO)
+        || (pImage->uOpenFlags & VD_OPEN_FLAGS_INFO))
+    {
+        pImage->cSessions = 1;
+        return;
+    }
+
+    pImage->papSessions = (PISCSIIMAGE *)RTMemAllocZ((pImage->cSessions - 1) * sizeof(PISCSIIMAGE));
+    if (!pImage->papSessions)
+    {
+        LogRel(("iSCSI: Out of memory allocating the sessions to target %s\n", pImage->pszTargetName));
+        pImage->cSessions = 1;
+        return;
+    }
+
+    uint32_t cSessions = 1;
+    while (cSessions < pImage->cSessions)
+    {
+        PISCSIIMAGE pSession = (PISCSIIMAGE)RTMemAllocZ(sizeof(ISCSIIMAGE));
+        if (!pSession)
+            break;
+
+        pSession->pszFilename = pImage->pszFilename;
+        pSession->pVDIfsDisk  = pImage->pVDIfsDisk;
+        pSession->pVDIfsImage = pImage->pVDIfsImage;
+
+        int rc = iscsiOpenImage(pSession, pImage->uOpenFlags);
+        if (   RT_SUCCESS(rc)
+            && (   pSession->cbSize != pImage->cbSize
+                || pSession->cbSector != pImage->cbSector))
+        {
+            iscsiFreeImage(pSession, false /* fDelete */);
+            rc = VERR_INVALID_STATE;
+        }
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("iSCSI: Could not open session %u to target %s, rc=%Rrc\n",
+                    cSessions, pImage->pszTargetName, rc));
+            RTMemFree(pSession);
+            break;
+        }
+
+        pImage->papSessions[cSessions - 1] = pSession;
+        cSessions++;
+    }
+
+    LogRel(("iSCSI: Using %u of %u sessions to target %s\n",
+            cSessions, pImage->cSessions, pImage->pszTargetName));
+    if (cSessions == 1)
+    {
+        RTMemFree(pImage->papSessions);
+        pImage->papSessions = NULL;
+    }
+    pImage->cSessions = cSessions;
+}
+
+/**
+ * Internal. Returns the session with the least number of outstanding
+ * requests to issue the next asynchronous request on.
+ *
+ * @returns The session to use.
+ * @param   pImage      The first session.
+ */
+static PISCSIIMAGE iscsiSessionSelect(PISCSIIMAGE pImage)
+{
+    PISCSIIMAGE pSession = pImage;
+    uint32_t    cReqsActive = ASMAtomicReadU32(&pImage->cReqsActive);
+
+    for (uint32_t i = 0; i < pImage->cSessions - 1 && cReqsActive; i++)
+    {
+        uint32_t cReqsSession = ASMAtomicReadU32(&pImage->papSessions[i]->cReqsActive);
+        if (cReqsSession < cReqsActive)
+        {
+            pSession    = pImage->papSessions[i];
+            cReqsActive = cReqsSession;
+        }
+    }
+
+    return pSession;
+}
+
 /**
  * Internal. Free all allocated space for representing an image, and optionally
  * delete the image from disk.
@@ -3737,6 +4202,8 @@ static int iscsiFreeImage(PISCSIIMAGE pImage, bool fDelete)
      * not signalled as an error. After all nothing bad happens. */
     if (pImage)
     {
+        iscsiSessionsDestroy(pImage);
+
         if (pImage->Mutex != NIL_RTSEMMUTEX)
         {
             /* Detaching only makes sense when the mutex is there. Otherwise the
@@ -3831,6 +4298,7 @@ static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags)
     bool fLunEncoded = false;
     uint32_t uWriteSplitDef = 0;
     uint32_t uTimeoutDef = 0;
+    uint32_t cSessionsDef = 0;
     uint64_t uCfgTmp = 0;
     bool fHostIPDef = false;
     bool fDumpMalformedPacketsDef = false;
@@ -3838,6 +4306,8 @@ static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags)
     AssertRC(rc);
     rc = RTStrToUInt32Full(s_iscsiConfigDefaultTimeout, 0, &uTimeoutDef);
     AssertRC(rc);
+    rc = RTStrToUInt32Full(s_iscsiConfigDefaultSessions, 0, &cSessionsDef);
+    AssertRC(rc);
     rc = RTStrToUInt64Full(s_iscsiConfigDefaultHostIPStack, 0, &uCfgTmp);
     AssertRC(rc);
     fHostIPDef = RT_BOOL(uCfgTmp);
@@ -3913,7 +4383,8 @@ static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags)
                            "WriteSplit\0"
                            "Timeout\0"
                            "HostIPStack\0"
-                           "DumpMalformedPackets\0"))
+                           "DumpMalformedPackets\0"
+                           "Sessions\0"))
     {
         rc = vdIfError(pImage->pIfError, VERR_VD_UNKNOWN_CFG_VALUES, RT_SRC_POS, N_("iSCSI: configuration error: unknown configuration keys present"));
         goto out;
@@ -4084,6 +4555,22 @@ static int iscsiOpenImage(PISCSIIMAGE pImage, unsigned uOpenFlags)
         goto out;
     }
 
+    rc = VDCFGQueryU32Def(pImage->pIfConfig,
+                          "Sessions", &pImage->cSessions,
+                          cSessionsDef);
+    if (RT_FAILURE(rc))
+    {
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("iSCSI: configuration error: failed to read Sessions as U32"));
+        goto out;
+    }
+    if (   !pImage->cSessions
+        || pImage->cSessions > ISCSI_SESSIONS_MAX)
+    {
+        rc = vdIfError(pImage->pIfError, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                       N_("iSCSI: configuration error: number of sessions out of range (1-%u)"), ISCSI_SESSIONS_MAX);
+        goto out;
+    }
+
     /* Don't actually establish iSCSI transport connection if this is just an
      * open to query the image information and the host IP stack isn't used.
      * Even trying is rather useless, as in this context the InTnet IP stack
@@ -4627,6 +5114,7 @@ static DECLCALLBACK(int) iscsiOpen(const char *pszFilename, unsigned uOpenFlags,
     rc = iscsiOpenImage(pImage, uOpenFlags);
     if (RT_SUCCESS(rc))
     {
+        iscsiSessionsCreate(pImage);
         LogFlowFunc(("target %s cVolume %d, cbSector %d\n", pImage->pszTargetName, pImage->cVolume, pImage->cbSector));
         LogRel(("iSCSI: target address %s, target name %s, SCSI LUN %lld\n", pImage->pszTargetAddress, pImage->pszTargetName, pImage->LUN));
         *ppBackendData = pImage;
@@ -4777,9 +5265,15 @@ static DECLCALLBACK(int) iscsiRead(void *pBackendData, uint64_t uOffset, size_t
         }
         else
         {
-            rc = iscsiCommandAsync(pImage, pReq, iscsiCommandAsyncComplete, pReq);
+            PISCSIIMAGE pSession = iscsiSessionSelect(pImage);
+
+            ASMAtomicIncU32(&pSession->cReqsActive);
+            rc = iscsiCommandAsync(pSession, pReq, iscsiCommandAsyncComplete, pReq);
             if (RT_FAILURE(rc))
+            {
+                ASMAtomicDecU32(&pSession->cReqsActive);
                 AssertMsgFailed(("iscsiCommandAsync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
+            }
             else
             {
                 *pcbActuallyRead = cbToRead;
@@ -4814,9 +5308,16 @@ static DECLCALLBACK(int) iscsiWrite(void *pBackendData, uint64_t uOffset, size_t
         return VERR_INVALID_PARAMETER;
 
     /*
-     * Clip read size to a value which is supported by the target.
+     * Clip write size to a value which is supported by the target. The I/O thread
+     * transfers everything exceeding the immediate data with Data-Out PDUs,
+     * the synchronous path sends all data with the command.
      */
-    cbToWrite = RT_MIN(cbToWrite, pImage->cbSendDataLength);
+    if (pImage->fExtendedSelectSupported)
+        cbToWrite = RT_MIN(cbToWrite, pImage->cbWriteSplit);
+    else
+        cbToWrite = RT_MIN(cbToWrite, RT_MIN(pImage->cbSendDataLength, pImage->cbFirstBurstLength));
+    /* The transfer length in the CDB is limited to 16 bits. */
+    cbToWrite = RT_MIN(cbToWrite, (size_t)UINT16_MAX * pImage->cbSector);
 
     unsigned cI2TSegs = 0;
     size_t   cbSegs = 0;
@@ -4903,9 +5404,15 @@ static DECLCALLBACK(int) iscsiWrite(void *pBackendData, uint64_t uOffset, size_t
         }
         else
         {
-            rc = iscsiCommandAsync(pImage, pReq, iscsiCommandAsyncComplete, pReq);
+            PISCSIIMAGE pSession = iscsiSessionSelect(pImage);
+
+            ASMAtomicIncU32(&pSession->cReqsActive);
+            rc = iscsiCommandAsync(pSession, pReq, iscsiCommandAsyncComplete, pReq);
             if (RT_FAILURE(rc))
+            {
+                ASMAtomicDecU32(&pSession->cReqsActive);
                 AssertMsgFailed(("iscsiCommandAsync(%s, %#llx) -> %Rrc\n", pImage->pszTargetName, uOffset, rc));
+            }
             else
             {
                 *pcbWriteProcess = cbToWrite;
@@ -4966,9 +5473,17 @@ static DECLCALLBACK(int) iscsiFlush(void *pBackendData, PVDIOCTX pIoCtx)
         }
         else
         {
+            /*
+             * The write cache belongs to the logical unit, flushing it through the
+             * first session covers the writes completed on the other sessions too.
+             */
+            ASMAtomicIncU32(&pImage->cReqsActive);
             rc = iscsiCommandAsync(pImage, pReq, iscsiCommandAsyncComplete, pReq);
             if (RT_FAILURE(rc))
+            {
+                ASMAtomicDecU32(&pImage->cReqsActive);
                 AssertMsgFailed(("iscsiCommand(%s) -> %Rrc\n", pImage->pszTargetName, rc));
+            }
             else
                 return VERR_VD_IOCTX_HALT; /* Halt the I/O context until further notification from the I/O thread. */
         }
@@ -5185,6 +5700,8 @@ static DECLCALLBACK(int) iscsiSetOpenFlags(void *pBackendData, unsigned uOpenFla
     {
         iscsiFreeImage(pImage, false);
         rc = iscsiOpenImage(pImage, uOpenFlags);
+        if (RT_SUCCESS(rc))
+            iscsiSessionsCreate(pImage);
     }
     else
     {
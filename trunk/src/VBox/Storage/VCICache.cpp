@@ -28,6 +28,11 @@
 #include <iprt/alloc.h>
 #include <iprt/file.h>
 #include <iprt/asm.h>
+#include <iprt/avl.h>
+#include <iprt/list.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
+#include <iprt/uuid.h>
 
 #include "VDBackends.h"
 
@@ -48,6 +53,11 @@
 /** Convert byte offset/size to block number/size. */
 #define VCI_BYTE2BLOCK(u)          ((u) >> 9)
 
+/** Size of a cache line, the unit of allocation and replacement. */
+#define VCI_LINE_SIZE              _64K
+/** Number of blocks in a cache line. */
+#define VCI_LINE_BLOCKS            (VCI_LINE_SIZE / VCI_BLOCK_SIZE)
+
 /**
  * The VCI header - at the beginning of the file.
  *
@@ -60,25 +70,27 @@ typedef struct VciHdr
     uint32_t    u32Signature;
     /** Version of the layout of metadata in the cache. */
     uint32_t    u32Version;
-    /** Maximum size of the cache file in blocks.
+    /** Maximum size of the cache file in bytes.
      *  This includes all metadata. */
-    uint64_t    cBlocksCache;
+    uint64_t    cbCache;
     /** Flag indicating whether the cache was closed cleanly. */
     uint8_t     fUncleanShutdown;
     /** Cache type. */
     uint32_t    u32CacheType;
-    /** Offset of the B+-Tree root in the image in blocks. */
-    uint64_t    offTreeRoot;
-    /** Offset of the block allocation bitmap in blocks. */
-    uint64_t    offBlkMap;
-    /** Size of the block allocation bitmap in blocks. */
-    uint32_t    cBlkMap;
+    /** Offset of the cache line table in bytes. */
+    uint64_t    offLineTbl;
+    /** Number of cache lines. */
+    uint32_t    cLines;
+    /** Size of a cache line in bytes. */
+    uint32_t    cbLine;
+    /** Offset of the first cache line in bytes. */
+    uint64_t    offData;
     /** UUID of the image. */
     RTUUID      uuidImage;
     /** Modification UUID for the cache. */
     RTUUID      uuidModification;
     /** Reserved for future use. */
-    uint8_t     abReserved[951];
+    uint8_t     abReserved[947];
 } VciHdr, *PVciHdr;
 #pragma pack()
 AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
@@ -86,7 +98,7 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 /** VCI signature to identify a valid image. */
 #define VCI_HDR_SIGNATURE          UINT32_C(0x00494356) /* \0ICV */
 /** Current version we support. */
-#define VCI_HDR_VERSION            UINT32_C(0x00000001)
+#define VCI_HDR_VERSION            UINT32_C(0x00000002)
 
 /** Value for an unclean cache shutdown. */
 #define VCI_HDR_UNCLEAN_SHUTDOWN   UINT8_C(0x01)
@@ -98,238 +110,86 @@ AssertCompileSize(VciHdr, 2 * VCI_BLOCK_SIZE);
 /** Cache type: Fixed image, space is preallocated. */
 #define VCI_HDR_CACHE_TYPE_FIXED   UINT32_C(0x00000002)
 
-/**
- * On disk representation of an extent describing a range of cached data.
- *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciCacheExtent
-{
-    /** Block address of the previous extent in the LRU list. */
-    uint64_t    u64ExtentPrev;
-    /** Block address of the next extent in the LRU list. */
-    uint64_t    u64ExtentNext;
-    /** Flags (for compression, encryption etc.) - currently unused and should be always 0. */
-    uint8_t     u8Flags;
-    /** Reserved */
-    uint8_t     u8Reserved;
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VciCacheExtent, *PVciCacheExtent;
-#pragma pack()
-AssertCompileSize(VciCacheExtent, 38);
+/** Offset of the cache line table in the image. */
+#define VCI_LINE_TBL_OFFSET        _4K
 
 /**
- * On disk representation of an internal node.
+ * On disk representation of a cache line table entry.
  *
  * All entries a stored in little endian order.
  */
 #pragma pack(1)
-typedef struct VciTreeNodeInternal
+typedef struct VciLineEnt
 {
-    /** First block of cached data the internal node represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t    u32Blocks;
-    /** Block address in the image where the next node in the tree is stored. */
-    uint64_t    u64ChildAddr;
-} VciTreeNodeInternal, *PVciTreeNodeInternal;
-#pragma pack()
-AssertCompileSize(VciTreeNodeInternal, 20);
-
-/**
- * On-disk representation of a node in the B+-Tree.
- *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciTreeNode
-{
-    /** Type of the node (root, internal, leaf). */
-    uint8_t     u8Type;
-    /** Data in the node. */
-    uint8_t     au8Data[4095];
-} VciTreeNode, *PVciTreeNode;
-#pragma pack()
-AssertCompileSize(VciTreeNode, 8 * VCI_BLOCK_SIZE);
-
-/** Node type: Internal node containing links to other nodes (VciTreeNodeInternal). */
-#define VCI_TREE_NODE_TYPE_INTERNAL UINT8_C(0x01)
-/** Node type: Leaf of the tree (VciCacheExtent). */
-#define VCI_TREE_NODE_TYPE_LEAF     UINT8_C(0x02)
-
-/** Number of cache extents described by one node. */
-#define VCI_TREE_EXTENTS_PER_NODE        ((sizeof(VciTreeNode)-1) / sizeof(VciCacheExtent))
-/** Number of internal nodes managed by one tree node. */
-#define VCI_TREE_INTERNAL_NODES_PER_NODE ((sizeof(VciTreeNode)-1) / sizeof(VciTreeNodeInternal))
-
-/**
- * VCI block bitmap header.
- *
- * All entries a stored in little endian order.
- */
-#pragma pack(1)
-typedef struct VciBlkMap
-{
-    /** Magic of the block bitmap. */
-    uint32_t     u32Magic;
-    /** Version of the block bitmap. */
-    uint32_t     u32Version;
-    /** Number of blocks this block map manages. */
-    uint64_t     cBlocks;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
-    /** Reserved for future use. */
-    uint8_t      au8Reserved[472];
-} VciBlkMap, *PVciBlkMap;
+    /** Line of the virtual disk cached in this slot (disk offset / line size). */
+    uint64_t    u64DiskLine;
+    /** Flags for this entry, VCI_LINE_ENT_F_*. */
+    uint32_t    u32Flags;
+    /** Position in the LRU list when the cache was closed, 0 is the most recent. */
+    uint32_t    u32LruRank;
+    /** Bitmap of blocks in the line holding valid data. */
+    uint64_t    au64Valid[VCI_LINE_BLOCKS / 64];
+} VciLineEnt, *PVciLineEnt;
 #pragma pack()
-AssertCompileSize(VciBlkMap, VCI_BLOCK_SIZE);
+AssertCompileSize(VciLineEnt, 32);
 
-/** The magic which identifies a block map. */
-#define VCI_BLKMAP_MAGIC   UINT32_C(0x4b4c4256) /* KLBV */
-/** Current version. */
-#define VCI_BLKMAP_VERSION UINT32_C(0x00000001)
+/** Line table entry flag: The slot caches data. */
+#define VCI_LINE_ENT_F_USED        RT_BIT_32(0)
 
-/** Block bitmap entry */
-typedef uint8_t VciBlkMapEnt;
+/** Minimum number of cache lines a cache must hold. */
+#define VCI_LINES_MIN              256
+/** Number of line table entries read or written at once. */
+#define VCI_LINE_TBL_CHUNK         (_64K / sizeof(VciLineEnt))
 
+/*******************************************************************************
+* Constants And Macros, Structures and Typedefs                                *
+*******************************************************************************/
 
-/*********************************************************************************************************************************
-*   Constants And Macros, Structures and Typedefs                                                                                *
-*********************************************************************************************************************************/
-
-/**
- * Block range descriptor.
- */
-typedef struct VCIBLKRANGEDESC
-{
-    /** Previous entry in the list. */
-    struct VCIBLKRANGEDESC    *pPrev;
-    /** Next entry in the list. */
-    struct VCIBLKRANGEDESC    *pNext;
-    /** Start address of the range. */
-    uint64_t                   offAddrStart;
-    /** Number of blocks in the range. */
-    uint64_t                   cBlocks;
-    /** Flag whether the range is free or allocated. */
-    bool                       fFree;
-} VCIBLKRANGEDESC, *PVCIBLKRANGEDESC;
-
-/**
- * Block map for the cache image - in memory structure.
- */
-typedef struct VCIBLKMAP
-{
-    /** Number of blocks the map manages. */
-    uint64_t     cBlocks;
-    /** Number of blocks allocated for metadata. */
-    uint64_t     cBlocksAllocMeta;
-    /** Number of blocks allocated for actual cached data. */
-    uint64_t     cBlocksAllocData;
-    /** Number of free blocks. */
-    uint64_t     cBlocksFree;
-
-    /** Pointer to the head of the block range list. */
-    PVCIBLKRANGEDESC pRangesHead;
-    /** Pointer to the tail of the block range list. */
-    PVCIBLKRANGEDESC pRangesTail;
-
-} VCIBLKMAP;
-/** Pointer to a block map. */
-typedef VCIBLKMAP *PVCIBLKMAP;
-
-/**
- * B+-Tree node header.
- */
-typedef struct VCITREENODE
-{
-    /** Type of the node (VCI_TREE_NODE_TYPE_*). */
-    uint8_t             u8Type;
-    /** Block address where the node is stored. */
-    uint64_t            u64BlockAddr;
-    /** Pointer to the parent. */
-    struct VCITREENODE *pParent;
-} VCITREENODE, *PVCITREENODE;
-
-/**
- * B+-Tree node pointer.
- */
-typedef struct VCITREENODEPTR
-{
-    /** Flag whether the node is in memory or still on the disk. */
-    bool         fInMemory;
-    /** Type dependent data. */
-    union
-    {
-        /** Pointer to a in memory node. */
-        PVCITREENODE pNode;
-        /** Start block address of the node. */
-        uint64_t     offAddrBlockNode;
-    } u;
-} VCITREENODEPTR, *PVCITREENODEPTR;
-
-/**
- * Internal node.
- */
-typedef struct VCINODEINTERNAL
-{
-    /** First block of cached data the internal node represents. */
-    uint64_t       u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t       u32Blocks;
-    /** Pointer to the child node. */
-    VCITREENODEPTR PtrChild;
-} VCINODEINTERNAL, *PVCINODEINTERNAL;
+/** Lines accessed less than this many milliseconds ago are not evicted. This
+ * protects lines which might still be read from by requests in flight. */
+#define VCI_LINE_EVICT_MIN_AGE_MS  2000
+/** Maximum number of lines to look at from the LRU tail when evicting. */
+#define VCI_LINE_EVICT_SCAN_MAX    16
+/** Minimum number of entries in the ghost table. */
+#define VCI_GHOST_ENTRIES_MIN      1024
 
 /**
- * A in memory internal B+-tree node.
+ * In memory state of a cache line.
  */
-typedef struct VCITREENODEINT
+typedef struct VCILINE
 {
-    /** Node core. */
-    VCITREENODE     Core;
-    /** Number of used nodes. */
-    unsigned        cUsedNodes;
-    /** Array of internal nodes. */
-    VCINODEINTERNAL aIntNodes[VCI_TREE_INTERNAL_NODES_PER_NODE];
-} VCITREENODEINT, *PVCITREENODEINT;
+    /** AVL tree node, the key is the line of the virtual disk. */
+    AVLRU64NODECORE Core;
+    /** Node in the LRU list (the free list if unused). */
+    RTLISTNODE      NodeLru;
+    /** Index of the slot in the image. */
+    uint32_t        idxSlot;
+    /** Number of fills in flight for this line. */
+    uint32_t        cFillsPending;
+    /** Generation counter, incremented whenever data is invalidated. */
+    uint32_t        uGen;
+    /** Flag whether the line caches data. */
+    bool            fUsed;
+    /** Timestamp of the last access in milliseconds. */
+    uint64_t        u64TsLastUse;
+    /** Bitmap of blocks holding valid data. */
+    uint64_t        au64Valid[VCI_LINE_BLOCKS / 64];
+} VCILINE, *PVCILINE;
 
 /**
- * A in memory cache extent.
+ * A fill of a cache line in flight.
  */
-typedef struct VCICACHEEXTENT
+typedef struct VCIFILL
 {
-    /** First block of cached data the extent represents. */
-    uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VCICACHEEXTENT, *PVCICACHEEXTENT;
-
-/**
- * A in memory leaf B+-tree node.
- */
-typedef struct VCITREENODELEAF
-{
-    /** Node core. */
-    VCITREENODE             Core;
-    /** Next leaf node in the list. */
-    struct VCITREENODELEAF *pNext;
-    /** Number of used nodes. */
-    unsigned                cUsedNodes;
-    /** The extents in the node. */
-    VCICACHEEXTENT          aExtents[VCI_TREE_EXTENTS_PER_NODE];
-} VCITREENODELEAF, *PVCITREENODELEAF;
+    /** The line being filled. */
+    PVCILINE        pLine;
+    /** Generation of the line when the fill was started. */
+    uint32_t        uGen;
+    /** First block filled. */
+    uint32_t        iBlock;
+    /** Number of blocks filled. */
+    uint32_t        cBlocks;
+} VCIFILL, *PVCIFILL;
 
 /**
  * VCI image data structure.
@@ -356,25 +216,51 @@ typedef struct VCICACHE
     unsigned          uImageFlags;
     /** Total size of the image. */
     uint64_t          cbSize;
-
-    /** Offset of the B+-Tree in the image in bytes. */
-    uint64_t          offTreeRoot;
-    /** Pointer to the root node of the B+-Tree. */
-    PVCITREENODE      pRoot;
-    /** Offset to the block allocation bitmap in bytes. */
-    uint64_t          offBlksBitmap;
-    /** Block map. */
-    PVCIBLKMAP        pBlkMap;
+    /** UUID of the image. */
+    RTUUID            ImageUuid;
+    /** Modification UUID of the image. */
+    RTUUID            ModificationUuid;
+    /** Flag whether the header on disk is marked as unclean by us and
+     * the state has to be saved when closing. */
+    bool              fHdrUnclean;
+    /** Flag whether a line must miss twice before it may replace another. */
+    bool              fAdmitOnSecondMiss;
+
+    /** Offset of the line table in bytes. */
+    uint64_t          offLineTbl;
+    /** Offset of the first cache line in bytes. */
+    uint64_t          offData;
+    /** Number of cache lines. */
+    uint32_t          cLines;
+    /** Number of lines caching data. */
+    uint32_t          cLinesUsed;
+    /** Array of all cache lines. */
+    PVCILINE          paLines;
+    /** Tree of used lines, indexed by the line of the virtual disk. */
+    AVLRU64TREE       TreeLines;
+    /** Used lines, most recently used first. */
+    RTLISTANCHOR      ListLru;
+    /** Unused lines. */
+    RTLISTANCHOR      ListFree;
+    /** Ghost table of recently missed lines (disk line + 1, 0 if empty). */
+    uint64_t         *pau64Ghost;
+    /** Mask for indexing the ghost table. */
+    uint32_t          fGhostMask;
+
+    /** Statistics: Bytes read from the cache. */
+    uint64_t          cbReadHit;
+    /** Statistics: Bytes not found in the cache. */
+    uint64_t          cbReadMiss;
+    /** Statistics: Bytes written to the cache. */
+    uint64_t          cbFilled;
+    /** Statistics: Fills rejected by the admission policy. */
+    uint64_t          cFillsRejected;
+    /** Statistics: Lines evicted. */
+    uint64_t          cEvictions;
+    /** Statistics: Bytes invalidated. */
+    uint64_t          cbInvalidated;
 } VCICACHE, *PVCICACHE;
 
-/** No block free in bitmap error code. */
-#define VERR_VCI_NO_BLOCKS_FREE (-65536)
-
-/** Flags for the block map allocator. */
-#define VCIBLKMAP_ALLOC_DATA 0
-#define VCIBLKMAP_ALLOC_META RT_BIT(0)
-#define VCIBLKMAP_ALLOC_MASK 0x1
-
 
 /*********************************************************************************************************************************
 *   Static Variables                                                                                                             *
@@ -387,6 +273,15 @@ static const char *const s_apszVciFileExtensions[] =
     NULL
 };
 
+/** Configuration keys of a cache. */
+static const VDCONFIGINFO s_vciConfigInfo[] =
+{
+    /* Evaluated by the generic VD layer: "around" or "through". */
+    { "WriteMode",         "around", VDCFGVALUETYPE_STRING,  0 },
+    { "AdmitOnSecondMiss", "1",      VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                NULL,     VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -409,794 +304,448 @@ static int vciFlushImage(PVCICACHE pCache)
 }
 
 /**
- * Internal. Free all allocated space for representing an image except pCache,
- * and optionally delete the image from disk.
+ * Internal. Writes the header of the image.
+ *
+ * @returns VBox status code.
+ * @param   pCache      The cache image instance.
+ * @param   fUnclean    Flag whether to mark the cache as in use.
  */
-static int vciFreeImage(PVCICACHE pCache, bool fDelete)
+static int vciHdrUpdate(PVCICACHE pCache, bool fUnclean)
 {
-    int rc = VINF_SUCCESS;
-
-    /* Freeing a never allocated image (e.g. because the open failed) is
-     * not signalled as an error. After all nothing bad happens. */
-    if (pCache)
-    {
-        if (pCache->pStorage)
-        {
-            /* No point updating the file that is deleted anyway. */
-            if (!fDelete)
-                vciFlushImage(pCache);
-
-            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
-            pCache->pStorage = NULL;
-        }
-
-        if (fDelete && pCache->pszFilename)
-            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
-    }
+    VciHdr Hdr;
 
-    LogFlowFunc(("returns %Rrc\n", rc));
-    return rc;
+    memset(&Hdr, 0, sizeof(Hdr));
+    Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
+    Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
+    Hdr.cbCache          = RT_H2LE_U64(pCache->cbSize);
+    Hdr.fUncleanShutdown = fUnclean ? VCI_HDR_UNCLEAN_SHUTDOWN : VCI_HDR_CLEAN_SHUTDOWN;
+    Hdr.u32CacheType     = pCache->uImageFlags & VD_IMAGE_FLAGS_FIXED
+                           ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
+                           : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
+    Hdr.offLineTbl       = RT_H2LE_U64(pCache->offLineTbl);
+    Hdr.cLines           = RT_H2LE_U32(pCache->cLines);
+    Hdr.cbLine           = RT_H2LE_U32(VCI_LINE_SIZE);
+    Hdr.offData          = RT_H2LE_U64(pCache->offData);
+    Hdr.uuidImage        = pCache->ImageUuid;
+    Hdr.uuidModification = pCache->ModificationUuid;
+
+    return vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
 }
 
 /**
- * Creates a new block map which can manage the given number of blocks.
- *
- * The size of the bitmap is aligned to the VCI block size.
- *
- * @returns VBox status code.
- * @param   cBlocks      The number of blocks the bitmap can manage.
- * @param   ppBlkMap     Where to store the pointer to the block bitmap.
- * @param   pcbBlkMap    Where to store the size of the block bitmap in blocks
- *                       needed on the disk.
+ * Internal. Checks whether a line holds no valid data.
  */
-static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcBlkMap)
+DECLINLINE(bool) vciLineIsEmpty(PVCILINE pLine)
 {
-    int rc = VINF_SUCCESS;
-    uint32_t cbBlkMap = RT_ALIGN_Z(cBlocks / sizeof(VciBlkMapEnt) / 8, VCI_BLOCK_SIZE);
-    PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-    PVCIBLKRANGEDESC pFree   = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-    LogFlowFunc(("cBlocks=%u ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
-
-    if (pBlkMap && pFree)
-    {
-        pBlkMap->cBlocks          = cBlocks;
-        pBlkMap->cBlocksAllocMeta = 0;
-        pBlkMap->cBlocksAllocData = 0;
-        pBlkMap->cBlocksFree      = cBlocks;
-
-        pFree->pPrev = NULL;
-        pFree->pNext = NULL;
-        pFree->offAddrStart = 0;
-        pFree->cBlocks      = cBlocks;
-        pFree->fFree        = true;
-
-        pBlkMap->pRangesHead = pFree;
-        pBlkMap->pRangesTail = pFree;
-
-        Assert(!((cbBlkMap + sizeof(VciBlkMap)) % VCI_BLOCK_SIZE));
-        *ppBlkMap = pBlkMap;
-        *pcBlkMap = VCI_BYTE2BLOCK(cbBlkMap + sizeof(VciBlkMap));
-    }
-    else
-    {
-        if (pBlkMap)
-            RTMemFree(pBlkMap);
-        if (pFree)
-            RTMemFree(pFree);
+    return !(pLine->au64Valid[0] | pLine->au64Valid[1]);
+}
 
-        rc = VERR_NO_MEMORY;
-    }
+/**
+ * Internal. Moves the given line to the head of the LRU list.
+ */
+DECLINLINE(void) vciLineTouch(PVCICACHE pCache, PVCILINE pLine)
+{
+    RTListNodeRemove(&pLine->NodeLru);
+    RTListPrepend(&pCache->ListLru, &pLine->NodeLru);
+    pLine->u64TsLastUse = RTTimeMilliTS();
+}
 
-    LogFlowFunc(("returns rc=%Rrc cBlkMap=%u\n", rc, *pcBlkMap));
-    return rc;
+/**
+ * Internal. Returns a used line to the free list.
+ */
+static void vciLineFree(PVCICACHE pCache, PVCILINE pLine)
+{
+    Assert(pLine->fUsed && !pLine->cFillsPending);
+
+    PAVLRU64NODECORE pCore = RTAvlrU64Remove(&pCache->TreeLines, pLine->Core.Key);
+    Assert(pCore == &pLine->Core); NOREF(pCore);
+    pLine->fUsed = false;
+    pLine->uGen++;
+    pLine->au64Valid[0] = 0;
+    pLine->au64Valid[1] = 0;
+    RTListNodeRemove(&pLine->NodeLru);
+    RTListAppend(&pCache->ListFree, &pLine->NodeLru);
+    pCache->cLinesUsed--;
 }
 
 /**
- * Frees a block map.
+ * Internal. Evicts the least recently used line which is not busy.
  *
- * @returns nothing.
- * @param   pBlkMap         The block bitmap to destroy.
+ * @returns Pointer to the evicted line, still linked into the LRU list.
+ * @returns NULL if no line can be evicted right now.
+ * @param   pCache      The cache image instance.
  */
-static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
+static PVCILINE vciLineEvict(PVCICACHE pCache)
 {
-    LogFlowFunc(("pBlkMap=%#p\n", pBlkMap));
+    uint64_t u64Now = RTTimeMilliTS();
+    PVCILINE pLine = RTListGetLast(&pCache->ListLru, VCILINE, NodeLru);
 
-    PVCIBLKRANGEDESC pRangeCur = pBlkMap->pRangesHead;
-
-    while (pRangeCur)
+    for (unsigned i = 0; pLine && i < VCI_LINE_EVICT_SCAN_MAX; i++)
     {
-        PVCIBLKRANGEDESC pTmp = pRangeCur;
+        /* The tail holds the oldest lines, if it is too young all the others are too. */
+        if (u64Now - pLine->u64TsLastUse < VCI_LINE_EVICT_MIN_AGE_MS)
+            break;
 
-        RTMemFree(pTmp);
+        if (!pLine->cFillsPending)
+        {
+            PAVLRU64NODECORE pCore = RTAvlrU64Remove(&pCache->TreeLines, pLine->Core.Key);
+            Assert(pCore == &pLine->Core); NOREF(pCore);
+            pLine->fUsed = false;
+            pLine->uGen++;
+            pLine->au64Valid[0] = 0;
+            pLine->au64Valid[1] = 0;
+            pCache->cLinesUsed--;
+            pCache->cEvictions++;
+            return pLine;
+        }
 
-        pRangeCur = pRangeCur->pNext;
+        pLine = RTListGetPrev(&pCache->ListLru, pLine, VCILINE, NodeLru);
     }
 
-    RTMemFree(pBlkMap);
-
-    LogFlowFunc(("returns\n"));
+    return NULL;
 }
 
 /**
- * Loads the block map from the specified medium and creates all necessary
- * in memory structures to manage used and free blocks.
+ * Internal. Checks whether the given disk line missed recently and records
+ * the miss otherwise.
  *
- * @returns VBox status code.
- * @param   pStorage        Storage handle to read the block bitmap from.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
- * @param   ppBlkMap        Where to store the block bitmap on success.
+ * @returns true if the line missed before, false otherwise.
  */
-static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap, PVCIBLKMAP *ppBlkMap)
+static bool vciGhostCheckAndSet(PVCICACHE pCache, uint64_t uDiskLine)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
-
-    LogFlowFunc(("pStorage=%#p offBlkMap=%llu cBlkMap=%u ppBlkMap=%#p\n",
-                 pStorage, offBlkMap, cBlkMap, ppBlkMap));
+    uint32_t idx = (uint32_t)((uDiskLine * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & pCache->fGhostMask;
 
-    if (cBlkMap >= VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
+    if (pCache->pau64Ghost[idx] == uDiskLine + 1)
     {
-        cBlkMap -= VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                   &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
-        {
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-            BlkMap.u32Magic         = RT_LE2H_U32(BlkMap.u32Magic);
-            BlkMap.u32Version       = RT_LE2H_U32(BlkMap.u32Version);
-            BlkMap.cBlocks          = RT_LE2H_U32(BlkMap.cBlocks);
-            BlkMap.cBlocksFree      = RT_LE2H_U32(BlkMap.cBlocksFree);
-            BlkMap.cBlocksAllocMeta = RT_LE2H_U32(BlkMap.cBlocksAllocMeta);
-            BlkMap.cBlocksAllocData = RT_LE2H_U32(BlkMap.cBlocksAllocData);
-
-            if (   BlkMap.u32Magic == VCI_BLKMAP_MAGIC
-                && BlkMap.u32Version == VCI_BLKMAP_VERSION
-                && BlkMap.cBlocks == BlkMap.cBlocksFree + BlkMap.cBlocksAllocMeta + BlkMap.cBlocksAllocData
-                && VCI_BYTE2BLOCK(BlkMap.cBlocks / 8) == cBlkMap)
-            {
-                PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
-                if (pBlkMap)
-                {
-                    pBlkMap->cBlocks          = BlkMap.cBlocks;
-                    pBlkMap->cBlocksFree      = BlkMap.cBlocksFree;
-                    pBlkMap->cBlocksAllocMeta = BlkMap.cBlocksAllocMeta;
-                    pBlkMap->cBlocksAllocData = BlkMap.cBlocksAllocData;
-
-                    /* Load the bitmap and construct the range list. */
-                    uint32_t cBlocksFree = 0;
-                    uint32_t cBlocksAllocated = 0;
-                    PVCIBLKRANGEDESC pRangeCur = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-
-                    if (pRangeCur)
-                    {
-                        uint8_t abBitmapBuffer[16 * _1K];
-                        uint32_t cBlocksRead = 0;
-                        uint64_t cBlocksLeft = VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8);
-
-                        cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                   offBlkMap, abBitmapBuffer,
-                                                   cBlocksRead);
-
-                        if (RT_SUCCESS(rc))
-                        {
-                            pRangeCur->fFree        = !(abBitmapBuffer[0] & 0x01);
-                            pRangeCur->offAddrStart = 0;
-                            pRangeCur->cBlocks      = 0;
-                            pRangeCur->pNext        = NULL;
-                            pRangeCur->pPrev        = NULL;
-                            pBlkMap->pRangesHead = pRangeCur;
-                            pBlkMap->pRangesTail = pRangeCur;
-                        }
-                        else
-                            RTMemFree(pRangeCur);
-
-                        while (   RT_SUCCESS(rc)
-                               && cBlocksLeft)
-                        {
-                            int iBit = 0;
-                            uint32_t cBits = VCI_BLOCK2BYTE(cBlocksRead) * 8;
-                            uint32_t iBitPrev = 0xffffffff;
-
-                            while (cBits)
-                            {
-                                if (pRangeCur->fFree)
-                                {
-                                    /* Check for the first set bit. */
-                                    iBit = ASMBitNextSet(abBitmapBuffer, cBits, iBitPrev);
-                                }
-                                else
-                                {
-                                    /* Check for the first free bit. */
-                                    iBit = ASMBitNextClear(abBitmapBuffer, cBits, iBitPrev);
-                                }
-
-                                if (iBit == -1)
-                                {
-                                    /* No change. */
-                                    pRangeCur->cBlocks += cBits;
-                                    cBits = 0;
-                                }
-                                else
-                                {
-                                    Assert((uint32_t)iBit < cBits);
-                                    pRangeCur->cBlocks += iBit;
-
-                                    /* Create a new range descriptor. */
-                                    PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-                                    if (!pRangeNew)
-                                    {
-                                        rc = VERR_NO_MEMORY;
-                                        break;
-                                    }
-
-                                    pRangeNew->fFree = !pRangeCur->fFree;
-                                    pRangeNew->offAddrStart = pRangeCur->offAddrStart + pRangeCur->cBlocks;
-                                    pRangeNew->cBlocks = 0;
-                                    pRangeNew->pPrev = pRangeCur;
-                                    pRangeCur->pNext = pRangeNew;
-                                    pBlkMap->pRangesTail = pRangeNew;
-                                    pRangeCur = pRangeNew;
-                                    cBits -= iBit;
-                                    iBitPrev = iBit;
-                                }
-                            }
-
-                            cBlocksLeft -= cBlocksRead;
-                            offBlkMap   += cBlocksRead;
-
-                            if (   RT_SUCCESS(rc)
-                                && cBlocksLeft)
-                            {
-                                /* Read next chunk. */
-                                cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                                rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                           offBlkMap, abBitmapBuffer, cBlocksRead);
-                            }
-                        }
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-
-                    if (RT_SUCCESS(rc))
-                    {
-                        *ppBlkMap = pBlkMap;
-                        LogFlowFunc(("return success\n"));
-                        return VINF_SUCCESS;
-                    }
-                    else
-                        RTMemFree(pBlkMap);
-                }
-                else
-                    rc = VERR_NO_MEMORY;
-            }
-            else
-                rc = VERR_VD_GEN_INVALID_HEADER;
-        }
-        else
-            rc = VERR_VD_GEN_INVALID_HEADER;
+        pCache->pau64Ghost[idx] = 0;
+        return true;
     }
-    else
-        rc = VERR_VD_GEN_INVALID_HEADER;
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    pCache->pau64Ghost[idx] = uDiskLine + 1;
+    return false;
 }
 
 /**
- * Saves the block map in the cache image. All necessary on disk structures
- * are written.
+ * Internal. Allocates a line for the given line of the virtual disk, evicting
+ * another one if the cache is full and the admission policy agrees.
  *
- * @returns VBox status code.
- * @param   pBlkMap         The block bitmap to save.
- * @param   pStorage        Where the block bitmap should be written to.
- * @param   offBlkMap       Start of the block bitmap in blocks.
- * @param   cBlkMap         Size of the block bitmap on the disk in blocks.
+ * @returns Pointer to the line, NULL if the data should not be cached.
+ * @param   pCache      The cache image instance.
+ * @param   uDiskLine   The line of the virtual disk.
  */
-static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMap)
+static PVCILINE vciLineAlloc(PVCICACHE pCache, uint64_t uDiskLine)
 {
-    int rc = VINF_SUCCESS;
-    VciBlkMap BlkMap;
-
-    LogFlowFunc(("pBlkMap=%#p pStorage=%#p offBlkMap=%llu cBlkMap=%u\n",
-                 pBlkMap, pStorage, offBlkMap, cBlkMap));
+    PVCILINE pLine = RTListGetFirst(&pCache->ListFree, VCILINE, NodeLru);
 
-    /* Make sure the number of blocks allocated for us match our expectations. */
-    if (VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)) == cBlkMap)
+    if (!pLine)
     {
-        /* Setup the header */
-        memset(&BlkMap, 0, sizeof(VciBlkMap));
-
-        BlkMap.u32Magic         = RT_H2LE_U32(VCI_BLKMAP_MAGIC);
-        BlkMap.u32Version       = RT_H2LE_U32(VCI_BLKMAP_VERSION);
-        BlkMap.cBlocks          = RT_H2LE_U32(pBlkMap->cBlocks);
-        BlkMap.cBlocksFree      = RT_H2LE_U32(pBlkMap->cBlocksFree);
-        BlkMap.cBlocksAllocMeta = RT_H2LE_U32(pBlkMap->cBlocksAllocMeta);
-        BlkMap.cBlocksAllocData = RT_H2LE_U32(pBlkMap->cBlocksAllocData);
-
-        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                    &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
-        if (RT_SUCCESS(rc))
+        /* Don't let one-time accesses (scans) flush the working set out of a full cache. */
+        if (   pCache->fAdmitOnSecondMiss
+            && !vciGhostCheckAndSet(pCache, uDiskLine))
         {
-            uint8_t abBitmapBuffer[16*_1K];
-            unsigned iBit = 0;
-            PVCIBLKRANGEDESC pCur = pBlkMap->pRangesHead;
-
-            offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-            /* Write the descriptor ranges. */
-            while (pCur)
-            {
-                uint64_t cBlocks = pCur->cBlocks;
-
-                while (cBlocks)
-                {
-                    uint64_t cBlocksMax = RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
-
-                    if (pCur->fFree)
-                        ASMBitClearRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-                    else
-                        ASMBitSetRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-
-                    iBit    += cBlocksMax;
-                    cBlocks -= cBlocksMax;
-
-                    if (iBit == sizeof(abBitmapBuffer) * 8)
-                    {
-                        /* Buffer is full, write to file and reset. */
-                        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                                    offBlkMap, abBitmapBuffer,
-                                                    VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)));
-                        if (RT_FAILURE(rc))
-                            break;
-
-                        offBlkMap += VCI_BYTE2BLOCK(sizeof(abBitmapBuffer));
-                        iBit = 0;
-                    }
-                }
-
-                pCur = pCur->pNext;
-            }
-
-            Assert(iBit % 8 == 0);
+            pCache->cFillsRejected++;
+            return NULL;
+        }
 
-            if (RT_SUCCESS(rc) && iBit)
-                rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                            offBlkMap, abBitmapBuffer, VCI_BYTE2BLOCK(iBit / 8));
+        pLine = vciLineEvict(pCache);
+        if (!pLine)
+        {
+            pCache->cFillsRejected++;
+            return NULL;
         }
     }
-    else
-        rc = VERR_INTERNAL_ERROR; /* @todo Better error code. */
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    pLine->Core.Key     = uDiskLine;
+    pLine->Core.KeyLast = uDiskLine;
+    bool fInserted = RTAvlrU64Insert(&pCache->TreeLines, &pLine->Core);
+    Assert(fInserted); NOREF(fInserted);
+    pLine->fUsed = true;
+    pCache->cLinesUsed++;
+    vciLineTouch(pCache, pLine);
+
+    return pLine;
 }
 
 /**
- * Finds the range block describing the given block address.
- *
- * @returns Pointer to the block range descriptor or NULL if none could be found.
- * @param   pBlkMap         The block bitmap to search on.
- * @param   offBlockAddr    The block address to search for.
+ * Internal. Invalidates the part of a line overlapping the given range of the
+ * virtual disk, freeing the line if nothing valid is left.
  */
-static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr)
+static void vciLineInvalidate(PVCICACHE pCache, PVCILINE pLine, uint64_t uOffset, uint64_t uOffsetEnd)
 {
-    PVCIBLKRANGEDESC pBlk = pBlkMap->pRangesHead;
+    uint64_t offLine = pLine->Core.Key * VCI_LINE_SIZE;
+    int32_t iBlockStart = uOffset > offLine ? (int32_t)VCI_BYTE2BLOCK(uOffset - offLine) : 0;
+    int32_t iBlockEnd   = uOffsetEnd < offLine + VCI_LINE_SIZE
+                        ? (int32_t)VCI_BYTE2BLOCK(uOffsetEnd - offLine + VCI_BLOCK_SIZE - 1)
+                        : VCI_LINE_BLOCKS;
+
+    ASMBitClearRange(pLine->au64Valid, iBlockStart, iBlockEnd);
+    /* Keeps fills in flight from validating stale data. */
+    pLine->uGen++;
+    if (   !pLine->cFillsPending
+        && vciLineIsEmpty(pLine))
+        vciLineFree(pCache, pLine);
+}
+
+/**
+ * Internal. Allocates the in memory line state and puts all lines onto the
+ * free list.
+ */
+static int vciLinesInit(PVCICACHE pCache)
+{
+    uint32_t cGhost = VCI_GHOST_ENTRIES_MIN;
+
+    while (   cGhost < pCache->cLines / 2
+           && cGhost < RT_BIT_32(30))
+        cGhost <<= 1;
+
+    pCache->paLines    = (PVCILINE)RTMemAllocZ(pCache->cLines * sizeof(VCILINE));
+    pCache->pau64Ghost = (uint64_t *)RTMemAllocZ(cGhost * sizeof(uint64_t));
+    if (   !pCache->paLines
+        || !pCache->pau64Ghost)
+        return VERR_NO_MEMORY;
+
+    pCache->fGhostMask = cGhost - 1;
+    pCache->cLinesUsed = 0;
+    pCache->TreeLines  = NULL;
+    RTListInit(&pCache->ListLru);
+    RTListInit(&pCache->ListFree);
 
-    while (   pBlk
-           && pBlk->offAddrStart < offBlockAddr)
-        pBlk = pBlk->pNext;
+    for (uint32_t i = 0; i < pCache->cLines; i++)
+    {
+        pCache->paLines[i].idxSlot = i;
+        RTListAppend(&pCache->ListFree, &pCache->paLines[i].NodeLru);
+    }
 
-    return pBlk;
+    return VINF_SUCCESS;
 }
 
 /**
- * Allocates the given number of blocks in the bitmap and returns the start block address.
- *
- * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocks          How many blocks to allocate.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * Internal. Loads the line table of a cleanly closed cache, restoring the
+ * LRU order. Inconsistent entries are dropped.
  */
-static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint32_t cBlocks, uint32_t fFlags,
-                             uint64_t *poffBlockAddr)
+static int vciLineTblLoad(PVCICACHE pCache)
 {
-    PVCIBLKRANGEDESC pBestFit = NULL;
-    PVCIBLKRANGEDESC pCur = NULL;
     int rc = VINF_SUCCESS;
+    RTLISTANCHOR ListUnranked;
+    PVciLineEnt paEnt = (PVciLineEnt)RTMemAlloc(VCI_LINE_TBL_CHUNK * sizeof(VciLineEnt));
+    PVCILINE *papRanked = (PVCILINE *)RTMemAllocZ(pCache->cLines * sizeof(PVCILINE));
 
-    LogFlowFunc(("pBlkMap=%#p cBlocks=%u poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocks, poffBlockAddr));
-
-    pCur = pBlkMap->pRangesHead;
-
-    while (pCur)
+    if (   !paEnt
+        || !papRanked)
     {
-        if (   pCur->fFree
-            && pCur->cBlocks >= cBlocks)
-        {
-            if (   !pBestFit
-                || pCur->cBlocks < pBestFit->cBlocks)
-            {
-                pBestFit = pCur;
-                /* Stop searching if the size is matching exactly. */
-                if (pBestFit->cBlocks == cBlocks)
-                    break;
-            }
-        }
-        pCur = pCur->pNext;
+        RTMemFree(paEnt);
+        RTMemFree(papRanked);
+        return VERR_NO_MEMORY;
     }
 
-    Assert(!pBestFit || pBestFit->fFree);
+    RTListInit(&ListUnranked);
 
-    if (pBestFit)
+    for (uint32_t idxSlot = 0; idxSlot < pCache->cLines && RT_SUCCESS(rc); idxSlot += VCI_LINE_TBL_CHUNK)
     {
-        pBestFit->fFree = false;
+        uint32_t cEnt = RT_MIN(pCache->cLines - idxSlot, VCI_LINE_TBL_CHUNK);
 
-        if (pBestFit->cBlocks > cBlocks)
+        rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
+                                   pCache->offLineTbl + (uint64_t)idxSlot * sizeof(VciLineEnt),
+                                   paEnt, cEnt * sizeof(VciLineEnt));
+        for (uint32_t i = 0; i < cEnt && RT_SUCCESS(rc); i++)
         {
-            /* Create a new free block. */
-            PVCIBLKRANGEDESC pFree = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+            PVCILINE pLine = &pCache->paLines[idxSlot + i];
 
-            if (pFree)
+            if (!(RT_LE2H_U32(paEnt[i].u32Flags) & VCI_LINE_ENT_F_USED))
+                continue;
+
+            pLine->Core.Key     = RT_LE2H_U64(paEnt[i].u64DiskLine);
+            pLine->Core.KeyLast = pLine->Core.Key;
+            pLine->au64Valid[0] = RT_LE2H_U64(paEnt[i].au64Valid[0]);
+            pLine->au64Valid[1] = RT_LE2H_U64(paEnt[i].au64Valid[1]);
+            if (   vciLineIsEmpty(pLine)
+                || !RTAvlrU64Insert(&pCache->TreeLines, &pLine->Core))
             {
-                pFree->fFree = true;
-                pFree->cBlocks = pBestFit->cBlocks - cBlocks;
-                pBestFit->cBlocks -= pFree->cBlocks;
-                pFree->offAddrStart = pBestFit->offAddrStart + cBlocks;
-
-                /* Link into the list. */
-                pFree->pNext = pBestFit->pNext;
-                pBestFit->pNext = pFree;
-                pFree->pPrev    = pBestFit;
-                if (!pFree->pNext)
-                    pBlkMap->pRangesTail = pFree;
-
-                *poffBlockAddr = pBestFit->offAddrStart;
+                pLine->au64Valid[0] = 0;
+                pLine->au64Valid[1] = 0;
+                continue;
             }
+
+            pLine->fUsed = true;
+            pCache->cLinesUsed++;
+            RTListNodeRemove(&pLine->NodeLru);
+
+            uint32_t uRank = RT_LE2H_U32(paEnt[i].u32LruRank);
+            if (   uRank < pCache->cLines
+                && !papRanked[uRank])
+                papRanked[uRank] = pLine;
             else
-            {
-                rc = VERR_NO_MEMORY;
-                pBestFit->fFree = true;
-            }
+                RTListAppend(&ListUnranked, &pLine->NodeLru);
         }
     }
-    else
-        rc = VERR_VCI_NO_BLOCKS_FREE;
 
     if (RT_SUCCESS(rc))
     {
-        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-            pBlkMap->cBlocksAllocMeta += cBlocks;
-        else
-            pBlkMap->cBlocksAllocData += cBlocks;
-
-        pBlkMap->cBlocksFree -= cBlocks;
+        for (uint32_t i = 0; i < pCache->cLines; i++)
+            if (papRanked[i])
+                RTListAppend(&pCache->ListLru, &papRanked[i]->NodeLru);
+        RTListConcatenate(&pCache->ListLru, &ListUnranked);
     }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
+    RTMemFree(papRanked);
+    RTMemFree(paEnt);
     return rc;
 }
 
 /**
- * Try to extend the space of an already allocated block.
- *
- * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocksNew       How many blocks the extended block should have.
- * @param   offBlockAddrOld  The start address of the block to reallocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * Internal. Writes the line table to the image.
  */
-static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
-                            uint64_t *poffBlockAddr)
+static int vciLineTblSave(PVCICACHE pCache)
 {
     int rc = VINF_SUCCESS;
+    PVciLineEnt paEnt = (PVciLineEnt)RTMemAllocZ(VCI_LINE_TBL_CHUNK * sizeof(VciLineEnt));
+    uint32_t *pau32Rank = (uint32_t *)RTMemAllocZ(pCache->cLines * sizeof(uint32_t));
 
-    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
-
-    AssertMsgFailed(("Implement\n"));
-
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
-}
-
-/**
- * Frees a range of blocks.
- *
- * @returns nothing.
- * @param   pBlkMap          The block bitmap.
- * @param   offBlockAddr     Address of the first block to free.
- * @param   cBlocks          How many blocks to free.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
- */
-static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks,
-                          uint32_t fFlags)
-{
-    PVCIBLKRANGEDESC pBlk;
+    if (   !paEnt
+        || !pau32Rank)
+    {
+        RTMemFree(paEnt);
+        RTMemFree(pau32Rank);
+        return VERR_NO_MEMORY;
+    }
 
-    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
-                 pBlkMap, offBlockAddr, cBlocks));
+    uint32_t uRank = 0;
+    PVCILINE pIt;
+    RTListForEach(&pCache->ListLru, pIt, VCILINE, NodeLru)
+    {
+        pau32Rank[pIt->idxSlot] = uRank++;
+    }
 
-    while (cBlocks)
+    for (uint32_t idxSlot = 0; idxSlot < pCache->cLines && RT_SUCCESS(rc); idxSlot += VCI_LINE_TBL_CHUNK)
     {
-        pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
-        AssertPtr(pBlk);
+        uint32_t cEnt = RT_MIN(pCache->cLines - idxSlot, VCI_LINE_TBL_CHUNK);
 
-        /* Easy case, the whole block is freed. */
-        if (   pBlk->offAddrStart == offBlockAddr
-            && pBlk->cBlocks <= cBlocks)
+        for (uint32_t i = 0; i < cEnt; i++)
         {
-            pBlk->fFree = true;
-            cBlocks      -= pBlk->cBlocks;
-            offBlockAddr += pBlk->cBlocks;
+            PVCILINE pLine = &pCache->paLines[idxSlot + i];
 
-            /* Check if it is possible to merge free blocks. */
-            if (   pBlk->pPrev
-                && pBlk->pPrev->fFree)
+            if (   pLine->fUsed
+                && !vciLineIsEmpty(pLine))
             {
-                PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
-
-                Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
-                pBlkPrev->cBlocks += pBlk->cBlocks;
-                pBlkPrev->pNext = pBlk->pNext;
-                if (pBlk->pNext)
-                    pBlk->pNext->pPrev = pBlkPrev;
-                else
-                    pBlkMap->pRangesTail = pBlkPrev;
-
-                RTMemFree(pBlk);
-                pBlk = pBlkPrev;
+                paEnt[i].u64DiskLine  = RT_H2LE_U64(pLine->Core.Key);
+                paEnt[i].u32Flags     = RT_H2LE_U32(VCI_LINE_ENT_F_USED);
+                paEnt[i].u32LruRank   = RT_H2LE_U32(pau32Rank[idxSlot + i]);
+                paEnt[i].au64Valid[0] = RT_H2LE_U64(pLine->au64Valid[0]);
+                paEnt[i].au64Valid[1] = RT_H2LE_U64(pLine->au64Valid[1]);
             }
-
-            /* Now the one to the right. */
-            if (   pBlk->pNext
-                && pBlk->pNext->fFree)
-            {
-                PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
-
-                Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
-                pBlk->cBlocks += pBlkNext->cBlocks;
-                pBlk->pNext = pBlkNext->pNext;
-                if (pBlkNext->pNext)
-                    pBlkNext->pNext->pPrev = pBlk;
-                else
-                    pBlkMap->pRangesTail = pBlk;
-
-                RTMemFree(pBlkNext);
-            }
-        }
-        else
-        {
-            /* The block is intersecting. */
-            AssertMsgFailed(("TODO\n"));
+            else
+                memset(&paEnt[i], 0, sizeof(VciLineEnt));
         }
-    }
 
-    if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-        pBlkMap->cBlocksAllocMeta -= cBlocks;
-    else
-        pBlkMap->cBlocksAllocData -= cBlocks;
-
-    pBlkMap->cBlocksFree += cBlocks;
+        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage,
+                                    pCache->offLineTbl + (uint64_t)idxSlot * sizeof(VciLineEnt),
+                                    paEnt, cEnt * sizeof(VciLineEnt));
+    }
 
-    LogFlowFunc(("returns\n"));
+    RTMemFree(pau32Rank);
+    RTMemFree(paEnt);
+    return rc;
 }
 
 /**
- * Converts a tree node from the image to the in memory structure.
- *
- * @returns Pointer to the in memory tree node.
- * @param   offBlockAddrNode    Block address of the node.
- * @param   pNodeImage          Pointer to the image representation of the node.
+ * Internal. Releases the in memory line state.
  */
-static PVCITREENODE vciTreeNodeImage2Host(uint64_t offBlockAddrNode, PVciTreeNode pNodeImage)
+static void vciLinesDestroy(PVCICACHE pCache)
 {
-    PVCITREENODE pNode = NULL;
-
-    if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_LEAF)
+    if (pCache->paLines)
     {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)RTMemAllocZ(sizeof(VCITREENODELEAF));
-
-        if (pLeaf)
-        {
-            PVciCacheExtent pExtent = (PVciCacheExtent)&pNodeImage->au8Data[0];
-
-            pLeaf->Core.u8Type = VCI_TREE_NODE_TYPE_LEAF;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pLeaf->aExtents); idx++)
-            {
-                pLeaf->aExtents[idx].u64BlockOffset = RT_LE2H_U64(pExtent->u64BlockOffset);
-                pLeaf->aExtents[idx].u32Blocks      = RT_LE2H_U32(pExtent->u32Blocks);
-                pLeaf->aExtents[idx].u64BlockAddr   = RT_LE2H_U64(pExtent->u64BlockAddr);
-                pExtent++;
-
-                if (   pLeaf->aExtents[idx].u32Blocks
-                    && pLeaf->aExtents[idx].u64BlockAddr)
-                    pLeaf->cUsedNodes++;
-            }
-
-            pNode = &pLeaf->Core;
-        }
+        RTMemFree(pCache->paLines);
+        pCache->paLines = NULL;
     }
-    else if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
+    if (pCache->pau64Ghost)
     {
-        PVCITREENODEINT pInt = (PVCITREENODEINT)RTMemAllocZ(sizeof(VCITREENODEINT));
-
-        if (pInt)
-        {
-            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNodeImage->au8Data[0];
-
-            pInt->Core.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pInt->aIntNodes); idx++)
-            {
-                pInt->aIntNodes[idx].u64BlockOffset              = RT_LE2H_U64(pIntImage->u64BlockOffset);
-                pInt->aIntNodes[idx].u32Blocks                   = RT_LE2H_U32(pIntImage->u32Blocks);
-                pInt->aIntNodes[idx].PtrChild.fInMemory          = false;
-                pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode = RT_LE2H_U64(pIntImage->u64ChildAddr);
-                pIntImage++;
-
-                if (   pInt->aIntNodes[idx].u32Blocks
-                    && pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode)
-                    pInt->cUsedNodes++;
-            }
-
-            pNode = &pInt->Core;
-        }
+        RTMemFree(pCache->pau64Ghost);
+        pCache->pau64Ghost = NULL;
     }
-    else
-        AssertMsgFailed(("Invalid node type %d\n", pNodeImage->u8Type));
+    pCache->TreeLines  = NULL;
+    pCache->cLinesUsed = 0;
+}
 
-    if (pNode)
-        pNode->u64BlockAddr = offBlockAddrNode;
+/**
+ * Internal. Advances the I/O context over data which is not cached.
+ */
+static void vciIoCtxSkip(PVCICACHE pCache, PVDIOCTX pIoCtx, size_t cbSkip)
+{
+    RTSGSEG aSeg[8];
 
-    return pNode;
+    while (cbSkip)
+    {
+        unsigned cSeg = RT_ELEMENTS(aSeg);
+        size_t cbSeg = vdIfIoIntIoCtxSegArrayCreate(pCache->pIfIo, pIoCtx, aSeg, &cSeg, cbSkip);
+        if (!cbSeg)
+            break;
+        cbSkip -= cbSeg;
+    }
 }
 
 /**
- * Looks up the cache extent for the given virtual block address.
- *
- * @returns Pointer to the cache extent or NULL if none could be found.
- * @param   pCache         The cache image instance.
- * @param   offBlockOffset The block offset to search for.
- * @param   ppNextBestFit  Where to store the pointer to the next best fit
- *                         cache extent above offBlockOffset if existing. - Optional
- *                         This is always filled if possible even if the function returns NULL.
+ * Internal. Free all allocated space for representing an image except pCache,
+ * and optionally delete the image from disk.
  */
-static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset,
-                                            PVCICACHEEXTENT *ppNextBestFit)
+static int vciFreeImage(PVCICACHE pCache, bool fDelete)
 {
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent = NULL;
-    PVCITREENODE pNodeCur = pCache->pRoot;
 
-    while (   RT_SUCCESS(rc)
-           && pNodeCur
-           && pNodeCur->u8Type != VCI_TREE_NODE_TYPE_LEAF)
+    /* Freeing a never allocated image (e.g. because the open failed) is
+     * not signalled as an error. After all nothing bad happens. */
+    if (pCache)
     {
-        PVCITREENODEINT pNodeInt = (PVCITREENODEINT)pNodeCur;
-
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_INTERNAL);
-
-        /* Search for the correct internal node. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pNodeInt->cUsedNodes;
-        unsigned idxCur = pNodeInt->cUsedNodes / 2;
-
-        while (idxMin < idxMax)
+        if (pCache->pStorage)
         {
-            PVCINODEINTERNAL pInt = &pNodeInt->aIntNodes[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pInt->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pInt->u64BlockOffset + pInt->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
+            /* No point updating the file that is deleted anyway. */
+            if (!fDelete && pCache->fHdrUnclean)
             {
-                /* The block lies in the node, stop searching. */
-                if (pInt->PtrChild.fInMemory)
-                    pNodeCur = pInt->PtrChild.u.pNode;
-                else
-                {
-                    PVCITREENODE pNodeNew;
-                    VciTreeNode NodeTree;
-
-                    /* Read from disk and add to the tree. */
-                    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                               VCI_BLOCK2BYTE(pInt->PtrChild.u.offAddrBlockNode),
-                                               &NodeTree, sizeof(NodeTree));
-                    AssertRC(rc);
-
-                    pNodeNew = vciTreeNodeImage2Host(pInt->PtrChild.u.offAddrBlockNode, &NodeTree);
-                    if (pNodeNew)
-                    {
-                        /* Link to the parent. */
-                        pInt->PtrChild.fInMemory = true;
-                        pInt->PtrChild.u.pNode = pNodeNew;
-                        pNodeNew->pParent = pNodeCur;
-                        pNodeCur = pNodeNew;
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
-                }
-                break;
+                /* The header stays marked as unclean if anything fails and
+                 * the cached data is discarded on the next open. */
+                rc = vciLineTblSave(pCache);
+                if (RT_SUCCESS(rc))
+                    rc = vciFlushImage(pCache);
+                if (RT_SUCCESS(rc))
+                    rc = vciHdrUpdate(pCache, false /* fUnclean */);
+                if (RT_SUCCESS(rc))
+                    rc = vciFlushImage(pCache);
+                if (RT_FAILURE(rc))
+                    LogRel(("VCI: Failed to save the state of '%s' (%Rrc)\n", pCache->pszFilename, rc));
             }
+            pCache->fHdrUnclean = false;
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
-        }
-    }
-
-    if (   RT_SUCCESS(rc)
-        && pNodeCur)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)pNodeCur;
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_LEAF);
-
-        /* Search the range. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pLeaf->cUsedNodes;
-        unsigned idxCur = pLeaf->cUsedNodes / 2;
+            if (pCache->cbReadHit + pCache->cbReadMiss)
+                LogRel(("VCI: '%s': %llu bytes hit, %llu bytes missed (%llu%% hit rate), %llu bytes filled, "
+                        "%llu fills rejected, %llu evictions, %llu bytes invalidated\n",
+                        pCache->pszFilename, pCache->cbReadHit, pCache->cbReadMiss,
+                        pCache->cbReadHit * 100 / (pCache->cbReadHit + pCache->cbReadMiss),
+                        pCache->cbFilled, pCache->cFillsRejected, pCache->cEvictions,
+                        pCache->cbInvalidated));
 
-        while (idxMin < idxMax)
-        {
-            PVCICACHEEXTENT pExtentCur = &pLeaf->aExtents[idxCur];
-
-            /* Determine the search direction. */
-            if (offBlockOffset < pExtentCur->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pExtentCur->u64BlockOffset + pExtentCur->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* We found the extent, stop searching. */
-                pExtent = pExtentCur;
-                break;
-            }
-
-            idxCur = idxMin + (idxMax - idxMin) / 2;
+            vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
+            pCache->pStorage = NULL;
         }
 
-        /* Get the next best fit extent if it exists. */
-        if (ppNextBestFit)
-        {
-            if (idxCur < pLeaf->cUsedNodes - 1)
-                *ppNextBestFit = &pLeaf->aExtents[idxCur + 1];
-            else
-            {
-                /*
-                 * Go up the tree and find the best extent
-                 * in the leftmost tree of the child subtree to the right.
-                 */
-                PVCITREENODEINT pInt = (PVCITREENODEINT)pLeaf->Core.pParent;
+        vciLinesDestroy(pCache);
 
-                while (pInt)
-                {
-
-                }
-            }
-        }
+        if (fDelete && pCache->pszFilename)
+            vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
     }
 
-    return pExtent;
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Reads the configuration of the cache.
+ */
+static void vciQueryConfig(PVCICACHE pCache)
+{
+    PVDINTERFACECONFIG pIfCfg = VDIfConfigGet(pCache->pVDIfsImage);
+
+    pCache->fAdmitOnSecondMiss = true;
+    if (pIfCfg)
+        VDCFGQueryBoolDef(pIfCfg, "AdmitOnSecondMiss", &pCache->fAdmitOnSecondMiss, true);
 }
 
 /**
@@ -1214,6 +763,8 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     pCache->pIfIo = VDIfIoIntGet(pCache->pVDIfsImage);
     AssertPtrReturn(pCache->pIfIo, VERR_INVALID_PARAMETER);
 
+    vciQueryConfig(pCache);
+
     /*
      * Open the image.
      */
@@ -1235,8 +786,7 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
         goto out;
     }
 
-    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr,
-                               VCI_BYTE2BLOCK(sizeof(Hdr)));
+    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
     if (RT_FAILURE(rc))
     {
         rc = VERR_VD_GEN_INVALID_HEADER;
@@ -1245,38 +795,65 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
 
     Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
     Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
+    Hdr.cbCache      = RT_LE2H_U64(Hdr.cbCache);
     Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
+    Hdr.offLineTbl   = RT_LE2H_U64(Hdr.offLineTbl);
+    Hdr.cLines       = RT_LE2H_U32(Hdr.cLines);
+    Hdr.cbLine       = RT_LE2H_U32(Hdr.cbLine);
+    Hdr.offData      = RT_LE2H_U64(Hdr.offData);
 
-    if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
-        && Hdr.u32Version == VCI_HDR_VERSION)
+    if (   Hdr.u32Signature != VCI_HDR_SIGNATURE
+        || Hdr.u32Version != VCI_HDR_VERSION)
     {
-        pCache->offTreeRoot   = Hdr.offTreeRoot;
-        pCache->offBlksBitmap = Hdr.offBlkMap;
+        rc = VERR_VD_GEN_INVALID_HEADER;
+        goto out;
+    }
 
-        /* Load the block map. */
-        rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, Hdr.cBlkMap, &pCache->pBlkMap);
-        if (RT_SUCCESS(rc))
-        {
-            /* Load the first tree node. */
-            VciTreeNode RootNode;
+    if (   Hdr.cbLine != VCI_LINE_SIZE
+        || !Hdr.cLines
+        || Hdr.offLineTbl < sizeof(VciHdr)
+        || Hdr.offLineTbl + (uint64_t)Hdr.cLines * sizeof(VciLineEnt) > Hdr.offData
+        || Hdr.offData % VCI_LINE_SIZE
+        || Hdr.offData + (uint64_t)Hdr.cLines * VCI_LINE_SIZE > Hdr.cbCache)
+    {
+        rc = vdIfError(pCache->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       N_("VCI: invalid cache layout in '%s'"), pCache->pszFilename);
+        goto out;
+    }
 
-            rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                       pCache->offTreeRoot, &RootNode,
-                                       VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-            if (RT_SUCCESS(rc))
-            {
-                pCache->pRoot = vciTreeNodeImage2Host(pCache->offTreeRoot, &RootNode);
-                if (!pCache->pRoot)
-                    rc = VERR_NO_MEMORY;
-            }
-        }
+    pCache->cbSize           = Hdr.cbCache;
+    pCache->uImageFlags      = Hdr.u32CacheType == VCI_HDR_CACHE_TYPE_FIXED ? VD_IMAGE_FLAGS_FIXED : 0;
+    pCache->offLineTbl       = Hdr.offLineTbl;
+    pCache->offData          = Hdr.offData;
+    pCache->cLines           = Hdr.cLines;
+    pCache->ImageUuid        = Hdr.uuidImage;
+    pCache->ModificationUuid = Hdr.uuidModification;
+
+    rc = vciLinesInit(pCache);
+    if (RT_FAILURE(rc))
+        goto out;
+
+    /* The line table can't be trusted if the cache wasn't closed properly,
+     * start with an empty cache then. */
+    if (Hdr.fUncleanShutdown == VCI_HDR_CLEAN_SHUTDOWN)
+    {
+        rc = vciLineTblLoad(pCache);
+        if (RT_FAILURE(rc))
+            goto out;
     }
     else
-        rc = VERR_VD_GEN_INVALID_HEADER;
+        LogRel(("VCI: '%s' was not closed properly, discarding cached data\n", pCache->pszFilename));
+
+    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+    {
+        /* Mark the cache as in use, the line table on disk is stale from now on. */
+        rc = vciHdrUpdate(pCache, true /* fUnclean */);
+        if (RT_SUCCESS(rc))
+            rc = vciFlushImage(pCache);
+        if (RT_FAILURE(rc))
+            goto out;
+        pCache->fHdrUnclean = true;
+    }
 
 out:
     if (RT_FAILURE(rc))
@@ -1293,10 +870,10 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
                           void *pvUser, unsigned uPercentStart,
                           unsigned uPercentSpan)
 {
-    VciHdr Hdr;
-    VciTreeNode NodeRoot;
     int rc;
-    uint64_t cBlocks = cbSize / VCI_BLOCK_SIZE; /* Size of the cache in blocks. */
+    uint64_t cLines;
+
+    NOREF(pszComment);
 
     pCache->uImageFlags = uImageFlags;
     pCache->uOpenFlags = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
@@ -1311,6 +888,20 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
         return rc;
     }
 
+    /* Leave room for the header, the line table and aligning the data area. */
+    cLines = cbSize > VCI_LINE_TBL_OFFSET + VCI_LINE_SIZE
+           ? (cbSize - VCI_LINE_TBL_OFFSET - VCI_LINE_SIZE) / (VCI_LINE_SIZE + sizeof(VciLineEnt))
+           : 0;
+    if (   cLines < VCI_LINES_MIN
+        || cLines > UINT32_MAX)
+    {
+        rc = vdIfError(pCache->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS,
+                       N_("VCI: invalid cache size %llu for '%s'"), cbSize, pCache->pszFilename);
+        return rc;
+    }
+
+    vciQueryConfig(pCache);
+
     do
     {
         /* Create image file. */
@@ -1324,109 +915,47 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
             break;
         }
 
-        /* Allocate block bitmap. */
-        uint32_t cBlkMap = 0;
-        rc = vciBlkMapCreate(cBlocks, &pCache->pBlkMap, &cBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot create block bitmap '%s'"), pCache->pszFilename);
-            break;
-        }
+        pCache->cbSize     = cbSize;
+        pCache->cLines     = (uint32_t)cLines;
+        pCache->offLineTbl = VCI_LINE_TBL_OFFSET;
+        pCache->offData    = RT_ALIGN_64(VCI_LINE_TBL_OFFSET + cLines * sizeof(VciLineEnt), VCI_LINE_SIZE);
+        Assert(pCache->offData + cLines * VCI_LINE_SIZE <= cbSize);
 
-        /*
-         * Allocate space for the header in the block bitmap.
-         * Because the block map is empty the header has to start at block 0
-         */
-        uint64_t offHdr = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciHdr)), VCIBLKMAP_ALLOC_META, &offHdr);
-        if (RT_FAILURE(rc))
+        if (uImageFlags & VD_IMAGE_FLAGS_FIXED)
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for header in block bitmap '%s'"), pCache->pszFilename);
-            break;
+            rc = vdIfIoIntFileSetAllocationSize(pCache->pIfIo, pCache->pStorage, cbSize,
+                                                0 /* fFlags */, pfnProgress, pvUser,
+                                                uPercentStart, uPercentSpan);
+            if (RT_FAILURE(rc))
+            {
+                rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot set the file size for '%s'"), pCache->pszFilename);
+                break;
+            }
         }
 
-        Assert(offHdr == 0);
-
-        /*
-         * Allocate space for the block map itself.
-         */
-        uint64_t offBlkMap = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlkMap, VCIBLKMAP_ALLOC_META, &offBlkMap);
+        rc = vciLinesInit(pCache);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate the cache lines for '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate space for the tree root node.
-         */
-        uint64_t offTreeRoot = 0;
-        rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META, &offTreeRoot);
+        /* Write an empty line table. */
+        rc = vciLineTblSave(pCache);
         if (RT_FAILURE(rc))
         {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
+            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write line table '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate the in memory root node.
-         */
-        pCache->pRoot = (PVCITREENODE)RTMemAllocZ(sizeof(VCITREENODELEAF));
-        if (!pCache->pRoot)
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate B+-Tree root pointer '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        pCache->pRoot->u8Type = VCI_TREE_NODE_TYPE_LEAF;
-        /* Rest remains 0 as the tree is still empty. */
-
-        /*
-         * Now that we are here we have all the basic structures and know where to place them in the image.
-         * It's time to write it now.
-         */
-
-        /* Setup the header. */
-        memset(&Hdr, 0, sizeof(VciHdr));
-        Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
-        Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
-        Hdr.cBlocksCache     = RT_H2LE_U64(cBlocks);
-        Hdr.fUncleanShutdown = VCI_HDR_UNCLEAN_SHUTDOWN;
-        Hdr.u32CacheType     = uImageFlags & VD_IMAGE_FLAGS_FIXED
-                               ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
-                               : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
-        Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
-        Hdr.offBlkMap        = RT_H2LE_U64(offBlkMap);
-        Hdr.cBlkMap          = RT_H2LE_U32(cBlkMap);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offHdr, &Hdr,
-                                    VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        /* The cache stays open, so the header is marked as in use. */
+        rc = vciHdrUpdate(pCache, true /* fUnclean */);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
             break;
         }
 
-        rc = vciBlkMapSave(pCache->pBlkMap, pCache, offBlkMap, cBlkMap);
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write block map '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        /* Setup the root tree. */
-        memset(&NodeRoot, 0, sizeof(VciTreeNode));
-        NodeRoot.u8Type = RT_H2LE_U32(VCI_TREE_NODE_TYPE_LEAF);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offTreeRoot,
-                                    &NodeRoot, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-        if (RT_FAILURE(rc))
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
-            break;
-        }
-
         rc = vciFlushImage(pCache);
         if (RT_FAILURE(rc))
         {
@@ -1434,8 +963,7 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
             break;
         }
 
-        pCache->cbSize = cbSize;
-
+        pCache->fHdrUnclean = true;
     } while (0);
 
     if (RT_SUCCESS(rc) && pfnProgress)
@@ -1446,6 +974,37 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
     return rc;
 }
 
+/**
+ * Internal: Completion callback for a cache line fill.
+ */
+static DECLCALLBACK(int) vciFillComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    PVCIFILL pFill = (PVCIFILL)pvUser;
+    PVCILINE pLine = pFill->pLine;
+
+    NOREF(pIoCtx);
+    Assert(pLine->cFillsPending > 0);
+    pLine->cFillsPending--;
+
+    /* Only mark the data as valid if nothing was invalidated in the meantime. */
+    if (   RT_SUCCESS(rcReq)
+        && pLine->fUsed
+        && pLine->uGen == pFill->uGen)
+    {
+        ASMBitSetRange(pLine->au64Valid, pFill->iBlock, pFill->iBlock + pFill->cBlocks);
+        pCache->cbFilled += VCI_BLOCK2BYTE(pFill->cBlocks);
+    }
+
+    if (   pLine->fUsed
+        && !pLine->cFillsPending
+        && vciLineIsEmpty(pLine))
+        vciLineFree(pCache, pLine);
+
+    RTMemFree(pFill);
+    return VINF_SUCCESS;
+}
+
 /** @copydoc VDCACHEBACKEND::pfnProbe */
 static DECLCALLBACK(int) vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsCache,
                                   PVDINTERFACE pVDIfsImage)
@@ -1483,11 +1042,6 @@ static DECLCALLBACK(int) vciProbe(const char *pszFilename, PVDINTERFACE pVDIfsCa
 
     Hdr.u32Signature = RT_LE2H_U32(Hdr.u32Signature);
     Hdr.u32Version   = RT_LE2H_U32(Hdr.u32Version);
-    Hdr.cBlocksCache = RT_LE2H_U64(Hdr.cBlocksCache);
-    Hdr.u32CacheType = RT_LE2H_U32(Hdr.u32CacheType);
-    Hdr.offTreeRoot  = RT_LE2H_U64(Hdr.offTreeRoot);
-    Hdr.offBlkMap    = RT_LE2H_U64(Hdr.offBlkMap);
-    Hdr.cBlkMap      = RT_LE2H_U32(Hdr.cBlkMap);
 
     if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
         && Hdr.u32Version == VCI_HDR_VERSION)
@@ -1597,6 +1151,8 @@ static DECLCALLBACK(int) vciCreate(const char *pszFilename, uint64_t cbSize,
     pCache->pStorage = NULL;
     pCache->pVDIfsDisk = pVDIfsDisk;
     pCache->pVDIfsImage = pVDIfsImage;
+    if (pUuid)
+        pCache->ImageUuid = *pUuid;
 
     rc = vciCreateImage(pCache, cbSize, uImageFlags, pszComment, uOpenFlags,
                         pfnProgress, pvUser, uPercentStart, uPercentSpan);
@@ -1646,33 +1202,47 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
                  pBackendData, uOffset, cbToRead, pIoCtx, pcbActuallyRead));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent;
-    uint64_t cBlocksToRead = VCI_BYTE2BLOCK(cbToRead);
-    uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint64_t uDiskLine = uOffset / VCI_LINE_SIZE;
+    uint32_t iBlock    = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_LINE_SIZE);
+    uint32_t cBlocks   = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToRead), VCI_LINE_BLOCKS - iBlock);
+    PVCILINE pLine;
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToRead % 512 == 0);
 
-    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, NULL);
-    if (pExtent)
+    pLine = (PVCILINE)RTAvlrU64Get(&pCache->TreeLines, uDiskLine);
+    if (   pLine
+        && ASMBitTest(pLine->au64Valid, iBlock))
     {
-        uint64_t offRead = offBlockAddr - pExtent->u64BlockOffset;
-        cBlocksToRead = RT_MIN(cBlocksToRead, pExtent->u32Blocks - offRead);
+        /* Read the run of valid blocks. */
+        int iBlockEnd = ASMBitNextClear(pLine->au64Valid, VCI_LINE_BLOCKS, iBlock);
+        if (iBlockEnd != -1)
+            cBlocks = RT_MIN(cBlocks, (uint32_t)iBlockEnd - iBlock);
 
         rc = vdIfIoIntFileReadUser(pCache->pIfIo, pCache->pStorage,
-                                   pExtent->u64BlockAddr + offRead,
-                                   pIoCtx, cBlocksToRead);
+                                   pCache->offData + (uint64_t)pLine->idxSlot * VCI_LINE_SIZE
+                                   + VCI_BLOCK2BYTE(iBlock),
+                                   pIoCtx, VCI_BLOCK2BYTE(cBlocks));
+        vciLineTouch(pCache, pLine);
+        pCache->cbReadHit += VCI_BLOCK2BYTE(cBlocks);
     }
     else
     {
-        /** @todo Best fit to check whether we have cached data later and set
-         * pcbActuallyRead accordingly. */
+        /* Report the run of blocks which are not cached. */
+        if (pLine)
+        {
+            int iBlockNext = ASMBitNextSet(pLine->au64Valid, VCI_LINE_BLOCKS, iBlock);
+            if (iBlockNext != -1)
+                cBlocks = RT_MIN(cBlocks, (uint32_t)iBlockNext - iBlock);
+        }
+
         rc = VERR_VD_BLOCK_FREE;
+        pCache->cbReadMiss += VCI_BLOCK2BYTE(cBlocks);
     }
 
     if (pcbActuallyRead)
-        *pcbActuallyRead = VCI_BLOCK2BYTE(cBlocksToRead);
+        *pcbActuallyRead = VCI_BLOCK2BYTE(cBlocks);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1686,19 +1256,67 @@ static DECLCALLBACK(int) vciWrite(void *pBackendData, uint64_t uOffset, size_t c
                  pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
-    uint64_t cBlocksToWrite = VCI_BYTE2BLOCK(cbToWrite);
-    uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint64_t uDiskLine = uOffset / VCI_LINE_SIZE;
+    uint32_t iBlock    = (uint32_t)VCI_BYTE2BLOCK(uOffset % VCI_LINE_SIZE);
+    uint32_t cBlocks   = (uint32_t)RT_MIN(VCI_BYTE2BLOCK(cbToWrite), VCI_LINE_BLOCKS - iBlock);
+    bool fCached = false;
 
     AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToWrite % 512 == 0);
 
-    while (cBlocksToWrite)
+    if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
     {
+        PVCILINE pLine = (PVCILINE)RTAvlrU64Get(&pCache->TreeLines, uDiskLine);
+
+        if (!pLine)
+            pLine = vciLineAlloc(pCache, uDiskLine);
+        else if (pLine->cFillsPending)
+            pLine = NULL; /* Don't stack fills on a line, they could complete in any order. */
+        else if (ASMBitTest(pLine->au64Valid, iBlock))
+        {
+            int iBlockClear = ASMBitNextClear(pLine->au64Valid, VCI_LINE_BLOCKS, iBlock);
+            if (   iBlockClear == -1
+                || (uint32_t)iBlockClear >= iBlock + cBlocks)
+                pLine = NULL; /* Everything cached already. */
+        }
 
+        if (pLine)
+        {
+            PVCIFILL pFill = (PVCIFILL)RTMemAlloc(sizeof(VCIFILL));
+            if (pFill)
+            {
+                pFill->pLine   = pLine;
+                pFill->uGen    = pLine->uGen;
+                pFill->iBlock  = iBlock;
+                pFill->cBlocks = cBlocks;
+                pLine->cFillsPending++;
+                vciLineTouch(pCache, pLine);
+
+                rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage,
+                                            pCache->offData + (uint64_t)pLine->idxSlot * VCI_LINE_SIZE
+                                            + VCI_BLOCK2BYTE(iBlock),
+                                            pIoCtx, VCI_BLOCK2BYTE(cBlocks),
+                                            vciFillComplete, pFill);
+                if (RT_SUCCESS(rc))
+                    vciFillComplete(pCache, pIoCtx, pFill, rc); /* Not called for synchronous completions. */
+                else if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                {
+                    pLine->cFillsPending--;
+                    if (   !pLine->cFillsPending
+                        && vciLineIsEmpty(pLine))
+                        vciLineFree(pCache, pLine);
+                    RTMemFree(pFill);
+                }
+                fCached = true;
+            }
+        }
     }
 
-    *pcbWriteProcess = cbToWrite; /** @todo: Implement. */
+    if (!fCached)
+        vciIoCtxSkip(pCache, pIoCtx, VCI_BLOCK2BYTE(cBlocks));
+
+    *pcbWriteProcess = VCI_BLOCK2BYTE(cBlocks);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1708,12 +1326,76 @@ static DECLCALLBACK(int) vciWrite(void *pBackendData, uint64_t uOffset, size_t c
 static DECLCALLBACK(int) vciFlush(void *pBackendData, PVDIOCTX pIoCtx)
 {
     LogFlowFunc(("pBackendData=%#p\n", pBackendData));
+    NOREF(pBackendData); NOREF(pIoCtx);
+
+    /* Nothing to do, the cache content is only trusted after a clean close
+     * which flushes everything. */
+    LogFlowFunc(("returns %Rrc\n", VINF_SUCCESS));
+    return VINF_SUCCESS;
+}
+
+/** @copydoc VDCACHEBACKEND::pfnDiscard */
+static DECLCALLBACK(int) vciDiscard(void *pBackendData, PVDIOCTX pIoCtx,
+                                    uint64_t uOffset, size_t cbDiscard,
+                                    size_t *pcbPreAllocated, size_t *pcbPostAllocated,
+                                    size_t *pcbActuallyDiscarded, void **ppbmAllocationBitmap,
+                                    unsigned fDiscard)
+{
+    LogFlowFunc(("pBackendData=%#p pIoCtx=%#p uOffset=%llu cbDiscard=%zu pcbPreAllocated=%#p pcbPostAllocated=%#p pcbActuallyDiscarded=%#p ppbmAllocationBitmap=%#p fDiscard=%#x\n",
+                 pBackendData, pIoCtx, uOffset, cbDiscard, pcbPreAllocated, pcbPostAllocated, pcbActuallyDiscarded, ppbmAllocationBitmap, fDiscard));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
-    int rc = VINF_SUCCESS;
+    uint64_t uOffsetEnd = uOffset + cbDiscard;
+    uint64_t uDiskLineFirst = uOffset / VCI_LINE_SIZE;
+    uint64_t uDiskLineLast  = (uOffsetEnd - 1) / VCI_LINE_SIZE;
 
-    rc = vciFlushImage(pCache);
-    LogFlowFunc(("returns %Rrc\n", rc));
-    return rc;
+    NOREF(pIoCtx); NOREF(fDiscard);
+    AssertPtr(pCache);
+
+    /*
+     * Only the in memory state is changed. The line table on disk is not
+     * trusted while the cache is open read/write (the header is marked
+     * unclean), a crash makes the next open start with an empty cache and a
+     * clean close writes the table without the invalidated lines. A cache
+     * opened read-only keeps its old modification UUID if the disk is written,
+     * so the next open notices that the cache is not up to date.
+     */
+    if (cbDiscard)
+    {
+        if (uDiskLineLast - uDiskLineFirst >= pCache->cLinesUsed)
+        {
+            /* Large range, cheaper to walk the used lines. */
+            PVCILINE pIt, pItNext;
+            RTListForEachSafe(&pCache->ListLru, pIt, pItNext, VCILINE, NodeLru)
+            {
+                if (   pIt->Core.Key >= uDiskLineFirst
+                    && pIt->Core.Key <= uDiskLineLast)
+                    vciLineInvalidate(pCache, pIt, uOffset, uOffsetEnd);
+            }
+        }
+        else
+        {
+            for (uint64_t uDiskLine = uDiskLineFirst; uDiskLine <= uDiskLineLast; uDiskLine++)
+            {
+                PVCILINE pLine = (PVCILINE)RTAvlrU64Get(&pCache->TreeLines, uDiskLine);
+                if (pLine)
+                    vciLineInvalidate(pCache, pLine, uOffset, uOffsetEnd);
+            }
+        }
+
+        pCache->cbInvalidated += cbDiscard;
+    }
+
+    if (pcbPreAllocated)
+        *pcbPreAllocated = 0;
+    if (pcbPostAllocated)
+        *pcbPostAllocated = 0;
+    if (pcbActuallyDiscarded)
+        *pcbActuallyDiscarded = cbDiscard;
+    if (ppbmAllocationBitmap)
+        *ppbmAllocationBitmap = NULL;
+
+    LogFlowFunc(("returns %Rrc\n", VINF_SUCCESS));
+    return VINF_SUCCESS;
 }
 
 /** @copydoc VDCACHEBACKEND::pfnGetVersion */
@@ -1725,7 +1407,7 @@ static DECLCALLBACK(unsigned) vciGetVersion(void *pBackendData)
     AssertPtr(pCache);
 
     if (pCache)
-        return 1;
+        return VCI_HDR_VERSION;
     else
         return 0;
 }
@@ -1884,7 +1566,10 @@ static DECLCALLBACK(int) vciGetUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->ImageUuid;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -1905,7 +1590,11 @@ static DECLCALLBACK(int) vciSetUuid(void *pBackendData, PCRTUUID pUuid)
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            /* Written to the header when the cache is closed. */
+            pCache->ImageUuid = *pUuid;
+            rc = VINF_SUCCESS;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -1926,7 +1615,10 @@ static DECLCALLBACK(int) vciGetModificationUuid(void *pBackendData, PRTUUID pUui
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->ModificationUuid;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -1946,7 +1638,11 @@ static DECLCALLBACK(int) vciSetModificationUuid(void *pBackendData, PCRTUUID pUu
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            /* Written to the header when the cache is closed. */
+            pCache->ModificationUuid = *pUuid;
+            rc = VINF_SUCCESS;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -1960,7 +1656,19 @@ static DECLCALLBACK(int) vciSetModificationUuid(void *pBackendData, PCRTUUID pUu
 /** @copydoc VDCACHEBACKEND::pfnDump */
 static DECLCALLBACK(void) vciDump(void *pBackendData)
 {
-    NOREF(pBackendData);
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+
+    AssertPtr(pCache);
+    if (!pCache)
+        return;
+
+    vdIfErrorMessage(pCache->pIfError, "Header: cbCache=%llu cLines=%u cLinesUsed=%u offLineTbl=%llu offData=%llu\n",
+                     pCache->cbSize, pCache->cLines, pCache->cLinesUsed, pCache->offLineTbl, pCache->offData);
+    vdIfErrorMessage(pCache->pIfError, "Header: Image UUID=%RTuuid Modification UUID=%RTuuid\n",
+                     &pCache->ImageUuid, &pCache->ModificationUuid);
+    vdIfErrorMessage(pCache->pIfError, "Stats: cbReadHit=%llu cbReadMiss=%llu cbFilled=%llu cFillsRejected=%llu cEvictions=%llu cbInvalidated=%llu\n",
+                     pCache->cbReadHit, pCache->cbReadMiss, pCache->cbFilled, pCache->cFillsRejected,
+                     pCache->cEvictions, pCache->cbInvalidated);
 }
 
 
@@ -1971,11 +1679,11 @@ const VDCACHEBACKEND g_VciCacheBackend =
     /* cbSize */
     sizeof(VDCACHEBACKEND),
     /* uBackendCaps */
-    VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC | VD_CAP_FILE | VD_CAP_VFS,
+    VD_CAP_CREATE_FIXED | VD_CAP_CREATE_DYNAMIC | VD_CAP_FILE | VD_CAP_VFS | VD_CAP_CONFIG,
     /* papszFileExtensions */
     s_apszVciFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_vciConfigInfo,
     /* pfnProbe */
     vciProbe,
     /* pfnOpen */
@@ -1991,7 +1699,7 @@ const VDCACHEBACKEND g_VciCacheBackend =
     /* pfnFlush */
     vciFlush,
     /* pfnDiscard */
-    NULL,
+    vciDiscard,
     /* pfnGetVersion */
     vciGetVersion,
     /* pfnGetSize */
@@ -137,6 +137,20 @@ typedef struct VDIMAGE
 #define VD_IMAGE_MODIFIED_DISABLE_UUID_UPDATE   RT_BIT(2)
 
 
+/** Number of recent writes tracked for detecting stale cache fills. */
+#define VD_CACHE_WRITES_TRACKED                 64
+
+/**
+ * A write to the disk recorded for the cache.
+ */
+typedef struct VDCACHEWRITE
+{
+    /** Start offset of the write. */
+    uint64_t            uOffset;
+    /** Size of the write. */
+    size_t              cbWrite;
+} VDCACHEWRITE;
+
 /**
  * VBox HDD Cache image descriptor.
  */
@@ -159,6 +173,14 @@ typedef struct VDCACHE
     PVDINTERFACE        pVDIfsCache;
     /** I/O related things. */
     VDIO                VDIo;
+
+    /** Flag whether written data is put into the cache (write-through) or
+     * only invalidated there (write-around). */
+    bool                fWriteThrough;
+    /** Sequence number of the last write recorded. */
+    uint64_t            uSeqWrite;
+    /** Ring of the most recent writes, indexed by the sequence number. */
+    VDCACHEWRITE        aWrites[VD_CACHE_WRITES_TRACKED];
 } VDCACHE, *PVDCACHE;
 
 /**
@@ -395,6 +417,8 @@ typedef struct VDIOCTX
             uint64_t             uOffsetXferOrig;
             /** Original size of the transfer - required for fitlering read requests. */
             size_t               cbXferOrig;
+            /** Cache write sequence number when the data to fill the cache with was read. */
+            uint64_t             uCacheSeq;
         } Io;
         /** Discard requests. */
         struct
@@ -489,6 +513,9 @@ typedef struct VDIOCTX
  * multiple times.
  */
 #define VDIOCTX_FLAGS_WRITE_FILTER_APPLIED   RT_BIT_32(6)
+/** Data was read from the images which should be put into the cache
+ * once the read completed. */
+#define VDIOCTX_FLAGS_CACHE_FILL             RT_BIT_32(7)
 
 /** NIL I/O context pointer value. */
 #define NIL_VDIOCTX ((PVDIOCTX)0)
@@ -663,6 +690,8 @@ static RTLDRMOD *g_ahFilterBackendPlugins = NULL;
 /** Forward declaration of the async discard helper. */
 static DECLCALLBACK(int) vdDiscardHelperAsync(PVDIOCTX pIoCtx);
 static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx);
+static DECLCALLBACK(int) vdReadHelperCacheFillAsync(PVDIOCTX pIoCtx);
+static DECLCALLBACK(int) vdWriteHelperCacheUpdateAsync(PVDIOCTX pIoCtx);
 static void vdDiskProcessBlockedIoCtx(PVBOXHDD pDisk);
 static int vdDiskUnlock(PVBOXHDD pDisk, PVDIOCTX pIoCtxRc);
 static DECLCALLBACK(void) vdIoCtxSyncComplete(void *pvUser1, void *pvUser2, int rcReq);
@@ -1081,6 +1110,7 @@ DECLINLINE(void) vdIoCtxInit(PVDIOCTX pIoCtx, PVBOXHDD pDisk, VDIOCTXTXDIR enmTx
     pIoCtx->Req.Io.pImageParentOverride = NULL;
     pIoCtx->Req.Io.uOffsetXferOrig      = uOffset;
     pIoCtx->Req.Io.cbXferOrig           = cbTransfer;
+    pIoCtx->Req.Io.uCacheSeq            = 0;
     pIoCtx->cDataTransfersPending = 0;
     pIoCtx->cMetaTransfersPending = 0;
     pIoCtx->fComplete             = false;
@@ -1180,6 +1210,107 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
     return rc;
 }
 
+/**
+ * Internal: Records a write to the disk so cache fills of data read before
+ * can be detected as stale.
+ *
+ * @returns nothing.
+ * @param   pCache     The cache.
+ * @param   uOffset    Start offset of the write.
+ * @param   cbWrite    Size of the write.
+ */
+static void vdCacheRecordWrite(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite)
+{
+    pCache->uSeqWrite++;
+    pCache->aWrites[pCache->uSeqWrite % VD_CACHE_WRITES_TRACKED].uOffset = uOffset;
+    pCache->aWrites[pCache->uSeqWrite % VD_CACHE_WRITES_TRACKED].cbWrite = cbWrite;
+}
+
+/**
+ * Internal: Checks whether data read from the images might have been
+ * overwritten since it was read.
+ *
+ * @returns true if the data must not be put into the cache, false otherwise.
+ * @param   pCache     The cache.
+ * @param   uSeq       The write sequence number when the data was read.
+ * @param   uOffset    Start offset of the data.
+ * @param   cbFill     Size of the data.
+ */
+static bool vdCacheFillIsStale(PVDCACHE pCache, uint64_t uSeq, uint64_t uOffset, size_t cbFill)
+{
+    /* Too many writes in between to tell. */
+    if (pCache->uSeqWrite - uSeq >= VD_CACHE_WRITES_TRACKED)
+        return true;
+
+    for (uint64_t uSeqCur = uSeq + 1; uSeqCur <= pCache->uSeqWrite; uSeqCur++)
+    {
+        VDCACHEWRITE *pWrite = &pCache->aWrites[uSeqCur % VD_CACHE_WRITES_TRACKED];
+
+        if (   pWrite->uOffset < uOffset + cbFill
+            && uOffset < pWrite->uOffset + pWrite->cbWrite)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Internal: Removes the given range from the cache.
+ *
+ * @returns nothing.
+ * @param   pCache     The cache.
+ * @param   uOffset    Start offset of the range.
+ * @param   cbRange    Size of the range.
+ */
+static void vdCacheInvalidate(PVDCACHE pCache, uint64_t uOffset, uint64_t cbRange)
+{
+    vdCacheRecordWrite(pCache, uOffset, (size_t)RT_MIN(cbRange, ~(size_t)0));
+
+    if (!pCache->Backend->pfnDiscard)
+        return;
+
+    while (cbRange)
+    {
+        size_t cbThisDiscard = (size_t)RT_MIN(cbRange, ~(size_t)0 & ~(size_t)(_64K - 1));
+        size_t cbPreAllocated = 0;
+        size_t cbPostAllocated = 0;
+        size_t cbDiscarded = 0;
+        void *pbmAllocated = NULL;
+
+        int rc = pCache->Backend->pfnDiscard(pCache->pBackendData, NULL, uOffset, cbThisDiscard,
+                                             &cbPreAllocated, &cbPostAllocated, &cbDiscarded,
+                                             &pbmAllocated, 0);
+        AssertMsgBreak(RT_SUCCESS(rc) && cbDiscarded, ("rc=%Rrc cbDiscarded=%zu\n", rc, cbDiscarded));
+        RTMemFree(pbmAllocated);
+
+        uOffset += cbDiscarded;
+        cbRange -= cbDiscarded;
+    }
+}
+
+/**
+ * Internal: Reads the configuration of the cache handled in this code.
+ *
+ * @returns nothing.
+ * @param   pCache     The cache.
+ */
+static void vdCacheQueryConfig(PVDCACHE pCache)
+{
+    PVDINTERFACECONFIG pIfCfg = VDIfConfigGet(pCache->pVDIfsCache);
+
+    pCache->fWriteThrough = false;
+    if (pIfCfg)
+    {
+        char *pszWriteMode = NULL;
+        int rc = VDCFGQueryStringAllocDef(pIfCfg, "WriteMode", &pszWriteMode, "around");
+        if (RT_SUCCESS(rc))
+        {
+            pCache->fWriteThrough = !RTStrICmp(pszWriteMode, "through");
+            RTMemFree(pszWriteMode);
+        }
+    }
+}
+
 /**
  * Creates a new empty discard state.
  *
@@ -2047,22 +2178,29 @@ static DECLCALLBACK(int) vdReadHelperAsync(PVDIOCTX pIoCtx)
         cbThisRead = cbToRead;
 
         if (   pDisk->pCache
-            && !pImageParentOverride)
+            && !pImageParentOverride
+            && pIoCtx->Req.Io.pImageStart == pDisk->pLast)
         {
             rc = vdCacheReadHelper(pDisk->pCache, uOffset, cbThisRead,
                                    pIoCtx, &cbThisRead);
             if (rc == VERR_VD_BLOCK_FREE)
             {
-                rc = vdDiskReadHelper(pDisk, pCurrImage, NULL, uOffset, cbThisRead,
-                                      pIoCtx, &cbThisRead);
-
-                /* If the read was successful, write the data back into the cache. */
-                if (   RT_SUCCESS(rc)
-                    && pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
+                /*
+                 * The cache is updated once the whole request completed and the data
+                 * is in the buffer. Remember the write sequence number to detect writes
+                 * racing with this read.
+                 */
+                if (   (pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
+                    && !(pIoCtx->fFlags & VDIOCTX_FLAGS_CACHE_FILL)
+                    && pIoCtx->enmTxDir == VDIOCTXTXDIR_READ
+                    && !pIoCtx->pIoCtxParent)
                 {
-                    rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbThisRead,
-                                            pIoCtx, NULL);
+                    pIoCtx->fFlags |= VDIOCTX_FLAGS_CACHE_FILL;
+                    pIoCtx->Req.Io.uCacheSeq = pDisk->pCache->uSeqWrite;
                 }
+
+                rc = vdDiskReadHelper(pDisk, pCurrImage, NULL, uOffset, cbThisRead,
+                                      pIoCtx, &cbThisRead);
             }
         }
         else
@@ -2157,11 +2295,51 @@ static DECLCALLBACK(int) vdReadHelperAsync(PVDIOCTX pIoCtx)
         pIoCtx->Req.Io.pImageCur  = pCurrImage ? pCurrImage : pIoCtx->Req.Io.pImageStart;
     }
 
+    if (   RT_SUCCESS(rc)
+        && !cbToRead
+        && (pIoCtx->fFlags & VDIOCTX_FLAGS_CACHE_FILL)
+        && !pIoCtx->pfnIoCtxTransferNext)
+        pIoCtx->pfnIoCtxTransferNext = vdReadHelperCacheFillAsync;
+
     return (!(pIoCtx->fFlags & VDIOCTX_FLAGS_ZERO_FREE_BLOCKS))
            ? VERR_VD_BLOCK_FREE
            : rc;
 }
 
+/**
+ * internal: put the data of a completed read into the cache - async version.
+ */
+static DECLCALLBACK(int) vdReadHelperCacheFillAsync(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk  = pIoCtx->pDisk;
+    PVDCACHE pCache = pDisk->pCache;
+
+    LogFlowFunc(("pIoCtx=%#p\n", pIoCtx));
+
+    /* Wait for all reads to complete, we get called again for every completion. */
+    if (   pIoCtx->Req.Io.cbTransferLeft
+        || pIoCtx->cDataTransfersPending)
+        return VERR_VD_ASYNC_IO_IN_PROGRESS;
+
+    if (   pCache
+        && !vdCacheFillIsStale(pCache, pIoCtx->Req.Io.uCacheSeq,
+                               pIoCtx->Req.Io.uOffsetXferOrig, pIoCtx->Req.Io.cbXferOrig))
+    {
+        RTSgBufReset(&pIoCtx->Req.Io.SgBuf);
+        pIoCtx->Req.Io.cbTransferLeft = (uint32_t)pIoCtx->Req.Io.cbXferOrig;
+        rc = vdCacheWriteHelper(pCache, pIoCtx->Req.Io.uOffsetXferOrig, pIoCtx->Req.Io.cbXferOrig,
+                                pIoCtx, NULL);
+        /* Failing to update the cache doesn't fail the read. */
+        if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            LogFlowFunc(("Updating the cache failed with %Rrc\n", rc));
+        rc = VINF_SUCCESS;
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
 /**
  * internal: parent image read wrapper for compacting.
  */
@@ -2607,8 +2785,11 @@ static DECLCALLBACK(int) vdWriteHelperCommitAsync(PVDIOCTX pIoCtx)
         rc = VINF_SUCCESS;
     else if (rc == VERR_VD_IOCTX_HALT)
     {
+        /*
+         * Keep the status so the commit is retried when the context is continued
+         * and the backend didn't complete the whole transfer while halted.
+         */
         pIoCtx->fFlags |= VDIOCTX_FLAGS_BLOCKED;
-        rc = VINF_SUCCESS;
     }
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -2971,6 +3152,11 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
         if (RT_FAILURE(rc))
             return rc;
         pIoCtx->fFlags |= VDIOCTX_FLAGS_WRITE_FILTER_APPLIED;
+
+        /* Nothing may be read from the cache for this range until the write completed. */
+        if (   pDisk->pCache
+            && pIoCtx->Req.Io.pImageStart == pDisk->pLast)
+            vdCacheInvalidate(pDisk->pCache, uOffset, cbWrite);
     }
 
     if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG))
@@ -3127,6 +3313,49 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
         pIoCtx->Req.Io.cbTransfer = cbWrite;
     }
 
+    if (   RT_SUCCESS(rc)
+        && !cbWrite
+        && pDisk->pCache
+        && pIoCtx->Req.Io.pImageStart == pDisk->pLast)
+        pIoCtx->pfnIoCtxTransferNext = vdWriteHelperCacheUpdateAsync;
+
+    return rc;
+}
+
+/**
+ * internal: update the cache after a write completed - async version.
+ */
+static DECLCALLBACK(int) vdWriteHelperCacheUpdateAsync(PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVBOXHDD pDisk  = pIoCtx->pDisk;
+    PVDCACHE pCache = pDisk->pCache;
+
+    LogFlowFunc(("pIoCtx=%#p\n", pIoCtx));
+
+    /* Wait for all writes to complete, we get called again for every completion. */
+    if (   pIoCtx->Req.Io.cbTransferLeft
+        || pIoCtx->cDataTransfersPending)
+        return VERR_VD_ASYNC_IO_IN_PROGRESS;
+
+    if (pCache)
+    {
+        /* Reads started while the write was in flight might have put old data into the cache. */
+        vdCacheInvalidate(pCache, pIoCtx->Req.Io.uOffsetXferOrig, pIoCtx->Req.Io.cbXferOrig);
+
+        if (pCache->fWriteThrough)
+        {
+            RTSgBufReset(&pIoCtx->Req.Io.SgBuf);
+            pIoCtx->Req.Io.cbTransferLeft = (uint32_t)pIoCtx->Req.Io.cbXferOrig;
+            rc = vdCacheWriteHelper(pCache, pIoCtx->Req.Io.uOffsetXferOrig, pIoCtx->Req.Io.cbXferOrig,
+                                    pIoCtx, NULL);
+            if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                LogFlowFunc(("Updating the cache failed with %Rrc\n", rc));
+            rc = VINF_SUCCESS;
+        }
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
@@ -3403,6 +3632,11 @@ static DECLCALLBACK(int) vdDiscardHelperAsync(PVDIOCTX pIoCtx)
         && !pIoCtx->Req.Discard.cbDiscardLeft)
     {
         LogFlowFunc(("All ranges discarded, completing\n"));
+        if (pDisk->pCache)
+        {
+            for (unsigned i = 0; i < cRanges; i++)
+                vdCacheInvalidate(pDisk->pCache, paRanges[i].offStart, paRanges[i].cbRange);
+        }
         vdIoCtxUnlockDisk(pDisk, pIoCtx, true /* fProcessDeferredReqs*/);
         return VINF_SUCCESS;
     }
@@ -6739,6 +6973,9 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
             }
         }
 
+        pCache->VDIo.pBackendData = pCache->pBackendData;
+        vdCacheQueryConfig(pCache);
+
         /* Lock disk for writing, as we modify pDisk information below. */
         rc2 = vdThreadStartWrite(pDisk);
         AssertRC(rc2);
@@ -6760,7 +6997,19 @@ VBOXDDU_DECL(int) VDCacheOpen(PVBOXHDD pDisk, const char *pszBackend,
             if (RT_SUCCESS(rc))
             {
                 if (RTUuidCompare(&UuidImage, &UuidCache))
-                    rc = VERR_VD_CACHE_NOT_UP_TO_DATE;
+                {
+                    /* Start over with an empty cache if the backend can drop its content. */
+                    if (   pCache->Backend->pfnDiscard
+                        && !(pCache->Backend->pfnGetOpenFlags(pCache->pBackendData) & VD_OPEN_FLAGS_READONLY))
+                    {
+                        LogRel(("VD: Cache '%s' is not up to date, discarding its content\n", pszFilename));
+                        vdCacheInvalidate(pCache, 0, pDisk->cbSize);
+                        rc = pCache->Backend->pfnSetModificationUuid(pCache->pBackendData,
+                                                                     &UuidImage);
+                    }
+                    else
+                        rc = VERR_VD_CACHE_NOT_UP_TO_DATE;
+                }
             }
         }
 
@@ -7611,6 +7860,7 @@ VBOXDDU_DECL(int) VDCreateCache(PVBOXHDD pDisk, const char *pszBackend,
             fLockWrite = true;
 
             pCache->VDIo.pBackendData = pCache->pBackendData;
+            vdCacheQueryConfig(pCache);
 
             /* Re-check state, as the lock wasn't held and another image
              * creation call could have been done by another thread. */
@@ -10854,7 +11104,7 @@ VBOXDDU_DECL(int) VDAsyncRead(PVBOXHDD pDisk, uint64_t uOffset, size_t cbRead,
                                   cbRead, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
                                   NULL, vdReadHelperAsync,
-                                  VDIOCTX_FLAGS_ZERO_FREE_BLOCKS);
+                                  VDIOCTX_FLAGS_ZERO_FREE_BLOCKS | VDIOCTX_FLAGS_READ_UPDATE_CACHE);
         if (!pIoCtx)
         {
             rc = VERR_NO_MEMORY;
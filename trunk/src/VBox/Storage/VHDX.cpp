@@ -30,6 +30,8 @@
 #include <iprt/path.h>
 #include <iprt/uuid.h>
 #include <iprt/crc.h>
+#include <iprt/string.h>
+#include <iprt/utf16.h>
 
 #include "VDBackends.h"
 
@@ -97,6 +99,8 @@ typedef VhdxHeader *PVhdxHeader;
 #define VHDX_HEADER1_OFFSET      _64K
 /** Start offset of the second VHDX header. */
 #define VHDX_HEADER2_OFFSET      _128K
+/** Size of the VHDX header area. */
+#define VHDX_HEADER_SIZE         _4K
 /** Current Log format version. */
 #define VHDX_HEADER_LOG_VERSION  UINT16_C(0)
 /** Current VHDX format version. */
@@ -127,6 +131,8 @@ typedef VhdxRegionTblHdr *PVhdxRegionTblHdr;
 #define VHDX_REGION_TBL_HDR_ENTRY_COUNT_MAX UINT32_C(2047)
 /** Offset where the region table is stored (192 KB). */
 #define VHDX_REGION_TBL_HDR_OFFSET          UINT64_C(196608)
+/** Offset where the copy of the region table is stored (256 KB). */
+#define VHDX_REGION_TBL_HDR_OFFSET2         UINT64_C(262144)
 /** Maximum size of the region table. */
 #define VHDX_REGION_TBL_SIZE_MAX            _64K
 
@@ -190,6 +196,8 @@ typedef struct VhdxLogEntryHdr *PVhdxLogEntryHdr;
 
 /** VHDX log entry signature ("loge"). */
 #define VHDX_LOG_ENTRY_HEADER_SIGNATURE UINT32_C(0x65676f6c)
+/** Size of a sector in the log, log entries are always a multiple of this. */
+#define VHDX_LOG_SECTOR_SIZE            _4K
 
 /**
  * VHDX log zero descriptor.
@@ -279,6 +287,8 @@ typedef VhdxBatEntry *PVhdxBatEntry;
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) (((bat) & UINT64_C(0xfffffffffff00000)) >> 20)
 /** Get a byte offset from the BAT entry. */
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET(bat) (VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) * (uint64_t)_1M)
+/** Create a BAT entry from the given state and byte offset (must be 1MB aligned). */
+#define VHDX_BAT_ENTRY_CREATE(state, off) (((off) & UINT64_C(0xfffffffffff00000)) | ((state) & UINT64_C(0x7)))
 
 /** Block not present and the data is undefined. */
 #define VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT       (0)
@@ -455,6 +465,16 @@ typedef struct VhdxParentLocatorHeader *PVhdxParentLocatorHeader;
 
 /** VHDX parent locator type. */
 #define VHDX_PARENT_LOCATOR_TYPE_VHDX "b04aefb7-d19e-4a81-b789-25b8e9445913"
+/** Parent locator key holding the data write GUID of the parent. */
+#define VHDX_PARENT_LOCATOR_KEY_LINKAGE       "parent_linkage"
+/** Parent locator key holding the path of the parent relative to the child. */
+#define VHDX_PARENT_LOCATOR_KEY_RELATIVE_PATH "relative_path"
+/** Parent locator key holding the volume path of the parent. */
+#define VHDX_PARENT_LOCATOR_KEY_VOLUME_PATH   "volume_path"
+/** Parent locator key holding the absolute path of the parent. */
+#define VHDX_PARENT_LOCATOR_KEY_ABSOLUTE_PATH "absolute_win32_path"
+/** Parent locator key holding the VirtualBox UUID of the parent. */
+#define VHDX_PARENT_LOCATOR_KEY_PARENT_UUID   "parent_uuid"
 
 /**
  * VHDX parent locator entry.
@@ -509,6 +529,37 @@ typedef struct VHDXMETADATAITEMPROPS
     VHDXMETADATAITEM     enmMetadataItem;
 } VHDXMETADATAITEMPROPS;
 
+/** Size of the log entries written by this backend (one descriptor sector
+ * and one data sector updating a single BAT sector). */
+#define VHDX_LOG_ENTRY_SIZE_BAT_UPDATE  (2 * VHDX_LOG_SECTOR_SIZE)
+/** Size of a BAT sector updated through the log. */
+#define VHDX_BAT_SECTOR_SIZE            _4K
+/** Number of BAT entries in one BAT sector. */
+#define VHDX_BAT_SECTOR_ENTRIES         (VHDX_BAT_SECTOR_SIZE / sizeof(VhdxBatEntry))
+
+/** Block size for newly created dynamic images. */
+#define VHDX_CREATE_BLOCK_SIZE          (32 * _1M)
+/** Block size for newly created differencing images. */
+#define VHDX_CREATE_BLOCK_SIZE_DIFF     (2 * _1M)
+/** Logical sector size of newly created images. */
+#define VHDX_CREATE_LOGICAL_SECTOR_SIZE 512
+/** Physical sector size of newly created images. */
+#define VHDX_CREATE_PHYS_SECTOR_SIZE    _4K
+/** Offset of the log for newly created images. */
+#define VHDX_CREATE_LOG_OFFSET          _1M
+/** Size of the log for newly created images. */
+#define VHDX_CREATE_LOG_SIZE            _1M
+/** Offset of the metadata region for newly created images. */
+#define VHDX_CREATE_METADATA_OFFSET     (2 * _1M)
+/** Size of the metadata region for newly created images. */
+#define VHDX_CREATE_METADATA_SIZE       _1M
+/** Offset of the BAT region for newly created images. */
+#define VHDX_CREATE_BAT_OFFSET          (3 * _1M)
+/** Offset of the first metadata item inside the metadata region. */
+#define VHDX_METADATA_ITEM_OFFSET_MIN   _64K
+/** Space reserved for the parent locator of newly created differencing images. */
+#define VHDX_CREATE_PARENT_LOCATOR_SIZE _64K
+
 /**
  * VHDX image data structure.
  */
@@ -549,9 +600,112 @@ typedef struct VHDXIMAGE
     PVhdxBatEntry       paBat;
     /** Chunk ratio. */
     uint32_t            uChunkRatio;
+    /** Number of entries in the BAT (payload and sector bitmap entries). */
+    uint32_t            cBatEntries;
+    /** Start offset of the BAT region in the file. */
+    uint64_t            offBat;
+    /** Offset where the next payload block is allocated. */
+    uint64_t            offBlockNext;
+    /** Size of the file when the image was opened, used as the flushed file
+     * offset in log entries. */
+    uint64_t            cbFileOpened;
+    /** Array of payload block offsets freed by discards and available for reuse. */
+    uint64_t           *paoffBlocksFree;
+    /** Number of free blocks in the array. */
+    uint32_t            cBlocksFree;
+    /** Maximum number of entries the free block array can hold. */
+    uint32_t            cBlocksFreeMax;
+
+    /** The current header in host endianess. */
+    VhdxHeader          Hdr;
+    /** Offset of the current header in the file. */
+    uint64_t            offHdrCur;
+    /** Flag whether the header was changed and needs to be written on the next flush. */
+    bool                fHdrDirty;
+    /** Flag whether the log is active (image opened for writing). */
+    bool                fLogActive;
+    /** Current head of the log (relative to the log start). */
+    uint32_t            offLogHead;
+    /** Current tail of the log (relative to the log start). */
+    uint32_t            offLogTail;
+    /** Sequence number of the last written log entry. */
+    uint64_t            u64LogSeqLast;
+    /** Number of log entries which are not durably applied yet. */
+    uint32_t            cLogEntriesPending;
+    /** Number of log entries reserved for block allocations in progress. */
+    uint32_t            cLogEntriesReserved;
+    /** I/O contexts waiting for log space to become available. */
+    PVDIOCTX           *papIoCtxLogWait;
+    /** Number of I/O contexts waiting for log space. */
+    uint32_t            cIoCtxLogWait;
+    /** Maximum number of entries the waiter array can hold. */
+    uint32_t            cIoCtxLogWaitMax;
+
+    /** Offset of the page 83 data metadata item, 0 if not present. */
+    uint64_t            offPage83;
+    /** Page 83 UUID, used as the image UUID. */
+    RTUUID              UuidPage83;
+    /** Offset of the parent locator, 0 if the image has no parent. */
+    uint64_t            offParentLocator;
+    /** Maximum size of the parent locator in the file. */
+    uint32_t            cbParentLocatorMax;
+    /** Offset of the parent locator metadata table entry. */
+    uint64_t            offParentLocatorTblEntry;
+    /** Parent linkage (data write GUID of the parent). */
+    RTUUID              UuidParentLinkage;
+    /** UUID of the parent image. */
+    RTUUID              UuidParent;
+    /** Absolute path of the parent, NULL if not known. */
+    char               *pszParentAbsPath;
+    /** Relative path of the parent, NULL if not known. */
+    char               *pszParentRelPath;
+    /** Volume path of the parent, NULL if not known. */
+    char               *pszParentVolPath;
 
 } VHDXIMAGE, *PVHDXIMAGE;
 
+/**
+ * States of an async BAT update.
+ */
+typedef enum VHDXBATUPDATESTATE
+{
+    /** Invalid. */
+    VHDXBATUPDATESTATE_INVALID = 0,
+    /** Write the log entry. */
+    VHDXBATUPDATESTATE_LOG_WRITE,
+    /** Flush the log entry (and all data written before). */
+    VHDXBATUPDATESTATE_LOG_FLUSH,
+    /** Write the BAT sector to its final location. */
+    VHDXBATUPDATESTATE_BAT_WRITE,
+    /** Flush the BAT sector so the log entry can be retired. */
+    VHDXBATUPDATESTATE_BAT_FLUSH,
+    /** Update completed. */
+    VHDXBATUPDATESTATE_COMPLETE,
+    /** 32bit hack. */
+    VHDXBATUPDATESTATE_32BIT_HACK = 0x7fffffff
+} VHDXBATUPDATESTATE;
+
+/**
+ * Async BAT update state, used for block allocations and discards.
+ */
+typedef struct VHDXBATUPDATE
+{
+    /** Current state. */
+    VHDXBATUPDATESTATE  enmState;
+    /** Index of the updated BAT entry. */
+    uint32_t            idxBat;
+    /** The new BAT entry. */
+    uint64_t            u64BatEntryNew;
+    /** Payload block to put on the free list when the update completed, 0 if none. */
+    uint64_t            offBlockFree;
+    /** Offset of the log entry relative to the log start. */
+    uint32_t            offLogEntry;
+    /** The log entry to write. */
+    uint8_t             abLogEntry[VHDX_LOG_ENTRY_SIZE_BAT_UPDATE];
+    /** BAT sector buffer. */
+    uint8_t             abBatSector[VHDX_BAT_SECTOR_SIZE];
+} VHDXBATUPDATE, *PVHDXBATUPDATE;
+
 /**
  * Endianess conversion direction.
  */
@@ -659,9 +813,9 @@ DECLINLINE(void) vhdxConvHeaderEndianess(VHDXECONV enmConv, PVhdxHeader pHdrConv
     pHdrConv->u32Signature      = SET_ENDIAN_U32(pHdr->u32Signature);
     pHdrConv->u32Checksum       = SET_ENDIAN_U32(pHdr->u32Checksum);
     pHdrConv->u64SequenceNumber = SET_ENDIAN_U64(pHdr->u64SequenceNumber);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidFileWrite, &pHdrConv->UuidFileWrite);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidDataWrite, &pHdrConv->UuidDataWrite);
-    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidLog, &pHdrConv->UuidLog);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidFileWrite, &pHdr->UuidFileWrite);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidDataWrite, &pHdr->UuidDataWrite);
+    vhdxConvUuidEndianess(enmConv, &pHdrConv->UuidLog, &pHdr->UuidLog);
     pHdrConv->u16LogVersion     = SET_ENDIAN_U16(pHdr->u16LogVersion);
     pHdrConv->u16Version        = SET_ENDIAN_U16(pHdr->u16Version);
     pHdrConv->u32LogLength      = SET_ENDIAN_U32(pHdr->u32LogLength);
@@ -728,6 +882,7 @@ DECLINLINE(void) vhdxConvLogEntryHdrEndianess(VHDXECONV enmConv, PVhdxLogEntryHd
     pLogEntryHdrConv->u32Reserved          = SET_ENDIAN_U32(pLogEntryHdr->u32Reserved);
     vhdxConvUuidEndianess(enmConv, &pLogEntryHdrConv->UuidLog, &pLogEntryHdr->UuidLog);
     pLogEntryHdrConv->u64FlushedFileOffset = SET_ENDIAN_U64(pLogEntryHdr->u64FlushedFileOffset);
+    pLogEntryHdrConv->u64LastFileOffset    = SET_ENDIAN_U64(pLogEntryHdr->u64LastFileOffset);
 }
 
 /**
@@ -963,6 +1118,71 @@ DECLINLINE(void) vhdxConvParentLocatorEntryEndianess(VHDXECONV enmConv, PVhdxPar
     pParentLocatorEntryConv->u16ValueLength = SET_ENDIAN_U16(pParentLocatorEntry->u16ValueLength);
 }
 
+/**
+ * Writes the in memory header to the header location which is not current,
+ * making it the current header.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context for an async write, NULL for a synchronous one.
+ */
+static int vhdxHeaderWrite(PVHDXIMAGE pImage, PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+    PVhdxHeader pHdr = (PVhdxHeader)RTMemAllocZ(sizeof(VhdxHeader));
+
+    LogFlowFunc(("pImage=%#p pIoCtx=%#p\n", pImage, pIoCtx));
+
+    if (pHdr)
+    {
+        uint64_t offHdr =   pImage->offHdrCur == VHDX_HEADER1_OFFSET
+                          ? VHDX_HEADER2_OFFSET
+                          : VHDX_HEADER1_OFFSET;
+
+        pImage->Hdr.u64SequenceNumber++;
+        pImage->Hdr.u32Checksum = 0;
+        vhdxConvHeaderEndianess(VHDXECONV_H2F, pHdr, &pImage->Hdr);
+        pHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pHdr, sizeof(VhdxHeader)));
+
+        if (pIoCtx)
+            rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, offHdr,
+                                        pHdr, sizeof(VhdxHeader), pIoCtx, NULL, NULL);
+        else
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offHdr,
+                                        pHdr, sizeof(VhdxHeader));
+        if (   RT_SUCCESS(rc)
+            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        {
+            pImage->offHdrCur = offHdr;
+            pImage->fHdrDirty = false;
+        }
+
+        RTMemFree(pHdr);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Updates the header synchronously, making sure everything written before
+ * is on the disk before the new header becomes current.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxUpdateHeader(PVHDXIMAGE pImage)
+{
+    int rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+    if (RT_SUCCESS(rc))
+        rc = vhdxHeaderWrite(pImage, NULL);
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+    return rc;
+}
+
 /**
  * Internal. Free all allocated space for representing an image except pImage,
  * and optionally delete the image from disk.
@@ -977,6 +1197,19 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
     {
         if (pImage->pStorage)
         {
+            /*
+             * Retire the log when closing an image opened for writing. All BAT
+             * updates were applied and flushed once they completed, so an
+             * empty log is correct after the final flush.
+             */
+            if (   !fDelete
+                && (pImage->fLogActive || pImage->fHdrDirty))
+            {
+                Assert(!pImage->cLogEntriesPending);
+                RTUuidClear(&pImage->Hdr.UuidLog);
+                vhdxUpdateHeader(pImage);
+            }
+
             rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
             pImage->pStorage = NULL;
         }
@@ -987,6 +1220,48 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
             pImage->paBat = NULL;
         }
 
+        if (pImage->paoffBlocksFree)
+        {
+            RTMemFree(pImage->paoffBlocksFree);
+            pImage->paoffBlocksFree = NULL;
+        }
+
+        if (pImage->papIoCtxLogWait)
+        {
+            Assert(!pImage->cIoCtxLogWait);
+            RTMemFree(pImage->papIoCtxLogWait);
+            pImage->papIoCtxLogWait = NULL;
+        }
+
+        if (pImage->pszParentAbsPath)
+        {
+            RTStrFree(pImage->pszParentAbsPath);
+            pImage->pszParentAbsPath = NULL;
+        }
+
+        if (pImage->pszParentRelPath)
+        {
+            RTStrFree(pImage->pszParentRelPath);
+            pImage->pszParentRelPath = NULL;
+        }
+
+        if (pImage->pszParentVolPath)
+        {
+            RTStrFree(pImage->pszParentVolPath);
+            pImage->pszParentVolPath = NULL;
+        }
+
+        pImage->cBlocksFree        = 0;
+        pImage->cBlocksFreeMax     = 0;
+        pImage->fLogActive         = false;
+        pImage->fHdrDirty          = false;
+        pImage->cLogEntriesPending = 0;
+        pImage->cLogEntriesReserved = 0;
+        pImage->cIoCtxLogWait      = 0;
+        pImage->cIoCtxLogWaitMax   = 0;
+        pImage->offPage83          = 0;
+        pImage->offParentLocator   = 0;
+
         if (fDelete && pImage->pszFilename)
             vdIfIoIntFileDelete(pImage->pIfIo, pImage->pszFilename);
     }
@@ -1002,27 +1277,33 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
  * @returns VBox status code.
  * @param   pImage    Image instance data.
  * @param   pHdr      The header to load.
+ * @param   offHdr    Offset of the header in the file.
  */
-static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr)
+static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr, uint64_t offHdr)
 {
     int rc = VINF_SUCCESS;
 
-    LogFlowFunc(("pImage=%#p pHdr=%#p\n", pImage, pHdr));
+    LogFlowFunc(("pImage=%#p pHdr=%#p offHdr=%llu\n", pImage, pHdr, offHdr));
 
     /*
-     * Most fields in the header are not required because the backend implements
-     * readonly access only so far.
-     * We just have to check that the log is empty, we have to refuse to load the
-     * image otherwsie because replaying the log is not implemented.
+     * A non empty log is replayed after the header was loaded, it only has to
+     * be properly aligned to be usable.
      */
     if (pHdr->u16Version == VHDX_HEADER_VHDX_VERSION)
     {
-        /* Check that the log UUID is zero. */
         pImage->uVersion = pHdr->u16Version;
-        if (!RTUuidIsNull(&pHdr->UuidLog))
-            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                           "VHDX: Image \'%s\' has a non empty log which is not supported",
+        if (   pHdr->u16LogVersion != VHDX_HEADER_LOG_VERSION
+            || !pHdr->u32LogLength
+            || pHdr->u32LogLength % _1M
+            || pHdr->u64LogOffset % _1M)
+            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                           "VHDX: Image \'%s\' has an invalid log region",
                            pImage->pszFilename);
+        else
+        {
+            memcpy(&pImage->Hdr, pHdr, sizeof(VhdxHeader));
+            pImage->offHdrCur = offHdr;
+        }
     }
     else
         rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
@@ -1098,7 +1379,9 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         if (fHdr1Valid != fHdr2Valid)
         {
             /* Only one header is valid - use it. */
-            rc = vhdxLoadHeader(pImage, fHdr1Valid ? pHdr1 : pHdr2);
+            rc =   fHdr1Valid
+                 ? vhdxLoadHeader(pImage, pHdr1, VHDX_HEADER1_OFFSET)
+                 : vhdxLoadHeader(pImage, pHdr2, VHDX_HEADER2_OFFSET);
         }
         else if (!fHdr1Valid && !fHdr2Valid)
         {
@@ -1110,9 +1393,9 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         {
             /* Both headers are valid. Use the sequence number to find the current one. */
             if (pHdr1->u64SequenceNumber > pHdr2->u64SequenceNumber)
-                rc = vhdxLoadHeader(pImage, pHdr1);
+                rc = vhdxLoadHeader(pImage, pHdr1, VHDX_HEADER1_OFFSET);
             else
-                rc = vhdxLoadHeader(pImage, pHdr2);
+                rc = vhdxLoadHeader(pImage, pHdr2, VHDX_HEADER2_OFFSET);
         }
     }
     else
@@ -1129,163 +1412,135 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
 }
 
 /**
- * Loads the BAT region.
+ * Checks whether the log entry at the given offset is valid.
  *
- * @returns VBox status code.
- * @param   pImage    Image instance data.
- * @param   offRegion Start offset of the region.
- * @param   cbRegion  Size of the region.
+ * @returns true if the entry is valid, false otherwise.
+ * @param   pImage       Image instance data.
+ * @param   pbLog        The complete log region read into memory.
+ * @param   offEntry     Offset of the entry relative to the log start.
+ * @param   pEntryHdr    Where to store the entry header in host endianess.
  */
-static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
-                             size_t cbRegion)
+static bool vhdxLogEntryIsValid(PVHDXIMAGE pImage, uint8_t *pbLog, uint32_t offEntry,
+                                PVhdxLogEntryHdr pEntryHdr)
 {
-    int rc = VINF_SUCCESS;
-    uint32_t cDataBlocks;
-    uint32_t uChunkRatio;
-    uint32_t cSectorBitmapBlocks;
-    uint32_t cBatEntries;
-    uint32_t cbBatEntries;
-    PVhdxBatEntry paBatEntries = NULL;
-
-    LogFlowFunc(("pImage=%#p\n", pImage));
-
-    /* Calculate required values first. */
-    uint64_t uChunkRatio64 = (RT_BIT_64(23) * pImage->cbLogicalSector) / pImage->cbBlock;
-    uChunkRatio = (uint32_t)uChunkRatio64; Assert(uChunkRatio == uChunkRatio64);
-    uint64_t cDataBlocks64 = pImage->cbSize / pImage->cbBlock;
-    cDataBlocks = (uint32_t)cDataBlocks64; Assert(cDataBlocks == cDataBlocks64);
-
-    if (pImage->cbSize % pImage->cbBlock)
-        cDataBlocks++;
-
-    cSectorBitmapBlocks = cDataBlocks / uChunkRatio;
-    if (cDataBlocks % uChunkRatio)
-        cSectorBitmapBlocks++;
+    uint32_t cbLog = pImage->Hdr.u32LogLength;
+    uint8_t *pbEntry = pbLog + offEntry;
+    PVhdxLogEntryHdr pEntryHdrFile = (PVhdxLogEntryHdr)pbEntry;
+
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_F2H, pEntryHdr, pEntryHdrFile);
+
+    if (   pEntryHdr->u32Signature != VHDX_LOG_ENTRY_HEADER_SIGNATURE
+        || !pEntryHdr->u64SequenceNumber
+        || pEntryHdr->u32EntryLength < VHDX_LOG_SECTOR_SIZE
+        || pEntryHdr->u32EntryLength % VHDX_LOG_SECTOR_SIZE
+        || pEntryHdr->u32EntryLength > cbLog - offEntry
+        || pEntryHdr->u32Tail >= cbLog
+        || pEntryHdr->u32Tail % VHDX_LOG_SECTOR_SIZE
+        || pEntryHdr->u32DescriptorCount > cbLog / sizeof(VhdxLogDataDesc)
+        || RTUuidCompare(&pEntryHdr->UuidLog, &pImage->Hdr.UuidLog))
+        return false;
+
+    /* The descriptor sectors come first, followed by one data sector for each data descriptor. */
+    uint32_t cbDescSectors = RT_ALIGN_32(  sizeof(VhdxLogEntryHdr)
+                                         + pEntryHdr->u32DescriptorCount * sizeof(VhdxLogDataDesc),
+                                         VHDX_LOG_SECTOR_SIZE);
+    if (cbDescSectors > pEntryHdr->u32EntryLength)
+        return false;
+
+    /* Verify the checksum which is calculated with the checksum field set to 0. */
+    uint32_t u32ChkSumSaved = pEntryHdrFile->u32Checksum;
+    pEntryHdrFile->u32Checksum = 0;
+    uint32_t u32ChkSum = RTCrc32C(pbEntry, pEntryHdr->u32EntryLength);
+    pEntryHdrFile->u32Checksum = u32ChkSumSaved;
+    if (u32ChkSum != pEntryHdr->u32Checksum)
+        return false;
+
+    /* Zero and data descriptors share the location of the signature and sequence number. */
+    PVhdxLogDataDesc pDesc = (PVhdxLogDataDesc)(pEntryHdrFile + 1);
+    uint32_t offDataSector = cbDescSectors;
+    for (uint32_t i = 0; i < pEntryHdr->u32DescriptorCount; i++, pDesc++)
+    {
+        VhdxLogDataDesc Desc;
 
-    cBatEntries = cDataBlocks + (cDataBlocks - 1)/uChunkRatio;
-    cbBatEntries = cBatEntries * sizeof(VhdxBatEntry);
+        vhdxConvLogDataDescEndianess(VHDXECONV_F2H, &Desc, pDesc);
+        if (Desc.u64SequenceNumber != pEntryHdr->u64SequenceNumber)
+            return false;
 
-    if (cbBatEntries <= cbRegion)
-    {
-        /*
-         * Load the complete BAT region first, convert to host endianess and process
-         * it afterwards. The SB entries can be removed because they are not needed yet.
-         */
-        paBatEntries = (PVhdxBatEntry)RTMemAlloc(cbBatEntries);
-        if (paBatEntries)
+        if (Desc.u32DataSignature == VHDX_LOG_DATA_DESC_SIGNATURE)
         {
-            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offRegion,
-                                       paBatEntries, cbBatEntries);
-            if (RT_SUCCESS(rc))
-            {
-                vhdxConvBatTableEndianess(VHDXECONV_F2H, paBatEntries, paBatEntries,
-                                          cBatEntries);
+            if (offDataSector >= pEntryHdr->u32EntryLength)
+                return false;
 
-                /* Go through the table and validate it. */
-                for (unsigned i = 0; i < cBatEntries; i++)
-                {
-                    if (   i != 0
-                        && (i % uChunkRatio) == 0)
-                    {
-/**
- * Disabled the verification because there are images out there with the sector bitmap
- * marked as present. The entry is never accessed and the image is readonly anyway,
- * so no harm done.
- */
-#if 0
-                        /* Sector bitmap block. */
-                        if (   VHDX_BAT_ENTRY_GET_STATE(paBatEntries[i].u64BatEntry)
-                            != VHDX_BAT_ENTRY_SB_BLOCK_NOT_PRESENT)
-                        {
-                            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                                           "VHDX: Sector bitmap block at entry %u of image \'%s\' marked as present, violation of the specification",
-                                           i, pImage->pszFilename);
-                            break;
-                        }
-#endif
-                    }
-                    else
-                    {
-                        /* Payload block. */
-                        if (   VHDX_BAT_ENTRY_GET_STATE(paBatEntries[i].u64BatEntry)
-                            == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT)
-                        {
-                            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                                           "VHDX: Payload block at entry %u of image \'%s\' marked as partially present, violation of the specification",
-                                           i, pImage->pszFilename);
-                            break;
-                        }
-                    }
-                }
+            PVhdxLogDataSector pSector = (PVhdxLogDataSector)(pbEntry + offDataSector);
+            if (   RT_LE2H_U32(pSector->u32DataSignature) != VHDX_LOG_DATA_SECTOR_SIGNATURE
+                || RT_LE2H_U32(pSector->u32SequenceHigh) != (uint32_t)(pEntryHdr->u64SequenceNumber >> 32)
+                || RT_LE2H_U32(pSector->u32SequenceLow) != (uint32_t)pEntryHdr->u64SequenceNumber)
+                return false;
 
-                if (RT_SUCCESS(rc))
-                {
-                    pImage->paBat       = paBatEntries;
-                    pImage->uChunkRatio = uChunkRatio;
-                }
-            }
-            else
-                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                               "VHDX: Error reading the BAT from image \'%s\'",
-                               pImage->pszFilename);
+            offDataSector += VHDX_LOG_SECTOR_SIZE;
         }
-        else
-            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
-                           "VHDX: Out of memory allocating memory for %u BAT entries of image \'%s\'",
-                           cBatEntries, pImage->pszFilename);
+        else if (Desc.u32DataSignature != VHDX_LOG_ZERO_DESC_SIGNATURE)
+            return false;
     }
-    else
-        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                       "VHDX: Mismatch between calculated number of BAT entries and region size (expected %u got %u) for image \'%s\'",
-                       cbBatEntries, cbRegion, pImage->pszFilename);
 
-    if (   RT_FAILURE(rc)
-        && paBatEntries)
-        RTMemFree(paBatEntries);
-
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
-    return rc;
+    return offDataSector == pEntryHdr->u32EntryLength;
 }
 
 /**
- * Load the file parameters metadata item from the file.
+ * Applies the updates of a single (validated) log entry to the file.
  *
  * @returns VBox status code.
- * @param   pImage    Image instance data.
- * @param   offItem   File offset where the data is stored.
- * @param   cbItem    Size of the item in the file.
+ * @param   pImage       Image instance data.
+ * @param   pbEntry      The log entry.
+ * @param   pEntryHdr    The entry header in host endianess.
+ * @param   pbSector     Scratch buffer of VHDX_LOG_SECTOR_SIZE bytes.
  */
-static int vhdxLoadFileParametersMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+static int vhdxLogEntryReplay(PVHDXIMAGE pImage, uint8_t *pbEntry, PVhdxLogEntryHdr pEntryHdr,
+                              uint8_t *pbSector)
 {
     int rc = VINF_SUCCESS;
+    PVhdxLogDataDesc pDesc = (PVhdxLogDataDesc)(pbEntry + sizeof(VhdxLogEntryHdr));
+    uint32_t offDataSector = RT_ALIGN_32(  sizeof(VhdxLogEntryHdr)
+                                         + pEntryHdr->u32DescriptorCount * sizeof(VhdxLogDataDesc),
+                                         VHDX_LOG_SECTOR_SIZE);
 
-    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+    LogFlowFunc(("pImage=%#p u64SequenceNumber=%llu\n", pImage, pEntryHdr->u64SequenceNumber));
 
-    if (cbItem != sizeof(VhdxFileParameters))
-        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                       "VHDX: File parameters item size mismatch (expected %u got %zu) in image \'%s\'",
-                       sizeof(VhdxFileParameters), cbItem, pImage->pszFilename);
-    else
+    for (uint32_t i = 0; i < pEntryHdr->u32DescriptorCount && RT_SUCCESS(rc); i++, pDesc++)
     {
-        VhdxFileParameters FileParameters;
-
-        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
-                                   &FileParameters, sizeof(FileParameters));
-        if (RT_SUCCESS(rc))
+        if (RT_LE2H_U32(pDesc->u32DataSignature) == VHDX_LOG_DATA_DESC_SIGNATURE)
         {
-            vhdxConvFileParamsEndianess(VHDXECONV_F2H, &FileParameters, &FileParameters);
-            pImage->cbBlock = FileParameters.u32BlockSize;
-
-            /* @todo: No support for differencing images yet. */
-            if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT)
-                rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                               "VHDX: Image \'%s\' is a differencing image which is not supported yet",
-                               pImage->pszFilename);
+            PVhdxLogDataSector pSector = (PVhdxLogDataSector)(pbEntry + offDataSector);
+
+            /* The leading and trailing bytes are stored in the descriptor in file order. */
+            memcpy(pbSector, &pDesc->u64LeadingBytes, sizeof(pDesc->u64LeadingBytes));
+            memcpy(pbSector + sizeof(uint64_t), &pSector->u8Data[0], sizeof(pSector->u8Data));
+            memcpy(pbSector + VHDX_LOG_SECTOR_SIZE - sizeof(uint32_t), &pDesc->u32TrailingBytes,
+                   sizeof(pDesc->u32TrailingBytes));
+
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage,
+                                        RT_LE2H_U64(pDesc->u64FileOffset),
+                                        pbSector, VHDX_LOG_SECTOR_SIZE);
+            offDataSector += VHDX_LOG_SECTOR_SIZE;
         }
         else
-            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                           "VHDX: Reading the file parameters metadata item from image \'%s\' failed",
-                           pImage->pszFilename);
+        {
+            PVhdxLogZeroDesc pZeroDesc = (PVhdxLogZeroDesc)pDesc;
+            uint64_t offZero = RT_LE2H_U64(pZeroDesc->u64FileOffset);
+            uint64_t cbZero = RT_LE2H_U64(pZeroDesc->u64ZeroLength);
+
+            memset(pbSector, 0, VHDX_LOG_SECTOR_SIZE);
+            while (   cbZero
+                   && RT_SUCCESS(rc))
+            {
+                size_t cbThisZero = (size_t)RT_MIN(cbZero, VHDX_LOG_SECTOR_SIZE);
+
+                rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offZero,
+                                            pbSector, cbThisZero);
+                offZero += cbThisZero;
+                cbZero  -= cbThisZero;
+            }
+        }
     }
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -1293,57 +1548,780 @@ static int vhdxLoadFileParametersMetadata(PVHDXIMAGE pImage, uint64_t offItem, s
 }
 
 /**
- * Load the virtual disk size metadata item from the file.
+ * Replays the log if it contains an active sequence of entries and marks the
+ * log as empty afterwards.
  *
  * @returns VBox status code.
  * @param   pImage    Image instance data.
- * @param   offItem   File offset where the data is stored.
- * @param   cbItem    Size of the item in the file.
  */
-static int vhdxLoadVDiskSizeMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+static int vhdxLogReplay(PVHDXIMAGE pImage)
 {
     int rc = VINF_SUCCESS;
+    uint32_t cbLog = pImage->Hdr.u32LogLength;
+    uint64_t cbFile = 0;
+    uint8_t *pbLog = NULL;
+    uint8_t *pbSector = NULL;
 
-    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+    LogFlowFunc(("pImage=%#p\n", pImage));
 
-    if (cbItem != sizeof(VhdxVDiskSize))
-        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                       "VHDX: Virtual disk size item size mismatch (expected %u got %zu) in image \'%s\'",
-                       sizeof(VhdxVDiskSize), cbItem, pImage->pszFilename);
+    pbLog = (uint8_t *)RTMemAlloc(cbLog);
+    pbSector = (uint8_t *)RTMemAlloc(VHDX_LOG_SECTOR_SIZE);
+    if (pbLog && pbSector)
+    {
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pImage->Hdr.u64LogOffset,
+                                   pbLog, cbLog);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+        if (RT_FAILURE(rc))
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the log of image \'%s\' failed",
+                           pImage->pszFilename);
+    }
     else
+        rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                       "VHDX: Out of memory allocating memory for the log of image \'%s\'",
+                       pImage->pszFilename);
+
+    if (RT_SUCCESS(rc))
     {
-        VhdxVDiskSize VDiskSize;
+        VhdxLogEntryHdr EntryHdr;
+        uint64_t u64SeqMax = UINT64_MAX;
+        uint64_t u64LastFileOffset = 0;
+        uint32_t offHead = 0;
+        uint32_t offTail = 0;
+        bool fFound = false;
 
-        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
-                                   &VDiskSize, sizeof(VDiskSize));
-        if (RT_SUCCESS(rc))
+        /*
+         * The head of the active sequence is the valid entry with the highest
+         * sequence number for which the chain of entries starting at its tail
+         * is complete. Try the candidates in descending order until one is found.
+         */
+        while (!fFound)
         {
-            vhdxConvVDiskSizeEndianess(VHDXECONV_F2H, &VDiskSize, &VDiskSize);
-            pImage->cbSize = VDiskSize.u64VDiskSize;
+            uint64_t u64SeqCand = 0;
+            uint32_t offCand = 0;
+
+            for (uint32_t off = 0; off < cbLog; off += VHDX_LOG_SECTOR_SIZE)
+            {
+                if (   vhdxLogEntryIsValid(pImage, pbLog, off, &EntryHdr)
+                    && EntryHdr.u64SequenceNumber < u64SeqMax
+                    && EntryHdr.u64SequenceNumber > u64SeqCand)
+                {
+                    u64SeqCand = EntryHdr.u64SequenceNumber;
+                    offCand    = off;
+                }
+            }
+
+            if (!u64SeqCand)
+                break; /* No candidate left, the log is empty. */
+
+            u64SeqMax = u64SeqCand;
+            vhdxLogEntryIsValid(pImage, pbLog, offCand, &EntryHdr);
+            if (EntryHdr.u64FlushedFileOffset > cbFile)
+                continue;
+
+            /* Walk the sequence from the tail to the candidate. */
+            uint32_t off = EntryHdr.u32Tail;
+            uint64_t u64SeqPrev = 0;
+            unsigned cEntries = 0;
+            VhdxLogEntryHdr EntryHdrCur;
+            for (;;)
+            {
+                if (   !vhdxLogEntryIsValid(pImage, pbLog, off, &EntryHdrCur)
+                    || (u64SeqPrev && EntryHdrCur.u64SequenceNumber != u64SeqPrev + 1)
+                    || ++cEntries > cbLog / VHDX_LOG_SECTOR_SIZE)
+                    break;
+
+                if (off == offCand)
+                {
+                    fFound            = true;
+                    offHead           = offCand;
+                    offTail           = EntryHdr.u32Tail;
+                    u64LastFileOffset = EntryHdr.u64LastFileOffset;
+                    break;
+                }
+
+                u64SeqPrev = EntryHdrCur.u64SequenceNumber;
+                off = (off + EntryHdrCur.u32EntryLength) % cbLog;
+            }
+        }
+
+        if (fFound)
+        {
+            if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                rc = vdIfError(pImage->pIfError, VERR_VD_IMAGE_READ_ONLY, RT_SRC_POS,
+                               "VHDX: Image \'%s\' has a non empty log which must be replayed by opening the image read/write",
+                               pImage->pszFilename);
+            else
+            {
+                LogRel(("VHDX: Replaying the log of image \'%s\'\n", pImage->pszFilename));
+
+                uint32_t off = offTail;
+                for (;;)
+                {
+                    vhdxLogEntryIsValid(pImage, pbLog, off, &EntryHdr);
+                    rc = vhdxLogEntryReplay(pImage, pbLog + off, &EntryHdr, pbSector);
+                    if (   RT_FAILURE(rc)
+                        || off == offHead)
+                        break;
+                    off = (off + EntryHdr.u32EntryLength) % cbLog;
+                }
+
+                if (   RT_SUCCESS(rc)
+                    && cbFile < u64LastFileOffset)
+                    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, u64LastFileOffset);
+                if (RT_FAILURE(rc))
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                   "VHDX: Replaying the log of image \'%s\' failed",
+                                   pImage->pszFilename);
+            }
+        }
+
+        /* Mark the log as empty. */
+        if (   RT_SUCCESS(rc)
+            && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+        {
+            RTUuidClear(&pImage->Hdr.UuidLog);
+            rc = vhdxUpdateHeader(pImage);
         }
-        else
-            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                           "VHDX: Reading the virtual disk size metadata item from image \'%s\' failed",
-                           pImage->pszFilename);
     }
 
+    if (pbLog)
+        RTMemFree(pbLog);
+    if (pbSector)
+        RTMemFree(pbSector);
+
     LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
 /**
- * Load the logical sector size metadata item from the file.
+ * Returns the index of the BAT entry for the payload block containing the given offset.
  *
- * @returns VBox status code.
+ * @returns BAT index.
  * @param   pImage    Image instance data.
- * @param   offItem   File offset where the data is stored.
- * @param   cbItem    Size of the item in the file.
+ * @param   uOffset   Offset in the virtual disk.
  */
-static int vhdxLoadVDiskLogSectorSizeMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+DECLINLINE(uint32_t) vhdxBatIdxFromOffset(PVHDXIMAGE pImage, uint64_t uOffset)
 {
-    int rc = VINF_SUCCESS;
-
-    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+    uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBlock == uOffset / pImage->cbBlock);
+    return idxBlock + idxBlock / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
+}
+
+/**
+ * Copies the BAT sector containing the given entry into the given buffer,
+ * converting it to the file endianess.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ * @param   idxBat    Index of the BAT entry.
+ * @param   pbSector  Where to store the BAT sector, VHDX_BAT_SECTOR_SIZE bytes.
+ */
+static void vhdxBatSectorGet(PVHDXIMAGE pImage, uint32_t idxBat, uint8_t *pbSector)
+{
+    uint32_t idxFirst = idxBat & ~(uint32_t)(VHDX_BAT_SECTOR_ENTRIES - 1);
+    uint32_t cEntries = RT_MIN(pImage->cBatEntries - idxFirst, VHDX_BAT_SECTOR_ENTRIES);
+
+    memset(pbSector, 0, VHDX_BAT_SECTOR_SIZE);
+    vhdxConvBatTableEndianess(VHDXECONV_H2F, (PVhdxBatEntry)pbSector, &pImage->paBat[idxFirst],
+                              cEntries);
+}
+
+/**
+ * Puts the given payload block onto the list of free blocks.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ * @param   offBlock  File offset of the block.
+ */
+static void vhdxBlockFreeListAdd(PVHDXIMAGE pImage, uint64_t offBlock)
+{
+    if (pImage->cBlocksFree == pImage->cBlocksFreeMax)
+    {
+        uint32_t cBlocksFreeMaxNew = pImage->cBlocksFreeMax ? pImage->cBlocksFreeMax * 2 : 16;
+        uint64_t *paoffBlocksFreeNew = (uint64_t *)RTMemRealloc(pImage->paoffBlocksFree,
+                                                                cBlocksFreeMaxNew * sizeof(uint64_t));
+        if (!paoffBlocksFreeNew)
+            return; /* The block is leaked, not worth failing the request. */
+
+        pImage->paoffBlocksFree = paoffBlocksFreeNew;
+        pImage->cBlocksFreeMax  = cBlocksFreeMaxNew;
+    }
+
+    pImage->paoffBlocksFree[pImage->cBlocksFree++] = offBlock;
+}
+
+/**
+ * Returns the file offset of a payload block to allocate, reusing discarded
+ * blocks first.
+ *
+ * @returns File offset of the block.
+ * @param   pImage    Image instance data.
+ */
+static uint64_t vhdxBlockAlloc(PVHDXIMAGE pImage)
+{
+    uint64_t offBlock;
+
+    if (pImage->cBlocksFree)
+        offBlock = pImage->paoffBlocksFree[--pImage->cBlocksFree];
+    else
+    {
+        offBlock = pImage->offBlockNext;
+        pImage->offBlockNext += pImage->cbBlock;
+    }
+
+    return offBlock;
+}
+
+/**
+ * Wakes up all I/O contexts waiting for log space once the log wrapped
+ * around, that is all pending entries were applied and flushed.
+ *
+ * The I/O contexts retry the write and either get a reservation now or
+ * are put back on the waiting list.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ */
+static void vhdxLogWaitersWake(PVHDXIMAGE pImage)
+{
+    if (   pImage->cIoCtxLogWait
+        && !pImage->cLogEntriesPending)
+    {
+        uint32_t cIoCtxLogWait = pImage->cIoCtxLogWait;
+
+        pImage->cIoCtxLogWait = 0;
+        for (uint32_t i = 0; i < cIoCtxLogWait; i++)
+            pImage->pIfIo->pfnIoCtxCompleted(pImage->pIfIo->Core.pvUser, pImage->papIoCtxLogWait[i],
+                                             VINF_SUCCESS, 0 /* cbCompleted */);
+    }
+}
+
+/**
+ * Reserves space in the log for the BAT update of a block allocation.
+ *
+ * The log is only wrapped around when all pending entries were retired, so
+ * with a steady stream of allocations it can fill up. Instead of failing the
+ * guest request the I/O context is halted until the log is empty again.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_IOCTX_HALT if the I/O context was put on the waiting list.
+ * @retval  VERR_TRY_AGAIN if there is no room and pIoCtx is NULL.
+ * @param   pImage    Image instance data.
+ * @param   pIoCtx    The I/O context to halt if the log is full,
+ *                    NULL to fail instead.
+ */
+static int vhdxLogReserve(PVHDXIMAGE pImage, PVDIOCTX pIoCtx)
+{
+    uint32_t cbLog = pImage->Hdr.u32LogLength;
+    uint32_t cbUsed =   pImage->cLogEntriesPending
+                      ? (pImage->offLogHead + cbLog - pImage->offLogTail) % cbLog
+                      : 0;
+
+    /* Keep the order of waiting requests, new ones queue up behind them. */
+    if (   !pImage->cIoCtxLogWait
+        &&   cbUsed + (uint64_t)(pImage->cLogEntriesReserved + 1) * VHDX_LOG_ENTRY_SIZE_BAT_UPDATE
+           < cbLog)
+    {
+        pImage->cLogEntriesReserved++;
+        return VINF_SUCCESS;
+    }
+
+    /* Nothing in flight which could free the log, can only happen with a tiny log. */
+    if (   !pImage->cLogEntriesPending
+        && !pImage->cLogEntriesReserved
+        && !pImage->cIoCtxLogWait)
+    {
+        LogRel(("VHDX: Log of image \'%s\' is too small\n", pImage->pszFilename));
+        return VERR_DISK_FULL;
+    }
+
+    if (!pIoCtx)
+        return VERR_TRY_AGAIN;
+
+    if (pImage->cIoCtxLogWait == pImage->cIoCtxLogWaitMax)
+    {
+        uint32_t cIoCtxLogWaitMaxNew = RT_MAX(pImage->cIoCtxLogWaitMax * 2, 16);
+        PVDIOCTX *papIoCtxLogWaitNew = (PVDIOCTX *)RTMemRealloc(pImage->papIoCtxLogWait,
+                                                                cIoCtxLogWaitMaxNew * sizeof(PVDIOCTX));
+        if (!papIoCtxLogWaitNew)
+            return VERR_NO_MEMORY;
+
+        pImage->papIoCtxLogWait  = papIoCtxLogWaitNew;
+        pImage->cIoCtxLogWaitMax = cIoCtxLogWaitMaxNew;
+    }
+
+    LogFlowFunc(("Log of image '%s' is full, halting pIoCtx=%#p\n", pImage->pszFilename, pIoCtx));
+    pImage->papIoCtxLogWait[pImage->cIoCtxLogWait++] = pIoCtx;
+    return VERR_VD_IOCTX_HALT;
+}
+
+/**
+ * Releases a log reservation which is not used because the block
+ * allocation failed.
+ *
+ * @returns nothing.
+ * @param   pImage    Image instance data.
+ */
+static void vhdxLogReserveRelease(PVHDXIMAGE pImage)
+{
+    Assert(pImage->cLogEntriesReserved);
+    pImage->cLogEntriesReserved--;
+    vhdxLogWaitersWake(pImage);
+}
+
+/**
+ * Creates the log entry for the given BAT update using the space reserved
+ * with vhdxLogReserve().
+ *
+ * The log entry consists of a single data descriptor updating the BAT sector
+ * containing the changed entry. The in memory BAT must be updated already so
+ * entries are created in the order the changes were made.
+ *
+ * @returns VBox status code.
+ * @param   pImage       Image instance data.
+ * @param   pBatUpdate   The BAT update.
+ */
+static int vhdxLogEntryCreate(PVHDXIMAGE pImage, PVHDXBATUPDATE pBatUpdate)
+{
+    uint32_t cbLog = pImage->Hdr.u32LogLength;
+
+    AssertReturn(pImage->cLogEntriesReserved, VERR_INTERNAL_ERROR);
+    pImage->cLogEntriesReserved--;
+
+    if (!pImage->cLogEntriesPending)
+        pImage->offLogTail = pImage->offLogHead;
+
+    pBatUpdate->offLogEntry = pImage->offLogHead;
+    pImage->offLogHead = (pImage->offLogHead + VHDX_LOG_ENTRY_SIZE_BAT_UPDATE) % cbLog;
+    pImage->cLogEntriesPending++;
+
+    uint64_t u64Seq = ++pImage->u64LogSeqLast;
+    uint64_t offBatSector = pImage->offBat + ((pBatUpdate->idxBat * sizeof(VhdxBatEntry)) & ~(uint64_t)(VHDX_BAT_SECTOR_SIZE - 1));
+    uint8_t *pbSector = &pBatUpdate->abLogEntry[VHDX_LOG_SECTOR_SIZE];
+    PVhdxLogEntryHdr pEntryHdr = (PVhdxLogEntryHdr)&pBatUpdate->abLogEntry[0];
+    PVhdxLogDataDesc pDesc = (PVhdxLogDataDesc)(pEntryHdr + 1);
+    PVhdxLogDataSector pDataSector = (PVhdxLogDataSector)pbSector;
+    VhdxLogEntryHdr EntryHdr;
+    VhdxLogDataDesc Desc;
+
+    memset(&pBatUpdate->abLogEntry[0], 0, sizeof(pBatUpdate->abLogEntry));
+
+    /* Get the BAT sector and move the leading and trailing bytes into the descriptor. */
+    vhdxBatSectorGet(pImage, pBatUpdate->idxBat, pbSector);
+    memcpy(&pDesc->u64LeadingBytes, pbSector, sizeof(pDesc->u64LeadingBytes));
+    memcpy(&pDesc->u32TrailingBytes, pbSector + VHDX_LOG_SECTOR_SIZE - sizeof(uint32_t),
+           sizeof(pDesc->u32TrailingBytes));
+
+    Desc.u32DataSignature  = VHDX_LOG_DATA_DESC_SIGNATURE;
+    Desc.u32TrailingBytes  = 0; /* Raw, set above. */
+    Desc.u64LeadingBytes   = 0; /* Raw, set above. */
+    Desc.u64FileOffset     = offBatSector;
+    Desc.u64SequenceNumber = u64Seq;
+    pDesc->u32DataSignature  = RT_H2LE_U32(Desc.u32DataSignature);
+    pDesc->u64FileOffset     = RT_H2LE_U64(Desc.u64FileOffset);
+    pDesc->u64SequenceNumber = RT_H2LE_U64(Desc.u64SequenceNumber);
+
+    pDataSector->u32DataSignature = RT_H2LE_U32(VHDX_LOG_DATA_SECTOR_SIGNATURE);
+    pDataSector->u32SequenceHigh  = RT_H2LE_U32((uint32_t)(u64Seq >> 32));
+    pDataSector->u32SequenceLow   = RT_H2LE_U32((uint32_t)u64Seq);
+
+    RT_ZERO(EntryHdr);
+    EntryHdr.u32Signature         = VHDX_LOG_ENTRY_HEADER_SIGNATURE;
+    EntryHdr.u32Checksum          = 0;
+    EntryHdr.u32EntryLength       = VHDX_LOG_ENTRY_SIZE_BAT_UPDATE;
+    EntryHdr.u32Tail              = pImage->offLogTail;
+    EntryHdr.u64SequenceNumber    = u64Seq;
+    EntryHdr.u32DescriptorCount   = 1;
+    EntryHdr.u64FlushedFileOffset = pImage->cbFileOpened;
+    EntryHdr.u64LastFileOffset    = pImage->offBlockNext;
+    memcpy(&EntryHdr.UuidLog, &pImage->Hdr.UuidLog, sizeof(RTUUID));
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_H2F, pEntryHdr, &EntryHdr);
+    pEntryHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(&pBatUpdate->abLogEntry[0], VHDX_LOG_ENTRY_SIZE_BAT_UPDATE));
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Completes a BAT update, retiring the log entry and freeing the state.
+ *
+ * @returns nothing.
+ * @param   pImage       Image instance data.
+ * @param   pBatUpdate   The BAT update.
+ * @param   rcReq        Status code of the update.
+ */
+static void vhdxBatUpdateComplete(PVHDXIMAGE pImage, PVHDXBATUPDATE pBatUpdate, int rcReq)
+{
+    Assert(pImage->cLogEntriesPending);
+    pImage->cLogEntriesPending--;
+    if (!pImage->cLogEntriesPending)
+        pImage->offLogTail = pImage->offLogHead;
+
+    if (   RT_SUCCESS(rcReq)
+        && pBatUpdate->offBlockFree)
+        vhdxBlockFreeListAdd(pImage, pBatUpdate->offBlockFree);
+
+    RTMemFree(pBatUpdate);
+    vhdxLogWaitersWake(pImage);
+}
+
+static DECLCALLBACK(int) vhdxBatUpdateAsync(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq);
+
+/**
+ * Advances the BAT update state machine until an I/O operation is pending or
+ * the update completed.
+ *
+ * @returns VBox status code.
+ * @param   pImage       Image instance data.
+ * @param   pIoCtx       The I/O context the update belongs to.
+ * @param   pBatUpdate   The BAT update.
+ */
+static int vhdxBatUpdateProcess(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, PVHDXBATUPDATE pBatUpdate)
+{
+    int rc = VINF_SUCCESS;
+
+    while (   RT_SUCCESS(rc)
+           && pBatUpdate->enmState != VHDXBATUPDATESTATE_COMPLETE)
+    {
+        switch (pBatUpdate->enmState)
+        {
+            case VHDXBATUPDATESTATE_LOG_WRITE:
+            {
+                pBatUpdate->enmState = VHDXBATUPDATESTATE_LOG_FLUSH;
+                rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                            pImage->Hdr.u64LogOffset + pBatUpdate->offLogEntry,
+                                            &pBatUpdate->abLogEntry[0], sizeof(pBatUpdate->abLogEntry),
+                                            pIoCtx, vhdxBatUpdateAsync, pBatUpdate);
+                break;
+            }
+            case VHDXBATUPDATESTATE_LOG_FLUSH:
+            {
+                pBatUpdate->enmState = VHDXBATUPDATESTATE_BAT_WRITE;
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        vhdxBatUpdateAsync, pBatUpdate);
+                break;
+            }
+            case VHDXBATUPDATESTATE_BAT_WRITE:
+            {
+                /*
+                 * Always write the current state of the BAT sector so a concurrent
+                 * update of the same sector finishing earlier can't roll back
+                 * the change of a later one.
+                 */
+                uint64_t offBatSector =   pImage->offBat
+                                        + ((pBatUpdate->idxBat * sizeof(VhdxBatEntry)) & ~(uint64_t)(VHDX_BAT_SECTOR_SIZE - 1));
+
+                vhdxBatSectorGet(pImage, pBatUpdate->idxBat, &pBatUpdate->abBatSector[0]);
+                pBatUpdate->enmState = VHDXBATUPDATESTATE_BAT_FLUSH;
+                rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, offBatSector,
+                                            &pBatUpdate->abBatSector[0], sizeof(pBatUpdate->abBatSector),
+                                            pIoCtx, vhdxBatUpdateAsync, pBatUpdate);
+                break;
+            }
+            case VHDXBATUPDATESTATE_BAT_FLUSH:
+            {
+                pBatUpdate->enmState = VHDXBATUPDATESTATE_COMPLETE;
+                rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx,
+                                        vhdxBatUpdateAsync, pBatUpdate);
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid state %d\n", pBatUpdate->enmState));
+                rc = VERR_INTERNAL_ERROR;
+        }
+    }
+
+    if (rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+        vhdxBatUpdateComplete(pImage, pBatUpdate, rc);
+
+    return rc;
+}
+
+/**
+ * Completion callback for the I/O operations of a BAT update.
+ */
+static DECLCALLBACK(int) vhdxBatUpdateAsync(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    PVHDXBATUPDATE pBatUpdate = (PVHDXBATUPDATE)pvUser;
+
+    if (RT_FAILURE(rcReq))
+    {
+        vhdxBatUpdateComplete(pImage, pBatUpdate, rcReq);
+        return rcReq;
+    }
+
+    return vhdxBatUpdateProcess(pImage, pIoCtx, pBatUpdate);
+}
+
+/**
+ * Updates a BAT entry in memory and starts writing the change to the
+ * log and the BAT region.
+ *
+ * The update state and the log reservation are owned by this function
+ * afterwards, even in the failure case.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the update is still in progress.
+ * @param   pImage       Image instance data.
+ * @param   pIoCtx       The I/O context the update belongs to.
+ * @param   pBatUpdate   The BAT update with idxBat, u64BatEntryNew and
+ *                       offBlockFree initialized.
+ */
+static int vhdxBatUpdate(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, PVHDXBATUPDATE pBatUpdate)
+{
+    uint64_t u64BatEntryOld = pImage->paBat[pBatUpdate->idxBat].u64BatEntry;
+
+    LogFlowFunc(("pImage=%#p idxBat=%u u64BatEntryNew=%#llx\n", pImage, pBatUpdate->idxBat,
+                 pBatUpdate->u64BatEntryNew));
+
+    pImage->paBat[pBatUpdate->idxBat].u64BatEntry = pBatUpdate->u64BatEntryNew;
+    int rc = vhdxLogEntryCreate(pImage, pBatUpdate);
+    if (RT_SUCCESS(rc))
+    {
+        pBatUpdate->enmState = VHDXBATUPDATESTATE_LOG_WRITE;
+        rc = vhdxBatUpdateProcess(pImage, pIoCtx, pBatUpdate);
+    }
+    else
+    {
+        pImage->paBat[pBatUpdate->idxBat].u64BatEntry = u64BatEntryOld;
+        RTMemFree(pBatUpdate);
+        vhdxLogWaitersWake(pImage);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Completion callback for the write of a newly allocated payload block,
+ * updates the BAT afterwards.
+ */
+static DECLCALLBACK(int) vhdxBlockAllocUpdate(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    PVHDXBATUPDATE pBatUpdate = (PVHDXBATUPDATE)pvUser;
+    int rc = rcReq;
+
+    if (RT_SUCCESS(rcReq))
+        rc = vhdxBatUpdate(pImage, pIoCtx, pBatUpdate); /* Space in the log was reserved already. */
+    else
+    {
+        /* I/O error, don't update the BAT and give the block and the log space back. */
+        vhdxBlockFreeListAdd(pImage, VHDX_BAT_ENTRY_GET_FILE_OFFSET(pBatUpdate->u64BatEntryNew));
+        RTMemFree(pBatUpdate);
+        vhdxLogReserveRelease(pImage);
+    }
+
+    return rc;
+}
+
+/**
+ * Writes the page 83 data metadata item synchronously.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxPage83Write(PVHDXIMAGE pImage)
+{
+    VhdxPage83Data Page83Data;
+
+    if (!pImage->offPage83)
+        return VERR_NOT_SUPPORTED;
+
+    vhdxConvUuidEndianess(VHDXECONV_H2F, &Page83Data.UuidPage83Data, &pImage->UuidPage83);
+    return vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, pImage->offPage83,
+                                  &Page83Data, sizeof(Page83Data));
+}
+
+/**
+ * Loads the BAT region.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offRegion Start offset of the region.
+ * @param   cbRegion  Size of the region.
+ */
+static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
+                             size_t cbRegion)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t cDataBlocks;
+    uint32_t uChunkRatio;
+    uint32_t cSectorBitmapBlocks;
+    uint32_t cBatEntries;
+    uint32_t cbBatEntries;
+    PVhdxBatEntry paBatEntries = NULL;
+
+    LogFlowFunc(("pImage=%#p\n", pImage));
+
+    /* Calculate required values first. */
+    uint64_t uChunkRatio64 = (RT_BIT_64(23) * pImage->cbLogicalSector) / pImage->cbBlock;
+    uChunkRatio = (uint32_t)uChunkRatio64; Assert(uChunkRatio == uChunkRatio64);
+    uint64_t cDataBlocks64 = pImage->cbSize / pImage->cbBlock;
+    cDataBlocks = (uint32_t)cDataBlocks64; Assert(cDataBlocks == cDataBlocks64);
+
+    if (pImage->cbSize % pImage->cbBlock)
+        cDataBlocks++;
+
+    cSectorBitmapBlocks = cDataBlocks / uChunkRatio;
+    if (cDataBlocks % uChunkRatio)
+        cSectorBitmapBlocks++;
+
+    /* Differencing images have a sector bitmap entry for the last chunk as well. */
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+        cBatEntries = cSectorBitmapBlocks * (uChunkRatio + 1);
+    else
+        cBatEntries = cDataBlocks + (cDataBlocks - 1)/uChunkRatio;
+    cbBatEntries = cBatEntries * sizeof(VhdxBatEntry);
+
+    if (cbBatEntries <= cbRegion)
+    {
+        /*
+         * Load the complete BAT region and convert it to host endianess. The sector
+         * bitmap entries are kept so the table can be written back as a whole.
+         */
+        paBatEntries = (PVhdxBatEntry)RTMemAlloc(cbBatEntries);
+        if (paBatEntries)
+        {
+            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offRegion,
+                                       paBatEntries, cbBatEntries);
+            if (RT_SUCCESS(rc))
+            {
+                vhdxConvBatTableEndianess(VHDXECONV_F2H, paBatEntries, paBatEntries,
+                                          cBatEntries);
+
+                /*
+                 * Sector bitmap entries are not validated because there are images out
+                 * there with the sector bitmap marked as present even though no payload
+                 * block of the chunk is partially present. The sector bitmap is only
+                 * accessed for partially present payload blocks.
+                 */
+                if (RT_SUCCESS(rc))
+                {
+                    pImage->paBat       = paBatEntries;
+                    pImage->uChunkRatio = uChunkRatio;
+                    pImage->cBatEntries = cBatEntries;
+                    pImage->offBat      = offRegion;
+                }
+            }
+            else
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               "VHDX: Error reading the BAT from image \'%s\'",
+                               pImage->pszFilename);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                           "VHDX: Out of memory allocating memory for %u BAT entries of image \'%s\'",
+                           cBatEntries, pImage->pszFilename);
+    }
+    else
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: Mismatch between calculated number of BAT entries and region size (expected %u got %u) for image \'%s\'",
+                       cbBatEntries, cbRegion, pImage->pszFilename);
+
+    if (   RT_FAILURE(rc)
+        && paBatEntries)
+        RTMemFree(paBatEntries);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Load the file parameters metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offItem   File offset where the data is stored.
+ * @param   cbItem    Size of the item in the file.
+ */
+static int vhdxLoadFileParametersMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+
+    if (cbItem != sizeof(VhdxFileParameters))
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: File parameters item size mismatch (expected %u got %zu) in image \'%s\'",
+                       sizeof(VhdxFileParameters), cbItem, pImage->pszFilename);
+    else
+    {
+        VhdxFileParameters FileParameters;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
+                                   &FileParameters, sizeof(FileParameters));
+        if (RT_SUCCESS(rc))
+        {
+            vhdxConvFileParamsEndianess(VHDXECONV_F2H, &FileParameters, &FileParameters);
+            pImage->cbBlock = FileParameters.u32BlockSize;
+
+            if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT)
+                pImage->uImageFlags |= VD_IMAGE_FLAGS_DIFF;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the file parameters metadata item from image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Load the virtual disk size metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offItem   File offset where the data is stored.
+ * @param   cbItem    Size of the item in the file.
+ */
+static int vhdxLoadVDiskSizeMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+
+    if (cbItem != sizeof(VhdxVDiskSize))
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: Virtual disk size item size mismatch (expected %u got %zu) in image \'%s\'",
+                       sizeof(VhdxVDiskSize), cbItem, pImage->pszFilename);
+    else
+    {
+        VhdxVDiskSize VDiskSize;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
+                                   &VDiskSize, sizeof(VDiskSize));
+        if (RT_SUCCESS(rc))
+        {
+            vhdxConvVDiskSizeEndianess(VHDXECONV_F2H, &VDiskSize, &VDiskSize);
+            pImage->cbSize = VDiskSize.u64VDiskSize;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the virtual disk size metadata item from image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Load the logical sector size metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offItem   File offset where the data is stored.
+ * @param   cbItem    Size of the item in the file.
+ */
+static int vhdxLoadVDiskLogSectorSizeMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
 
     if (cbItem != sizeof(VhdxVDiskLogicalSectorSize))
         rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
@@ -1351,22 +2329,379 @@ static int vhdxLoadVDiskLogSectorSizeMetadata(PVHDXIMAGE pImage, uint64_t offIte
                        sizeof(VhdxVDiskLogicalSectorSize), cbItem, pImage->pszFilename);
     else
     {
-        VhdxVDiskLogicalSectorSize VDiskLogSectSize;
+        VhdxVDiskLogicalSectorSize VDiskLogSectSize;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
+                                   &VDiskLogSectSize, sizeof(VDiskLogSectSize));
+        if (RT_SUCCESS(rc))
+        {
+            vhdxConvVDiskLogSectSizeEndianess(VHDXECONV_F2H, &VDiskLogSectSize,
+                                              &VDiskLogSectSize);
+            pImage->cbLogicalSector = VDiskLogSectSize.u32LogicalSectorSize;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the virtual disk logical sector size metadata item from image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Load the page 83 data metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offItem   File offset where the data is stored.
+ * @param   cbItem    Size of the item in the file.
+ */
+static int vhdxLoadPage83Metadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+
+    if (cbItem != sizeof(VhdxPage83Data))
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: Page 83 data item size mismatch (expected %u got %zu) in image \'%s\'",
+                       sizeof(VhdxPage83Data), cbItem, pImage->pszFilename);
+    else
+    {
+        VhdxPage83Data Page83Data;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
+                                   &Page83Data, sizeof(Page83Data));
+        if (RT_SUCCESS(rc))
+        {
+            vhdxConvPage83DataEndianess(VHDXECONV_F2H, &Page83Data, &Page83Data);
+            pImage->UuidPage83 = Page83Data.UuidPage83Data;
+            pImage->offPage83  = offItem;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the page 83 data metadata item from image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Converts a little endian UTF-16 string from the parent locator to UTF-8.
+ *
+ * @returns VBox status code.
+ * @param   pbLocator Start of the parent locator in memory.
+ * @param   cbLocator Size of the parent locator.
+ * @param   off       Offset of the string relative to the locator start.
+ * @param   cb        Size of the string in bytes.
+ * @param   ppsz      Where to store the converted string on success, free with RTStrFree().
+ */
+static int vhdxParentLocatorStrGet(uint8_t *pbLocator, size_t cbLocator, uint32_t off, uint16_t cb,
+                                   char **ppsz)
+{
+    if (   (uint64_t)off + cb > cbLocator
+        || cb % sizeof(RTUTF16))
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    size_t cwc = cb / sizeof(RTUTF16);
+    PRTUTF16 pwsz = (PRTUTF16)RTMemTmpAlloc((cwc + 1) * sizeof(RTUTF16));
+    if (!pwsz)
+        return VERR_NO_MEMORY;
+
+    memcpy(pwsz, pbLocator + off, cb);
+    for (size_t i = 0; i < cwc; i++)
+        pwsz[i] = RT_LE2H_U16(pwsz[i]);
+    pwsz[cwc] = '\0';
+
+    *ppsz = NULL;
+    int rc = RTUtf16ToUtf8Ex(pwsz, cwc, ppsz, 0, NULL);
+    RTMemTmpFree(pwsz);
+    return rc;
+}
+
+/**
+ * Parses a UUID stored in the parent locator, the braces used by
+ * Hyper-V are optional.
+ *
+ * @returns VBox status code.
+ * @param   pszUuid   The UUID string.
+ * @param   pUuid     Where to store the UUID.
+ */
+static int vhdxParentLocatorUuidParse(const char *pszUuid, PRTUUID pUuid)
+{
+    char szUuid[RTUUID_STR_LENGTH];
+    size_t cchUuid = strlen(pszUuid);
+
+    if (   cchUuid == RTUUID_STR_LENGTH + 1
+        && pszUuid[0] == '{'
+        && pszUuid[cchUuid - 1] == '}')
+    {
+        memcpy(szUuid, pszUuid + 1, RTUUID_STR_LENGTH - 1);
+        szUuid[RTUUID_STR_LENGTH - 1] = '\0';
+        pszUuid = szUuid;
+    }
+
+    return RTUuidFromStr(pUuid, pszUuid);
+}
+
+/**
+ * Load the parent locator metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ * @param   offItem     File offset where the data is stored.
+ * @param   cbItem      Size of the item in the file.
+ * @param   offTblEntry File offset of the metadata table entry for this item.
+ */
+static int vhdxLoadParentLocatorMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem,
+                                         uint64_t offTblEntry)
+{
+    int rc = VINF_SUCCESS;
+    uint8_t *pbLocator = NULL;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+
+    if (   cbItem < sizeof(VhdxParentLocatorHeader)
+        || cbItem > _64K)
+        return vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                         "VHDX: Parent locator item has an invalid size (%zu) in image \'%s\'",
+                         cbItem, pImage->pszFilename);
+
+    pbLocator = (uint8_t *)RTMemTmpAlloc(cbItem);
+    if (!pbLocator)
+        return vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                         "VHDX: Out of memory allocating memory for the parent locator of image \'%s\'",
+                         pImage->pszFilename);
+
+    rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem, pbLocator, cbItem);
+    if (RT_SUCCESS(rc))
+    {
+        VhdxParentLocatorHeader ParentLocatorHdr;
+
+        vhdxConvParentLocatorHeaderEndianness(VHDXECONV_F2H, &ParentLocatorHdr,
+                                              (PVhdxParentLocatorHeader)pbLocator);
+        if (RTUuidCompareStr(&ParentLocatorHdr.UuidLocatorType, VHDX_PARENT_LOCATOR_TYPE_VHDX))
+            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                           "VHDX: Image \'%s\' uses an unsupported parent locator type",
+                           pImage->pszFilename);
+        else if (  sizeof(VhdxParentLocatorHeader)
+                 + ParentLocatorHdr.u16KeyValueCount * sizeof(VhdxParentLocatorEntry) > cbItem)
+            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                           "VHDX: Parent locator of image \'%s\' exceeds the item size",
+                           pImage->pszFilename);
+        else
+        {
+            PVhdxParentLocatorEntry pEntry = (PVhdxParentLocatorEntry)(pbLocator + sizeof(VhdxParentLocatorHeader));
+
+            for (unsigned i = 0; i < ParentLocatorHdr.u16KeyValueCount && RT_SUCCESS(rc); i++, pEntry++)
+            {
+                VhdxParentLocatorEntry Entry;
+                char *pszKey = NULL;
+                char *pszValue = NULL;
+
+                vhdxConvParentLocatorEntryEndianess(VHDXECONV_F2H, &Entry, pEntry);
+                rc = vhdxParentLocatorStrGet(pbLocator, cbItem, Entry.u32KeyOffset,
+                                             Entry.u16KeyLength, &pszKey);
+                if (RT_SUCCESS(rc))
+                    rc = vhdxParentLocatorStrGet(pbLocator, cbItem, Entry.u32ValueOffset,
+                                                 Entry.u16ValueLength, &pszValue);
+                if (RT_SUCCESS(rc))
+                {
+                    if (!strcmp(pszKey, VHDX_PARENT_LOCATOR_KEY_LINKAGE))
+                        rc = vhdxParentLocatorUuidParse(pszValue, &pImage->UuidParentLinkage);
+                    else if (!strcmp(pszKey, VHDX_PARENT_LOCATOR_KEY_PARENT_UUID))
+                        rc = vhdxParentLocatorUuidParse(pszValue, &pImage->UuidParent);
+                    else if (!strcmp(pszKey, VHDX_PARENT_LOCATOR_KEY_ABSOLUTE_PATH))
+                    {
+                        RTStrFree(pImage->pszParentAbsPath);
+                        pImage->pszParentAbsPath = pszValue;
+                        pszValue = NULL;
+                    }
+                    else if (!strcmp(pszKey, VHDX_PARENT_LOCATOR_KEY_RELATIVE_PATH))
+                    {
+                        RTStrFree(pImage->pszParentRelPath);
+                        pImage->pszParentRelPath = pszValue;
+                        pszValue = NULL;
+                    }
+                    else if (!strcmp(pszKey, VHDX_PARENT_LOCATOR_KEY_VOLUME_PATH))
+                    {
+                        RTStrFree(pImage->pszParentVolPath);
+                        pImage->pszParentVolPath = pszValue;
+                        pszValue = NULL;
+                    }
+                    /* else: Unknown keys are ignored. */
+                }
+
+                if (pszKey)
+                    RTStrFree(pszKey);
+                if (pszValue)
+                    RTStrFree(pszValue);
+            }
+
+            if (RT_FAILURE(rc))
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               "VHDX: Parent locator of image \'%s\' is corrupt",
+                               pImage->pszFilename);
+            else
+            {
+                pImage->offParentLocator         = offItem;
+                pImage->cbParentLocatorMax       = (uint32_t)cbItem;
+                pImage->offParentLocatorTblEntry = offTblEntry;
+            }
+        }
+    }
+    else
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                       "VHDX: Reading the parent locator metadata item from image \'%s\' failed",
+                       pImage->pszFilename);
+
+    RTMemTmpFree(pbLocator);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Appends a key value pair to the parent locator being built.
+ *
+ * @returns VBox status code.
+ * @param   pbLocator   The parent locator buffer.
+ * @param   cbLocator   Size of the buffer.
+ * @param   poffData    Where the key value data starts, updated on success.
+ * @param   pszKey      The key.
+ * @param   pszValue    The value.
+ */
+static int vhdxParentLocatorKeyAdd(uint8_t *pbLocator, size_t cbLocator, uint32_t *poffData,
+                                   const char *pszKey, const char *pszValue)
+{
+    PVhdxParentLocatorHeader pHdr = (PVhdxParentLocatorHeader)pbLocator;
+    uint16_t cKeys = RT_LE2H_U16(pHdr->u16KeyValueCount);
+    PVhdxParentLocatorEntry pEntry = (PVhdxParentLocatorEntry)(pbLocator + sizeof(VhdxParentLocatorHeader)) + cKeys;
+    const char *apsz[2] = { pszKey, pszValue };
+    uint32_t aoff[2];
+    uint16_t acb[2];
+    int rc = VINF_SUCCESS;
+
+    if ((uint8_t *)(pEntry + 1) > pbLocator + cbLocator)
+        return VERR_BUFFER_OVERFLOW;
+
+    for (unsigned i = 0; i < RT_ELEMENTS(apsz) && RT_SUCCESS(rc); i++)
+    {
+        PRTUTF16 pwsz = NULL;
+        size_t cwc = 0;
 
-        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
-                                   &VDiskLogSectSize, sizeof(VDiskLogSectSize));
+        rc = RTStrToUtf16Ex(apsz[i], RTSTR_MAX, &pwsz, 0, &cwc);
         if (RT_SUCCESS(rc))
         {
-            vhdxConvVDiskLogSectSizeEndianess(VHDXECONV_F2H, &VDiskLogSectSize,
-                                              &VDiskLogSectSize);
-            pImage->cbLogicalSector = VDiskLogSectSize.u32LogicalSectorSize;
+            if (   *poffData + cwc * sizeof(RTUTF16) <= cbLocator
+                && cwc * sizeof(RTUTF16) <= UINT16_MAX)
+            {
+                PRTUTF16 pwszDst = (PRTUTF16)(pbLocator + *poffData);
+
+                for (size_t iwc = 0; iwc < cwc; iwc++)
+                    pwszDst[iwc] = RT_H2LE_U16(pwsz[iwc]);
+                aoff[i] = *poffData;
+                acb[i]  = (uint16_t)(cwc * sizeof(RTUTF16));
+                *poffData += acb[i];
+            }
+            else
+                rc = VERR_BUFFER_OVERFLOW;
+
+            RTUtf16Free(pwsz);
+        }
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pEntry->u32KeyOffset   = RT_H2LE_U32(aoff[0]);
+        pEntry->u32ValueOffset = RT_H2LE_U32(aoff[1]);
+        pEntry->u16KeyLength   = RT_H2LE_U16(acb[0]);
+        pEntry->u16ValueLength = RT_H2LE_U16(acb[1]);
+        pHdr->u16KeyValueCount = RT_H2LE_U16(cKeys + 1);
+    }
+
+    return rc;
+}
+
+/**
+ * Writes the parent locator from the in memory state synchronously and
+ * updates the size in the metadata table.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxParentLocatorWrite(PVHDXIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t cbLocator = pImage->cbParentLocatorMax;
+    uint8_t *pbLocator = NULL;
+
+    LogFlowFunc(("pImage=%#p\n", pImage));
+
+    if (!pImage->offParentLocator)
+        return VERR_NOT_SUPPORTED;
+
+    pbLocator = (uint8_t *)RTMemTmpAllocZ(cbLocator);
+    if (!pbLocator)
+        return VERR_NO_MEMORY;
+
+    /* The key value data starts after the maximum number of entries written here. */
+    uint32_t offData = sizeof(VhdxParentLocatorHeader) + 5 * sizeof(VhdxParentLocatorEntry);
+    PVhdxParentLocatorHeader pHdr = (PVhdxParentLocatorHeader)pbLocator;
+    RTUUID UuidLocatorType;
+    char szUuid[RTUUID_STR_LENGTH + 2];
+
+    RTUuidFromStr(&UuidLocatorType, VHDX_PARENT_LOCATOR_TYPE_VHDX);
+    vhdxConvUuidEndianess(VHDXECONV_H2F, &pHdr->UuidLocatorType, &UuidLocatorType);
+    pHdr->u16KeyValueCount = 0;
+
+    /* Hyper-V stores the linkage with braces. */
+    szUuid[0] = '{';
+    RTUuidToStr(&pImage->UuidParentLinkage, &szUuid[1], RTUUID_STR_LENGTH);
+    szUuid[RTUUID_STR_LENGTH] = '}';
+    szUuid[RTUUID_STR_LENGTH + 1] = '\0';
+    rc = vhdxParentLocatorKeyAdd(pbLocator, cbLocator, &offData, VHDX_PARENT_LOCATOR_KEY_LINKAGE, szUuid);
+    if (RT_SUCCESS(rc))
+    {
+        RTUuidToStr(&pImage->UuidParent, szUuid, sizeof(szUuid));
+        rc = vhdxParentLocatorKeyAdd(pbLocator, cbLocator, &offData, VHDX_PARENT_LOCATOR_KEY_PARENT_UUID, szUuid);
+    }
+    if (   RT_SUCCESS(rc)
+        && pImage->pszParentAbsPath)
+        rc = vhdxParentLocatorKeyAdd(pbLocator, cbLocator, &offData, VHDX_PARENT_LOCATOR_KEY_ABSOLUTE_PATH,
+                                     pImage->pszParentAbsPath);
+    if (   RT_SUCCESS(rc)
+        && pImage->pszParentRelPath)
+        rc = vhdxParentLocatorKeyAdd(pbLocator, cbLocator, &offData, VHDX_PARENT_LOCATOR_KEY_RELATIVE_PATH,
+                                     pImage->pszParentRelPath);
+    if (   RT_SUCCESS(rc)
+        && pImage->pszParentVolPath)
+        rc = vhdxParentLocatorKeyAdd(pbLocator, cbLocator, &offData, VHDX_PARENT_LOCATOR_KEY_VOLUME_PATH,
+                                     pImage->pszParentVolPath);
+
+    if (RT_SUCCESS(rc))
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, pImage->offParentLocator,
+                                    pbLocator, offData);
+    if (RT_SUCCESS(rc))
+    {
+        /* Update the length in the metadata table entry. */
+        VhdxMetadataTblEntry MetadataTblEntry;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, pImage->offParentLocatorTblEntry,
+                                   &MetadataTblEntry, sizeof(MetadataTblEntry));
+        if (RT_SUCCESS(rc))
+        {
+            MetadataTblEntry.u32Length = RT_H2LE_U32(offData);
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, pImage->offParentLocatorTblEntry,
+                                        &MetadataTblEntry, sizeof(MetadataTblEntry));
         }
-        else
-            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
-                           "VHDX: Reading the virtual disk logical sector size metadata item from image \'%s\' failed",
-                           pImage->pszFilename);
     }
 
+    RTMemTmpFree(pbLocator);
+
     LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
@@ -1486,11 +2821,8 @@ static int vhdxLoadMetadataRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                     }
                     case VHDXMETADATAITEM_PAGE83_DATA:
                     {
-                        /*
-                         * Nothing to do here for now (marked as required but
-                         * there is no API to pass this information to the caller)
-                         * so far.
-                         */
+                        rc = vhdxLoadPage83Metadata(pImage, offMetadataItem,
+                                                    MetadataTblEntry.u32Length);
                         break;
                     }
                     case VHDXMETADATAITEM_LOGICAL_SECTOR_SIZE:
@@ -1510,9 +2842,9 @@ static int vhdxLoadMetadataRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                     }
                     case VHDXMETADATAITEM_PARENT_LOCATOR:
                     {
-                        rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                                       "VHDX: Image \'%s\' is a differencing image which is not supported yet",
-                                       pImage->pszFilename);
+                        rc = vhdxLoadParentLocatorMetadata(pImage, offMetadataItem,
+                                                           MetadataTblEntry.u32Length,
+                                                           offMetadataTblEntry);
                         break;
                     }
                     case VHDXMETADATAITEM_UNKNOWN:
@@ -1670,6 +3002,102 @@ static int vhdxLoadRegionTable(PVHDXIMAGE pImage)
     return rc;
 }
 
+/**
+ * Determines where new payload blocks are allocated and deals with blocks
+ * located beyond the end of the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   cbFile    Current size of the file.
+ */
+static int vhdxBatPrepare(PVHDXIMAGE pImage, uint64_t cbFile)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t offEnd = cbFile;
+    bool fReadOnly = RT_BOOL(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY);
+
+    LogFlowFunc(("pImage=%#p cbFile=%llu\n", pImage, cbFile));
+
+    for (uint32_t i = 0; i < pImage->cBatEntries; i++)
+    {
+        uint64_t u64BatEntry = pImage->paBat[i].u64BatEntry;
+        bool fSectorBitmap = (i % (pImage->uChunkRatio + 1)) == pImage->uChunkRatio;
+        uint64_t cbAllocated = fSectorBitmap ? _1M : pImage->cbBlock;
+        bool fAllocated;
+
+        if (fSectorBitmap)
+            fAllocated = VHDX_BAT_ENTRY_GET_STATE(u64BatEntry) == VHDX_BAT_ENTRY_SB_BLOCK_PRESENT;
+        else
+            fAllocated =    VHDX_BAT_ENTRY_GET_STATE(u64BatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT
+                         || VHDX_BAT_ENTRY_GET_STATE(u64BatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT;
+
+        if (fAllocated)
+        {
+            uint64_t offBlockEnd = VHDX_BAT_ENTRY_GET_FILE_OFFSET(u64BatEntry) + cbAllocated;
+
+            /*
+             * Blocks beyond the end of the file read as zeros. The file is extended
+             * when the image is writable, otherwise the block is treated as zeroed.
+             */
+            if (   fReadOnly
+                && offBlockEnd > cbFile
+                && !fSectorBitmap)
+                pImage->paBat[i].u64BatEntry = VHDX_BAT_ENTRY_CREATE(VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO, 0);
+            else
+                offEnd = RT_MAX(offEnd, offBlockEnd);
+        }
+    }
+
+    pImage->offBlockNext = RT_ALIGN_64(offEnd, _1M);
+    pImage->cbFileOpened = cbFile;
+
+    if (   !fReadOnly
+        && pImage->offBlockNext > cbFile)
+    {
+        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pImage->offBlockNext);
+        if (RT_SUCCESS(rc))
+            pImage->cbFileOpened = pImage->offBlockNext;
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Failed to extend image \'%s\'",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Prepares an image opened for writing, updating the header with new file write
+ * and log UUIDs as mandated by the specification.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxPrepareWrite(PVHDXIMAGE pImage)
+{
+    int rc = RTUuidCreate(&pImage->Hdr.UuidFileWrite);
+    if (RT_SUCCESS(rc))
+        rc = RTUuidCreate(&pImage->Hdr.UuidLog);
+    if (RT_SUCCESS(rc))
+    {
+        pImage->offLogHead         = 0;
+        pImage->offLogTail         = 0;
+        pImage->u64LogSeqLast      = 0;
+        pImage->cLogEntriesPending = 0;
+
+        rc = vhdxUpdateHeader(pImage);
+        if (RT_SUCCESS(rc))
+            pImage->fLogActive = true;
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Failed to update the header of image \'%s\'",
+                           pImage->pszFilename);
+    }
+
+    return rc;
+}
+
 /**
  * Internal: Open an image, constructing all necessary data structures.
  */
@@ -1686,10 +3114,6 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    /* Refuse write access, it is not implemented so far. */
-    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
-        return VERR_NOT_SUPPORTED;
-
     /*
      * Open the image.
      */
@@ -1718,23 +3142,295 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
                 else
                     rc = vhdxFindAndLoadCurrentHeader(pImage);
 
-                /* Load the region table. */
-                if (RT_SUCCESS(rc))
-                    rc = vhdxLoadRegionTable(pImage);
-            }
+                /* Replay the log before anything else is loaded because it might update it. */
+                if (   RT_SUCCESS(rc)
+                    && !RTUuidIsNull(&pImage->Hdr.UuidLog))
+                {
+                    rc = vhdxLogReplay(pImage);
+                    if (RT_SUCCESS(rc))
+                        rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+                }
+
+                /* Load the region table. */
+                if (RT_SUCCESS(rc))
+                    rc = vhdxLoadRegionTable(pImage);
+                if (RT_SUCCESS(rc))
+                    rc = vhdxBatPrepare(pImage, cbFile);
+                if (   RT_SUCCESS(rc)
+                    && !(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                    rc = vhdxPrepareWrite(pImage);
+            }
+        }
+        else
+            rc = VERR_VD_GEN_INVALID_HEADER;
+    }
+
+    if (RT_FAILURE(rc))
+        vhdxFreeImage(pImage, false);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+
+/**
+ * Internal: Create a new dynamic or differencing image.
+ */
+static int vhdxCreateImage(PVHDXIMAGE pImage, uint64_t cbSize, unsigned uImageFlags,
+                           PCVDGEOMETRY pPCHSGeometry, PCVDGEOMETRY pLCHSGeometry,
+                           PCRTUUID pUuid, unsigned uOpenFlags,
+                           PFNVDPROGRESS pfnProgress, void *pvUser,
+                           unsigned uPercentStart, unsigned uPercentSpan)
+{
+    int rc = VINF_SUCCESS;
+    uint8_t *pbBuf = NULL;
+    bool fDiff = RT_BOOL(uImageFlags & VD_IMAGE_FLAGS_DIFF);
+    uint32_t cbBlock = fDiff ? VHDX_CREATE_BLOCK_SIZE_DIFF : VHDX_CREATE_BLOCK_SIZE;
+    uint32_t uChunkRatio = (uint32_t)((RT_BIT_64(23) * VHDX_CREATE_LOGICAL_SECTOR_SIZE) / cbBlock);
+    uint32_t cDataBlocks = (uint32_t)((cbSize + cbBlock - 1) / cbBlock);
+    uint32_t cSectorBitmapBlocks = (cDataBlocks + uChunkRatio - 1) / uChunkRatio;
+    uint32_t cBatEntries =   fDiff
+                           ? cSectorBitmapBlocks * (uChunkRatio + 1)
+                           : cDataBlocks + (cDataBlocks - 1) / uChunkRatio;
+    uint32_t cbBat = RT_ALIGN_32(cBatEntries * sizeof(VhdxBatEntry), _1M);
+
+    LogFlowFunc(("pImage=%#p cbSize=%llu uImageFlags=%#x\n", pImage, cbSize, uImageFlags));
+
+    pImage->pIfError = VDIfErrorGet(pImage->pVDIfsDisk);
+    pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
+    AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
+
+    /* Create image file. */
+    rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
+                           VDOpenFlagsToFileOpenFlags(uOpenFlags & ~VD_OPEN_FLAGS_READONLY,
+                                                      true /* fCreate */),
+                           &pImage->pStorage);
+    if (RT_FAILURE(rc))
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: cannot create image '%s'",
+                         pImage->pszFilename);
+
+    pbBuf = (uint8_t *)RTMemTmpAllocZ(_1M);
+    if (!pbBuf)
+        rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                       "VHDX: Out of memory while creating image '%s'",
+                       pImage->pszFilename);
+
+    /*
+     * The first megabyte contains the file identifier, both headers and
+     * both copies of the region table.
+     */
+    if (RT_SUCCESS(rc))
+    {
+        PVhdxFileIdentifier pFileIdentifier = (PVhdxFileIdentifier)pbBuf;
+        static const char s_szCreator[] = "VirtualBox";
+
+        pFileIdentifier->u64Signature = RT_H2LE_U64(VHDX_FILE_IDENTIFIER_SIGNATURE);
+        for (unsigned i = 0; i < sizeof(s_szCreator) - 1; i++)
+            pFileIdentifier->awszCreator[i] = RT_H2LE_U16((uint16_t)s_szCreator[i]);
+
+        /* Both headers, the second one with a higher sequence number is the current one. */
+        VhdxHeader Hdr;
+        RT_ZERO(Hdr);
+        Hdr.u32Signature  = VHDX_HEADER_SIGNATURE;
+        Hdr.u16LogVersion = VHDX_HEADER_LOG_VERSION;
+        Hdr.u16Version    = VHDX_HEADER_VHDX_VERSION;
+        Hdr.u32LogLength  = VHDX_CREATE_LOG_SIZE;
+        Hdr.u64LogOffset  = VHDX_CREATE_LOG_OFFSET;
+        rc = RTUuidCreate(&Hdr.UuidFileWrite);
+        if (RT_SUCCESS(rc))
+            rc = RTUuidCreate(&Hdr.UuidDataWrite);
+        for (unsigned i = 0; i < 2 && RT_SUCCESS(rc); i++)
+        {
+            PVhdxHeader pHdr = (PVhdxHeader)(pbBuf + (i ? VHDX_HEADER2_OFFSET : VHDX_HEADER1_OFFSET));
+
+            Hdr.u64SequenceNumber = i;
+            vhdxConvHeaderEndianess(VHDXECONV_H2F, pHdr, &Hdr);
+            pHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pHdr, sizeof(VhdxHeader)));
+        }
+
+        /* The region table with the BAT and metadata regions. */
+        uint8_t *pbRegionTbl = pbBuf + VHDX_REGION_TBL_HDR_OFFSET;
+        PVhdxRegionTblHdr pRegionTblHdr = (PVhdxRegionTblHdr)pbRegionTbl;
+        PVhdxRegionTblEntry pRegTblEntry = (PVhdxRegionTblEntry)(pRegionTblHdr + 1);
+        VhdxRegionTblHdr RegionTblHdr;
+        VhdxRegionTblEntry RegTblEntry;
+
+        RT_ZERO(RegionTblHdr);
+        RegionTblHdr.u32Signature  = VHDX_REGION_TBL_HDR_SIGNATURE;
+        RegionTblHdr.u32EntryCount = 2;
+        vhdxConvRegionTblHdrEndianess(VHDXECONV_H2F, pRegionTblHdr, &RegionTblHdr);
+
+        RTUuidFromStr(&RegTblEntry.UuidObject, VHDX_REGION_TBL_ENTRY_UUID_BAT);
+        RegTblEntry.u64FileOffset = VHDX_CREATE_BAT_OFFSET;
+        RegTblEntry.u32Length     = cbBat;
+        RegTblEntry.u32Flags      = VHDX_REGION_TBL_ENTRY_FLAGS_IS_REQUIRED;
+        vhdxConvRegionTblEntryEndianess(VHDXECONV_H2F, pRegTblEntry, &RegTblEntry);
+        pRegTblEntry++;
+
+        RTUuidFromStr(&RegTblEntry.UuidObject, VHDX_REGION_TBL_ENTRY_UUID_METADATA);
+        RegTblEntry.u64FileOffset = VHDX_CREATE_METADATA_OFFSET;
+        RegTblEntry.u32Length     = VHDX_CREATE_METADATA_SIZE;
+        RegTblEntry.u32Flags      = VHDX_REGION_TBL_ENTRY_FLAGS_IS_REQUIRED;
+        vhdxConvRegionTblEntryEndianess(VHDXECONV_H2F, pRegTblEntry, &RegTblEntry);
+
+        pRegionTblHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pbRegionTbl, VHDX_REGION_TBL_SIZE_MAX));
+        memcpy(pbBuf + VHDX_REGION_TBL_HDR_OFFSET2, pbRegionTbl, VHDX_REGION_TBL_SIZE_MAX);
+
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, 0, pbBuf, _1M);
+        if (RT_FAILURE(rc))
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: cannot write the headers of image '%s'",
+                           pImage->pszFilename);
+    }
+
+    /* The metadata region. */
+    if (RT_SUCCESS(rc))
+    {
+        PVhdxMetadataTblHdr pMetadataTblHdr = (PVhdxMetadataTblHdr)pbBuf;
+        PVhdxMetadataTblEntry pMetadataTblEntry = (PVhdxMetadataTblEntry)(pMetadataTblHdr + 1);
+        VhdxMetadataTblHdr MetadataTblHdr;
+        uint32_t offItem = VHDX_METADATA_ITEM_OFFSET_MIN;
+
+        memset(pbBuf, 0, _1M);
+        RT_ZERO(MetadataTblHdr);
+        MetadataTblHdr.u64Signature  = VHDX_METADATA_TBL_HDR_SIGNATURE;
+        MetadataTblHdr.u16EntryCount = 0;
+
+        for (unsigned i = 0; i < RT_ELEMENTS(s_aVhdxMetadataItemProps); i++)
+        {
+            VhdxMetadataTblEntry MetadataTblEntry;
+            uint32_t cbItem = 0;
+            uint8_t *pbItem = pbBuf + offItem;
+
+            switch (s_aVhdxMetadataItemProps[i].enmMetadataItem)
+            {
+                case VHDXMETADATAITEM_FILE_PARAMS:
+                {
+                    VhdxFileParameters FileParameters;
+                    FileParameters.u32BlockSize = cbBlock;
+                    FileParameters.u32Flags     = fDiff ? VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT : 0;
+                    vhdxConvFileParamsEndianess(VHDXECONV_H2F, (PVhdxFileParameters)pbItem, &FileParameters);
+                    cbItem = sizeof(FileParameters);
+                    break;
+                }
+                case VHDXMETADATAITEM_VDISK_SIZE:
+                {
+                    VhdxVDiskSize VDiskSize;
+                    VDiskSize.u64VDiskSize = cbSize;
+                    vhdxConvVDiskSizeEndianess(VHDXECONV_H2F, (PVhdxVDiskSize)pbItem, &VDiskSize);
+                    cbItem = sizeof(VDiskSize);
+                    break;
+                }
+                case VHDXMETADATAITEM_PAGE83_DATA:
+                {
+                    VhdxPage83Data Page83Data;
+                    Page83Data.UuidPage83Data = *pUuid;
+                    vhdxConvPage83DataEndianess(VHDXECONV_H2F, (PVhdxPage83Data)pbItem, &Page83Data);
+                    cbItem = sizeof(Page83Data);
+                    break;
+                }
+                case VHDXMETADATAITEM_LOGICAL_SECTOR_SIZE:
+                {
+                    VhdxVDiskLogicalSectorSize VDiskLogSectSize;
+                    VDiskLogSectSize.u32LogicalSectorSize = VHDX_CREATE_LOGICAL_SECTOR_SIZE;
+                    vhdxConvVDiskLogSectSizeEndianess(VHDXECONV_H2F, (PVhdxVDiskLogicalSectorSize)pbItem,
+                                                      &VDiskLogSectSize);
+                    cbItem = sizeof(VDiskLogSectSize);
+                    break;
+                }
+                case VHDXMETADATAITEM_PHYSICAL_SECTOR_SIZE:
+                {
+                    VhdxVDiskPhysicalSectorSize VDiskPhysSectSize;
+                    VDiskPhysSectSize.u64PhysicalSectorSize = VHDX_CREATE_PHYS_SECTOR_SIZE;
+                    vhdxConvVDiskPhysSectSizeEndianess(VHDXECONV_H2F, (PVhdxVDiskPhysicalSectorSize)pbItem,
+                                                       &VDiskPhysSectSize);
+                    cbItem = sizeof(VDiskPhysSectSize);
+                    break;
+                }
+                case VHDXMETADATAITEM_PARENT_LOCATOR:
+                {
+                    if (!fDiff)
+                        continue;
+
+                    /* The parent locator gets its own area and is written after the table. */
+                    pbItem = pbBuf + 2 * VHDX_METADATA_ITEM_OFFSET_MIN;
+                    cbItem = sizeof(VhdxParentLocatorHeader);
+                    pImage->offParentLocator         = VHDX_CREATE_METADATA_OFFSET + 2 * VHDX_METADATA_ITEM_OFFSET_MIN;
+                    pImage->cbParentLocatorMax       = VHDX_CREATE_PARENT_LOCATOR_SIZE;
+                    pImage->offParentLocatorTblEntry =   VHDX_CREATE_METADATA_OFFSET
+                                                       + ((uint8_t *)pMetadataTblEntry - pbBuf);
+                    break;
+                }
+                default:
+                    AssertFailed();
+                    continue;
+            }
+
+            RTUuidFromStr(&MetadataTblEntry.UuidItem, s_aVhdxMetadataItemProps[i].pszItemUuid);
+            MetadataTblEntry.u32Offset   = (uint32_t)(pbItem - pbBuf);
+            MetadataTblEntry.u32Length   = cbItem;
+            MetadataTblEntry.u32Flags    =   (s_aVhdxMetadataItemProps[i].fIsUser ? VHDX_METADATA_TBL_ENTRY_FLAGS_IS_USER : 0)
+                                           | (s_aVhdxMetadataItemProps[i].fIsVDisk ? VHDX_METADATA_TBL_ENTRY_FLAGS_IS_VDISK : 0)
+                                           | (s_aVhdxMetadataItemProps[i].fIsRequired ? VHDX_METADATA_TBL_ENTRY_FLAGS_IS_REQUIRED : 0);
+            MetadataTblEntry.u32Reserved = 0;
+            vhdxConvMetadataTblEntryEndianess(VHDXECONV_H2F, pMetadataTblEntry, &MetadataTblEntry);
+            pMetadataTblEntry++;
+            MetadataTblHdr.u16EntryCount++;
+
+            if (s_aVhdxMetadataItemProps[i].enmMetadataItem != VHDXMETADATAITEM_PARENT_LOCATOR)
+                offItem += cbItem;
+        }
+
+        vhdxConvMetadataTblHdrEndianess(VHDXECONV_H2F, pMetadataTblHdr, &MetadataTblHdr);
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, VHDX_CREATE_METADATA_OFFSET,
+                                    pbBuf, VHDX_CREATE_METADATA_SIZE);
+        if (   RT_SUCCESS(rc)
+            && fDiff)
+            rc = vhdxParentLocatorWrite(pImage);
+        if (RT_FAILURE(rc))
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: cannot write the metadata of image '%s'",
+                           pImage->pszFilename);
+    }
+
+    /* The log and the BAT are all zeros initially, extending the file takes care of it. */
+    if (RT_SUCCESS(rc))
+    {
+        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, VHDX_CREATE_BAT_OFFSET + cbBat);
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+        if (RT_FAILURE(rc))
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, "VHDX: cannot set the size of image '%s'",
+                           pImage->pszFilename);
+    }
+
+    if (pbBuf)
+        RTMemTmpFree(pbBuf);
+
+    if (RT_SUCCESS(rc) && pfnProgress)
+        pfnProgress(pvUser, uPercentStart + uPercentSpan * 98 / 100);
+
+    /* Reopen the image to set up everything the same way as for existing images. */
+    if (RT_SUCCESS(rc))
+    {
+        rc = vhdxFreeImage(pImage, false);
+        if (RT_SUCCESS(rc))
+            rc = vhdxOpenImage(pImage, uOpenFlags);
+        if (RT_SUCCESS(rc))
+        {
+            pImage->PCHSGeometry = *pPCHSGeometry;
+            pImage->LCHSGeometry = *pLCHSGeometry;
         }
-        else
-            rc = VERR_VD_GEN_INVALID_HEADER;
     }
+    else
+        vhdxFreeImage(pImage, rc != VERR_ALREADY_EXISTS);
 
-    if (RT_FAILURE(rc))
-        vhdxFreeImage(pImage, false);
+    if (RT_SUCCESS(rc) && pfnProgress)
+        pfnProgress(pvUser, uPercentStart + uPercentSpan);
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
-
 /** @copydoc VBOXHDDBACKEND::pfnCheckIfValid */
 static DECLCALLBACK(int) vhdxCheckIfValid(const char *pszFilename, PVDINTERFACE pVDIfsDisk,
                                           PVDINTERFACE pVDIfsImage, VDTYPE *penmType)
@@ -1843,7 +3539,58 @@ static DECLCALLBACK(int) vhdxCreate(const char *pszFilename, uint64_t cbSize,
 {
     LogFlowFunc(("pszFilename=\"%s\" cbSize=%llu uImageFlags=%#x pszComment=\"%s\" pPCHSGeometry=%#p pLCHSGeometry=%#p Uuid=%RTuuid uOpenFlags=%#x uPercentStart=%u uPercentSpan=%u pVDIfsDisk=%#p pVDIfsImage=%#p pVDIfsOperation=%#p enmType=%u ppBackendData=%#p",
                  pszFilename, cbSize, uImageFlags, pszComment, pPCHSGeometry, pLCHSGeometry, pUuid, uOpenFlags, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, enmType, ppBackendData));
-    int rc = VERR_NOT_SUPPORTED;
+    int rc;
+    PVHDXIMAGE pImage;
+
+    PFNVDPROGRESS pfnProgress = NULL;
+    void *pvUser = NULL;
+    PVDINTERFACEPROGRESS pIfProgress = VDIfProgressGet(pVDIfsOperation);
+    if (pIfProgress)
+    {
+        pfnProgress = pIfProgress->pfnProgress;
+        pvUser = pIfProgress->Core.pvUser;
+    }
+
+    NOREF(pszComment);
+
+    /* Only dynamic and differencing images can be created. */
+    if (   (uImageFlags & ~(VD_IMAGE_FLAGS_DIFF))
+        || enmType != VDTYPE_HDD)
+        rc = VERR_VD_INVALID_TYPE;
+    /* Check open flags. All valid flags are supported. */
+    else if (   uOpenFlags & ~VD_OPEN_FLAGS_MASK
+             || !VALID_PTR(pszFilename)
+             || !*pszFilename
+             || !VALID_PTR(pPCHSGeometry)
+             || !VALID_PTR(pLCHSGeometry)
+             || !VALID_PTR(pUuid))
+        rc = VERR_INVALID_PARAMETER;
+    /* The specification limits the virtual disk size to 64TB. */
+    else if (   !cbSize
+             || cbSize % VHDX_CREATE_LOGICAL_SECTOR_SIZE
+             || cbSize > 64 * _1T)
+        rc = VERR_VD_INVALID_SIZE;
+    else
+    {
+        pImage = (PVHDXIMAGE)RTMemAllocZ(sizeof(VHDXIMAGE));
+        if (!pImage)
+            rc = VERR_NO_MEMORY;
+        else
+        {
+            pImage->pszFilename = pszFilename;
+            pImage->pStorage = NULL;
+            pImage->pVDIfsDisk = pVDIfsDisk;
+            pImage->pVDIfsImage = pVDIfsImage;
+
+            rc = vhdxCreateImage(pImage, cbSize, uImageFlags, pPCHSGeometry, pLCHSGeometry,
+                                 pUuid, uOpenFlags, pfnProgress, pvUser, uPercentStart,
+                                 uPercentSpan);
+            if (RT_SUCCESS(rc))
+                *ppBackendData = pImage;
+            else
+                RTMemFree(pImage);
+        }
+    }
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1923,19 +3670,28 @@ static DECLCALLBACK(int) vhdxRead(void *pBackendData, uint64_t uOffset, size_t c
         rc = VERR_INVALID_PARAMETER;
     else
     {
-        uint32_t idxBat = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBat == uOffset / pImage->cbBlock);
+        uint32_t idxBat = vhdxBatIdxFromOffset(pImage, uOffset);
         uint32_t offRead = uOffset % pImage->cbBlock;
-        uint64_t uBatEntry;
-
-        idxBat += idxBat / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
-        uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+        uint64_t uBatEntry = pImage->paBat[idxBat].u64BatEntry;
 
         cbToRead = RT_MIN(cbToRead, pImage->cbBlock - offRead);
 
         switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
         {
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT:
+            {
+                rc = VERR_VD_BLOCK_FREE;
+                break;
+            }
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNDEFINED:
+            {
+                /* Differencing images get the data from the parent. */
+                if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+                {
+                    rc = VERR_VD_BLOCK_FREE;
+                    break;
+                }
+            } /* Fall through. */
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO:
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED:
             {
@@ -1950,6 +3706,56 @@ static DECLCALLBACK(int) vhdxRead(void *pBackendData, uint64_t uOffset, size_t c
                 break;
             }
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT:
+            {
+                /*
+                 * The sector bitmap of the chunk tells which sectors are in the
+                 * block, the rest comes from the parent.
+                 */
+                uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock);
+                uint32_t idxSb = (idxBlock / pImage->uChunkRatio) * (pImage->uChunkRatio + 1) + pImage->uChunkRatio;
+                uint64_t uSbEntry = idxSb < pImage->cBatEntries ? pImage->paBat[idxSb].u64BatEntry : 0;
+
+                if (VHDX_BAT_ENTRY_GET_STATE(uSbEntry) != VHDX_BAT_ENTRY_SB_BLOCK_PRESENT)
+                {
+                    rc = VERR_VD_BLOCK_FREE;
+                    break;
+                }
+
+                /* Bit index of the first sector inside the sector bitmap block. */
+                uint64_t idxBit =   (uint64_t)(idxBlock % pImage->uChunkRatio) * (pImage->cbBlock / pImage->cbLogicalSector)
+                                  + offRead / pImage->cbLogicalSector;
+                uint64_t offSbPage = (idxBit / 8) & ~(uint64_t)(_4K - 1);
+                uint32_t idxBitPage = (uint32_t)(idxBit - offSbPage * 8);
+                uint32_t cSectors = (uint32_t)RT_MIN(cbToRead / pImage->cbLogicalSector, _4K * 8 - idxBitPage);
+                uint8_t abSbPage[_4K];
+                PVDMETAXFER pMetaXfer;
+
+                rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
+                                           VHDX_BAT_ENTRY_GET_FILE_OFFSET(uSbEntry) + offSbPage,
+                                           &abSbPage[0], sizeof(abSbPage), pIoCtx, &pMetaXfer,
+                                           NULL, NULL);
+                if (RT_FAILURE(rc))
+                    break;
+                vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+
+                /* Clip the read to the run of sectors with the same state. */
+                bool fPresent = ASMBitTest(&abSbPage[0], idxBitPage);
+                uint32_t cSectorsRun = 1;
+                while (   cSectorsRun < cSectors
+                       && ASMBitTest(&abSbPage[0], idxBitPage + cSectorsRun) == fPresent)
+                    cSectorsRun++;
+
+                cbToRead = (size_t)cSectorsRun * pImage->cbLogicalSector;
+                if (fPresent)
+                {
+                    uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offRead;
+                    rc = vdIfIoIntFileReadUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                               pIoCtx, cbToRead);
+                }
+                else
+                    rc = VERR_VD_BLOCK_FREE;
+                break;
+            }
             default:
                 rc = VERR_INVALID_PARAMETER;
                 break;
@@ -1971,7 +3777,7 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
     LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToWrite=%zu pcbWriteProcess=%#p pcbPreRead=%#p pcbPostRead=%#p\n",
                  pBackendData, uOffset, pIoCtx, cbToWrite, pcbWriteProcess, pcbPreRead, pcbPostRead));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
-    int rc;
+    int rc = VINF_SUCCESS;
 
     AssertPtr(pImage);
     Assert(uOffset % 512 == 0);
@@ -1983,7 +3789,103 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
              || cbToWrite == 0)
         rc = VERR_INVALID_PARAMETER;
     else
-        rc = VERR_NOT_SUPPORTED;
+    {
+        uint32_t idxBat = vhdxBatIdxFromOffset(pImage, uOffset);
+        uint32_t offWrite = uOffset % pImage->cbBlock;
+        uint64_t uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+        uint32_t uState = (uint32_t)VHDX_BAT_ENTRY_GET_STATE(uBatEntry);
+
+        /* Clip write range to at most the rest of the block. */
+        cbToWrite = RT_MIN(cbToWrite, pImage->cbBlock - offWrite);
+
+        do
+        {
+            if (uState == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT)
+            {
+                /* Block present in image file, write relevant data. */
+                uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offWrite;
+                rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                            pIoCtx, cbToWrite, NULL, NULL);
+                break;
+            }
+
+            /*
+             * Zero writes to blocks reading as zeros in a base image don't need
+             * to allocate anything.
+             */
+            if (   !(pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+                && !(pImage->uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES)
+                && uState != VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT
+                && vdIfIoIntIoCtxIsZero(pImage->pIfIo, pIoCtx, cbToWrite, true))
+            {
+                *pcbPreRead = 0;
+                *pcbPostRead = 0;
+                break;
+            }
+
+            if (   cbToWrite == pImage->cbBlock
+                && !(fWrite & VD_WRITE_NO_ALLOC))
+            {
+                /*
+                 * Full block write to a block not present in the file.
+                 * Partially present blocks are replaced by a fully present block
+                 * after the data from the parent was merged by the upper layer.
+                 */
+                Assert(!offWrite);
+                *pcbPreRead = 0;
+                *pcbPostRead = 0;
+
+                /* Make sure the BAT update fits into the log before writing anything. */
+                rc = vhdxLogReserve(pImage, pIoCtx);
+                if (RT_FAILURE(rc))
+                {
+                    if (rc == VERR_VD_IOCTX_HALT)
+                        cbToWrite = 0; /* Nothing processed, the write is retried when the log is empty. */
+                    break;
+                }
+
+                PVHDXBATUPDATE pBatUpdate = (PVHDXBATUPDATE)RTMemAllocZ(sizeof(VHDXBATUPDATE));
+                if (!pBatUpdate)
+                {
+                    vhdxLogReserveRelease(pImage);
+                    rc = VERR_NO_MEMORY;
+                    break;
+                }
+
+                uint64_t offBlock = vhdxBlockAlloc(pImage);
+
+                pBatUpdate->idxBat         = idxBat;
+                pBatUpdate->u64BatEntryNew = VHDX_BAT_ENTRY_CREATE(VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT, offBlock);
+                if (uState == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT)
+                    pBatUpdate->offBlockFree = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry);
+
+                rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offBlock,
+                                            pIoCtx, cbToWrite, vhdxBlockAllocUpdate, pBatUpdate);
+                if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    break;
+                else if (RT_FAILURE(rc))
+                {
+                    vhdxBlockFreeListAdd(pImage, offBlock);
+                    RTMemFree(pBatUpdate);
+                    vhdxLogReserveRelease(pImage);
+                    break;
+                }
+
+                rc = vhdxBlockAllocUpdate(pImage, pIoCtx, pBatUpdate, rc);
+            }
+            else
+            {
+                /* Trying to do a partial write to an unallocated block. Don't do
+                 * anything except letting the upper layer know what to do. */
+                *pcbPreRead = offWrite;
+                *pcbPostRead = pImage->cbBlock - cbToWrite - *pcbPreRead;
+                rc = VERR_VD_BLOCK_FREE;
+            }
+        } while (0);
+
+        if (pcbWriteProcess)
+            *pcbWriteProcess = cbToWrite;
+    }
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1994,12 +3896,147 @@ static DECLCALLBACK(int) vhdxFlush(void *pBackendData, PVDIOCTX pIoCtx)
 {
     LogFlowFunc(("pBackendData=%#p pIoCtx=%#p\n", pBackendData, pIoCtx));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
-    int rc;
+    int rc = VINF_SUCCESS;
 
     if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
         rc = VERR_VD_IMAGE_READ_ONLY;
     else
-        rc = VERR_NOT_SUPPORTED;
+    {
+        /* Write the changed data write UUID before flushing everything. */
+        if (pImage->fHdrDirty)
+            rc = vhdxHeaderWrite(pImage, pIoCtx);
+
+        if (   RT_SUCCESS(rc)
+            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx, NULL, NULL);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @copydoc VBOXHDDBACKEND::pfnDiscard */
+static DECLCALLBACK(int) vhdxDiscard(void *pBackendData, PVDIOCTX pIoCtx,
+                                     uint64_t uOffset, size_t cbDiscard,
+                                     size_t *pcbPreAllocated,
+                                     size_t *pcbPostAllocated,
+                                     size_t *pcbActuallyDiscarded,
+                                     void   **ppbmAllocationBitmap,
+                                     unsigned fDiscard)
+{
+    LogFlowFunc(("pBackendData=%#p pIoCtx=%#p uOffset=%llu cbDiscard=%zu pcbPreAllocated=%#p pcbPostAllocated=%#p pcbActuallyDiscarded=%#p ppbmAllocationBitmap=%#p fDiscard=%#x\n",
+                 pBackendData, pIoCtx, uOffset, cbDiscard, pcbPreAllocated, pcbPostAllocated, pcbActuallyDiscarded, ppbmAllocationBitmap, fDiscard));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    Assert(!(uOffset % 512));
+    Assert(!(cbDiscard % 512));
+
+    AssertMsgReturn(!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY),
+                    ("Image is readonly\n"), VERR_VD_IMAGE_READ_ONLY);
+    AssertMsgReturn(   uOffset + cbDiscard <= pImage->cbSize
+                    && cbDiscard,
+                    ("Invalid parameters uOffset=%llu cbDiscard=%zu\n",
+                     uOffset, cbDiscard),
+                     VERR_INVALID_PARAMETER);
+
+    uint32_t idxBat = vhdxBatIdxFromOffset(pImage, uOffset);
+    uint32_t offDiscard = uOffset % pImage->cbBlock;
+    uint64_t uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+
+    /* Clip range to at most the rest of the block. */
+    cbDiscard = RT_MIN(cbDiscard, pImage->cbBlock - offDiscard);
+
+    if (pcbPreAllocated)
+        *pcbPreAllocated = 0;
+
+    if (pcbPostAllocated)
+        *pcbPostAllocated = 0;
+
+    /* Partially present blocks are left alone, the parent provides parts of the data. */
+    if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT)
+    {
+        size_t cbPreAllocated = offDiscard;
+        size_t cbPostAllocated = pImage->cbBlock - cbDiscard - cbPreAllocated;
+
+        if (!cbPreAllocated && !cbPostAllocated)
+        {
+            /*
+             * Discarding a whole block. Differencing images must not expose the
+             * parent data afterwards, so the block is marked as zeroed there.
+             */
+            PVHDXBATUPDATE pBatUpdate = NULL;
+
+            /*
+             * The discard paths can't halt the I/O context, if the log is full
+             * the block just stays allocated. Discards are only hints anyway.
+             */
+            rc = vhdxLogReserve(pImage, NULL /* pIoCtx */);
+            if (RT_SUCCESS(rc))
+            {
+                pBatUpdate = (PVHDXBATUPDATE)RTMemAllocZ(sizeof(VHDXBATUPDATE));
+                if (!pBatUpdate)
+                    vhdxLogReserveRelease(pImage);
+            }
+
+            if (pBatUpdate)
+            {
+                uint32_t uStateNew =   pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF
+                                     ? VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO
+                                     : VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED;
+
+                pBatUpdate->idxBat         = idxBat;
+                pBatUpdate->u64BatEntryNew = VHDX_BAT_ENTRY_CREATE(uStateNew, 0);
+                pBatUpdate->offBlockFree   = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry);
+                rc = vhdxBatUpdate(pImage, pIoCtx, pBatUpdate);
+            }
+            else if (rc == VERR_TRY_AGAIN)
+                rc = VINF_SUCCESS;
+            else if (RT_SUCCESS(rc))
+                rc = VERR_NO_MEMORY;
+        }
+        else if (fDiscard & VD_DISCARD_MARK_UNUSED)
+        {
+            /* Just zero out the given range. */
+            void *pvZero = RTMemAllocZ(cbDiscard);
+            if (pvZero)
+            {
+                uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offDiscard;
+                rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, offFile,
+                                            pvZero, cbDiscard, pIoCtx, NULL, NULL);
+                RTMemFree(pvZero);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+        else
+        {
+            /*
+             * There is no cheap way to tell which sectors of the block are in use,
+             * so report everything outside of the discarded range as allocated and
+             * let the upper layer collect the discards until the block is free.
+             */
+            uint32_t cSectors = (uint32_t)(pImage->cbBlock / 512);
+            void *pbmAllocationBitmap = RTMemAlloc(cSectors / 8);
+            if (pbmAllocationBitmap)
+            {
+                ASMBitSetRange(pbmAllocationBitmap, 0, cSectors);
+                ASMBitClearRange(pbmAllocationBitmap, offDiscard / 512, (offDiscard + cbDiscard) / 512);
+
+                *pcbPreAllocated = cbPreAllocated;
+                *pcbPostAllocated = cbPostAllocated;
+                *ppbmAllocationBitmap = pbmAllocationBitmap;
+                rc = VERR_VD_DISCARD_ALIGNMENT_NOT_MET;
+            }
+            else
+                rc = VERR_NO_MEMORY;
+        }
+    }
+    /* else: nothing to do. */
+
+    if (pcbActuallyDiscarded)
+        *pcbActuallyDiscarded = cbDiscard;
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2218,7 +4255,10 @@ static DECLCALLBACK(int) vhdxSetOpenFlags(void *pBackendData, unsigned uOpenFlag
     int rc = VINF_SUCCESS;
 
     /* Image must be opened and the new flags must be valid. */
-    if (!pImage || (uOpenFlags & ~(VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
+    if (!pImage || (uOpenFlags & ~(  VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO
+                                   | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE
+                                   | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_DISCARD
+                                   | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
         rc = VERR_INVALID_PARAMETER;
     else
     {
@@ -2284,7 +4324,10 @@ static DECLCALLBACK(int) vhdxGetUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pImage);
 
     if (pImage)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pImage->UuidPage83;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -2305,7 +4348,11 @@ static DECLCALLBACK(int) vhdxSetUuid(void *pBackendData, PCRTUUID pUuid)
     if (pImage)
     {
         if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            /* The image UUID is kept in the page 83 data metadata item. */
+            pImage->UuidPage83 = *pUuid;
+            rc = vhdxPage83Write(pImage);
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -2326,7 +4373,10 @@ static DECLCALLBACK(int) vhdxGetModificationUuid(void *pBackendData, PRTUUID pUu
     AssertPtr(pImage);
 
     if (pImage)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pImage->Hdr.UuidDataWrite;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -2346,7 +4396,15 @@ static DECLCALLBACK(int) vhdxSetModificationUuid(void *pBackendData, PCRTUUID pU
     if (pImage)
     {
         if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            /*
+             * The modification UUID maps to the data write GUID in the header.
+             * This is called from the I/O path, the header is written on the next flush.
+             */
+            pImage->Hdr.UuidDataWrite = *pUuid;
+            pImage->fHdrDirty = true;
+            rc = VINF_SUCCESS;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -2367,7 +4425,15 @@ static DECLCALLBACK(int) vhdxGetParentUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pImage);
 
     if (pImage)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        if (pImage->offParentLocator)
+        {
+            *pUuid = pImage->UuidParent;
+            rc = VINF_SUCCESS;
+        }
+        else
+            rc = VERR_NOT_SUPPORTED;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -2387,7 +4453,14 @@ static DECLCALLBACK(int) vhdxSetParentUuid(void *pBackendData, PCRTUUID pUuid)
     if (pImage)
     {
         if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            RTUUID UuidParentOld = pImage->UuidParent;
+
+            pImage->UuidParent = *pUuid;
+            rc = vhdxParentLocatorWrite(pImage);
+            if (RT_FAILURE(rc))
+                pImage->UuidParent = UuidParentOld;
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -2408,7 +4481,16 @@ static DECLCALLBACK(int) vhdxGetParentModificationUuid(void *pBackendData, PRTUU
     AssertPtr(pImage);
 
     if (pImage)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        if (pImage->offParentLocator)
+        {
+            /* The parent linkage is the data write GUID of the parent. */
+            *pUuid = pImage->UuidParentLinkage;
+            rc = VINF_SUCCESS;
+        }
+        else
+            rc = VERR_NOT_SUPPORTED;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -2428,9 +4510,92 @@ static DECLCALLBACK(int) vhdxSetParentModificationUuid(void *pBackendData, PCRTU
     if (pImage)
     {
         if (!(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            RTUUID UuidParentLinkageOld = pImage->UuidParentLinkage;
+
+            pImage->UuidParentLinkage = *pUuid;
+            rc = vhdxParentLocatorWrite(pImage);
+            if (RT_FAILURE(rc))
+                pImage->UuidParentLinkage = UuidParentLinkageOld;
+        }
+        else
+            rc = VERR_VD_IMAGE_READ_ONLY;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @interface_method_impl{VBOXHDDBACKEND,pfnGetParentFilename} */
+static DECLCALLBACK(int) vhdxGetParentFilename(void *pBackendData, char **ppszParentFilename)
+{
+    LogFlowFunc(("pBackendData=%#p ppszParentFilename=%#p\n", pBackendData, ppszParentFilename));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    if (pImage)
+    {
+        const char *pszParent =   pImage->pszParentAbsPath
+                                ? pImage->pszParentAbsPath
+                                : pImage->pszParentRelPath
+                                ? pImage->pszParentRelPath
+                                : pImage->pszParentVolPath;
+        if (pszParent)
+        {
+            *ppszParentFilename = RTStrDup(pszParent);
+            if (!*ppszParentFilename)
+                rc = VERR_NO_MEMORY;
+        }
         else
+            rc = VERR_NOT_SUPPORTED;
+    }
+    else
+        rc = VERR_VD_NOT_OPENED;
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+/** @interface_method_impl{VBOXHDDBACKEND,pfnSetParentFilename} */
+static DECLCALLBACK(int) vhdxSetParentFilename(void *pBackendData, const char *pszParentFilename)
+{
+    LogFlowFunc(("pBackendData=%#p pszParentFilename=%s\n", pBackendData, pszParentFilename));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pImage);
+    if (pImage)
+    {
+        if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
             rc = VERR_VD_IMAGE_READ_ONLY;
+        else
+        {
+            char *pszParentAbsPathOld = pImage->pszParentAbsPath;
+
+            pImage->pszParentAbsPath = RTStrDup(pszParentFilename);
+            if (pImage->pszParentAbsPath)
+            {
+                rc = vhdxParentLocatorWrite(pImage);
+                if (RT_SUCCESS(rc))
+                {
+                    if (pszParentAbsPathOld)
+                        RTStrFree(pszParentAbsPathOld);
+                }
+                else
+                {
+                    RTStrFree(pImage->pszParentAbsPath);
+                    pImage->pszParentAbsPath = pszParentAbsPathOld;
+                }
+            }
+            else
+            {
+                pImage->pszParentAbsPath = pszParentAbsPathOld;
+                rc = VERR_NO_MEMORY;
+            }
+        }
     }
     else
         rc = VERR_VD_NOT_OPENED;
@@ -2462,7 +4627,8 @@ const VBOXHDDBACKEND g_VhdxBackend =
     /* cbSize */
     sizeof(VBOXHDDBACKEND),
     /* uBackendCaps */
-    VD_CAP_FILE | VD_CAP_VFS,
+      VD_CAP_UUID | VD_CAP_CREATE_DYNAMIC | VD_CAP_DIFF | VD_CAP_FILE
+    | VD_CAP_ASYNC | VD_CAP_VFS | VD_CAP_DISCARD,
     /* paFileExtensions */
     s_aVhdxFileExtensions,
     /* paConfigInfo */
@@ -2484,7 +4650,7 @@ const VBOXHDDBACKEND g_VhdxBackend =
     /* pfnFlush */
     vhdxFlush,
     /* pfnDiscard */
-    NULL,
+    vhdxDiscard,
     /* pfnGetVersion */
     vhdxGetVersion,
     /* pfnGetSectorSize */
@@ -2536,9 +4702,9 @@ const VBOXHDDBACKEND g_VhdxBackend =
     /* pfnSetParentTimestamp */
     NULL,
     /* pfnGetParentFilename */
-    NULL,
+    vhdxGetParentFilename,
     /* pfnSetParentFilename */
-    NULL,
+    vhdxSetParentFilename,
     /* pfnComposeLocation */
     genericFileComposeLocation,
     /* pfnComposeName */
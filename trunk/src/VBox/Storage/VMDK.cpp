@@ -32,6 +32,9 @@
 #include <iprt/rand.h>
 #include <iprt/zip.h>
 #include <iprt/asm.h>
+#include <iprt/mp.h>
+#include <iprt/req.h>
+#include <iprt/semaphore.h>
 
 #include "VDBackends.h"
 
@@ -40,6 +43,14 @@
 *   Constants And Macros, Structures and Typedefs                                                                                *
 *********************************************************************************************************************************/
 
+/** Maximum number of worker threads deflating grains of streamOptimized
+ * images in parallel. */
+#define VMDK_DEFLATE_THREADS_MAX 8
+
+/** Number of grains which can be in flight per deflate worker thread. This
+ * bounds the memory used for buffering grains which wait for emission. */
+#define VMDK_DEFLATE_JOBS_PER_THREAD 4
+
 /** Maximum encoded string size (including NUL) we allow for VMDK images.
  * Deliberately not set high to avoid running out of descriptor space. */
 #define VMDK_ENCODED_COMMENT_MAX 1024
@@ -331,6 +342,39 @@ typedef struct VMDKEXTENT
     struct VMDKIMAGE *pImage;
 } VMDKEXTENT, *PVMDKEXTENT;
 
+/**
+ * Grain deflate job for streamOptimized images. Jobs are compressed by the
+ * worker threads in any order, but written to the image strictly in the
+ * order they were submitted, so the stream layout stays unchanged.
+ */
+typedef struct VMDKDEFLATEJOB
+{
+    /** Reference to the image the grain is written to. */
+    struct VMDKIMAGE *pImage;
+    /** Extent the grain belongs to. */
+    PVMDKEXTENT     pExtent;
+    /** Compression level to use. */
+    RTZIPLEVEL      enmLevel;
+    /** Grain number, for updating the grain table on emission. */
+    uint32_t        uGrain;
+    /** LBA recorded in the grain marker. */
+    uint64_t        uLBA;
+    /** Uncompressed grain data. */
+    void            *pvGrain;
+    /** Size of the uncompressed grain. */
+    size_t          cbGrain;
+    /** Compressed grain buffer, with marker. */
+    void            *pvCompGrain;
+    /** Size of the compressed grain buffer. */
+    size_t          cbCompGrain;
+    /** Size of marker and compressed data, padded to a full sector. */
+    uint32_t        cbMarkerData;
+    /** Status code of the deflate operation. */
+    int             rc;
+    /** Event signalled when the grain has been deflated. */
+    RTSEMEVENT      hEvtDone;
+} VMDKDEFLATEJOB, *PVMDKDEFLATEJOB;
+
 /**
  * Grain table cache size. Allocated per image.
  */
@@ -472,6 +516,25 @@ typedef struct VMDKIMAGE
     size_t          cbDescAlloc;
     /** Parsed descriptor file content. */
     VMDKDESCRIPTOR  Descriptor;
+
+    /** Compression level used for writing compressed grains. */
+    RTZIPLEVEL      enmCompLevel;
+    /** Number of deflate worker threads requested, 0 for automatic. */
+    uint32_t        cDeflateThreads;
+    /** Flag whether setting up the deflate pipeline was attempted. */
+    bool            fDeflateInit;
+    /** Request pool for deflating streamOptimized grains in parallel. */
+    RTREQPOOL       hReqPoolDeflate;
+    /** Ring of deflate jobs, NULL if grains are compressed inline. */
+    PVMDKDEFLATEJOB paDeflateJobs;
+    /** Number of entries in the deflate job ring. */
+    unsigned        cDeflateJobs;
+    /** Index of the oldest job which still needs to be emitted. */
+    unsigned        iDeflateJobHead;
+    /** Number of jobs submitted but not yet emitted. */
+    unsigned        cDeflateJobsPending;
+    /** Sticky status of the deflate pipeline. */
+    int             rcDeflate;
 } VMDKIMAGE;
 
 
@@ -523,6 +586,18 @@ static const VDFILEEXTENSION s_aVmdkFileExtensions[] =
     {NULL, VDTYPE_INVALID}
 };
 
+/** Configuration keys, only evaluated when creating an image. */
+static const VDCONFIGINFO s_aVmdkConfigInfo[] =
+{
+    /* CompressionLevel is one of "store", "fast", "default" or "max" and applies
+     * to the grains of streamOptimized images. */
+    { "CompressionLevel",     "default",                                 VDCFGVALUETYPE_STRING,  VD_CFGKEY_EXPERT },
+    /* CompressionThreads of 0 selects the number of worker threads by the
+     * number of online CPUs, 1 disables parallel compression. */
+    { "CompressionThreads",   "0",                                       VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                   NULL,                                      VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
@@ -787,13 +862,14 @@ static DECLCALLBACK(int) vmdkFileDeflateHelper(void *pvUser, const void *pvBuf,
 }
 
 /**
- * Internal: deflate the uncompressed data and write to a file,
- * distinguishing between async and normal operation
+ * Internal: deflate the uncompressed data into the given buffer, prefixed by
+ * the compressed grain marker and padded to a full sector. Touches no image
+ * state, so it is safe to call from the deflate worker threads.
  */
-DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
-                                    uint64_t uOffset, const void *pvBuf,
-                                    size_t cbToWrite, uint64_t uLBA,
-                                    uint32_t *pcbMarkerData)
+static int vmdkDeflateGrain(PVMDKIMAGE pImage, RTZIPLEVEL enmLevel,
+                            void *pvCompGrain, size_t cbCompGrain,
+                            const void *pvBuf, size_t cbToWrite,
+                            uint64_t uLBA, uint32_t *pcbMarkerData)
 {
     int rc;
     PRTZIPCOMP pZip = NULL;
@@ -801,11 +877,11 @@ DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 
     DeflateState.pImage = pImage;
     DeflateState.iOffset = -1;
-    DeflateState.cbCompGrain = pExtent->cbCompGrain;
-    DeflateState.pvCompGrain = pExtent->pvCompGrain;
+    DeflateState.cbCompGrain = cbCompGrain;
+    DeflateState.pvCompGrain = pvCompGrain;
 
     rc = RTZipCompCreate(&pZip, &DeflateState, vmdkFileDeflateHelper,
-                         RTZIPTYPE_ZLIB, RTZIPLEVEL_DEFAULT);
+                         RTZIPTYPE_ZLIB, enmLevel);
     if (RT_FAILURE(rc))
         return rc;
     rc = RTZipCompress(pZip, pvBuf, cbToWrite);
@@ -822,23 +898,41 @@ DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
         if (uSize % 512)
         {
             uint32_t uSizeAlign = RT_ALIGN(uSize, 512);
-            memset((uint8_t *)pExtent->pvCompGrain + uSize, '\0',
+            memset((uint8_t *)pvCompGrain + uSize, '\0',
                    uSizeAlign - uSize);
             uSize = uSizeAlign;
         }
 
-        if (pcbMarkerData)
-            *pcbMarkerData = uSize;
+        *pcbMarkerData = uSize;
 
         /* Compressed grain marker. Data follows immediately. */
-        VMDKMARKER *pMarker = (VMDKMARKER *)pExtent->pvCompGrain;
+        VMDKMARKER *pMarker = (VMDKMARKER *)pvCompGrain;
         pMarker->uSector = RT_H2LE_U64(uLBA);
         pMarker->cbSize = RT_H2LE_U32(  DeflateState.iOffset
                                       - RT_OFFSETOF(VMDKMARKER, uType));
+    }
+    return rc;
+}
+
+/**
+ * Internal: deflate the uncompressed data and write to a file,
+ * distinguishing between async and normal operation
+ */
+DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
+                                    uint64_t uOffset, const void *pvBuf,
+                                    size_t cbToWrite, uint64_t uLBA,
+                                    uint32_t *pcbMarkerData)
+{
+    uint32_t uSize = 0;
+    int rc = vmdkDeflateGrain(pImage, pImage->enmCompLevel,
+                              pExtent->pvCompGrain, pExtent->cbCompGrain,
+                              pvBuf, cbToWrite, uLBA, &uSize);
+    if (RT_SUCCESS(rc))
+    {
+        if (pcbMarkerData)
+            *pcbMarkerData = uSize;
         rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
-                                    uOffset, pMarker, uSize);
-        if (RT_FAILURE(rc))
-            return rc;
+                                    uOffset, pExtent->pvCompGrain, uSize);
     }
     return rc;
 }
@@ -3916,6 +4010,50 @@ static int vmdkCreateStreamImage(PVMDKIMAGE pImage, uint64_t cbSize,
     return rc;
 }
 
+/**
+ * Internal: query the compression settings for a new image from the
+ * per-image config interface, if there is one.
+ */
+static int vmdkQueryCompressionConfig(PVMDKIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+    PVDINTERFACECONFIG pIfCfg = VDIfConfigGet(pImage->pVDIfsImage);
+
+    if (pIfCfg)
+    {
+        char *pszLevel = NULL;
+        rc = VDCFGQueryStringAllocDef(pIfCfg, "CompressionLevel", &pszLevel, "default");
+        if (RT_SUCCESS(rc))
+        {
+            if (!RTStrICmp(pszLevel, "store"))
+                pImage->enmCompLevel = RTZIPLEVEL_STORE;
+            else if (!RTStrICmp(pszLevel, "fast"))
+                pImage->enmCompLevel = RTZIPLEVEL_FAST;
+            else if (!RTStrICmp(pszLevel, "default"))
+                pImage->enmCompLevel = RTZIPLEVEL_DEFAULT;
+            else if (!RTStrICmp(pszLevel, "max"))
+                pImage->enmCompLevel = RTZIPLEVEL_MAX;
+            else
+                rc = vdIfError(pImage->pIfError, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                               N_("VMDK: invalid compression level '%s' for '%s'"), pszLevel, pImage->pszFilename);
+            RTMemFree(pszLevel);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           N_("VMDK: getting compression level for '%s' failed (%Rrc)"), pImage->pszFilename, rc);
+
+        if (RT_SUCCESS(rc))
+        {
+            rc = VDCFGQueryU32Def(pIfCfg, "CompressionThreads", &pImage->cDeflateThreads, 0);
+            if (RT_FAILURE(rc))
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               N_("VMDK: getting compression thread count for '%s' failed (%Rrc)"), pImage->pszFilename, rc);
+        }
+    }
+
+    return rc;
+}
+
 /**
  * Internal: The actual code for creating any VMDK variant currently in
  * existence on hosted environments.
@@ -3935,6 +4073,10 @@ static int vmdkCreateImage(PVMDKIMAGE pImage, uint64_t cbSize,
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
+    rc = vmdkQueryCompressionConfig(pImage);
+    if (RT_FAILURE(rc))
+        goto out;
+
     rc = vmdkCreateDescriptor(pImage, pImage->pDescData, pImage->cbDescAlloc,
                               &pImage->Descriptor);
     if (RT_FAILURE(rc))
@@ -4203,6 +4345,225 @@ static int vmdkStreamFlushGT(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     return rc;
 }
 
+/**
+ * Internal. Deflate worker, runs on one of the pool threads.
+ */
+static DECLCALLBACK(void) vmdkStreamDeflateWorker(PVMDKDEFLATEJOB pJob)
+{
+    pJob->rc = vmdkDeflateGrain(pJob->pImage, pJob->enmLevel,
+                                pJob->pvCompGrain, pJob->cbCompGrain,
+                                pJob->pvGrain, pJob->cbGrain,
+                                pJob->uLBA, &pJob->cbMarkerData);
+    RTSemEventSignal(pJob->hEvtDone);
+}
+
+/**
+ * Internal. Free the deflate pipeline. All jobs must have completed.
+ */
+static void vmdkStreamDeflateTerm(PVMDKIMAGE pImage)
+{
+    Assert(!pImage->cDeflateJobsPending);
+
+    if (pImage->hReqPoolDeflate != NIL_RTREQPOOL)
+    {
+        RTReqPoolRelease(pImage->hReqPoolDeflate);
+        pImage->hReqPoolDeflate = NIL_RTREQPOOL;
+    }
+
+    if (pImage->paDeflateJobs)
+    {
+        for (unsigned i = 0; i < pImage->cDeflateJobs; i++)
+        {
+            PVMDKDEFLATEJOB pJob = &pImage->paDeflateJobs[i];
+            if (pJob->hEvtDone != NIL_RTSEMEVENT)
+                RTSemEventDestroy(pJob->hEvtDone);
+            if (pJob->pvGrain)
+                RTMemFree(pJob->pvGrain);
+            if (pJob->pvCompGrain)
+                RTMemFree(pJob->pvCompGrain);
+        }
+        RTMemFree(pImage->paDeflateJobs);
+        pImage->paDeflateJobs = NULL;
+    }
+    pImage->cDeflateJobs = 0;
+    pImage->iDeflateJobHead = 0;
+}
+
+/**
+ * Internal. Set up the pipeline for deflating streamOptimized grains on
+ * worker threads. If this is not possible (single CPU, no memory, ...) the
+ * grains are compressed inline, so failing here is not an error.
+ */
+static void vmdkStreamDeflateInit(PVMDKIMAGE pImage, PVMDKEXTENT pExtent)
+{
+    int rc = VINF_SUCCESS;
+    uint32_t cThreads = pImage->cDeflateThreads;
+
+    pImage->fDeflateInit = true;
+    if (!cThreads)
+        cThreads = RTMpGetOnlineCount();
+    cThreads = RT_MIN(cThreads, VMDK_DEFLATE_THREADS_MAX);
+    if (cThreads <= 1)
+        return;
+
+    pImage->cDeflateJobs = cThreads * VMDK_DEFLATE_JOBS_PER_THREAD;
+    pImage->paDeflateJobs = (PVMDKDEFLATEJOB)RTMemAllocZ(pImage->cDeflateJobs * sizeof(VMDKDEFLATEJOB));
+    if (!pImage->paDeflateJobs)
+        rc = VERR_NO_MEMORY;
+
+    for (unsigned i = 0; i < pImage->cDeflateJobs && RT_SUCCESS(rc); i++)
+    {
+        PVMDKDEFLATEJOB pJob = &pImage->paDeflateJobs[i];
+
+        pJob->pImage      = pImage;
+        pJob->pExtent     = pExtent;
+        pJob->hEvtDone    = NIL_RTSEMEVENT;
+        pJob->cbGrain     = VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain);
+        pJob->cbCompGrain = pExtent->cbCompGrain;
+        pJob->pvGrain     = RTMemAlloc(pJob->cbGrain);
+        pJob->pvCompGrain = RTMemAlloc(pJob->cbCompGrain);
+        if (!pJob->pvGrain || !pJob->pvCompGrain)
+            rc = VERR_NO_MEMORY;
+        else
+            rc = RTSemEventCreate(&pJob->hEvtDone);
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = RTReqPoolCreate(cThreads, 10 * RT_MS_1SEC, UINT32_MAX, 0, "VmdkDefl",
+                             &pImage->hReqPoolDeflate);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("VMDK: Failed to set up parallel compression for '%s' (%Rrc), compressing on the I/O thread\n",
+                pExtent->pszFullname, rc));
+        vmdkStreamDeflateTerm(pImage);
+    }
+    else
+        LogFlowFunc(("%u deflate threads, %u jobs in flight for '%s'\n",
+                     cThreads, pImage->cDeflateJobs, pExtent->pszFullname));
+}
+
+/**
+ * Internal. Wait for the oldest pending deflate job and append it to the
+ * stream. This is the only place where the grain table entry and the append
+ * position are updated for pipelined grains, which keeps the grains in
+ * submission order.
+ */
+static int vmdkStreamDeflateEmitHead(PVMDKIMAGE pImage, bool fDiscard)
+{
+    PVMDKDEFLATEJOB pJob = &pImage->paDeflateJobs[pImage->iDeflateJobHead];
+    PVMDKEXTENT pExtent = pJob->pExtent;
+    int rc;
+
+    Assert(pImage->cDeflateJobsPending);
+    RTSemEventWait(pJob->hEvtDone, RT_INDEFINITE_WAIT);
+    pImage->iDeflateJobHead = (pImage->iDeflateJobHead + 1) % pImage->cDeflateJobs;
+    pImage->cDeflateJobsPending--;
+
+    /* Once a grain is lost the stream is unusable, drop everything after it. */
+    if (RT_FAILURE(pImage->rcDeflate) || fDiscard)
+        return pImage->rcDeflate;
+
+    rc = pJob->rc;
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t uFileOffset = pExtent->uAppendPosition;
+        if (!uFileOffset)
+            rc = VERR_INTERNAL_ERROR;
+        else
+        {
+            /* Align to sector, as the previous write could have been any size. */
+            uFileOffset = RT_ALIGN_64(uFileOffset, 512);
+
+            uint32_t uCacheLine = pJob->uGrain % pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE;
+            uint32_t uCacheEntry = pJob->uGrain % VMDK_GT_CACHELINE_SIZE;
+            pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
+
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
+                                        uFileOffset, pJob->pvCompGrain, pJob->cbMarkerData);
+            if (RT_SUCCESS(rc))
+                pExtent->uAppendPosition += pJob->cbMarkerData;
+        }
+    }
+    if (RT_FAILURE(rc))
+    {
+        pImage->rcDeflate = rc;
+        rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot write compressed data block in '%s'"), pExtent->pszFullname);
+    }
+    return rc;
+}
+
+/**
+ * Internal. Emit all pending deflate jobs, or just wait for them if the
+ * data is discarded anyway.
+ */
+static int vmdkStreamDeflateDrain(PVMDKIMAGE pImage, bool fDiscard)
+{
+    int rc = VINF_SUCCESS;
+
+    while (pImage->cDeflateJobsPending)
+    {
+        int rc2 = vmdkStreamDeflateEmitHead(pImage, fDiscard);
+        if (RT_SUCCESS(rc))
+            rc = rc2;
+    }
+    return RT_SUCCESS(rc) ? pImage->rcDeflate : rc;
+}
+
+/**
+ * Internal. Check whether a job for the given grain is still queued, i.e. the
+ * grain table entry for it is not set yet.
+ */
+static bool vmdkStreamDeflateIsPending(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, uint32_t uGrain)
+{
+    for (unsigned i = 0; i < pImage->cDeflateJobsPending; i++)
+    {
+        PVMDKDEFLATEJOB pJob = &pImage->paDeflateJobs[(pImage->iDeflateJobHead + i) % pImage->cDeflateJobs];
+        if (   pJob->pExtent == pExtent
+            && pJob->uGrain == uGrain)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * Internal. Queue a full grain for deflating on the worker threads. If the
+ * job ring is full the oldest job is emitted first.
+ */
+static int vmdkStreamDeflateSubmit(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
+                                   PVDIOCTX pIoCtx, uint64_t cbWrite,
+                                   uint64_t uSector, uint32_t uGrain)
+{
+    int rc = pImage->rcDeflate;
+    if (RT_FAILURE(rc))
+        return rc;
+
+    if (pImage->cDeflateJobsPending == pImage->cDeflateJobs)
+    {
+        rc = vmdkStreamDeflateEmitHead(pImage, false /* fDiscard */);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    PVMDKDEFLATEJOB pJob = &pImage->paDeflateJobs[  (pImage->iDeflateJobHead + pImage->cDeflateJobsPending)
+                                                  % pImage->cDeflateJobs];
+    Assert(pJob->pExtent == pExtent);
+    vdIfIoIntIoCtxCopyFrom(pImage->pIfIo, pIoCtx, pJob->pvGrain, cbWrite);
+    if (cbWrite != pJob->cbGrain)
+        memset((char *)pJob->pvGrain + cbWrite, '\0', pJob->cbGrain - cbWrite);
+    pJob->enmLevel     = pImage->enmCompLevel;
+    pJob->uGrain       = uGrain;
+    pJob->uLBA         = uSector;
+    pJob->cbMarkerData = 0;
+    pJob->rc           = VERR_INTERNAL_ERROR;
+    pImage->cDeflateJobsPending++;
+
+    rc = RTReqPoolCallVoidNoWait(pImage->hReqPoolDeflate, (PFNRT)vmdkStreamDeflateWorker, 1, pJob);
+    if (RT_FAILURE(rc))
+        vmdkStreamDeflateWorker(pJob); /* Do it ourselves, this signals the event. */
+    return VINF_SUCCESS;
+}
+
 /**
  * Internal. Free all allocated space for representing an image, and optionally
  * delete the image from disk.
@@ -4249,9 +4610,17 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete)
 
         if (pImage->uImageFlags & VD_VMDK_IMAGE_FLAGS_STREAM_OPTIMIZED)
         {
+            /* Grains still being deflated go into the stream before the
+             * grain tables. A stream with lost grains gets no footer. */
+            if (pImage->paDeflateJobs)
+            {
+                rc = vmdkStreamDeflateDrain(pImage, fDelete);
+                vmdkStreamDeflateTerm(pImage);
+            }
+
             /* No need to write any pending data if the file will be deleted
              * or if the new file wasn't successfully created. */
-            if (   !fDelete && pImage->pExtents
+            if (   !fDelete && RT_SUCCESS(rc) && pImage->pExtents
                 && pImage->pExtents[0].cGTEntries
                 && pImage->pExtents[0].uAppendPosition)
             {
@@ -4370,6 +4739,14 @@ static int vmdkFlushImage(PVMDKIMAGE pImage, PVDIOCTX pIoCtx)
     PVMDKEXTENT pExtent;
     int rc = VINF_SUCCESS;
 
+    /* Get grains which are still being deflated into the stream. */
+    if (pImage->cDeflateJobsPending)
+    {
+        rc = vmdkStreamDeflateDrain(pImage, false /* fDiscard */);
+        if (RT_FAILURE(rc))
+            goto out;
+    }
+
     /* Update descriptor if changed. */
     if (pImage->Descriptor.fDirty)
     {
@@ -4605,6 +4982,13 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 
     if (uGDEntry != uLastGDEntry)
     {
+        /* The grain table can only be written once all its grains are. */
+        if (pImage->cDeflateJobsPending)
+        {
+            rc = vmdkStreamDeflateDrain(pImage, false /* fDiscard */);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
         rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
         if (RT_FAILURE(rc))
             return rc;
@@ -4625,13 +5009,28 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     uFileOffset = RT_ALIGN_64(uFileOffset, 512);
 
     /* Paranoia check: extent type, grain table buffer presence and
-     * grain table buffer space. Also grain table entry must be clear. */
+     * grain table buffer space. Also grain table entry must be clear and
+     * the grain must not be waiting in the deflate ring, which sets the
+     * entry only on emission. */
     if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
         || !pImage->pGTCache
         || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
-        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
+        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry]
+        || (   pImage->cDeflateJobsPending
+            && vmdkStreamDeflateIsPending(pImage, pExtent, uGrain)))
         return VERR_INTERNAL_ERROR;
 
+    if (!pImage->fDeflateInit)
+        vmdkStreamDeflateInit(pImage, pExtent);
+    if (pImage->paDeflateJobs)
+    {
+        /* The grain table entry is set when the grain is emitted. */
+        rc = vmdkStreamDeflateSubmit(pImage, pExtent, pIoCtx, cbWrite, uSector, uGrain);
+        if (RT_SUCCESS(rc))
+            pExtent->uLastGrainAccess = uGrain;
+        return rc;
+    }
+
     /* Update grain table entry. */
     pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
 
@@ -5294,6 +5693,8 @@ static DECLCALLBACK(int) vmdkOpen(const char *pszFilename, unsigned uOpenFlags,
     pImage->pDescData = NULL;
     pImage->pVDIfsDisk = pVDIfsDisk;
     pImage->pVDIfsImage = pVDIfsImage;
+    pImage->enmCompLevel = RTZIPLEVEL_DEFAULT;
+    pImage->hReqPoolDeflate = NIL_RTREQPOOL;
 
     rc = vmdkOpenImage(pImage, uOpenFlags);
     if (RT_SUCCESS(rc))
@@ -5390,6 +5791,8 @@ static DECLCALLBACK(int) vmdkCreate(const char *pszFilename, uint64_t cbSize,
     pImage->pDescData = NULL;
     pImage->pVDIfsDisk = pVDIfsDisk;
     pImage->pVDIfsImage = pVDIfsImage;
+    pImage->enmCompLevel = RTZIPLEVEL_DEFAULT;
+    pImage->hReqPoolDeflate = NIL_RTREQPOOL;
     /* Descriptors for split images can be pretty large, especially if the
      * filename is long. So prepare for the worst, and allocate quite some
      * memory for the descriptor in this case. */
@@ -6582,7 +6985,7 @@ const VBOXHDDBACKEND g_VmdkBackend =
     /* paFileExtensions */
     s_aVmdkFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aVmdkConfigInfo,
     /* pfnCheckIfValid */
     vmdkCheckIfValid,
     /* pfnOpen */
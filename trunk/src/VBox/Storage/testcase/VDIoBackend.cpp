@@ -281,6 +281,60 @@ int VDIoBackendStorageGetSize(PVDIOSTORAGE pIoStorage, uint64_t *pcbSize)
     return rc;
 }
 
+int VDIoBackendStorageCopy(PVDIOSTORAGE pIoStorage, const char *pszName,
+                           PPVDIOSTORAGE ppIoStorageCopy)
+{
+    PVDIOSTORAGE pIoStorageCopy = NULL;
+    uint64_t cbSize = 0;
+    int rc = VDIoBackendStorageGetSize(pIoStorage, &cbSize);
+    if (RT_SUCCESS(rc))
+        rc = VDIoBackendStorageCreate(pIoStorage->pIoBackend,
+                                      pIoStorage->fMemory ? "memory" : "file",
+                                      pszName, pIoStorage->pfnComplete, &pIoStorageCopy);
+    if (RT_SUCCESS(rc))
+    {
+        size_t cbBuf = _1M;
+        void *pvBuf = RTMemAlloc(cbBuf);
+        if (pvBuf)
+        {
+            uint64_t off = 0;
+
+            rc = VDIoBackendStorageSetSize(pIoStorageCopy, cbSize);
+            while (   RT_SUCCESS(rc)
+                   && off < cbSize)
+            {
+                size_t cbThisCopy = (size_t)RT_MIN(cbBuf, cbSize - off);
+                RTSGSEG Seg;
+                RTSGBUF SgBuf;
+
+                Seg.pvSeg = pvBuf;
+                Seg.cbSeg = cbThisCopy;
+                RTSgBufInit(&SgBuf, &Seg, 1);
+                rc = VDIoBackendTransfer(pIoStorage, VDIOTXDIR_READ, off, cbThisCopy, &SgBuf,
+                                         NULL, true /* fSync */);
+                if (RT_SUCCESS(rc))
+                {
+                    RTSgBufReset(&SgBuf);
+                    rc = VDIoBackendTransfer(pIoStorageCopy, VDIOTXDIR_WRITE, off, cbThisCopy, &SgBuf,
+                                             NULL, true /* fSync */);
+                }
+                off += cbThisCopy;
+            }
+
+            RTMemFree(pvBuf);
+        }
+        else
+            rc = VERR_NO_MEMORY;
+
+        if (RT_SUCCESS(rc))
+            *ppIoStorageCopy = pIoStorageCopy;
+        else
+            VDIoBackendStorageDestroy(pIoStorageCopy);
+    }
+
+    return rc;
+}
+
 DECLHIDDEN(int) VDIoBackendDumpToFile(PVDIOSTORAGE pIoStorage, const char *pszPath)
 {
     int rc = VINF_SUCCESS;
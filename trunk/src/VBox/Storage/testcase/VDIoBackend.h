@@ -71,6 +71,19 @@ int VDIoBackendStorageSetSize(PVDIOSTORAGE pIoStorage, uint64_t cbSize);
 
 int VDIoBackendStorageGetSize(PVDIOSTORAGE pIoStorage, uint64_t *pcbSize);
 
+/**
+ * Creates a new storage object with a copy of the current content of the
+ * given one, using the same backend and completion handler.
+ *
+ * @returns IPRT status code.
+ *
+ * @param pIoStorage     The storage to copy.
+ * @param pszName        Name of the new storage.
+ * @param ppIoStorageCopy Where to store the handle of the copy on success.
+ */
+int VDIoBackendStorageCopy(PVDIOSTORAGE pIoStorage, const char *pszName,
+                           PPVDIOSTORAGE ppIoStorageCopy);
+
 DECLHIDDEN(int) VDIoBackendDumpToFile(PVDIOSTORAGE pIoStorage, const char *pszPath);
 
 /**
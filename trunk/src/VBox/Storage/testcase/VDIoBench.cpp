@@ -0,0 +1,584 @@
+/* $Id$ */
+/** @file
+ * VBox HDD container test utility - I/O benchmark statistics and reports.
+ */
+
+/*
+ * Copyright (C) 2015 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*
+ * The report is a JSON document with one result object per line. This keeps
+ * it readable for any JSON consumer while the baseline loader below gets away
+ * with a simple line based key lookup instead of a full JSON parser.
+ */
+
+#define LOGGROUP LOGGROUP_DEFAULT
+#include <iprt/log.h>
+#include <iprt/err.h>
+#include <iprt/mem.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/file.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/time.h>
+
+#include "VDIoBench.h"
+
+/**
+ * JSON benchmark report.
+ */
+typedef struct VDIOBENCHREPORT
+{
+    /** The stream to write to. */
+    PRTSTREAM     pStrm;
+    /** Number of results written so far. */
+    unsigned      cResults;
+} VDIOBENCHREPORT;
+
+/**
+ * A single job of a baseline.
+ */
+typedef struct VDIOBENCHBASELINEJOB
+{
+    /** Job name. */
+    char         *pszJob;
+    /** Image format. */
+    char         *pszBackend;
+    /** I/O backend. */
+    char         *pszIoBackend;
+    /** Number of images in the chain. */
+    unsigned      cImages;
+    /** Throughput in KB/s. */
+    uint64_t      uThroughputKBs;
+    /** Number of reads. */
+    uint64_t      cReads;
+    /** 99th percentile of the read latency. */
+    uint64_t      cNsReadP99;
+    /** Number of writes. */
+    uint64_t      cWrites;
+    /** 99th percentile of the write latency. */
+    uint64_t      cNsWriteP99;
+} VDIOBENCHBASELINEJOB;
+/** Pointer to a baseline job. */
+typedef VDIOBENCHBASELINEJOB *PVDIOBENCHBASELINEJOB;
+
+/**
+ * Benchmark baseline.
+ */
+typedef struct VDIOBENCHBASELINE
+{
+    /** Number of jobs. */
+    unsigned              cJobs;
+    /** Array of jobs. */
+    PVDIOBENCHBASELINEJOB paJobs;
+} VDIOBENCHBASELINE;
+
+/**
+ * Returns the bucket index for the given latency.
+ */
+static unsigned vdIoBenchHistGetIdx(uint64_t cNs)
+{
+    if (cNs < 8)
+        return (unsigned)cNs;
+
+    unsigned iBit = ASMBitLastSetU64(cNs) - 1;
+    return (iBit - 2) * 8 + ((unsigned)(cNs >> (iBit - 3)) & 7);
+}
+
+/**
+ * Returns the largest latency falling into the given bucket.
+ */
+static uint64_t vdIoBenchHistGetBucketMax(unsigned idx)
+{
+    if (idx < 8)
+        return idx;
+
+    unsigned iShift = idx / 8 - 1;
+    uint64_t uFirst = (UINT64_C(8) + idx % 8) << iShift;
+    return uFirst + ((UINT64_C(1) << iShift) - 1);
+}
+
+void VDIoBenchHistInit(PVDIOBENCHHIST pHist)
+{
+    RT_ZERO(*pHist);
+    pHist->cNsMin = UINT64_MAX;
+}
+
+void VDIoBenchHistAdd(PVDIOBENCHHIST pHist, uint64_t cNs)
+{
+    ASMAtomicIncU32(&pHist->acBuckets[vdIoBenchHistGetIdx(cNs)]);
+    ASMAtomicAddU64(&pHist->cNsTotal, cNs);
+    ASMAtomicIncU64(&pHist->cSamples);
+
+    uint64_t cNsOld = ASMAtomicReadU64(&pHist->cNsMin);
+    while (   cNs < cNsOld
+           && !ASMAtomicCmpXchgU64(&pHist->cNsMin, cNs, cNsOld))
+        cNsOld = ASMAtomicReadU64(&pHist->cNsMin);
+
+    cNsOld = ASMAtomicReadU64(&pHist->cNsMax);
+    while (   cNs > cNsOld
+           && !ASMAtomicCmpXchgU64(&pHist->cNsMax, cNs, cNsOld))
+        cNsOld = ASMAtomicReadU64(&pHist->cNsMax);
+}
+
+uint64_t VDIoBenchHistGetPercentile(PCVDIOBENCHHIST pHist, unsigned uPermille)
+{
+    if (!pHist->cSamples)
+        return 0;
+
+    uint64_t cTarget = (pHist->cSamples * RT_MIN(uPermille, 1000) + 999) / 1000;
+    uint64_t cSeen = 0;
+    for (unsigned i = 0; i < RT_ELEMENTS(pHist->acBuckets); i++)
+    {
+        cSeen += pHist->acBuckets[i];
+        if (cSeen && cSeen >= cTarget)
+            return RT_MIN(vdIoBenchHistGetBucketMax(i), pHist->cNsMax);
+    }
+
+    return pHist->cNsMax;
+}
+
+/**
+ * Returns the average latency of the histogram.
+ */
+static uint64_t vdIoBenchHistGetAvg(PCVDIOBENCHHIST pHist)
+{
+    return pHist->cSamples ? pHist->cNsTotal / pHist->cSamples : 0;
+}
+
+/**
+ * Returns the throughput of the job in KB/s.
+ */
+static uint64_t vdIoBenchGetThroughputKBs(PCVDIOBENCHRESULT pResult)
+{
+    if (!pResult->cNsElapsed)
+        return 0;
+    return pResult->cbTransferred / _1K * RT_NS_1SEC / pResult->cNsElapsed;
+}
+
+/**
+ * Returns the number of requests per second the job achieved.
+ */
+static uint64_t vdIoBenchGetIops(PCVDIOBENCHRESULT pResult)
+{
+    if (!pResult->cNsElapsed)
+        return 0;
+    return (pResult->HistRead.cSamples + pResult->HistWrite.cSamples) * RT_NS_1SEC / pResult->cNsElapsed;
+}
+
+/**
+ * Reports the latency values of one direction and prints the distribution,
+ * merging the sub-buckets of each power of two.
+ */
+static void vdIoBenchHistReport(RTTEST hTest, PCVDIOBENCHHIST pHist, const char *pszDir)
+{
+    if (!pHist->cSamples)
+        return;
+
+    RTTestValueF(hTest, pHist->cSamples, RTTESTUNIT_OCCURRENCES, "%s count", pszDir);
+    RTTestValueF(hTest, pHist->cNsMin, RTTESTUNIT_NS, "%s latency min", pszDir);
+    RTTestValueF(hTest, vdIoBenchHistGetAvg(pHist), RTTESTUNIT_NS, "%s latency avg", pszDir);
+    RTTestValueF(hTest, VDIoBenchHistGetPercentile(pHist, 500), RTTESTUNIT_NS, "%s latency p50", pszDir);
+    RTTestValueF(hTest, VDIoBenchHistGetPercentile(pHist, 900), RTTESTUNIT_NS, "%s latency p90", pszDir);
+    RTTestValueF(hTest, VDIoBenchHistGetPercentile(pHist, 990), RTTESTUNIT_NS, "%s latency p99", pszDir);
+    RTTestValueF(hTest, VDIoBenchHistGetPercentile(pHist, 999), RTTESTUNIT_NS, "%s latency p99.9", pszDir);
+    RTTestValueF(hTest, pHist->cNsMax, RTTESTUNIT_NS, "%s latency max", pszDir);
+
+    RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "%s latency distribution:\n", pszDir);
+    for (unsigned i = 0; i < RT_ELEMENTS(pHist->acBuckets); i += 8)
+    {
+        uint64_t cSamples = 0;
+        for (unsigned j = i; j < i + 8; j++)
+            cSamples += pHist->acBuckets[j];
+        if (!cSamples)
+            continue;
+
+        unsigned uPct = (unsigned)(cSamples * 1000 / pHist->cSamples);
+        char szBar[51];
+        unsigned cchBar = uPct / 20;
+        memset(szBar, '#', cchBar);
+        szBar[cchBar] = '\0';
+        RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "  %'14llu - %'14llu ns: %10llu %3u.%u%% %s\n",
+                     i < 8 ? 0 : vdIoBenchHistGetBucketMax(i - 1) + 1, vdIoBenchHistGetBucketMax(i + 7),
+                     cSamples, uPct / 10, uPct % 10, szBar);
+    }
+}
+
+void VDIoBenchResultReport(RTTEST hTest, PCVDIOBENCHRESULT pResult)
+{
+    RTTestPrintf(hTest, RTTESTLVL_ALWAYS,
+                 "%s: %s (%s, %u image(s)), %s %s, queue depth %u, %zu byte blocks, %u%% writes\n",
+                 pResult->pszJob, pResult->pszBackend, pResult->pszIoBackend, pResult->cImages,
+                 pResult->fRandom ? "random" : "sequential", pResult->fAsync ? "async" : "sync",
+                 pResult->cQueueDepth, pResult->cbBlock, pResult->uWritePct);
+    RTTestValue(hTest, "Throughput", vdIoBenchGetThroughputKBs(pResult), RTTESTUNIT_KILOBYTES_PER_SEC);
+    RTTestValue(hTest, "IOPS", vdIoBenchGetIops(pResult), RTTESTUNIT_OCCURRENCES_PER_SEC);
+    RTTestValue(hTest, "Elapsed", pResult->cNsElapsed / RT_NS_1MS, RTTESTUNIT_MS);
+    vdIoBenchHistReport(hTest, &pResult->HistRead, "Read");
+    vdIoBenchHistReport(hTest, &pResult->HistWrite, "Write");
+}
+
+/**
+ * Writes a string value escaped for JSON.
+ */
+static void vdIoBenchJsonWriteStr(PRTSTREAM pStrm, const char *psz)
+{
+    RTStrmPutCh(pStrm, '"');
+    for (; *psz; psz++)
+    {
+        unsigned char ch = (unsigned char)*psz;
+        if (ch == '"' || ch == '\\')
+        {
+            RTStrmPutCh(pStrm, '\\');
+            RTStrmPutCh(pStrm, ch);
+        }
+        else if (ch < 0x20)
+            RTStrmPrintf(pStrm, "\\u%04x", ch);
+        else
+            RTStrmPutCh(pStrm, ch);
+    }
+    RTStrmPutCh(pStrm, '"');
+}
+
+/**
+ * Writes the statistics of one direction as members of the current object.
+ */
+static void vdIoBenchJsonWriteHistStats(PRTSTREAM pStrm, PCVDIOBENCHHIST pHist, const char *pszDir)
+{
+    RTStrmPrintf(pStrm,
+                 ", \"%s_count\": %llu, \"%s_min_ns\": %llu, \"%s_avg_ns\": %llu"
+                 ", \"%s_p50_ns\": %llu, \"%s_p90_ns\": %llu, \"%s_p99_ns\": %llu"
+                 ", \"%s_p999_ns\": %llu, \"%s_max_ns\": %llu",
+                 pszDir, pHist->cSamples,
+                 pszDir, pHist->cSamples ? pHist->cNsMin : 0,
+                 pszDir, vdIoBenchHistGetAvg(pHist),
+                 pszDir, VDIoBenchHistGetPercentile(pHist, 500),
+                 pszDir, VDIoBenchHistGetPercentile(pHist, 900),
+                 pszDir, VDIoBenchHistGetPercentile(pHist, 990),
+                 pszDir, VDIoBenchHistGetPercentile(pHist, 999),
+                 pszDir, pHist->cNsMax);
+}
+
+/**
+ * Writes the non empty buckets of a histogram as an array of
+ * [upper bound in ns, count] pairs.
+ */
+static void vdIoBenchJsonWriteHistBuckets(PRTSTREAM pStrm, PCVDIOBENCHHIST pHist, const char *pszDir)
+{
+    bool fFirst = true;
+
+    RTStrmPrintf(pStrm, ", \"%s_histogram\": [", pszDir);
+    for (unsigned i = 0; i < RT_ELEMENTS(pHist->acBuckets); i++)
+    {
+        if (!pHist->acBuckets[i])
+            continue;
+        RTStrmPrintf(pStrm, "%s[%llu, %u]", fFirst ? "" : ", ",
+                     vdIoBenchHistGetBucketMax(i), pHist->acBuckets[i]);
+        fFirst = false;
+    }
+    RTStrmPutCh(pStrm, ']');
+}
+
+int VDIoBenchReportCreate(PPVDIOBENCHREPORT ppReport, const char *pszFilename)
+{
+    int rc = VINF_SUCCESS;
+    PVDIOBENCHREPORT pReport = (PVDIOBENCHREPORT)RTMemAllocZ(sizeof(VDIOBENCHREPORT));
+
+    if (pReport)
+    {
+        rc = RTStrmOpen(pszFilename, "w", &pReport->pStrm);
+        if (RT_SUCCESS(rc))
+        {
+            RTStrmPrintf(pReport->pStrm, "{\n  \"tool\": \"tstVDIo\",\n  \"format\": 1,\n  \"results\": [");
+            *ppReport = pReport;
+        }
+        else
+            RTMemFree(pReport);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
+int VDIoBenchReportAdd(PVDIOBENCHREPORT pReport, const char *pszScript, PCVDIOBENCHRESULT pResult)
+{
+    PRTSTREAM pStrm = pReport->pStrm;
+
+    RTStrmPrintf(pStrm, "%s\n    {\"job\": ", pReport->cResults ? "," : "");
+    vdIoBenchJsonWriteStr(pStrm, pResult->pszJob);
+    RTStrmPrintf(pStrm, ", \"script\": ");
+    vdIoBenchJsonWriteStr(pStrm, pszScript);
+    RTStrmPrintf(pStrm, ", \"backend\": ");
+    vdIoBenchJsonWriteStr(pStrm, pResult->pszBackend);
+    RTStrmPrintf(pStrm, ", \"iobackend\": ");
+    vdIoBenchJsonWriteStr(pStrm, pResult->pszIoBackend);
+    RTStrmPrintf(pStrm,
+                 ", \"images\": %u, \"mode\": \"%s\", \"async\": %s, \"queuedepth\": %u"
+                 ", \"blocksize\": %zu, \"writepct\": %u, \"bytes\": %llu, \"elapsed_ns\": %llu"
+                 ", \"throughput_kbs\": %llu, \"iops\": %llu",
+                 pResult->cImages, pResult->fRandom ? "rnd" : "seq",
+                 pResult->fAsync ? "true" : "false", pResult->cQueueDepth,
+                 pResult->cbBlock, pResult->uWritePct, pResult->cbTransferred,
+                 pResult->cNsElapsed, vdIoBenchGetThroughputKBs(pResult),
+                 vdIoBenchGetIops(pResult));
+    vdIoBenchJsonWriteHistStats(pStrm, &pResult->HistRead, "read");
+    vdIoBenchJsonWriteHistStats(pStrm, &pResult->HistWrite, "write");
+    vdIoBenchJsonWriteHistBuckets(pStrm, &pResult->HistRead, "read");
+    vdIoBenchJsonWriteHistBuckets(pStrm, &pResult->HistWrite, "write");
+    RTStrmPutCh(pStrm, '}');
+    pReport->cResults++;
+
+    return RTStrmError(pStrm);
+}
+
+void VDIoBenchReportDestroy(PVDIOBENCHREPORT pReport)
+{
+    RTStrmPrintf(pReport->pStrm, "\n  ]\n}\n");
+    RTStrmClose(pReport->pStrm);
+    RTMemFree(pReport);
+}
+
+/**
+ * Returns the value of the given member in a report line.
+ *
+ * @returns Pointer to the first character of the value, NULL if not found.
+ * @param   pszLine    The line to search.
+ * @param   pszKey     The member name.
+ */
+static const char *vdIoBenchBaselineFindValue(const char *pszLine, const char *pszKey)
+{
+    size_t cchKey = strlen(pszKey);
+    const char *psz = pszLine;
+
+    while ((psz = strchr(psz, '"')) != NULL)
+    {
+        psz++;
+        if (   !strncmp(psz, pszKey, cchKey)
+            && psz[cchKey] == '"'
+            && psz[cchKey + 1] == ':')
+        {
+            psz = RTStrStripL(psz + cchKey + 2);
+            return psz;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Returns the string value of the given member, unescaped.
+ *
+ * @returns Duplicated string to be freed with RTMemFree(), NULL if not found
+ *          or out of memory.
+ */
+static char *vdIoBenchBaselineQueryStr(const char *pszLine, const char *pszKey)
+{
+    const char *psz = vdIoBenchBaselineFindValue(pszLine, pszKey);
+    if (!psz || *psz != '"')
+        return NULL;
+
+    psz++;
+    char *pszRet = (char *)RTMemAlloc(strlen(psz) + 1);
+    if (pszRet)
+    {
+        char *pszDst = pszRet;
+        while (*psz && *psz != '"')
+        {
+            if (*psz == '\\' && psz[1])
+                psz++;
+            *pszDst++ = *psz++;
+        }
+        *pszDst = '\0';
+    }
+
+    return pszRet;
+}
+
+/**
+ * Returns the numeric value of the given member, 0 if not found.
+ */
+static uint64_t vdIoBenchBaselineQueryU64(const char *pszLine, const char *pszKey)
+{
+    uint64_t u64 = 0;
+    const char *psz = vdIoBenchBaselineFindValue(pszLine, pszKey);
+    if (psz)
+        RTStrToUInt64Ex(psz, NULL, 10, &u64);
+    return u64;
+}
+
+/**
+ * Parses a single result line and adds it to the baseline.
+ */
+static int vdIoBenchBaselineAddLine(PVDIOBENCHBASELINE pBaseline, const char *pszLine)
+{
+    if (!(pBaseline->cJobs % 16))
+    {
+        PVDIOBENCHBASELINEJOB paJobsNew = (PVDIOBENCHBASELINEJOB)RTMemRealloc(pBaseline->paJobs,
+                                                                              (pBaseline->cJobs + 16) * sizeof(VDIOBENCHBASELINEJOB));
+        if (!paJobsNew)
+            return VERR_NO_MEMORY;
+        pBaseline->paJobs = paJobsNew;
+    }
+
+    PVDIOBENCHBASELINEJOB pJob = &pBaseline->paJobs[pBaseline->cJobs];
+    pJob->pszJob         = vdIoBenchBaselineQueryStr(pszLine, "job");
+    pJob->pszBackend     = vdIoBenchBaselineQueryStr(pszLine, "backend");
+    pJob->pszIoBackend   = vdIoBenchBaselineQueryStr(pszLine, "iobackend");
+    pJob->cImages        = (unsigned)vdIoBenchBaselineQueryU64(pszLine, "images");
+    pJob->uThroughputKBs = vdIoBenchBaselineQueryU64(pszLine, "throughput_kbs");
+    pJob->cReads         = vdIoBenchBaselineQueryU64(pszLine, "read_count");
+    pJob->cNsReadP99     = vdIoBenchBaselineQueryU64(pszLine, "read_p99_ns");
+    pJob->cWrites        = vdIoBenchBaselineQueryU64(pszLine, "write_count");
+    pJob->cNsWriteP99    = vdIoBenchBaselineQueryU64(pszLine, "write_p99_ns");
+
+    if (   !pJob->pszJob
+        || !pJob->pszBackend
+        || !pJob->pszIoBackend)
+    {
+        RTMemFree(pJob->pszJob);
+        RTMemFree(pJob->pszBackend);
+        RTMemFree(pJob->pszIoBackend);
+        return VERR_INVALID_PARAMETER;
+    }
+
+    pBaseline->cJobs++;
+    return VINF_SUCCESS;
+}
+
+int VDIoBenchBaselineLoad(PPVDIOBENCHBASELINE ppBaseline, const char *pszFilename)
+{
+    void *pvFile = NULL;
+    size_t cbFile = 0;
+    int rc = RTFileReadAll(pszFilename, &pvFile, &cbFile);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PVDIOBENCHBASELINE pBaseline = (PVDIOBENCHBASELINE)RTMemAllocZ(sizeof(VDIOBENCHBASELINE));
+    char *pszContent = (char *)RTMemAlloc(cbFile + 1);
+    if (pBaseline && pszContent)
+    {
+        memcpy(pszContent, pvFile, cbFile);
+        pszContent[cbFile] = '\0';
+
+        char *pszLine = pszContent;
+        while (pszLine && RT_SUCCESS(rc))
+        {
+            char *pszEol = strchr(pszLine, '\n');
+            if (pszEol)
+                *pszEol++ = '\0';
+
+            if (vdIoBenchBaselineFindValue(pszLine, "job"))
+                rc = vdIoBenchBaselineAddLine(pBaseline, pszLine);
+
+            pszLine = pszEol;
+        }
+
+        if (RT_SUCCESS(rc))
+            *ppBaseline = pBaseline;
+        else
+            VDIoBenchBaselineDestroy(pBaseline);
+    }
+    else
+    {
+        RTMemFree(pBaseline);
+        rc = VERR_NO_MEMORY;
+    }
+
+    RTMemFree(pszContent);
+    RTFileReadAllFree(pvFile, cbFile);
+    return rc;
+}
+
+/**
+ * Returns the deviation of the current from the baseline value in percent.
+ */
+static int vdIoBenchGetDeviationPct(uint64_t uBase, uint64_t uCur)
+{
+    if (!uBase)
+        return 0;
+    return (int)(((int64_t)uCur - (int64_t)uBase) * 100 / (int64_t)uBase);
+}
+
+/**
+ * Compares a latency percentile against the baseline.
+ */
+static void vdIoBenchBaselineCompareLatency(RTTEST hTest, const char *pszJob, const char *pszDir,
+                                            uint64_t cNsBase, uint64_t cNsCur, unsigned uTolerancePct)
+{
+    if (cNsCur * 100 > cNsBase * (100 + uTolerancePct))
+        RTTestFailed(hTest, "%s: %s p99 latency regressed from %llu ns to %llu ns (%+d%%)\n",
+                     pszJob, pszDir, cNsBase, cNsCur, vdIoBenchGetDeviationPct(cNsBase, cNsCur));
+    else
+        RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "%s: %s p99 latency %llu ns, baseline %llu ns (%+d%%)\n",
+                     pszJob, pszDir, cNsCur, cNsBase, vdIoBenchGetDeviationPct(cNsBase, cNsCur));
+}
+
+int VDIoBenchBaselineCompare(PVDIOBENCHBASELINE pBaseline, RTTEST hTest,
+                             PCVDIOBENCHRESULT pResult, unsigned uTolerancePct)
+{
+    PVDIOBENCHBASELINEJOB pJob = NULL;
+
+    for (unsigned i = 0; i < pBaseline->cJobs; i++)
+    {
+        PVDIOBENCHBASELINEJOB pCur = &pBaseline->paJobs[i];
+        if (   pCur->cImages == pResult->cImages
+            && !RTStrCmp(pCur->pszJob, pResult->pszJob)
+            && !RTStrICmp(pCur->pszBackend, pResult->pszBackend)
+            && !RTStrCmp(pCur->pszIoBackend, pResult->pszIoBackend))
+        {
+            pJob = pCur;
+            break;
+        }
+    }
+
+    if (!pJob)
+    {
+        RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "%s: No baseline found\n", pResult->pszJob);
+        return VERR_NOT_FOUND;
+    }
+
+    uint64_t uThroughputKBs = vdIoBenchGetThroughputKBs(pResult);
+    uTolerancePct = RT_MIN(uTolerancePct, 100);
+    if (uThroughputKBs * 100 < pJob->uThroughputKBs * (100 - uTolerancePct))
+        RTTestFailed(hTest, "%s: Throughput regressed from %llu KB/s to %llu KB/s (%+d%%)\n",
+                     pResult->pszJob, pJob->uThroughputKBs, uThroughputKBs,
+                     vdIoBenchGetDeviationPct(pJob->uThroughputKBs, uThroughputKBs));
+    else
+        RTTestPrintf(hTest, RTTESTLVL_ALWAYS, "%s: Throughput %llu KB/s, baseline %llu KB/s (%+d%%)\n",
+                     pResult->pszJob, uThroughputKBs, pJob->uThroughputKBs,
+                     vdIoBenchGetDeviationPct(pJob->uThroughputKBs, uThroughputKBs));
+
+    if (pJob->cReads && pResult->HistRead.cSamples)
+        vdIoBenchBaselineCompareLatency(hTest, pResult->pszJob, "Read", pJob->cNsReadP99,
+                                        VDIoBenchHistGetPercentile(&pResult->HistRead, 990),
+                                        uTolerancePct);
+    if (pJob->cWrites && pResult->HistWrite.cSamples)
+        vdIoBenchBaselineCompareLatency(hTest, pResult->pszJob, "Write", pJob->cNsWriteP99,
+                                        VDIoBenchHistGetPercentile(&pResult->HistWrite, 990),
+                                        uTolerancePct);
+
+    return VINF_SUCCESS;
+}
+
+void VDIoBenchBaselineDestroy(PVDIOBENCHBASELINE pBaseline)
+{
+    for (unsigned i = 0; i < pBaseline->cJobs; i++)
+    {
+        RTMemFree(pBaseline->paJobs[i].pszJob);
+        RTMemFree(pBaseline->paJobs[i].pszBackend);
+        RTMemFree(pBaseline->paJobs[i].pszIoBackend);
+    }
+    RTMemFree(pBaseline->paJobs);
+    RTMemFree(pBaseline);
+}
@@ -0,0 +1,188 @@
+/* $Id$ */
+/** @file
+ * VBox HDD container test utility - I/O benchmark statistics and reports.
+ */
+
+/*
+ * Copyright (C) 2015 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+#ifndef _VDIoBench_h__
+#define _VDIoBench_h__
+
+#include <iprt/types.h>
+#include <iprt/test.h>
+
+/**
+ * Number of latency histogram buckets. Values below 8ns get a bucket each,
+ * every power of two above is split into 8 linear sub-buckets, which bounds
+ * the error of the reported percentiles to 12.5%.
+ */
+#define VDIOBENCH_HIST_BUCKETS  496
+
+/**
+ * Latency histogram. Samples can be added concurrently from the I/O threads.
+ */
+typedef struct VDIOBENCHHIST
+{
+    /** Number of samples. */
+    volatile uint64_t cSamples;
+    /** Sum of all samples in nanoseconds. */
+    volatile uint64_t cNsTotal;
+    /** Smallest sample in nanoseconds. */
+    volatile uint64_t cNsMin;
+    /** Largest sample in nanoseconds. */
+    volatile uint64_t cNsMax;
+    /** The buckets. */
+    volatile uint32_t acBuckets[VDIOBENCH_HIST_BUCKETS];
+} VDIOBENCHHIST;
+/** Pointer to a latency histogram. */
+typedef VDIOBENCHHIST *PVDIOBENCHHIST;
+/** Pointer to a const latency histogram. */
+typedef const VDIOBENCHHIST *PCVDIOBENCHHIST;
+
+/**
+ * Result of a single benchmark job.
+ */
+typedef struct VDIOBENCHRESULT
+{
+    /** Job name as given by the script. */
+    const char     *pszJob;
+    /** Image format of the top image. */
+    const char     *pszBackend;
+    /** Storage the images live on ("memory" or "file"). */
+    const char     *pszIoBackend;
+    /** Number of images in the chain. */
+    unsigned        cImages;
+    /** Flag whether random access was used. */
+    bool            fRandom;
+    /** Flag whether the async interface was used. */
+    bool            fAsync;
+    /** Maximum number of outstanding requests. */
+    unsigned        cQueueDepth;
+    /** Block size of the requests. */
+    size_t          cbBlock;
+    /** Chance of a request being a write in percent. */
+    unsigned        uWritePct;
+    /** Number of bytes transferred. */
+    uint64_t        cbTransferred;
+    /** Wall clock time the job took in nanoseconds. */
+    uint64_t        cNsElapsed;
+    /** Read latencies. */
+    VDIOBENCHHIST   HistRead;
+    /** Write latencies. */
+    VDIOBENCHHIST   HistWrite;
+} VDIOBENCHRESULT;
+/** Pointer to a benchmark result. */
+typedef VDIOBENCHRESULT *PVDIOBENCHRESULT;
+/** Pointer to a const benchmark result. */
+typedef const VDIOBENCHRESULT *PCVDIOBENCHRESULT;
+
+/** Pointer to a JSON benchmark report. */
+typedef struct VDIOBENCHREPORT *PVDIOBENCHREPORT;
+/** Pointer to a JSON benchmark report pointer. */
+typedef PVDIOBENCHREPORT *PPVDIOBENCHREPORT;
+
+/** Pointer to a loaded benchmark baseline. */
+typedef struct VDIOBENCHBASELINE *PVDIOBENCHBASELINE;
+/** Pointer to a benchmark baseline pointer. */
+typedef PVDIOBENCHBASELINE *PPVDIOBENCHBASELINE;
+
+/**
+ * Initializes a latency histogram.
+ *
+ * @param pHist      The histogram.
+ */
+void VDIoBenchHistInit(PVDIOBENCHHIST pHist);
+
+/**
+ * Adds a latency sample to the histogram, thread safe.
+ *
+ * @param pHist      The histogram.
+ * @param cNs        The latency in nanoseconds.
+ */
+void VDIoBenchHistAdd(PVDIOBENCHHIST pHist, uint64_t cNs);
+
+/**
+ * Returns the latency below which the given share of samples lies.
+ *
+ * @returns Latency in nanoseconds (upper bound of the bucket), 0 if there
+ *          are no samples.
+ * @param pHist      The histogram.
+ * @param uPermille  The percentile in parts per thousand, e.g. 990 for p99.
+ */
+uint64_t VDIoBenchHistGetPercentile(PCVDIOBENCHHIST pHist, unsigned uPermille);
+
+/**
+ * Reports the result of a job as test values and prints the latency
+ * distribution.
+ *
+ * @param hTest      The test handle.
+ * @param pResult    The job result.
+ */
+void VDIoBenchResultReport(RTTEST hTest, PCVDIOBENCHRESULT pResult);
+
+/**
+ * Creates a JSON report file, overwriting an existing one.
+ *
+ * @returns VBox status code.
+ * @param ppReport      Where to store the report handle on success.
+ * @param pszFilename   The file to write to.
+ */
+int VDIoBenchReportCreate(PPVDIOBENCHREPORT ppReport, const char *pszFilename);
+
+/**
+ * Appends a job result to the report.
+ *
+ * @returns VBox status code.
+ * @param pReport       The report handle.
+ * @param pszScript     Name of the script the job ran in.
+ * @param pResult       The job result.
+ */
+int VDIoBenchReportAdd(PVDIOBENCHREPORT pReport, const char *pszScript, PCVDIOBENCHRESULT pResult);
+
+/**
+ * Completes and closes the report.
+ *
+ * @param pReport       The report handle.
+ */
+void VDIoBenchReportDestroy(PVDIOBENCHREPORT pReport);
+
+/**
+ * Loads a baseline from a JSON report written earlier.
+ *
+ * @returns VBox status code.
+ * @param ppBaseline    Where to store the baseline handle on success.
+ * @param pszFilename   The report to load.
+ */
+int VDIoBenchBaselineLoad(PPVDIOBENCHBASELINE ppBaseline, const char *pszFilename);
+
+/**
+ * Compares a job result against the baseline. Regressions beyond the given
+ * tolerance are reported as test failures.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if the baseline has no matching job.
+ * @param pBaseline     The baseline handle.
+ * @param hTest         The test handle.
+ * @param pResult       The job result.
+ * @param uTolerancePct Allowed deviation in percent.
+ */
+int VDIoBenchBaselineCompare(PVDIOBENCHBASELINE pBaseline, RTTEST hTest,
+                             PCVDIOBENCHRESULT pResult, unsigned uTolerancePct);
+
+/**
+ * Frees a baseline.
+ *
+ * @param pBaseline     The baseline handle.
+ */
+void VDIoBenchBaselineDestroy(PVDIOBENCHBASELINE pBaseline);
+
+#endif /* _VDIoBench_h__ */
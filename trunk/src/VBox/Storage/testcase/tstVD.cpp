@@ -30,6 +30,7 @@
 #include <iprt/mem.h>
 #include <iprt/initterm.h>
 #include <iprt/rand.h>
+#include <iprt/uuid.h>
 #include "stdio.h"
 #include "stdlib.h"
 
@@ -698,6 +699,270 @@ static int tstVDCreateWriteOpenRead(const char *pszBackend,
     return 0;
 }
 
+/** Number of deflate worker threads the streamOptimized test image is
+ * created with, as returned by the config interface. */
+static char g_szStreamThreads[16];
+
+static DECLCALLBACK(bool) tstVDStreamAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    NOREF(pvUser); NOREF(pszzValid);
+    return true;
+}
+
+static DECLCALLBACK(int) tstVDStreamQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    NOREF(pvUser);
+    if (strcmp(pszName, "CompressionThreads"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+    *pcbValue = strlen(g_szStreamThreads) + 1;
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) tstVDStreamQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    NOREF(pvUser);
+    if (strcmp(pszName, "CompressionThreads"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+    return RTStrCopy(pszValue, cchValue, g_szStreamThreads);
+}
+
+/**
+ * Fills one chunk of the streamOptimized test data. Every fourth chunk stays
+ * unwritten, the others get data which deflates to something in between the
+ * stored and the fully compressed case.
+ *
+ * @returns true if the chunk is to be written, false if it stays unallocated.
+ */
+static bool tstVDStreamFillChunk(PRNDCTX pCtx, unsigned iChunk, uint8_t *pbBuf, size_t cbBuf)
+{
+    if (iChunk % 4 == 3)
+    {
+        memset(pbBuf, 0, cbBuf);
+        return false;
+    }
+
+    uint32_t *pu32 = (uint32_t *)pbBuf;
+    for (size_t i = 0; i < cbBuf / sizeof(uint32_t); i++)
+        pu32[i] = RTPRandU32(pCtx) & 0x0f0f0f0f;
+    return true;
+}
+
+/**
+ * Creates a streamOptimized VMDK from the same data using the given number of
+ * deflate threads.
+ */
+static int tstVDStreamCreate(const char *pszFilename, uint32_t cThreads, uint64_t cbDisk)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    VDGEOMETRY PCHS = { 0, 0, 0 };
+    VDGEOMETRY LCHS = { 0, 0, 0 };
+    RTUUID Uuid;
+    PVDINTERFACE       pVDIfs = NULL;
+    PVDINTERFACE       pVDIfsImage = NULL;
+    VDINTERFACEERROR   VDIfError;
+    VDINTERFACECONFIG  VDIfConfig;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            if (pvBuf) \
+                RTMemFree(pvBuf); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    /* Create the per-image config interface selecting the thread count. */
+    RTStrPrintf(g_szStreamThreads, sizeof(g_szStreamThreads), "%u", cThreads);
+    VDIfConfig.pfnAreKeysValid = tstVDStreamAreKeysValid;
+    VDIfConfig.pfnQuerySize    = tstVDStreamQuerySize;
+    VDIfConfig.pfnQuery        = tstVDStreamQuery;
+    VDIfConfig.pfnQueryBytes   = NULL;
+
+    rc = VDInterfaceAdd(&VDIfConfig.Core, "tstVD_Config", VDINTERFACETYPE_CONFIG,
+                        NULL, sizeof(VDINTERFACECONFIG), &pVDIfsImage);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+
+    RTFileDelete(pszFilename);
+
+    /* Same UUID for both images, it ends up in the footer. */
+    rc = RTUuidFromStr(&Uuid, "c0ffee00-1111-2222-3333-444455556666");
+    AssertRC(rc);
+
+    rc = VDCreateBase(pVD, "VMDK", pszFilename, cbDisk,
+                      VD_VMDK_IMAGE_FLAGS_STREAM_OPTIMIZED, "Test image",
+                      &PCHS, &LCHS, &Uuid, VD_OPEN_FLAGS_NORMAL,
+                      pVDIfsImage, NULL);
+    CHECK("VDCreateBase()");
+
+    RNDCTX ctx;
+    RTPRandInit(&ctx, 0x5eed);
+    for (unsigned iChunk = 0; iChunk < cbDisk / _1M; iChunk++)
+        if (tstVDStreamFillChunk(&ctx, iChunk, (uint8_t *)pvBuf, _1M))
+        {
+            rc = VDWrite(pVD, (uint64_t)iChunk * _1M, pvBuf, _1M);
+            if (RT_FAILURE(rc))
+                break;
+        }
+    CHECK("VDWrite()");
+
+    rc = VDCloseAll(pVD);
+    CHECK("VDCloseAll()");
+
+    VDDestroy(pVD);
+    RTMemFree(pvBuf);
+#undef CHECK
+    return VINF_SUCCESS;
+}
+
+/**
+ * Checks that the streamOptimized image contains the test data.
+ */
+static int tstVDStreamVerify(const char *pszFilename, uint64_t cbDisk)
+{
+    int rc;
+    PVBOXHDD pVD = NULL;
+    PVDINTERFACE     pVDIfs = NULL;
+    VDINTERFACEERROR VDIfError;
+
+#define CHECK(str) \
+    do \
+    { \
+        RTPrintf("%s rc=%Rrc\n", str, rc); \
+        if (RT_FAILURE(rc)) \
+        { \
+            RTMemFree(pvBuf); \
+            RTMemFree(pvCmp); \
+            VDDestroy(pVD); \
+            return rc; \
+        } \
+    } while (0)
+
+    void *pvBuf = RTMemAlloc(_1M);
+    void *pvCmp = RTMemAlloc(_1M);
+
+    /* Create error interface. */
+    VDIfError.pfnError = tstVDError;
+    VDIfError.pfnMessage = tstVDMessage;
+
+    rc = VDInterfaceAdd(&VDIfError.Core, "tstVD_Error", VDINTERFACETYPE_ERROR,
+                        NULL, sizeof(VDINTERFACEERROR), &pVDIfs);
+    AssertRC(rc);
+
+    rc = VDCreate(pVDIfs, VDTYPE_HDD, &pVD);
+    CHECK("VDCreate()");
+
+    rc = VDOpen(pVD, "VMDK", pszFilename, VD_OPEN_FLAGS_READONLY, NULL);
+    CHECK("VDOpen()");
+
+    RNDCTX ctx;
+    RTPRandInit(&ctx, 0x5eed);
+    for (unsigned iChunk = 0; iChunk < cbDisk / _1M; iChunk++)
+    {
+        tstVDStreamFillChunk(&ctx, iChunk, (uint8_t *)pvCmp, _1M);
+        rc = VDRead(pVD, (uint64_t)iChunk * _1M, pvBuf, _1M);
+        if (RT_FAILURE(rc))
+            break;
+        if (memcmp(pvBuf, pvCmp, _1M))
+        {
+            RTPrintf("ERROR: Chunk %u of %s is corrupt\n", iChunk, pszFilename);
+            rc = VERR_INTERNAL_ERROR;
+            break;
+        }
+    }
+    CHECK("VDRead()");
+
+    VDDestroy(pVD);
+    RTMemFree(pvBuf);
+    RTMemFree(pvCmp);
+#undef CHECK
+    return VINF_SUCCESS;
+}
+
+/**
+ * Creates the same streamOptimized image with one and with several deflate
+ * threads, checks that the files are identical and that the data reads back.
+ *
+ * The embedded descriptor is skipped when comparing, as it carries a random
+ * content ID.
+ */
+static int tstVmdkStreamDeflate(const char *pszFilename1, const char *pszFilename2)
+{
+    uint64_t const cbDisk = 64 * _1M;
+
+    int rc = tstVDStreamCreate(pszFilename1, 1, cbDisk);
+    if (RT_SUCCESS(rc))
+        rc = tstVDStreamCreate(pszFilename2, 4, cbDisk);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    uint8_t *pbFile1 = NULL;
+    uint8_t *pbFile2 = NULL;
+    size_t   cbFile1 = 0;
+    size_t   cbFile2 = 0;
+    rc = RTFileReadAll(pszFilename1, (void **)&pbFile1, &cbFile1);
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTFileReadAll(pszFilename2, (void **)&pbFile2, &cbFile2);
+        if (RT_SUCCESS(rc))
+        {
+            /* descriptorOffset and descriptorSize of the sparse extent header, in sectors. */
+            uint64_t offDesc = 0;
+            uint64_t cDescSectors = 0;
+            if (cbFile1 >= 512)
+            {
+                offDesc      = RT_LE2H_U64(*(uint64_t *)&pbFile1[28]) * 512;
+                cDescSectors = RT_LE2H_U64(*(uint64_t *)&pbFile1[36]);
+            }
+
+            if (   cbFile1 != cbFile2
+                || offDesc + cDescSectors * 512 > cbFile1)
+            {
+                RTPrintf("ERROR: %s has %zu bytes, %s has %zu bytes\n", pszFilename1, cbFile1, pszFilename2, cbFile2);
+                rc = VERR_INTERNAL_ERROR;
+            }
+            else
+            {
+                size_t offEnd = (size_t)(offDesc + cDescSectors * 512);
+                if (   memcmp(pbFile1, pbFile2, (size_t)offDesc)
+                    || memcmp(pbFile1 + offEnd, pbFile2 + offEnd, cbFile1 - offEnd))
+                {
+                    RTPrintf("ERROR: %s and %s differ\n", pszFilename1, pszFilename2);
+                    rc = VERR_INTERNAL_ERROR;
+                }
+            }
+            RTFileReadAllFree(pbFile2, cbFile2);
+        }
+        RTFileReadAllFree(pbFile1, cbFile1);
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = tstVDStreamVerify(pszFilename1, cbDisk);
+    if (RT_SUCCESS(rc))
+        rc = tstVDStreamVerify(pszFilename2, cbDisk);
+
+    RTFileDelete(pszFilename1);
+    RTFileDelete(pszFilename2);
+    return rc;
+}
+
 static int tstVmdkRename(const char *src, const char *dst)
 {
     int rc;
@@ -839,6 +1104,13 @@ static void tstVmdk()
     RTFileDelete("tmpVDCreate-s001.vmdk");
     RTFileDelete("tmpVDCreate-s002.vmdk");
     RTFileDelete("tmpVDCreate-s003.vmdk");
+
+    rc = tstVmdkStreamDeflate("tmpVDStream1.vmdk", "tmpVDStream2.vmdk");
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstVD: VMDK streamOptimized parallel deflate test failed! rc=%Rrc\n", rc);
+        g_cErrors++;
+    }
 }
 
 int main(int argc, char *argv[])
@@ -877,6 +1149,8 @@ int main(int argc, char *argv[])
     RTFileDelete("tmpVDRename-s001.vmdk");
     RTFileDelete("tmpVDRename-s002.vmdk");
     RTFileDelete("tmpVDRename-s003.vmdk");
+    RTFileDelete("tmpVDStream1.vmdk");
+    RTFileDelete("tmpVDStream2.vmdk");
     RTFileDelete("tmp/tmpVDRename.vmdk");
     RTFileDelete("tmp/tmpVDRename-s001.vmdk");
     RTFileDelete("tmp/tmpVDRename-s002.vmdk");
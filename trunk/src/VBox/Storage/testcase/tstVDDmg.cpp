@@ -0,0 +1,585 @@
+/* $Id$ */
+/** @file
+ * tstVDDmg.cpp - testcase for the compressed chunk handling of the DMG backend.
+ *
+ * The backend source is included directly. The decoders are fed with hand
+ * made streams, the chunk cache is driven through a faked internal I/O
+ * interface which completes metadata reads on demand, like VD does for
+ * asynchronous requests. The faked interface checks that the image file is
+ * only accessed from the thread issuing the requests and never from the
+ * decompression workers.
+ */
+
+/*
+ * Copyright (C) 2015 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "../DMG.cpp"
+
+#include <iprt/test.h>
+#include <iprt/thread.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Number of compressed extents in the faked image. */
+#define TST_EXTENTS             8
+/** Decompressed size of an extent. */
+#define TST_EXTENT_SIZE         _64K
+/** Size of the faked image file. */
+#define TST_FILE_SIZE           (TST_EXTENTS * (TST_EXTENT_SIZE + _4K))
+/** Maximum number of metadata transfers in flight. */
+#define TST_META_XFERS          4
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Faked I/O context reading into a flat buffer.
+ */
+typedef struct TSTIOCTX
+{
+    /** Flag whether the context is synchronous. */
+    bool                fSync;
+    /** The buffer to read into. */
+    uint8_t            *pbBuf;
+    /** Size of the buffer. */
+    size_t              cbBuf;
+    /** Current offset into the buffer. */
+    size_t              offBuf;
+    /** Event signalled on completion. */
+    RTSEMEVENT          hEvtCompleted;
+    /** Flag whether the context was completed through pfnIoCtxCompleted. */
+    volatile bool       fCompleted;
+    /** Status code the context was completed with. */
+    int                 rcCompleted;
+} TSTIOCTX;
+/** Pointer to a faked I/O context. */
+typedef TSTIOCTX *PTSTIOCTX;
+
+/**
+ * Faked metadata transfer.
+ */
+typedef struct TSTMETAXFER
+{
+    /** Flag whether the slot is in use. */
+    bool                fUsed;
+    /** Flag whether the data was read. */
+    bool                fDone;
+    /** Offset in the file. */
+    uint64_t            off;
+    /** Number of bytes transferred. */
+    size_t              cb;
+    /** Reference counter. */
+    uint32_t            cRefs;
+} TSTMETAXFER;
+/** Pointer to a faked metadata transfer. */
+typedef TSTMETAXFER *PTSTMETAXFER;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The faked internal I/O interface. */
+static VDINTERFACEIOINT     g_TstIfIo;
+/** The thread issuing the requests. */
+static RTTHREAD             g_hThreadIo = NIL_RTTHREAD;
+/** The faked image file. */
+static uint8_t              g_abFile[TST_FILE_SIZE];
+/** Metadata transfers. */
+static TSTMETAXFER          g_aMetaXfers[TST_META_XFERS];
+/** Number of metadata reads started. */
+static unsigned             g_cMetaReads = 0;
+/** Number of image file accesses from other threads than g_hThreadIo. */
+static volatile uint32_t    g_cIoWrongThread = 0;
+
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnReadMeta} */
+static DECLCALLBACK(int) tstReadMeta(void *pvUser, PVDIOSTORAGE pStorage, uint64_t uOffset, void *pvBuffer,
+                                     size_t cbBuffer, PVDIOCTX pIoCtx, PPVDMETAXFER ppMetaXfer,
+                                     PFNVDXFERCOMPLETED pfnComplete, void *pvCompleteUser)
+{
+    NOREF(pvUser); NOREF(pStorage); NOREF(pfnComplete); NOREF(pvCompleteUser);
+
+    if (RTThreadSelf() != g_hThreadIo)
+        ASMAtomicIncU32(&g_cIoWrongThread);
+    if (   uOffset > sizeof(g_abFile)
+        || cbBuffer > sizeof(g_abFile) - uOffset)
+        return VERR_EOF;
+
+    if (   !pIoCtx
+        || ((PTSTIOCTX)pIoCtx)->fSync)
+    {
+        memcpy(pvBuffer, &g_abFile[uOffset], cbBuffer);
+        if (ppMetaXfer)
+            *ppMetaXfer = NULL;
+        return VINF_SUCCESS;
+    }
+
+    /* Join a transfer of the same range, overlapping ones make VD assert. */
+    PTSTMETAXFER pFree = NULL;
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aMetaXfers); i++)
+    {
+        PTSTMETAXFER pMetaXfer = &g_aMetaXfers[i];
+
+        if (!pMetaXfer->fUsed)
+        {
+            if (!pFree)
+                pFree = pMetaXfer;
+        }
+        else if (   pMetaXfer->off == uOffset
+                 && pMetaXfer->cb == cbBuffer)
+        {
+            if (!pMetaXfer->fDone)
+                return VERR_VD_NOT_ENOUGH_METADATA;
+            memcpy(pvBuffer, &g_abFile[uOffset], cbBuffer);
+            pMetaXfer->cRefs++;
+            *ppMetaXfer = (PVDMETAXFER)pMetaXfer;
+            return VINF_SUCCESS;
+        }
+        else if (   pMetaXfer->off < uOffset + cbBuffer
+                 && uOffset < pMetaXfer->off + pMetaXfer->cb)
+        {
+            RTTestIFailed("Metadata read %#llx LB %#zx overlaps the transfer %#llx LB %#zx",
+                          uOffset, cbBuffer, pMetaXfer->off, pMetaXfer->cb);
+            return VERR_INTERNAL_ERROR;
+        }
+    }
+
+    if (!pFree)
+    {
+        RTTestIFailed("Too many metadata transfers");
+        return VERR_NO_MEMORY;
+    }
+
+    pFree->fUsed = true;
+    pFree->fDone = false;
+    pFree->off   = uOffset;
+    pFree->cb    = cbBuffer;
+    pFree->cRefs = 0;
+    g_cMetaReads++;
+    return VERR_VD_NOT_ENOUGH_METADATA;
+}
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnMetaXferRelease} */
+static DECLCALLBACK(void) tstMetaXferRelease(void *pvUser, PVDMETAXFER pMetaXfer)
+{
+    NOREF(pvUser);
+    if (!pMetaXfer)
+        return;
+
+    PTSTMETAXFER pTstMetaXfer = (PTSTMETAXFER)pMetaXfer;
+    RTTESTI_CHECK_RETV(pTstMetaXfer->cRefs > 0);
+    if (!--pTstMetaXfer->cRefs)
+        pTstMetaXfer->fUsed = false;
+}
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnIoCtxCopyTo} */
+static DECLCALLBACK(size_t) tstIoCtxCopyTo(void *pvUser, PVDIOCTX pIoCtx, const void *pvBuffer, size_t cbBuffer)
+{
+    NOREF(pvUser);
+    PTSTIOCTX pTstIoCtx = (PTSTIOCTX)pIoCtx;
+    size_t cbCopy = RT_MIN(cbBuffer, pTstIoCtx->cbBuf - pTstIoCtx->offBuf);
+
+    memcpy(pTstIoCtx->pbBuf + pTstIoCtx->offBuf, pvBuffer, cbCopy);
+    pTstIoCtx->offBuf += cbCopy;
+    return cbCopy;
+}
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnIoCtxSegArrayCreate} */
+static DECLCALLBACK(size_t) tstIoCtxSegArrayCreate(void *pvUser, PVDIOCTX pIoCtx, PRTSGSEG paSeg, unsigned *pcSeg,
+                                                   size_t cbData)
+{
+    NOREF(pvUser);
+    PTSTIOCTX pTstIoCtx = (PTSTIOCTX)pIoCtx;
+    size_t cbSeg = RT_MIN(cbData, pTstIoCtx->cbBuf - pTstIoCtx->offBuf);
+
+    if (paSeg)
+    {
+        paSeg[0].pvSeg = pTstIoCtx->pbBuf + pTstIoCtx->offBuf;
+        paSeg[0].cbSeg = cbSeg;
+        pTstIoCtx->offBuf += cbSeg;
+    }
+    *pcSeg = 1;
+    return cbSeg;
+}
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnIoCtxCompleted} */
+static DECLCALLBACK(void) tstIoCtxCompleted(void *pvUser, PVDIOCTX pIoCtx, int rcReq, size_t cbCompleted)
+{
+    NOREF(pvUser); NOREF(cbCompleted);
+    PTSTIOCTX pTstIoCtx = (PTSTIOCTX)pIoCtx;
+
+    pTstIoCtx->rcCompleted = rcReq;
+    ASMAtomicWriteBool(&pTstIoCtx->fCompleted, true);
+    RTSemEventSignal(pTstIoCtx->hEvtCompleted);
+}
+
+/** @interface_method_impl{VDINTERFACEIOINT,pfnIoCtxIsSynchronous} */
+static DECLCALLBACK(bool) tstIoCtxIsSynchronous(void *pvUser, PVDIOCTX pIoCtx)
+{
+    NOREF(pvUser);
+    return ((PTSTIOCTX)pIoCtx)->fSync;
+}
+
+/**
+ * Completes all pending metadata transfers.
+ */
+static void tstMetaXfersComplete(void)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aMetaXfers); i++)
+        if (g_aMetaXfers[i].fUsed)
+            g_aMetaXfers[i].fDone = true;
+}
+
+/**
+ * Returns the expected content of the given byte of an extent.
+ */
+DECLINLINE(uint8_t) tstExtentByte(unsigned iExtent, size_t off)
+{
+    return (uint8_t)(iExtent * 31 + off * 7 + (off >> 9));
+}
+
+/**
+ * Builds the faked image: ADC and LZFSE compressed extents alternating,
+ * stored back to back in the file.
+ */
+static PDMGIMAGE tstImageCreate(void)
+{
+    PDMGIMAGE pThis = (PDMGIMAGE)RTMemAllocZ(sizeof(DMGIMAGE));
+    RTTESTI_CHECK_RET(pThis, NULL);
+
+    pThis->pszFilename     = "tstVDDmg.dmg";
+    pThis->pIfIoXxx        = &g_TstIfIo;
+    pThis->hDmgFileInXar   = NIL_RTVFSFILE;
+    pThis->hXarFss         = NIL_RTVFSFSSTREAM;
+    pThis->hEvtChunkLoaded = NIL_RTSEMEVENTMULTI;
+    pThis->hReqPoolDecomp  = NIL_RTREQPOOL;
+    pThis->uOpenFlags      = VD_OPEN_FLAGS_READONLY;
+    pThis->cbSize          = TST_EXTENTS * TST_EXTENT_SIZE;
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aChunks); i++)
+        RTListInit(&pThis->aChunks[i].ListWaiters);
+
+    pThis->paExtents = (PDMGEXTENT)RTMemAllocZ(TST_EXTENTS * sizeof(DMGEXTENT));
+    RTTESTI_CHECK_RET(pThis->paExtents, NULL);
+    pThis->cExtents     = TST_EXTENTS;
+    pThis->cExtentsMax  = TST_EXTENTS;
+    pThis->cExtentsComp = TST_EXTENTS;
+
+    uint64_t offFile = 0;
+    for (unsigned iExtent = 0; iExtent < TST_EXTENTS; iExtent++)
+    {
+        PDMGEXTENT pExtent = &pThis->paExtents[iExtent];
+        uint8_t *pb = &g_abFile[offFile];
+        size_t off = 0;
+
+        if (iExtent & 1)
+        {
+            /* A single uncompressed LZFSE block. */
+            *(uint32_t *)&pb[off]     = RT_H2LE_U32(DMG_LZFSE_MAGIC_RAW);
+            *(uint32_t *)&pb[off + 4] = RT_H2LE_U32(TST_EXTENT_SIZE);
+            off += 8;
+            for (size_t offData = 0; offData < TST_EXTENT_SIZE; offData++)
+                pb[off++] = tstExtentByte(iExtent, offData);
+            *(uint32_t *)&pb[off] = RT_H2LE_U32(DMG_LZFSE_MAGIC_EOS);
+            off += 4;
+            pExtent->enmType = DMGEXTENTTYPE_COMP_LZFSE;
+        }
+        else
+        {
+            /* ADC literal runs. */
+            for (size_t offData = 0; offData < TST_EXTENT_SIZE; offData += 128)
+            {
+                pb[off++] = 0x80 | 127;
+                for (size_t i = 0; i < 128; i++)
+                    pb[off++] = tstExtentByte(iExtent, offData + i);
+            }
+            pExtent->enmType = DMGEXTENTTYPE_COMP_ADC;
+        }
+
+        pExtent->uSectorExtent  = DMG_BYTE2BLOCK(iExtent * TST_EXTENT_SIZE);
+        pExtent->cSectorsExtent = DMG_BYTE2BLOCK(TST_EXTENT_SIZE);
+        pExtent->offFileStart   = offFile;
+        pExtent->cbFile         = off;
+        pExtent->idxExtentRead  = iExtent;
+        offFile += off;
+        Assert(offFile <= sizeof(g_abFile));
+    }
+
+    /* Same as dmgOpenImage does. */
+    dmgExtentsGroupReads(pThis);
+    RTTESTI_CHECK_RC(RTCritSectInit(&pThis->CritSectChunks), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(RTSemEventMultiCreate(&pThis->hEvtChunkLoaded), VINF_SUCCESS);
+    RTTESTI_CHECK_RC(RTReqPoolCreate(2, 10 * RT_MS_1SEC, UINT32_MAX, 0, "tstDmgDecomp", &pThis->hReqPoolDecomp),
+                     VINF_SUCCESS);
+    return pThis;
+}
+
+static void tstImageDestroy(PDMGIMAGE pThis)
+{
+    dmgFreeImage(pThis, false);
+    RTMemFree(pThis);
+
+    for (unsigned i = 0; i < RT_ELEMENTS(g_aMetaXfers); i++)
+        RTTESTI_CHECK_MSG(!g_aMetaXfers[i].fUsed,
+                          ("Metadata transfer %#llx LB %#zx not released\n", g_aMetaXfers[i].off, g_aMetaXfers[i].cb));
+    RT_ZERO(g_aMetaXfers);
+}
+
+static void tstIoCtxInit(PTSTIOCTX pIoCtx, bool fSync, uint8_t *pbBuf, size_t cbBuf)
+{
+    RT_ZERO(*pIoCtx);
+    pIoCtx->fSync = fSync;
+    pIoCtx->pbBuf = pbBuf;
+    pIoCtx->cbBuf = cbBuf;
+    RTTESTI_CHECK_RC(RTSemEventCreate(&pIoCtx->hEvtCompleted), VINF_SUCCESS);
+}
+
+/**
+ * Waits for a read to finish, either right away or through a worker.
+ */
+static int tstIoCtxWait(PTSTIOCTX pIoCtx, int rc)
+{
+    if (rc == VERR_VD_IOCTX_HALT)
+    {
+        RTTESTI_CHECK_RC(RTSemEventWait(pIoCtx->hEvtCompleted, 30 * RT_MS_1SEC), VINF_SUCCESS);
+        RTTESTI_CHECK(ASMAtomicReadBool(&pIoCtx->fCompleted));
+        rc = pIoCtx->rcCompleted;
+    }
+    else
+        RTTESTI_CHECK(!pIoCtx->fCompleted);
+    RTSemEventDestroy(pIoCtx->hEvtCompleted);
+    pIoCtx->hEvtCompleted = NIL_RTSEMEVENT;
+    return rc;
+}
+
+/**
+ * Checks that the buffer holds the content of the given range of the image.
+ */
+static void tstCheckData(const uint8_t *pbBuf, uint64_t off, size_t cb)
+{
+    for (size_t i = 0; i < cb; i++)
+    {
+        unsigned iExtent  = (unsigned)((off + i) / TST_EXTENT_SIZE);
+        size_t   offExtent = (size_t)((off + i) % TST_EXTENT_SIZE);
+        if (pbBuf[i] != tstExtentByte(iExtent, offExtent))
+        {
+            RTTestIFailed("Data mismatch at offset %#llx", off + i);
+            break;
+        }
+    }
+}
+
+static void tstAdc(void)
+{
+    RTTestISub("ADC");
+    uint8_t abDst[16];
+
+    /* Literal run, two byte match and an overlapping three byte match. */
+    static const uint8_t s_abValid[] = { 0x83, 'a', 'b', 'c', 'd', 0x00, 0x03, 0x45, 0x00, 0x03 };
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abValid, sizeof(s_abValid), abDst, sizeof(abDst)), VINF_SUCCESS);
+    RTTESTI_CHECK(!memcmp(abDst, "abcdabcdabcdabcd", sizeof(abDst)));
+
+    /* Output shorter than announced. */
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abValid, 5, abDst, sizeof(abDst)), VERR_ZIP_CORRUPTED);
+
+    /* Match referencing data before the start. */
+    static const uint8_t s_abBadMatch[] = { 0x80, 'a', 0x00, 0x01 };
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abBadMatch, sizeof(s_abBadMatch), abDst, 4), VERR_ZIP_CORRUPTED);
+
+    /* Truncated literal run and truncated three byte match. */
+    static const uint8_t s_abTruncLit[] = { 0x83, 'a', 'b' };
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abTruncLit, sizeof(s_abTruncLit), abDst, 4), VERR_ZIP_CORRUPTED);
+    static const uint8_t s_abTruncMatch[] = { 0x80, 'a', 0x40, 0x00 };
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abTruncMatch, sizeof(s_abTruncMatch), abDst, 5), VERR_ZIP_CORRUPTED);
+
+    /* Match exceeding the output. */
+    static const uint8_t s_abLongMatch[] = { 0x80, 'a', 0x7f, 0x00, 0x00 };
+    RTTESTI_CHECK_RC(dmgAdcDecompress(s_abLongMatch, sizeof(s_abLongMatch), abDst, sizeof(abDst)), VERR_ZIP_CORRUPTED);
+}
+
+static void tstLzfse(void)
+{
+    RTTestISub("LZFSE/LZVN");
+    uint8_t abDst[19];
+
+    /*
+     * An uncompressed block followed by a LZVN block with a literal, a small
+     * distance match and a match reusing the previous distance.
+     */
+    static const uint8_t s_abValid[] =
+    {
+        'b', 'v', 'x', '-', 4, 0, 0, 0, '0', '1', '2', '3',
+        'b', 'v', 'x', 'n', 15, 0, 0, 0, 16, 0, 0, 0,
+            0xe4, 'w', 'x', 'y', 'z', 0x28, 0x04, 0xf3, 0x06, 0, 0, 0, 0, 0, 0, 0,
+        'b', 'v', 'x', '$'
+    };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abValid, sizeof(s_abValid), abDst, sizeof(abDst)), VINF_SUCCESS);
+    RTTESTI_CHECK(!memcmp(abDst, "0123wxyzwxyzwxyzwxy", sizeof(abDst)));
+
+    /* Missing end of stream marker. */
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abValid, sizeof(s_abValid) - 4, abDst, sizeof(abDst)), VERR_ZIP_CORRUPTED);
+
+    /* Blocks using the FSE entropy coder are not supported. */
+    static const uint8_t s_abFse[] = { 'b', 'v', 'x', '2', 0, 0, 0, 0 };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abFse, sizeof(s_abFse), abDst, sizeof(abDst)), VERR_NOT_SUPPORTED);
+
+    /* Unknown block magic. */
+    static const uint8_t s_abBadMagic[] = { 'b', 'v', 'x', '?', 0, 0, 0, 0 };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abBadMagic, sizeof(s_abBadMagic), abDst, sizeof(abDst)), VERR_ZIP_CORRUPTED);
+
+    /* LZVN match with a zero distance and one reaching before the start. */
+    static const uint8_t s_abZeroDist[] =
+    {
+        'b', 'v', 'x', 'n', 5, 0, 0, 0, 5, 0, 0, 0,
+            0xe1, 'a', 0x08, 0x00, 0x06,
+        'b', 'v', 'x', '$'
+    };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abZeroDist, sizeof(s_abZeroDist), abDst, 5), VERR_ZIP_CORRUPTED);
+    static const uint8_t s_abFarDist[] =
+    {
+        'b', 'v', 'x', 'n', 5, 0, 0, 0, 5, 0, 0, 0,
+            0xe1, 'a', 0x08, 0x02, 0x06,
+        'b', 'v', 'x', '$'
+    };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abFarDist, sizeof(s_abFarDist), abDst, 5), VERR_ZIP_CORRUPTED);
+
+    /* LZVN payload without the end of stream opcode. */
+    static const uint8_t s_abNoEos[] =
+    {
+        'b', 'v', 'x', 'n', 4, 0, 0, 0, 5, 0, 0, 0,
+            0xe4, 'w', 'x', 'y', 'z',
+        'b', 'v', 'x', '$'
+    };
+    RTTESTI_CHECK_RC(dmgLzfseDecompress(s_abNoEos, sizeof(s_abNoEos), abDst, 4), VERR_ZIP_CORRUPTED);
+}
+
+/**
+ * Asynchronous reads wait for the compressed data and share the read of a
+ * group, the workers complete them.
+ */
+static void tstChunksAsync(void)
+{
+    RTTestISub("Asynchronous chunk reads");
+
+    PDMGIMAGE pThis = tstImageCreate();
+    RTTESTI_CHECK_RETV(pThis);
+    RTTESTI_CHECK(pThis->paExtents[3].idxExtentRead == 0);
+    RTTESTI_CHECK(pThis->paExtents[4].idxExtentRead == 4);
+
+    static uint8_t s_abBuf1[TST_EXTENT_SIZE];
+    static uint8_t s_abBuf2[TST_EXTENT_SIZE];
+    TSTIOCTX IoCtx1, IoCtx2;
+    size_t cbRead = 0;
+    tstIoCtxInit(&IoCtx1, false, s_abBuf1, sizeof(s_abBuf1));
+    tstIoCtxInit(&IoCtx2, false, s_abBuf2, sizeof(s_abBuf2));
+
+    /* Both requests wait for the same read of the first group. */
+    RTTESTI_CHECK_RC(dmgRead(pThis, 0, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx1, &cbRead), VERR_VD_NOT_ENOUGH_METADATA);
+    RTTESTI_CHECK_RC(dmgRead(pThis, 2 * TST_EXTENT_SIZE, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx2, &cbRead),
+                     VERR_VD_NOT_ENOUGH_METADATA);
+    RTTESTI_CHECK(g_cMetaReads == 1);
+
+    /* VD restarts the requests once the data is there. */
+    tstMetaXfersComplete();
+    int rc = dmgRead(pThis, 0, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx1, &cbRead);
+    RTTESTI_CHECK_MSG(RT_SUCCESS(rc) || rc == VERR_VD_IOCTX_HALT, ("rc=%Rrc\n", rc));
+    RTTESTI_CHECK(cbRead == TST_EXTENT_SIZE);
+    RTTESTI_CHECK_RC(tstIoCtxWait(&IoCtx1, rc), VINF_SUCCESS);
+    tstCheckData(s_abBuf1, 0, TST_EXTENT_SIZE);
+
+    rc = dmgRead(pThis, 2 * TST_EXTENT_SIZE, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx2, &cbRead);
+    RTTESTI_CHECK_MSG(RT_SUCCESS(rc) || rc == VERR_VD_IOCTX_HALT, ("rc=%Rrc\n", rc));
+    RTTESTI_CHECK_RC(tstIoCtxWait(&IoCtx2, rc), VINF_SUCCESS);
+    tstCheckData(s_abBuf2, 2 * TST_EXTENT_SIZE, TST_EXTENT_SIZE);
+
+    /* The rest of the group was decompressed ahead and is read without touching the file. */
+    for (unsigned iExtent = 1; iExtent < 4; iExtent++)
+    {
+        tstIoCtxInit(&IoCtx1, false, s_abBuf1, sizeof(s_abBuf1));
+        rc = dmgRead(pThis, iExtent * TST_EXTENT_SIZE, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx1, &cbRead);
+        RTTESTI_CHECK_MSG(RT_SUCCESS(rc) || rc == VERR_VD_IOCTX_HALT, ("rc=%Rrc\n", rc));
+        RTTESTI_CHECK_RC(tstIoCtxWait(&IoCtx1, rc), VINF_SUCCESS);
+        tstCheckData(s_abBuf1, iExtent * TST_EXTENT_SIZE, TST_EXTENT_SIZE);
+    }
+    RTTESTI_CHECK(g_cMetaReads == 1);
+    RTTESTI_CHECK(pThis->cChunkReadAheadHits >= 2);
+
+    /* A random read in the next group reads the whole group but decompresses only its own extent. */
+    tstIoCtxInit(&IoCtx1, false, s_abBuf1, sizeof(s_abBuf1));
+    RTTESTI_CHECK_RC(dmgRead(pThis, 4 * TST_EXTENT_SIZE + _4K, _8K, (PVDIOCTX)&IoCtx1, &cbRead),
+                     VERR_VD_NOT_ENOUGH_METADATA);
+    tstMetaXfersComplete();
+    rc = dmgRead(pThis, 4 * TST_EXTENT_SIZE + _4K, _8K, (PVDIOCTX)&IoCtx1, &cbRead);
+    RTTESTI_CHECK_RC(tstIoCtxWait(&IoCtx1, rc), VINF_SUCCESS);
+    tstCheckData(s_abBuf1, 4 * TST_EXTENT_SIZE + _4K, _8K);
+    RTTESTI_CHECK(g_cMetaReads == 2);
+
+    tstImageDestroy(pThis);
+    RTTESTI_CHECK(!g_cIoWrongThread);
+}
+
+/**
+ * Synchronous reads get the compressed data right away and decompress on the
+ * calling thread.
+ */
+static void tstChunksSync(void)
+{
+    RTTestISub("Synchronous chunk reads");
+
+    PDMGIMAGE pThis = tstImageCreate();
+    RTTESTI_CHECK_RETV(pThis);
+
+    static uint8_t s_abBuf[TST_EXTENT_SIZE];
+    for (unsigned iExtent = 0; iExtent < TST_EXTENTS; iExtent++)
+    {
+        TSTIOCTX IoCtx;
+        size_t cbRead = 0;
+        tstIoCtxInit(&IoCtx, true, s_abBuf, sizeof(s_abBuf));
+        int rc = dmgRead(pThis, iExtent * TST_EXTENT_SIZE, TST_EXTENT_SIZE, (PVDIOCTX)&IoCtx, &cbRead);
+        RTTESTI_CHECK_RC(tstIoCtxWait(&IoCtx, rc), VINF_SUCCESS);
+        tstCheckData(s_abBuf, iExtent * TST_EXTENT_SIZE, TST_EXTENT_SIZE);
+    }
+    RTTESTI_CHECK(pThis->cChunkMisses + pThis->cChunkHits >= TST_EXTENTS);
+
+    tstImageDestroy(pThis);
+    RTTESTI_CHECK(!g_cIoWrongThread);
+}
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstVDDmg", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    g_hThreadIo = RTThreadSelf();
+    g_TstIfIo.pfnReadMeta            = tstReadMeta;
+    g_TstIfIo.pfnMetaXferRelease     = tstMetaXferRelease;
+    g_TstIfIo.pfnIoCtxCopyTo         = tstIoCtxCopyTo;
+    g_TstIfIo.pfnIoCtxSegArrayCreate = tstIoCtxSegArrayCreate;
+    g_TstIfIo.pfnIoCtxCompleted      = tstIoCtxCompleted;
+    g_TstIfIo.pfnIoCtxIsSynchronous  = tstIoCtxIsSynchronous;
+
+    tstAdc();
+    tstLzfse();
+    tstChunksAsync();
+    tstChunksSync();
+
+    return RTTestSummaryAndDestroy(hTest);
+}
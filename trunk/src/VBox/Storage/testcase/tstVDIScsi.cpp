@@ -0,0 +1,456 @@
+/* $Id$ */
+/** @file
+ * tstVDIScsi.cpp - testcase for the Data-Out handling of the iSCSI backend.
+ *
+ * The backend source is included directly and driven from a faked network
+ * stack standing in for the target, so no target is required. The tests cover
+ * the unsolicited and R2T solicited Data-Out PDUs and commands completed by the
+ * target while their data is still queued or partially sent.
+ */
+
+/*
+ * Copyright (C) 2015 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include "../ISCSI.cpp"
+
+#include <iprt/test.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Maximum data segment length negotiated with the fake target. */
+#define TST_SEND_DATA_LENGTH    _8K
+/** First burst length negotiated with the fake target. */
+#define TST_FIRST_BURST_LENGTH  _32K
+/** Size of the write commands issued. */
+#define TST_WRITE_SIZE          _64K
+/** Target transfer tag used in the R2Ts. */
+#define TST_TTT                 0x1234
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A SCSI write request together with the data buffer.
+ */
+typedef struct TSTWRITEREQ
+{
+    /** The SCSI request. */
+    SCSIREQ                 ScsiReq;
+    /** The data to write. */
+    uint8_t                 abData[TST_WRITE_SIZE];
+    /** Number of times the completion callback was called. */
+    unsigned                cCompleted;
+    /** Status code the command was completed with. */
+    int                     rcCompleted;
+} TSTWRITEREQ;
+/** Pointer to a write request. */
+typedef TSTWRITEREQ *PTSTWRITEREQ;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The fake network stack. */
+static VDINTERFACETCPNET    g_TstIfNet;
+/** Everything the initiator sent so far. */
+static uint8_t              g_abWire[4 * TST_WRITE_SIZE];
+/** Number of bytes in g_abWire. */
+static size_t               g_cbWire = 0;
+/** Number of bytes the socket accepts before it would block. */
+static size_t               g_cbWireBudget = 0;
+
+
+/** @interface_method_impl{VDINTERFACETCPNET,pfnSgWriteNB} */
+static DECLCALLBACK(int) tstSgWriteNB(VDSOCKET Sock, PRTSGBUF pSgBuffer, size_t *pcbWritten)
+{
+    NOREF(Sock);
+    RTSGBUF SgBuf;
+
+    *pcbWritten = 0;
+    if (!g_cbWireBudget)
+        return VERR_TRY_AGAIN;
+
+    RTSgBufClone(&SgBuf, pSgBuffer);
+    size_t cbWrite = RT_MIN(g_cbWireBudget, sizeof(g_abWire) - g_cbWire);
+    cbWrite = RTSgBufCopyToBuf(&SgBuf, &g_abWire[g_cbWire], cbWrite);
+    g_cbWire       += cbWrite;
+    g_cbWireBudget -= cbWrite;
+    *pcbWritten     = cbWrite;
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(void) tstCmdComplete(PISCSIIMAGE pImage, int rcReq, void *pvUser)
+{
+    NOREF(pImage);
+    PTSTWRITEREQ pReq = (PTSTWRITEREQ)pvUser;
+
+    pReq->cCompleted++;
+    pReq->rcCompleted = rcReq;
+}
+
+/**
+ * Creates a session which already finished the login and negotiated
+ * InitialR2T=No and ImmediateData=Yes.
+ */
+static PISCSIIMAGE tstSessionCreate(void)
+{
+    PISCSIIMAGE pImage = (PISCSIIMAGE)RTMemAllocZ(sizeof(ISCSIIMAGE));
+    if (pImage)
+    {
+        pImage->pszTargetName      = (char *)"tstVDIScsi";
+        pImage->pIfNet             = &g_TstIfNet;
+        pImage->Socket             = (VDSOCKET)(uintptr_t)1;
+        pImage->state              = ISCSISTATE_NORMAL;
+        pImage->cbSendDataLength   = TST_SEND_DATA_LENGTH;
+        pImage->cbRecvDataLength   = TST_SEND_DATA_LENGTH;
+        pImage->cbFirstBurstLength = TST_FIRST_BURST_LENGTH;
+        pImage->cbMaxBurstLength   = ISCSI_BURST_LENGTH_MAX;
+        pImage->fInitialR2T        = false;
+        pImage->fImmediateData     = true;
+        pImage->CmdSN              = 1;
+        pImage->ExpCmdSN           = 1;
+        pImage->MaxCmdSN           = 32;
+        pImage->ExpStatSN          = 1;
+        pImage->cSessions          = 1;
+    }
+    return pImage;
+}
+
+static void tstSessionDestroy(PISCSIIMAGE pImage)
+{
+    while (pImage->pIScsiPDUTxHead)
+    {
+        PISCSIPDUTX pIScsiPDUTx = pImage->pIScsiPDUTxHead;
+        pImage->pIScsiPDUTxHead = pIScsiPDUTx->pNext;
+        RTMemFree(pIScsiPDUTx);
+    }
+    RTMemFree(pImage->pIScsiPDUTxCur);
+    RTMemFree(iscsiCmdRemoveAll(pImage));
+    RTMemFree(pImage);
+}
+
+/**
+ * Issues a write of TST_WRITE_SIZE bytes on the given session.
+ */
+static PISCSICMD tstWriteIssue(PISCSIIMAGE pImage, PTSTWRITEREQ pReq)
+{
+    for (unsigned i = 0; i < sizeof(pReq->abData); i++)
+        pReq->abData[i] = (uint8_t)(i * 7 + (i >> 12));
+
+    PSCSIREQ pScsiReq = &pReq->ScsiReq;
+    pScsiReq->enmXfer       = SCSIXFER_TO_TARGET;
+    pScsiReq->cbCDB         = 10;
+    pScsiReq->abCDB[0]      = SCSI_WRITE_10;
+    pScsiReq->abCDB[8]      = TST_WRITE_SIZE / 512;
+    pScsiReq->abCDB[7]      = (TST_WRITE_SIZE / 512) >> 8;
+    pScsiReq->cbI2TData     = sizeof(pReq->abData);
+    pScsiReq->aSegs[0].pvSeg = pReq->abData;
+    pScsiReq->aSegs[0].cbSeg = sizeof(pReq->abData);
+    pScsiReq->paI2TSegs     = &pScsiReq->aSegs[0];
+    pScsiReq->cI2TSegs      = 1;
+    pScsiReq->cbSense       = sizeof(pScsiReq->abSense);
+
+    PISCSICMD pIScsiCmd = (PISCSICMD)RTMemAllocZ(sizeof(ISCSICMD));
+    if (pIScsiCmd)
+    {
+        pIScsiCmd->enmCmdType               = ISCSICMDTYPE_REQ;
+        pIScsiCmd->pfnComplete              = tstCmdComplete;
+        pIScsiCmd->pvUser                   = pReq;
+        pIScsiCmd->CmdType.ScsiReq.pScsiReq = pScsiReq;
+
+        int rc = iscsiPDUTxPrepare(pImage, pIScsiCmd);
+        if (RT_FAILURE(rc))
+        {
+            RTTestIFailed("iscsiPDUTxPrepare -> %Rrc", rc);
+            RTMemFree(pIScsiCmd);
+            pIScsiCmd = NULL;
+        }
+    }
+    return pIScsiCmd;
+}
+
+/**
+ * Feeds an R2T from the target to the session.
+ */
+static int tstTargetR2T(PISCSIIMAGE pImage, uint32_t Itt, uint32_t offData, uint32_t cbData)
+{
+    uint32_t aBHS[ISCSI_BHS_SIZE / sizeof(uint32_t)];
+    RT_ZERO(aBHS);
+    aBHS[0]  = RT_H2N_U32(ISCSIOP_R2T | ISCSI_FINAL_BIT);
+    aBHS[4]  = Itt;
+    aBHS[5]  = RT_H2N_U32(TST_TTT);
+    aBHS[6]  = RT_H2N_U32(pImage->ExpStatSN);
+    aBHS[7]  = RT_H2N_U32(pImage->CmdSN);
+    aBHS[8]  = RT_H2N_U32(pImage->CmdSN + 31);
+    aBHS[10] = RT_H2N_U32(offData);
+    aBHS[11] = RT_H2N_U32(cbData);
+
+    ISCSIRES Res;
+    Res.pvSeg = aBHS;
+    Res.cbSeg = sizeof(aBHS);
+    return iscsiRecvPDUProcess(pImage, &Res, 1);
+}
+
+/**
+ * Feeds a SCSI Response with CHECK CONDITION status and without sense data
+ * from the target to the session.
+ */
+static int tstTargetResponse(PISCSIIMAGE pImage, uint32_t Itt)
+{
+    uint32_t aBHS[ISCSI_BHS_SIZE / sizeof(uint32_t)];
+    RT_ZERO(aBHS);
+    aBHS[0] = RT_H2N_U32(ISCSIOP_SCSI_RES | ISCSI_FINAL_BIT | SCSI_STATUS_CHECK_CONDITION);
+    aBHS[4] = Itt;
+    aBHS[6] = RT_H2N_U32(pImage->ExpStatSN);
+    aBHS[7] = RT_H2N_U32(pImage->CmdSN);
+    aBHS[8] = RT_H2N_U32(pImage->CmdSN + 31);
+
+    ISCSIRES Res;
+    Res.pvSeg = aBHS;
+    Res.cbSeg = sizeof(aBHS);
+    return iscsiRecvPDUProcess(pImage, &Res, 1);
+}
+
+/**
+ * Checks the next Data-Out PDU on the wire.
+ *
+ * @returns Offset of the PDU following this one.
+ */
+static size_t tstCheckDataOut(PTSTWRITEREQ pReq, size_t offWire, uint32_t Itt, uint32_t Ttt,
+                              uint32_t DataSN, uint32_t offData, uint32_t cbData, bool fFinal)
+{
+    if (offWire + ISCSI_BHS_SIZE + cbData > g_cbWire)
+    {
+        RTTestIFailed("Data-Out PDU at %#zx (offset %#x) is missing, only %#zx bytes sent", offWire, offData, g_cbWire);
+        return g_cbWire;
+    }
+
+    const uint32_t *paBHS = (const uint32_t *)&g_abWire[offWire];
+    RTTESTI_CHECK_MSG((RT_N2H_U32(paBHS[0]) & ISCSIOP_MASK) == ISCSIOP_SCSI_DATA_OUT,
+                      ("PDU at %#zx: opcode %#x\n", offWire, RT_N2H_U32(paBHS[0]) & ISCSIOP_MASK));
+    RTTESTI_CHECK_MSG(RT_BOOL(RT_N2H_U32(paBHS[0]) & ISCSI_FINAL_BIT) == fFinal,
+                      ("PDU at %#zx: F bit %#x\n", offWire, RT_N2H_U32(paBHS[0])));
+    RTTESTI_CHECK_MSG((RT_N2H_U32(paBHS[1]) & 0xffffff) == cbData,
+                      ("PDU at %#zx: data length %#x, expected %#x\n", offWire, RT_N2H_U32(paBHS[1]) & 0xffffff, cbData));
+    RTTESTI_CHECK(paBHS[4] == Itt);
+    RTTESTI_CHECK_MSG(RT_N2H_U32(paBHS[5]) == Ttt,
+                      ("PDU at %#zx: TTT %#x, expected %#x\n", offWire, RT_N2H_U32(paBHS[5]), Ttt));
+    RTTESTI_CHECK_MSG(RT_N2H_U32(paBHS[9]) == DataSN,
+                      ("PDU at %#zx: DataSN %u, expected %u\n", offWire, RT_N2H_U32(paBHS[9]), DataSN));
+    RTTESTI_CHECK_MSG(RT_N2H_U32(paBHS[10]) == offData,
+                      ("PDU at %#zx: buffer offset %#x, expected %#x\n", offWire, RT_N2H_U32(paBHS[10]), offData));
+    RTTESTI_CHECK_MSG(!memcmp(&g_abWire[offWire + ISCSI_BHS_SIZE], &pReq->abData[offData], cbData),
+                      ("PDU at %#zx: data mismatch\n", offWire));
+
+    return offWire + ISCSI_BHS_SIZE + cbData;
+}
+
+/**
+ * Unsolicited Data-Out still queued when the R2T for the rest of the data
+ * arrives must go out first, each sequence numbered on its own.
+ */
+static void tstR2TDataSequence(void)
+{
+    RTTestISub("R2T data sequence");
+
+    TSTWRITEREQ Req;
+    RT_ZERO(Req);
+    g_cbWire = 0;
+    PISCSIIMAGE pImage = tstSessionCreate();
+    RTTESTI_CHECK_RETV(pImage);
+
+    /* Let only the command PDU with the immediate data out, the unsolicited data stays queued. */
+    g_cbWireBudget = ISCSI_BHS_SIZE + TST_SEND_DATA_LENGTH;
+    PISCSICMD pIScsiCmd = tstWriteIssue(pImage, &Req);
+    if (pIScsiCmd)
+    {
+        uint32_t Itt = pIScsiCmd->Itt;
+        RTTESTI_CHECK(g_cbWire == ISCSI_BHS_SIZE + TST_SEND_DATA_LENGTH);
+        RTTESTI_CHECK(iscsiCmdGetFromItt(pImage, Itt) == pIScsiCmd);
+        RTTESTI_CHECK(pImage->pIScsiPDUTxHead && pImage->pIScsiPDUTxHead->pIScsiCmd == pIScsiCmd);
+
+        RTTESTI_CHECK_RC(tstTargetR2T(pImage, Itt, TST_FIRST_BURST_LENGTH, TST_WRITE_SIZE - TST_FIRST_BURST_LENGTH),
+                         VINF_SUCCESS);
+
+        g_cbWireBudget = ~(size_t)0;
+        RTTESTI_CHECK_RC(iscsiSendPDUAsync(pImage), VINF_SUCCESS);
+        RTTESTI_CHECK(!pImage->pIScsiPDUTxHead && !pImage->pIScsiPDUTxCur);
+
+        /* Command PDU with the immediate data. */
+        const uint32_t *paBHS = (const uint32_t *)&g_abWire[0];
+        RTTESTI_CHECK((RT_N2H_U32(paBHS[0]) & ISCSIOP_MASK) == ISCSIOP_SCSI_CMD);
+        RTTESTI_CHECK(!(RT_N2H_U32(paBHS[0]) & ISCSI_FINAL_BIT));
+        RTTESTI_CHECK(RT_N2H_U32(paBHS[5]) == TST_WRITE_SIZE);
+        RTTESTI_CHECK(!memcmp(&g_abWire[ISCSI_BHS_SIZE], &Req.abData[0], TST_SEND_DATA_LENGTH));
+
+        /* Unsolicited data up to the first burst length. */
+        size_t offWire = ISCSI_BHS_SIZE + TST_SEND_DATA_LENGTH;
+        uint32_t DataSN = 0;
+        for (uint32_t offData = TST_SEND_DATA_LENGTH; offData < TST_FIRST_BURST_LENGTH; offData += TST_SEND_DATA_LENGTH)
+            offWire = tstCheckDataOut(&Req, offWire, Itt, ISCSI_TASK_TAG_RSVD, DataSN++, offData, TST_SEND_DATA_LENGTH,
+                                      offData + TST_SEND_DATA_LENGTH == TST_FIRST_BURST_LENGTH);
+
+        /* The solicited data follows in order. */
+        DataSN = 0;
+        for (uint32_t offData = TST_FIRST_BURST_LENGTH; offData < TST_WRITE_SIZE; offData += TST_SEND_DATA_LENGTH)
+            offWire = tstCheckDataOut(&Req, offWire, Itt, TST_TTT, DataSN++, offData, TST_SEND_DATA_LENGTH,
+                                      offData + TST_SEND_DATA_LENGTH == TST_WRITE_SIZE);
+        RTTESTI_CHECK_MSG(offWire == g_cbWire, ("%#zx bytes sent, expected %#zx\n", g_cbWire, offWire));
+
+        RTTESTI_CHECK_RC(tstTargetResponse(pImage, Itt), VINF_SUCCESS);
+        RTTESTI_CHECK(Req.cCompleted == 1);
+        RTTESTI_CHECK(!pImage->cCmdsWaiting);
+    }
+
+    tstSessionDestroy(pImage);
+}
+
+/**
+ * Bogus R2Ts must be ignored without sending anything.
+ */
+static void tstR2TInvalid(void)
+{
+    RTTestISub("Invalid R2T");
+
+    TSTWRITEREQ Req;
+    RT_ZERO(Req);
+    g_cbWire = 0;
+    PISCSIIMAGE pImage = tstSessionCreate();
+    RTTESTI_CHECK_RETV(pImage);
+
+    g_cbWireBudget = ~(size_t)0;
+    PISCSICMD pIScsiCmd = tstWriteIssue(pImage, &Req);
+    if (pIScsiCmd)
+    {
+        uint32_t Itt = pIScsiCmd->Itt;
+        size_t cbWire = g_cbWire;
+
+        /* Beyond the end of the data, exceeding the burst length and for an unknown task. */
+        pImage->cbMaxBurstLength = _16K;
+        RTTESTI_CHECK_RC(tstTargetR2T(pImage, Itt, TST_WRITE_SIZE - 512, _1K), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(tstTargetR2T(pImage, Itt, TST_FIRST_BURST_LENGTH, _32K), VINF_SUCCESS);
+        RTTESTI_CHECK_RC(tstTargetR2T(pImage, Itt ^ RT_H2N_U32(0x8000), TST_FIRST_BURST_LENGTH, _1K), VINF_SUCCESS);
+        RTTESTI_CHECK(g_cbWire == cbWire);
+        RTTESTI_CHECK(!pImage->pIScsiPDUTxHead);
+        RTTESTI_CHECK(!Req.cCompleted);
+
+        RTTESTI_CHECK_RC(tstTargetResponse(pImage, Itt), VINF_SUCCESS);
+        RTTESTI_CHECK(Req.cCompleted == 1);
+    }
+
+    tstSessionDestroy(pImage);
+}
+
+/**
+ * A command completed by the target while its solicited data is still queued
+ * must take the data with it.
+ */
+static void tstCompleteWithDataQueued(void)
+{
+    RTTestISub("Completion with queued Data-Out");
+
+    TSTWRITEREQ Req;
+    RT_ZERO(Req);
+    g_cbWire = 0;
+    PISCSIIMAGE pImage = tstSessionCreate();
+    RTTESTI_CHECK_RETV(pImage);
+
+    g_cbWireBudget = ~(size_t)0;
+    PISCSICMD pIScsiCmd = tstWriteIssue(pImage, &Req);
+    if (pIScsiCmd)
+    {
+        uint32_t Itt = pIScsiCmd->Itt;
+
+        /* Block the socket, the solicited data stays queued. */
+        g_cbWireBudget = 0;
+        RTTESTI_CHECK_RC(tstTargetR2T(pImage, Itt, TST_FIRST_BURST_LENGTH, TST_WRITE_SIZE - TST_FIRST_BURST_LENGTH),
+                         VINF_SUCCESS);
+        RTTESTI_CHECK(pImage->pIScsiPDUTxHead != NULL);
+
+        RTTESTI_CHECK_RC(tstTargetResponse(pImage, Itt), VINF_SUCCESS);
+        RTTESTI_CHECK(Req.cCompleted == 1);
+        RTTESTI_CHECK(!pImage->pIScsiPDUTxHead && !pImage->pIScsiPDUTxTail && !pImage->pIScsiPDUTxCur);
+
+        /* Nothing may be sent for the completed command. */
+        size_t cbWire = g_cbWire;
+        g_cbWireBudget = ~(size_t)0;
+        RTTESTI_CHECK_RC(iscsiSendPDUAsync(pImage), VINF_SUCCESS);
+        RTTESTI_CHECK(g_cbWire == cbWire);
+    }
+
+    tstSessionDestroy(pImage);
+}
+
+/**
+ * A command completed by the target while one of its Data-Out PDUs is partially
+ * sent must not complete before the PDU is on the wire completely.
+ */
+static void tstCompleteWithDataInFlight(void)
+{
+    RTTestISub("Completion with Data-Out in flight");
+
+    TSTWRITEREQ Req;
+    RT_ZERO(Req);
+    g_cbWire = 0;
+    PISCSIIMAGE pImage = tstSessionCreate();
+    RTTESTI_CHECK_RETV(pImage);
+
+    /* Send the command and a part of the first unsolicited Data-Out PDU. */
+    g_cbWireBudget = ISCSI_BHS_SIZE + TST_SEND_DATA_LENGTH + ISCSI_BHS_SIZE + 100;
+    PISCSICMD pIScsiCmd = tstWriteIssue(pImage, &Req);
+    if (pIScsiCmd)
+    {
+        uint32_t Itt = pIScsiCmd->Itt;
+        RTTESTI_CHECK(pImage->pIScsiPDUTxCur && pImage->pIScsiPDUTxCur->fDataOut);
+
+        RTTESTI_CHECK_RC(tstTargetResponse(pImage, Itt), VINF_SUCCESS);
+        RTTESTI_CHECK(!Req.cCompleted);
+        RTTESTI_CHECK(!pImage->pIScsiPDUTxHead);
+
+        /* Only the rest of the PDU in flight goes out before the command completes. */
+        g_cbWireBudget = ~(size_t)0;
+        RTTESTI_CHECK_RC(iscsiSendPDUAsync(pImage), VINF_SUCCESS);
+        RTTESTI_CHECK(Req.cCompleted == 1);
+        RTTESTI_CHECK(!pImage->pIScsiPDUTxCur);
+
+        size_t offWire = tstCheckDataOut(&Req, ISCSI_BHS_SIZE + TST_SEND_DATA_LENGTH, Itt, ISCSI_TASK_TAG_RSVD, 0,
+                                         TST_SEND_DATA_LENGTH, TST_SEND_DATA_LENGTH, false);
+        RTTESTI_CHECK(offWire == g_cbWire);
+    }
+
+    tstSessionDestroy(pImage);
+}
+
+int main()
+{
+    RTTEST hTest;
+    int rc = RTTestInitAndCreate("tstVDIScsi", &hTest);
+    if (rc)
+        return rc;
+    RTTestBanner(hTest);
+
+    g_TstIfNet.pfnSgWriteNB = tstSgWriteNB;
+
+    tstR2TDataSequence();
+    tstR2TInvalid();
+    tstCompleteWithDataQueued();
+    tstCompleteWithDataInFlight();
+
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -41,6 +41,7 @@
 #include "VDMemDisk.h"
 #include "VDIoBackend.h"
 #include "VDIoRnd.h"
+#include "VDIoBench.h"
 
 #include "VDScript.h"
 #include "BuiltinTests.h"
@@ -109,6 +110,12 @@ typedef struct VDDISK
     VDGEOMETRY     LogicalGeom;
     /** Global test data. */
     PVDTESTGLOB    pTestGlob;
+    /** Config interface of the cache, answers the write mode. */
+    VDINTERFACECONFIG VDIfCfgCache;
+    /** Pointer to the per cache interface list. */
+    PVDINTERFACE   pInterfacesCache;
+    /** Write mode of the cache ("around" or "through"). */
+    char           szCacheWriteMode[16];
 } VDDISK, *PVDDISK;
 
 /**
@@ -153,6 +160,14 @@ typedef struct VDTESTGLOB
     char            *pszIoBackend;
     /** Testcase handle. */
     RTTEST           hTest;
+    /** Name of the executed script. */
+    const char      *pszScript;
+    /** Benchmark report to add job results to, NULL if none. */
+    PVDIOBENCHREPORT pBenchReport;
+    /** Baseline to compare job results against, NULL if none. */
+    PVDIOBENCHBASELINE pBenchBaseline;
+    /** Allowed deviation from the baseline in percent. */
+    unsigned         uBenchTolerancePct;
 } VDTESTGLOB;
 
 /**
@@ -189,6 +204,10 @@ typedef struct VDIOREQ
     void          *pvBufRead;
     /** Opaque user data. */
     void          *pvUser;
+    /** Submission timestamp. */
+    uint64_t      tsStart;
+    /** Benchmark result to record the latency in, NULL if not benchmarking. */
+    PVDIOBENCHRESULT pBench;
 } VDIOREQ, *PVDIOREQ;
 
 /**
@@ -212,6 +231,8 @@ typedef struct VDIOTEST
     PVDIORND    pIoRnd;
     /** Pointer to the data pattern to use. */
     PVDPATTERN  pPattern;
+    /** Benchmark result to record request latencies in, NULL if not benchmarking. */
+    PVDIOBENCHRESULT pBench;
     /** Data dependent on the I/O mode (sequential or random). */
     union
     {
@@ -233,12 +254,16 @@ typedef struct VDIOTEST
 static DECLCALLBACK(int) vdScriptHandlerCreate(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerOpen(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerIoBench(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerFlush(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerMerge(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCompact(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerDiscard(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCopy(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerClose(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCreateCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerOpenCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCloseCache(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerPrintFileSize(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoRngCreate(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerIoRngDestroy(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -247,6 +272,7 @@ static DECLCALLBACK(int) vdScriptHandlerIoPatternCreateFromFile(PVDSCRIPTARG paS
 static DECLCALLBACK(int) vdScriptHandlerIoPatternDestroy(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerSleep(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerDumpFile(PVDSCRIPTARG paScriptArgs, void *pvUser);
+static DECLCALLBACK(int) vdScriptHandlerCopyFile(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerDestroyDisk(PVDSCRIPTARG paScriptArgs, void *pvUser);
 static DECLCALLBACK(int) vdScriptHandlerCompareDisks(PVDSCRIPTARG paScriptArgs, void *pvUser);
@@ -303,6 +329,21 @@ const VDSCRIPTTYPE g_aArgIo[] =
     VDSCRIPTTYPE_STRING  /* pattern */
 };
 
+/* I/O benchmark action */
+const VDSCRIPTTYPE g_aArgIoBench[] =
+{
+    VDSCRIPTTYPE_STRING, /* job */
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_BOOL,   /* async */
+    VDSCRIPTTYPE_UINT32, /* queuedepth */
+    VDSCRIPTTYPE_STRING, /* mode */
+    VDSCRIPTTYPE_UINT64, /* blocksize */
+    VDSCRIPTTYPE_UINT64, /* offStart */
+    VDSCRIPTTYPE_UINT64, /* offEnd */
+    VDSCRIPTTYPE_UINT64, /* size */
+    VDSCRIPTTYPE_UINT32  /* writes */
+};
+
 /* flush action */
 const VDSCRIPTTYPE g_aArgFlush[] =
 {
@@ -355,6 +396,32 @@ const VDSCRIPTTYPE g_aArgClose[] =
     VDSCRIPTTYPE_BOOL    /* delete */
 };
 
+/* create cache action */
+const VDSCRIPTTYPE g_aArgCreateCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_STRING, /* name */
+    VDSCRIPTTYPE_UINT64, /* size */
+    VDSCRIPTTYPE_STRING, /* backend */
+    VDSCRIPTTYPE_STRING  /* writemode */
+};
+
+/* open cache action */
+const VDSCRIPTTYPE g_aArgOpenCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_STRING, /* name */
+    VDSCRIPTTYPE_STRING, /* backend */
+    VDSCRIPTTYPE_STRING  /* writemode */
+};
+
+/* close cache action */
+const VDSCRIPTTYPE g_aArgCloseCache[] =
+{
+    VDSCRIPTTYPE_STRING, /* disk */
+    VDSCRIPTTYPE_BOOL    /* delete */
+};
+
 /* print file size action */
 const VDSCRIPTTYPE g_aArgPrintFileSize[] =
 {
@@ -413,6 +480,13 @@ const VDSCRIPTTYPE g_aArgDumpFile[] =
     VDSCRIPTTYPE_STRING  /* path */
 };
 
+/* Copy file action */
+const VDSCRIPTTYPE g_aArgCopyFile[] =
+{
+    VDSCRIPTTYPE_STRING, /* file */
+    VDSCRIPTTYPE_STRING  /* copy */
+};
+
 /* Create virtual disk handle */
 const VDSCRIPTTYPE g_aArgCreateDisk[] =
 {
@@ -476,8 +550,12 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"create",                     VDSCRIPTTYPE_VOID, g_aArgCreate,                      RT_ELEMENTS(g_aArgCreate),                     vdScriptHandlerCreate},
     {"open",                       VDSCRIPTTYPE_VOID, g_aArgOpen,                        RT_ELEMENTS(g_aArgOpen),                       vdScriptHandlerOpen},
     {"io",                         VDSCRIPTTYPE_VOID, g_aArgIo,                          RT_ELEMENTS(g_aArgIo),                         vdScriptHandlerIo},
+    {"iobench",                    VDSCRIPTTYPE_VOID, g_aArgIoBench,                     RT_ELEMENTS(g_aArgIoBench),                    vdScriptHandlerIoBench},
     {"flush",                      VDSCRIPTTYPE_VOID, g_aArgFlush,                       RT_ELEMENTS(g_aArgFlush),                      vdScriptHandlerFlush},
     {"close",                      VDSCRIPTTYPE_VOID, g_aArgClose,                       RT_ELEMENTS(g_aArgClose),                      vdScriptHandlerClose},
+    {"createcache",                VDSCRIPTTYPE_VOID, g_aArgCreateCache,                 RT_ELEMENTS(g_aArgCreateCache),                vdScriptHandlerCreateCache},
+    {"opencache",                  VDSCRIPTTYPE_VOID, g_aArgOpenCache,                   RT_ELEMENTS(g_aArgOpenCache),                  vdScriptHandlerOpenCache},
+    {"closecache",                 VDSCRIPTTYPE_VOID, g_aArgCloseCache,                  RT_ELEMENTS(g_aArgCloseCache),                 vdScriptHandlerCloseCache},
     {"printfilesize",              VDSCRIPTTYPE_VOID, g_aArgPrintFileSize,               RT_ELEMENTS(g_aArgPrintFileSize),              vdScriptHandlerPrintFileSize},
 #ifdef VBOX_TSTVDIO_WITH_LOG_REPLAY
     {"ioreplay",                   VDSCRIPTTYPE_VOID, g_aArgIoLogReplay,                 RT_ELEMENTS(g_aArgIoLogReplay),                vdScriptHandlerIoLogReplay},
@@ -493,6 +571,7 @@ const VDSCRIPTCALLBACK g_aScriptActions[] =
     {"iopatterndestroy",           VDSCRIPTTYPE_VOID, g_aArgIoPatternDestroy,            RT_ELEMENTS(g_aArgIoPatternDestroy),           vdScriptHandlerIoPatternDestroy},
     {"sleep",                      VDSCRIPTTYPE_VOID, g_aArgSleep,                       RT_ELEMENTS(g_aArgSleep),                      vdScriptHandlerSleep},
     {"dumpfile",                   VDSCRIPTTYPE_VOID, g_aArgDumpFile,                    RT_ELEMENTS(g_aArgDumpFile),                   vdScriptHandlerDumpFile},
+    {"copyfile",                   VDSCRIPTTYPE_VOID, g_aArgCopyFile,                    RT_ELEMENTS(g_aArgCopyFile),                   vdScriptHandlerCopyFile},
     {"createdisk",                 VDSCRIPTTYPE_VOID, g_aArgCreateDisk,                  RT_ELEMENTS(g_aArgCreateDisk),                 vdScriptHandlerCreateDisk},
     {"destroydisk",                VDSCRIPTTYPE_VOID, g_aArgDestroyDisk,                 RT_ELEMENTS(g_aArgDestroyDisk),                vdScriptHandlerDestroyDisk},
     {"comparedisks",               VDSCRIPTTYPE_VOID, g_aArgCompareDisks,                RT_ELEMENTS(g_aArgCompareDisks),               vdScriptHandlerCompareDisks},
@@ -532,6 +611,7 @@ static int tstVDIoTestInit(PVDIOTEST pIoTest, PVDTESTGLOB pGlob, bool fRandomAcc
 static bool tstVDIoTestRunning(PVDIOTEST pIoTest);
 static void tstVDIoTestDestroy(PVDIOTEST pIoTest);
 static bool tstVDIoTestReqOutstanding(PVDIOREQ pIoReq);
+static void tstVDIoTestReqRecordLatency(PVDIOREQ pIoReq);
 static int  tstVDIoTestReqInit(PVDIOTEST pIoTest, PVDIOREQ pIoReq, void *pvUser);
 static DECLCALLBACK(void) tstVDIoTestReqComplete(void *pvUser1, void *pvUser2, int rcReq);
 
@@ -701,6 +781,253 @@ static uint64_t tstVDIoGetSpeedKBs(uint64_t cbIo, uint64_t tsNano)
     return uSpeedKBs;
 }
 
+/**
+ * Runs an initialized I/O test on the given disk until all requests completed.
+ *
+ * @returns VBox status code.
+ * @param   pGlob          Global test state.
+ * @param   pDisk          The disk to run the test on.
+ * @param   pIoTest        The I/O test to run.
+ * @param   fAsync         Flag whether to use the async interface.
+ * @param   cMaxReqs       Maximum number of outstanding requests for async I/O.
+ * @param   pcNsElapsed    Where to store the time the test took in nanoseconds.
+ */
+static int tstVDIoTestExec(PVDTESTGLOB pGlob, PVDDISK pDisk, PVDIOTEST pIoTest, bool fAsync,
+                           unsigned cMaxReqs, uint64_t *pcNsElapsed)
+{
+    int rc = VINF_SUCCESS;
+    PVDIOREQ paIoReq = NULL;
+    unsigned cMaxTasksOutstanding = fAsync ? cMaxReqs : 1;
+    RTSEMEVENT EventSem;
+
+    rc = RTSemEventCreate(&EventSem);
+    paIoReq = (PVDIOREQ)RTMemAllocZ(cMaxTasksOutstanding * sizeof(VDIOREQ));
+    if (paIoReq && RT_SUCCESS(rc))
+    {
+        uint64_t NanoTS = RTTimeNanoTS();
+
+        /* Init requests. */
+        for (unsigned i = 0; i < cMaxTasksOutstanding; i++)
+        {
+            paIoReq[i].idx = i;
+            paIoReq[i].pvBufRead = RTMemAlloc(pIoTest->cbBlkIo);
+            if (!paIoReq[i].pvBufRead)
+            {
+                rc = VERR_NO_MEMORY;
+                break;
+            }
+        }
+
+        while (   tstVDIoTestRunning(pIoTest)
+               && RT_SUCCESS(rc))
+        {
+            bool fTasksOutstanding = false;
+            unsigned idx = 0;
+
+            /* Submit all idling requests. */
+            while (   idx < cMaxTasksOutstanding
+                   && tstVDIoTestRunning(pIoTest))
+            {
+                if (!tstVDIoTestReqOutstanding(&paIoReq[idx]))
+                {
+                    rc = tstVDIoTestReqInit(pIoTest, &paIoReq[idx], pDisk);
+                    AssertRC(rc);
+
+                    if (RT_SUCCESS(rc))
+                    {
+                        if (!fAsync)
+                        {
+                            switch (paIoReq[idx].enmTxDir)
+                            {
+                                case VDIOREQTXDIR_READ:
+                                {
+                                    rc = VDRead(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].DataSeg.pvSeg, paIoReq[idx].cbReq);
+                                    tstVDIoTestReqRecordLatency(&paIoReq[idx]);
+
+                                    if (RT_SUCCESS(rc)
+                                        && pDisk->pMemDiskVerify)
+                                    {
+                                        RTSGBUF SgBuf;
+                                        RTSgBufInit(&SgBuf, &paIoReq[idx].DataSeg, 1);
+
+                                        if (VDMemDiskCmp(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq, &SgBuf))
+                                        {
+                                            RTTestFailed(pGlob->hTest, "Corrupted disk at offset %llu!\n", paIoReq[idx].off);
+                                            rc = VERR_INVALID_STATE;
+                                        }
+                                    }
+                                    break;
+                                }
+                                case VDIOREQTXDIR_WRITE:
+                                {
+                                    rc = VDWrite(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].DataSeg.pvSeg, paIoReq[idx].cbReq);
+                                    tstVDIoTestReqRecordLatency(&paIoReq[idx]);
+
+                                    if (RT_SUCCESS(rc)
+                                        && pDisk->pMemDiskVerify)
+                                    {
+                                        RTSGBUF SgBuf;
+                                        RTSgBufInit(&SgBuf, &paIoReq[idx].DataSeg, 1);
+                                        rc = VDMemDiskWrite(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq, &SgBuf);
+                                    }
+                                    break;
+                                }
+                                case VDIOREQTXDIR_FLUSH:
+                                {
+                                    rc = VDFlush(pDisk->pVD);
+                                    break;
+                                }
+                                case VDIOREQTXDIR_DISCARD:
+                                    AssertMsgFailed(("Invalid\n"));
+                            }
+
+                            ASMAtomicXchgBool(&paIoReq[idx].fOutstanding, false);
+                            if (RT_SUCCESS(rc))
+                                idx++;
+                        }
+                        else
+                        {
+                            LogFlow(("Queuing request %d\n", idx));
+                            switch (paIoReq[idx].enmTxDir)
+                            {
+                                case VDIOREQTXDIR_READ:
+                                {
+                                    rc = VDAsyncRead(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].cbReq, &paIoReq[idx].SgBuf,
+                                                     tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
+                                    break;
+                                }
+                                case VDIOREQTXDIR_WRITE:
+                                {
+                                    rc = VDAsyncWrite(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].cbReq, &paIoReq[idx].SgBuf,
+                                                      tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
+                                    break;
+                                }
+                                case VDIOREQTXDIR_FLUSH:
+                                {
+                                    rc = VDAsyncFlush(pDisk->pVD, tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
+                                    break;
+                                }
+                                case VDIOREQTXDIR_DISCARD:
+                                    AssertMsgFailed(("Invalid\n"));
+                            }
+
+                            if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                            {
+                                idx++;
+                                fTasksOutstanding = true;
+                                rc = VINF_SUCCESS;
+                            }
+                            else if (rc == VINF_VD_ASYNC_IO_FINISHED)
+                            {
+                                LogFlow(("Request %d completed\n", idx));
+                                tstVDIoTestReqRecordLatency(&paIoReq[idx]);
+                                switch (paIoReq[idx].enmTxDir)
+                                {
+                                    case VDIOREQTXDIR_READ:
+                                    {
+                                        if (pDisk->pMemDiskVerify)
+                                        {
+                                            RTCritSectEnter(&pDisk->CritSectVerify);
+                                            RTSgBufReset(&paIoReq[idx].SgBuf);
+
+                                            if (VDMemDiskCmp(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq,
+                                                             &paIoReq[idx].SgBuf))
+                                            {
+                                                RTTestFailed(pGlob->hTest, "Corrupted disk at offset %llu!\n", paIoReq[idx].off);
+                                                rc = VERR_INVALID_STATE;
+                                            }
+                                            RTCritSectLeave(&pDisk->CritSectVerify);
+                                        }
+                                        break;
+                                    }
+                                    case VDIOREQTXDIR_WRITE:
+                                    {
+                                        if (pDisk->pMemDiskVerify)
+                                        {
+                                            RTCritSectEnter(&pDisk->CritSectVerify);
+                                            RTSgBufReset(&paIoReq[idx].SgBuf);
+
+                                            rc = VDMemDiskWrite(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq,
+                                                                &paIoReq[idx].SgBuf);
+                                            RTCritSectLeave(&pDisk->CritSectVerify);
+                                        }
+                                        break;
+                                    }
+                                    case VDIOREQTXDIR_FLUSH:
+                                        break;
+                                    case VDIOREQTXDIR_DISCARD:
+                                        AssertMsgFailed(("Invalid\n"));
+                                }
+
+                                ASMAtomicXchgBool(&paIoReq[idx].fOutstanding, false);
+                                if (rc != VERR_INVALID_STATE)
+                                    rc = VINF_SUCCESS;
+                            }
+                        }
+
+                        if (RT_FAILURE(rc))
+                            RTPrintf("Error submitting task %u rc=%Rrc\n", paIoReq[idx].idx, rc);
+                    }
+                }
+            }
+
+            /* Wait for a request to complete. */
+            if (   fAsync
+                && fTasksOutstanding)
+            {
+                rc = RTSemEventWait(EventSem, RT_INDEFINITE_WAIT);
+                AssertRC(rc);
+            }
+        }
+
+        /* Cleanup, wait for all tasks to complete. */
+        while (fAsync)
+        {
+            unsigned idx = 0;
+            bool fAllIdle = true;
+
+            while (idx < cMaxTasksOutstanding)
+            {
+                if (tstVDIoTestReqOutstanding(&paIoReq[idx]))
+                {
+                    fAllIdle = false;
+                    break;
+                }
+                idx++;
+            }
+
+            if (!fAllIdle)
+            {
+                rc = RTSemEventWait(EventSem, 100);
+                Assert(RT_SUCCESS(rc) || rc == VERR_TIMEOUT);
+            }
+            else
+                break;
+        }
+
+        *pcNsElapsed = RTTimeNanoTS() - NanoTS;
+
+        for (unsigned i = 0; i < cMaxTasksOutstanding; i++)
+        {
+            if (paIoReq[i].pvBufRead)
+                RTMemFree(paIoReq[i].pvBufRead);
+        }
+
+        RTSemEventDestroy(EventSem);
+        RTMemFree(paIoReq);
+    }
+    else
+    {
+        if (paIoReq)
+            RTMemFree(paIoReq);
+        if (RT_SUCCESS(rc))
+            RTSemEventDestroy(EventSem);
+        rc = VERR_NO_MEMORY;
+    }
+
+    return rc;
+}
+
 static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -781,237 +1108,129 @@ static DECLCALLBACK(int) vdScriptHandlerIo(PVDSCRIPTARG paScriptArgs, void *pvUs
         rc = tstVDIoTestInit(&IoTest, pGlob, fRandomAcc, cbIo, cbBlkSize, offStart, offEnd, uWriteChance, pPattern);
         if (RT_SUCCESS(rc))
         {
-            PVDIOREQ paIoReq = NULL;
-            unsigned cMaxTasksOutstanding = fAsync ? cMaxReqs : 1;
-            RTSEMEVENT EventSem;
+            uint64_t NanoTS = 0;
 
-            rc = RTSemEventCreate(&EventSem);
-            paIoReq = (PVDIOREQ)RTMemAllocZ(cMaxTasksOutstanding * sizeof(VDIOREQ));
-            if (paIoReq && RT_SUCCESS(rc))
+            rc = tstVDIoTestExec(pGlob, pDisk, &IoTest, fAsync, cMaxReqs, &NanoTS);
+            if (RT_SUCCESS(rc))
             {
-                uint64_t NanoTS = RTTimeNanoTS();
-
-                /* Init requests. */
-                for (unsigned i = 0; i < cMaxTasksOutstanding; i++)
-                {
-                    paIoReq[i].idx = i;
-                    paIoReq[i].pvBufRead = RTMemAlloc(cbBlkSize);
-                    if (!paIoReq[i].pvBufRead)
-                    {
-                        rc = VERR_NO_MEMORY;
-                        break;
-                    }
-                }
-
-                while (   tstVDIoTestRunning(&IoTest)
-                       && RT_SUCCESS(rc))
-                {
-                    bool fTasksOutstanding = false;
-                    unsigned idx = 0;
-
-                    /* Submit all idling requests. */
-                    while (   idx < cMaxTasksOutstanding
-                           && tstVDIoTestRunning(&IoTest))
-                    {
-                        if (!tstVDIoTestReqOutstanding(&paIoReq[idx]))
-                        {
-                            rc = tstVDIoTestReqInit(&IoTest, &paIoReq[idx], pDisk);
-                            AssertRC(rc);
-
-                            if (RT_SUCCESS(rc))
-                            {
-                                if (!fAsync)
-                                {
-                                    switch (paIoReq[idx].enmTxDir)
-                                    {
-                                        case VDIOREQTXDIR_READ:
-                                        {
-                                            rc = VDRead(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].DataSeg.pvSeg, paIoReq[idx].cbReq);
+                uint64_t SpeedKBs = tstVDIoGetSpeedKBs(cbIo, NanoTS);
+                RTTestValue(pGlob->hTest, "Throughput", SpeedKBs, RTTESTUNIT_KILOBYTES_PER_SEC);
+            }
 
-                                            if (RT_SUCCESS(rc)
-                                                && pDisk->pMemDiskVerify)
-                                            {
-                                                RTSGBUF SgBuf;
-                                                RTSgBufInit(&SgBuf, &paIoReq[idx].DataSeg, 1);
-
-                                                if (VDMemDiskCmp(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq, &SgBuf))
-                                                {
-                                                    RTTestFailed(pGlob->hTest, "Corrupted disk at offset %llu!\n", paIoReq[idx].off);
-                                                    rc = VERR_INVALID_STATE;
-                                                }
-                                            }
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_WRITE:
-                                        {
-                                            rc = VDWrite(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].DataSeg.pvSeg, paIoReq[idx].cbReq);
+            tstVDIoTestDestroy(&IoTest);
+        }
+        RTTestSubDone(pGlob->hTest);
+    }
 
-                                            if (RT_SUCCESS(rc)
-                                                && pDisk->pMemDiskVerify)
-                                            {
-                                                RTSGBUF SgBuf;
-                                                RTSgBufInit(&SgBuf, &paIoReq[idx].DataSeg, 1);
-                                                rc = VDMemDiskWrite(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq, &SgBuf);
-                                            }
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_FLUSH:
-                                        {
-                                            rc = VDFlush(pDisk->pVD);
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_DISCARD:
-                                            AssertMsgFailed(("Invalid\n"));
-                                    }
+    return rc;
+}
 
-                                    ASMAtomicXchgBool(&paIoReq[idx].fOutstanding, false);
-                                    if (RT_SUCCESS(rc))
-                                        idx++;
-                                }
-                                else
-                                {
-                                    LogFlow(("Queuing request %d\n", idx));
-                                    switch (paIoReq[idx].enmTxDir)
-                                    {
-                                        case VDIOREQTXDIR_READ:
-                                        {
-                                            rc = VDAsyncRead(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].cbReq, &paIoReq[idx].SgBuf,
-                                                             tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_WRITE:
-                                        {
-                                            rc = VDAsyncWrite(pDisk->pVD, paIoReq[idx].off, paIoReq[idx].cbReq, &paIoReq[idx].SgBuf,
-                                                              tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_FLUSH:
-                                        {
-                                            rc = VDAsyncFlush(pDisk->pVD, tstVDIoTestReqComplete, &paIoReq[idx], EventSem);
-                                            break;
-                                        }
-                                        case VDIOREQTXDIR_DISCARD:
-                                            AssertMsgFailed(("Invalid\n"));
-                                    }
+/**
+ * Runs a benchmark job on a disk, reports throughput and latency distribution
+ * and compares the result against the baseline if one was given.
+ */
+static DECLCALLBACK(int) vdScriptHandlerIoBench(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszJob = paScriptArgs[0].psz;
+    const char *pcszDisk = paScriptArgs[1].psz;
+    bool fAsync = paScriptArgs[2].f;
+    unsigned cMaxReqs = paScriptArgs[3].u32;
+    bool fRandomAcc = false;
+    uint64_t cbBlkSize = paScriptArgs[5].u64;
+    uint64_t offStart = paScriptArgs[6].u64;
+    uint64_t offEnd = paScriptArgs[7].u64;
+    uint64_t cbIo = paScriptArgs[8].u64;
+    unsigned uWriteChance = paScriptArgs[9].u32;
+    PVDDISK pDisk = NULL;
 
-                                    if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
-                                    {
-                                        idx++;
-                                        fTasksOutstanding = true;
-                                        rc = VINF_SUCCESS;
-                                    }
-                                    else if (rc == VINF_VD_ASYNC_IO_FINISHED)
-                                    {
-                                        LogFlow(("Request %d completed\n", idx));
-                                        switch (paIoReq[idx].enmTxDir)
-                                        {
-                                            case VDIOREQTXDIR_READ:
-                                            {
-                                                if (pDisk->pMemDiskVerify)
-                                                {
-                                                    RTCritSectEnter(&pDisk->CritSectVerify);
-                                                    RTSgBufReset(&paIoReq[idx].SgBuf);
-
-                                                    if (VDMemDiskCmp(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq,
-                                                                     &paIoReq[idx].SgBuf))
-                                                    {
-                                                        RTTestFailed(pGlob->hTest, "Corrupted disk at offset %llu!\n", paIoReq[idx].off);
-                                                        rc = VERR_INVALID_STATE;
-                                                    }
-                                                    RTCritSectLeave(&pDisk->CritSectVerify);
-                                                }
-                                                break;
-                                            }
-                                            case VDIOREQTXDIR_WRITE:
-                                            {
-                                                if (pDisk->pMemDiskVerify)
-                                                {
-                                                    RTCritSectEnter(&pDisk->CritSectVerify);
-                                                    RTSgBufReset(&paIoReq[idx].SgBuf);
-
-                                                    rc = VDMemDiskWrite(pDisk->pMemDiskVerify, paIoReq[idx].off, paIoReq[idx].cbReq,
-                                                                        &paIoReq[idx].SgBuf);
-                                                    RTCritSectLeave(&pDisk->CritSectVerify);
-                                                }
-                                                break;
-                                            }
-                                            case VDIOREQTXDIR_FLUSH:
-                                                break;
-                                            case VDIOREQTXDIR_DISCARD:
-                                                AssertMsgFailed(("Invalid\n"));
-                                        }
+    if (!RTStrICmp(paScriptArgs[4].psz, "seq"))
+        fRandomAcc = false;
+    else if (!RTStrICmp(paScriptArgs[4].psz, "rnd"))
+        fRandomAcc = true;
+    else
+    {
+        RTPrintf("Invalid access mode '%s'\n", paScriptArgs[4].psz);
+        rc = VERR_INVALID_PARAMETER;
+    }
 
-                                        ASMAtomicXchgBool(&paIoReq[idx].fOutstanding, false);
-                                        if (rc != VERR_INVALID_STATE)
-                                            rc = VINF_SUCCESS;
-                                    }
-                                }
+    if (   RT_SUCCESS(rc)
+        && (   !cbBlkSize
+            || uWriteChance > 100
+            || (fAsync && !cMaxReqs)))
+        rc = VERR_INVALID_PARAMETER;
 
-                                if (RT_FAILURE(rc))
-                                    RTPrintf("Error submitting task %u rc=%Rrc\n", paIoReq[idx].idx, rc);
-                            }
-                        }
-                    }
+    if (RT_SUCCESS(rc))
+    {
+        pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+        if (!pDisk)
+            rc = VERR_NOT_FOUND;
+    }
 
-                    /* Wait for a request to complete. */
-                    if (   fAsync
-                        && fTasksOutstanding)
-                    {
-                        rc = RTSemEventWait(EventSem, RT_INDEFINITE_WAIT);
-                        AssertRC(rc);
-                    }
-                }
+    if (RT_SUCCESS(rc))
+    {
+        /* Set defaults if not set by the user. */
+        if (offStart == 0 && offEnd == 0)
+        {
+            offEnd = VDGetSize(pDisk->pVD, VD_LAST_IMAGE);
+            if (offEnd == 0)
+                return VERR_INVALID_STATE;
+        }
 
-                /* Cleanup, wait for all tasks to complete. */
-                while (fAsync)
-                {
-                    unsigned idx = 0;
-                    bool fAllIdle = true;
+        if (!cbIo)
+            cbIo = offEnd;
+    }
 
-                    while (idx < cMaxTasksOutstanding)
-                    {
-                        if (tstVDIoTestReqOutstanding(&paIoReq[idx]))
-                        {
-                            fAllIdle = false;
-                            break;
-                        }
-                        idx++;
-                    }
+    if (RT_SUCCESS(rc))
+    {
+        VDBACKENDINFO BackendInfo;
+        PVDIOBENCHRESULT pBench = (PVDIOBENCHRESULT)RTMemAllocZ(sizeof(VDIOBENCHRESULT));
+        if (!pBench)
+            return VERR_NO_MEMORY;
+
+        rc = VDBackendInfoSingle(pDisk->pVD, VD_LAST_IMAGE, &BackendInfo);
+        pBench->pszJob       = pcszJob;
+        pBench->pszBackend   = RT_SUCCESS(rc) ? BackendInfo.pszBackend : "unknown";
+        pBench->pszIoBackend = pGlob->pszIoBackend;
+        pBench->cImages      = VDGetCount(pDisk->pVD);
+        pBench->fRandom      = fRandomAcc;
+        pBench->fAsync       = fAsync;
+        pBench->cQueueDepth  = fAsync ? cMaxReqs : 1;
+        pBench->cbBlock      = cbBlkSize;
+        pBench->uWritePct    = uWriteChance;
+        VDIoBenchHistInit(&pBench->HistRead);
+        VDIoBenchHistInit(&pBench->HistWrite);
 
-                    if (!fAllIdle)
-                    {
-                        rc = RTSemEventWait(EventSem, 100);
-                        Assert(RT_SUCCESS(rc) || rc == VERR_TIMEOUT);
-                    }
-                    else
-                        break;
-                }
+        VDIOTEST IoTest;
 
-                NanoTS = RTTimeNanoTS() - NanoTS;
-                uint64_t SpeedKBs = tstVDIoGetSpeedKBs(cbIo, NanoTS);
-                RTTestValue(pGlob->hTest, "Throughput", SpeedKBs, RTTESTUNIT_KILOBYTES_PER_SEC);
+        RTTestSub(pGlob->hTest, pcszJob);
+        rc = tstVDIoTestInit(&IoTest, pGlob, fRandomAcc, cbIo, cbBlkSize, offStart, offEnd, uWriteChance, NULL);
+        if (RT_SUCCESS(rc))
+        {
+            IoTest.pBench = pBench;
+            rc = tstVDIoTestExec(pGlob, pDisk, &IoTest, fAsync, cMaxReqs, &pBench->cNsElapsed);
+            if (RT_SUCCESS(rc))
+            {
+                pBench->cbTransferred = cbIo;
+                VDIoBenchResultReport(pGlob->hTest, pBench);
 
-                for (unsigned i = 0; i < cMaxTasksOutstanding; i++)
+                if (pGlob->pBenchReport)
                 {
-                    if (paIoReq[i].pvBufRead)
-                        RTMemFree(paIoReq[i].pvBufRead);
+                    int rc2 = VDIoBenchReportAdd(pGlob->pBenchReport, pGlob->pszScript, pBench);
+                    if (RT_FAILURE(rc2))
+                        RTTestFailed(pGlob->hTest, "Writing the benchmark report failed rc=%Rrc\n", rc2);
                 }
 
-                RTSemEventDestroy(EventSem);
-                RTMemFree(paIoReq);
-            }
-            else
-            {
-                if (paIoReq)
-                    RTMemFree(paIoReq);
-                if (RT_SUCCESS(rc))
-                    RTSemEventDestroy(EventSem);
-                rc = VERR_NO_MEMORY;
+                if (pGlob->pBenchBaseline)
+                    VDIoBenchBaselineCompare(pGlob->pBenchBaseline, pGlob->hTest, pBench,
+                                             pGlob->uBenchTolerancePct);
             }
 
             tstVDIoTestDestroy(&IoTest);
         }
         RTTestSubDone(pGlob->hTest);
+        RTMemFree(pBench);
     }
 
     return rc;
@@ -1422,6 +1641,137 @@ static DECLCALLBACK(int) vdScriptHandlerClose(PVDSCRIPTARG paScriptArgs, void *p
 }
 
 
+static DECLCALLBACK(bool) tstVDIoCacheCfgAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    NOREF(pvUser); NOREF(pszzValid);
+    return true;
+}
+
+static DECLCALLBACK(int) tstVDIoCacheCfgQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    PVDDISK pDisk = (PVDDISK)pvUser;
+
+    if (RTStrCmp(pszName, "WriteMode"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    *pcbValue = strlen(pDisk->szCacheWriteMode) + 1;
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) tstVDIoCacheCfgQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    PVDDISK pDisk = (PVDDISK)pvUser;
+
+    if (RTStrCmp(pszName, "WriteMode"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    return RTStrCopy(pszValue, cchValue, pDisk->szCacheWriteMode);
+}
+
+/**
+ * Sets up the interface list for a cache of the given disk, consisting of the
+ * per image interfaces and a config interface returning the write mode.
+ */
+static int tstVDIoCacheIfsSetup(PVDTESTGLOB pGlob, PVDDISK pDisk, const char *pcszWriteMode)
+{
+    if (   RTStrICmp(pcszWriteMode, "around")
+        && RTStrICmp(pcszWriteMode, "through"))
+    {
+        RTPrintf("Invalid cache write mode '%s' given\n", pcszWriteMode);
+        return VERR_INVALID_PARAMETER;
+    }
+
+    RTStrCopy(pDisk->szCacheWriteMode, sizeof(pDisk->szCacheWriteMode), pcszWriteMode);
+    pDisk->VDIfCfgCache.pfnAreKeysValid = tstVDIoCacheCfgAreKeysValid;
+    pDisk->VDIfCfgCache.pfnQuerySize    = tstVDIoCacheCfgQuerySize;
+    pDisk->VDIfCfgCache.pfnQuery        = tstVDIoCacheCfgQuery;
+    pDisk->VDIfCfgCache.pfnQueryBytes   = NULL;
+    pDisk->pInterfacesCache = pGlob->pInterfacesImages;
+    return VDInterfaceAdd(&pDisk->VDIfCfgCache.Core, "tstVDIo_VDICfgCache", VDINTERFACETYPE_CONFIG,
+                          pDisk, sizeof(VDINTERFACECONFIG), &pDisk->pInterfacesCache);
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCreateCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = NULL;
+    const char *pcszCache = NULL;
+    const char *pcszBackend = NULL;
+    const char *pcszWriteMode = NULL;
+    uint64_t cbSize = 0;
+    PVDDISK pDisk = NULL;
+
+    pcszDisk      = paScriptArgs[0].psz;
+    pcszCache     = paScriptArgs[1].psz;
+    cbSize        = paScriptArgs[2].u64;
+    pcszBackend   = paScriptArgs[3].psz;
+    pcszWriteMode = paScriptArgs[4].psz;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        rc = tstVDIoCacheIfsSetup(pGlob, pDisk, pcszWriteMode);
+        if (RT_SUCCESS(rc))
+            rc = VDCreateCache(pDisk->pVD, pcszBackend, pcszCache, cbSize, VD_IMAGE_FLAGS_NONE,
+                               NULL, NULL, VD_OPEN_FLAGS_ASYNC_IO, pDisk->pInterfacesCache, NULL);
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerOpenCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = NULL;
+    const char *pcszCache = NULL;
+    const char *pcszBackend = NULL;
+    const char *pcszWriteMode = NULL;
+    PVDDISK pDisk = NULL;
+
+    pcszDisk      = paScriptArgs[0].psz;
+    pcszCache     = paScriptArgs[1].psz;
+    pcszBackend   = paScriptArgs[2].psz;
+    pcszWriteMode = paScriptArgs[3].psz;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+    {
+        rc = tstVDIoCacheIfsSetup(pGlob, pDisk, pcszWriteMode);
+        if (RT_SUCCESS(rc))
+            rc = VDCacheOpen(pDisk->pVD, pcszBackend, pcszCache, VD_OPEN_FLAGS_ASYNC_IO,
+                             pDisk->pInterfacesCache);
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+static DECLCALLBACK(int) vdScriptHandlerCloseCache(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszDisk = NULL;
+    bool fDelete = false;
+    PVDDISK pDisk = NULL;
+
+    pcszDisk = paScriptArgs[0].psz;
+    fDelete  = paScriptArgs[1].f;
+
+    pDisk = tstVDIoGetDiskByName(pGlob, pcszDisk);
+    if (pDisk)
+        rc = VDCacheClose(pDisk->pVD, fDelete);
+    else
+        rc = VERR_NOT_FOUND;
+
+    return rc;
+}
+
+
 static DECLCALLBACK(int) vdScriptHandlerPrintFileSize(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -1807,6 +2157,60 @@ static DECLCALLBACK(int) vdScriptHandlerDumpFile(PVDSCRIPTARG paScriptArgs, void
     return rc;
 }
 
+/**
+ * Copies the current content of a file, even while an image is open. Reopening
+ * the copy later on gives the state an image would have after a host crash.
+ */
+static DECLCALLBACK(int) vdScriptHandlerCopyFile(PVDSCRIPTARG paScriptArgs, void *pvUser)
+{
+    int rc = VINF_SUCCESS;
+    PVDTESTGLOB pGlob = (PVDTESTGLOB)pvUser;
+    const char *pcszFile = NULL;
+    const char *pcszCopy = NULL;
+    PVDFILE pFile = NULL;
+
+    pcszFile = paScriptArgs[0].psz;
+    pcszCopy = paScriptArgs[1].psz;
+
+    /* The source must exist and the copy not. */
+    PVDFILE pIt = NULL;
+    RTListForEach(&pGlob->ListFiles, pIt, VDFILE, Node)
+    {
+        if (!RTStrCmp(pIt->pszName, pcszCopy))
+            return VERR_ALREADY_EXISTS;
+        if (!RTStrCmp(pIt->pszName, pcszFile))
+            pFile = pIt;
+    }
+
+    if (pFile)
+    {
+        PVDFILE pCopy = (PVDFILE)RTMemAllocZ(sizeof(VDFILE));
+        if (pCopy)
+        {
+            pCopy->pszName = RTStrDup(pcszCopy);
+            if (pCopy->pszName)
+            {
+                rc = VDIoBackendStorageCopy(pFile->pIoStorage, pcszCopy, &pCopy->pIoStorage);
+                if (RT_SUCCESS(rc))
+                    RTListAppend(&pGlob->ListFiles, &pCopy->Node);
+                else
+                    RTStrFree(pCopy->pszName);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+
+            if (RT_FAILURE(rc))
+                RTMemFree(pCopy);
+        }
+        else
+            rc = VERR_NO_MEMORY;
+    }
+    else
+        rc = VERR_FILE_NOT_FOUND;
+
+    return rc;
+}
+
 static DECLCALLBACK(int) vdScriptHandlerCreateDisk(PVDSCRIPTARG paScriptArgs, void *pvUser)
 {
     int rc = VINF_SUCCESS;
@@ -2480,6 +2884,25 @@ static bool tstVDIoTestReqOutstanding(PVDIOREQ pIoReq)
     return pIoReq->fOutstanding;
 }
 
+/**
+ * Records the latency of a completed request if benchmarking.
+ *
+ * @returns nothing.
+ * @param   pIoReq    The completed request.
+ */
+static void tstVDIoTestReqRecordLatency(PVDIOREQ pIoReq)
+{
+    if (pIoReq->pBench)
+    {
+        uint64_t cNs = RTTimeNanoTS() - pIoReq->tsStart;
+
+        if (pIoReq->enmTxDir == VDIOREQTXDIR_READ)
+            VDIoBenchHistAdd(&pIoReq->pBench->HistRead, cNs);
+        else if (pIoReq->enmTxDir == VDIOREQTXDIR_WRITE)
+            VDIoBenchHistAdd(&pIoReq->pBench->HistWrite, cNs);
+    }
+}
+
 /**
  * Returns true with the given chance in percent.
  *
@@ -2578,6 +3001,8 @@ static int tstVDIoTestReqInit(PVDIOTEST pIoTest, PVDIOREQ pIoReq, void *pvUser)
                 }
             }
             pIoReq->pvUser = pvUser;
+            pIoReq->pBench = pIoTest->pBench;
+            pIoReq->tsStart = RTTimeNanoTS();
             pIoReq->fOutstanding = true;
         }
     }
@@ -2594,6 +3019,7 @@ static DECLCALLBACK(void) tstVDIoTestReqComplete(void *pvUser1, void *pvUser2, i
     PVDDISK pDisk = (PVDDISK)pIoReq->pvUser;
 
     LogFlow(("Request %d completed\n", pIoReq->idx));
+    tstVDIoTestReqRecordLatency(pIoReq);
 
     if (pDisk->pMemDiskVerify)
     {
@@ -2737,6 +3163,13 @@ static int tstVDIoPatternGetBuffer(PVDPATTERN pPattern, void **ppv, size_t cb)
     return VINF_SUCCESS;
 }
 
+/** Benchmark report given with --json, NULL if none. */
+static PVDIOBENCHREPORT   g_pBenchReport       = NULL;
+/** Benchmark baseline given with --baseline, NULL if none. */
+static PVDIOBENCHBASELINE g_pBenchBaseline     = NULL;
+/** Allowed deviation from the baseline in percent. */
+static unsigned           g_uBenchTolerancePct = 10;
+
 /**
  * Executes the given script.
  *
@@ -2753,6 +3186,10 @@ static void tstVDIoScriptExec(const char *pszName, const char *pszScript)
     RTListInit(&GlobTest.ListFiles);
     RTListInit(&GlobTest.ListDisks);
     RTListInit(&GlobTest.ListPatterns);
+    GlobTest.pszScript          = pszName;
+    GlobTest.pBenchReport       = g_pBenchReport;
+    GlobTest.pBenchBaseline     = g_pBenchBaseline;
+    GlobTest.uBenchTolerancePct = g_uBenchTolerancePct;
     GlobTest.pszIoBackend = RTStrDup("memory");
     if (!GlobTest.pszIoBackend)
     {
@@ -2895,13 +3332,21 @@ static void tstVDIoRunBuiltinTests(void)
 static void printUsage(void)
 {
     RTPrintf("Usage:\n"
-             "--script <filename>    Script to execute\n");
+             "--script <filename>    Script to execute\n"
+             "--json <filename>      Write the results of iobench jobs to the given JSON report\n"
+             "--baseline <filename>  Compare iobench jobs against a previously written JSON report\n"
+             "--tolerance <percent>  Allowed regression against the baseline (default 10)\n"
+             "\n"
+             "--json, --baseline and --tolerance apply to the scripts given after them.\n");
 }
 
 static const RTGETOPTDEF g_aOptions[] =
 {
-    { "--script",   's', RTGETOPT_REQ_STRING },
-    { "--help",     'h', RTGETOPT_REQ_NOTHING }
+    { "--script",    's', RTGETOPT_REQ_STRING },
+    { "--json",      'j', RTGETOPT_REQ_STRING },
+    { "--baseline",  'b', RTGETOPT_REQ_STRING },
+    { "--tolerance", 't', RTGETOPT_REQ_UINT32 },
+    { "--help",      'h', RTGETOPT_REQ_NOTHING }
 };
 
 int main(int argc, char *argv[])
@@ -2933,6 +3378,25 @@ int main(int argc, char *argv[])
             case 's':
                 tstVDIoScriptRun(ValueUnion.psz);
                 break;
+            case 'j':
+                if (g_pBenchReport)
+                    VDIoBenchReportDestroy(g_pBenchReport);
+                g_pBenchReport = NULL;
+                rc = VDIoBenchReportCreate(&g_pBenchReport, ValueUnion.psz);
+                if (RT_FAILURE(rc))
+                    RTPrintf("Creating the benchmark report '%s' failed rc=%Rrc\n", ValueUnion.psz, rc);
+                break;
+            case 'b':
+                if (g_pBenchBaseline)
+                    VDIoBenchBaselineDestroy(g_pBenchBaseline);
+                g_pBenchBaseline = NULL;
+                rc = VDIoBenchBaselineLoad(&g_pBenchBaseline, ValueUnion.psz);
+                if (RT_FAILURE(rc))
+                    RTPrintf("Loading the benchmark baseline '%s' failed rc=%Rrc\n", ValueUnion.psz, rc);
+                break;
+            case 't':
+                g_uBenchTolerancePct = ValueUnion.u32;
+                break;
             case 'h':
                 printUsage();
                 break;
@@ -2941,6 +3405,11 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (g_pBenchReport)
+        VDIoBenchReportDestroy(g_pBenchReport);
+    if (g_pBenchBaseline)
+        VDIoBenchBaselineDestroy(g_pBenchBaseline);
+
     rc = VDShutdown();
     if (RT_FAILURE(rc))
         RTPrintf("tstVDIo: unloading backends failed! rc=%Rrc\n", rc);
@@ -59,6 +59,7 @@ static void printUsage(PRTSTREAM pStrm)
                  "                [--srcformat VDI|VMDK|VHD|RAW|..]\n"
                  "                [--dstformat VDI|VMDK|VHD|RAW|..]\n"
                  "                [--variant Standard,Fixed,Split2G,Stream,ESX]\n"
+                 "                [--compressionlevel store|fast|default|max]\n"
                  "\n"
                  "   info         --filename <filename>\n"
                  "\n"
@@ -822,6 +823,50 @@ static DECLCALLBACK(int) convOutFlush(void *pvUser, void *pStorage)
     return VINF_SUCCESS;
 }
 
+/**
+ * @interface_method_impl{VDINTERFACECONFIG,pfnAreKeysValid}
+ *
+ * Shared by the config interfaces below, each of which only answers the one
+ * key it was set up for, so there is nothing the backend could pass that we
+ * would have to reject.
+ */
+static DECLCALLBACK(bool) vdIfCfgAreKeysValid(void *pvUser, const char *pszzValid)
+{
+    NOREF(pvUser); NOREF(pszzValid);
+    return true;
+}
+
+static DECLCALLBACK(int) vdIfCfgConvertQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
+{
+    AssertReturn(VALID_PTR(pcbValue), VERR_INVALID_POINTER);
+
+    AssertPtrReturn(pvUser, VERR_GENERAL_FAILURE);
+
+    if (RTStrCmp(pszName, "CompressionLevel"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    *pcbValue = strlen((const char *)pvUser) + 1 /* include terminator */;
+
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) vdIfCfgConvertQuery(void *pvUser, const char *pszName, char *pszValue, size_t cchValue)
+{
+    AssertReturn(VALID_PTR(pszValue), VERR_INVALID_POINTER);
+
+    AssertPtrReturn(pvUser, VERR_GENERAL_FAILURE);
+
+    if (RTStrCmp(pszName, "CompressionLevel"))
+        return VERR_CFGM_VALUE_NOT_FOUND;
+
+    if (strlen((const char *)pvUser) >= cchValue)
+        return VERR_CFGM_NOT_ENOUGH_SPACE;
+
+    memcpy(pszValue, pvUser, strlen((const char *)pvUser) + 1);
+
+    return VINF_SUCCESS;
+}
+
 static int handleConvert(HandlerArg *a)
 {
     const char *pszSrcFilename = NULL;
@@ -832,6 +877,7 @@ static int handleConvert(HandlerArg *a)
     VDTYPE enmSrcType = VDTYPE_HDD;
     const char *pszDstFormat = NULL;
     const char *pszVariant = NULL;
+    const char *pszCompressionLevel = NULL;
     PVBOXHDD pSrcDisk = NULL;
     PVBOXHDD pDstDisk = NULL;
     unsigned uImageFlags = VD_IMAGE_FLAGS_NONE;
@@ -839,6 +885,7 @@ static int handleConvert(HandlerArg *a)
     PVDINTERFACE pIfsImageOutput = NULL;
     VDINTERFACEIO IfsInputIO;
     VDINTERFACEIO IfsOutputIO;
+    VDINTERFACECONFIG IfsOutputCfg;
     int rc = VINF_SUCCESS;
 
     /* Parse the command line. */
@@ -850,7 +897,8 @@ static int handleConvert(HandlerArg *a)
         { "--stdout", 'P', RTGETOPT_REQ_NOTHING },
         { "--srcformat", 's', RTGETOPT_REQ_STRING },
         { "--dstformat", 'd', RTGETOPT_REQ_STRING },
-        { "--variant", 'v', RTGETOPT_REQ_STRING }
+        { "--variant", 'v', RTGETOPT_REQ_STRING },
+        { "--compressionlevel", 'c', RTGETOPT_REQ_STRING }
     };
     int ch;
     RTGETOPTUNION ValueUnion;
@@ -881,6 +929,9 @@ static int handleConvert(HandlerArg *a)
             case 'v':   // --variant
                 pszVariant = ValueUnion.psz;
                 break;
+            case 'c':   // --compressionlevel
+                pszCompressionLevel = ValueUnion.psz;
+                break;
 
             default:
                 ch = RTGetOptPrintError(ch, &ValueUnion);
@@ -947,6 +998,15 @@ static int handleConvert(HandlerArg *a)
         VDInterfaceAdd(&IfsOutputIO.Core, "stdout", VDINTERFACETYPE_IO,
                        NULL, sizeof(VDINTERFACEIO), &pIfsImageOutput);
     }
+    if (pszCompressionLevel)
+    {
+        IfsOutputCfg.pfnAreKeysValid = vdIfCfgAreKeysValid;
+        IfsOutputCfg.pfnQuerySize    = vdIfCfgConvertQuerySize;
+        IfsOutputCfg.pfnQuery        = vdIfCfgConvertQuery;
+        IfsOutputCfg.pfnQueryBytes   = NULL;
+        VDInterfaceAdd(&IfsOutputCfg.Core, "Config", VDINTERFACETYPE_CONFIG,
+                       (void *)pszCompressionLevel, sizeof(VDINTERFACECONFIG), &pIfsImageOutput);
+    }
 
     /* check the variant parameter */
     if (pszVariant)
@@ -1435,11 +1495,6 @@ static int handleCreateCache(HandlerArg *a)
     return rc;
 }
 
-static DECLCALLBACK(bool) vdIfCfgCreateBaseAreKeysValid(void *pvUser, const char *pszzValid)
-{
-    return VINF_SUCCESS; /** @todo: Implement. */
-}
-
 static DECLCALLBACK(int) vdIfCfgCreateBaseQuerySize(void *pvUser, const char *pszName, size_t *pcbValue)
 {
     AssertReturn(VALID_PTR(pcbValue), VERR_INVALID_POINTER);
@@ -1550,7 +1605,7 @@ static int handleCreateBase(HandlerArg *a)
     /* Setup the config interface if required. */
     if (pszDataAlignment)
     {
-        vdIfCfg.pfnAreKeysValid = vdIfCfgCreateBaseAreKeysValid;
+        vdIfCfg.pfnAreKeysValid = vdIfCfgAreKeysValid;
         vdIfCfg.pfnQuerySize    = vdIfCfgCreateBaseQuerySize;
         vdIfCfg.pfnQuery        = vdIfCfgCreateBaseQuery;
         VDInterfaceAdd(&vdIfCfg.Core, "Config", VDINTERFACETYPE_CONFIG, (void *)pszDataAlignment,
@@ -949,6 +949,71 @@ DECLINLINE(void) iemInitDecoder(PIEMCPU pIemCpu, bool fBypassHandlers)
 }
 
 
+#ifdef IEM_WITH_CODE_TLB
+/**
+ * Translates a code address via the instruction fetch TLB, loading the entry
+ * on a miss.
+ *
+ * @returns VBox status code from PGMGstGetPage.
+ * @param   pIemCpu             The IEM state.
+ * @param   GCPtrCode           The linear code address.
+ * @param   pfFlags             Where to return the page table flags.
+ * @param   pGCPhysPage         Where to return the guest physical page address.
+ * @param   ppbPage             Where to return the ring-3 mapping of the page.
+ *                              NULL if the page isn't plain RAM and must be
+ *                              read thru PGMPhysRead.
+ */
+IEM_STATIC int iemCodeTlbLookup(PIEMCPU pIemCpu, RTGCPTR GCPtrCode, uint64_t *pfFlags, PRTGCPHYS pGCPhysPage,
+                                uint8_t const **ppbPage)
+{
+    uint64_t const   uTagNoRev = IEMCODETLB_CALC_TAG_NO_REV(GCPtrCode);
+    uint64_t const   uPhysRev  = ASMAtomicReadU64(&pIemCpu->CodeTlb.uPhysRev);
+    PIEMCODETLBENTRY pTlbe     = &pIemCpu->CodeTlb.aEntries[IEMCODETLB_TAG_TO_INDEX(uTagNoRev)];
+    if (   pTlbe->uTag     == (uTagNoRev | pIemCpu->CodeTlb.uRevision)
+        && pTlbe->uPhysRev == uPhysRev)
+    {
+        pIemCpu->CodeTlb.cHits++;
+        *pfFlags     = pTlbe->fFlags;
+        *pGCPhysPage = pTlbe->GCPhysPage;
+        *ppbPage     = pTlbe->pbMappingR3;
+        return VINF_SUCCESS;
+    }
+    pIemCpu->CodeTlb.cMisses++;
+
+    *ppbPage = NULL;
+    int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrCode, pfFlags, pGCPhysPage);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Only plain RAM without read handlers goes into the TLB.  A mapping made
+     * while bypassing handlers must not be used by later, ordinary fetches.
+     * The mapping lock is dropped right away, PGM bumps uPhysRev before the
+     * mapping can go away.
+     */
+    pTlbe->uTag = 0;
+    if (!pIemCpu->fBypassHandlers)
+    {
+        void          *pvPage;
+        PGMPAGEMAPLOCK Lock;
+        rc = PGMPhysIemGCPhys2Ptr(IEMCPU_TO_VM(pIemCpu), IEMCPU_TO_VMCPU(pIemCpu), *pGCPhysPage,
+                                  false /*fWritable*/, false /*fByPassHandlers*/, &pvPage, &Lock);
+        if (rc == VINF_SUCCESS)
+        {
+            PGMPhysReleasePageMappingLock(IEMCPU_TO_VM(pIemCpu), &Lock);
+            pTlbe->uTag        = uTagNoRev | pIemCpu->CodeTlb.uRevision;
+            pTlbe->uPhysRev    = uPhysRev;
+            pTlbe->GCPhysPage  = *pGCPhysPage;
+            pTlbe->pbMappingR3 = (uint8_t const *)((uintptr_t)pvPage & ~(uintptr_t)PAGE_OFFSET_MASK);
+            pTlbe->fFlags      = *pfFlags;
+            *ppbPage = pTlbe->pbMappingR3;
+        }
+    }
+    return VINF_SUCCESS;
+}
+#endif /* IEM_WITH_CODE_TLB */
+
+
 /**
  * Prefetch opcodes the first time when starting executing.
  *
@@ -1010,7 +1075,12 @@ IEM_STATIC VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PIEMCPU pIemCpu, bool f
 
     RTGCPHYS    GCPhys;
     uint64_t    fFlags;
+#ifdef IEM_WITH_CODE_TLB
+    uint8_t const *pbPage;
+    int rc = iemCodeTlbLookup(pIemCpu, GCPtrPC, &fFlags, &GCPhys, &pbPage);
+#else
     int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrPC, &fFlags, &GCPhys);
+#endif
     if (RT_FAILURE(rc))
     {
         Log(("iemInitDecoderAndPrefetchOpcodes: %RGv - rc=%Rrc\n", GCPtrPC, rc));
@@ -1072,6 +1142,11 @@ IEM_STATIC VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PIEMCPU pIemCpu, bool f
         if (cbToTryRead > sizeof(pIemCpu->abOpcode))
             cbToTryRead = sizeof(pIemCpu->abOpcode);
 
+#ifdef IEM_WITH_CODE_TLB
+        if (pbPage)
+            memcpy(pIemCpu->abOpcode, &pbPage[GCPhys & PAGE_OFFSET_MASK], cbToTryRead);
+        else
+#endif
         if (!pIemCpu->fBypassHandlers)
         {
             VBOXSTRICTRC rcStrict = PGMPhysRead(pVM, GCPhys, pIemCpu->abOpcode, cbToTryRead, PGMACCESSORIGIN_IEM);
@@ -1182,7 +1257,12 @@ IEM_STATIC VBOXSTRICTRC iemOpcodeFetchMoreBytes(PIEMCPU pIemCpu, size_t cbMin)
 
     RTGCPHYS    GCPhys;
     uint64_t    fFlags;
+#ifdef IEM_WITH_CODE_TLB
+    uint8_t const *pbPage;
+    int rc = iemCodeTlbLookup(pIemCpu, GCPtrNext, &fFlags, &GCPhys, &pbPage);
+#else
     int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrNext, &fFlags, &GCPhys);
+#endif
     if (RT_FAILURE(rc))
     {
         Log(("iemOpcodeFetchMoreBytes: %RGv - rc=%Rrc\n", GCPtrNext, rc));
@@ -1211,6 +1291,11 @@ IEM_STATIC VBOXSTRICTRC iemOpcodeFetchMoreBytes(PIEMCPU pIemCpu, size_t cbMin)
      * and since PATM should only patch the start of an instruction there
      * should be no need to check again here.
      */
+#ifdef IEM_WITH_CODE_TLB
+    if (pbPage)
+        memcpy(&pIemCpu->abOpcode[pIemCpu->cbOpcode], &pbPage[GCPhys & PAGE_OFFSET_MASK], cbToTryRead);
+    else
+#endif
     if (!pIemCpu->fBypassHandlers)
     {
         VBOXSTRICTRC rcStrict = PGMPhysRead(IEMCPU_TO_VM(pIemCpu), GCPhys, &pIemCpu->abOpcode[pIemCpu->cbOpcode],
@@ -11651,6 +11736,73 @@ VMM_INT_DECL(int) IEMBreakpointClear(PVM pVM, RTGCPTR GCPtrBp)
 }
 
 
+/**
+ * Invalidates the instruction fetch TLB of a CPU.
+ *
+ * Called by PGM on guest TLB flushes and paging mode changes, and by EM after
+ * other execution engines have run the guest.
+ *
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @thread  EMT(pVCpu)
+ */
+VMM_INT_DECL(void) IEMTlbInvalidateAll(PVMCPU pVCpu)
+{
+#ifdef IEM_WITH_CODE_TLB
+    PIEMCPU pIemCpu = &pVCpu->iem.s;
+    pIemCpu->CodeTlb.uRevision += IEMCODETLB_REVISION_INCR;
+    if (RT_UNLIKELY(pIemCpu->CodeTlb.uRevision == 0))
+    {
+        /* Wrapped: zero all the tags so no stale entry can match. */
+        pIemCpu->CodeTlb.uRevision = IEMCODETLB_REVISION_INCR;
+        for (unsigned i = 0; i < RT_ELEMENTS(pIemCpu->CodeTlb.aEntries); i++)
+            pIemCpu->CodeTlb.aEntries[i].uTag = 0;
+    }
+#else
+    NOREF(pVCpu);
+#endif
+}
+
+
+/**
+ * Invalidates a page in the instruction fetch TLB of a CPU.
+ *
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   GCPtr       The linear address of the page.
+ * @thread  EMT(pVCpu)
+ */
+VMM_INT_DECL(void) IEMTlbInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtr)
+{
+#ifdef IEM_WITH_CODE_TLB
+    PIEMCPU        pIemCpu   = &pVCpu->iem.s;
+    uint64_t const uTagNoRev = IEMCODETLB_CALC_TAG_NO_REV(GCPtr);
+    uintptr_t const idx      = IEMCODETLB_TAG_TO_INDEX(uTagNoRev);
+    if (pIemCpu->CodeTlb.aEntries[idx].uTag == (uTagNoRev | pIemCpu->CodeTlb.uRevision))
+        pIemCpu->CodeTlb.aEntries[idx].uTag = 0;
+#else
+    NOREF(pVCpu); NOREF(GCPtr);
+#endif
+}
+
+
+/**
+ * Invalidates the host page mappings in the instruction fetch TLBs of all
+ * CPUs.
+ *
+ * Called by PGM whenever the backing of a guest physical page changes or a
+ * page gains an access handler.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @thread  Any
+ */
+VMM_INT_DECL(void) IEMTlbInvalidateAllPhysical(PVM pVM)
+{
+    /* The TLB is only used in ring-3, but the backing may be changed in any
+       context (e.g. zero page replacement in ring-0). */
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+        ASMAtomicIncU64(&pVM->aCpus[idCpu].iem.s.CodeTlb.uPhysRev);
+}
+
+
 #if 0 /* The IRET-to-v8086 mode in PATM is very optimistic, so I don't dare do this yet. */
 /**
  * Executes a IRET instruction with default operand size.
@@ -60,6 +60,147 @@ VMMDECL(bool) IOMIsLockWriteOwner(PVM pVM)
 //#undef LOG_GROUP
 //#define LOG_GROUP LOG_GROUP_IOM_IOPORT
 
+/**
+ * Looks up the I/O port handler for the current context in the range trees.
+ *
+ * This is the fallback for iomIOPortLookup when the port map is being updated
+ * or could not hold all the ranges.
+ *
+ * @returns VINF_SUCCESS and @a pEntry if a range was found.
+ * @returns VERR_NOT_FOUND if no range covers the port.
+ * @returns VINF_IOM_R3_IOPORT_READ or VINF_IOM_R3_IOPORT_WRITE if the port is
+ *          only handled in ring-3 or the lock is busy. (R0/RC only)
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   Port        The I/O port to lookup.
+ * @param   fWrite      Whether this is for a write.
+ * @param   pEntry      Where to return the handler.
+ */
+static int iomIOPortLookupLocked(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, bool fWrite, CTX_SUFF(PIOMIOPORTENTRY) pEntry)
+{
+    int rc = IOM_LOCK_SHARED(pVM);
+#ifndef IN_RING3
+    if (rc == VERR_SEM_BUSY)
+        return fWrite ? VINF_IOM_R3_IOPORT_WRITE : VINF_IOM_R3_IOPORT_READ;
+#endif
+    AssertRC(rc);
+
+    CTX_SUFF(PIOMIOPORTRANGE) pRange = fWrite ? pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) : pVCpu->iom.s.CTX_SUFF(pRangeLastRead);
+    if (    !pRange
+        ||   (unsigned)Port - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
+    {
+        pRange = iomIOPortGetRange(pVM, Port);
+        if (pRange)
+        {
+            if (fWrite)
+                pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) = pRange;
+            else
+                pVCpu->iom.s.CTX_SUFF(pRangeLastRead)  = pRange;
+        }
+    }
+    MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
+    if (pRange)
+    {
+        pEntry->pvUser            = pRange->pvUser;
+        pEntry->pDevIns           = pRange->pDevIns;
+        pEntry->pfnOutCallback    = pRange->pfnOutCallback;
+        pEntry->pfnInCallback     = pRange->pfnInCallback;
+        pEntry->pfnOutStrCallback = pRange->pfnOutStrCallback;
+        pEntry->pfnInStrCallback  = pRange->pfnInStrCallback;
+#ifdef IN_RING3
+        pEntry->fFlags            = pRange->fFlags;
+#else
+        PIOMIOPORTRANGER3 pRangeR3 = iomIOPortGetRangeR3(pVM, Port);
+        pEntry->fFlags            = pRangeR3 ? pRangeR3->fFlags : 0;
+#endif
+        rc = VINF_SUCCESS;
+    }
+#ifndef IN_RING3
+    else if (iomIOPortGetRangeR3(pVM, Port))
+        rc = fWrite ? VINF_IOM_R3_IOPORT_WRITE : VINF_IOM_R3_IOPORT_READ;
+#endif
+    else
+        rc = VERR_NOT_FOUND;
+
+    IOM_UNLOCK_SHARED(pVM);
+    return rc;
+}
+
+
+/**
+ * Looks up the I/O port handler for the current context.
+ *
+ * The direct port map is consulted without taking the IOM lock, the lock is
+ * only taken when the map is being updated or could not hold all the ranges.
+ *
+ * @returns VINF_SUCCESS and @a pEntry if a range was found.
+ * @returns VERR_NOT_FOUND if no range covers the port.
+ * @returns VINF_IOM_R3_IOPORT_READ or VINF_IOM_R3_IOPORT_WRITE if the port is
+ *          only handled in ring-3 or the lock is busy. (R0/RC only)
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   Port        The I/O port to lookup.
+ * @param   fWrite      Whether this is for a write.
+ * @param   pEntry      Where to return the handler.
+ */
+DECLINLINE(int) iomIOPortLookup(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, bool fWrite, CTX_SUFF(PIOMIOPORTENTRY) pEntry)
+{
+    PIOMIOPORTMAP  pMap = pVM->iom.s.CTX_SUFF(pIOPortMap);
+    uint32_t const uSeq = ASMAtomicReadU32(&pMap->uSeq);
+    if (   !(uSeq & 1)
+        && pMap->cSlots != UINT32_MAX)
+    {
+        unsigned const iSlot = pMap->aiSlots[Port];
+        *pEntry = pMap->aSlots[iSlot].CTX_SUFF(Entry);
+        ASMCompilerBarrier();
+        if (ASMAtomicReadU32(&pMap->uSeq) == uSeq)
+        {
+            if (pEntry->pDevIns)
+                return VINF_SUCCESS;
+            if (!iSlot)
+                return VERR_NOT_FOUND;
+#ifndef IN_RING3
+            return fWrite ? VINF_IOM_R3_IOPORT_WRITE : VINF_IOM_R3_IOPORT_READ;
+#endif
+        }
+    }
+    return iomIOPortLookupLocked(pVM, pVCpu, Port, fWrite, pEntry);
+}
+
+
+/**
+ * Enters the device critical section before calling the I/O port callbacks.
+ *
+ * @returns VINF_SUCCESS or rcBusy.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pEntry      The I/O port handler.
+ * @param   rcBusy      The status to return if the critical section is busy.
+ */
+DECLINLINE(int) iomIOPortEnterDevLock(PVM pVM, CTX_SUFF(PIOMIOPORTENTRY) pEntry, int rcBusy)
+{
+    if (!(pEntry->fFlags & IOMIOPORT_FLAGS_NO_DEV_LOCK))
+        return PDMCritSectEnter(pEntry->pDevIns->CTX_SUFF(pCritSectRo), rcBusy);
+    STAM_COUNTER_INC(&pVM->iom.s.StatIOPortNoDevLock);
+    NOREF(pVM);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Leaves the device critical section entered by iomIOPortEnterDevLock.
+ *
+ * @param   pEntry      The I/O port handler.
+ */
+DECLINLINE(void) iomIOPortLeaveDevLock(CTX_SUFF(PIOMIOPORTENTRY) pEntry)
+{
+    if (!(pEntry->fFlags & IOMIOPORT_FLAGS_NO_DEV_LOCK))
+        PDMCritSectLeave(pEntry->pDevIns->CTX_SUFF(pCritSectRo));
+}
+
+
 /**
  * Reads an I/O port register.
  *
@@ -82,13 +223,6 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
 
 /** @todo should initialize *pu32Value here because it can happen that some
  *        handle is buggy and doesn't handle all cases. */
-    /* Take the IOM lock before performing any device I/O. */
-    int rc2 = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc2 == VERR_SEM_BUSY)
-        return VINF_IOM_R3_IOPORT_READ;
-#endif
-    AssertRC(rc2);
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyIOPortRead(pVM, Port, cbValue);
 #endif
@@ -97,51 +231,36 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
     /*
      * Get the statistics record.
      */
-    PIOMIOPORTSTATS  pStats = pVCpu->iom.s.CTX_SUFF(pStatsLastRead);
-    if (!pStats || pStats->Core.Key != Port)
-    {
-        pStats = (PIOMIOPORTSTATS)RTAvloIOPortGet(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortStatTree, Port);
-        if (pStats)
-            pVCpu->iom.s.CTX_SUFF(pStatsLastRead) = pStats;
-    }
+    PIOMIOPORTSTATS  pStats = iomIOPortGetStats(pVM, pVCpu, Port, false /*fWrite*/);
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastRead);
-    if (    !pRange
-        ||   (unsigned)Port - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, Port);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastRead) = pRange;
-    }
-    MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
-    if (pRange)
+    CTX_SUFF(IOMIOPORTENTRY) Entry;
+    int rc2 = iomIOPortLookup(pVM, pVCpu, Port, false /*fWrite*/, &Entry);
+    if (rc2 == VINF_SUCCESS)
     {
         /*
-         * Found a range, get the data in case we leave the IOM lock.
+         * Found a range.
          */
-        PFNIOMIOPORTIN  pfnInCallback = pRange->pfnInCallback;
+        PFNIOMIOPORTIN  pfnInCallback = Entry.pfnInCallback;
 #ifndef IN_RING3
         if (pfnInCallback)
         { /* likely */ }
         else
         {
             STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->InRZToR3); });
-            IOM_UNLOCK_SHARED(pVM);
             return VINF_IOM_R3_IOPORT_READ;
         }
 #endif
-        void           *pvUser    = pRange->pvUser;
-        PPDMDEVINS      pDevIns   = pRange->pDevIns;
-        IOM_UNLOCK_SHARED(pVM);
+        void           *pvUser    = Entry.pvUser;
+        PPDMDEVINS      pDevIns   = Entry.pDevIns;
 
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_READ);
+        VBOXSTRICTRC rcStrict = iomIOPortEnterDevLock(pVM, &Entry, VINF_IOM_R3_IOPORT_READ);
         if (rcStrict == VINF_SUCCESS)
         { /* likely */ }
         else
@@ -159,7 +278,7 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
         else
 #endif
             rcStrict = pfnInCallback(pDevIns, pvUser, Port, pu32Value, (unsigned)cbValue);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomIOPortLeaveDevLock(&Entry);
 
 #ifdef VBOX_WITH_STATISTICS
         if (rcStrict == VINF_SUCCESS && pStats)
@@ -191,17 +310,16 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
     /*
      * Handler in ring-3?
      */
-    PIOMIOPORTRANGER3 pRangeR3 = iomIOPortGetRangeR3(pVM, Port);
-    if (pRangeR3)
+    if (rc2 == VINF_IOM_R3_IOPORT_READ)
     {
 # ifdef VBOX_WITH_STATISTICS
         if (pStats)
             STAM_COUNTER_INC(&pStats->InRZToR3);
 # endif
-        IOM_UNLOCK_SHARED(pVM);
         return VINF_IOM_R3_IOPORT_READ;
     }
 #endif
+    Assert(rc2 == VERR_NOT_FOUND);
 
     /*
      * Ok, no handler for this port.
@@ -219,11 +337,9 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortRead(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint32
         case 4: *(uint32_t *)pu32Value = UINT32_C(0xffffffff); break;
         default:
             AssertMsgFailed(("Invalid I/O port size %d. Port=%d\n", cbValue, Port));
-            IOM_UNLOCK_SHARED(pVM);
             return VERR_IOM_INVALID_IOPORT_SIZE;
     }
     Log3(("IOMIOPortRead: Port=%RTiop *pu32=%08RX32 cb=%d rc=VINF_SUCCESS\n", Port, *pu32Value, cbValue));
-    IOM_UNLOCK_SHARED(pVM);
     return VINF_SUCCESS;
 }
 
@@ -251,13 +367,6 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
 {
     Assert(pVCpu->iom.s.PendingIOPortWrite.cbValue == 0);
 
-    /* Take the IOM lock before performing any device I/O. */
-    int rc2 = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc2 == VERR_SEM_BUSY)
-        return VINF_IOM_R3_IOPORT_READ;
-#endif
-    AssertRC(rc2);
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyIOPortReadString(pVM, uPort, pvDst, *pcTransfers, cb);
 #endif
@@ -269,52 +378,37 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
     /*
      * Get the statistics record.
      */
-    PIOMIOPORTSTATS pStats = pVCpu->iom.s.CTX_SUFF(pStatsLastRead);
-    if (!pStats || pStats->Core.Key != uPort)
-    {
-        pStats = (PIOMIOPORTSTATS)RTAvloIOPortGet(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortStatTree, uPort);
-        if (pStats)
-            pVCpu->iom.s.CTX_SUFF(pStatsLastRead) = pStats;
-    }
+    PIOMIOPORTSTATS pStats = iomIOPortGetStats(pVM, pVCpu, uPort, false /*fWrite*/);
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastRead);
-    if (    !pRange
-        ||   (unsigned)uPort - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, uPort);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastRead) = pRange;
-    }
-    MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
-    if (pRange)
+    CTX_SUFF(IOMIOPORTENTRY) Entry;
+    int rc2 = iomIOPortLookup(pVM, pVCpu, uPort, false /*fWrite*/, &Entry);
+    if (rc2 == VINF_SUCCESS)
     {
         /*
          * Found a range.
          */
-        PFNIOMIOPORTINSTRING pfnInStrCallback = pRange->pfnInStrCallback;
-        PFNIOMIOPORTIN       pfnInCallback    = pRange->pfnInCallback;
+        PFNIOMIOPORTINSTRING pfnInStrCallback = Entry.pfnInStrCallback;
+        PFNIOMIOPORTIN       pfnInCallback    = Entry.pfnInCallback;
 #ifndef IN_RING3
         if (pfnInStrCallback || pfnInCallback)
         { /* likely */ }
         else
         {
             STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->InRZToR3); });
-            IOM_UNLOCK_SHARED(pVM);
             return VINF_IOM_R3_IOPORT_READ;
         }
 #endif
-        void           *pvUser    = pRange->pvUser;
-        PPDMDEVINS      pDevIns   = pRange->pDevIns;
-        IOM_UNLOCK_SHARED(pVM);
+        void           *pvUser    = Entry.pvUser;
+        PPDMDEVINS      pDevIns   = Entry.pDevIns;
 
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_READ);
+        VBOXSTRICTRC rcStrict = iomIOPortEnterDevLock(pVM, &Entry, VINF_IOM_R3_IOPORT_READ);
         if (rcStrict == VINF_SUCCESS)
         { /* likely */ }
         else
@@ -379,7 +473,7 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
             } while (   *pcTransfers > 0
                      && rcStrict == VINF_SUCCESS);
         }
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomIOPortLeaveDevLock(&Entry);
 
 #ifdef VBOX_WITH_STATISTICS
         if (rcStrict == VINF_SUCCESS && pStats)
@@ -398,17 +492,16 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
     /*
      * Handler in ring-3?
      */
-    PIOMIOPORTRANGER3 pRangeR3 = iomIOPortGetRangeR3(pVM, uPort);
-    if (pRangeR3)
+    if (rc2 == VINF_IOM_R3_IOPORT_READ)
     {
 # ifdef VBOX_WITH_STATISTICS
         if (pStats)
             STAM_COUNTER_INC(&pStats->InRZToR3);
 # endif
-        IOM_UNLOCK_SHARED(pVM);
         return VINF_IOM_R3_IOPORT_READ;
     }
 #endif
+    Assert(rc2 == VERR_NOT_FOUND);
 
     /*
      * Ok, no handler for this port.
@@ -421,7 +514,6 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortReadString(PVM pVM, PVMCPU pVCpu, RTIOPORT u
 #endif
     Log3(("IOMIOPortReadStr: uPort=%RTiop (unused) pvDst=%p pcTransfer=%p:{%#x->%#x} cb=%d rc=VINF_SUCCESS\n",
           uPort, pvDst, pcTransfers, cRequestedTransfers, *pcTransfers, cb));
-    IOM_UNLOCK_SHARED(pVM);
     return VINF_SUCCESS;
 }
 
@@ -471,13 +563,6 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
     Assert(pVCpu->iom.s.PendingIOPortWrite.cbValue == 0);
 #endif
 
-    /* Take the IOM lock before performing any device I/O. */
-    int rc2 = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc2 == VERR_SEM_BUSY)
-        return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
-#endif
-    AssertRC(rc2);
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyIOPortWrite(pVM, Port, u32Value, cbValue);
 #endif
@@ -488,51 +573,36 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
     /*
      * Find the statistics record.
      */
-    PIOMIOPORTSTATS pStats = pVCpu->iom.s.CTX_SUFF(pStatsLastWrite);
-    if (!pStats || pStats->Core.Key != Port)
-    {
-        pStats = (PIOMIOPORTSTATS)RTAvloIOPortGet(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortStatTree, Port);
-        if (pStats)
-            pVCpu->iom.s.CTX_SUFF(pStatsLastWrite) = pStats;
-    }
+    PIOMIOPORTSTATS pStats = iomIOPortGetStats(pVM, pVCpu, Port, true /*fWrite*/);
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastWrite);
-    if (    !pRange
-        ||   (unsigned)Port - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, Port);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) = pRange;
-    }
-    MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
-    if (pRange)
+    CTX_SUFF(IOMIOPORTENTRY) Entry;
+    int rc2 = iomIOPortLookup(pVM, pVCpu, Port, true /*fWrite*/, &Entry);
+    if (rc2 == VINF_SUCCESS)
     {
         /*
          * Found a range.
          */
-        PFNIOMIOPORTOUT pfnOutCallback = pRange->pfnOutCallback;
+        PFNIOMIOPORTOUT pfnOutCallback = Entry.pfnOutCallback;
 #ifndef IN_RING3
         if (pfnOutCallback)
         { /* likely */ }
         else
         {
             STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->OutRZToR3); });
-            IOM_UNLOCK_SHARED(pVM);
             return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
         }
 #endif
-        void           *pvUser    = pRange->pvUser;
-        PPDMDEVINS      pDevIns   = pRange->pDevIns;
-        IOM_UNLOCK_SHARED(pVM);
+        void           *pvUser    = Entry.pvUser;
+        PPDMDEVINS      pDevIns   = Entry.pDevIns;
 
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_WRITE);
+        VBOXSTRICTRC rcStrict = iomIOPortEnterDevLock(pVM, &Entry, VINF_IOM_R3_IOPORT_WRITE);
         if (rcStrict == VINF_SUCCESS)
         { /* likely */ }
         else
@@ -554,7 +624,7 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
         else
 #endif
             rcStrict = pfnOutCallback(pDevIns, pvUser, Port, u32Value, (unsigned)cbValue);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomIOPortLeaveDevLock(&Entry);
 
 #ifdef VBOX_WITH_STATISTICS
         if (rcStrict == VINF_SUCCESS && pStats)
@@ -576,17 +646,16 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
     /*
      * Handler in ring-3?
      */
-    PIOMIOPORTRANGER3 pRangeR3 = iomIOPortGetRangeR3(pVM, Port);
-    if (pRangeR3)
+    if (rc2 == VINF_IOM_R3_IOPORT_WRITE)
     {
 # ifdef VBOX_WITH_STATISTICS
         if (pStats)
             STAM_COUNTER_INC(&pStats->OutRZToR3);
 # endif
-        IOM_UNLOCK_SHARED(pVM);
         return iomIOPortRing3WritePending(pVCpu, Port, u32Value, cbValue);
     }
 #endif
+    Assert(rc2 == VERR_NOT_FOUND);
 
     /*
      * Ok, no handler for that port.
@@ -597,7 +666,6 @@ VMMDECL(VBOXSTRICTRC) IOMIOPortWrite(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, uint3
         STAM_COUNTER_INC(&pStats->CTX_SUFF_Z(Out));
 #endif
     Log3(("IOMIOPortWrite: Port=%RTiop u32=%08RX32 cb=%d nop\n", Port, u32Value, cbValue));
-    IOM_UNLOCK_SHARED(pVM);
     return VINF_SUCCESS;
 }
 
@@ -627,13 +695,6 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
     Assert(pVCpu->iom.s.PendingIOPortWrite.cbValue == 0);
     Assert(cb == 1 || cb == 2 || cb == 4);
 
-    /* Take the IOM lock before performing any device I/O. */
-    int rc2 = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc2 == VERR_SEM_BUSY)
-        return VINF_IOM_R3_IOPORT_WRITE;
-#endif
-    AssertRC(rc2);
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyIOPortWriteString(pVM, uPort, pvSrc, *pcTransfers, cb);
 #endif
@@ -645,52 +706,37 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
     /*
      * Get the statistics record.
      */
-    PIOMIOPORTSTATS     pStats = pVCpu->iom.s.CTX_SUFF(pStatsLastWrite);
-    if (!pStats || pStats->Core.Key != uPort)
-    {
-        pStats = (PIOMIOPORTSTATS)RTAvloIOPortGet(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortStatTree, uPort);
-        if (pStats)
-            pVCpu->iom.s.CTX_SUFF(pStatsLastWrite) = pStats;
-    }
+    PIOMIOPORTSTATS     pStats = iomIOPortGetStats(pVM, pVCpu, uPort, true /*fWrite*/);
 #endif
 
     /*
      * Get handler for current context.
      */
-    CTX_SUFF(PIOMIOPORTRANGE) pRange = pVCpu->iom.s.CTX_SUFF(pRangeLastWrite);
-    if (    !pRange
-        ||   (unsigned)uPort - (unsigned)pRange->Port >= (unsigned)pRange->cPorts)
-    {
-        pRange = iomIOPortGetRange(pVM, uPort);
-        if (pRange)
-            pVCpu->iom.s.CTX_SUFF(pRangeLastWrite) = pRange;
-    }
-    MMHYPER_RC_ASSERT_RCPTR(pVM, pRange);
-    if (pRange)
+    CTX_SUFF(IOMIOPORTENTRY) Entry;
+    int rc2 = iomIOPortLookup(pVM, pVCpu, uPort, true /*fWrite*/, &Entry);
+    if (rc2 == VINF_SUCCESS)
     {
         /*
          * Found a range.
          */
-        PFNIOMIOPORTOUTSTRING   pfnOutStrCallback = pRange->pfnOutStrCallback;
-        PFNIOMIOPORTOUT         pfnOutCallback    = pRange->pfnOutCallback;
+        PFNIOMIOPORTOUTSTRING   pfnOutStrCallback = Entry.pfnOutStrCallback;
+        PFNIOMIOPORTOUT         pfnOutCallback    = Entry.pfnOutCallback;
 #ifndef IN_RING3
         if (pfnOutStrCallback || pfnOutCallback)
         { /* likely */ }
         else
         {
             STAM_STATS({ if (pStats) STAM_COUNTER_INC(&pStats->OutRZToR3); });
-            IOM_UNLOCK_SHARED(pVM);
             return VINF_IOM_R3_IOPORT_WRITE;
         }
 #endif
-        void           *pvUser    = pRange->pvUser;
-        PPDMDEVINS      pDevIns   = pRange->pDevIns;
-        IOM_UNLOCK_SHARED(pVM);
+        void           *pvUser    = Entry.pvUser;
+        PPDMDEVINS      pDevIns   = Entry.pDevIns;
 
         /*
          * Call the device.
          */
-        VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_IOPORT_WRITE);
+        VBOXSTRICTRC rcStrict = iomIOPortEnterDevLock(pVM, &Entry, VINF_IOM_R3_IOPORT_WRITE);
         if (rcStrict == VINF_SUCCESS)
         { /* likely */ }
         else
@@ -749,7 +795,7 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
                      && rcStrict == VINF_SUCCESS);
         }
 
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomIOPortLeaveDevLock(&Entry);
 
 #ifdef VBOX_WITH_STATISTICS
         if (rcStrict == VINF_SUCCESS && pStats)
@@ -768,17 +814,16 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
     /*
      * Handler in ring-3?
      */
-    PIOMIOPORTRANGER3 pRangeR3 = iomIOPortGetRangeR3(pVM, uPort);
-    if (pRangeR3)
+    if (rc2 == VINF_IOM_R3_IOPORT_WRITE)
     {
 # ifdef VBOX_WITH_STATISTICS
         if (pStats)
             STAM_COUNTER_INC(&pStats->OutRZToR3);
 # endif
-        IOM_UNLOCK_SHARED(pVM);
         return VINF_IOM_R3_IOPORT_WRITE;
     }
 #endif
+    Assert(rc2 == VERR_NOT_FOUND);
 
     /*
      * Ok, no handler for this port.
@@ -790,7 +835,6 @@ VMM_INT_DECL(VBOXSTRICTRC) IOMIOPortWriteString(PVM pVM, PVMCPU pVCpu, RTIOPORT
 #endif
     Log3(("IOMIOPortWriteStr: uPort=%RTiop (unused) pvSrc=%p pcTransfer=%p:{%#x->%#x} cb=%d rc=VINF_SUCCESS\n",
           uPort, pvSrc, pcTransfers, cRequestedTransfers, *pcTransfers, cb));
-    IOM_UNLOCK_SHARED(pVM);
     return VINF_SUCCESS;
 }
 
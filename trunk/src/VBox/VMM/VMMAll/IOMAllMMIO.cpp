@@ -47,6 +47,39 @@
 
 
 
+/**
+ * Enters the device critical section before calling the MMIO range callbacks.
+ *
+ * @returns VINF_SUCCESS or rcBusy.
+ *
+ * @param   pVM     The cross context VM structure.
+ * @param   pRange  The MMIO range.
+ * @param   pDevIns The device instance owning the range.
+ * @param   rcBusy  The status to return if the critical section is busy.
+ */
+DECLINLINE(int) iomMmioEnterDevLock(PVM pVM, PIOMMMIORANGE pRange, PPDMDEVINS pDevIns, int rcBusy)
+{
+    if (!(pRange->fFlags & IOMMMIO_FLAGS_NO_DEV_LOCK))
+        return PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), rcBusy);
+    STAM_COUNTER_INC(&pVM->iom.s.StatMMIONoDevLock);
+    NOREF(pVM);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Leaves the device critical section entered by iomMmioEnterDevLock.
+ *
+ * @param   pRange  The MMIO range.
+ * @param   pDevIns The device instance owning the range.
+ */
+DECLINLINE(void) iomMmioLeaveDevLock(PIOMMMIORANGE pRange, PPDMDEVINS pDevIns)
+{
+    if (!(pRange->fFlags & IOMMMIO_FLAGS_NO_DEV_LOCK))
+        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+}
+
+
 #ifndef IN_RING3
 /**
  * Defers a pending MMIO write to ring-3.
@@ -596,27 +629,27 @@ DECLINLINE(void) iomMMIOStatLength(PVM pVM, unsigned cb)
 static VBOXSTRICTRC iomMmioCommonPfHandler(PVM pVM, PVMCPU pVCpu, uint32_t uErrorCode, PCPUMCTXCORE pCtxCore,
                                            RTGCPHYS GCPhysFault, void *pvUser)
 {
-    int rc = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc == VERR_SEM_BUSY)
-        return VINF_IOM_R3_MMIO_READ_WRITE;
-#endif
-    AssertRC(rc);
-
     STAM_PROFILE_START(&pVM->iom.s.StatRZMMIOHandler, a);
     Log(("iomMmioCommonPfHandler: GCPhys=%RGp uErr=%#x rip=%RGv\n", GCPhysFault, uErrorCode, (RTGCPTR)pCtxCore->rip));
 
     PIOMMMIORANGE pRange = (PIOMMMIORANGE)pvUser;
     Assert(pRange);
-    Assert(pRange == iomMmioGetRange(pVM, pVCpu, GCPhysFault));
-    iomMmioRetainRange(pRange);
-#ifndef VBOX_WITH_STATISTICS
-    IOM_UNLOCK_SHARED(pVM);
+    iomMmioRetainHandlerRange(pVM, pVCpu, pRange);
+    int rc;
 
-#else
+#ifdef VBOX_WITH_STATISTICS
     /*
      * Locate the statistics.
      */
+    rc = IOM_LOCK_SHARED(pVM);
+# ifndef IN_RING3
+    if (rc == VERR_SEM_BUSY)
+    {
+        iomMmioReleaseRange(pVM, pRange);
+        return VINF_IOM_R3_MMIO_READ_WRITE;
+    }
+# endif
+    AssertRC(rc);
     PIOMMMIOSTATS pStats = iomMmioGetStats(pVM, pVCpu, GCPhysFault, pRange);
     if (!pStats)
     {
@@ -663,7 +696,7 @@ static VBOXSTRICTRC iomMmioCommonPfHandler(PVM pVM, PVMCPU pVCpu, uint32_t uErro
      * Retain the range and do locking.
      */
     PPDMDEVINS pDevIns = pRange->CTX_SUFF(pDevIns);
-    rc = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_MMIO_READ_WRITE);
+    rc = iomMmioEnterDevLock(pVM, pRange, pDevIns, VINF_IOM_R3_MMIO_READ_WRITE);
     if (rc != VINF_SUCCESS)
     {
         iomMmioReleaseRange(pVM, pRange);
@@ -677,7 +710,7 @@ static VBOXSTRICTRC iomMmioCommonPfHandler(PVM pVM, PVMCPU pVCpu, uint32_t uErro
 
     NOREF(pCtxCore); NOREF(GCPhysFault);
     STAM_PROFILE_STOP(&pVM->iom.s.StatRZMMIOHandler, a);
-    PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+    iomMmioLeaveDevLock(pRange, pDevIns);
     iomMmioReleaseRange(pVM, pRange);
     if (RT_SUCCESS(rcStrict))
         return rcStrict;
@@ -721,19 +754,9 @@ VMMDECL(VBOXSTRICTRC) IOMMMIOPhysHandler(PVM pVM, PVMCPU pVCpu, RTGCUINT uErrorC
     /*
      * We don't have a range here, so look it up before calling the common function.
      */
-    int rc2 = IOM_LOCK_SHARED(pVM); NOREF(rc2);
-#ifndef IN_RING3
-    if (rc2 == VERR_SEM_BUSY)
-        return VINF_IOM_R3_MMIO_READ_WRITE;
-#endif
-    PIOMMMIORANGE pRange = iomMmioGetRange(pVM, pVCpu, GCPhysFault);
+    PIOMMMIORANGE pRange = iomMmioGetRangeWithRef(pVM, pVCpu, GCPhysFault);
     if (RT_UNLIKELY(!pRange))
-    {
-        IOM_UNLOCK_SHARED(pVM);
         return VERR_IOM_MMIO_RANGE_NOT_FOUND;
-    }
-    iomMmioRetainRange(pRange);
-    IOM_UNLOCK_SHARED(pVM);
 
     VBOXSTRICTRC rcStrict = iomMmioCommonPfHandler(pVM, pVCpu, (uint32_t)uErrorCode, pCtxCore, GCPhysFault, pRange);
 
@@ -768,29 +791,12 @@ PGM_ALL_CB2_DECL(VBOXSTRICTRC) iomMmioHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GC
         return enmAccessType == PGMACCESSTYPE_WRITE ? VINF_IOM_R3_MMIO_WRITE : VINF_IOM_R3_MMIO_READ;
 #endif
 
-    /*
-     * Validate the range.
-     */
-    int rc = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc == VERR_SEM_BUSY)
-    {
-        if (enmAccessType == PGMACCESSTYPE_READ)
-            return VINF_IOM_R3_MMIO_READ;
-        Assert(enmAccessType == PGMACCESSTYPE_WRITE);
-        return iomMmioRing3WritePending(pVCpu, GCPhysFault, pvBuf, cbBuf, NULL /*pRange*/);
-    }
-#endif
-    AssertRC(rc);
-    Assert(pRange == iomMmioGetRange(pVM, pVCpu, GCPhysFault));
-
     /*
      * Perform locking.
      */
-    iomMmioRetainRange(pRange);
+    iomMmioRetainHandlerRange(pVM, pVCpu, pRange);
     PPDMDEVINS pDevIns = pRange->CTX_SUFF(pDevIns);
-    IOM_UNLOCK_SHARED(pVM);
-    VBOXSTRICTRC rcStrict = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_MMIO_READ_WRITE);
+    VBOXSTRICTRC rcStrict = iomMmioEnterDevLock(pVM, pRange, pDevIns, VINF_IOM_R3_MMIO_READ_WRITE);
     if (rcStrict == VINF_SUCCESS)
     {
         /*
@@ -828,7 +834,7 @@ PGM_ALL_CB2_DECL(VBOXSTRICTRC) iomMmioHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GC
 #endif
 
         iomMmioReleaseRange(pVM, pRange);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomMmioLeaveDevLock(pRange, pDevIns);
     }
 #ifdef IN_RING3
     else
@@ -869,13 +875,6 @@ PGM_ALL_CB2_DECL(VBOXSTRICTRC) iomMmioHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GC
 VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32_t *pu32Value, size_t cbValue)
 {
     Assert(pVCpu->iom.s.PendingMmioWrite.cbValue == 0);
-    /* Take the IOM lock before performing any MMIO. */
-    VBOXSTRICTRC rc = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc == VERR_SEM_BUSY)
-        return VINF_IOM_R3_MMIO_WRITE;
-#endif
-    AssertRC(VBOXSTRICTRC_VAL(rc));
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyMMIORead(pVM, GCPhys, cbValue);
 #endif
@@ -883,18 +882,23 @@ VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32
     /*
      * Lookup the current context range node and statistics.
      */
-    PIOMMMIORANGE pRange = iomMmioGetRange(pVM, pVCpu, GCPhys);
+    PIOMMMIORANGE pRange = iomMmioGetRangeWithRef(pVM, pVCpu, GCPhys);
     if (!pRange)
     {
         AssertMsgFailed(("Handlers and page tables are out of sync or something! GCPhys=%RGp cbValue=%d\n", GCPhys, cbValue));
-        IOM_UNLOCK_SHARED(pVM);
         return VERR_IOM_MMIO_RANGE_NOT_FOUND;
     }
-    iomMmioRetainRange(pRange);
-#ifndef VBOX_WITH_STATISTICS
-    IOM_UNLOCK_SHARED(pVM);
-
-#else  /* VBOX_WITH_STATISTICS */
+    VBOXSTRICTRC rc;
+#ifdef VBOX_WITH_STATISTICS
+    rc = IOM_LOCK_SHARED(pVM);
+# ifndef IN_RING3
+    if (rc == VERR_SEM_BUSY)
+    {
+        iomMmioReleaseRange(pVM, pRange);
+        return VINF_IOM_R3_MMIO_READ;
+    }
+# endif
+    AssertRC(VBOXSTRICTRC_VAL(rc));
     PIOMMMIOSTATS pStats = iomMmioGetStats(pVM, pVCpu, GCPhys, pRange);
     if (!pStats)
     {
@@ -914,7 +918,7 @@ VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32
          * Perform locking.
          */
         PPDMDEVINS pDevIns = pRange->CTX_SUFF(pDevIns);
-        rc = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_MMIO_WRITE);
+        rc = iomMmioEnterDevLock(pVM, pRange, pDevIns, VINF_IOM_R3_MMIO_WRITE);
         if (rc != VINF_SUCCESS)
         {
             iomMmioReleaseRange(pVM, pRange);
@@ -937,7 +941,7 @@ VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32
         {
             case VINF_SUCCESS:
                 Log4(("IOMMMIORead: GCPhys=%RGp *pu32=%08RX32 cb=%d rc=VINF_SUCCESS\n", GCPhys, *pu32Value, cbValue));
-                PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+                iomMmioLeaveDevLock(pRange, pDevIns);
                 iomMmioReleaseRange(pVM, pRange);
                 return rc;
 #ifndef IN_RING3
@@ -947,21 +951,21 @@ VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32
 #endif
             default:
                 Log4(("IOMMMIORead: GCPhys=%RGp *pu32=%08RX32 cb=%d rc=%Rrc\n", GCPhys, *pu32Value, cbValue, VBOXSTRICTRC_VAL(rc)));
-                PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+                iomMmioLeaveDevLock(pRange, pDevIns);
                 iomMmioReleaseRange(pVM, pRange);
                 return rc;
 
             case VINF_IOM_MMIO_UNUSED_00:
                 iomMMIODoRead00s(pu32Value, cbValue);
                 Log4(("IOMMMIORead: GCPhys=%RGp *pu32=%08RX32 cb=%d rc=%Rrc\n", GCPhys, *pu32Value, cbValue, VBOXSTRICTRC_VAL(rc)));
-                PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+                iomMmioLeaveDevLock(pRange, pDevIns);
                 iomMmioReleaseRange(pVM, pRange);
                 return VINF_SUCCESS;
 
             case VINF_IOM_MMIO_UNUSED_FF:
                 iomMMIODoReadFFs(pu32Value, cbValue);
                 Log4(("IOMMMIORead: GCPhys=%RGp *pu32=%08RX32 cb=%d rc=%Rrc\n", GCPhys, *pu32Value, cbValue, VBOXSTRICTRC_VAL(rc)));
-                PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+                iomMmioLeaveDevLock(pRange, pDevIns);
                 iomMmioReleaseRange(pVM, pRange);
                 return VINF_SUCCESS;
         }
@@ -1002,13 +1006,6 @@ VMMDECL(VBOXSTRICTRC) IOMMMIORead(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32
 VMMDECL(VBOXSTRICTRC) IOMMMIOWrite(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint32_t u32Value, size_t cbValue)
 {
     Assert(pVCpu->iom.s.PendingMmioWrite.cbValue == 0);
-    /* Take the IOM lock before performing any MMIO. */
-    VBOXSTRICTRC rc = IOM_LOCK_SHARED(pVM);
-#ifndef IN_RING3
-    if (rc == VERR_SEM_BUSY)
-        return VINF_IOM_R3_MMIO_WRITE;
-#endif
-    AssertRC(VBOXSTRICTRC_VAL(rc));
 #if defined(IEM_VERIFICATION_MODE) && defined(IN_RING3)
     IEMNotifyMMIOWrite(pVM, GCPhys, u32Value, cbValue);
 #endif
@@ -1016,18 +1013,23 @@ VMMDECL(VBOXSTRICTRC) IOMMMIOWrite(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint3
     /*
      * Lookup the current context range node.
      */
-    PIOMMMIORANGE pRange = iomMmioGetRange(pVM, pVCpu, GCPhys);
+    PIOMMMIORANGE pRange = iomMmioGetRangeWithRef(pVM, pVCpu, GCPhys);
     if (!pRange)
     {
         AssertMsgFailed(("Handlers and page tables are out of sync or something! GCPhys=%RGp cbValue=%d\n", GCPhys, cbValue));
-        IOM_UNLOCK_SHARED(pVM);
         return VERR_IOM_MMIO_RANGE_NOT_FOUND;
     }
-    iomMmioRetainRange(pRange);
-#ifndef VBOX_WITH_STATISTICS
-    IOM_UNLOCK_SHARED(pVM);
-
-#else  /* VBOX_WITH_STATISTICS */
+    VBOXSTRICTRC rc;
+#ifdef VBOX_WITH_STATISTICS
+    rc = IOM_LOCK_SHARED(pVM);
+# ifndef IN_RING3
+    if (rc == VERR_SEM_BUSY)
+    {
+        iomMmioReleaseRange(pVM, pRange);
+        return VINF_IOM_R3_MMIO_WRITE;
+    }
+# endif
+    AssertRC(VBOXSTRICTRC_VAL(rc));
     PIOMMMIOSTATS pStats = iomMmioGetStats(pVM, pVCpu, GCPhys, pRange);
     if (!pStats)
     {
@@ -1047,7 +1049,7 @@ VMMDECL(VBOXSTRICTRC) IOMMMIOWrite(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint3
          * Perform locking.
          */
         PPDMDEVINS pDevIns = pRange->CTX_SUFF(pDevIns);
-        rc = PDMCritSectEnter(pDevIns->CTX_SUFF(pCritSectRo), VINF_IOM_R3_MMIO_READ);
+        rc = iomMmioEnterDevLock(pVM, pRange, pDevIns, VINF_IOM_R3_MMIO_READ);
         if (rc != VINF_SUCCESS)
         {
             iomMmioReleaseRange(pVM, pRange);
@@ -1073,7 +1075,7 @@ VMMDECL(VBOXSTRICTRC) IOMMMIOWrite(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, uint3
 #endif
         Log4(("IOMMMIOWrite: GCPhys=%RGp u32=%08RX32 cb=%d rc=%Rrc\n", GCPhys, u32Value, cbValue, VBOXSTRICTRC_VAL(rc)));
         iomMmioReleaseRange(pVM, pRange);
-        PDMCritSectLeave(pDevIns->CTX_SUFF(pCritSectRo));
+        iomMmioLeaveDevLock(pRange, pDevIns);
         return rc;
     }
 #ifndef IN_RING3
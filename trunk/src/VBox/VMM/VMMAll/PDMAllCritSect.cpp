@@ -38,18 +38,24 @@
 #endif
 #if defined(IN_RING3) || defined(IN_RING0)
 # include <iprt/thread.h>
+# include <iprt/time.h>
 #endif
 
 
 /*********************************************************************************************************************************
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
-/** The number loops to spin for in ring-3. */
-#define PDMCRITSECT_SPIN_COUNT_R3       20
-/** The number loops to spin for in ring-0. */
-#define PDMCRITSECT_SPIN_COUNT_R0       256
-/** The number loops to spin for in the raw-mode context. */
-#define PDMCRITSECT_SPIN_COUNT_RC       256
+/** @def PDMCRITSECT_CTX_SPINS
+ * The current context spin limit of a critical section. */
+/** @def PDMCRITSECT_CTX_SPINS_MAX
+ * The current context spin limit ceiling of a critical section. */
+#ifdef IN_RING3
+# define PDMCRITSECT_CTX_SPINS(a_pCritSect)       ((a_pCritSect)->s.cSpinsR3)
+# define PDMCRITSECT_CTX_SPINS_MAX(a_pCritSect)   ((a_pCritSect)->s.cSpinsMaxR3)
+#else
+# define PDMCRITSECT_CTX_SPINS(a_pCritSect)       ((a_pCritSect)->s.cSpinsRZ)
+# define PDMCRITSECT_CTX_SPINS_MAX(a_pCritSect)   ((a_pCritSect)->s.cSpinsMaxRZ)
+#endif
 
 
 /* Undefine the automatic VBOX_STRICT API mappings. */
@@ -108,7 +114,53 @@ DECL_FORCE_INLINE(int) pdmCritSectEnterFirst(PPDMCRITSECT pCritSect, RTNATIVETHR
 }
 
 
+/**
+ * Moves the spin limit towards twice what it took to get the lock by spinning.
+ *
+ * The updates are not serialized, this is just a heuristic.
+ *
+ * @param   pCritSect           The critsect.
+ * @param   cSpins              The number of loops it took.
+ */
+DECLINLINE(void) pdmCritSectSpinAdjustAcquired(PPDMCRITSECT pCritSect, uint32_t cSpins)
+{
+    uint32_t const cMax    = PDMCRITSECT_CTX_SPINS_MAX(pCritSect);
+    uint32_t const cTarget = RT_MIN(cSpins * 2 + PDMCRITSECT_SPIN_MIN, cMax);
+    uint32_t const cCur    = PDMCRITSECT_CTX_SPINS(pCritSect);
+    if (cTarget > cCur)
+        PDMCRITSECT_CTX_SPINS(pCritSect) = cCur + (cTarget - cCur + 7) / 8;
+    else
+        PDMCRITSECT_CTX_SPINS(pCritSect) = cCur - (cCur - cTarget) / 8;
+}
+
+
 #if defined(IN_RING3) || defined(IN_RING0)
+/**
+ * Records a blocking wait and adjusts the spin limit accordingly.
+ *
+ * If the lock became available soon after we gave up spinning, spinning a
+ * little longer would've been cheaper than blocking, so the limit is raised.
+ * Long waits lower it, there is no point in burning CPU on those.
+ *
+ * @param   pCritSect           The critsect.
+ * @param   cNsWait             How long the wait took.
+ */
+static void pdmR3R0CritSectSpinAdjustWaited(PPDMCRITSECT pCritSect, uint64_t cNsWait)
+{
+    unsigned const iBucket = cNsWait < RT_NS_10US  ? 0
+                           : cNsWait < RT_NS_100US ? 1
+                           : cNsWait < RT_NS_1MS   ? 2 : 3;
+    STAM_REL_COUNTER_INC(&pCritSect->s.aStatWaitHisto[iBucket]);
+
+    uint32_t const cMax = PDMCRITSECT_CTX_SPINS_MAX(pCritSect);
+    uint32_t const cCur = PDMCRITSECT_CTX_SPINS(pCritSect);
+    if (cNsWait < PDMCRITSECT_SPIN_WORTHWHILE_NS)
+        PDMCRITSECT_CTX_SPINS(pCritSect) = RT_MIN(cCur + cCur / 4 + PDMCRITSECT_SPIN_MIN, cMax);
+    else
+        PDMCRITSECT_CTX_SPINS(pCritSect) = RT_MAX(cCur - cCur / 8, RT_MIN(PDMCRITSECT_SPIN_MIN, cMax));
+}
+
+
 /**
  * Deals with the contended case in ring-3 and ring-0.
  *
@@ -147,6 +199,7 @@ static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD
     RTTHREAD        hThreadSelf = RTThreadSelf();
 #  endif
 # endif
+    uint64_t const nsStart = RTTimeNanoTS();
     for (;;)
     {
         /*
@@ -181,7 +234,10 @@ static int pdmR3R0CritSectEnterContended(PPDMCRITSECT pCritSect, RTNATIVETHREAD
         if (RT_UNLIKELY(pCritSect->s.Core.u32Magic != RTCRITSECT_MAGIC))
             return VERR_SEM_DESTROYED;
         if (rc == VINF_SUCCESS)
+        {
+            pdmR3R0CritSectSpinAdjustWaited(pCritSect, RTTimeNanoTS() - nsStart);
             return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+        }
         AssertMsg(rc == VERR_INTERRUPTED, ("rc=%Rrc\n", rc));
 
 # ifdef IN_RING0
@@ -249,20 +305,31 @@ DECL_FORCE_INLINE(int) pdmCritSectEnter(PPDMCRITSECT pCritSect, int rcBusy, PCRT
 
     /*
      * Spin for a bit without incrementing the counter.
+     *
+     * How long is learned per critical section (the limit is zero on
+     * uniprocessor hosts).  If others are already queued up waiting, the lock
+     * will be handed to them first, so we go straight to waiting.
      */
-    /** @todo Move this to cfgm variables since it doesn't make sense to spin on UNI
-     *        cpu systems. */
-    int32_t cSpinsLeft = CTX_SUFF(PDMCRITSECT_SPIN_COUNT_);
-    while (cSpinsLeft-- > 0)
+    uint32_t const cMaxSpins = PDMCRITSECT_CTX_SPINS(pCritSect);
+    if (   cMaxSpins
+        && ASMAtomicUoReadS32(&pCritSect->s.Core.cLockers) <= 0)
     {
-        if (ASMAtomicCmpXchgS32(&pCritSect->s.Core.cLockers, 0, -1))
-            return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
-        ASMNopPause();
-        /** @todo Should use monitor/mwait on e.g. &cLockers here, possibly with a
-           cli'ed pendingpreemption check up front using sti w/ instruction fusing
-           for avoiding races. Hmm ... This is assuming the other party is actually
-           executing code on another CPU ... which we could keep track of if we
-           wanted. */
+        for (uint32_t cSpins = 0; cSpins < cMaxSpins; cSpins++)
+        {
+            if (ASMAtomicCmpXchgS32(&pCritSect->s.Core.cLockers, 0, -1))
+            {
+                STAM_REL_COUNTER_INC(&pCritSect->s.StatSpinAcquired);
+                pdmCritSectSpinAdjustAcquired(pCritSect, cSpins);
+                return pdmCritSectEnterFirst(pCritSect, hNativeSelf, pSrcPos);
+            }
+            ASMNopPause();
+            /** @todo Should use monitor/mwait on e.g. &cLockers here, possibly with a
+               cli'ed pendingpreemption check up front using sti w/ instruction fusing
+               for avoiding races. Hmm ... This is assuming the other party is actually
+               executing code on another CPU ... which we could keep track of if we
+               wanted. */
+        }
+        STAM_REL_COUNTER_INC(&pCritSect->s.StatSpinGaveUp);
     }
 
 #ifdef IN_RING3
@@ -28,9 +28,151 @@
 #include "PDMNetShaperInternal.h"
 
 
+/**
+ * Calculates how long it takes to transfer the given number of bytes at the
+ * rate of the bucket.
+ *
+ * @returns Nanoseconds.
+ * @param   cbPerSec        The bucket rate (bytes per second, non-zero).
+ * @param   cbTransfer      Number of bytes.
+ */
+DECLINLINE(uint64_t) pdmNsBucketCalcCost(uint64_t cbPerSec, size_t cbTransfer)
+{
+    return (uint64_t)cbTransfer * RT_NS_1SEC / cbPerSec;
+}
+
+
+/**
+ * Takes tokens from the bucket if they are available.
+ *
+ * @returns true if the tokens were taken, false if the bucket doesn't hold
+ *          enough of them.
+ * @param   pBucket         The bucket.
+ * @param   tsNow           The current time.
+ * @param   cbTransfer      Number of bytes to take.
+ */
+static bool pdmNsBucketTryTake(PPDMNSBUCKET pBucket, uint64_t tsNow, size_t cbTransfer)
+{
+    uint64_t const cbPerSec = ASMAtomicReadU64(&pBucket->cbPerSec);
+    if (!cbPerSec)
+        return true;
+    uint64_t const cNsBurst = ASMAtomicReadU64(&pBucket->cNsBurst);
+    uint64_t const cNsCost  = pdmNsBucketCalcCost(cbPerSec, cbTransfer);
+    for (;;)
+    {
+        uint64_t const tsTat    = ASMAtomicReadU64(&pBucket->tsTat);
+        uint64_t const tsTatNew = RT_MAX(tsTat, tsNow) + cNsCost;
+        if (tsTatNew - tsNow > cNsBurst)
+            return false;
+        if (ASMAtomicCmpXchgU64(&pBucket->tsTat, tsTatNew, tsTat))
+            return true;
+    }
+}
+
+
+/**
+ * Charges the bucket for bytes sent regardless of whether tokens are available.
+ *
+ * The bucket is emptied at most, it doesn't go into debt, so a burst of
+ * traffic in a child group cannot starve its siblings for longer than it takes
+ * to refill the parent bucket.
+ *
+ * @param   pBucket         The bucket.
+ * @param   tsNow           The current time.
+ * @param   cbTransfer      Number of bytes to charge.
+ */
+static void pdmNsBucketCharge(PPDMNSBUCKET pBucket, uint64_t tsNow, size_t cbTransfer)
+{
+    uint64_t const cbPerSec = ASMAtomicReadU64(&pBucket->cbPerSec);
+    if (!cbPerSec)
+        return;
+    uint64_t const cNsBurst = ASMAtomicReadU64(&pBucket->cNsBurst);
+    uint64_t const cNsCost  = pdmNsBucketCalcCost(cbPerSec, cbTransfer);
+    for (;;)
+    {
+        uint64_t const tsTat    = ASMAtomicReadU64(&pBucket->tsTat);
+        uint64_t const tsTatNew = RT_MIN(RT_MAX(tsTat, tsNow) + cNsCost, tsNow + cNsBurst);
+        if (   tsTatNew == tsTat
+            || ASMAtomicCmpXchgU64(&pBucket->tsTat, tsTatNew, tsTat))
+            return;
+    }
+}
+
+
+/**
+ * Checks whether the bucket could supply the given number of bytes without
+ * taking anything.
+ *
+ * @returns true if available, false if not.
+ * @param   pBucket         The bucket.
+ * @param   tsNow           The current time.
+ * @param   cbTransfer      Number of bytes.
+ */
+DECLINLINE(bool) pdmNsBucketHasTokens(PPDMNSBUCKET pBucket, uint64_t tsNow, size_t cbTransfer)
+{
+    uint64_t const cbPerSec = ASMAtomicReadU64(&pBucket->cbPerSec);
+    if (!cbPerSec)
+        return true;
+    uint64_t const tsTat = ASMAtomicReadU64(&pBucket->tsTat);
+    return RT_MAX(tsTat, tsNow) + pdmNsBucketCalcCost(cbPerSec, cbTransfer) - tsNow <= ASMAtomicReadU64(&pBucket->cNsBurst);
+}
+
+
+/**
+ * Tries to allocate bandwidth in the given group, borrowing from the parent
+ * groups if necessary.
+ *
+ * @returns true if bandwidth was allocated, false if not.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   tsNow           The current time.
+ * @param   cbTransfer      Number of bytes to allocate.
+ * @param   cDepth          Recursion depth (paranoia).
+ */
+static bool pdmNsBwGroupAllocate(PPDMNSBWGROUP pBwGroup, uint64_t tsNow, size_t cbTransfer, unsigned cDepth)
+{
+    PPDMNSBWGROUP pParent = pBwGroup->CTX_SUFF(pParent);
+    AssertReturn(cDepth < 16, false);
+
+    /* A disabled group is transparent. */
+    if (!ASMAtomicReadU64(&pBwGroup->cbPerSecMax))
+        return !VALID_PTR(pParent) || pdmNsBwGroupAllocate(pParent, tsNow, cbTransfer, cDepth + 1);
+
+    /* The ceiling is never exceeded. */
+    if (!pdmNsBucketHasTokens(&pBwGroup->Ceil, tsNow, cbTransfer))
+        return false;
+
+    /* Own rate first; the traffic is accounted to all ancestors. */
+    if (pdmNsBucketTryTake(&pBwGroup->Rate, tsNow, cbTransfer))
+    {
+        pdmNsBucketCharge(&pBwGroup->Ceil, tsNow, cbTransfer);
+        for (unsigned i = 0; VALID_PTR(pParent) && i < 16; i++)
+        {
+            pdmNsBucketCharge(&pParent->Rate, tsNow, cbTransfer);
+            pParent = pParent->CTX_SUFF(pParent);
+        }
+        STAM_REL_COUNTER_ADD(&pBwGroup->StatBytesGranted, cbTransfer);
+        return true;
+    }
+
+    /* Borrow from the parent (which in turn may borrow from its parent). */
+    if (   VALID_PTR(pParent)
+        && pdmNsBwGroupAllocate(pParent, tsNow, cbTransfer, cDepth + 1))
+    {
+        pdmNsBucketCharge(&pBwGroup->Ceil, tsNow, cbTransfer);
+        STAM_REL_COUNTER_ADD(&pBwGroup->StatBytesBorrowed, cbTransfer);
+        return true;
+    }
+    return false;
+}
+
+
 /**
  * Obtain bandwidth in a bandwidth group.
  *
+ * This doesn't take any locks.  When several filters of the group are
+ * backlogged, each is limited to the deficit accumulated by the shaper thread
+ * (deficit round robin) so a bursty filter cannot starve its neighbours.
+ *
  * @returns True if bandwidth was allocated, false if not.
  * @param   pFilter         Pointer to the filter that allocates bandwidth.
  * @param   cbTransfer      Number of bytes to allocate.
@@ -42,36 +184,35 @@ VMMDECL(bool) PDMNsAllocateBandwidth(PPDMNSFILTER pFilter, size_t cbTransfer)
         return true;
 
     PPDMNSBWGROUP pBwGroup = ASMAtomicReadPtrT(&pFilter->CTX_SUFF(pBwGroup), PPDMNSBWGROUP);
-    int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
-    if (RT_UNLIKELY(rc == VERR_SEM_BUSY))
+
+    /* An unlimited group without a parent never denies anything. */
+    if (   !ASMAtomicReadU64(&pBwGroup->cbPerSecMax)
+        && !VALID_PTR(pBwGroup->CTX_SUFF(pParent)))
         return true;
 
-    bool fAllowed = true;
-    if (pBwGroup->cbPerSecMax)
+    bool const    fDrr     = ASMAtomicReadU32(&pBwGroup->cBacklogged) > 1;
+    bool          fAllowed;
+    if (   fDrr
+        && ASMAtomicReadS64(&pFilter->cbDeficit) < (int64_t)cbTransfer)
     {
-        /* Re-fill the bucket first */
-        uint64_t tsNow        = RTTimeSystemNanoTS();
-        uint32_t uTokensAdded = (tsNow - pBwGroup->tsUpdatedLast) * pBwGroup->cbPerSecMax / (1000 * 1000 * 1000);
-        uint32_t uTokens      = RT_MIN(pBwGroup->cbBucket, uTokensAdded + pBwGroup->cbTokensLast);
-
-        if (cbTransfer > uTokens)
+        fAllowed = false;
+        STAM_REL_COUNTER_INC(&pBwGroup->StatDeniedDrr);
+    }
+    else
+    {
+        fAllowed = pdmNsBwGroupAllocate(pBwGroup, RTTimeSystemNanoTS(), cbTransfer, 0);
+        if (fAllowed)
         {
-            fAllowed = false;
-            ASMAtomicWriteBool(&pFilter->fChoked, true);
+            if (fDrr)
+                ASMAtomicSubS64(&pFilter->cbDeficit, (int64_t)cbTransfer);
         }
         else
-        {
-            pBwGroup->tsUpdatedLast = tsNow;
-            pBwGroup->cbTokensLast = uTokens - (uint32_t)cbTransfer;
-        }
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u uTokens=%u uTokensAdded=%u fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), cbTransfer, uTokens, uTokensAdded, fAllowed));
+            STAM_REL_COUNTER_INC(&pBwGroup->StatDenied);
     }
-    else
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} disabled fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), fAllowed));
 
-    rc = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc);
+    if (!fAllowed)
+        ASMAtomicWriteBool(&pFilter->fChoked, true);
+    Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u fDrr=%RTbool fAllowed=%RTbool\n",
+          pBwGroup, R3STRING(pBwGroup->pszNameR3), cbTransfer, fDrr, fAllowed));
     return fAllowed;
 }
-
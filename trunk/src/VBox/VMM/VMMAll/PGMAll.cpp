@@ -34,6 +34,7 @@
 # include <VBox/vmm/rem.h>
 #endif
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/hm.h>
 #include <VBox/vmm/hm_vmx.h>
 #include "PGMInternal.h"
@@ -730,6 +731,7 @@ VMMDECL(int) PGMInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtrPage)
      */
     REMNotifyInvalidatePage(pVM, GCPtrPage);
 #endif /* !IN_RING3 */
+    IEMTlbInvalidatePage(pVCpu, GCPtrPage);
 
 
 #ifdef IN_RC
@@ -1947,6 +1949,7 @@ VMMDECL(int) PGMFlushTLB(PVMCPU pVCpu, uint64_t cr3, bool fGlobal)
     VMCPU_FF_SET(pVCpu, VMCPU_FF_PGM_SYNC_CR3_NON_GLOBAL);
     if (fGlobal)
         VMCPU_FF_SET(pVCpu, VMCPU_FF_PGM_SYNC_CR3);
+    IEMTlbInvalidateAll(pVCpu);
     LogFlow(("PGMFlushTLB: cr3=%RX64 OldCr3=%RX64 fGlobal=%d\n", cr3, pVCpu->pgm.s.GCPhysCR3, fGlobal));
 
     /*
@@ -2279,6 +2282,9 @@ VMMDECL(int) PGMChangeMode(PVMCPU pVCpu, uint64_t cr0, uint64_t cr4, uint64_t ef
             enmGuestMode = PGMMODE_AMD64_NX;
     }
 
+    /* The paging bits may have changed even if the mode didn't. */
+    IEMTlbInvalidateAll(pVCpu);
+
     /*
      * Did it change?
      */
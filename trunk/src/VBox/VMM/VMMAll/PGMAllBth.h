@@ -175,7 +175,7 @@ static VBOXSTRICTRC PGM_BTH_NAME(Trap0eHandlerDoAccessHandlers)(PVMCPU pVCpu, RT
 # else
         const RTGCPHYS  GCPhysFault = PGM_A20_APPLY(pVCpu, (RTGCPHYS)pvFault);
 # endif
-        PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhysFault);
+        PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhysFault);
         if (pCur)
         {
             PPGMPHYSHANDLERTYPEINT pCurType = PGMPHYSHANDLER_GET_TYPE(pVM, pCur);
@@ -263,7 +263,7 @@ static VBOXSTRICTRC PGM_BTH_NAME(Trap0eHandlerDoAccessHandlers)(PVMCPU pVCpu, RT
 
 #  ifdef VBOX_WITH_STATISTICS
                 pgmLock(pVM);
-                pCur = pgmHandlerPhysicalLookup(pVM, GCPhysFault);
+                pCur = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhysFault);
                 if (pCur)
                     STAM_PROFILE_STOP(&pCur->Stat, h);
                 pgmUnlock(pVM);
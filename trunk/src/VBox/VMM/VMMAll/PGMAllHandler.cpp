@@ -25,6 +25,7 @@
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/stam.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
@@ -122,6 +123,229 @@ VMMDECL(uint32_t) PGMHandlerPhysicalTypeRetain(PVM pVM, PGMPHYSHANDLERTYPE hType
 }
 
 
+/**
+ * Gets the physical handler lookup index, if present.
+ *
+ * @returns Pointer to the index, NULL if not present.
+ * @param   pVM         The cross context VM structure.
+ */
+DECLINLINE(PPGMPHYSHANDLERIDX) pgmHandlerPhysicalIdxGet(PVM pVM)
+{
+    PPGMTREES pTrees = pVM->pgm.s.CTX_SUFF(pTrees);
+    int32_t   off    = pTrees->offPhysHandlerIdx;
+    return off ? (PPGMPHYSHANDLERIDX)((uint8_t *)pTrees + off) : NULL;
+}
+
+
+/**
+ * Searches the physical handler lookup index for the first entry ending at or
+ * above @a GCPhys.
+ *
+ * @returns Entry index, pIdx->cEntries if none.
+ * @param   pIdx        The physical handler lookup index.
+ * @param   GCPhys      The address to search for.
+ */
+DECLINLINE(uint32_t) pgmHandlerPhysicalIdxSearch(PPGMPHYSHANDLERIDX pIdx, RTGCPHYS GCPhys)
+{
+    uint32_t iStart = 0;
+    uint32_t iEnd   = pIdx->cEntries;
+    while (iStart < iEnd)
+    {
+        uint32_t const i = iStart + (iEnd - iStart) / 2;
+        if (pIdx->aEntries[i].GCPhysLast < GCPhys)
+            iStart = i + 1;
+        else
+            iEnd = i;
+    }
+    return iStart;
+}
+
+
+/**
+ * Callback for pgmHandlerPhysicalIdxRebuild that adds one handler.
+ *
+ * @returns 0 (continue enumeration).
+ * @param   pNode       The handler node.
+ * @param   pvUser      The cross context VM structure.
+ */
+static DECLCALLBACK(int) pgmHandlerPhysicalIdxRebuildOne(PAVLROGCPHYSNODECORE pNode, void *pvUser)
+{
+    PVM                 pVM  = (PVM)pvUser;
+    PPGMPHYSHANDLERIDX  pIdx = pgmHandlerPhysicalIdxGet(pVM);
+    AssertReturn(pIdx->cEntries < pIdx->cMaxEntries, VERR_INTERNAL_ERROR_3);
+    PPGMPHYSHANDLERIDXENTRY pEntry = &pIdx->aEntries[pIdx->cEntries++];
+    pEntry->GCPhysLast = pNode->KeyLast;
+    pEntry->offHandler = (int32_t)((intptr_t)pNode - (intptr_t)pVM->pgm.s.CTX_SUFF(pTrees));
+    return 0;
+}
+
+
+/**
+ * Callback for pgmHandlerPhysicalIdxRebuild that counts the handlers.
+ *
+ * @returns 0 (continue enumeration).
+ * @param   pNode       The handler node.
+ * @param   pvUser      Pointer to the counter.
+ */
+static DECLCALLBACK(int) pgmHandlerPhysicalIdxCountOne(PAVLROGCPHYSNODECORE pNode, void *pvUser)
+{
+    NOREF(pNode);
+    *(uint32_t *)pvUser += 1;
+    return 0;
+}
+
+
+/**
+ * Reallocates the physical handler lookup index and fills it from the tree.
+ *
+ * Failing to allocate the index isn't fatal, the lookups will just fall back
+ * on the tree until the next rebuild.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+static void pgmHandlerPhysicalIdxRebuild(PVM pVM)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMTREES pTrees = pVM->pgm.s.CTX_SUFF(pTrees);
+
+    PPGMPHYSHANDLERIDX pOld = pgmHandlerPhysicalIdxGet(pVM);
+    pTrees->offPhysHandlerIdx = 0;
+    if (pOld)
+        MMHyperFree(pVM, pOld);
+
+    uint32_t cHandlers = 0;
+    RTAvlroGCPhysDoWithAll(&pTrees->PhysHandlers, true /*fFromLeft*/, pgmHandlerPhysicalIdxCountOne, &cHandlers);
+
+    uint32_t const      cMaxEntries = RT_ALIGN_32(cHandlers * 2 + 1, 64);
+    PPGMPHYSHANDLERIDX  pIdx;
+    int rc = MMHyperAlloc(pVM, RT_OFFSETOF(PGMPHYSHANDLERIDX, aEntries) + cMaxEntries * sizeof(pIdx->aEntries[0]), 0,
+                          MM_TAG_PGM_HANDLERS, (void **)&pIdx);
+    if (RT_FAILURE(rc))
+    {
+        Log(("pgmHandlerPhysicalIdxRebuild: Failed to allocate index for %u handlers: %Rrc\n", cHandlers, rc));
+        return;
+    }
+    pIdx->cEntries    = 0;
+    pIdx->cMaxEntries = cMaxEntries;
+    pTrees->offPhysHandlerIdx = (int32_t)((intptr_t)pIdx - (intptr_t)pTrees);
+
+    rc = RTAvlroGCPhysDoWithAll(&pTrees->PhysHandlers, true /*fFromLeft*/, pgmHandlerPhysicalIdxRebuildOne, pVM);
+    AssertRC(rc);
+    Assert(pIdx->cEntries == cHandlers);
+}
+
+
+/**
+ * Adds a handler to the physical handler lookup index.
+ *
+ * Must be called after the handler has been inserted into the tree.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pHandler    The handler.
+ */
+void pgmHandlerPhysicalIdxInsert(PVM pVM, PPGMPHYSHANDLER pHandler)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPHYSHANDLERIDX pIdx = pgmHandlerPhysicalIdxGet(pVM);
+    if (!pIdx || pIdx->cEntries >= pIdx->cMaxEntries)
+    {
+        /* The tree already includes the new handler. */
+        pgmHandlerPhysicalIdxRebuild(pVM);
+        return;
+    }
+
+    uint32_t const i = pgmHandlerPhysicalIdxSearch(pIdx, pHandler->Core.Key);
+    Assert(i >= pIdx->cEntries || pIdx->aEntries[i].GCPhysLast > pHandler->Core.KeyLast);
+    if (i < pIdx->cEntries)
+        memmove(&pIdx->aEntries[i + 1], &pIdx->aEntries[i], (pIdx->cEntries - i) * sizeof(pIdx->aEntries[0]));
+    pIdx->aEntries[i].GCPhysLast = pHandler->Core.KeyLast;
+    pIdx->aEntries[i].offHandler = (int32_t)((intptr_t)pHandler - (intptr_t)pVM->pgm.s.CTX_SUFF(pTrees));
+    pIdx->cEntries++;
+}
+
+
+/**
+ * Removes a handler from the physical handler lookup index.
+ *
+ * Must be called before the handler range is changed.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pHandler    The handler.
+ */
+void pgmHandlerPhysicalIdxRemove(PVM pVM, PPGMPHYSHANDLER pHandler)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPHYSHANDLERIDX pIdx = pgmHandlerPhysicalIdxGet(pVM);
+    if (!pIdx)
+        return;
+
+    int32_t const  offHandler = (int32_t)((intptr_t)pHandler - (intptr_t)pVM->pgm.s.CTX_SUFF(pTrees));
+    uint32_t const i          = pgmHandlerPhysicalIdxSearch(pIdx, pHandler->Core.KeyLast);
+    if (RT_LIKELY(i < pIdx->cEntries && pIdx->aEntries[i].offHandler == offHandler))
+    {
+        pIdx->cEntries--;
+        if (i < pIdx->cEntries)
+            memmove(&pIdx->aEntries[i], &pIdx->aEntries[i + 1], (pIdx->cEntries - i) * sizeof(pIdx->aEntries[0]));
+    }
+    else
+    {
+        /* Out of sync, drop it and let the next insert rebuild it from the tree. */
+        AssertMsgFailed(("%RGp-%RGp not found in the index\n", pHandler->Core.Key, pHandler->Core.KeyLast));
+        pVM->pgm.s.CTX_SUFF(pTrees)->offPhysHandlerIdx = 0;
+        MMHyperFree(pVM, pIdx);
+    }
+}
+
+
+/**
+ * Looks up the physical handler covering @a GCPhys without consulting the
+ * last-hit caches.
+ *
+ * @returns Physical handler covering @a GCPhys, NULL if none.
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The lookup address.
+ */
+PPGMPHYSHANDLER pgmHandlerPhysicalLookupSlow(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMPHYSHANDLERIDX pIdx = pgmHandlerPhysicalIdxGet(pVM);
+    if (RT_LIKELY(pIdx))
+    {
+        uint32_t const i = pgmHandlerPhysicalIdxSearch(pIdx, GCPhys);
+        if (i < pIdx->cEntries)
+        {
+            PPGMPHYSHANDLER pHandler = (PPGMPHYSHANDLER)((uint8_t *)pVM->pgm.s.CTX_SUFF(pTrees) + pIdx->aEntries[i].offHandler);
+            if (GCPhys >= pHandler->Core.Key)
+                return pHandler;
+        }
+        return NULL;
+    }
+    return (PPGMPHYSHANDLER)RTAvlroGCPhysRangeGet(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, GCPhys);
+}
+
+
+/**
+ * Invalidates the physical handler last-hit caches of the VM and all VCPUs.
+ *
+ * Must be called when a handler is freed.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+void pgmHandlerPhysicalInvalidateLookupCaches(PVM pVM)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    pVM->pgm.s.pLastPhysHandlerR0 = 0;
+    pVM->pgm.s.pLastPhysHandlerR3 = 0;
+    pVM->pgm.s.pLastPhysHandlerRC = 0;
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        PVMCPU pVCpu = &pVM->aCpus[idCpu];
+        pVCpu->pgm.s.pLastPhysHandlerR0 = 0;
+        pVCpu->pgm.s.pLastPhysHandlerR3 = 0;
+        pVCpu->pgm.s.pLastPhysHandlerRC = 0;
+    }
+}
+
+
 
 /**
  * Register a access handler for a physical range.
@@ -224,6 +448,7 @@ VMMDECL(int) PGMHandlerPhysicalRegister(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS GCPhy
      */
     if (RTAvlroGCPhysInsert(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, &pNew->Core))
     {
+        pgmHandlerPhysicalIdxInsert(pVM, pNew);
         rc = pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(pVM, pNew, pRam);
         if (rc == VINF_PGM_SYNC_CR3)
             rc = VINF_PGM_GCPHYS_ALIASED;
@@ -271,6 +496,7 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVM pVM, PPGMPHYSHANDL
      * mapping the page.
      */
     bool                    fFlushTLBs = false;
+    bool                    fUpgraded  = false;
     int                     rc         = VINF_SUCCESS;
     PPGMPHYSHANDLERTYPEINT  pCurType   = PGMPHYSHANDLER_GET_TYPE(pVM, pCur);
     const unsigned          uState     = pCurType->uState;
@@ -286,6 +512,7 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVM pVM, PPGMPHYSHANDL
         if (PGM_PAGE_GET_HNDL_PHYS_STATE(pPage) < uState)
         {
             PGM_PAGE_SET_HNDL_PHYS_STATE(pPage, uState);
+            fUpgraded = true;
 
             int rc2 = pgmPoolTrackUpdateGCPhys(pVM, pRam->GCPhys + (i << PAGE_SHIFT), pPage,
                                                false /* allow updates of PTEs (instead of flushing) */, &fFlushTLBs);
@@ -299,6 +526,10 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVM pVM, PPGMPHYSHANDL
         i++;
     }
 
+    /* Direct page mappings cached by IEM must go through the handler now. */
+    if (fUpgraded)
+        IEMTlbInvalidateAllPhysical(pVM);
+
     if (fFlushTLBs)
     {
         PGM_INVL_ALL_VCPU_TLBS(pVM);
@@ -327,6 +558,7 @@ VMMDECL(int)  PGMHandlerPhysicalDeregister(PVM pVM, RTGCPHYS GCPhys)
     PPGMPHYSHANDLER pCur = (PPGMPHYSHANDLER)RTAvlroGCPhysRemove(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, GCPhys);
     if (pCur)
     {
+        pgmHandlerPhysicalIdxRemove(pVM, pCur);
         LogFlow(("PGMHandlerPhysicalDeregister: Removing Range %RGp-%RGp %s\n", pCur->Core.Key, pCur->Core.KeyLast, R3STRING(pCur->pszDesc)));
 
         /*
@@ -335,9 +567,7 @@ VMMDECL(int)  PGMHandlerPhysicalDeregister(PVM pVM, RTGCPHYS GCPhys)
          */
         pgmHandlerPhysicalResetRamFlags(pVM, pCur);
         pgmHandlerPhysicalDeregisterNotifyREM(pVM, pCur);
-        pVM->pgm.s.pLastPhysHandlerR0 = 0;
-        pVM->pgm.s.pLastPhysHandlerR3 = 0;
-        pVM->pgm.s.pLastPhysHandlerRC = 0;
+        pgmHandlerPhysicalInvalidateLookupCaches(pVM);
         PGMHandlerPhysicalTypeRelease(pVM, pCur->hType);
         MMHyperFree(pVM, pCur);
         pgmUnlock(pVM);
@@ -523,7 +753,7 @@ void pgmHandlerPhysicalResetAliasedPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
      */
     if (fDoAccounting)
     {
-        PPGMPHYSHANDLER pHandler = pgmHandlerPhysicalLookup(pVM, GCPhysPage);
+        PPGMPHYSHANDLER pHandler = pgmHandlerPhysicalLookup(pVM, VMMGetCpu(pVM), GCPhysPage);
         if (RT_LIKELY(pHandler))
         {
             Assert(pHandler->cAliasedPages > 0);
@@ -621,6 +851,8 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
     PPGMPHYSHANDLER pCur = (PPGMPHYSHANDLER)RTAvlroGCPhysRemove(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, GCPhysCurrent);
     if (pCur)
     {
+        pgmHandlerPhysicalIdxRemove(pVM, pCur);
+
         /*
          * Clear the ram flags. (We're gonna move or free it!)
          */
@@ -651,6 +883,7 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
 
                 if (RTAvlroGCPhysInsert(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, &pCur->Core))
                 {
+                    pgmHandlerPhysicalIdxInsert(pVM, pCur);
 #ifdef VBOX_WITH_REM
                     RTGCPHYS            cb            = GCPhysLast - GCPhys + 1;
                     PGMPHYSHANDLERKIND  enmKind       = pCurType->enmKind;
@@ -698,9 +931,7 @@ VMMDECL(int) PGMHandlerPhysicalModify(PVM pVM, RTGCPHYS GCPhysCurrent, RTGCPHYS
          * We've only gotta notify REM and free the memory.
          */
         pgmHandlerPhysicalDeregisterNotifyREM(pVM, pCur);
-        pVM->pgm.s.pLastPhysHandlerR0 = 0;
-        pVM->pgm.s.pLastPhysHandlerR3 = 0;
-        pVM->pgm.s.pLastPhysHandlerRC = 0;
+        pgmHandlerPhysicalInvalidateLookupCaches(pVM);
         PGMHandlerPhysicalTypeRelease(pVM, pCur->hType);
         MMHyperFree(pVM, pCur);
     }
@@ -787,6 +1018,7 @@ VMMDECL(int) PGMHandlerPhysicalSplit(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS GCPhysSp
             /*
              * Create new handler node for the 2nd half.
              */
+            pgmHandlerPhysicalIdxRemove(pVM, pCur);
             *pNew = *pCur;
             pNew->Core.Key      = GCPhysSplit;
             pNew->cPages        = (pNew->Core.KeyLast - (pNew->Core.Key & X86_PTE_PAE_PG_MASK) + PAGE_SIZE) >> PAGE_SHIFT;
@@ -794,8 +1026,10 @@ VMMDECL(int) PGMHandlerPhysicalSplit(PVM pVM, RTGCPHYS GCPhys, RTGCPHYS GCPhysSp
             pCur->Core.KeyLast  = GCPhysSplit - 1;
             pCur->cPages        = (pCur->Core.KeyLast - (pCur->Core.Key & X86_PTE_PAE_PG_MASK) + PAGE_SIZE) >> PAGE_SHIFT;
 
+            pgmHandlerPhysicalIdxInsert(pVM, pCur);
             if (RT_LIKELY(RTAvlroGCPhysInsert(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, &pNew->Core)))
             {
+                pgmHandlerPhysicalIdxInsert(pVM, pNew);
                 LogFlow(("PGMHandlerPhysicalSplit: %RGp-%RGp and %RGp-%RGp\n",
                          pCur->Core.Key, pCur->Core.KeyLast, pNew->Core.Key, pNew->Core.KeyLast));
                 pgmUnlock(pVM);
@@ -852,13 +1086,14 @@ VMMDECL(int) PGMHandlerPhysicalJoin(PVM pVM, RTGCPHYS GCPhys1, RTGCPHYS GCPhys2)
                     PPGMPHYSHANDLER pCur3 = (PPGMPHYSHANDLER)RTAvlroGCPhysRemove(&pVM->pgm.s.CTX_SUFF(pTrees)->PhysHandlers, GCPhys2);
                     if (RT_LIKELY(pCur3 == pCur2))
                     {
+                        pgmHandlerPhysicalIdxRemove(pVM, pCur2);
+                        pgmHandlerPhysicalIdxRemove(pVM, pCur1);
                         pCur1->Core.KeyLast  = pCur2->Core.KeyLast;
                         pCur1->cPages        = (pCur1->Core.KeyLast - (pCur1->Core.Key & X86_PTE_PAE_PG_MASK) + PAGE_SIZE) >> PAGE_SHIFT;
                         LogFlow(("PGMHandlerPhysicalJoin: %RGp-%RGp %RGp-%RGp\n",
                                  pCur1->Core.Key, pCur1->Core.KeyLast, pCur2->Core.Key, pCur2->Core.KeyLast));
-                        pVM->pgm.s.pLastPhysHandlerR0 = 0;
-                        pVM->pgm.s.pLastPhysHandlerR3 = 0;
-                        pVM->pgm.s.pLastPhysHandlerRC = 0;
+                        pgmHandlerPhysicalIdxInsert(pVM, pCur1);
+                        pgmHandlerPhysicalInvalidateLookupCaches(pVM);
                         PGMHandlerPhysicalTypeRelease(pVM, pCur2->hType);
                         MMHyperFree(pVM, pCur2);
                         pgmUnlock(pVM);
@@ -1317,7 +1552,7 @@ VMMDECL(bool) PGMHandlerPhysicalIsRegistered(PVM pVM, RTGCPHYS GCPhys)
      * Find the handler.
      */
     pgmLock(pVM);
-    PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+    PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, VMMGetCpu(pVM), GCPhys);
     if (pCur)
     {
 #ifdef VBOX_STRICT
@@ -1349,7 +1584,7 @@ VMMDECL(bool) PGMHandlerPhysicalIsRegistered(PVM pVM, RTGCPHYS GCPhys)
 bool pgmHandlerPhysicalIsAll(PVM pVM, RTGCPHYS GCPhys)
 {
     pgmLock(pVM);
-    PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+    PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, VMMGetCpu(pVM), GCPhys);
     if (!pCur)
     {
         pgmUnlock(pVM);
@@ -25,6 +25,7 @@
 #include <VBox/vmm/vmm.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -352,14 +353,42 @@ void pgmPhysInvalidRamRangeTlbs(PVM pVM)
 
 
 /**
- * Tests if a value of type RTGCPHYS is negative if the type had been signed
- * instead of unsigned.
+ * Looks up the RAM range containing @a GCPhys, or failing that, the first
+ * range above it.
  *
- * @returns @c true if negative, @c false if positive or zero.
- * @param   a_GCPhys        The value to test.
- * @todo    Move me to iprt/types.h.
+ * This does a binary search of the RAM range lookup table, falling back on a
+ * linear walk of the RAM range list should the table be unavailable.
+ *
+ * @returns Pointer to the RAM range, NULL if there is no range at or above
+ *          @a GCPhys.
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The guest physical address.
  */
-#define RTGCPHYS_IS_NEGATIVE(a_GCPhys)  ((a_GCPhys) & ((RTGCPHYS)1 << (sizeof(RTGCPHYS)*8 - 1)))
+static PPGMRAMRANGE pgmPhysLookupRangeAtOrAbove(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMRAMRANGELOOKUP pLookup = pVM->pgm.s.CTX_SUFF(pRamRangeLookup);
+    if (RT_LIKELY(pLookup))
+    {
+        /* Find the first range ending at or above GCPhys. */
+        uint32_t const cEntries = pLookup->cEntries;
+        uint32_t       iStart   = 0;
+        uint32_t       iEnd     = cEntries;
+        while (iStart < iEnd)
+        {
+            uint32_t const i = iStart + (iEnd - iStart) / 2;
+            if (pLookup->aEntries[i].GCPhysLast < GCPhys)
+                iStart = i + 1;
+            else
+                iEnd = i;
+        }
+        return iStart < cEntries ? pLookup->aEntries[iStart].CTX_SUFF(pRam) : NULL;
+    }
+
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangesX); pRam; pRam = pRam->CTX_SUFF(pNext))
+        if (GCPhys <= pRam->GCPhysLast)
+            return pRam;
+    return NULL;
+}
 
 
 /**
@@ -371,19 +400,11 @@ PPGMRAMRANGE pgmPhysGetRangeSlow(PVM pVM, RTGCPHYS GCPhys)
 {
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,RamRangeTlbMisses));
 
-    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangeTree);
-    while (pRam)
+    PPGMRAMRANGE pRam = pgmPhysLookupRangeAtOrAbove(pVM, GCPhys);
+    if (pRam && GCPhys - pRam->GCPhys < pRam->cb)
     {
-        RTGCPHYS off = GCPhys - pRam->GCPhys;
-        if (off < pRam->cb)
-        {
-            pVM->pgm.s.CTX_SUFF(apRamRangesTlb)[PGM_RAMRANGE_TLB_IDX(GCPhys)] = pRam;
-            return pRam;
-        }
-        if (RTGCPHYS_IS_NEGATIVE(off))
-            pRam = pRam->CTX_SUFF(pLeft);
-        else
-            pRam = pRam->CTX_SUFF(pRight);
+        pVM->pgm.s.CTX_SUFF(apRamRangesTlb)[PGM_RAMRANGE_TLB_IDX(GCPhys)] = pRam;
+        return pRam;
     }
     return NULL;
 }
@@ -398,25 +419,10 @@ PPGMRAMRANGE pgmPhysGetRangeAtOrAboveSlow(PVM pVM, RTGCPHYS GCPhys)
 {
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,RamRangeTlbMisses));
 
-    PPGMRAMRANGE pLastLeft = NULL;
-    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangeTree);
-    while (pRam)
-    {
-        RTGCPHYS off = GCPhys - pRam->GCPhys;
-        if (off < pRam->cb)
-        {
-            pVM->pgm.s.CTX_SUFF(apRamRangesTlb)[PGM_RAMRANGE_TLB_IDX(GCPhys)] = pRam;
-            return pRam;
-        }
-        if (RTGCPHYS_IS_NEGATIVE(off))
-        {
-            pLastLeft = pRam;
-            pRam = pRam->CTX_SUFF(pLeft);
-        }
-        else
-            pRam = pRam->CTX_SUFF(pRight);
-    }
-    return pLastLeft;
+    PPGMRAMRANGE pRam = pgmPhysLookupRangeAtOrAbove(pVM, GCPhys);
+    if (pRam && GCPhys - pRam->GCPhys < pRam->cb)
+        pVM->pgm.s.CTX_SUFF(apRamRangesTlb)[PGM_RAMRANGE_TLB_IDX(GCPhys)] = pRam;
+    return pRam;
 }
 
 
@@ -429,8 +435,8 @@ PPGMPAGE pgmPhysGetPageSlow(PVM pVM, RTGCPHYS GCPhys)
 {
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,RamRangeTlbMisses));
 
-    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangeTree);
-    while (pRam)
+    PPGMRAMRANGE pRam = pgmPhysLookupRangeAtOrAbove(pVM, GCPhys);
+    if (pRam)
     {
         RTGCPHYS off = GCPhys - pRam->GCPhys;
         if (off < pRam->cb)
@@ -438,11 +444,6 @@ PPGMPAGE pgmPhysGetPageSlow(PVM pVM, RTGCPHYS GCPhys)
             pVM->pgm.s.CTX_SUFF(apRamRangesTlb)[PGM_RAMRANGE_TLB_IDX(GCPhys)] = pRam;
             return &pRam->aPages[off >> PAGE_SHIFT];
         }
-
-        if (RTGCPHYS_IS_NEGATIVE(off))
-            pRam = pRam->CTX_SUFF(pLeft);
-        else
-            pRam = pRam->CTX_SUFF(pRight);
     }
     return NULL;
 }
@@ -457,8 +458,8 @@ int pgmPhysGetPageExSlow(PVM pVM, RTGCPHYS GCPhys, PPPGMPAGE ppPage)
 {
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,RamRangeTlbMisses));
 
-    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangeTree);
-    while (pRam)
+    PPGMRAMRANGE pRam = pgmPhysLookupRangeAtOrAbove(pVM, GCPhys);
+    if (pRam)
     {
         RTGCPHYS off = GCPhys - pRam->GCPhys;
         if (off < pRam->cb)
@@ -467,11 +468,6 @@ int pgmPhysGetPageExSlow(PVM pVM, RTGCPHYS GCPhys, PPPGMPAGE ppPage)
             *ppPage = &pRam->aPages[off >> PAGE_SHIFT];
             return VINF_SUCCESS;
         }
-
-        if (RTGCPHYS_IS_NEGATIVE(off))
-            pRam = pRam->CTX_SUFF(pLeft);
-        else
-            pRam = pRam->CTX_SUFF(pRight);
     }
 
     *ppPage = NULL;
@@ -488,8 +484,8 @@ int pgmPhysGetPageAndRangeExSlow(PVM pVM, RTGCPHYS GCPhys, PPPGMPAGE ppPage, PPG
 {
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,RamRangeTlbMisses));
 
-    PPGMRAMRANGE pRam = pVM->pgm.s.CTX_SUFF(pRamRangeTree);
-    while (pRam)
+    PPGMRAMRANGE pRam = pgmPhysLookupRangeAtOrAbove(pVM, GCPhys);
+    if (pRam)
     {
         RTGCPHYS off = GCPhys - pRam->GCPhys;
         if (off < pRam->cb)
@@ -499,11 +495,6 @@ int pgmPhysGetPageAndRangeExSlow(PVM pVM, RTGCPHYS GCPhys, PPPGMPAGE ppPage, PPG
             *ppPage = &pRam->aPages[off >> PAGE_SHIFT];
             return VINF_SUCCESS;
         }
-
-        if (RTGCPHYS_IS_NEGATIVE(off))
-            pRam = pRam->CTX_SUFF(pLeft);
-        else
-            pRam = pRam->CTX_SUFF(pRight);
     }
 
     *ppRam  = NULL;
@@ -594,7 +585,7 @@ void pgmPhysInvalidatePageMapTLB(PVM pVM)
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->StatPageMapTlbFlushes);
 
     /* Clear the shared R0/R3 TLB completely. */
-    for (unsigned i = 0; i < RT_ELEMENTS(pVM->pgm.s.PhysTlbHC.aEntries); i++)
+    for (unsigned i = 0; i <= pVM->pgm.s.PhysTlbHC.fIdxMask; i++)
     {
         pVM->pgm.s.PhysTlbHC.aEntries[i].GCPhys = NIL_RTGCPHYS;
         pVM->pgm.s.PhysTlbHC.aEntries[i].pPage = 0;
@@ -604,6 +595,7 @@ void pgmPhysInvalidatePageMapTLB(PVM pVM)
 
     /** @todo clear the RC TLB whenever we add it. */
 
+    IEMTlbInvalidateAllPhysical(pVM);
     pgmUnlock(pVM);
 }
 
@@ -621,14 +613,14 @@ void pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys)
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->StatPageMapTlbFlushEntry);
 
 #ifdef IN_RC
-    unsigned idx = PGM_PAGER3MAPTLB_IDX(GCPhys);
+    unsigned idx = PGM_PAGER3MAPTLB_IDX(pVM, GCPhys);
     pVM->pgm.s.PhysTlbHC.aEntries[idx].GCPhys = NIL_RTGCPHYS;
     pVM->pgm.s.PhysTlbHC.aEntries[idx].pPage = 0;
     pVM->pgm.s.PhysTlbHC.aEntries[idx].pMap = 0;
     pVM->pgm.s.PhysTlbHC.aEntries[idx].pv = 0;
 #else
     /* Clear the shared R0/R3 TLB entry. */
-    PPGMPAGEMAPTLBE pTlbe = &pVM->pgm.s.CTXSUFF(PhysTlb).aEntries[PGM_PAGEMAPTLB_IDX(GCPhys)];
+    PPGMPAGEMAPTLBE pTlbe = &pVM->pgm.s.CTXSUFF(PhysTlb).aEntries[PGM_PAGEMAPTLB_IDX(pVM, GCPhys)];
     pTlbe->GCPhys = NIL_RTGCPHYS;
     pTlbe->pPage  = 0;
     pTlbe->pMap   = 0;
@@ -636,6 +628,8 @@ void pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys)
 #endif
 
     /** @todo clear the RC TLB whenever we add it. */
+
+    IEMTlbInvalidateAllPhysical(pVM);
 }
 
 /**
@@ -1458,7 +1452,7 @@ int pgmPhysPageLoadIntoTlbWithPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
      * Map the page.
      * Make a special case for the zero page as it is kind of special.
      */
-    PPGMPAGEMAPTLBE pTlbe = &pVM->pgm.s.CTXSUFF(PhysTlb).aEntries[PGM_PAGEMAPTLB_IDX(GCPhys)];
+    PPGMPAGEMAPTLBE pTlbe = &pVM->pgm.s.CTXSUFF(PhysTlb).aEntries[PGM_PAGEMAPTLB_IDX(pVM, GCPhys)];
     if (    !PGM_PAGE_IS_ZERO(pPage)
         &&  !PGM_PAGE_IS_BALLOONED(pPage))
     {
@@ -2309,7 +2303,7 @@ static VBOXSTRICTRC pgmPhysReadHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys,
     if (   PGM_PAGE_GET_HNDL_PHYS_STATE(pPage) == PGM_PAGE_HNDL_PHYS_STATE_ALL
         || PGM_PAGE_IS_MMIO_OR_SPECIAL_ALIAS(pPage))
     {
-        pPhys = pgmHandlerPhysicalLookup(pVM, GCPhys);
+        pPhys = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
         AssertReleaseMsg(pPhys, ("GCPhys=%RGp cb=%#x\n", GCPhys, cb));
         Assert(GCPhys >= pPhys->Core.Key && GCPhys <= pPhys->Core.KeyLast);
         Assert((pPhys->Core.Key     & PAGE_OFFSET_MASK) == 0);
@@ -2335,7 +2329,7 @@ static VBOXSTRICTRC pgmPhysReadHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys,
         pgmLock(pVM);
 
 #ifdef VBOX_WITH_STATISTICS
-        pPhys = pgmHandlerPhysicalLookup(pVM, GCPhys);
+        pPhys = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
         if (pPhys)
             STAM_PROFILE_STOP(&pPhys->Stat, h);
 #else
@@ -2603,7 +2597,7 @@ static VBOXSTRICTRC pgmPhysWriteHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
     if (   !PGM_PAGE_HAS_ACTIVE_VIRTUAL_HANDLERS(pPage)
         || PGM_PAGE_IS_MMIO_OR_SPECIAL_ALIAS(pPage) /* screw virtual handlers on MMIO pages */)
     {
-        PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+        PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
         if (pCur)
         {
             Assert(GCPhys >= pCur->Core.Key && GCPhys <= pCur->Core.KeyLast);
@@ -2636,7 +2630,7 @@ static VBOXSTRICTRC pgmPhysWriteHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
                 pgmLock(pVM);
 
 #ifdef VBOX_WITH_STATISTICS
-                pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+                pCur = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
                 if (pCur)
                     STAM_PROFILE_STOP(&pCur->Stat, h);
 #else
@@ -2815,7 +2809,7 @@ static VBOXSTRICTRC pgmPhysWriteHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
 
         if (fMorePhys && !pPhys)
         {
-            pPhys = pgmHandlerPhysicalLookup(pVM, GCPhys);
+            pPhys = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
             if (pPhys)
             {
                 offPhys = 0;
@@ -2881,7 +2875,7 @@ static VBOXSTRICTRC pgmPhysWriteHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
             pgmLock(pVM);
 
 #ifdef VBOX_WITH_STATISTICS
-            pPhys = pgmHandlerPhysicalLookup(pVM, GCPhys);
+            pPhys = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
             if (pPhys)
                 STAM_PROFILE_STOP(&pPhys->Stat, h);
 #else
@@ -2954,7 +2948,7 @@ static VBOXSTRICTRC pgmPhysWriteHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys
             pgmLock(pVM);
 
 # ifdef VBOX_WITH_STATISTICS
-            pPhys = pgmHandlerPhysicalLookup(pVM, GCPhys);
+            pPhys = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhys);
             if (pPhys)
                 STAM_PROFILE_STOP(&pPhys->Stat, h);
 # else
@@ -135,13 +135,20 @@
  *
  * @section sec_gmm_numa        NUMA
  *
- * NUMA considerations will be designed and implemented a bit later.
+ * The VMM in ring-3 can bind the EMTs to the CPUs of a host NUMA node
+ * (GMMR3InitNuma) and then tells us which node each vCPU is on
+ * (GMMR0SetNumaNode).  Chunks are allocated on the EMTs, so the host will
+ * normally back them with memory from the node the EMT is running on, and we
+ * tag each new chunk with the node of the allocating vCPU.
  *
- * The preliminary guesses is that we will have to try allocate memory as
- * close as possible to the CPUs the VM is executed on (EMT and additional CPU
- * threads). Which means it's mostly about allocation and sharing policies.
- * Both the scheduler and allocator interface will to supply some NUMA info
- * and we'll need to have a way to calc access costs.
+ * When handing out pages we prefer chunks on the node of the calling vCPU,
+ * both among the chunks associated with the VM and when picking up empty
+ * chunks or chunks of other VMs.  Chunks on other nodes are only used when
+ * the allocation can't be satisfied otherwise.  Only the EMT binding tells us
+ * about nodes, so VMs which aren't bound behave as before.
+ *
+ * GMMR0QueryStatistics reports how many of a VM's chunks are on nodes its
+ * vCPUs are bound to and how many are not.
  *
  */
 
@@ -428,8 +435,8 @@ typedef struct GMMCHUNK
      * When in bound memory mode this isn't a preference any longer.  (Giant
      * mtx.) */
     uint16_t            hGVM;
-    /** The ID of the NUMA node the memory mostly resides on.  (Reserved for
-     *  future use.)  (Giant mtx.) */
+    /** The ID of the NUMA node the memory mostly resides on, i.e. the node the
+     *  allocating vCPU was bound to.  (Giant mtx.) */
     uint16_t            idNumaNode;
     /** The number of private pages.  (Giant mtx.) */
     uint16_t            cPrivate;
@@ -952,6 +959,8 @@ GMMR0DECL(void) GMMR0InitPerVMData(PGVM pGVM)
     pGVM->gmm.s.Stats.enmPolicy = GMMOCPOLICY_INVALID;
     pGVM->gmm.s.Stats.enmPriority = GMMPRIORITY_INVALID;
     pGVM->gmm.s.Stats.fMayAllocate = false;
+    for (unsigned i = 0; i < RT_ELEMENTS(pGVM->gmm.s.aidNumaNodes); i++)
+        pGVM->gmm.s.aidNumaNodes[i] = GMM_CHUNK_NUMA_ID_UNKNOWN;
 }
 
 
@@ -1202,17 +1211,33 @@ static int gmmR0ChunkMutexDropGiant(PGMMR0CHUNKMTXSTATE pMtxState)
 
 
 /**
- * For experimenting with NUMA affinity and such.
+ * Gets the NUMA node the calling EMT is bound to.
  *
- * @returns The current NUMA Node ID.
+ * @returns The NUMA node ID, GMM_CHUNK_NUMA_ID_UNKNOWN if the caller isn't an
+ *          EMT of the VM or isn't bound to any node.
+ * @param   pGVM        Pointer to the global VM structure.
  */
-static uint16_t gmmR0GetCurrentNumaNodeId(void)
+static uint16_t gmmR0GetCurrentNumaNodeId(PGVM pGVM)
 {
-#if 1
+    RTNATIVETHREAD const hNativeSelf = RTThreadNativeSelf();
+    for (VMCPUID idCpu = 0; idCpu < pGVM->cCpus; idCpu++)
+        if (pGVM->aCpus[idCpu].hEMT == hNativeSelf)
+            return pGVM->gmm.s.aidNumaNodes[idCpu];
     return GMM_CHUNK_NUMA_ID_UNKNOWN;
-#else
-    return RTMpCpuId() / 16;
-#endif
+}
+
+
+/**
+ * Checks if a chunk is on the given NUMA node.
+ *
+ * @returns true if it is or if @a idNumaNode is unknown, false if not.
+ * @param   pChunk      The chunk.
+ * @param   idNumaNode  The NUMA node ID, GMM_CHUNK_NUMA_ID_UNKNOWN for any.
+ */
+DECLINLINE(bool) gmmR0IsChunkOnNumaNode(PGMMCHUNK pChunk, uint16_t idNumaNode)
+{
+    return idNumaNode == GMM_CHUNK_NUMA_ID_UNKNOWN
+        || pChunk->idNumaNode == idNumaNode;
 }
 
 
@@ -2113,6 +2138,8 @@ static uint32_t gmmR0AllocatePagesFromChunk(PGMMCHUNK pChunk, uint16_t const hGV
  * @param   MemObj      The memory object for the chunk.
  * @param   hGVM        The affinity of the chunk. NIL_GVM_HANDLE for no
  *                      affinity.
+ * @param   idNumaNode  The NUMA node the memory was allocated on,
+ *                      GMM_CHUNK_NUMA_ID_UNKNOWN if not known.
  * @param   fChunkFlags The chunk flags, GMM_CHUNK_FLAGS_XXX.
  * @param   ppChunk     Chunk address (out).  Optional.
  *
@@ -2120,8 +2147,8 @@ static uint32_t gmmR0AllocatePagesFromChunk(PGMMCHUNK pChunk, uint16_t const hGV
  *          The giant GMM mutex will be acquired and returned acquired in
  *          the success path.   On failure, no locks will be held.
  */
-static int gmmR0RegisterChunk(PGMM pGMM, PGMMCHUNKFREESET pSet, RTR0MEMOBJ MemObj, uint16_t hGVM, uint16_t fChunkFlags,
-                              PGMMCHUNK *ppChunk)
+static int gmmR0RegisterChunk(PGMM pGMM, PGMMCHUNKFREESET pSet, RTR0MEMOBJ MemObj, uint16_t hGVM, uint16_t idNumaNode,
+                              uint16_t fChunkFlags, PGMMCHUNK *ppChunk)
 {
     Assert(pGMM->hMtxOwner != RTThreadNativeSelf());
     Assert(hGVM != NIL_GVM_HANDLE || pGMM->fBoundMemoryMode);
@@ -2138,7 +2165,7 @@ static int gmmR0RegisterChunk(PGMM pGMM, PGMMCHUNKFREESET pSet, RTR0MEMOBJ MemOb
         pChunk->cFree       = GMM_CHUNK_NUM_PAGES;
         pChunk->hGVM        = hGVM;
         /*pChunk->iFreeHead = 0;*/
-        pChunk->idNumaNode  = gmmR0GetCurrentNumaNodeId();
+        pChunk->idNumaNode  = idNumaNode;
         pChunk->iChunkMtx   = UINT8_MAX;
         pChunk->fFlags      = fChunkFlags;
         for (unsigned iPage = 0; iPage < RT_ELEMENTS(pChunk->aPages) - 1; iPage++)
@@ -2218,7 +2245,7 @@ static int gmmR0AllocateChunkNew(PGMM pGMM, PGVM pGVM, PGMMCHUNKFREESET pSet, ui
  *        free pages first and then unchaining them right afterwards. Instead
  *        do as much work as possible without holding the giant lock. */
         PGMMCHUNK pChunk;
-        rc = gmmR0RegisterChunk(pGMM, pSet, hMemObj, pGVM->hSelf, 0 /*fChunkFlags*/, &pChunk);
+        rc = gmmR0RegisterChunk(pGMM, pSet, hMemObj, pGVM->hSelf, gmmR0GetCurrentNumaNodeId(pGVM), 0 /*fChunkFlags*/, &pChunk);
         if (RT_SUCCESS(rc))
         {
             *piPage = gmmR0AllocatePagesFromChunk(pChunk, pGVM->hSelf, *piPage, cPages, paPages);
@@ -2284,12 +2311,12 @@ static uint32_t gmmR0AllocatePagesFromEmptyChunksOnSameNode(PGMMCHUNKFREESET pSe
     PGMMCHUNK pChunk = pSet->apLists[GMM_CHUNK_FREE_SET_UNUSED_LIST];
     if (pChunk)
     {
-        uint16_t const idNumaNode = gmmR0GetCurrentNumaNodeId();
+        uint16_t const idNumaNode = gmmR0GetCurrentNumaNodeId(pGVM);
         while (pChunk)
         {
             PGMMCHUNK pNext = pChunk->pFreeNext;
 
-            if (pChunk->idNumaNode == idNumaNode)
+            if (gmmR0IsChunkOnNumaNode(pChunk, idNumaNode))
             {
                 pChunk->hGVM = pGVM->hSelf;
                 iPage = gmmR0AllocatePagesFromChunk(pChunk, pGVM->hSelf, iPage, cPages, paPages);
@@ -2321,7 +2348,7 @@ static uint32_t gmmR0AllocatePagesFromSameNode(PGMMCHUNKFREESET pSet, PGVM pGVM,
                                                uint32_t iPage, uint32_t cPages, PGMMPAGEDESC paPages)
 {
     /** @todo start by picking from chunks with about the right size first?  */
-    uint16_t const  idNumaNode = gmmR0GetCurrentNumaNodeId();
+    uint16_t const  idNumaNode = gmmR0GetCurrentNumaNodeId(pGVM);
     unsigned        iList      = GMM_CHUNK_FREE_SET_UNUSED_LIST;
     while (iList-- > 0)
     {
@@ -2330,7 +2357,7 @@ static uint32_t gmmR0AllocatePagesFromSameNode(PGMMCHUNKFREESET pSet, PGVM pGVM,
         {
             PGMMCHUNK pNext = pChunk->pFreeNext;
 
-            if (pChunk->idNumaNode == idNumaNode)
+            if (gmmR0IsChunkOnNumaNode(pChunk, idNumaNode))
             {
                 iPage = gmmR0AllocatePagesFromChunk(pChunk, pGVM->hSelf, iPage, cPages, paPages);
                 if (iPage >= cPages)
@@ -2361,13 +2388,14 @@ static uint32_t gmmR0AllocatePagesFromSameNode(PGMMCHUNKFREESET pSet, PGVM pGVM,
 static uint32_t gmmR0AllocatePagesAssociatedWithVM(PGMM pGMM, PGVM pGVM, PGMMCHUNKFREESET pSet,
                                                    uint32_t iPage, uint32_t cPages, PGMMPAGEDESC paPages)
 {
-    uint16_t const hGVM = pGVM->hSelf;
+    uint16_t const hGVM       = pGVM->hSelf;
+    uint16_t const idNumaNode = gmmR0GetCurrentNumaNodeId(pGVM);
 
     /* Hint. */
     if (pGVM->gmm.s.idLastChunkHint != NIL_GMM_CHUNKID)
     {
         PGMMCHUNK pChunk = gmmR0GetChunk(pGMM, pGVM->gmm.s.idLastChunkHint);
-        if (pChunk && pChunk->cFree)
+        if (pChunk && pChunk->cFree && gmmR0IsChunkOnNumaNode(pChunk, idNumaNode))
         {
             iPage = gmmR0AllocatePagesFromChunk(pChunk, hGVM, iPage, cPages, paPages);
             if (iPage >= cPages)
@@ -2375,27 +2403,29 @@ static uint32_t gmmR0AllocatePagesAssociatedWithVM(PGMM pGMM, PGVM pGVM, PGMMCHU
         }
     }
 
-    /* Scan. */
-    for (unsigned iList = 0; iList < RT_ELEMENTS(pSet->apLists); iList++)
-    {
-        PGMMCHUNK pChunk = pSet->apLists[iList];
-        while (pChunk)
+    /* Scan, first for chunks on our NUMA node and then for the rest. */
+    for (unsigned iPass = idNumaNode != GMM_CHUNK_NUMA_ID_UNKNOWN ? 0 : 1; iPass < 2; iPass++)
+        for (unsigned iList = 0; iList < RT_ELEMENTS(pSet->apLists); iList++)
         {
-            PGMMCHUNK pNext = pChunk->pFreeNext;
-
-            if (pChunk->hGVM == hGVM)
+            PGMMCHUNK pChunk = pSet->apLists[iList];
+            while (pChunk)
             {
-                iPage = gmmR0AllocatePagesFromChunk(pChunk, hGVM, iPage, cPages, paPages);
-                if (iPage >= cPages)
+                PGMMCHUNK pNext = pChunk->pFreeNext;
+
+                if (   pChunk->hGVM == hGVM
+                    && (iPass > 0 || pChunk->idNumaNode == idNumaNode))
                 {
-                    pGVM->gmm.s.idLastChunkHint = pChunk->cFree ? pChunk->Core.Key : NIL_GMM_CHUNKID;
-                    return iPage;
+                    iPage = gmmR0AllocatePagesFromChunk(pChunk, hGVM, iPage, cPages, paPages);
+                    if (iPage >= cPages)
+                    {
+                        pGVM->gmm.s.idLastChunkHint = pChunk->cFree ? pChunk->Core.Key : NIL_GMM_CHUNKID;
+                        return iPage;
+                    }
                 }
-            }
 
-            pChunk = pNext;
+                pChunk = pNext;
+            }
         }
-    }
     return iPage;
 }
 
@@ -2412,19 +2442,25 @@ static uint32_t gmmR0AllocatePagesAssociatedWithVM(PGMM pGMM, PGVM pGVM, PGMMCHU
  */
 static uint32_t gmmR0AllocatePagesInBoundMode(PGVM pGVM, uint32_t iPage, uint32_t cPages, PGMMPAGEDESC paPages)
 {
-    for (unsigned iList = 0; iList < RT_ELEMENTS(pGVM->gmm.s.Private.apLists); iList++)
-    {
-        PGMMCHUNK pChunk = pGVM->gmm.s.Private.apLists[iList];
-        while (pChunk)
+    /* Chunks on our NUMA node first, then the rest. */
+    uint16_t const idNumaNode = gmmR0GetCurrentNumaNodeId(pGVM);
+    for (unsigned iPass = idNumaNode != GMM_CHUNK_NUMA_ID_UNKNOWN ? 0 : 1; iPass < 2; iPass++)
+        for (unsigned iList = 0; iList < RT_ELEMENTS(pGVM->gmm.s.Private.apLists); iList++)
         {
-            Assert(pChunk->hGVM == pGVM->hSelf);
-            PGMMCHUNK pNext = pChunk->pFreeNext;
-            iPage = gmmR0AllocatePagesFromChunk(pChunk, pGVM->hSelf, iPage, cPages, paPages);
-            if (iPage >= cPages)
-                return iPage;
-            pChunk = pNext;
+            PGMMCHUNK pChunk = pGVM->gmm.s.Private.apLists[iList];
+            while (pChunk)
+            {
+                Assert(pChunk->hGVM == pGVM->hSelf);
+                PGMMCHUNK pNext = pChunk->pFreeNext;
+                if (iPass > 0 || pChunk->idNumaNode == idNumaNode)
+                {
+                    iPage = gmmR0AllocatePagesFromChunk(pChunk, pGVM->hSelf, iPage, cPages, paPages);
+                    if (iPage >= cPages)
+                        return iPage;
+                }
+                pChunk = pNext;
+            }
         }
-    }
     return iPage;
 }
 
@@ -3076,7 +3112,8 @@ GMMR0DECL(int)  GMMR0AllocateLargePage(PVM pVM, VMCPUID idCpu, uint32_t cbPage,
         {
             PGMMCHUNKFREESET pSet = pGMM->fBoundMemoryMode ? &pGVM->gmm.s.Private : &pGMM->PrivateX;
             PGMMCHUNK pChunk;
-            rc = gmmR0RegisterChunk(pGMM, pSet, hMemObj, pGVM->hSelf, GMM_CHUNK_FLAGS_LARGE_PAGE, &pChunk);
+            rc = gmmR0RegisterChunk(pGMM, pSet, hMemObj, pGVM->hSelf, gmmR0GetCurrentNumaNodeId(pGVM),
+                                    GMM_CHUNK_FLAGS_LARGE_PAGE, &pChunk);
             if (RT_SUCCESS(rc))
             {
                 /*
@@ -4268,7 +4305,8 @@ GMMR0DECL(int) GMMR0SeedChunk(PVM pVM, VMCPUID idCpu, RTR3PTR pvR3)
     rc = RTR0MemObjLockUser(&MemObj, pvR3, GMM_CHUNK_SIZE, RTMEM_PROT_READ | RTMEM_PROT_WRITE, NIL_RTR0PROCESS);
     if (RT_SUCCESS(rc))
     {
-        rc = gmmR0RegisterChunk(pGMM, &pGVM->gmm.s.Private, MemObj, pGVM->hSelf, 0 /*fChunkFlags*/, NULL);
+        rc = gmmR0RegisterChunk(pGMM, &pGVM->gmm.s.Private, MemObj, pGVM->hSelf, gmmR0GetCurrentNumaNodeId(pGVM),
+                                0 /*fChunkFlags*/, NULL);
         if (RT_SUCCESS(rc))
             gmmR0MutexRelease(pGMM);
         else
@@ -4279,6 +4317,46 @@ GMMR0DECL(int) GMMR0SeedChunk(PVM pVM, VMCPUID idCpu, RTR3PTR pvR3)
     return rc;
 }
 
+
+/**
+ * Tells GMM which host NUMA node the EMT of a vCPU is bound to.
+ *
+ * Chunks allocated by this vCPU will be tagged with this node and preferred
+ * when it allocates pages.  See @ref sec_gmm_numa.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   idCpu       The VCPU id of the calling EMT.
+ * @param   idNumaNode  The host NUMA node, UINT32_MAX if not bound.
+ *
+ * @thread  EMT(idCpu)
+ */
+GMMR0DECL(int) GMMR0SetNumaNode(PVM pVM, VMCPUID idCpu, uint32_t idNumaNode)
+{
+    LogFlow(("GMMR0SetNumaNode: pVM=%p idCpu=%u idNumaNode=%#x\n", pVM, idCpu, idNumaNode));
+
+    /*
+     * Validate input and get the basics.
+     */
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    PGVM pGVM;
+    int rc = GVMMR0ByVMAndEMT(pVM, idCpu, &pGVM);
+    if (RT_FAILURE(rc))
+        return rc;
+    AssertMsgReturn(idNumaNode < GMM_CHUNK_NUMA_ID_UNKNOWN || idNumaNode == UINT32_MAX,
+                    ("%#x\n", idNumaNode), VERR_INVALID_PARAMETER);
+    AssertReturn(idCpu < RT_ELEMENTS(pGVM->gmm.s.aidNumaNodes), VERR_INVALID_CPU_ID);
+
+    rc = gmmR0MutexAcquire(pGMM);
+    if (RT_SUCCESS(rc))
+    {
+        pGVM->gmm.s.aidNumaNodes[idCpu] = idNumaNode == UINT32_MAX ? GMM_CHUNK_NUMA_ID_UNKNOWN : (uint16_t)idNumaNode;
+        gmmR0MutexRelease(pGMM);
+    }
+    return rc;
+}
+
 #ifdef VBOX_WITH_PAGE_SHARING
 
 # ifdef VBOX_STRICT
@@ -5351,6 +5429,43 @@ GMMR0DECL(int) GMMR0FindDuplicatePageReq(PVM pVM, PGMMFINDDUPLICATEPAGEREQ pReq)
 #endif /* VBOX_STRICT && HC_ARCH_BITS == 64 */
 
 
+/**
+ * Counts the chunks associated with a VM by NUMA locality.
+ *
+ * Chunks on a node one of the vCPUs is bound to count as local, chunks on
+ * other nodes as remote.  Chunks of unknown locality aren't counted.
+ *
+ * @param   pGMM            Pointer to the GMM instance data.
+ * @param   pGVM            Pointer to the global VM structure.
+ * @param   pcLocal         Where to return the number of local chunks.
+ * @param   pcRemote        Where to return the number of remote chunks.
+ *
+ * @remarks Caller owns the giant GMM mutex.
+ */
+static void gmmR0CountNumaChunks(PGMM pGMM, PGVM pGVM, uint64_t *pcLocal, uint64_t *pcRemote)
+{
+    uint64_t  cLocal  = 0;
+    uint64_t  cRemote = 0;
+    PGMMCHUNK pChunk;
+    RTListForEach(&pGMM->ChunkList, pChunk, GMMCHUNK, ListNode)
+    {
+        if (   pChunk->hGVM != pGVM->hSelf
+            || pChunk->idNumaNode == GMM_CHUNK_NUMA_ID_UNKNOWN)
+            continue;
+
+        bool fLocal = false;
+        for (VMCPUID idCpu = 0; idCpu < pGVM->cCpus && !fLocal; idCpu++)
+            fLocal = pGVM->gmm.s.aidNumaNodes[idCpu] == pChunk->idNumaNode;
+        if (fLocal)
+            cLocal++;
+        else
+            cRemote++;
+    }
+    *pcLocal  = cLocal;
+    *pcRemote = cRemote;
+}
+
+
 /**
  * Retrieves the GMM statistics visible to the caller.
  *
@@ -5406,13 +5521,17 @@ GMMR0DECL(int) GMMR0QueryStatistics(PGMMSTATS pStats, PSUPDRVSESSION pSession, P
     pStats->cChunks                     = pGMM->cChunks;
     pStats->cFreedChunks                = pGMM->cFreedChunks;
     pStats->cShareableModules           = pGMM->cShareableModules;
-    RT_ZERO(pStats->au64Reserved);
+    pStats->cNumaLocalChunks            = 0;
+    pStats->cNumaRemoteChunks           = 0;
 
     /*
      * Copy out the VM statistics.
      */
     if (pGVM)
+    {
         pStats->VMStats = pGVM->gmm.s.Stats;
+        gmmR0CountNumaChunks(pGMM, pGVM, &pStats->cNumaLocalChunks, &pStats->cNumaRemoteChunks);
+    }
     else
         RT_ZERO(pStats->VMStats);
 
@@ -81,6 +81,9 @@ typedef struct GMMPERVM
     PAVLGCPTRNODECORE   pSharedModuleTree;
     /** Hints at the last chunk we allocated some memory from. */
     uint32_t            idLastChunkHint;
+    /** The host NUMA node each vCPU's EMT is bound to,
+     * GMM_CHUNK_NUMA_ID_UNKNOWN if not bound. */
+    uint16_t            aidNumaNodes[VMM_MAX_CPU_COUNT];
 } GMMPERVM;
 /** Pointer to the per-VM GMM data. */
 typedef GMMPERVM *PGMMPERVM;
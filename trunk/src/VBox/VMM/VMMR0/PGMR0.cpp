@@ -557,7 +557,7 @@ VMMR0DECL(VBOXSTRICTRC) PGMR0Trap0eHandlerNPMisconfig(PVM pVM, PVMCPU pVCpu, PGM
      * Try lookup the all access physical handler for the address.
      */
     pgmLock(pVM);
-    PPGMPHYSHANDLER         pHandler     = pgmHandlerPhysicalLookup(pVM, GCPhysFault);
+    PPGMPHYSHANDLER         pHandler     = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhysFault);
     PPGMPHYSHANDLERTYPEINT  pHandlerType = RT_LIKELY(pHandler) ? PGMPHYSHANDLER_GET_TYPE(pVM, pHandler) : NULL;
     if (RT_LIKELY(pHandler && pHandlerType->enmKind != PGMPHYSHANDLERKIND_WRITE))
     {
@@ -592,7 +592,7 @@ VMMR0DECL(VBOXSTRICTRC) PGMR0Trap0eHandlerNPMisconfig(PVM pVM, PVMCPU pVCpu, PGM
 
 #ifdef VBOX_WITH_STATISTICS
                 pgmLock(pVM);
-                pHandler = pgmHandlerPhysicalLookup(pVM, GCPhysFault);
+                pHandler = pgmHandlerPhysicalLookup(pVM, pVCpu, GCPhysFault);
                 if (pHandler)
                     STAM_PROFILE_STOP(&pHandler->Stat, h);
                 pgmUnlock(pVM);
@@ -1667,6 +1667,13 @@ static int vmmR0EntryExWorker(PVM pVM, VMCPUID idCpu, VMMR0OPERATION enmOperatio
             VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
             break;
 
+        case VMMR0_DO_GMM_SET_NUMA_NODE:
+            if (pReqHdr || u64Arg > UINT32_MAX)
+                return VERR_INVALID_PARAMETER;
+            rc = GMMR0SetNumaNode(pVM, idCpu, (uint32_t)u64Arg);
+            VMM_CHECK_SMAP_CHECK2(pVM, RT_NOTHING);
+            break;
+
         case VMMR0_DO_GMM_REGISTER_SHARED_MODULE:
             if (idCpu == NIL_VMCPUID)
                 return VERR_INVALID_CPU_ID;
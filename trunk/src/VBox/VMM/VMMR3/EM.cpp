@@ -2505,6 +2505,7 @@ VMMR3_INT_DECL(int) EMR3ExecuteVM(PVM pVM, PVMCPU pVCpu)
                 case EMSTATE_RAW:
 #ifdef VBOX_WITH_RAW_MODE
                     rc = emR3RawExecute(pVM, pVCpu, &fFFDone);
+                    IEMTlbInvalidateAll(pVCpu);
 #else
                     AssertLogRelMsgFailed(("%Rrc\n", rc));
                     rc = VERR_EM_INTERNAL_ERROR;
@@ -2516,6 +2517,7 @@ VMMR3_INT_DECL(int) EMR3ExecuteVM(PVM pVM, PVMCPU pVCpu)
                  */
                 case EMSTATE_HM:
                     rc = emR3HmExecute(pVM, pVCpu, &fFFDone);
+                    IEMTlbInvalidateAll(pVCpu); /* The guest may have changed its page tables behind our back. */
                     break;
 
                 /*
@@ -2523,6 +2525,9 @@ VMMR3_INT_DECL(int) EMR3ExecuteVM(PVM pVM, PVMCPU pVCpu)
                  */
                 case EMSTATE_REM:
                     rc = emR3RemExecute(pVM, pVCpu, &fFFDone);
+#ifdef VBOX_WITH_REM
+                    IEMTlbInvalidateAll(pVCpu);
+#endif
                     Log2(("EMR3ExecuteVM: emR3RemExecute -> %Rrc\n", rc));
                     break;
 
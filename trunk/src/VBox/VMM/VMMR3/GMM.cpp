@@ -22,6 +22,7 @@
 #define LOG_GROUP LOG_GROUP_GMM
 #include <VBox/vmm/gmm.h>
 #include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/vm.h>
 #include <VBox/sup.h>
 #include <VBox/err.h>
@@ -29,8 +30,13 @@
 
 #include <iprt/assert.h>
 #include <VBox/log.h>
+#include <iprt/cpuset.h>
 #include <iprt/mem.h>
 #include <iprt/string.h>
+#include <iprt/thread.h>
+#ifdef RT_OS_LINUX
+# include <iprt/linux/sysfs.h>
+#endif
 
 
 /**
@@ -386,6 +392,117 @@ GMMR3DECL(int)  GMMR3SeedChunk(PVM pVM, RTR3PTR pvR3)
 }
 
 
+/**
+ * Gets the set of host CPUs making up a NUMA node.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if the host NUMA topology isn't known.
+ * @param   idNumaNode  The host NUMA node.
+ * @param   pCpuSet     Where to return the CPU set.
+ */
+static int gmmR3QueryNumaNodeCpuSet(uint32_t idNumaNode, PRTCPUSET pCpuSet)
+{
+    RTCpuSetEmpty(pCpuSet);
+#ifdef RT_OS_LINUX
+    /* The cpulist file has the form "0-7,16-23". */
+    char szCpuList[1024];
+    int rc = RTLinuxSysFsReadStrFile(szCpuList, sizeof(szCpuList), NULL, "devices/system/node/node%u/cpulist", idNumaNode);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    char *psz = RTStrStrip(szCpuList);
+    while (*psz)
+    {
+        uint32_t idFirst;
+        rc = RTStrToUInt32Ex(psz, &psz, 10, &idFirst);
+        if (rc != VINF_SUCCESS && rc != VWRN_TRAILING_CHARS)
+            return VERR_PARSE_ERROR;
+        uint32_t idLast = idFirst;
+        if (*psz == '-')
+        {
+            rc = RTStrToUInt32Ex(psz + 1, &psz, 10, &idLast);
+            if ((rc != VINF_SUCCESS && rc != VWRN_TRAILING_CHARS) || idLast < idFirst)
+                return VERR_PARSE_ERROR;
+        }
+        for (uint32_t idCpu = idFirst; idCpu <= idLast; idCpu++)
+            RTCpuSetAdd(pCpuSet, idCpu);
+
+        if (*psz == ',')
+            psz++;
+        else if (*psz)
+            return VERR_PARSE_ERROR;
+    }
+    return RTCpuSetCount(pCpuSet) > 0 ? VINF_SUCCESS : VERR_NOT_FOUND;
+#else
+    NOREF(idNumaNode);
+    return VERR_NOT_SUPPORTED;
+#endif
+}
+
+
+/**
+ * Binds the calling EMT to the CPUs of a host NUMA node and tells GMM.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   idNumaNode  The host NUMA node.
+ * @thread  EMT
+ */
+static DECLCALLBACK(int) gmmR3NumaBindEmt(PVM pVM, uint32_t idNumaNode)
+{
+    RTCPUSET CpuSet;
+    int rc = gmmR3QueryNumaNodeCpuSet(idNumaNode, &CpuSet);
+    if (RT_SUCCESS(rc))
+        rc = RTThreadSetAffinity(&CpuSet);
+    if (RT_SUCCESS(rc))
+        rc = VMMR3CallR0(pVM, VMMR0_DO_GMM_SET_NUMA_NODE, idNumaNode, NULL);
+    return rc;
+}
+
+
+/**
+ * Binds the EMTs to host NUMA nodes according to the configuration.
+ *
+ * This must be done before guest memory is allocated, as GMM allocates chunks
+ * on the EMTs and prefers the node of the allocating vCPU.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @thread  EMT(0)
+ */
+GMMR3DECL(int) GMMR3InitNuma(PVM pVM)
+{
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "GMM");
+
+    /** @cfgm{/GMM/NumaNode, uint32_t, UINT32_MAX}
+     * The host NUMA node to bind all EMTs to and to allocate guest memory from.
+     * UINT32_MAX means no binding. */
+    uint32_t idNumaNodeVM;
+    int rc = CFGMR3QueryU32Def(pCfg, "NumaNode", &idNumaNodeVM, UINT32_MAX);
+    AssertLogRelRCReturn(rc, rc);
+
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        /** @cfgm{/GMM/NumaNodeCPU\#, uint32_t, /GMM/NumaNode}
+         * The host NUMA node for the EMT of vCPU \#, overriding /GMM/NumaNode. */
+        char szName[32];
+        RTStrPrintf(szName, sizeof(szName), "NumaNodeCPU%u", idCpu);
+        uint32_t idNumaNode;
+        rc = CFGMR3QueryU32Def(pCfg, szName, &idNumaNode, idNumaNodeVM);
+        AssertLogRelRCReturn(rc, rc);
+        if (idNumaNode == UINT32_MAX)
+            continue;
+
+        rc = VMR3ReqCallWait(pVM, idCpu, (PFNRT)gmmR3NumaBindEmt, 2, pVM, idNumaNode);
+        if (RT_FAILURE(rc))
+            return VMSetError(pVM, rc, RT_SRC_POS, N_("Failed to bind vCPU %u to host NUMA node %u (%Rrc)"),
+                              idCpu, idNumaNode, rc);
+        LogRel(("GMM: vCPU %u bound to host NUMA node %u\n", idCpu, idNumaNode));
+    }
+    return VINF_SUCCESS;
+}
+
+
 /**
  * @see GMMR0RegisterSharedModule
  */
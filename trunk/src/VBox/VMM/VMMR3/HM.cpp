@@ -483,10 +483,12 @@ VMMR3_INT_DECL(int) HMR3Init(PVM pVM)
     rc = CFGMR3QueryBoolDef(pCfgHm, "EnableUX", &pVM->hm.s.vmx.fAllowUnrestricted, true);
     AssertRCReturn(rc, rc);
 
-    /** @cfgm{/HM/EnableLargePages, bool, false}
+    /** @cfgm{/HM/EnableLargePages, bool, true}
      * Enables using large pages (2 MB) for guest memory, thus saving on (nested)
-     * page table walking and maybe better TLB hit rate in some cases. */
-    rc = CFGMR3QueryBoolDef(pCfgHm, "EnableLargePages", &pVM->hm.s.fLargePages, false);
+     * page table walking and maybe better TLB hit rate in some cases.  Ranges
+     * that end up backed by 4 KB pages are migrated by the PGM large page
+     * compaction, see /PGM/LargePageCompactInterval. */
+    rc = CFGMR3QueryBoolDef(pCfgHm, "EnableLargePages", &pVM->hm.s.fLargePages, true);
     AssertRCReturn(rc, rc);
 
     /** @cfgm{/HM/EnableVPID, bool, false}
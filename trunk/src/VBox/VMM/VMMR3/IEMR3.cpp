@@ -84,6 +84,10 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
                         "Approx bytes written",              "/IEM/CPU%u/cbWritten", idCpu);
         STAMR3RegisterF(pVM, &pVCpu->iem.s.cPendingCommit,            STAMTYPE_U32,       STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
                         "Times RC/R0 had to postpone instruction committing to ring-3", "/IEM/CPU%u/cPendingCommit", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.CodeTlb.cHits,             STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                        "Instruction fetch TLB hits",        "/IEM/CPU%u/CodeTlb/cHits", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.CodeTlb.cMisses,           STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                        "Instruction fetch TLB misses",      "/IEM/CPU%u/CodeTlb/cMisses", idCpu);
 
         /*
          * Host and guest CPU information.
@@ -124,6 +128,12 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
         uint32_t iMemMap = RT_ELEMENTS(pVCpu->iem.s.aMemMappings);
         while (iMemMap-- > 0)
             pVCpu->iem.s.aMemMappings[iMemMap].fAccess = IEM_ACCESS_INVALID;
+
+        /*
+         * Start the instruction fetch TLB at a non-zero revision so the zeroed
+         * entries never match.
+         */
+        pVCpu->iem.s.CodeTlb.uRevision = IEMCODETLB_REVISION_INCR;
     }
     return VINF_SUCCESS;
 }
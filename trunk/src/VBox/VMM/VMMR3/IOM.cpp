@@ -122,7 +122,9 @@
 #include <VBox/param.h>
 #include <iprt/assert.h>
 #include <iprt/alloc.h>
+#include <iprt/asm.h>
 #include <iprt/string.h>
+#include <iprt/thread.h>
 #include <VBox/log.h>
 #include <VBox/err.h>
 
@@ -133,6 +135,8 @@
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 static void iomR3FlushCache(PVM pVM);
+static void iomR3IOPortMapRebuild(PVM pVM);
+static void iomR3MmioLookupRebuild(PVM pVM);
 static DECLCALLBACK(int) iomR3RelocateIOPortCallback(PAVLROIOPORTNODECORE pNode, void *pvUser);
 static DECLCALLBACK(int) iomR3RelocateMMIOCallback(PAVLROGCPHYSNODECORE pNode, void *pvUser);
 static DECLCALLBACK(void) iomR3IOPortInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
@@ -188,6 +192,24 @@ VMMR3_INT_DECL(int) IOMR3Init(PVM pVM)
         pVM->iom.s.pTreesRC = MMHyperR3ToRC(pVM, pVM->iom.s.pTreesR3);
         pVM->iom.s.pTreesR0 = MMHyperR3ToR0(pVM, pVM->iom.s.pTreesR3);
 
+        /*
+         * Allocate the direct I/O port map and the MMIO range lookup.  Both
+         * start out zeroed, i.e. all ports in slot 0 and no MMIO ranges.
+         */
+        rc = MMR3HyperAllocOnceNoRel(pVM, sizeof(*pVM->iom.s.pIOPortMapR3), PAGE_SIZE, MM_TAG_IOM,
+                                     (void **)&pVM->iom.s.pIOPortMapR3);
+        AssertRCReturn(rc, rc);
+        pVM->iom.s.pIOPortMapRC = MMHyperR3ToRC(pVM, pVM->iom.s.pIOPortMapR3);
+        pVM->iom.s.pIOPortMapR0 = MMHyperR3ToR0(pVM, pVM->iom.s.pIOPortMapR3);
+        pVM->iom.s.pIOPortMapR3->cSlots = 1;
+
+        rc = MMR3HyperAllocOnceNoRel(pVM, sizeof(*pVM->iom.s.pMmioLookupR3), PAGE_SIZE, MM_TAG_IOM,
+                                     (void **)&pVM->iom.s.pMmioLookupR3);
+        AssertRCReturn(rc, rc);
+        pVM->iom.s.pMmioLookupRC = MMHyperR3ToRC(pVM, pVM->iom.s.pMmioLookupR3);
+        pVM->iom.s.pMmioLookupR0 = MMHyperR3ToR0(pVM, pVM->iom.s.pMmioLookupR3);
+        pVM->iom.s.pMmioLookupR3->uGeneration = 2;
+
         /*
          * Register the MMIO access handler type.
          */
@@ -233,10 +255,12 @@ VMMR3_INT_DECL(int) IOMR3Init(PVM pVM)
 #endif
             STAM_REG(pVM, &pVM->iom.s.StatRZInstOther,        STAMTYPE_COUNTER, "/IOM/RZ-MMIOHandler/Inst/Other",           STAMUNIT_OCCURENCES,     "Other instructions counter.");
             STAM_REG(pVM, &pVM->iom.s.StatR3MMIOHandler,      STAMTYPE_COUNTER, "/IOM/R3-MMIOHandler",                      STAMUNIT_OCCURENCES,     "Number of calls to iomR3MmioHandler.");
+            STAM_REG(pVM, &pVM->iom.s.StatMMIONoDevLock,      STAMTYPE_COUNTER, "/IOM/MMIONoDevLock",                       STAMUNIT_OCCURENCES,     "MMIO accesses not entering the device lock (IOMMMIO_FLAGS_NO_DEV_LOCK).");
             STAM_REG(pVM, &pVM->iom.s.StatInstIn,             STAMTYPE_COUNTER, "/IOM/IOWork/In",                           STAMUNIT_OCCURENCES,     "Counter of any IN instructions.");
             STAM_REG(pVM, &pVM->iom.s.StatInstOut,            STAMTYPE_COUNTER, "/IOM/IOWork/Out",                          STAMUNIT_OCCURENCES,     "Counter of any OUT instructions.");
             STAM_REG(pVM, &pVM->iom.s.StatInstIns,            STAMTYPE_COUNTER, "/IOM/IOWork/Ins",                          STAMUNIT_OCCURENCES,     "Counter of any INS instructions.");
             STAM_REG(pVM, &pVM->iom.s.StatInstOuts,           STAMTYPE_COUNTER, "/IOM/IOWork/Outs",                         STAMUNIT_OCCURENCES,     "Counter of any OUTS instructions.");
+            STAM_REG(pVM, &pVM->iom.s.StatIOPortNoDevLock,    STAMTYPE_COUNTER, "/IOM/IOWork/NoDevLock",                    STAMUNIT_OCCURENCES,     "I/O port accesses not entering the device lock (IOMIOPORT_FLAGS_NO_DEV_LOCK).");
         }
     }
 
@@ -293,6 +317,204 @@ static void iomR3FlushCache(PVM pVM)
 }
 
 
+/**
+ * Callback for iomR3IOPortMapRebuild that marks where a range starts and
+ * where the ports after it start.
+ *
+ * @returns 0 (continue enum)
+ * @param   pNode       The range node (any context).
+ * @param   pvUser      The boundary bitmap (_64K + 1 bits).
+ */
+static DECLCALLBACK(int) iomR3IOPortMapBoundaryCallback(PAVLROIOPORTNODECORE pNode, void *pvUser)
+{
+    ASMBitSet(pvUser, pNode->Key);
+    ASMBitSet(pvUser, (uint32_t)pNode->KeyLast + 1);
+    return 0;
+}
+
+
+/**
+ * Rebuilds the direct I/O port map from the range trees.
+ *
+ * Called after each change to the I/O port ranges.  The ports are split into
+ * runs covered by the same R3, R0 and RC ranges and each run gets a slot with
+ * copies of the range callbacks.  If there are more runs than slots, the map
+ * is disabled and the I/O port accessors go back to searching the trees.
+ *
+ * @param   pVM     The cross context VM structure.
+ */
+static void iomR3IOPortMapRebuild(PVM pVM)
+{
+    Assert(IOM_IS_EXCL_LOCK_OWNER(pVM));
+    PIOMIOPORTMAP   pMap   = pVM->iom.s.pIOPortMapR3;
+    PIOMTREES       pTrees = pVM->iom.s.pTreesR3;
+
+    /*
+     * Collect the run boundaries.
+     */
+    void *pvBitmap = RTMemTmpAllocZ((_64K + 64) / 8);
+
+    ASMAtomicIncU32(&pMap->uSeq);
+    Assert(pMap->uSeq & 1);
+    if (pvBitmap)
+    {
+        RTAvlroIOPortDoWithAll(&pTrees->IOPortTreeR3, true, iomR3IOPortMapBoundaryCallback, pvBitmap);
+        RTAvlroIOPortDoWithAll(&pTrees->IOPortTreeR0, true, iomR3IOPortMapBoundaryCallback, pvBitmap);
+        RTAvlroIOPortDoWithAll(&pTrees->IOPortTreeRC, true, iomR3IOPortMapBoundaryCallback, pvBitmap);
+
+        /*
+         * Fill the slots, slot 0 being the empty one for unclaimed ports.
+         */
+        RT_ZERO(pMap->aSlots[0]);
+        uint32_t cSlots = 1;
+        uint32_t uPort  = 0;
+        while (uPort < _64K)
+        {
+            int32_t  iNext    = ASMBitNextSet(pvBitmap, _64K + 64, uPort);
+            uint32_t uPortEnd = iNext > 0 && (uint32_t)iNext < _64K ? (uint32_t)iNext : _64K;
+
+            PIOMIOPORTRANGER3 pRangeR3 = (PIOMIOPORTRANGER3)RTAvlroIOPortGet(&pTrees->IOPortTreeR3, (RTIOPORT)uPort);
+            PIOMIOPORTRANGER0 pRangeR0 = (PIOMIOPORTRANGER0)RTAvlroIOPortGet(&pTrees->IOPortTreeR0, (RTIOPORT)uPort);
+            PIOMIOPORTRANGERC pRangeRC = (PIOMIOPORTRANGERC)RTAvlroIOPortGet(&pTrees->IOPortTreeRC, (RTIOPORT)uPort);
+            uint16_t          iSlot    = 0;
+            if (pRangeR3 || pRangeR0 || pRangeRC)
+            {
+                if (cSlots >= IOM_IOPORT_MAP_MAX_SLOTS)
+                {
+                    LogRel(("IOM: Too many I/O port ranges for the direct map, falling back on the range trees\n"));
+                    cSlots = UINT32_MAX;
+                    break;
+                }
+                iSlot = (uint16_t)cSlots++;
+                PIOMIOPORTSLOT pSlot = &pMap->aSlots[iSlot];
+                RT_ZERO(*pSlot);
+                if (pRangeR3)
+                {
+                    pSlot->EntryR3.pvUser            = pRangeR3->pvUser;
+                    pSlot->EntryR3.pDevIns           = pRangeR3->pDevIns;
+                    pSlot->EntryR3.pfnOutCallback    = pRangeR3->pfnOutCallback;
+                    pSlot->EntryR3.pfnInCallback     = pRangeR3->pfnInCallback;
+                    pSlot->EntryR3.pfnOutStrCallback = pRangeR3->pfnOutStrCallback;
+                    pSlot->EntryR3.pfnInStrCallback  = pRangeR3->pfnInStrCallback;
+                    pSlot->EntryR3.fFlags            = pRangeR3->fFlags;
+                }
+                if (pRangeR0)
+                {
+                    pSlot->EntryR0.pvUser            = pRangeR0->pvUser;
+                    pSlot->EntryR0.pDevIns           = pRangeR0->pDevIns;
+                    pSlot->EntryR0.pfnOutCallback    = pRangeR0->pfnOutCallback;
+                    pSlot->EntryR0.pfnInCallback     = pRangeR0->pfnInCallback;
+                    pSlot->EntryR0.pfnOutStrCallback = pRangeR0->pfnOutStrCallback;
+                    pSlot->EntryR0.pfnInStrCallback  = pRangeR0->pfnInStrCallback;
+                    pSlot->EntryR0.fFlags            = pRangeR3 ? pRangeR3->fFlags : 0;
+                }
+                if (pRangeRC)
+                {
+                    pSlot->EntryRC.pvUser            = pRangeRC->pvUser;
+                    pSlot->EntryRC.pDevIns           = pRangeRC->pDevIns;
+                    pSlot->EntryRC.pfnOutCallback    = pRangeRC->pfnOutCallback;
+                    pSlot->EntryRC.pfnInCallback     = pRangeRC->pfnInCallback;
+                    pSlot->EntryRC.pfnOutStrCallback = pRangeRC->pfnOutStrCallback;
+                    pSlot->EntryRC.pfnInStrCallback  = pRangeRC->pfnInStrCallback;
+                    pSlot->EntryRC.fFlags            = pRangeR3 ? pRangeR3->fFlags : 0;
+                }
+            }
+
+            for (; uPort < uPortEnd; uPort++)
+                pMap->aiSlots[uPort] = iSlot;
+        }
+        ASMAtomicWriteU32(&pMap->cSlots, cSlots);
+        RTMemTmpFree(pvBitmap);
+    }
+    else
+    {
+        LogRel(("IOM: Out of memory rebuilding the I/O port map, falling back on the range trees\n"));
+        ASMAtomicWriteU32(&pMap->cSlots, UINT32_MAX);
+    }
+    ASMAtomicIncU32(&pMap->uSeq);
+}
+
+
+/**
+ * Argument package for iomR3MmioLookupRebuildCallback.
+ */
+typedef struct IOMR3MMIOLOOKUPARGS
+{
+    PVM                 pVM;
+    PIOMMMIOLOOKUPTABLE pTable;
+} IOMR3MMIOLOOKUPARGS;
+
+
+/**
+ * Callback for iomR3MmioLookupRebuild that appends a range to the table.
+ *
+ * @returns 0 (continue enum), VERR_BUFFER_OVERFLOW if the table is full.
+ * @param   pNode       The range node.
+ * @param   pvUser      Pointer to a IOMR3MMIOLOOKUPARGS structure.
+ */
+static DECLCALLBACK(int) iomR3MmioLookupRebuildCallback(PAVLROGCPHYSNODECORE pNode, void *pvUser)
+{
+    IOMR3MMIOLOOKUPARGS *pArgs  = (IOMR3MMIOLOOKUPARGS *)pvUser;
+    PIOMMMIOLOOKUPTABLE  pTable = pArgs->pTable;
+    PIOMMMIORANGE        pRange = (PIOMMMIORANGE)pNode;
+    if (pTable->cEntries >= IOM_MMIO_LOOKUP_MAX_ENTRIES)
+        return VERR_BUFFER_OVERFLOW;
+
+    PIOMMMIOLOOKUPENTRY pEntry = &pTable->aEntries[pTable->cEntries++];
+    pEntry->GCPhysFirst = pRange->Core.Key;
+    pEntry->GCPhysLast  = pRange->Core.KeyLast;
+    pEntry->pRangeR3    = pRange;
+    pEntry->pRangeR0    = MMHyperR3ToR0(pArgs->pVM, pRange);
+    pEntry->pRangeRC    = MMHyperR3ToRC(pArgs->pVM, pRange);
+    pEntry->u32Padding  = 0;
+    return 0;
+}
+
+
+/**
+ * Rebuilds the MMIO range lookup table from the MMIO tree and publishes it.
+ *
+ * This does not return before all EMTs have left the previous generation, so
+ * ranges removed from the tree may be released afterwards.
+ *
+ * @param   pVM     The cross context VM structure.
+ */
+static void iomR3MmioLookupRebuild(PVM pVM)
+{
+    Assert(IOM_IS_EXCL_LOCK_OWNER(pVM));
+    PIOMMMIOLOOKUP pLookup = pVM->iom.s.pMmioLookupR3;
+
+    /*
+     * Build the new table in the inactive half.
+     */
+    uint32_t const uGenOld = pLookup->uGeneration;
+    uint32_t       uGenNew = uGenOld + 1;
+    if (!uGenNew)
+        uGenNew = 2;    /* Must keep the table index alternating and skip zero. */
+    Assert((uGenNew & 1) != (uGenOld & 1));
+
+    IOMR3MMIOLOOKUPARGS Args;
+    Args.pVM    = pVM;
+    Args.pTable = &pLookup->aTables[uGenNew & 1];
+    Args.pTable->cEntries = 0;
+    int rc = RTAvlroGCPhysDoWithAll(&pVM->iom.s.pTreesR3->MMIOTree, true /*fFromLeft*/,
+                                    iomR3MmioLookupRebuildCallback, &Args);
+    if (rc != 0)
+    {
+        LogRel(("IOM: Too many MMIO ranges for the lookup table, falling back on the range tree\n"));
+        Args.pTable->cEntries = UINT32_MAX;
+    }
+
+    /*
+     * Publish it and wait for the EMTs still searching the old one.
+     */
+    ASMAtomicWriteU32(&pLookup->uGeneration, uGenNew);
+    for (VMCPUID iCpu = 0; iCpu < pVM->cCpus; iCpu++)
+        while (ASMAtomicReadU32(&pVM->aCpus[iCpu].iom.s.uMmioLookupGen) == uGenOld)
+            RTThreadYield();
+}
+
+
 /**
  * The VM is being reset.
  *
@@ -325,6 +547,17 @@ VMMR3_INT_DECL(void) IOMR3Relocate(PVM pVM, RTGCINTPTR offDelta)
     RTAvlroIOPortDoWithAll(&pVM->iom.s.pTreesR3->IOPortTreeRC, true, iomR3RelocateIOPortCallback, &offDelta);
     RTAvlroGCPhysDoWithAll(&pVM->iom.s.pTreesR3->MMIOTree,     true, iomR3RelocateMMIOCallback,   &offDelta);
 
+    /*
+     * The direct I/O port map holds copies of the raw-mode callbacks, while
+     * the MMIO lookup holds raw-mode range pointers.  Rebuild both.
+     */
+    pVM->iom.s.pIOPortMapRC  = MMHyperR3ToRC(pVM, pVM->iom.s.pIOPortMapR3);
+    pVM->iom.s.pMmioLookupRC = MMHyperR3ToRC(pVM, pVM->iom.s.pMmioLookupR3);
+    IOM_LOCK_EXCL(pVM);
+    iomR3IOPortMapRebuild(pVM);
+    iomR3MmioLookupRebuild(pVM);
+    IOM_UNLOCK_EXCL(pVM);
+
     /*
      * Reset the raw-mode cache (don't bother relocating it).
      */
@@ -551,18 +784,22 @@ PIOMMMIOSTATS iomR3MMIOStatsCreate(PVM pVM, RTGCPHYS GCPhys, const char *pszDesc
  * @param   pfnInCallback       Pointer to function which is gonna handle IN operations in R3.
  * @param   pfnOutStrCallback   Pointer to function which is gonna handle string OUT operations in R3.
  * @param   pfnInStrCallback    Pointer to function which is gonna handle string IN operations in R3.
+ * @param   fFlags              Flags, IOMIOPORT_FLAGS_XXX.  They apply to
+ *                              the R0 and RC handlers of the ports as well.
  * @param   pszDesc             Pointer to description string. This must not be freed.
  */
 VMMR3_INT_DECL(int) IOMR3IOPortRegisterR3(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT PortStart, RTUINT cPorts, RTHCPTR pvUser,
                                           R3PTRTYPE(PFNIOMIOPORTOUT) pfnOutCallback, R3PTRTYPE(PFNIOMIOPORTIN) pfnInCallback,
-                                          R3PTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback, R3PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback, const char *pszDesc)
+                                          R3PTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback, R3PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback,
+                                          uint32_t fFlags, const char *pszDesc)
 {
-    LogFlow(("IOMR3IOPortRegisterR3: pDevIns=%p PortStart=%#x cPorts=%#x pvUser=%RHv pfnOutCallback=%#x pfnInCallback=%#x pfnOutStrCallback=%#x pfnInStrCallback=%#x pszDesc=%s\n",
-             pDevIns, PortStart, cPorts, pvUser, pfnOutCallback, pfnInCallback, pfnOutStrCallback, pfnInStrCallback, pszDesc));
+    LogFlow(("IOMR3IOPortRegisterR3: pDevIns=%p PortStart=%#x cPorts=%#x pvUser=%RHv pfnOutCallback=%#x pfnInCallback=%#x pfnOutStrCallback=%#x pfnInStrCallback=%#x fFlags=%#x pszDesc=%s\n",
+             pDevIns, PortStart, cPorts, pvUser, pfnOutCallback, pfnInCallback, pfnOutStrCallback, pfnInStrCallback, fFlags, pszDesc));
 
     /*
      * Validate input.
      */
+    AssertMsgReturn(!(fFlags & ~IOMIOPORT_FLAGS_VALID_MASK), ("%#x\n", fFlags), VERR_INVALID_PARAMETER);
     if (    (RTUINT)PortStart + cPorts <= (RTUINT)PortStart
         ||  (RTUINT)PortStart + cPorts > 0x10000)
     {
@@ -604,6 +841,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortRegisterR3(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
         pRange->pfnOutStrCallback = pfnOutStrCallback;
         pRange->pfnInStrCallback = pfnInStrCallback;
         pRange->pszDesc         = pszDesc;
+        pRange->fFlags          = fFlags;
 
         /*
          * Try Insert it.
@@ -615,6 +853,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortRegisterR3(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
             for (unsigned iPort = 0; iPort < cPorts; iPort++)
                 iomR3IOPortStatsCreate(pVM, PortStart + iPort, pszDesc);
 #endif
+            iomR3IOPortMapRebuild(pVM);
             IOM_UNLOCK_EXCL(pVM);
             return VINF_SUCCESS;
         }
@@ -732,6 +971,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortRegisterRC(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
          */
         if (RTAvlroIOPortInsert(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortTreeRC, &pRange->Core))
         {
+            iomR3IOPortMapRebuild(pVM);
             IOM_UNLOCK_EXCL(pVM);
             return VINF_SUCCESS;
         }
@@ -847,6 +1087,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortRegisterR0(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
          */
         if (RTAvlroIOPortInsert(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortTreeR0, &pRange->Core))
         {
+            iomR3IOPortMapRebuild(pVM);
             IOM_UNLOCK_EXCL(pVM);
             return VINF_SUCCESS;
         }
@@ -979,6 +1220,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortDeregister(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
                 int rc2 = MMHyperAlloc(pVM, sizeof(*pRangeNew), 0, MM_TAG_IOM, (void **)&pRangeNew);
                 if (RT_FAILURE(rc2))
                 {
+                    iomR3IOPortMapRebuild(pVM);
                     IOM_UNLOCK_EXCL(pVM);
                     return rc2;
                 }
@@ -1062,6 +1304,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortDeregister(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
                 int rc2 = MMHyperAlloc(pVM, sizeof(*pRangeNew), 0, MM_TAG_IOM, (void **)&pRangeNew);
                 if (RT_FAILURE(rc2))
                 {
+                    iomR3IOPortMapRebuild(pVM);
                     IOM_UNLOCK_EXCL(pVM);
                     return rc2;
                 }
@@ -1144,6 +1387,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortDeregister(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
                 int rc2 = MMHyperAlloc(pVM, sizeof(*pRangeNew), 0, MM_TAG_IOM, (void **)&pRangeNew);
                 if (RT_FAILURE(rc2))
                 {
+                    iomR3IOPortMapRebuild(pVM);
                     IOM_UNLOCK_EXCL(pVM);
                     return rc2;
                 }
@@ -1173,6 +1417,7 @@ VMMR3_INT_DECL(int) IOMR3IOPortDeregister(PVM pVM, PPDMDEVINS pDevIns, RTIOPORT
     } /* for all ports - ring-3. */
 
     /* done */
+    iomR3IOPortMapRebuild(pVM);
     IOM_UNLOCK_EXCL(pVM);
     return rc;
 }
@@ -1420,6 +1665,7 @@ IOMR3MmioRegisterR3(PVM pVM, PPDMDEVINS pDevIns, RTGCPHYS GCPhysStart, uint32_t
             IOM_LOCK_EXCL(pVM);
             if (RTAvlroGCPhysInsert(&pVM->iom.s.pTreesR3->MMIOTree, &pRange->Core))
             {
+                iomR3MmioLookupRebuild(pVM);
                 iomR3FlushCache(pVM);
                 IOM_UNLOCK_EXCL(pVM);
                 return VINF_SUCCESS;
@@ -1634,6 +1880,7 @@ VMMR3_INT_DECL(int) IOMR3MmioDeregister(PVM pVM, PPDMDEVINS pDevIns, RTGCPHYS GC
         AssertRC(rc);
 
         IOM_LOCK_EXCL(pVM);
+        iomR3MmioLookupRebuild(pVM);
 
         /* advance and free. */
         GCPhys = pRange->Core.KeyLast + 1;
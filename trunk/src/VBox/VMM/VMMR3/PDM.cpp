@@ -408,6 +408,8 @@ VMMR3_INT_DECL(int) PDMR3Init(PVM pVM)
 #endif
     if (RT_SUCCESS(rc))
         rc = pdmR3BlkCacheInit(pVM);
+    if (RT_SUCCESS(rc))
+        rc = pdmR3WorkPoolInit(pVM);
     if (RT_SUCCESS(rc))
         rc = pdmR3DrvInit(pVM);
     if (RT_SUCCESS(rc))
@@ -630,6 +632,8 @@ static void pdmR3TermLuns(PVM pVM, PPDMLUN pLun, const char *pszDevice, unsigned
         {
             PPDMDRVINS pDrvNext = pDrvIns->Internal.s.pUp;
 
+            /* Work items must not run while or after the driver is destroyed. */
+            pdmR3WorkQueueDestroyDriver(pVM, pDrvIns);
             if (pDrvIns->pReg->pfnDestruct)
             {
                 LogFlow(("pdmR3DevTerm: Destroying - driver '%s'/%d on LUN#%d of device '%s'/%d\n",
@@ -724,6 +728,8 @@ VMMR3_INT_DECL(int) PDMR3Term(PVM pVM)
     {
         pdmR3TermLuns(pVM, pDevIns->Internal.s.pLunsR3, pDevIns->pReg->szName, pDevIns->iInstance);
 
+        /* Work items must not run while or after the device is destroyed. */
+        pdmR3WorkQueueDestroyDevice(pVM, pDevIns);
         if (pDevIns->pReg->pfnDestruct)
         {
             LogFlow(("pdmR3DevTerm: Destroying - device '%s'/%d\n",
@@ -748,6 +754,11 @@ VMMR3_INT_DECL(int) PDMR3Term(PVM pVM)
      */
     pdmR3ThreadDestroyAll(pVM);
 
+    /*
+     * Stop the work pool.
+     */
+    pdmR3WorkPoolTerm(pVM);
+
     /*
      * Destroy the block cache.
      */
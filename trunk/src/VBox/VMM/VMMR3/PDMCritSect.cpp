@@ -23,6 +23,7 @@
 #include "PDMInternal.h"
 #include <VBox/vmm/pdmcritsect.h>
 #include <VBox/vmm/pdmcritsectrw.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
@@ -33,6 +34,7 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/lockvalidator.h>
+#include <iprt/mp.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
 
@@ -124,6 +126,45 @@ VMMR3_INT_DECL(int) PDMR3CritSectBothTerm(PVM pVM)
 }
 
 
+/**
+ * Sets up the spinning parameters of a critical section.
+ *
+ * @param   pVM             The cross context VM structure.
+ * @param   pCritSect       The critical section.
+ */
+static void pdmR3CritSectInitSpinning(PVM pVM, PPDMCRITSECTINT pCritSect)
+{
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "PDM/CritSect");
+
+    /** @cfgm{/PDM/CritSect/SpinMaxR3, uint32_t, 0, 65536, 1024}
+     * The max number of loops a contended ring-3 enter spins before blocking.
+     * The actual number is learned per critical section.  0 disables spinning. */
+    uint32_t cSpinsMaxR3;
+    int rc = CFGMR3QueryU32Def(pCfg, "SpinMaxR3", &cSpinsMaxR3, PDMCRITSECT_SPIN_MAX_R3_DEF);
+    AssertLogRelRC(rc);
+    if (RT_FAILURE(rc) || cSpinsMaxR3 > _64K)
+        cSpinsMaxR3 = PDMCRITSECT_SPIN_MAX_R3_DEF;
+
+    /** @cfgm{/PDM/CritSect/SpinMaxRZ, uint32_t, 0, 65536, 2048}
+     * The max number of loops a contended ring-0 or raw-mode enter spins before
+     * blocking or going to ring-3.  0 disables spinning. */
+    uint32_t cSpinsMaxRZ;
+    rc = CFGMR3QueryU32Def(pCfg, "SpinMaxRZ", &cSpinsMaxRZ, PDMCRITSECT_SPIN_MAX_RZ_DEF);
+    AssertLogRelRC(rc);
+    if (RT_FAILURE(rc) || cSpinsMaxRZ > _64K)
+        cSpinsMaxRZ = PDMCRITSECT_SPIN_MAX_RZ_DEF;
+
+    /* The owner can't release the lock while we're spinning on the only CPU. */
+    if (RTMpGetOnlineCount() <= 1)
+        cSpinsMaxR3 = cSpinsMaxRZ = 0;
+
+    pCritSect->cSpinsMaxR3 = cSpinsMaxR3;
+    pCritSect->cSpinsMaxRZ = cSpinsMaxRZ;
+    pCritSect->cSpinsR3    = RT_MIN(PDMCRITSECT_SPIN_COUNT_R3, cSpinsMaxR3);
+    pCritSect->cSpinsRZ    = RT_MIN(PDMCRITSECT_SPIN_COUNT_RZ, cSpinsMaxRZ);
+}
+
+
 /**
  * Initializes a critical section and inserts it into the list.
  *
@@ -183,10 +224,19 @@ static int pdmR3CritSectInitOne(PVM pVM, PPDMCRITSECTINT pCritSect, void *pvKey,
                 pCritSect->fUsedByTimerOrSimilar     = false;
                 pCritSect->hEventToSignal            = NIL_SUPSEMEVENT;
                 pCritSect->pszName                   = pszName;
+                pdmR3CritSectInitSpinning(pVM, pCritSect);
 
                 STAMR3RegisterF(pVM, &pCritSect->StatContentionRZLock,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSects/%s/ContentionRZLock", pCritSect->pszName);
                 STAMR3RegisterF(pVM, &pCritSect->StatContentionRZUnlock,STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSects/%s/ContentionRZUnlock", pCritSect->pszName);
                 STAMR3RegisterF(pVM, &pCritSect->StatContentionR3,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,          NULL, "/PDM/CritSects/%s/ContentionR3", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->StatSpinAcquired,      STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Contended enters that got the lock by spinning.", "/PDM/CritSects/%s/SpinAcquired", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->StatSpinGaveUp,        STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Contended enters that gave up spinning.", "/PDM/CritSects/%s/SpinGaveUp", pCritSect->pszName);
+                STAMR3RegisterF(pVM, (void *)&pCritSect->cSpinsR3,      STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,               "The current ring-3 spin limit.", "/PDM/CritSects/%s/SpinLimitR3", pCritSect->pszName);
+                STAMR3RegisterF(pVM, (void *)&pCritSect->cSpinsRZ,      STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,               "The current ring-0/raw-mode spin limit.", "/PDM/CritSects/%s/SpinLimitRZ", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->aStatWaitHisto[0],     STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Blocking waits shorter than 10us.", "/PDM/CritSects/%s/Wait-lt10us", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->aStatWaitHisto[1],     STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Blocking waits between 10us and 100us.", "/PDM/CritSects/%s/Wait-lt100us", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->aStatWaitHisto[2],     STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Blocking waits between 100us and 1ms.", "/PDM/CritSects/%s/Wait-lt1ms", pCritSect->pszName);
+                STAMR3RegisterF(pVM, &pCritSect->aStatWaitHisto[3],     STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,          "Blocking waits of 1ms or longer.", "/PDM/CritSects/%s/Wait-ge1ms", pCritSect->pszName);
 #ifdef VBOX_WITH_STATISTICS
                 STAMR3RegisterF(pVM, &pCritSect->StatLocked,        STAMTYPE_PROFILE_ADV, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_OCCURENCE, NULL, "/PDM/CritSects/%s/Locked", pCritSect->pszName);
 #endif
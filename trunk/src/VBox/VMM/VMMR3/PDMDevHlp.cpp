@@ -114,7 +114,7 @@ static DECLCALLBACK(int) pdmR3DevHlp_IOPortRegister(PPDMDEVINS pDevIns, RTIOPORT
 #endif
 
     int rc = IOMR3IOPortRegisterR3(pDevIns->Internal.s.pVMR3, pDevIns, Port, cPorts, pvUser,
-                                   pfnOut, pfnIn, pfnOutStr, pfnInStr, pszDesc);
+                                   pfnOut, pfnIn, pfnOutStr, pfnInStr, 0 /*fFlags*/, pszDesc);
 
     LogFlow(("pdmR3DevHlp_IOPortRegister: caller='%s'/%d: returns %Rrc\n", pDevIns->pReg->szName, pDevIns->iInstance, rc));
     return rc;
@@ -2302,6 +2302,42 @@ static DECLCALLBACK(VMRESUMEREASON) pdmR3DevHlp_VMGetResumeReason(PPDMDEVINS pDe
 }
 
 
+/** @interface_method_impl{PDMDEVHLPR3,pfnWorkQueueCreate} */
+static DECLCALLBACK(int) pdmR3DevHlp_WorkQueueCreate(PPDMDEVINS pDevIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                                     PFNPDMWORKDEV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    PDMDEV_ASSERT_DEVINS(pDevIns);
+    PVM pVM = pDevIns->Internal.s.pVMR3;
+    VM_ASSERT_EMT(pVM);
+    LogFlow(("pdmR3DevHlp_WorkQueueCreate: caller='%s'/%d: enmPrio=%d iAffinity=%#x pfnCallback=%p pszName=%p:{%s} ppQueue=%p\n",
+             pDevIns->pReg->szName, pDevIns->iInstance, enmPrio, iAffinity, pfnCallback, pszName, pszName, ppQueue));
+
+    int rc = pdmR3WorkQueueCreateDevice(pVM, pDevIns, enmPrio, iAffinity, pfnCallback, pszName, ppQueue);
+
+    LogFlow(("pdmR3DevHlp_WorkQueueCreate: caller='%s'/%d: returns %Rrc *ppQueue=%p\n", pDevIns->pReg->szName, pDevIns->iInstance,
+             rc, *ppQueue));
+    return rc;
+}
+
+
+/** @interface_method_impl{PDMDEVHLPR3,pfnIOPortRegisterEx} */
+static DECLCALLBACK(int) pdmR3DevHlp_IOPortRegisterEx(PPDMDEVINS pDevIns, RTIOPORT Port, RTIOPORT cPorts, RTHCPTR pvUser, uint32_t fFlags,
+                                                      PFNIOMIOPORTOUT pfnOut, PFNIOMIOPORTIN pfnIn,
+                                                      PFNIOMIOPORTOUTSTRING pfnOutStr, PFNIOMIOPORTINSTRING pfnInStr, const char *pszDesc)
+{
+    PDMDEV_ASSERT_DEVINS(pDevIns);
+    LogFlow(("pdmR3DevHlp_IOPortRegisterEx: caller='%s'/%d: Port=%#x cPorts=%#x pvUser=%p fFlags=%#x pfnOut=%p pfnIn=%p pfnOutStr=%p pfnInStr=%p pszDesc=%p:{%s}\n",
+             pDevIns->pReg->szName, pDevIns->iInstance, Port, cPorts, pvUser, fFlags, pfnOut, pfnIn, pfnOutStr, pfnInStr, pszDesc, pszDesc));
+    VM_ASSERT_EMT(pDevIns->Internal.s.pVMR3);
+
+    int rc = IOMR3IOPortRegisterR3(pDevIns->Internal.s.pVMR3, pDevIns, Port, cPorts, pvUser,
+                                   pfnOut, pfnIn, pfnOutStr, pfnInStr, fFlags, pszDesc);
+
+    LogFlow(("pdmR3DevHlp_IOPortRegisterEx: caller='%s'/%d: returns %Rrc\n", pDevIns->pReg->szName, pDevIns->iInstance, rc));
+    return rc;
+}
+
+
 /** @interface_method_impl{PDMDEVHLPR3,pfnGetUVM} */
 static DECLCALLBACK(PUVM) pdmR3DevHlp_GetUVM(PPDMDEVINS pDevIns)
 {
@@ -3684,8 +3720,8 @@ const PDMDEVHLPR3 g_pdmR3DevHlpTrusted =
     pdmR3DevHlp_CallR0,
     pdmR3DevHlp_VMGetSuspendReason,
     pdmR3DevHlp_VMGetResumeReason,
-    0,
-    0,
+    pdmR3DevHlp_WorkQueueCreate,
+    pdmR3DevHlp_IOPortRegisterEx,
     0,
     0,
     0,
@@ -3937,8 +3973,8 @@ const PDMDEVHLPR3 g_pdmR3DevHlpUnTrusted =
     pdmR3DevHlp_CallR0,
     pdmR3DevHlp_VMGetSuspendReason,
     pdmR3DevHlp_VMGetResumeReason,
-    0,
-    0,
+    pdmR3DevHlp_WorkQueueCreate,
+    pdmR3DevHlp_IOPortRegisterEx,
     0,
     0,
     0,
@@ -924,8 +924,12 @@ void pdmR3DrvDestroyChain(PPDMDRVINS pDrvIns, uint32_t fFlags)
         }
 
         /*
-         * Call destructor.
+         * Drain the work queues so no work items run while or after the
+         * driver is destroyed, then call destructor.
          */
+        int rc = pdmR3WorkQueueDestroyDriver(pVM, pCur);
+        AssertRC(rc);
+
         pCur->pUpBase = NULL;
         if (pCur->pReg->pfnDestruct)
             pCur->pReg->pfnDestruct(pCur);
@@ -935,7 +939,7 @@ void pdmR3DrvDestroyChain(PPDMDRVINS pDrvIns, uint32_t fFlags)
          * Free all resources allocated by the driver.
          */
         /* Queues. */
-        int rc = PDMR3QueueDestroyDriver(pVM, pCur);
+        rc = PDMR3QueueDestroyDriver(pVM, pCur);
         AssertRC(rc);
 
         /* Timers. */
@@ -1777,6 +1781,23 @@ static DECLCALLBACK(VMRESUMEREASON) pdmR3DrvHlp_VMGetResumeReason(PPDMDRVINS pDr
 }
 
 
+/** @interface_method_impl{PDMDRVHLPR3,pfnWorkQueueCreate} */
+static DECLCALLBACK(int) pdmR3DrvHlp_WorkQueueCreate(PPDMDRVINS pDrvIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                                     PFNPDMWORKDRV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    PDMDRV_ASSERT_DRVINS(pDrvIns);
+    VM_ASSERT_EMT(pDrvIns->Internal.s.pVMR3);
+    LogFlow(("pdmR3DrvHlp_WorkQueueCreate: caller='%s'/%d: enmPrio=%d iAffinity=%#x pfnCallback=%p pszName=%p:{%s} ppQueue=%p\n",
+             pDrvIns->pReg->szName, pDrvIns->iInstance, enmPrio, iAffinity, pfnCallback, pszName, pszName, ppQueue));
+
+    int rc = pdmR3WorkQueueCreateDriver(pDrvIns->Internal.s.pVMR3, pDrvIns, enmPrio, iAffinity, pfnCallback, pszName, ppQueue);
+
+    LogFlow(("pdmR3DrvHlp_WorkQueueCreate: caller='%s'/%d: returns %Rrc *ppQueue=%p\n", pDrvIns->pReg->szName, pDrvIns->iInstance,
+             rc, *ppQueue));
+    return rc;
+}
+
+
 /**
  * The driver helper structure.
  */
@@ -1826,7 +1847,7 @@ const PDMDRVHLPR3 g_pdmR3DrvHlp =
     pdmR3DrvHlp_BlkCacheRetain,
     pdmR3DrvHlp_VMGetSuspendReason,
     pdmR3DrvHlp_VMGetResumeReason,
-    NULL,
+    pdmR3DrvHlp_WorkQueueCreate,
     NULL,
     NULL,
     NULL,
@@ -134,18 +134,101 @@ static void pdmNsBwGroupUnlink(PPDMNSBWGROUP pBwGroup)
 #endif
 
 
+/**
+ * Sets the rate of a token bucket, dropping tokens exceeding the new burst
+ * size.
+ *
+ * @param   pBucket         The bucket.
+ * @param   cbPerSec        The new rate in bytes per second, 0 for unlimited.
+ * @param   cbBurst         The burst size in bytes.
+ */
+static void pdmNsBucketSetRate(PPDMNSBUCKET pBucket, uint64_t cbPerSec, uint32_t cbBurst)
+{
+    uint64_t const tsNow    = RTTimeSystemNanoTS();
+    uint64_t const cNsBurst = cbPerSec ? (uint64_t)cbBurst * RT_NS_1SEC / cbPerSec : 0;
+
+    /* Set the rate to unlimited while updating so PDMNsAllocateBandwidth never
+       combines the old rate with the new burst size. */
+    ASMAtomicWriteU64(&pBucket->cbPerSec, 0);
+    ASMAtomicWriteU64(&pBucket->cNsBurst, cNsBurst);
+    ASMAtomicWriteU64(&pBucket->tsTat, tsNow);
+    ASMAtomicWriteU64(&pBucket->cbPerSec, cbPerSec);
+}
+
+
 static void pdmNsBwGroupSetLimit(PPDMNSBWGROUP pBwGroup, uint64_t cbPerSecMax)
 {
     pBwGroup->cbPerSecMax = cbPerSecMax;
-    pBwGroup->cbBucket    = RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000);
-    LogFlow(("pdmNsBwGroupSetLimit: New rate limit is %llu bytes per second, adjusted bucket size to %u bytes\n",
-             pBwGroup->cbPerSecMax, pBwGroup->cbBucket));
+    pBwGroup->cbBucket    = pBwGroup->cbBurstCfg
+                          ? pBwGroup->cbBurstCfg
+                          : RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000);
+    pdmNsBucketSetRate(&pBwGroup->Rate, cbPerSecMax, pBwGroup->cbBucket);
+
+    /* The ceiling only matters when there is a parent to borrow from. */
+    uint64_t cbPerSecCeil = 0;
+    if (pBwGroup->pParentR3 && cbPerSecMax)
+        cbPerSecCeil = RT_MAX(pBwGroup->cbPerSecCeil, cbPerSecMax);
+    pdmNsBucketSetRate(&pBwGroup->Ceil, cbPerSecCeil,
+                       RT_MAX(pBwGroup->cbBucket, (uint32_t)RT_MIN(cbPerSecCeil * PDM_NETSHAPER_MAX_LATENCY / 1000, UINT32_MAX)));
+
+    /* Start deficit round robin over, the quantums were sized for the old
+       limits and the shaper thread skips groups that became unlimited. */
+    ASMAtomicWriteU32(&pBwGroup->cBacklogged, 0);
+    for (PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3; pFilter; pFilter = pFilter->pNextR3)
+        ASMAtomicWriteS64(&pFilter->cbDeficit, 0);
+    LogFlow(("pdmNsBwGroupSetLimit: New rate limit is %llu bytes per second (ceiling %llu), adjusted bucket size to %u bytes\n",
+             pBwGroup->cbPerSecMax, cbPerSecCeil, pBwGroup->cbBucket));
+}
+
+
+/**
+ * Makes @a pBwGroup a child of the group named @a pszParent.
+ *
+ * @returns VBox status code.
+ * @param   pShaper         The network shaper.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   pszParent       The name of the parent group.
+ */
+static int pdmNsBwGroupSetParent(PPDMNETSHAPER pShaper, PPDMNSBWGROUP pBwGroup, const char *pszParent)
+{
+    PPDMNSBWGROUP pParent = pdmNsBwGroupFindById(pShaper, pszParent);
+    if (!pParent)
+        return VMSetError(pShaper->pVM, VERR_NOT_FOUND, RT_SRC_POS,
+                          N_("Parent bandwidth group '%s' of '%s' not found"), pszParent, pBwGroup->pszNameR3);
+
+    /* Refuse loops. */
+    for (PPDMNSBWGROUP pCur = pParent; pCur; pCur = pCur->pParentR3)
+        if (pCur == pBwGroup)
+            return VMSetError(pShaper->pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                              N_("Bandwidth group '%s' cannot be its own ancestor"), pBwGroup->pszNameR3);
+
+    pBwGroup->pParentR3 = pParent;
+    pBwGroup->pParentR0 = MMHyperR3ToR0(pShaper->pVM, pParent);
+    pdmNsBwGroupSetLimit(pBwGroup, pBwGroup->cbPerSecMax);
+    LogRel(("NetShaper: Bandwidth group '%s' is a child of '%s'\n", pBwGroup->pszNameR3, pParent->pszNameR3));
+    return VINF_SUCCESS;
 }
 
 
-static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax)
+static void pdmNsBwGroupRegisterStats(PPDMNETSHAPER pShaper, PPDMNSBWGROUP pBwGroup)
 {
-    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu\n", pShaper, pszBwGroup, pszBwGroup, cbPerSecMax));
+    PVM pVM = pShaper->pVM;
+    STAMR3RegisterF(pVM, &pBwGroup->StatBytesGranted, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                    "Bytes granted at the group's own rate.", "/PDM/NetShaper/%s/BytesGranted", pBwGroup->pszNameR3);
+    STAMR3RegisterF(pVM, &pBwGroup->StatBytesBorrowed, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                    "Bytes granted by borrowing from the parent group.", "/PDM/NetShaper/%s/BytesBorrowed", pBwGroup->pszNameR3);
+    STAMR3RegisterF(pVM, &pBwGroup->StatDenied, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                    "Requests denied for lack of bandwidth.", "/PDM/NetShaper/%s/Denied", pBwGroup->pszNameR3);
+    STAMR3RegisterF(pVM, &pBwGroup->StatDeniedDrr, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                    "Requests denied by the deficit round robin.", "/PDM/NetShaper/%s/DeniedDrr", pBwGroup->pszNameR3);
+}
+
+
+static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax,
+                              uint64_t cbPerSecCeil, uint32_t cbBurst)
+{
+    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu cbPerSecCeil=%llu cbBurst=%u\n",
+             pShaper, pszBwGroup, pszBwGroup, cbPerSecMax, cbPerSecCeil, cbBurst));
 
     AssertPtrReturn(pShaper, VERR_INVALID_POINTER);
     AssertPtrReturn(pszBwGroup, VERR_INVALID_POINTER);
@@ -166,16 +249,19 @@ static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uin
                 if (pBwGroup->pszNameR3)
                 {
                     pBwGroup->pShaperR3             = pShaper;
+                    pBwGroup->pParentR3             = NULL;
+                    pBwGroup->pParentR0             = NIL_RTR0PTR;
                     pBwGroup->cRefs                 = 0;
+                    pBwGroup->cBacklogged           = 0;
+                    pBwGroup->cbPerSecCeil          = cbPerSecCeil;
+                    pBwGroup->cbBurstCfg            = cbBurst;
 
                     pdmNsBwGroupSetLimit(pBwGroup, cbPerSecMax);
 
-                    pBwGroup->cbTokensLast          = pBwGroup->cbBucket;
-                    pBwGroup->tsUpdatedLast         = RTTimeSystemNanoTS();
-
                     LogFlowFunc(("pszBwGroup={%s} cbBucket=%u\n",
                                  pszBwGroup, pBwGroup->cbBucket));
                     pdmNsBwGroupLink(pBwGroup);
+                    pdmNsBwGroupRegisterStats(pShaper, pBwGroup);
                     return VINF_SUCCESS;
                 }
                 PDMR3CritSectDelete(&pBwGroup->Lock);
@@ -226,20 +312,43 @@ static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
     Assert(RTCritSectIsOwner(&pBwGroup->pShaperR3->Lock));
     //LOCK_NETSHAPER(pShaper);
 
-    /* Check if the group is disabled. */
-    if (pBwGroup->cbPerSecMax == 0)
+    /* Check if the group is disabled, unless it may be limited by a parent. */
+    if (   pBwGroup->cbPerSecMax == 0
+        && !pBwGroup->pParentR3)
         return;
 
+    /*
+     * Deficit round robin: Count the filters that were choked during the last
+     * period.  If more than one is backlogged, each gets an equal quantum of the
+     * group's bucket which PDMNsAllocateBandwidth makes it stay within.  Filters
+     * that aren't backlogged lose their deficit.
+     */
+    uint32_t cBacklogged = 0;
+    for (PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3; pFilter; pFilter = pFilter->pNextR3)
+        if (ASMAtomicReadBool(&pFilter->fChoked))
+            cBacklogged++;
+
+    int64_t const cbQuantum = RT_MAX(pBwGroup->cbBucket / RT_MAX(cBacklogged, 1), PDM_NETSHAPER_MIN_QUANTUM);
+    ASMAtomicWriteU32(&pBwGroup->cBacklogged, cBacklogged);
+
     PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3;
     while (pFilter)
     {
         bool fChoked = ASMAtomicXchgBool(&pFilter->fChoked, false);
         Log3((LOG_FN_FMT ": pFilter=%#p fChoked=%RTbool\n", __PRETTY_FUNCTION__, pFilter, fChoked));
-        if (fChoked && pFilter->pIDrvNetR3)
+        if (fChoked)
         {
-            LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p\n", pFilter));
-            pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+            /* Don't let the deficit pile up beyond two rounds. */
+            int64_t cbDeficit = ASMAtomicReadS64(&pFilter->cbDeficit) + cbQuantum;
+            ASMAtomicWriteS64(&pFilter->cbDeficit, RT_MIN(cbDeficit, 2 * cbQuantum));
+            if (pFilter->pIDrvNetR3)
+            {
+                LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p\n", pFilter));
+                pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+            }
         }
+        else
+            ASMAtomicWriteS64(&pFilter->cbDeficit, cBacklogged > 1 ? cbQuantum : 0);
 
         pFilter = pFilter->pNextR3;
     }
@@ -253,6 +362,7 @@ static void pdmNsFilterLink(PPDMNSFILTER pFilter)
     PPDMNSBWGROUP pBwGroup = pFilter->pBwGroupR3;
     int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
 
+    pFilter->cbDeficit = 0;
     pFilter->pNextR3 = pBwGroup->pFiltersHeadR3;
     pBwGroup->pFiltersHeadR3 = pFilter;
 
@@ -385,11 +495,46 @@ VMMR3DECL(int) PDMR3NsBwGroupSetLimit(PUVM pUVM, const char *pszBwGroup, uint64_
         rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
         if (RT_SUCCESS(rc))
         {
+            /* This resets the buckets, dropping extra tokens. */
             pdmNsBwGroupSetLimit(pBwGroup, cbPerSecMax);
 
-            /* Drop extra tokens */
-            if (pBwGroup->cbTokensLast > pBwGroup->cbBucket)
-                pBwGroup->cbTokensLast = pBwGroup->cbBucket;
+            int rc2 = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc2);
+        }
+    }
+    else
+        rc = VERR_NOT_FOUND;
+
+    UNLOCK_NETSHAPER(pShaper);
+    return rc;
+}
+
+
+/**
+ * Adjusts the ceiling and burst size of the bandwidth group.
+ *
+ * @returns VBox status code.
+ * @param   pUVM            The user mode VM handle.
+ * @param   pszBwGroup      Name of the bandwidth group to change.
+ * @param   cbPerSecCeil    Number of bytes per second the group may reach by
+ *                          borrowing from its parent, see the Ceil CFGM key.
+ * @param   cbBurst         The burst size in bytes, 0 for the default.
+ */
+VMMR3DECL(int) PDMR3NsBwGroupSetCeilAndBurst(PUVM pUVM, const char *pszBwGroup, uint64_t cbPerSecCeil, uint32_t cbBurst)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PPDMNETSHAPER pShaper = pUVM->pdm.s.pNetShaper;
+    LOCK_NETSHAPER_RETURN(pShaper);
+
+    int           rc;
+    PPDMNSBWGROUP pBwGroup = pdmNsBwGroupFindById(pShaper, pszBwGroup);
+    if (pBwGroup)
+    {
+        rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+        if (RT_SUCCESS(rc))
+        {
+            pBwGroup->cbPerSecCeil = cbPerSecCeil;
+            pBwGroup->cbBurstCfg   = cbBurst;
+            pdmNsBwGroupSetLimit(pBwGroup, pBwGroup->cbPerSecMax);
 
             int rc2 = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc2);
         }
@@ -464,6 +609,7 @@ int pdmR3NetShaperTerm(PVM pVM)
     {
         PPDMNSBWGROUP pFree = pBwGroup;
         pBwGroup = pBwGroup->pNextR3;
+        STAMR3DeregisterF(pVM->pUVM, "/PDM/NetShaper/%s/*", pFree->pszNameR3);
         pdmNsBwGroupTerminate(pFree);
         MMR3HeapFree(pFree->pszNameR3);
         MMHyperFree(pVM, pFree);
@@ -504,6 +650,8 @@ int pdmR3NetShaperInit(PVM pVM)
                 for (PCFGMNODE pCur = CFGMR3GetFirstChild(pCfgBwGrp); pCur; pCur = CFGMR3GetNextChild(pCur))
                 {
                     uint64_t cbMax;
+                    uint64_t cbCeil  = 0;
+                    uint32_t cbBurst = 0;
                     size_t cbName = CFGMR3GetNameLen(pCur) + 1;
                     char *pszBwGrpId = (char *)RTMemAllocZ(cbName);
 
@@ -518,14 +666,41 @@ int pdmR3NetShaperInit(PVM pVM)
 
                     if (RT_SUCCESS(rc))
                         rc = CFGMR3QueryU64(pCur, "Max", &cbMax);
+                    /** @cfgm{/PDM/NetworkShaper/BwGroups/\<name\>/Ceil, uint64_t, Max}
+                     * The rate a child group may reach by borrowing bandwidth its
+                     * parent's other children leave unused. */
                     if (RT_SUCCESS(rc))
-                        rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax);
+                        rc = CFGMR3QueryU64Def(pCur, "Ceil", &cbCeil, 0);
+                    /** @cfgm{/PDM/NetworkShaper/BwGroups/\<name\>/Burst, uint32_t, Max * 100ms}
+                     * The number of bytes the group may send in one burst. */
+                    if (RT_SUCCESS(rc))
+                        rc = CFGMR3QueryU32Def(pCur, "Burst", &cbBurst, 0);
+                    if (RT_SUCCESS(rc))
+                        rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax, cbCeil, cbBurst);
 
                     RTMemFree(pszBwGrpId);
 
                     if (RT_FAILURE(rc))
                         break;
                 }
+
+                /* Link the hierarchy now that all groups exist. */
+                for (PCFGMNODE pCur = CFGMR3GetFirstChild(pCfgBwGrp); pCur && RT_SUCCESS(rc); pCur = CFGMR3GetNextChild(pCur))
+                {
+                    /** @cfgm{/PDM/NetworkShaper/BwGroups/\<name\>/Parent, string, none}
+                     * The name of the group this group borrows bandwidth from and
+                     * whose bandwidth its traffic is accounted to. */
+                    char *pszParent = NULL;
+                    rc = CFGMR3QueryStringAllocDef(pCur, "Parent", &pszParent, NULL);
+                    if (RT_SUCCESS(rc) && pszParent)
+                    {
+                        char szName[128];
+                        rc = CFGMR3GetName(pCur, szName, sizeof(szName));
+                        if (RT_SUCCESS(rc))
+                            rc = pdmNsBwGroupSetParent(pShaper, pdmNsBwGroupFindById(pShaper, szName), pszParent);
+                        MMR3HeapFree(pszParent);
+                    }
+                }
             }
 
             if (RT_SUCCESS(rc))
@@ -0,0 +1,929 @@
+/* $Id$ */
+/** @file
+ * PDM Work Queues - Shared worker thread pool for devices and drivers.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_PDM
+#include "PDMInternal.h"
+#include <VBox/vmm/pdm.h>
+#include <VBox/vmm/pdmworkqueue.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/uvm.h>
+#include <VBox/err.h>
+
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/list.h>
+#include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The max number of worker threads. */
+#define PDMWORKPOOL_MAX_WORKERS         64
+/** The default max number of worker threads when not configured. */
+#define PDMWORKPOOL_DEF_MAX_WORKERS     8
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * The work queue owner type.
+ */
+typedef enum PDMWORKQUEUETYPE
+{
+    /** Device consumer. */
+    PDMWORKQUEUETYPE_DEV = 1,
+    /** Driver consumer. */
+    PDMWORKQUEUETYPE_DRV,
+    /** Internal consumer. */
+    PDMWORKQUEUETYPE_INTERNAL
+} PDMWORKQUEUETYPE;
+
+/**
+ * A PDM work queue.
+ */
+typedef struct PDMWORKQUEUE
+{
+    /** Pointer to the next queue in the pool list (PDMWORKPOOL::CritSect). */
+    struct PDMWORKQUEUE        *pNext;
+    /** Node in the ready list of a worker (PDMWORKER::CritSect). */
+    RTLISTNODE                  ReadyNode;
+    /** Owner specific data. */
+    union
+    {
+        /** PDMWORKQUEUETYPE_DEV */
+        struct
+        {
+            /** Pointer to the callback. */
+            PFNPDMWORKDEV       pfnCallback;
+            /** Pointer to the device instance owning the queue. */
+            PPDMDEVINS          pDevIns;
+        } Dev;
+        /** PDMWORKQUEUETYPE_DRV */
+        struct
+        {
+            /** Pointer to the callback. */
+            PFNPDMWORKDRV       pfnCallback;
+            /** Pointer to the driver instance owning the queue. */
+            PPDMDRVINS          pDrvIns;
+        } Drv;
+        /** PDMWORKQUEUETYPE_INTERNAL */
+        struct
+        {
+            /** Pointer to the callback. */
+            PFNPDMWORKINT       pfnCallback;
+        } Int;
+    } u;
+    /** The owner type. */
+    PDMWORKQUEUETYPE            enmType;
+    /** The priority. */
+    PDMWORKPRIO                 enmPrio;
+    /** The index of the home worker, UINT32_MAX if none. */
+    uint32_t                    iHomeWorker;
+    /** Number of threads waiting in PDMR3WorkQueueWaitIdle. */
+    uint32_t volatile           cIdleWaiters;
+    /** Number of workers currently referencing the queue.  Decremented as the
+     * very last access to the queue, so destruction waits for this. */
+    uint32_t volatile           cRunning;
+    /** Set while the queue is on a ready list or being run by a worker. */
+    bool volatile               fScheduled;
+    /** Set when the queue is being destroyed, no more posting. */
+    bool volatile               fDestroying;
+    /** LIFO of posted items. */
+    PPDMWORKITEM volatile       pPending;
+    /** Signalled when a worker leaves the queue idle and there are waiters. */
+    RTSEMEVENTMULTI             hEvtIdle;
+    /** The pool this queue belongs to. */
+    struct PDMWORKPOOL         *pPool;
+    /** The queue name (allocated). */
+    char                       *pszName;
+    /** Stat: Number of items posted. */
+    STAMCOUNTER                 StatPosted;
+    /** Stat: Number of times the queue was run by another worker than its home. */
+    STAMCOUNTER                 StatStolen;
+    /** Stat: Profiling the running of the items. */
+    STAMPROFILE                 StatRun;
+} PDMWORKQUEUE;
+
+/**
+ * A worker thread in the pool.
+ */
+typedef struct PDMWORKER
+{
+    /** The pool. */
+    struct PDMWORKPOOL         *pPool;
+    /** The thread handle. */
+    RTTHREAD                    hThread;
+    /** The event semaphore the worker sleeps on. */
+    RTSEMEVENT                  hEvt;
+    /** Protects the ready lists. */
+    RTCRITSECT                  CritSect;
+    /** Queues ready to run, one list per priority. */
+    RTLISTANCHOR                aReady[PDMWORKPRIO_END];
+    /** Number of queues on the ready lists. */
+    uint32_t volatile           cReady;
+    /** Set while the worker is (about to go) sleeping. */
+    bool volatile               fSleeping;
+    /** The index of this worker. */
+    uint32_t                    idx;
+    /** Stat: Number of queues stolen from other workers. */
+    STAMCOUNTER                 StatSteals;
+    /** Stat: Number of times the worker went to sleep. */
+    STAMCOUNTER                 StatSleeps;
+} PDMWORKER;
+/** Pointer to a worker thread. */
+typedef PDMWORKER *PPDMWORKER;
+
+/**
+ * The PDM worker pool.
+ */
+typedef struct PDMWORKPOOL
+{
+    /** The VM handle. */
+    PVM                         pVM;
+    /** Protects the queue list and the worker startup. */
+    RTCRITSECT                  CritSect;
+    /** List of work queues. */
+    PPDMWORKQUEUE               pQueues;
+    /** Set when the workers should terminate. */
+    bool volatile               fTerminate;
+    /** Whether the workers have been started. */
+    bool                        fStarted;
+    /** Whether to bind the workers to host CPUs. */
+    bool                        fBindWorkers;
+    /** Round robin index for queues without a home worker. */
+    uint32_t volatile           iNextWorker;
+    /** The number of workers. */
+    uint32_t                    cWorkers;
+    /** The workers (variable size). */
+    PDMWORKER                   aWorkers[1];
+} PDMWORKPOOL;
+/** Pointer to the PDM worker pool. */
+typedef PDMWORKPOOL *PPDMWORKPOOL;
+
+
+/*********************************************************************************************************************************
+*   Internal Functions                                                                                                           *
+*********************************************************************************************************************************/
+static DECLCALLBACK(int) pdmR3WorkerThread(RTTHREAD hThreadSelf, void *pvUser);
+
+
+
+/**
+ * Initializes the worker pool.
+ *
+ * The worker threads aren't started till the first queue is created.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ */
+int pdmR3WorkPoolInit(PVM pVM)
+{
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "PDM/WorkPool");
+
+    /** @cfgm{/PDM/WorkPool/Workers, uint32_t, 0, 64, 0}
+     * The number of worker threads shared by the work queues.  0 means one per
+     * online host CPU, but no more than 8. */
+    uint32_t cWorkers;
+    int rc = CFGMR3QueryU32Def(pCfg, "Workers", &cWorkers, 0);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(cWorkers <= PDMWORKPOOL_MAX_WORKERS, ("Workers=%u\n", cWorkers), VERR_OUT_OF_RANGE);
+    if (!cWorkers)
+        cWorkers = RT_MAX(RT_MIN(RTMpGetOnlineCount(), PDMWORKPOOL_DEF_MAX_WORKERS), 1);
+
+    /** @cfgm{/PDM/WorkPool/BindWorkers, bool, false}
+     * Whether to bind each worker thread to a host CPU, so that the affinity
+     * hints of the work queues map to host CPUs. */
+    bool fBindWorkers;
+    rc = CFGMR3QueryBoolDef(pCfg, "BindWorkers", &fBindWorkers, false);
+    AssertLogRelRCReturn(rc, rc);
+
+    PPDMWORKPOOL pPool = (PPDMWORKPOOL)RTMemAllocZ(RT_OFFSETOF(PDMWORKPOOL, aWorkers[cWorkers]));
+    if (!pPool)
+        return VERR_NO_MEMORY;
+    pPool->pVM          = pVM;
+    pPool->cWorkers     = cWorkers;
+    pPool->fBindWorkers = fBindWorkers;
+    rc = RTCritSectInit(&pPool->CritSect);
+    if (RT_FAILURE(rc))
+    {
+        RTMemFree(pPool);
+        return rc;
+    }
+
+    for (uint32_t i = 0; i < cWorkers; i++)
+    {
+        PPDMWORKER pWorker = &pPool->aWorkers[i];
+        pWorker->pPool   = pPool;
+        pWorker->idx     = i;
+        pWorker->hThread = NIL_RTTHREAD;
+        pWorker->hEvt    = NIL_RTSEMEVENT;
+        for (unsigned iPrio = 0; iPrio < RT_ELEMENTS(pWorker->aReady); iPrio++)
+            RTListInit(&pWorker->aReady[iPrio]);
+        rc = RTCritSectInit(&pWorker->CritSect);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pWorker->hEvt);
+        if (RT_FAILURE(rc))
+        {
+            pVM->pUVM->pdm.s.pWorkPool = pPool;
+            pdmR3WorkPoolTerm(pVM);
+            return rc;
+        }
+
+        STAMR3RegisterF(pVM, &pWorker->StatSteals, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                        "Queues stolen from other workers.", "/PDM/WorkPool/Worker%u/Steals", i);
+        STAMR3RegisterF(pVM, &pWorker->StatSleeps, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                        "Times the worker ran out of work.", "/PDM/WorkPool/Worker%u/Sleeps", i);
+    }
+
+    pVM->pUVM->pdm.s.pWorkPool = pPool;
+    LogRel(("PDM: Work pool with %u workers%s\n", cWorkers, fBindWorkers ? " bound to host CPUs" : ""));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Terminates the worker pool.
+ *
+ * All queues should have been destroyed by now.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+void pdmR3WorkPoolTerm(PVM pVM)
+{
+    PPDMWORKPOOL pPool = pVM->pUVM->pdm.s.pWorkPool;
+    if (!pPool)
+        return;
+
+    while (pPool->pQueues)
+        PDMR3WorkQueueDestroy(pPool->pQueues);
+
+    ASMAtomicWriteBool(&pPool->fTerminate, true);
+    for (uint32_t i = 0; i < pPool->cWorkers; i++)
+        if (pPool->aWorkers[i].hEvt != NIL_RTSEMEVENT)
+            RTSemEventSignal(pPool->aWorkers[i].hEvt);
+
+    for (uint32_t i = 0; i < pPool->cWorkers; i++)
+    {
+        PPDMWORKER pWorker = &pPool->aWorkers[i];
+        if (pWorker->hThread != NIL_RTTHREAD)
+        {
+            int rc = RTThreadWait(pWorker->hThread, RT_MS_1MIN, NULL);
+            AssertLogRelMsgRC(rc, ("Worker #%u: %Rrc\n", i, rc));
+        }
+        if (pWorker->hEvt != NIL_RTSEMEVENT)
+            RTSemEventDestroy(pWorker->hEvt);
+        if (RTCritSectIsInitialized(&pWorker->CritSect))
+            RTCritSectDelete(&pWorker->CritSect);
+    }
+
+    RTCritSectDelete(&pPool->CritSect);
+    pVM->pUVM->pdm.s.pWorkPool = NULL;
+    RTMemFree(pPool);
+}
+
+
+/**
+ * Starts the worker threads, called when the first queue is created.
+ *
+ * @returns VBox status code.
+ * @param   pPool       The worker pool.
+ * @remarks Caller owns the pool critical section.
+ */
+static int pdmR3WorkPoolStart(PPDMWORKPOOL pPool)
+{
+    Assert(RTCritSectIsOwner(&pPool->CritSect));
+    if (pPool->fStarted)
+        return VINF_SUCCESS;
+
+    for (uint32_t i = 0; i < pPool->cWorkers; i++)
+    {
+        PPDMWORKER pWorker = &pPool->aWorkers[i];
+        if (pWorker->hThread == NIL_RTTHREAD)
+        {
+            int rc = RTThreadCreateF(&pWorker->hThread, pdmR3WorkerThread, pWorker, 0, RTTHREADTYPE_IO,
+                                     RTTHREADFLAGS_WAITABLE, "PDMWrk%u", i);
+            if (RT_FAILURE(rc))
+            {
+                pWorker->hThread = NIL_RTTHREAD;
+                LogRel(("PDM: Failed to create work pool thread #%u: %Rrc\n", i, rc));
+                return rc;
+            }
+        }
+    }
+
+    pPool->fStarted = true;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Puts a queue on the ready list of a worker and makes sure someone runs it.
+ *
+ * @param   pPool       The worker pool.
+ * @param   pQueue      The queue, fScheduled must be set.
+ * @param   pWorker     The worker to put it on.
+ */
+static void pdmR3WorkQueueMakeReady(PPDMWORKPOOL pPool, PPDMWORKQUEUE pQueue, PPDMWORKER pWorker)
+{
+    Assert(pQueue->fScheduled);
+
+    RTCritSectEnter(&pWorker->CritSect);
+    RTListAppend(&pWorker->aReady[pQueue->enmPrio], &pQueue->ReadyNode);
+    ASMAtomicIncU32(&pWorker->cReady);
+    RTCritSectLeave(&pWorker->CritSect);
+
+    /*
+     * Wake up the worker if it's sleeping.  Otherwise wake up some other idle
+     * worker which can steal the queue if the target doesn't get to it soon.
+     */
+    if (ASMAtomicReadBool(&pWorker->fSleeping))
+        RTSemEventSignal(pWorker->hEvt);
+    else if (pWorker->hThread != RTThreadSelf())
+    {
+        for (uint32_t i = 1; i < pPool->cWorkers; i++)
+        {
+            PPDMWORKER pOther = &pPool->aWorkers[(pWorker->idx + i) % pPool->cWorkers];
+            if (ASMAtomicReadBool(&pOther->fSleeping))
+            {
+                RTSemEventSignal(pOther->hEvt);
+                break;
+            }
+        }
+    }
+}
+
+
+/**
+ * Picks the worker a queue without a home worker should go to.
+ *
+ * @returns The worker.
+ * @param   pPool       The worker pool.
+ */
+static PPDMWORKER pdmR3WorkPoolPickWorker(PPDMWORKPOOL pPool)
+{
+    uint32_t const iStart = ASMAtomicIncU32(&pPool->iNextWorker) % pPool->cWorkers;
+    for (uint32_t i = 0; i < pPool->cWorkers; i++)
+    {
+        PPDMWORKER pWorker = &pPool->aWorkers[(iStart + i) % pPool->cWorkers];
+        if (ASMAtomicReadBool(&pWorker->fSleeping))
+            return pWorker;
+    }
+    return &pPool->aWorkers[iStart];
+}
+
+
+/**
+ * Takes the highest priority ready queue off a worker's ready lists.
+ *
+ * @returns The queue, NULL if none are ready.
+ * @param   pWorker     The worker to take it from.
+ */
+static PPDMWORKQUEUE pdmR3WorkerTakeReady(PPDMWORKER pWorker)
+{
+    if (!ASMAtomicReadU32(&pWorker->cReady))
+        return NULL;
+
+    PPDMWORKQUEUE pQueue = NULL;
+    RTCritSectEnter(&pWorker->CritSect);
+    for (unsigned iPrio = PDMWORKPRIO_END - 1; iPrio > PDMWORKPRIO_INVALID; iPrio--)
+    {
+        pQueue = RTListGetFirst(&pWorker->aReady[iPrio], PDMWORKQUEUE, ReadyNode);
+        if (pQueue)
+        {
+            ASMAtomicIncU32(&pQueue->cRunning);
+            RTListNodeRemove(&pQueue->ReadyNode);
+            ASMAtomicDecU32(&pWorker->cReady);
+            break;
+        }
+    }
+    RTCritSectLeave(&pWorker->CritSect);
+    return pQueue;
+}
+
+
+/**
+ * Runs the items posted to a queue.
+ *
+ * @param   pWorker     The worker running the queue.
+ * @param   pQueue      The queue.
+ */
+static void pdmR3WorkQueueRun(PPDMWORKER pWorker, PPDMWORKQUEUE pQueue)
+{
+    PPDMWORKPOOL pPool = pWorker->pPool;
+    STAM_REL_PROFILE_START(&pQueue->StatRun, a);
+
+    /*
+     * Grab everything posted so far and reverse the LIFO.  The items posted
+     * while we're busy are left for the next round, that keeps things fair.
+     */
+    PPDMWORKITEM pItems = ASMAtomicXchgPtrT(&pQueue->pPending, NULL, PPDMWORKITEM);
+    PPDMWORKITEM pHead  = NULL;
+    while (pItems)
+    {
+        PPDMWORKITEM pNext = pItems->pNext;
+        pItems->pNext = pHead;
+        pHead = pItems;
+        pItems = pNext;
+    }
+
+    while (pHead)
+    {
+        PPDMWORKITEM pItem = pHead;
+        pHead = pItem->pNext;
+        pItem->pNext = NULL;
+
+        switch (pQueue->enmType)
+        {
+            case PDMWORKQUEUETYPE_DEV:
+                pQueue->u.Dev.pfnCallback(pQueue->u.Dev.pDevIns, pItem);
+                break;
+            case PDMWORKQUEUETYPE_DRV:
+                pQueue->u.Drv.pfnCallback(pQueue->u.Drv.pDrvIns, pItem);
+                break;
+            case PDMWORKQUEUETYPE_INTERNAL:
+                pQueue->u.Int.pfnCallback(pPool->pVM, pItem);
+                break;
+            default:
+                AssertMsgFailed(("Invalid queue type %d\n", pQueue->enmType));
+                break;
+        }
+    }
+
+    STAM_REL_PROFILE_STOP(&pQueue->StatRun, a);
+
+    /*
+     * Done.  If more items were posted meanwhile, put the queue back on our
+     * own ready list, otherwise wake up anyone waiting for it to go idle.
+     */
+    ASMAtomicWriteBool(&pQueue->fScheduled, false);
+    if (   ASMAtomicReadPtrT(&pQueue->pPending, PPDMWORKITEM)
+        && ASMAtomicCmpXchgBool(&pQueue->fScheduled, true, false))
+        pdmR3WorkQueueMakeReady(pPool, pQueue, pWorker);
+    else if (ASMAtomicReadU32(&pQueue->cIdleWaiters))
+        RTSemEventMultiSignal(pQueue->hEvtIdle);
+
+    /* Must be the last access, the queue may be freed right after this. */
+    ASMAtomicDecU32(&pQueue->cRunning);
+}
+
+
+/**
+ * The worker thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hThreadSelf The thread handle.
+ * @param   pvUser      Pointer to the PDMWORKER structure.
+ */
+static DECLCALLBACK(int) pdmR3WorkerThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PPDMWORKER   pWorker = (PPDMWORKER)pvUser;
+    PPDMWORKPOOL pPool   = pWorker->pPool;
+    NOREF(hThreadSelf);
+
+    if (pPool->fBindWorkers)
+    {
+        RTCPUSET OnlineSet;
+        RTMpGetOnlineSet(&OnlineSet);
+        int const cCpus = RTCpuSetCount(&OnlineSet);
+        int       iCpu  = cCpus > 0 ? (int)(pWorker->idx % (uint32_t)cCpus) : -1;
+        for (int iSet = 0; iSet < RTCPUSET_MAX_CPUS && iCpu >= 0; iSet++)
+            if (RTCpuSetIsMemberByIndex(&OnlineSet, iSet) && iCpu-- == 0)
+            {
+                int rc = RTThreadSetAffinityToCpu(RTMpCpuIdFromSetIndex(iSet));
+                if (RT_FAILURE(rc))
+                    LogRel(("PDM: Failed to bind worker #%u to CPU set index %d: %Rrc\n", pWorker->idx, iSet, rc));
+                break;
+            }
+    }
+
+    while (!ASMAtomicReadBool(&pPool->fTerminate))
+    {
+        /*
+         * Our own ready queues first, then try steal from the others.
+         */
+        PPDMWORKQUEUE pQueue = pdmR3WorkerTakeReady(pWorker);
+        if (!pQueue)
+            for (uint32_t i = 1; i < pPool->cWorkers && !pQueue; i++)
+            {
+                pQueue = pdmR3WorkerTakeReady(&pPool->aWorkers[(pWorker->idx + i) % pPool->cWorkers]);
+                if (pQueue)
+                {
+                    STAM_REL_COUNTER_INC(&pWorker->StatSteals);
+                    if (pQueue->iHomeWorker != UINT32_MAX)
+                        STAM_REL_COUNTER_INC(&pQueue->StatStolen);
+                }
+            }
+        if (pQueue)
+        {
+            pdmR3WorkQueueRun(pWorker, pQueue);
+            continue;
+        }
+
+        /*
+         * Nothing to do.  Announce that we're sleeping before checking the
+         * ready lists one more time, so we cannot miss a wakeup.
+         */
+        ASMAtomicWriteBool(&pWorker->fSleeping, true);
+        bool fIdle = !ASMAtomicReadBool(&pPool->fTerminate);
+        for (uint32_t i = 0; i < pPool->cWorkers && fIdle; i++)
+            if (ASMAtomicReadU32(&pPool->aWorkers[i].cReady))
+                fIdle = false;
+        if (fIdle)
+        {
+            STAM_REL_COUNTER_INC(&pWorker->StatSleeps);
+            RTSemEventWait(pWorker->hEvt, RT_INDEFINITE_WAIT);
+        }
+        ASMAtomicWriteBool(&pWorker->fSleeping, false);
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates a work queue, internal worker.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   enmPrio     The queue priority.
+ * @param   iAffinity   The home worker hint, PDMWORKQUEUE_AFFINITY_ANY if none.
+ * @param   pszName     The queue name.
+ * @param   ppQueue     Where to return the queue.
+ */
+static int pdmR3WorkQueueCreate(PVM pVM, PDMWORKPRIO enmPrio, uint32_t iAffinity, const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    VM_ASSERT_EMT(pVM);
+    AssertPtrReturn(ppQueue, VERR_INVALID_POINTER);
+    *ppQueue = NULL;
+    AssertReturn(enmPrio > PDMWORKPRIO_INVALID && enmPrio < PDMWORKPRIO_END, VERR_INVALID_PARAMETER);
+    AssertPtrReturn(pszName, VERR_INVALID_POINTER);
+    PPDMWORKPOOL pPool = pVM->pUVM->pdm.s.pWorkPool;
+    AssertReturn(pPool, VERR_WRONG_ORDER);
+
+    PPDMWORKQUEUE pQueue = (PPDMWORKQUEUE)RTMemAllocZ(sizeof(*pQueue));
+    if (!pQueue)
+        return VERR_NO_MEMORY;
+    pQueue->enmPrio     = enmPrio;
+    pQueue->iHomeWorker = iAffinity != PDMWORKQUEUE_AFFINITY_ANY ? iAffinity % pPool->cWorkers : UINT32_MAX;
+    pQueue->pPool       = pPool;
+    pQueue->pszName     = RTStrDup(pszName);
+    int rc = pQueue->pszName ? RTSemEventMultiCreate(&pQueue->hEvtIdle) : VERR_NO_STR_MEMORY;
+    if (RT_SUCCESS(rc))
+    {
+        RTCritSectEnter(&pPool->CritSect);
+        rc = pdmR3WorkPoolStart(pPool);
+        if (RT_SUCCESS(rc))
+        {
+            pQueue->pNext  = pPool->pQueues;
+            pPool->pQueues = pQueue;
+        }
+        RTCritSectLeave(&pPool->CritSect);
+        if (RT_SUCCESS(rc))
+        {
+            STAMR3RegisterF(pVM, &pQueue->StatPosted, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                            "Work items posted.", "/PDM/WorkQueue/%s/Posted", pQueue->pszName);
+            STAMR3RegisterF(pVM, &pQueue->StatStolen, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                            "Times the queue was run by another worker than the home one.", "/PDM/WorkQueue/%s/Stolen",
+                            pQueue->pszName);
+            STAMR3RegisterF(pVM, &pQueue->StatRun, STAMTYPE_PROFILE, STAMVISIBILITY_USED, STAMUNIT_TICKS_PER_CALL,
+                            "Running the posted items.", "/PDM/WorkQueue/%s/Run", pQueue->pszName);
+            *ppQueue = pQueue;
+            return VINF_SUCCESS;
+        }
+        RTSemEventMultiDestroy(pQueue->hEvtIdle);
+    }
+    RTStrFree(pQueue->pszName);
+    RTMemFree(pQueue);
+    return rc;
+}
+
+
+/**
+ * Creates a work queue for a device.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pDevIns     The device instance.
+ * @param   enmPrio     The queue priority.
+ * @param   iAffinity   The home worker hint, PDMWORKQUEUE_AFFINITY_ANY if none.
+ * @param   pfnCallback The work item callback.
+ * @param   pszName     The queue name.
+ * @param   ppQueue     Where to return the queue.
+ */
+int pdmR3WorkQueueCreateDevice(PVM pVM, PPDMDEVINS pDevIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                               PFNPDMWORKDEV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    AssertPtrReturn(pfnCallback, VERR_INVALID_POINTER);
+    int rc = pdmR3WorkQueueCreate(pVM, enmPrio, iAffinity, pszName, ppQueue);
+    if (RT_SUCCESS(rc))
+    {
+        PPDMWORKQUEUE pQueue = *ppQueue;
+        pQueue->u.Dev.pfnCallback = pfnCallback;
+        pQueue->u.Dev.pDevIns     = pDevIns;
+        pQueue->enmType           = PDMWORKQUEUETYPE_DEV;
+    }
+    return rc;
+}
+
+
+/**
+ * Creates a work queue for a driver.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pDrvIns     The driver instance.
+ * @param   enmPrio     The queue priority.
+ * @param   iAffinity   The home worker hint, PDMWORKQUEUE_AFFINITY_ANY if none.
+ * @param   pfnCallback The work item callback.
+ * @param   pszName     The queue name.
+ * @param   ppQueue     Where to return the queue.
+ */
+int pdmR3WorkQueueCreateDriver(PVM pVM, PPDMDRVINS pDrvIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                               PFNPDMWORKDRV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    AssertPtrReturn(pfnCallback, VERR_INVALID_POINTER);
+    int rc = pdmR3WorkQueueCreate(pVM, enmPrio, iAffinity, pszName, ppQueue);
+    if (RT_SUCCESS(rc))
+    {
+        PPDMWORKQUEUE pQueue = *ppQueue;
+        pQueue->u.Drv.pfnCallback = pfnCallback;
+        pQueue->u.Drv.pDrvIns     = pDrvIns;
+        pQueue->enmType           = PDMWORKQUEUETYPE_DRV;
+    }
+    return rc;
+}
+
+
+/**
+ * Creates a work queue for internal use.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   enmPrio     The queue priority.
+ * @param   iAffinity   The home worker hint, PDMWORKQUEUE_AFFINITY_ANY if none.
+ * @param   pfnCallback The work item callback.
+ * @param   pszName     The queue name.
+ * @param   ppQueue     Where to return the queue.
+ */
+VMMR3DECL(int) PDMR3WorkQueueCreateInternal(PVM pVM, PDMWORKPRIO enmPrio, uint32_t iAffinity, PFNPDMWORKINT pfnCallback,
+                                            const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    AssertPtrReturn(pfnCallback, VERR_INVALID_POINTER);
+    int rc = pdmR3WorkQueueCreate(pVM, enmPrio, iAffinity, pszName, ppQueue);
+    if (RT_SUCCESS(rc))
+    {
+        PPDMWORKQUEUE pQueue = *ppQueue;
+        pQueue->u.Int.pfnCallback = pfnCallback;
+        pQueue->enmType           = PDMWORKQUEUETYPE_INTERNAL;
+    }
+    return rc;
+}
+
+
+/**
+ * Destroys a work queue.
+ *
+ * Items already posted are run before the queue is freed, but no new items can
+ * be posted once this has been called.
+ *
+ * @returns VBox status code.
+ * @param   pQueue      The queue to destroy, NULL is ignored.
+ * @thread  EMT, not a worker thread.
+ */
+VMMR3DECL(int) PDMR3WorkQueueDestroy(PPDMWORKQUEUE pQueue)
+{
+    if (!pQueue)
+        return VINF_SUCCESS;
+    AssertPtrReturn(pQueue, VERR_INVALID_POINTER);
+    PPDMWORKPOOL pPool = pQueue->pPool;
+    PVM          pVM   = pPool->pVM;
+
+    ASMAtomicWriteBool(&pQueue->fDestroying, true);
+    int rc = PDMR3WorkQueueWaitIdle(pQueue, RT_INDEFINITE_WAIT);
+    AssertRCReturn(rc, rc);
+
+    RTCritSectEnter(&pPool->CritSect);
+    if (pPool->pQueues == pQueue)
+        pPool->pQueues = pQueue->pNext;
+    else
+    {
+        PPDMWORKQUEUE pPrev = pPool->pQueues;
+        while (pPrev && pPrev->pNext != pQueue)
+            pPrev = pPrev->pNext;
+        AssertMsg(pPrev, ("Queue %p not found\n", pQueue));
+        if (pPrev)
+            pPrev->pNext = pQueue->pNext;
+    }
+    RTCritSectLeave(&pPool->CritSect);
+
+    STAMR3DeregisterF(pVM->pUVM, "/PDM/WorkQueue/%s/*", pQueue->pszName);
+    RTSemEventMultiDestroy(pQueue->hEvtIdle);
+    RTStrFree(pQueue->pszName);
+    RTMemFree(pQueue);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Destroys all work queues owned by a device.
+ *
+ * @returns VBox status code of the first failure.
+ * @param   pVM         The cross context VM structure.
+ * @param   pDevIns     The device instance.
+ */
+int pdmR3WorkQueueDestroyDevice(PVM pVM, PPDMDEVINS pDevIns)
+{
+    PPDMWORKPOOL pPool = pVM->pUVM->pdm.s.pWorkPool;
+    if (!pPool)
+        return VINF_SUCCESS;
+
+    int rc = VINF_SUCCESS;
+    RTCritSectEnter(&pPool->CritSect);
+    PPDMWORKQUEUE pQueue = pPool->pQueues;
+    while (pQueue)
+    {
+        PPDMWORKQUEUE pNext = pQueue->pNext;
+        if (   pQueue->enmType == PDMWORKQUEUETYPE_DEV
+            && pQueue->u.Dev.pDevIns == pDevIns)
+        {
+            int rc2 = PDMR3WorkQueueDestroy(pQueue);
+            if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+                rc = rc2;
+        }
+        pQueue = pNext;
+    }
+    RTCritSectLeave(&pPool->CritSect);
+    return rc;
+}
+
+
+/**
+ * Destroys all work queues owned by a driver.
+ *
+ * @returns VBox status code of the first failure.
+ * @param   pVM         The cross context VM structure.
+ * @param   pDrvIns     The driver instance.
+ */
+int pdmR3WorkQueueDestroyDriver(PVM pVM, PPDMDRVINS pDrvIns)
+{
+    PPDMWORKPOOL pPool = pVM->pUVM->pdm.s.pWorkPool;
+    if (!pPool)
+        return VINF_SUCCESS;
+
+    int rc = VINF_SUCCESS;
+    RTCritSectEnter(&pPool->CritSect);
+    PPDMWORKQUEUE pQueue = pPool->pQueues;
+    while (pQueue)
+    {
+        PPDMWORKQUEUE pNext = pQueue->pNext;
+        if (   pQueue->enmType == PDMWORKQUEUETYPE_DRV
+            && pQueue->u.Drv.pDrvIns == pDrvIns)
+        {
+            int rc2 = PDMR3WorkQueueDestroy(pQueue);
+            if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+                rc = rc2;
+        }
+        pQueue = pNext;
+    }
+    RTCritSectLeave(&pPool->CritSect);
+    return rc;
+}
+
+
+/**
+ * Posts a work item to a queue.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_INVALID_STATE if the queue is being destroyed.
+ * @param   pQueue      The queue.
+ * @param   pItem       The work item.  Must not be posted already.
+ * @thread  Any thread.
+ */
+VMMR3DECL(int) PDMR3WorkQueuePost(PPDMWORKQUEUE pQueue, PPDMWORKITEM pItem)
+{
+    AssertPtrReturn(pQueue, VERR_INVALID_POINTER);
+    AssertPtrReturn(pItem, VERR_INVALID_POINTER);
+    AssertReturn(!ASMAtomicReadBool(&pQueue->fDestroying), VERR_INVALID_STATE);
+
+    PPDMWORKITEM pNext;
+    do
+    {
+        pNext = ASMAtomicUoReadPtrT(&pQueue->pPending, PPDMWORKITEM);
+        ASMAtomicUoWritePtr(&pItem->pNext, pNext);
+    } while (!ASMAtomicCmpXchgPtr(&pQueue->pPending, pItem, pNext));
+    STAM_REL_COUNTER_INC(&pQueue->StatPosted);
+
+    /*
+     * Schedule the queue unless it's already on a ready list or running.
+     */
+    if (   !ASMAtomicReadBool(&pQueue->fScheduled)
+        && ASMAtomicCmpXchgBool(&pQueue->fScheduled, true, false))
+    {
+        PPDMWORKPOOL pPool   = pQueue->pPool;
+        PPDMWORKER   pWorker = pQueue->iHomeWorker != UINT32_MAX
+                             ? &pPool->aWorkers[pQueue->iHomeWorker]
+                             : pdmR3WorkPoolPickWorker(pPool);
+        pdmR3WorkQueueMakeReady(pPool, pQueue, pWorker);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks whether a work queue is idle, i.e. has no items pending or running.
+ *
+ * @returns true if idle, false if not.
+ * @param   pQueue      The queue.
+ */
+VMMR3DECL(bool) PDMR3WorkQueueIsIdle(PPDMWORKQUEUE pQueue)
+{
+    AssertPtrReturn(pQueue, true);
+    return !ASMAtomicReadPtrT(&pQueue->pPending, PPDMWORKITEM)
+        && !ASMAtomicReadBool(&pQueue->fScheduled);
+}
+
+
+/**
+ * Waits for a work queue to become idle.
+ *
+ * Use this when suspending, resetting or powering off if the work items
+ * access guest state.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_TIMEOUT if it didn't go idle within the given time.
+ * @param   pQueue      The queue.
+ * @param   cMillies    How long to wait.
+ * @thread  Any thread but the worker threads.
+ */
+VMMR3DECL(int) PDMR3WorkQueueWaitIdle(PPDMWORKQUEUE pQueue, RTMSINTERVAL cMillies)
+{
+    AssertPtrReturn(pQueue, VERR_INVALID_POINTER);
+#ifdef VBOX_STRICT
+    PPDMWORKPOOL pPool = pQueue->pPool;
+    for (uint32_t i = 0; i < pPool->cWorkers; i++)
+        AssertReturn(pPool->aWorkers[i].hThread != RTThreadSelf(), VERR_DEADLOCK);
+#endif
+
+    int            rc       = VINF_SUCCESS;
+    uint64_t const msStart  = RTTimeMilliTS();
+    ASMAtomicIncU32(&pQueue->cIdleWaiters);
+    for (;;)
+    {
+        RTSemEventMultiReset(pQueue->hEvtIdle);
+        if (PDMR3WorkQueueIsIdle(pQueue))
+        {
+            /* The worker may still be on its way out of pdmR3WorkQueueRun. */
+            if (!ASMAtomicReadU32(&pQueue->cRunning))
+                break;
+            RTThreadYield();
+            continue;
+        }
+
+        RTMSINTERVAL cMsWait = cMillies;
+        if (cMillies != RT_INDEFINITE_WAIT)
+        {
+            uint64_t const cMsElapsed = RTTimeMilliTS() - msStart;
+            if (cMsElapsed >= cMillies)
+            {
+                rc = VERR_TIMEOUT;
+                break;
+            }
+            cMsWait = cMillies - (RTMSINTERVAL)cMsElapsed;
+        }
+        rc = RTSemEventMultiWait(pQueue->hEvtIdle, cMsWait);
+        if (RT_FAILURE(rc) && rc != VERR_TIMEOUT)
+            break;
+        rc = VINF_SUCCESS;
+    }
+    ASMAtomicDecU32(&pQueue->cIdleWaiters);
+    return rc;
+}
+
@@ -622,6 +622,7 @@
 #include <VBox/sup.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/stam.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
@@ -1369,6 +1370,51 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
     rc = CFGMR3QueryBoolDef(pCfgPGM, "ZeroRamPagesOnReset", &pVM->pgm.s.fZeroRamPagesOnReset, true);
     AssertLogRelRCReturn(rc, rc);
 
+    /** @cfgm{/PGM/LargePageCompactInterval, uint32_t, ms, 0, 3600000, 1000}
+     * How often to look for 4 KB backed guest RAM that can be migrated into
+     * large pages.  Only relevant when large pages are used.  0 disables it. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LargePageCompactInterval", &pVM->pgm.s.cMsLargePageCompactInterval, 1000);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.cMsLargePageCompactInterval <= RT_MS_1HOUR,
+                          ("LargePageCompactInterval=%u\n", pVM->pgm.s.cMsLargePageCompactInterval), VERR_OUT_OF_RANGE);
+
+    /** @cfgm{/PGM/LargePageCompactMaxScan, uint32_t, 1, 65536, 64}
+     * The max number of 2 MB ranges the large page compaction examines per run. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LargePageCompactMaxScan", &pVM->pgm.s.cLargePageCompactMaxScan, 64);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.cLargePageCompactMaxScan >= 1 && pVM->pgm.s.cLargePageCompactMaxScan <= _64K,
+                          ("LargePageCompactMaxScan=%u\n", pVM->pgm.s.cLargePageCompactMaxScan), VERR_OUT_OF_RANGE);
+
+    /** @cfgm{/PGM/LargePageCompactMaxPromote, uint32_t, 1, 512, 4}
+     * The max number of 2 MB ranges the large page compaction migrates per run.
+     * This bounds the time the EMTs are held up. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LargePageCompactMaxPromote", &pVM->pgm.s.cLargePageCompactMaxPromote, 4);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.cLargePageCompactMaxPromote >= 1 && pVM->pgm.s.cLargePageCompactMaxPromote <= 512,
+                          ("LargePageCompactMaxPromote=%u\n", pVM->pgm.s.cLargePageCompactMaxPromote), VERR_OUT_OF_RANGE);
+
+    /** @cfgm{/PGM/LargePageCompactMinPages, uint32_t, 1, 512, 384}
+     * The min number of allocated 4 KB pages a 2 MB range must have for the
+     * large page compaction to migrate it.  Lower values trade host memory for
+     * fewer TLB misses as the zero pages in the range get backed too. */
+    rc = CFGMR3QueryU32Def(pCfgPGM, "LargePageCompactMinPages", &pVM->pgm.s.cLargePageCompactMinPages, 384);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(pVM->pgm.s.cLargePageCompactMinPages >= 1 && pVM->pgm.s.cLargePageCompactMinPages <= _2M / PAGE_SIZE,
+                          ("LargePageCompactMinPages=%u\n", pVM->pgm.s.cLargePageCompactMinPages), VERR_OUT_OF_RANGE);
+
+    /** @cfgm{/PGM/PageMapTlbEntries, uint32_t, 16, 1024, 1024}
+     * The number of entries in the guest page mapping TLB.  Must be a power of
+     * two.  Guests with large working sets benefit from the full size, while
+     * smaller values make the TLB flushes cheaper. */
+    uint32_t cPageMapTlbEntries;
+    rc = CFGMR3QueryU32Def(pCfgPGM, "PageMapTlbEntries", &cPageMapTlbEntries, PGM_PAGER3MAPTLB_ENTRIES);
+    AssertLogRelRCReturn(rc, rc);
+    AssertLogRelMsgReturn(   cPageMapTlbEntries >= 16
+                          && cPageMapTlbEntries <= PGM_PAGER3MAPTLB_ENTRIES
+                          && RT_IS_POWER_OF_TWO(cPageMapTlbEntries),
+                          ("PageMapTlbEntries=%u\n", cPageMapTlbEntries), VERR_OUT_OF_RANGE);
+    pVM->pgm.s.PhysTlbHC.fIdxMask = cPageMapTlbEntries - 1;
+
 #ifdef VBOX_WITH_STATISTICS
     /*
      * Allocate memory for the statistics before someone tries to use them.
@@ -1748,6 +1794,12 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG(pVM, &pPGM->StatLargePageReused,                STAMTYPE_COUNTER, "/PGM/LargePage/Reused",              STAMUNIT_OCCURENCES, "The number of times we've reused a large page.");
     STAM_REL_REG(pVM, &pPGM->StatLargePageRefused,               STAMTYPE_COUNTER, "/PGM/LargePage/Refused",             STAMUNIT_OCCURENCES, "The number of times we couldn't use a large page.");
     STAM_REL_REG(pVM, &pPGM->StatLargePageRecheck,               STAMTYPE_COUNTER, "/PGM/LargePage/Recheck",             STAMUNIT_OCCURENCES, "The number of times we've rechecked a disabled large page.");
+    STAM_REL_REG(pVM, &pPGM->uLargePageCoverage,                 STAMTYPE_U32,     "/PGM/LargePage/Coverage",            STAMUNIT_PCT,       "Percentage of the guest RAM backed by large pages.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageCompactScanned,        STAMTYPE_COUNTER, "/PGM/LargePage/Compact/Scanned",     STAMUNIT_OCCURENCES, "The number of 2 MB ranges examined by the compaction.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageCompactIneligible,     STAMTYPE_COUNTER, "/PGM/LargePage/Compact/Ineligible",  STAMUNIT_OCCURENCES, "The number of 2 MB ranges the compaction could not promote.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageCompactPromoted,       STAMTYPE_COUNTER, "/PGM/LargePage/Compact/Promoted",    STAMUNIT_OCCURENCES, "The number of 2 MB ranges the compaction promoted to large pages.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageCompactAllocFailed,    STAMTYPE_COUNTER, "/PGM/LargePage/Compact/AllocFailed", STAMUNIT_OCCURENCES, "The number of times the compaction failed to allocate a large page.");
+    STAM_REL_REG(pVM, &pPGM->StatLargePageCompact,               STAMTYPE_PROFILE, "/PGM/LargePage/Compact",             STAMUNIT_TICKS_PER_CALL, "Profiles the compaction runs.");
 
     STAM_REL_REG(pVM, &pPGM->StatShModCheck,                     STAMTYPE_PROFILE, "/PGM/ShMod/Check",                   STAMUNIT_TICKS_PER_CALL, "Profiles the shared module checking.");
 
@@ -2306,7 +2358,8 @@ VMMR3_INT_DECL(int) PGMR3InitCompleted(PVM pVM, VMINITCOMPLETED enmWhat)
 #else
             AssertLogRelReturn(!pVM->pgm.s.fPciPassthrough, VERR_PGM_PCI_PASSTHRU_MISCONFIG);
 #endif
-            break;
+            /* HM has made up its mind about large pages by now. */
+            return pgmR3PhysLargePageCompactInit(pVM);
 
         default:
             /* shut up gcc */
@@ -2435,6 +2488,8 @@ VMMR3DECL(void) PGMR3Relocate(PVM pVM, RTGCINTPTR offDelta)
     PGMRELOCHANDLERARGS Args = { offDelta, pVM };
     RTAvlroGCPhysDoWithAll(&pVM->pgm.s.pTreesR3->PhysHandlers,     true, pgmR3RelocatePhysHandler,      &Args);
     pVM->pgm.s.pLastPhysHandlerRC = NIL_RTRCPTR;
+    for (VMCPUID i = 0; i < pVM->cCpus; i++)
+        pVM->aCpus[i].pgm.s.pLastPhysHandlerRC = NIL_RTRCPTR;
 
     PPGMPHYSHANDLERTYPEINT pCurPhysType;
     RTListOff32ForEach(&pVM->pgm.s.pTreesR3->HeadPhysHandlerTypes, pCurPhysType, PGMPHYSHANDLERTYPEINT, ListNode)
@@ -3774,6 +3829,7 @@ void pgmR3RefreshShadowModeAfterA20Change(PVMCPU pVCpu)
     AssertReleaseRC(rc);
     rc = pgmR3ReEnterShadowModeAfterPoolFlush(pVCpu->CTX_SUFF(pVM), pVCpu);
     AssertReleaseRC(rc);
+    IEMTlbInvalidateAll(pVCpu);
 }
 
 
@@ -24,6 +24,7 @@
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/vmm/tm.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -592,145 +593,77 @@ VMMR3DECL(int) PGMR3PhysGCPhys2CCPtrReadOnlyExternal(PVM pVM, RTGCPHYS GCPhys, v
 }
 
 
-#define MAKE_LEAF(a_pNode) \
-    do { \
-        (a_pNode)->pLeftR3  = NIL_RTR3PTR; \
-        (a_pNode)->pRightR3 = NIL_RTR3PTR; \
-        (a_pNode)->pLeftR0  = NIL_RTR0PTR; \
-        (a_pNode)->pRightR0 = NIL_RTR0PTR; \
-        (a_pNode)->pLeftRC  = NIL_RTRCPTR; \
-        (a_pNode)->pRightRC = NIL_RTRCPTR; \
-    } while (0)
-
-#define INSERT_LEFT(a_pParent, a_pNode) \
-    do { \
-        (a_pParent)->pLeftR3 = (a_pNode); \
-        (a_pParent)->pLeftR0 = (a_pNode)->pSelfR0; \
-        (a_pParent)->pLeftRC = (a_pNode)->pSelfRC; \
-    } while (0)
-#define INSERT_RIGHT(a_pParent, a_pNode) \
-    do { \
-        (a_pParent)->pRightR3 = (a_pNode); \
-        (a_pParent)->pRightR0 = (a_pNode)->pSelfR0; \
-        (a_pParent)->pRightRC = (a_pNode)->pSelfRC; \
-    } while (0)
-
-
 /**
- * Recursive tree builder.
+ * Rebuilds the RAM range lookup table.
  *
- * @param   ppRam           Pointer to the iterator variable.
- * @param   iDepth          The current depth.  Inserts a leaf node if 0.
- */
-static PPGMRAMRANGE pgmR3PhysRebuildRamRangeSearchTreesRecursively(PPGMRAMRANGE *ppRam, int iDepth)
-{
-    PPGMRAMRANGE pRam;
-    if (iDepth <= 0)
-    {
-        /*
-         * Leaf node.
-         */
-        pRam = *ppRam;
-        if (pRam)
-        {
-            *ppRam = pRam->pNextR3;
-            MAKE_LEAF(pRam);
-        }
-    }
-    else
-    {
-
-        /*
-         * Intermediate node.
-         */
-        PPGMRAMRANGE pLeft = pgmR3PhysRebuildRamRangeSearchTreesRecursively(ppRam, iDepth - 1);
-
-        pRam = *ppRam;
-        if (!pRam)
-            return pLeft;
-        *ppRam = pRam->pNextR3;
-        MAKE_LEAF(pRam);
-        INSERT_LEFT(pRam, pLeft);
-
-        PPGMRAMRANGE pRight = pgmR3PhysRebuildRamRangeSearchTreesRecursively(ppRam, iDepth - 1);
-        if (pRight)
-            INSERT_RIGHT(pRam, pRight);
-    }
-    return pRam;
-}
-
-
-/**
- * Rebuilds the RAM range search trees.
+ * The table is double buffered so that EMTs doing lockless lookups (ring-0,
+ * raw-mode and the ring-3 slow paths) always see a consistent table.  The new
+ * table is built in the inactive buffer, growing it when necessary, and then
+ * published.  Should the hyper heap run dry, the lookup pointers are set to
+ * NULL and the lookup code will fall back on walking the RAM range list.
  *
  * @param   pVM         The cross context VM structure.
  */
-static void pgmR3PhysRebuildRamRangeSearchTrees(PVM pVM)
+static void pgmR3PhysRebuildRamRangeLookup(PVM pVM)
 {
+    uint32_t cRanges = 0;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
+        cRanges++;
 
     /*
-     * Create the reasonably balanced tree in a sequential fashion.
-     * For simplicity (laziness) we use standard recursion here.
+     * Pick the buffer not currently in use and make sure it is large enough.
      */
-    int             iDepth = 0;
-    PPGMRAMRANGE    pRam   = pVM->pgm.s.pRamRangesXR3;
-    PPGMRAMRANGE    pRoot  = pgmR3PhysRebuildRamRangeSearchTreesRecursively(&pRam, 0);
-    while (pRam)
+    unsigned const      iBuf    = pVM->pgm.s.pRamRangeLookupR3 == pVM->pgm.s.apRamRangeLookupR3[0];
+    PPGMRAMRANGELOOKUP  pLookup = pVM->pgm.s.apRamRangeLookupR3[iBuf];
+    if (!pLookup || pLookup->cMaxEntries < cRanges)
     {
-        PPGMRAMRANGE pLeft = pRoot;
-
-        pRoot = pRam;
-        pRam = pRam->pNextR3;
-        MAKE_LEAF(pRoot);
-        INSERT_LEFT(pRoot, pLeft);
-
-        PPGMRAMRANGE pRight = pgmR3PhysRebuildRamRangeSearchTreesRecursively(&pRam, iDepth);
-        if (pRight)
-            INSERT_RIGHT(pRoot, pRight);
-        /** @todo else: rotate the tree. */
+        if (pLookup)
+        {
+            pVM->pgm.s.apRamRangeLookupR3[iBuf] = NULL;
+            MMHyperFree(pVM, pLookup);
+            pLookup = NULL;
+        }
 
-        iDepth++;
+        uint32_t const cMaxEntries = RT_ALIGN_32(cRanges + 1, 16);
+        int rc = MMHyperAlloc(pVM, RT_OFFSETOF(PGMRAMRANGELOOKUP, aEntries) + cMaxEntries * sizeof(pLookup->aEntries[0]), 0,
+                              MM_TAG_PGM_PHYS, (void **)&pLookup);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("PGM: Failed to allocate a RAM range lookup table for %u ranges (%Rrc), using linear search\n",
+                    cRanges, rc));
+            ASMAtomicWriteNullPtr(&pVM->pgm.s.pRamRangeLookupR3);
+            pVM->pgm.s.pRamRangeLookupR0 = NIL_RTR0PTR;
+            pVM->pgm.s.pRamRangeLookupRC = NIL_RTRCPTR;
+            return;
+        }
+        pLookup->cMaxEntries = cMaxEntries;
+        pVM->pgm.s.apRamRangeLookupR3[iBuf] = pLookup;
     }
 
-    pVM->pgm.s.pRamRangeTreeR3 = pRoot;
-    pVM->pgm.s.pRamRangeTreeR0 = pRoot ? pRoot->pSelfR0 : NIL_RTR0PTR;
-    pVM->pgm.s.pRamRangeTreeRC = pRoot ? pRoot->pSelfRC : NIL_RTRCPTR;
-
-#ifdef VBOX_STRICT
     /*
-     * Verify that the above code works.
+     * Fill it.  The list is sorted by address, so is the table.
      */
-    unsigned cRanges = 0;
-    for (pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
-        cRanges++;
-    Assert(cRanges > 0);
-
-    unsigned cMaxDepth = ASMBitLastSetU32(cRanges);
-    if ((1U << cMaxDepth) < cRanges)
-        cMaxDepth++;
-
-    for (pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
+    uint32_t i = 0;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3, i++)
     {
-        unsigned     cDepth = 0;
-        PPGMRAMRANGE pRam2 = pVM->pgm.s.pRamRangeTreeR3;
-        for (;;)
-        {
-            if (pRam == pRam2)
-                break;
-            Assert(pRam2);
-            if (pRam->GCPhys < pRam2->GCPhys)
-                pRam2 = pRam2->pLeftR3;
-            else
-                pRam2 = pRam2->pRightR3;
-        }
-        AssertMsg(cDepth <= cMaxDepth, ("cDepth=%d cMaxDepth=%d\n", cDepth, cMaxDepth));
+        Assert(!i || pLookup->aEntries[i - 1].GCPhysLast < pRam->GCPhys);
+        pLookup->aEntries[i].GCPhysLast = pRam->GCPhysLast;
+        pLookup->aEntries[i].pRamR3     = pRam;
+        pLookup->aEntries[i].pRamR0     = pRam->pSelfR0;
+        pLookup->aEntries[i].pRamRC     = pRam->pSelfRC;
     }
-#endif /* VBOX_STRICT */
+    Assert(i == cRanges);
+    pLookup->cEntries = cRanges;
+
+    /*
+     * Publish it.
+     */
+    ASMAtomicWritePtr(&pVM->pgm.s.pRamRangeLookupR3, pLookup);
+    pVM->pgm.s.pRamRangeLookupR0 = MMHyperR3ToR0(pVM, pLookup);
+    pVM->pgm.s.pRamRangeLookupRC = MMHyperR3ToRC(pVM, pLookup);
+    ASMCompilerBarrier();
 }
 
-#undef MAKE_LEAF
-#undef INSERT_LEFT
-#undef INSERT_RIGHT
 
 /**
  * Relinks the RAM ranges using the pSelfRC and pSelfR0 pointers.
@@ -780,7 +713,7 @@ void pgmR3PhysRelinkRamRanges(PVM pVM)
     }
     ASMAtomicIncU32(&pVM->pgm.s.idRamRangesGen);
 
-    pgmR3PhysRebuildRamRangeSearchTrees(pVM);
+    pgmR3PhysRebuildRamRangeLookup(pVM);
 }
 
 
@@ -818,7 +751,7 @@ static void pgmR3PhysLinkRamRange(PVM pVM, PPGMRAMRANGE pNew, PPGMRAMRANGE pPrev
     }
     ASMAtomicIncU32(&pVM->pgm.s.idRamRangesGen);
 
-    pgmR3PhysRebuildRamRangeSearchTrees(pVM);
+    pgmR3PhysRebuildRamRangeLookup(pVM);
     pgmUnlock(pVM);
 }
 
@@ -854,7 +787,7 @@ static void pgmR3PhysUnlinkRamRange2(PVM pVM, PPGMRAMRANGE pRam, PPGMRAMRANGE pP
     }
     ASMAtomicIncU32(&pVM->pgm.s.idRamRangesGen);
 
-    pgmR3PhysRebuildRamRangeSearchTrees(pVM);
+    pgmR3PhysRebuildRamRangeLookup(pVM);
     pgmUnlock(pVM);
 }
 
@@ -3836,7 +3769,7 @@ static DECLCALLBACK(int) pgmR3PhysChunkUnmapCandidateCallback(PAVLU32NODECORE pN
     }
 #endif
 
-    for (unsigned i = 0; i < RT_ELEMENTS(pVM->pgm.s.PhysTlbHC.aEntries); i++)
+    for (unsigned i = 0; i <= pVM->pgm.s.PhysTlbHC.fIdxMask; i++)
         if (pVM->pgm.s.PhysTlbHC.aEntries[i].pMap == pChunk)
             return 0;
 
@@ -4275,6 +4208,319 @@ VMMR3DECL(int) PGMR3PhysAllocateLargeHandyPage(PVM pVM, RTGCPHYS GCPhys)
 }
 
 
+#ifdef PGM_WITH_LARGE_PAGES
+
+/**
+ * Tries to promote a 2 MB guest physical range backed by 4 KB pages to a
+ * large page; helper for pgmR3PhysLargePageCompactRendezvous.
+ *
+ * The content of the allocated pages is copied into a freshly allocated large
+ * page, the zero pages are cleared, and the old pages are returned to GMM.
+ * The shadow page tables for the range are flushed so the next \#PF / EPT
+ * violation maps it using a 2 MB PDE.
+ *
+ * @returns VBox status code.
+ * @retval  VINF_SUCCESS if the range was promoted.
+ * @retval  VERR_PGM_INVALID_LARGE_PAGE_RANGE if the range cannot be promoted.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pRam        The RAM range containing the whole 2 MB range.
+ * @param   GCPhysBase  The 2 MB aligned guest physical address.
+ */
+static int pgmR3PhysLargePageCompactRange(PVM pVM, PPGMRAMRANGE pRam, RTGCPHYS GCPhysBase)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    Assert(!(GCPhysBase & ~X86_PDE2M_PAE_PG_MASK));
+    Assert(GCPhysBase >= pRam->GCPhys && GCPhysBase + _2M - 1 <= pRam->GCPhysLast);
+    PPGMPAGE const paPages = &pRam->aPages[(GCPhysBase - pRam->GCPhys) >> PAGE_SHIFT];
+
+    /*
+     * Check that the range is worth promoting and that we can safely move it.
+     * Anything with handlers, mapping locks (DMA) or special state (shared,
+     * ballooned, write monitored) is left alone.
+     */
+    if (    PGM_PAGE_GET_PDE_TYPE(&paPages[0]) == PGM_PAGE_PDE_TYPE_PDE
+        ||  PGM_PAGE_GET_PDE_TYPE(&paPages[0]) == PGM_PAGE_PDE_TYPE_PDE_DISABLED)
+        return VERR_PGM_INVALID_LARGE_PAGE_RANGE;
+
+    uint32_t cAllocated = 0;
+    for (uint32_t iPage = 0; iPage < _2M / PAGE_SIZE; iPage++)
+    {
+        PPGMPAGE pPage = &paPages[iPage];
+        if (    PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+            ||  PGM_PAGE_HAS_ANY_HANDLERS(pPage)
+            ||  PGM_PAGE_GET_WRITE_LOCKS(pPage) != 0
+            ||  PGM_PAGE_GET_READ_LOCKS(pPage) != 0)
+            return VERR_PGM_INVALID_LARGE_PAGE_RANGE;
+        if (PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED)
+            cAllocated++;
+        else if (PGM_PAGE_GET_STATE(pPage) != PGM_PAGE_STATE_ZERO)
+            return VERR_PGM_INVALID_LARGE_PAGE_RANGE;
+    }
+    if (cAllocated < pVM->pgm.s.cLargePageCompactMinPages)
+        return VERR_PGM_INVALID_LARGE_PAGE_RANGE;
+
+    /*
+     * Get the free request ready before we allocate anything, so we don't
+     * have to back out after copying.
+     */
+    PGMMFREEPAGESREQ pReq;
+    uint32_t         cPendingPages = 0;
+    int rc = GMMR3FreePagesPrepare(pVM, &pReq, PGMPHYS_FREE_PAGE_BATCH_SIZE, GMMACCOUNT_BASE);
+    AssertLogRelRCReturn(rc, rc);
+
+    rc = VMMR3CallR0(pVM, VMMR0_DO_PGM_ALLOCATE_LARGE_HANDY_PAGE, 0, NULL);
+    if (RT_FAILURE(rc))
+    {
+        GMMR3FreePagesCleanup(pReq);
+        return rc;
+    }
+    Assert(pVM->pgm.s.cLargeHandyPages == 1);
+    uint32_t const idPageBase  = pVM->pgm.s.aLargeHandyPage[0].idPage;
+    RTHCPHYS const HCPhysBase  = pVM->pgm.s.aLargeHandyPage[0].HCPhysGCPhys;
+    pVM->pgm.s.cLargeHandyPages = 0;
+
+    /*
+     * Copy the pages.  Same assumption as PGMR3PhysAllocateLargeHandyPage
+     * about the page IDs increasing along with the host physical address.
+     * Each page is mapped individually since mapping the source pages may
+     * evict chunk mappings.
+     */
+    for (uint32_t iPage = 0; iPage < _2M / PAGE_SIZE; iPage++)
+    {
+        PPGMPAGE pPage  = &paPages[iPage];
+        RTGCPHYS GCPhys = GCPhysBase + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        void *pvDst;
+        rc = pgmPhysPageMapByPageID(pVM, idPageBase + iPage, HCPhysBase + ((RTHCPHYS)iPage << PAGE_SHIFT), &pvDst);
+        if (RT_SUCCESS(rc))
+        {
+            if (PGM_PAGE_IS_ZERO(pPage))
+                ASMMemZeroPage(pvDst);
+            else
+            {
+                void const *pvSrc;
+                rc = pgmPhysPageMapReadOnly(pVM, pPage, GCPhys, &pvSrc);
+                if (RT_SUCCESS(rc))
+                    memcpy(pvDst, pvSrc, PAGE_SIZE);
+            }
+        }
+        if (RT_FAILURE(rc))
+        {
+            AssertLogRelMsgFailed(("GCPhys=%RGp idPage=%#x rc=%Rrc\n", GCPhys, idPageBase + iPage, rc));
+            GMMR3FreePagesCleanup(pReq);
+            int rc2 = GMMR3FreeLargePage(pVM, idPageBase);
+            AssertLogRelRC(rc2);
+            return rc;
+        }
+    }
+
+    /*
+     * Switch the pages over.  The shadow PTEs must go before the tracking
+     * information is reset by pgmPhysFreePage.
+     */
+    bool fFlushTLBs = false;
+    for (uint32_t iPage = 0; iPage < _2M / PAGE_SIZE; iPage++)
+    {
+        PPGMPAGE pPage  = &paPages[iPage];
+        RTGCPHYS GCPhys = GCPhysBase + ((RTGCPHYS)iPage << PAGE_SHIFT);
+
+        if (PGM_PAGE_GET_TRACKING(pPage))
+        {
+            int rc2 = pgmPoolTrackUpdateGCPhys(pVM, GCPhys, pPage, true /*fFlushPTEs*/, &fFlushTLBs);
+            AssertMsg(rc2 == VINF_SUCCESS || rc2 == VINF_PGM_SYNC_CR3, ("%Rrc\n", rc2)); NOREF(rc2);
+        }
+
+        rc = pgmPhysFreePage(pVM, pReq, &cPendingPages, pPage, GCPhys);
+        AssertLogRelRCReturnStmt(rc, GMMR3FreePagesCleanup(pReq), rc);
+        Assert(PGM_PAGE_IS_ZERO(pPage));
+
+        pVM->pgm.s.cZeroPages--;
+        pVM->pgm.s.cPrivatePages++;
+        PGM_PAGE_SET_HCPHYS(pVM, pPage, HCPhysBase + ((RTHCPHYS)iPage << PAGE_SHIFT));
+        PGM_PAGE_SET_PAGEID(pVM, pPage, idPageBase + iPage);
+        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ALLOCATED);
+        PGM_PAGE_SET_PDE_TYPE(pVM, pPage, PGM_PAGE_PDE_TYPE_PDE);
+        PGM_PAGE_SET_PTE_INDEX(pVM, pPage, 0);
+        PGM_PAGE_SET_TRACKING(pVM, pPage, 0);
+    }
+    pVM->pgm.s.cLargePages++;
+
+    if (cPendingPages)
+    {
+        rc = GMMR3FreePagesPerform(pVM, pReq, cPendingPages);
+        AssertLogRelRC(rc);
+    }
+    GMMR3FreePagesCleanup(pReq);
+
+    /* Get rid of the 4 KB shadow page tables so the range gets a 2 MB PDE. */
+    pgmR3PoolFlushPhysPTs(pVM, GCPhysBase);
+
+    Log(("pgmR3PhysLargePageCompactRange: %RGp -> %RHp (%u allocated pages)\n", GCPhysBase, HCPhysBase, cAllocated));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Rendezvous callback that scans part of the guest RAM for 2 MB ranges to
+ * promote to large pages.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   pvUser      Unused.
+ */
+static DECLCALLBACK(VBOXSTRICTRC) pgmR3PhysLargePageCompactRendezvous(PVM pVM, PVMCPU pVCpu, void *pvUser)
+{
+    NOREF(pVCpu); NOREF(pvUser);
+
+    pgmLock(pVM);
+    if (pVM->pgm.s.cLargePageCompactBackoff)
+    {
+        pVM->pgm.s.cLargePageCompactBackoff--;
+        pgmUnlock(pVM);
+        return VINF_SUCCESS;
+    }
+    STAM_REL_PROFILE_START(&pVM->pgm.s.StatLargePageCompact, a);
+
+    uint32_t cPromoted = 0;
+    RTGCPHYS GCPhys    = pVM->pgm.s.GCPhysLargePageCompactNext;
+    for (uint32_t cScanned = 0;
+         cScanned < pVM->pgm.s.cLargePageCompactMaxScan && cPromoted < pVM->pgm.s.cLargePageCompactMaxPromote;
+         cScanned++)
+    {
+        PPGMRAMRANGE pRam = pgmPhysGetRangeAtOrAbove(pVM, GCPhys);
+        if (!pRam)
+        {
+            /* Wrap around. */
+            pRam = pgmPhysGetRangeAtOrAbove(pVM, 0);
+            if (!pRam)
+                break;
+        }
+
+        RTGCPHYS GCPhysBase = RT_ALIGN_T(RT_MAX(GCPhys, pRam->GCPhys), _2M, RTGCPHYS);
+        if (    GCPhysBase < pRam->GCPhys
+            ||  GCPhysBase + _2M - 1 > pRam->GCPhysLast)
+        {
+            /* No complete 2 MB range left in this RAM range; continue with the next one. */
+            GCPhys = pRam->GCPhysLast + 1;
+            continue;
+        }
+        GCPhys = GCPhysBase + _2M;
+
+        STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageCompactScanned);
+        int rc = pgmR3PhysLargePageCompactRange(pVM, pRam, GCPhysBase);
+        if (rc == VINF_SUCCESS)
+        {
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageCompactPromoted);
+            cPromoted++;
+        }
+        else if (rc == VERR_PGM_INVALID_LARGE_PAGE_RANGE)
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageCompactIneligible);
+        else
+        {
+            /* Most likely the host is short on contiguous memory; give it a while. */
+            LogFlow(("pgmR3PhysLargePageCompactRendezvous: %RGp failed with %Rrc\n", GCPhysBase, rc));
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLargePageCompactAllocFailed);
+            pVM->pgm.s.cLargePageCompactBackoff = 16;
+            break;
+        }
+    }
+    pVM->pgm.s.GCPhysLargePageCompactNext = GCPhys;
+
+    if (cPromoted)
+    {
+        PGM_INVL_ALL_VCPU_TLBS(pVM);
+        pgmPhysInvalidatePageMapTLB(pVM);
+    }
+
+    /* Update the coverage statistics. */
+    uint32_t const cRamPages = pVM->pgm.s.cAllPages - pVM->pgm.s.cPureMmioPages;
+    pVM->pgm.s.uLargePageCoverage = cRamPages
+                                  ? (uint32_t)((uint64_t)pVM->pgm.s.cLargePages * (_2M / PAGE_SIZE) * 100 / cRamPages)
+                                  : 0;
+
+    STAM_REL_PROFILE_STOP(&pVM->pgm.s.StatLargePageCompact, a);
+    pgmUnlock(pVM);
+
+    /* Flush the recompiler's TLB as well. */
+    if (cPromoted)
+        for (VMCPUID i = 0; i < pVM->cCpus; i++)
+            CPUMSetChangedFlags(&pVM->aCpus[i], CPUM_CHANGED_GLOBAL_TLB_FLUSH);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * EMT worker for the large page compaction timer.
+ *
+ * @param   pVM         The cross context VM structure.
+ */
+static DECLCALLBACK(void) pgmR3PhysLargePageCompactWorker(PVM pVM)
+{
+    int rc = VMMR3EmtRendezvous(pVM, VMMEMTRENDEZVOUS_FLAGS_TYPE_ONCE, pgmR3PhysLargePageCompactRendezvous, NULL);
+    AssertLogRelRC(rc);
+
+    TMTimerSetMillies(pVM->pgm.s.pLargePageCompactTimerR3, pVM->pgm.s.cMsLargePageCompactInterval);
+}
+
+
+/**
+ * @callback_method_impl{FNTMTIMERINT, Large page compaction timer.}
+ *
+ * Runs the compaction as a request on an EMT to stay clear of the locks held
+ * while timers are serviced.  The worker re-arms the timer.
+ */
+static DECLCALLBACK(void) pgmR3PhysLargePageCompactTimer(PVM pVM, PTMTIMER pTimer, void *pvUser)
+{
+    NOREF(pvUser);
+    if (    PGMIsUsingLargePages(pVM)
+        &&  !pVM->pgm.s.LiveSave.fActive)
+    {
+        int rc = VMR3ReqCallNoWait(pVM, VMCPUID_ANY_QUEUE, (PFNRT)pgmR3PhysLargePageCompactWorker, 1, pVM);
+        if (RT_SUCCESS(rc))
+            return;
+        AssertLogRelRC(rc);
+    }
+    TMTimerSetMillies(pTimer, pVM->pgm.s.cMsLargePageCompactInterval);
+}
+
+#endif /* PGM_WITH_LARGE_PAGES */
+
+/**
+ * Sets up the background large page compaction.
+ *
+ * Called once HM has decided whether large pages are used.  Guest RAM that
+ * ended up backed by 4 KB pages (large page allocation failures, ranges that
+ * were ballooned, shared or write monitored for a while) is periodically
+ * migrated into large pages.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ */
+int pgmR3PhysLargePageCompactInit(PVM pVM)
+{
+#ifdef PGM_WITH_LARGE_PAGES
+    if (    !PGMIsUsingLargePages(pVM)
+        ||  !pVM->pgm.s.cMsLargePageCompactInterval
+        ||  pVM->pgm.s.fPciPassthrough /* the IOMMU maps the host pages */)
+        return VINF_SUCCESS;
+
+    int rc = TMR3TimerCreateInternal(pVM, TMCLOCK_REAL, pgmR3PhysLargePageCompactTimer, NULL,
+                                     "PGM Large Page Compaction", &pVM->pgm.s.pLargePageCompactTimerR3);
+    AssertRCReturn(rc, rc);
+    rc = TMTimerSetMillies(pVM->pgm.s.pLargePageCompactTimerR3, pVM->pgm.s.cMsLargePageCompactInterval);
+    AssertRCReturn(rc, rc);
+
+    LogRel(("PGM: Large page compaction every %u ms (max %u of %u ranges per run, min %u allocated pages)\n",
+            pVM->pgm.s.cMsLargePageCompactInterval, pVM->pgm.s.cLargePageCompactMaxPromote,
+            pVM->pgm.s.cLargePageCompactMaxScan, pVM->pgm.s.cLargePageCompactMinPages));
+#else
+    NOREF(pVM);
+#endif
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Response to VM_FF_PGM_NEED_HANDY_PAGES and VMMCALLRING3_PGM_ALLOCATE_HANDY_PAGES.
  *
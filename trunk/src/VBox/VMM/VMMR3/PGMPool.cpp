@@ -826,6 +826,39 @@ void pgmR3PoolWriteProtectPages(PVM pVM)
     }
 }
 
+/**
+ * Flushes the shadow page tables mapping a 2 MB guest physical range with
+ * 4 KB pages, so the next sync can map it using a large page PDE.
+ *
+ * Only the nested paging kinds are considered as these are the only ones
+ * where large pages are used.
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhysBase  The 2 MB aligned guest physical address.
+ */
+void pgmR3PoolFlushPhysPTs(PVM pVM, RTGCPHYS GCPhysBase)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    Assert(!(GCPhysBase & ~X86_PDE2M_PAE_PG_MASK));
+    PPGMPOOL pPool = pVM->pgm.s.CTX_SUFF(pPool);
+
+    unsigned i = pPool->aiHash[PGMPOOL_HASH(GCPhysBase)];
+    while (i != NIL_PGMPOOL_IDX)
+    {
+        PPGMPOOLPAGE pPage = &pPool->aPages[i];
+        i = pPage->iNext; /* flushing unlinks the page */
+        if (    pPage->GCPhys == GCPhysBase
+            &&  (   pPage->enmKind == PGMPOOLKIND_EPT_PT_FOR_PHYS
+                 || pPage->enmKind == PGMPOOLKIND_PAE_PT_FOR_PHYS)
+            &&  !pgmPoolIsPageLocked(pPage))
+        {
+            Log(("pgmR3PoolFlushPhysPTs: flushing %RGp idx=%d\n", GCPhysBase, pPage->idx));
+            int rc = pgmPoolFlushPage(pPool, pPage);
+            AssertRC(rc);
+        }
+    }
+}
+
 #ifdef VBOX_WITH_DEBUGGER
 /**
  * @callback_method_impl{FNDBGCCMD, The '.pgmpoolcheck' command.}
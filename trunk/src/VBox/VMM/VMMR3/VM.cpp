@@ -46,6 +46,7 @@
 #include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/vmm.h>
 #include <VBox/vmm/gvmm.h>
+#include <VBox/vmm/gmm.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/cpum.h>
 #include <VBox/vmm/selm.h>
@@ -889,6 +890,13 @@ static int vmR3InitRing3(PVM pVM, PUVM pUVM)
             return rc;
     }
 
+    /*
+     * Bind the EMTs to host NUMA nodes before any guest memory is allocated.
+     */
+    rc = GMMR3InitNuma(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Register statistics.
      */
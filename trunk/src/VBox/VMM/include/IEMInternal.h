@@ -48,6 +48,17 @@ RT_C_DECLS_BEGIN
 # define IEM_VERIFICATION_MODE_FULL
 #endif
 
+/** @def IEM_WITH_CODE_TLB
+ * Enables the ring-3 instruction fetch TLB (IEMCODETLB).  Not used with the
+ * verification modes as they need to see every opcode read. */
+#if (   defined(IN_RING3) \
+     && !defined(IEM_VERIFICATION_MODE_FULL) \
+     && !defined(IEM_VERIFICATION_MODE_MINIMAL) \
+     && !defined(IEM_WITH_CODE_TLB)) \
+  || defined(DOXYGEN_RUNNING)
+# define IEM_WITH_CODE_TLB
+#endif
+
 
 /** @def IEM_CFG_TARGET_CPU
  * The minimum target CPU for the IEM emulation (IEMTARGETCPU_XXX value).
@@ -224,6 +235,77 @@ typedef IEMVERIFYEVTREC *PIEMVERIFYEVTREC;
 #endif /* IEM_VERIFICATION_MODE_FULL */
 
 
+/**
+ * An instruction fetch TLB entry.
+ *
+ * Caches the translation of a guest linear code page and a ring-3 mapping of
+ * the guest physical page backing it.  The opcode bytes themselves are read
+ * straight from the mapping on every fetch, so writes to the page by other
+ * CPUs, devices or IEM itself are seen without any write monitoring.
+ */
+typedef struct IEMCODETLBENTRY
+{
+    /** The tag: the linear page number (bits 12 thru 47) ORed with the TLB
+     * revision it was loaded in (IEMCODETLB::uRevision). */
+    uint64_t                        uTag;
+    /** The physical revision this entry was loaded in. */
+    uint64_t                        uPhysRev;
+    /** The guest physical address of the page. */
+    RTGCPHYS                        GCPhysPage;
+    /** The ring-3 mapping of the page (page aligned). */
+    R3PTRTYPE(uint8_t const *)      pbMappingR3;
+#if HC_ARCH_BITS == 32
+    uint32_t                        u32Alignment;
+#endif
+    /** The page table flags (X86_PTE_US and X86_PTE_PAE_NX) from the walk. */
+    uint64_t                        fFlags;
+} IEMCODETLBENTRY;
+AssertCompileSize(IEMCODETLBENTRY, 40);
+/** Pointer to an instruction fetch TLB entry. */
+typedef IEMCODETLBENTRY *PIEMCODETLBENTRY;
+
+/** The number of entries in the instruction fetch TLB (power of two). */
+#define IEMCODETLB_ENTRIES              16
+/** The mask for the linear page number part of IEMCODETLBENTRY::uTag. */
+#define IEMCODETLB_TAG_PAGE_MASK        UINT64_C(0x0000000fffffffff)
+/** The revision increment for IEMCODETLB::uRevision. */
+#define IEMCODETLB_REVISION_INCR        UINT64_C(0x0000001000000000)
+/** Calculates the tag for a linear address. */
+#define IEMCODETLB_CALC_TAG_NO_REV(a_GCPtr) ( ((a_GCPtr) >> PAGE_SHIFT) & IEMCODETLB_TAG_PAGE_MASK )
+/** Calculates the entry index for a tag (without revision). */
+#define IEMCODETLB_TAG_TO_INDEX(a_uTag)     ( (uintptr_t)(a_uTag) & (IEMCODETLB_ENTRIES - 1) )
+
+/**
+ * The instruction fetch TLB.
+ *
+ * Only used in ring-3, where IEMExecLots runs guests that HM cannot.  The
+ * translation part is invalidated by bumping uRevision (guest TLB flushes,
+ * paging mode changes, execution by other engines); the mapping part by
+ * bumping uPhysRev (PGM changing what backs guest physical pages).
+ *
+ * @remarks This only caches the instruction fetch, not decoded instructions.
+ *          The opcode functions decode and execute in the same pass, so there
+ *          is no decoded form to keep until the decoder is split from the
+ *          IEM_MC blocks.
+ */
+typedef struct IEMCODETLB
+{
+    /** The TLB revision, see IEMCODETLBENTRY::uTag. */
+    uint64_t                        uRevision;
+    /** The physical revision, bumped by IEMTlbInvalidateAllPhysical from any
+     * context. */
+    uint64_t volatile               uPhysRev;
+    /** The entries. */
+    IEMCODETLBENTRY                 aEntries[IEMCODETLB_ENTRIES];
+    /** Number of fetches satisfied by the TLB. */
+    uint32_t                        cHits;
+    /** Number of TLB misses. */
+    uint32_t                        cMisses;
+} IEMCODETLB;
+/** Pointer to the instruction fetch TLB. */
+typedef IEMCODETLB *PIEMCODETLB;
+
+
 /**
  * The per-CPU IEM state.
  */
@@ -414,6 +496,9 @@ typedef struct IEMCPU
         uint8_t             ab[512];
     } aBounceBuffers[3];
 
+    /** The instruction fetch TLB. */
+    IEMCODETLB              CodeTlb;
+
     /** @name Target CPU information.
      * @{ */
 #if IEM_CFG_TARGET_CPU == IEMTARGETCPU_DYNAMIC
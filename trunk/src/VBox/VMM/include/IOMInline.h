@@ -90,10 +90,65 @@ DECLINLINE(void) iomMmioRetainRange(PIOMMMIORANGE pRange)
 }
 
 
+/**
+ * Enters the MMIO lookup generation bracket.
+ *
+ * The generation is advertised in IOMCPU::uMmioLookupGen so that a writer
+ * publishing a new table waits for us before releasing any range that has
+ * dropped out of the current one.  Ranges must be retained before leaving.
+ *
+ * @returns The current generation.
+ * @param   pVM     The cross context VM structure.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ */
+DECLINLINE(uint32_t) iomMmioLookupEnter(PVM pVM, PVMCPU pVCpu)
+{
+    PIOMMMIOLOOKUP pLookup = pVM->iom.s.CTX_SUFF(pMmioLookup);
+    uint32_t       uGen    = ASMAtomicReadU32(&pLookup->uGeneration);
+    for (;;)
+    {
+        ASMAtomicWriteU32(&pVCpu->iom.s.uMmioLookupGen, uGen);
+        uint32_t const uGenNow = ASMAtomicReadU32(&pLookup->uGeneration);
+        if (uGenNow == uGen)
+            return uGen;
+        uGen = uGenNow;
+    }
+}
+
+
+/**
+ * Leaves the MMIO lookup generation bracket.
+ *
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ */
+DECLINLINE(void) iomMmioLookupLeave(PVMCPU pVCpu)
+{
+    ASMAtomicWriteU32(&pVCpu->iom.s.uMmioLookupGen, 0);
+}
+
+
+/**
+ * Retains the MMIO range PGM passed to an access handler.
+ *
+ * @param   pVM     The cross context VM structure.
+ * @param   pVCpu   The cross context virtual CPU structure of the calling EMT.
+ * @param   pRange  The range (the handler user argument).
+ */
+DECLINLINE(void) iomMmioRetainHandlerRange(PVM pVM, PVMCPU pVCpu, PIOMMMIORANGE pRange)
+{
+    iomMmioLookupEnter(pVM, pVCpu);
+    iomMmioRetainRange(pRange);
+    iomMmioLookupLeave(pVCpu);
+}
+
+
 /**
  * Gets the referenced MMIO range for the specified physical address in the
  * current context.
  *
+ * This does not take the IOM lock unless there are more ranges than the
+ * lookup table can hold.
+ *
  * @returns Pointer to MMIO range.
  * @returns NULL if address not in a MMIO range.
  *
@@ -103,6 +158,40 @@ DECLINLINE(void) iomMmioRetainRange(PIOMMMIORANGE pRange)
  */
 DECLINLINE(PIOMMMIORANGE) iomMmioGetRangeWithRef(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys)
 {
+    /*
+     * Search the published lookup table without taking the IOM lock.
+     */
+    uint32_t const      uGen     = iomMmioLookupEnter(pVM, pVCpu);
+    PIOMMMIOLOOKUPTABLE pTable   = &pVM->iom.s.CTX_SUFF(pMmioLookup)->aTables[uGen & 1];
+    uint32_t const      cEntries = pTable->cEntries;
+    if (cEntries != UINT32_MAX)
+    {
+        PIOMMMIORANGE pRange = NULL;
+        uint32_t      iFirst = 0;
+        uint32_t      iEnd   = cEntries;
+        while (iFirst < iEnd)
+        {
+            uint32_t const       i      = iFirst + (iEnd - iFirst) / 2;
+            PCIOMMMIOLOOKUPENTRY pEntry = &pTable->aEntries[i];
+            if (GCPhys < pEntry->GCPhysFirst)
+                iEnd = i;
+            else if (GCPhys > pEntry->GCPhysLast)
+                iFirst = i + 1;
+            else
+            {
+                pRange = pEntry->CTX_SUFF(pRange);
+                iomMmioRetainRange(pRange);
+                break;
+            }
+        }
+        iomMmioLookupLeave(pVCpu);
+        return pRange;
+    }
+    iomMmioLookupLeave(pVCpu);
+
+    /*
+     * Too many ranges for the table, search the tree.
+     */
     int rc = IOM_LOCK_SHARED_EX(pVM, VINF_SUCCESS);
     AssertRCReturn(rc, NULL);
 
@@ -157,6 +246,37 @@ DECLINLINE(PIOMMMIORANGE) iomMMIOGetRangeUnsafe(PVM pVM, PVMCPU pVCpu, RTGCPHYS
 
 
 #ifdef VBOX_WITH_STATISTICS
+/**
+ * Gets the I/O port statistics record.
+ *
+ * The records are never freed, so only the tree search on a cache miss needs
+ * the IOM lock.
+ *
+ * @returns Pointer to I/O port stats.
+ * @returns NULL if not found or if the IOM lock is busy (R0/RC).
+ *
+ * @param   pVM         The cross context VM structure.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling EMT.
+ * @param   Port        The I/O port to lookup.
+ * @param   fWrite      Whether this is for a write (selects the cache).
+ */
+DECLINLINE(PIOMIOPORTSTATS) iomIOPortGetStats(PVM pVM, PVMCPU pVCpu, RTIOPORT Port, bool fWrite)
+{
+    PIOMIOPORTSTATS *ppStatsLast = fWrite ? &pVCpu->iom.s.CTX_SUFF(pStatsLastWrite) : &pVCpu->iom.s.CTX_SUFF(pStatsLastRead);
+    PIOMIOPORTSTATS  pStats      = *ppStatsLast;
+    if (!pStats || pStats->Core.Key != Port)
+    {
+        if (IOM_LOCK_SHARED(pVM) != VINF_SUCCESS)
+            return NULL;
+        pStats = (PIOMIOPORTSTATS)RTAvloIOPortGet(&pVM->iom.s.CTX_SUFF(pTrees)->IOPortStatTree, Port);
+        IOM_UNLOCK_SHARED(pVM);
+        if (pStats)
+            *ppStatsLast = pStats;
+    }
+    return pStats;
+}
+
+
 /**
  * Gets the MMIO statistics record.
  *
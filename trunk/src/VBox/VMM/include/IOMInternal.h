@@ -160,6 +160,11 @@ typedef struct IOMIOPORTRANGER3
     R3PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback;
     /** Description / Name. For easing debugging. */
     R3PTRTYPE(const char *)     pszDesc;
+    /** Flags, see IOMIOPORT_FLAGS_XXX.  These apply to the R0 and RC ranges
+     * covering the same ports as well. */
+    uint32_t                    fFlags;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
 } IOMIOPORTRANGER3;
 /** Pointer to I/O port range descriptor, R3 version. */
 typedef IOMIOPORTRANGER3 *PIOMIOPORTRANGER3;
@@ -297,6 +302,193 @@ typedef struct IOMTREES
 typedef IOMTREES *PIOMTREES;
 
 
+/**
+ * I/O port map entry, R3 version.
+ *
+ * This is a copy of the IOMIOPORTRANGER3 members needed for dispatching, so
+ * that lockless readers never touch a range record that may be freed.
+ */
+typedef struct IOMIOPORTENTRYR3
+{
+    /** Pointer to user argument. */
+    RTR3PTR                     pvUser;
+    /** Pointer to the associated device instance, NULL if no range. */
+    R3PTRTYPE(PPDMDEVINS)       pDevIns;
+    /** Pointer to OUT callback function. */
+    R3PTRTYPE(PFNIOMIOPORTOUT)  pfnOutCallback;
+    /** Pointer to IN callback function. */
+    R3PTRTYPE(PFNIOMIOPORTIN)   pfnInCallback;
+    /** Pointer to string OUT callback function. */
+    R3PTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback;
+    /** Pointer to string IN callback function. */
+    R3PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback;
+    /** Flags, see IOMIOPORT_FLAGS_XXX. */
+    uint32_t                    fFlags;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+} IOMIOPORTENTRYR3;
+/** Pointer to an I/O port map entry, R3 version. */
+typedef IOMIOPORTENTRYR3 *PIOMIOPORTENTRYR3;
+
+/**
+ * I/O port map entry, R0 version.
+ */
+typedef struct IOMIOPORTENTRYR0
+{
+    /** Pointer to user argument. */
+    RTR0PTR                     pvUser;
+    /** Pointer to the associated device instance, NIL_RTR0PTR if no range. */
+    R0PTRTYPE(PPDMDEVINS)       pDevIns;
+    /** Pointer to OUT callback function. */
+    R0PTRTYPE(PFNIOMIOPORTOUT)  pfnOutCallback;
+    /** Pointer to IN callback function. */
+    R0PTRTYPE(PFNIOMIOPORTIN)   pfnInCallback;
+    /** Pointer to string OUT callback function. */
+    R0PTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback;
+    /** Pointer to string IN callback function. */
+    R0PTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback;
+    /** Flags, see IOMIOPORT_FLAGS_XXX. */
+    uint32_t                    fFlags;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+} IOMIOPORTENTRYR0;
+/** Pointer to an I/O port map entry, R0 version. */
+typedef IOMIOPORTENTRYR0 *PIOMIOPORTENTRYR0;
+
+/**
+ * I/O port map entry, RC version.
+ */
+typedef struct IOMIOPORTENTRYRC
+{
+    /** Pointer to user argument. */
+    RTRCPTR                     pvUser;
+    /** Pointer to the associated device instance, NIL_RTRCPTR if no range. */
+    RCPTRTYPE(PPDMDEVINS)       pDevIns;
+    /** Pointer to OUT callback function. */
+    RCPTRTYPE(PFNIOMIOPORTOUT)  pfnOutCallback;
+    /** Pointer to IN callback function. */
+    RCPTRTYPE(PFNIOMIOPORTIN)   pfnInCallback;
+    /** Pointer to string OUT callback function. */
+    RCPTRTYPE(PFNIOMIOPORTOUTSTRING) pfnOutStrCallback;
+    /** Pointer to string IN callback function. */
+    RCPTRTYPE(PFNIOMIOPORTINSTRING) pfnInStrCallback;
+    /** Flags, see IOMIOPORT_FLAGS_XXX. */
+    uint32_t                    fFlags;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+} IOMIOPORTENTRYRC;
+/** Pointer to an I/O port map entry, RC version. */
+typedef IOMIOPORTENTRYRC *PIOMIOPORTENTRYRC;
+
+/**
+ * I/O port map slot.
+ *
+ * A slot describes a run of ports covered by the same R3, R0 and RC ranges.
+ */
+typedef struct IOMIOPORTSLOT
+{
+    /** The ring-3 handler. */
+    IOMIOPORTENTRYR3            EntryR3;
+    /** The ring-0 handler. */
+    IOMIOPORTENTRYR0            EntryR0;
+    /** The raw-mode handler. */
+    IOMIOPORTENTRYRC            EntryRC;
+} IOMIOPORTSLOT;
+/** Pointer to an I/O port map slot. */
+typedef IOMIOPORTSLOT *PIOMIOPORTSLOT;
+
+/** The max number of slots in the I/O port map. */
+#define IOM_IOPORT_MAP_MAX_SLOTS        512
+
+/**
+ * Direct I/O port map.
+ *
+ * This translates each of the 64K ports into a slot with the handlers for all
+ * contexts.  It is rebuilt from the range trees while holding the IOM lock
+ * exclusively and read without taking the lock, the sequence number telling
+ * readers whether they saw a consistent map.
+ */
+typedef struct IOMIOPORTMAP
+{
+    /** Sequence number, odd while the map is being updated. */
+    uint32_t volatile           uSeq;
+    /** Number of slots in use, slot 0 being the one for unused ports.
+     * UINT32_MAX if the ranges did not fit and the trees must be searched. */
+    uint32_t volatile           cSlots;
+    /** The slot index of each port. */
+    uint16_t                    aiSlots[_64K];
+    /** The slots. */
+    IOMIOPORTSLOT               aSlots[IOM_IOPORT_MAP_MAX_SLOTS];
+} IOMIOPORTMAP;
+/** Pointer to the direct I/O port map. */
+typedef IOMIOPORTMAP *PIOMIOPORTMAP;
+
+
+/**
+ * MMIO lookup table entry.
+ */
+typedef struct IOMMMIOLOOKUPENTRY
+{
+    /** The first address of the range. */
+    RTGCPHYS                    GCPhysFirst;
+    /** The last address of the range (inclusive). */
+    RTGCPHYS                    GCPhysLast;
+    /** The range - R3 ptr. */
+    R3PTRTYPE(PIOMMMIORANGE)    pRangeR3;
+    /** The range - R0 ptr. */
+    R0PTRTYPE(PIOMMMIORANGE)    pRangeR0;
+    /** The range - RC ptr. */
+    RCPTRTYPE(PIOMMMIORANGE)    pRangeRC;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+} IOMMMIOLOOKUPENTRY;
+/** Pointer to a MMIO lookup table entry. */
+typedef IOMMMIOLOOKUPENTRY *PIOMMMIOLOOKUPENTRY;
+/** Pointer to a const MMIO lookup table entry. */
+typedef IOMMMIOLOOKUPENTRY const *PCIOMMMIOLOOKUPENTRY;
+
+/** The max number of MMIO ranges in a lookup table. */
+#define IOM_MMIO_LOOKUP_MAX_ENTRIES     256
+
+/**
+ * MMIO lookup table, sorted by address.
+ */
+typedef struct IOMMMIOLOOKUPTABLE
+{
+    /** Number of entries.  UINT32_MAX if the ranges did not fit and the tree
+     * must be searched. */
+    uint32_t                    cEntries;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+    /** The entries. */
+    IOMMMIOLOOKUPENTRY          aEntries[IOM_MMIO_LOOKUP_MAX_ENTRIES];
+} IOMMMIOLOOKUPTABLE;
+/** Pointer to a MMIO lookup table. */
+typedef IOMMMIOLOOKUPTABLE *PIOMMMIOLOOKUPTABLE;
+
+/**
+ * Read-mostly MMIO range lookup.
+ *
+ * The writer builds a new table in the inactive half while holding the IOM
+ * lock exclusively, publishes it by advancing the generation and then waits
+ * for every EMT to leave the previous generation (IOMCPU::uMmioLookupGen)
+ * before any range which dropped out of it may be released.  Readers retain
+ * the range they found before leaving, so they never take the IOM lock.
+ */
+typedef struct IOMMMIOLOOKUP
+{
+    /** The current generation, never zero.  The active table is
+     * aTables[uGeneration & 1]. */
+    uint32_t volatile           uGeneration;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
+    /** The two tables. */
+    IOMMMIOLOOKUPTABLE          aTables[2];
+} IOMMMIOLOOKUP;
+/** Pointer to the MMIO range lookup. */
+typedef IOMMMIOLOOKUP *PIOMMMIOLOOKUP;
+
+
 /**
  * Converts an IOM pointer into a VM pointer.
  * @returns Pointer to the VM structure the PGM is part of.
@@ -319,6 +511,19 @@ typedef struct IOM
     /** Pointer to the trees - R0 ptr. */
     R0PTRTYPE(PIOMTREES)            pTreesR0;
 
+    /** Pointer to the direct I/O port map - R3 ptr. */
+    R3PTRTYPE(PIOMIOPORTMAP)        pIOPortMapR3;
+    /** Pointer to the direct I/O port map - R0 ptr. */
+    R0PTRTYPE(PIOMIOPORTMAP)        pIOPortMapR0;
+    /** Pointer to the direct I/O port map - RC ptr. */
+    RCPTRTYPE(PIOMIOPORTMAP)        pIOPortMapRC;
+    /** Pointer to the MMIO range lookup - RC ptr. */
+    RCPTRTYPE(PIOMMMIOLOOKUP)       pMmioLookupRC;
+    /** Pointer to the MMIO range lookup - R3 ptr. */
+    R3PTRTYPE(PIOMMMIOLOOKUP)       pMmioLookupR3;
+    /** Pointer to the MMIO range lookup - R0 ptr. */
+    R0PTRTYPE(PIOMMMIOLOOKUP)       pMmioLookupR0;
+
     /** MMIO physical access handler type.   */
     PGMPHYSHANDLERTYPE              hMmioHandlerType;
     uint32_t                        u32Padding;
@@ -336,6 +541,7 @@ typedef struct IOM
     STAMCOUNTER                     StatInstOut;
     STAMCOUNTER                     StatInstIns;
     STAMCOUNTER                     StatInstOuts;
+    STAMCOUNTER                     StatIOPortNoDevLock;
     /** @} */
 
     /** @name MMIO statistics.
@@ -367,6 +573,7 @@ typedef struct IOM
     STAMCOUNTER                     StatRZMMIO8Bytes;
 
     STAMCOUNTER                     StatR3MMIOHandler;
+    STAMCOUNTER                     StatMMIONoDevLock;
 
     RTUINT                          cMovsMaxBytes;
     RTUINT                          cStosMaxBytes;
@@ -424,6 +631,12 @@ typedef struct IOMCPU
         uint32_t                        uAlignmentPadding;
     } PendingMmioWrite;
 
+    /** The MMIO lookup generation this EMT is searching, 0 if none.
+     * See IOMMMIOLOOKUP. */
+    uint32_t volatile               uMmioLookupGen;
+    /** Alignment padding. */
+    uint32_t                        u32Padding;
+
     /** @name Caching of I/O Port and MMIO ranges and statistics.
      * (Saves quite some time in rep outs/ins instruction emulation.)
      * @{ */
@@ -305,12 +305,28 @@ typedef struct PDMCRITSECTINT
     SUPSEMEVENT                     hEventToSignal;
     /** The lock name. */
     R3PTRTYPE(const char *)         pszName;
+    /** The current ring-3 spin limit (loop iterations), adjusted as we learn
+     * how long the lock is typically held. */
+    uint32_t volatile               cSpinsR3;
+    /** The current ring-0/raw-mode spin limit (loop iterations). */
+    uint32_t volatile               cSpinsRZ;
+    /** The upper bound for cSpinsR3, 0 means never spin (uniprocessor host). */
+    uint32_t                        cSpinsMaxR3;
+    /** The upper bound for cSpinsRZ, 0 means never spin. */
+    uint32_t                        cSpinsMaxRZ;
     /** R0/RC lock contention. */
     STAMCOUNTER                     StatContentionRZLock;
     /** R0/RC unlock contention. */
     STAMCOUNTER                     StatContentionRZUnlock;
     /** R3 lock contention. */
     STAMCOUNTER                     StatContentionR3;
+    /** Contended enters that got the lock while spinning. */
+    STAMCOUNTER                     StatSpinAcquired;
+    /** Contended enters that gave up spinning and blocked or went to ring-3. */
+    STAMCOUNTER                     StatSpinGaveUp;
+    /** Histogram of how long blocked waiters waited, see
+     * PDMCRITSECT_WAIT_HISTO_BUCKETS. */
+    STAMCOUNTER                     aStatWaitHisto[4];
     /** Profiling the time the section is locked. */
     STAMPROFILEADV                  StatLocked;
 } PDMCRITSECTINT;
@@ -322,6 +338,30 @@ typedef PDMCRITSECTINT *PPDMCRITSECTINT;
  * PDMCritSectIsOwner and PDMCritSectIsOwned optimizations. */
 #define PDMCRITSECT_FLAGS_PENDING_UNLOCK    RT_BIT_32(17)
 
+/** @name Critical section spinning.
+ * The spin limits start out at PDMCRITSECT_SPIN_COUNT_R3/RZ and are then
+ * adjusted per critical section, up to PDMCRITSECT::cSpinsMaxR3/RZ.
+ * @{ */
+/** The initial number of loops to spin for in ring-3. */
+#define PDMCRITSECT_SPIN_COUNT_R3           20
+/** The initial number of loops to spin for in ring-0 and raw-mode. */
+#define PDMCRITSECT_SPIN_COUNT_RZ           256
+/** The default ring-3 spin limit ceiling (/PDM/CritSect/SpinMaxR3). */
+#define PDMCRITSECT_SPIN_MAX_R3_DEF         1024
+/** The default ring-0 and raw-mode spin limit ceiling (/PDM/CritSect/SpinMaxRZ). */
+#define PDMCRITSECT_SPIN_MAX_RZ_DEF         2048
+/** The spin limit floor, so the limit can recover once the lock gets cheaper. */
+#define PDMCRITSECT_SPIN_MIN                8
+/** Blocking waits shorter than this (ns) mean we gave up spinning too early,
+ * as blocking and waking up again costs about as much. */
+#define PDMCRITSECT_SPIN_WORTHWHILE_NS      (20 * RT_NS_1US)
+/** @} */
+
+/** The number of buckets in the PDMCRITSECTINT::aStatWaitHisto histogram:
+ * below 10us, below 100us, below 1ms, and 1ms or longer. */
+#define PDMCRITSECT_WAIT_HISTO_BUCKETS      4
+AssertCompileMemberSize(PDMCRITSECTINT, aStatWaitHisto, sizeof(STAMCOUNTER) * PDMCRITSECT_WAIT_HISTO_BUCKETS);
+
 
 /**
  * Private critical section data.
@@ -1222,6 +1262,8 @@ typedef struct PDMUSERPERVM
 
     /** Global block cache data. */
     R3PTRTYPE(PPDMBLKCACHEGLOBAL)   pBlkCacheGlobal;
+    /** The worker pool running the work queues. */
+    R3PTRTYPE(struct PDMWORKPOOL *) pWorkPool;
 #ifdef VBOX_WITH_NETSHAPER
     /** Pointer to network shaper instance. */
     R3PTRTYPE(PPDMNETSHAPER)        pNetShaper;
@@ -1368,6 +1410,15 @@ int         pdmR3BlkCacheInit(PVM pVM);
 void        pdmR3BlkCacheTerm(PVM pVM);
 int         pdmR3BlkCacheResume(PVM pVM);
 
+int         pdmR3WorkPoolInit(PVM pVM);
+void        pdmR3WorkPoolTerm(PVM pVM);
+int         pdmR3WorkQueueCreateDevice(PVM pVM, PPDMDEVINS pDevIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                       PFNPDMWORKDEV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue);
+int         pdmR3WorkQueueCreateDriver(PVM pVM, PPDMDRVINS pDrvIns, PDMWORKPRIO enmPrio, uint32_t iAffinity,
+                                       PFNPDMWORKDRV pfnCallback, const char *pszName, PPDMWORKQUEUE *ppQueue);
+int         pdmR3WorkQueueDestroyDevice(PVM pVM, PPDMDEVINS pDevIns);
+int         pdmR3WorkQueueDestroyDriver(PVM pVM, PPDMDRVINS pDrvIns);
+
 #endif /* IN_RING3 */
 
 void        pdmLock(PVM pVM);
@@ -15,8 +15,35 @@
  * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
  */
 
+/**
+ * Token bucket, implemented as a generic cell rate algorithm (GCRA).
+ *
+ * Instead of a token count and a timestamp, which would have to be updated
+ * together, the bucket state is a single theoretical arrival time (TAT) that
+ * can be updated with a compare and exchange.  The bucket is empty when the
+ * TAT is cNsBurst or more ahead of the current time and full when the TAT is
+ * in the past.
+ */
+typedef struct PDMNSBUCKET
+{
+    /** Rate in bytes per second, 0 means unlimited. */
+    volatile uint64_t                           cbPerSec;
+    /** Burst size in nanoseconds at cbPerSec. */
+    volatile uint64_t                           cNsBurst;
+    /** The theoretical arrival time (RTTimeSystemNanoTS). */
+    volatile uint64_t                           tsTat;
+} PDMNSBUCKET;
+/** Pointer to a token bucket. */
+typedef PDMNSBUCKET *PPDMNSBUCKET;
+
 /**
  * Bandwidth group instance data
+ *
+ * Groups can be nested (HTB style).  A group may always send at its own rate
+ * (Rate bucket).  Beyond that it may borrow unused bandwidth from its parent,
+ * up to its ceiling (Ceil bucket).  Traffic sent at the group's own rate is
+ * charged to all its ancestors, so borrowing is limited to what siblings leave
+ * unused.
  */
 typedef struct PDMNSBWGROUP
 {
@@ -24,7 +51,12 @@ typedef struct PDMNSBWGROUP
     R3PTRTYPE(struct PDMNSBWGROUP *)            pNextR3;
     /** Pointer to the shared UVM structure. */
     R3PTRTYPE(struct PDMNETSHAPER *)            pShaperR3;
-    /** Critical section protecting all members below. */
+    /** Pointer to the parent group, NULL for root groups (ring-3). */
+    R3PTRTYPE(struct PDMNSBWGROUP *)            pParentR3;
+    /** Pointer to the parent group, NIL_RTR0PTR for root groups (ring-0). */
+    R0PTRTYPE(struct PDMNSBWGROUP *)            pParentR0;
+    /** Critical section protecting the filter list and limit changes.  The
+     * buckets are updated without taking it. */
     PDMCRITSECT                                 Lock;
     /** Pointer to the first filter attached to this group. */
     R3PTRTYPE(struct PDMNSFILTER *)             pFiltersHeadR3;
@@ -32,14 +64,30 @@ typedef struct PDMNSBWGROUP
     R3PTRTYPE(char *)                           pszNameR3;
     /** Maximum number of bytes filters are allowed to transfer. */
     volatile uint64_t                           cbPerSecMax;
+    /** Maximum number of bytes per second when borrowing from the parent,
+     * 0 if same as cbPerSecMax. */
+    volatile uint64_t                           cbPerSecCeil;
     /** Number of bytes we are allowed to transfer in one burst. */
     volatile uint32_t                           cbBucket;
-    /** Number of bytes we were allowed to transfer at the last update. */
-    volatile uint32_t                           cbTokensLast;
-    /** Timestamp of the last update */
-    volatile uint64_t                           tsUpdatedLast;
+    /** Configured burst size in bytes, 0 for the default. */
+    uint32_t                                    cbBurstCfg;
+    /** The bucket for the guaranteed rate (cbPerSecMax, cbBucket). */
+    PDMNSBUCKET                                 Rate;
+    /** The bucket for the ceiling (cbPerSecCeil), only used when borrowing. */
+    PDMNSBUCKET                                 Ceil;
+    /** Number of filters which were choked during the last shaper period.  When
+     * more than one is backlogged the deficit round robin is enforced. */
+    volatile uint32_t                           cBacklogged;
     /** Reference counter - How many filters are associated with this group. */
     volatile uint32_t                           cRefs;
+    /** Number of bytes granted at the group's own rate. */
+    STAMCOUNTER                                 StatBytesGranted;
+    /** Number of bytes granted by borrowing from the parent. */
+    STAMCOUNTER                                 StatBytesBorrowed;
+    /** Number of denied requests. */
+    STAMCOUNTER                                 StatDenied;
+    /** Number of requests denied by the deficit round robin scheduler. */
+    STAMCOUNTER                                 StatDeniedDrr;
 } PDMNSBWGROUP;
 /** Pointer to a bandwidth group. */
 typedef PDMNSBWGROUP *PPDMNSBWGROUP;
@@ -662,6 +662,44 @@ typedef PGMPHYSHANDLER *PPGMPHYSHANDLER;
 #define PGMPHYSHANDLER_GET_TYPE(a_pVM, a_pPhysHandler) PGMPHYSHANDLERTYPEINT_FROM_HANDLE(a_pVM, (a_pPhysHandler)->hType)
 
 
+/**
+ * Physical access handler lookup index entry.
+ */
+typedef struct PGMPHYSHANDLERIDXENTRY
+{
+    /** The last address covered by the handler (inclusive), the search key. */
+    RTGCPHYS                            GCPhysLast;
+    /** The handler as an offset relative to PGMTREES, valid in all contexts. */
+    int32_t                             offHandler;
+    /** Alignment padding. */
+    uint32_t                            u32Padding;
+} PGMPHYSHANDLERIDXENTRY;
+/** Pointer to a physical access handler lookup index entry. */
+typedef PGMPHYSHANDLERIDXENTRY *PPGMPHYSHANDLERIDXENTRY;
+
+/**
+ * Physical access handler lookup index.
+ *
+ * The physical handler tree flattened into an array sorted by address.  Page
+ * granular handlers (VGA dirty tracking, ROM shadowing and such) make the
+ * tree deep, and binary searching this packed array touches far fewer cache
+ * lines than walking it.  The index is kept in sync with the tree by the
+ * register, deregister, modify, split and join code, all owning the PGM lock.
+ * It lives on the hyper heap and is referenced by PGMTREES::offPhysHandlerIdx.
+ */
+typedef struct PGMPHYSHANDLERIDX
+{
+    /** The number of entries in use. */
+    uint32_t                            cEntries;
+    /** The number of entries allocated. */
+    uint32_t                            cMaxEntries;
+    /** The entries, sorted by address (variable size). */
+    PGMPHYSHANDLERIDXENTRY              aEntries[1];
+} PGMPHYSHANDLERIDX;
+/** Pointer to a physical access handler lookup index. */
+typedef PGMPHYSHANDLERIDX *PPGMPHYSHANDLERIDX;
+
+
 #ifdef VBOX_WITH_RAW_MODE
 
 /**
@@ -1508,22 +1546,9 @@ typedef struct PGMRAMRANGE
 
     /** Alignment padding. */
     RTRCPTR                             Alignment0;
-    /** Pointer to the left search three node - ring-3 context. */
-    R3PTRTYPE(struct PGMRAMRANGE *)     pLeftR3;
-    /** Pointer to the right search three node - ring-3 context. */
-    R3PTRTYPE(struct PGMRAMRANGE *)     pRightR3;
-    /** Pointer to the left search three node - ring-0 context. */
-    R0PTRTYPE(struct PGMRAMRANGE *)     pLeftR0;
-    /** Pointer to the right search three node - ring-0 context. */
-    R0PTRTYPE(struct PGMRAMRANGE *)     pRightR0;
-    /** Pointer to the left search three node - raw-mode context. */
-    RCPTRTYPE(struct PGMRAMRANGE *)     pLeftRC;
-    /** Pointer to the right search three node - raw-mode context. */
-    RCPTRTYPE(struct PGMRAMRANGE *)     pRightRC;
-
     /** Padding to make aPage aligned on sizeof(PGMPAGE). */
-#if HC_ARCH_BITS == 32
-    uint32_t                            au32Alignment2[HC_ARCH_BITS == 32 ? 2 : 0];
+#if HC_ARCH_BITS == 64
+    uint64_t                            u64Alignment2;
 #endif
     /** Array of physical guest page tracking structures. */
     PGMPAGE                             aPages[1];
@@ -1552,7 +1577,7 @@ typedef PGMRAMRANGE *PPGMRAMRANGE;
 
 /** The number of entries in the RAM range TLBs (there is one for each
  *  context).  Must be a power of two. */
-#define PGM_RAMRANGE_TLB_ENTRIES            8
+#define PGM_RAMRANGE_TLB_ENTRIES            32
 
 /**
  * Calculates the RAM range TLB index for the physical address.
@@ -1563,6 +1588,48 @@ typedef PGMRAMRANGE *PPGMRAMRANGE;
 #define PGM_RAMRANGE_TLB_IDX(a_GCPhys)      ( ((a_GCPhys) >> 20) & (PGM_RAMRANGE_TLB_ENTRIES - 1) )
 
 
+/**
+ * RAM range lookup table entry.
+ */
+typedef struct PGMRAMRANGELOOKUPENTRY
+{
+    /** Last address in the range (inclusive), the search key. */
+    RTGCPHYS                            GCPhysLast;
+    /** The RAM range - R3 pointer. */
+    R3PTRTYPE(PPGMRAMRANGE)             pRamR3;
+    /** The RAM range - R0 pointer. */
+    R0PTRTYPE(PPGMRAMRANGE)             pRamR0;
+    /** The RAM range - RC pointer. */
+    RCPTRTYPE(PPGMRAMRANGE)             pRamRC;
+    /** Alignment padding. */
+    RTRCPTR                             Alignment0;
+} PGMRAMRANGELOOKUPENTRY;
+AssertCompileMemberAlignment(PGMRAMRANGELOOKUPENTRY, GCPhysLast, 8);
+/** Pointer to a RAM range lookup table entry. */
+typedef PGMRAMRANGELOOKUPENTRY *PPGMRAMRANGELOOKUPENTRY;
+
+/**
+ * RAM range lookup table.
+ *
+ * This is the RAM range list flattened into an array sorted by address,
+ * used for binary searching when the RAM range TLB misses.  It lives on the
+ * hyper heap and is rebuilt by ring-3 whenever the list changes.  There are
+ * two tables which take turns at being the current one, so that lockless
+ * lookups never see one that is being rebuilt.
+ */
+typedef struct PGMRAMRANGELOOKUP
+{
+    /** The number of entries in use. */
+    uint32_t                            cEntries;
+    /** The number of entries allocated. */
+    uint32_t                            cMaxEntries;
+    /** The entries, sorted by address (variable size). */
+    PGMRAMRANGELOOKUPENTRY              aEntries[1];
+} PGMRAMRANGELOOKUP;
+/** Pointer to a RAM range lookup table. */
+typedef PGMRAMRANGELOOKUP *PPGMRAMRANGELOOKUP;
+
+
 
 /**
  * Per page tracking structure for ROM image.
@@ -1886,9 +1953,10 @@ typedef struct PGMPAGER3MAPTLBE
 typedef PGMPAGER3MAPTLBE *PPGMPAGER3MAPTLBE;
 
 
-/** The number of entries in the ring-3 guest page mapping TLB.
+/** The max number of entries in the ring-3 guest page mapping TLB.
+ * The number actually used is configurable, see /PGM/PageMapTlbEntries.
  * @remarks The value must be a power of two. */
-#define PGM_PAGER3MAPTLB_ENTRIES 256
+#define PGM_PAGER3MAPTLB_ENTRIES 1024
 
 /**
  * Ring-3 guest page mapping TLB.
@@ -1896,6 +1964,10 @@ typedef PGMPAGER3MAPTLBE *PPGMPAGER3MAPTLBE;
  */
 typedef struct PGMPAGER3MAPTLB
 {
+    /** The index mask, i.e. the number of entries in use minus one. */
+    uint32_t                    fIdxMask;
+    /** Alignment padding. */
+    uint32_t                    u32Padding;
     /** The TLB entries. */
     PGMPAGER3MAPTLBE            aEntries[PGM_PAGER3MAPTLB_ENTRIES];
 } PGMPAGER3MAPTLB;
@@ -1905,9 +1977,10 @@ typedef PGMPAGER3MAPTLB *PPGMPAGER3MAPTLB;
 /**
  * Calculates the index of the TLB entry for the specified guest page.
  * @returns Physical TLB index.
+ * @param   a_pVM       The cross context VM structure.
  * @param   GCPhys      The guest physical address.
  */
-#define PGM_PAGER3MAPTLB_IDX(GCPhys)    ( ((GCPhys) >> PAGE_SHIFT) & (PGM_PAGER3MAPTLB_ENTRIES - 1) )
+#define PGM_PAGER3MAPTLB_IDX(a_pVM, GCPhys)     ( ((GCPhys) >> PAGE_SHIFT) & (a_pVM)->pgm.s.PhysTlbHC.fIdxMask )
 
 
 /**
@@ -2074,6 +2147,7 @@ typedef PGMMAPSET *PPGMMAPSET;
 /** @def PGM_PAGEMAPTLB_IDX
  * Calculate the TLB index for a guest physical address.
  * @returns The TLB index.
+ * @param   a_pVM       The cross context VM structure.
  * @param   GCPhys      The guest physical address. */
 /** @typedef PPGMPAGEMAP
  * Pointer to a page mapper unit for current context. */
@@ -2084,7 +2158,7 @@ typedef PGMMAPSET *PPGMMAPSET;
 // typedef PPGMPAGEGCMAPTLBE              PPGMPAGEMAPTLBE;
 // typedef PPGMPAGEGCMAPTLBE             *PPPGMPAGEMAPTLBE;
 # define PGM_PAGEMAPTLB_ENTRIES         PGM_PAGEGCMAPTLB_ENTRIES
-# define PGM_PAGEMAPTLB_IDX(GCPhys)     PGM_PAGEGCMAPTLB_IDX(GCPhys)
+# define PGM_PAGEMAPTLB_IDX(a_pVM, GCPhys) PGM_PAGEGCMAPTLB_IDX(a_pVM, GCPhys)
  typedef void *                         PPGMPAGEMAP;
  typedef void **                        PPPGMPAGEMAP;
 //#elif IN_RING0
@@ -2092,7 +2166,7 @@ typedef PGMMAPSET *PPGMMAPSET;
 // typedef PPGMPAGER0MAPTLBE              PPGMPAGEMAPTLBE;
 // typedef PPGMPAGER0MAPTLBE             *PPPGMPAGEMAPTLBE;
 //# define PGM_PAGEMAPTLB_ENTRIES         PGM_PAGER0MAPTLB_ENTRIES
-//# define PGM_PAGEMAPTLB_IDX(GCPhys)     PGM_PAGER0MAPTLB_IDX(GCPhys)
+//# define PGM_PAGEMAPTLB_IDX(a_pVM, GCPhys) PGM_PAGER0MAPTLB_IDX(a_pVM, GCPhys)
 // typedef PPGMCHUNKR0MAP                 PPGMPAGEMAP;
 // typedef PPPGMCHUNKR0MAP                PPPGMPAGEMAP;
 #else
@@ -2100,7 +2174,7 @@ typedef PGMMAPSET *PPGMMAPSET;
  typedef PPGMPAGER3MAPTLBE              PPGMPAGEMAPTLBE;
  typedef PPGMPAGER3MAPTLBE             *PPPGMPAGEMAPTLBE;
 # define PGM_PAGEMAPTLB_ENTRIES         PGM_PAGER3MAPTLB_ENTRIES
-# define PGM_PAGEMAPTLB_IDX(GCPhys)     PGM_PAGER3MAPTLB_IDX(GCPhys)
+# define PGM_PAGEMAPTLB_IDX(a_pVM, GCPhys) PGM_PAGER3MAPTLB_IDX(a_pVM, GCPhys)
  typedef PPGMCHUNKR3MAP                 PPGMPAGEMAP;
  typedef PPPGMCHUNKR3MAP                PPPGMPAGEMAP;
 #endif
@@ -2720,6 +2794,10 @@ typedef struct PGMTREES
     RTLISTOFF32ANCHOR               HeadPhysHandlerTypes;
     /** Physical access handlers (AVL range+offsetptr tree). */
     AVLROGCPHYSTREE                 PhysHandlers;
+    /** The physical access handler lookup index (PGMPHYSHANDLERIDX), as an
+     * offset relative to this structure.  0 if not present, in which case the
+     * lookups fall back on the tree. */
+    int32_t                         offPhysHandlerIdx;
 #ifdef VBOX_WITH_RAW_MODE
     /** Virtual access handlers (AVL range + GC ptr tree). */
     AVLROGCPTRTREE                  VirtHandlers;
@@ -3292,8 +3370,10 @@ typedef struct PGM
     /** Pointer to the list of RAM ranges (Phys GC -> Phys HC conversion) - for R3.
      * This is sorted by physical address and contains no overlapping ranges. */
     R3PTRTYPE(PPGMRAMRANGE)         pRamRangesXR3;
-    /** Root of the RAM range search tree for ring-3. */
-    R3PTRTYPE(PPGMRAMRANGE)         pRamRangeTreeR3;
+    /** The current RAM range lookup table - R3 pointer. */
+    R3PTRTYPE(PPGMRAMRANGELOOKUP)   pRamRangeLookupR3;
+    /** The two RAM range lookup tables taking turns at being current. */
+    R3PTRTYPE(PPGMRAMRANGELOOKUP)   apRamRangeLookupR3[2];
     /** PGM offset based trees - R3 Ptr. */
     R3PTRTYPE(PPGMTREES)            pTreesR3;
     /** Caching the last physical handler we looked up in R3. */
@@ -3320,8 +3400,8 @@ typedef struct PGM
     R0PTRTYPE(PPGMRAMRANGE)         apRamRangesTlbR0[PGM_RAMRANGE_TLB_ENTRIES];
     /** R0 pointer corresponding to PGM::pRamRangesXR3. */
     R0PTRTYPE(PPGMRAMRANGE)         pRamRangesXR0;
-    /** Root of the RAM range search tree for ring-0. */
-    R0PTRTYPE(PPGMRAMRANGE)         pRamRangeTreeR0;
+    /** The current RAM range lookup table - R0 pointer. */
+    R0PTRTYPE(PPGMRAMRANGELOOKUP)   pRamRangeLookupR0;
     /** PGM offset based trees - R0 Ptr. */
     R0PTRTYPE(PPGMTREES)            pTreesR0;
     /** Caching the last physical handler we looked up in R0. */
@@ -3341,8 +3421,8 @@ typedef struct PGM
     RCPTRTYPE(PPGMRAMRANGE)         apRamRangesTlbRC[PGM_RAMRANGE_TLB_ENTRIES];
     /** RC pointer corresponding to PGM::pRamRangesXR3. */
     RCPTRTYPE(PPGMRAMRANGE)         pRamRangesXRC;
-    /** Root of the RAM range search tree for raw-mode context. */
-    RCPTRTYPE(PPGMRAMRANGE)         pRamRangeTreeRC;
+    /** The current RAM range lookup table - RC pointer. */
+    RCPTRTYPE(PPGMRAMRANGELOOKUP)   pRamRangeLookupRC;
     /** PGM offset based trees - RC Ptr. */
     RCPTRTYPE(PPGMTREES)            pTreesRC;
     /** Caching the last physical handler we looked up in RC. */
@@ -3564,6 +3644,26 @@ typedef struct PGM
     bool                            afReserved[3];
     /** @} */
 
+    /** @name   Large page compaction (ring-3 only).
+     * @{ */
+    /** The compaction timer (TMCLOCK_REAL), NULL if compaction is disabled. */
+    PTMTIMERR3                      pLargePageCompactTimerR3;
+    /** The guest physical address of the 2 MB range to examine next. */
+    RTGCPHYS                        GCPhysLargePageCompactNext;
+    /** The interval between compaction runs in milliseconds. */
+    uint32_t                        cMsLargePageCompactInterval;
+    /** The max number of 2 MB ranges to examine per run. */
+    uint32_t                        cLargePageCompactMaxScan;
+    /** The max number of 2 MB ranges to promote per run. */
+    uint32_t                        cLargePageCompactMaxPromote;
+    /** The min number of allocated pages in a 2 MB range for promoting it. */
+    uint32_t                        cLargePageCompactMinPages;
+    /** The number of runs to skip after failing to allocate a large page. */
+    uint32_t                        cLargePageCompactBackoff;
+    /** Percentage of the guest RAM backed by large pages, updated every run. */
+    uint32_t                        uLargePageCoverage;
+    /** @} */
+
     /** @name Release Statistics
      * @{ */
     uint32_t                        cAllPages;              /**< The total number of pages. (Should be Private + Shared + Zero + Pure MMIO.) */
@@ -3589,6 +3689,11 @@ typedef struct PGM
     STAMCOUNTER                     StatLargePageReused;    /**< The number of large pages we've reused.*/
     STAMCOUNTER                     StatLargePageRefused;   /**< The number of times we couldn't use a large page.*/
     STAMCOUNTER                     StatLargePageRecheck;   /**< The number of times we rechecked a disabled large page.*/
+    STAMCOUNTER                     StatLargePageCompactScanned;    /**< The number of 2 MB ranges examined by the compaction worker. */
+    STAMCOUNTER                     StatLargePageCompactIneligible; /**< The number of 2 MB ranges that could not be promoted. */
+    STAMCOUNTER                     StatLargePageCompactPromoted;   /**< The number of 2 MB ranges promoted to large pages. */
+    STAMCOUNTER                     StatLargePageCompactAllocFailed;/**< The number of times we failed to allocate a large page for compaction. */
+    STAMPROFILE                     StatLargePageCompact;           /**< Profiles the compaction runs. */
 
     STAMPROFILE                     StatShModCheck;         /**< Profiles shared module checks. */
     /** @} */
@@ -4049,6 +4154,20 @@ typedef struct PGMCPU
 #endif
     /** @} */
 
+    /** @name Physical access handler lookup cache.
+     * Kept per VCPU so EMTs hitting different devices don't keep evicting each
+     * other.  Protected by the PGM lock.
+     * @{ */
+    /** The last physical handler looked up by this VCPU - R3 pointer. */
+    R3PTRTYPE(PPGMPHYSHANDLER)      pLastPhysHandlerR3;
+    /** The last physical handler looked up by this VCPU - R0 pointer. */
+    R0PTRTYPE(PPGMPHYSHANDLER)      pLastPhysHandlerR0;
+    /** The last physical handler looked up by this VCPU - RC pointer. */
+    RCPTRTYPE(PPGMPHYSHANDLER)      pLastPhysHandlerRC;
+    /** Alignment padding. */
+    RTRCPTR                         RCPtrAlignment3;
+    /** @} */
+
     /** For saving stack space, the disassembler state is allocated here instead of
      * on the stack. */
     DISCPUSTATE                     DisState;
@@ -4141,6 +4260,10 @@ DECLCALLBACK(void) pgmR3MapInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs
 
 void            pgmR3HandlerPhysicalUpdateAll(PVM pVM);
 bool            pgmHandlerPhysicalIsAll(PVM pVM, RTGCPHYS GCPhys);
+PPGMPHYSHANDLER pgmHandlerPhysicalLookupSlow(PVM pVM, RTGCPHYS GCPhys);
+void            pgmHandlerPhysicalIdxInsert(PVM pVM, PPGMPHYSHANDLER pHandler);
+void            pgmHandlerPhysicalIdxRemove(PVM pVM, PPGMPHYSHANDLER pHandler);
+void            pgmHandlerPhysicalInvalidateLookupCaches(PVM pVM);
 void            pgmHandlerPhysicalResetAliasedPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhysPage, bool fDoAccounting);
 #ifdef VBOX_WITH_RAW_MODE
 PPGMVIRTHANDLER pgmHandlerVirtualFindByPhysAddr(PVM pVM, RTGCPHYS GCPhys, unsigned *piPage);
@@ -4197,6 +4320,7 @@ int             pgmR3PhysChunkMap(PVM pVM, uint32_t idChunk, PPPGMCHUNKR3MAP ppC
 int             pgmR3PhysRamTerm(PVM pVM);
 void            pgmR3PhysRomTerm(PVM pVM);
 void            pgmR3PhysAssertSharedPageChecksums(PVM pVM);
+int             pgmR3PhysLargePageCompactInit(PVM pVM);
 
 int             pgmR3PoolInit(PVM pVM);
 void            pgmR3PoolRelocate(PVM pVM);
@@ -4205,6 +4329,7 @@ void            pgmR3PoolReset(PVM pVM);
 void            pgmR3PoolClearAll(PVM pVM, bool fFlushRemTlb);
 DECLCALLBACK(VBOXSTRICTRC) pgmR3PoolClearAllRendezvous(PVM pVM, PVMCPU pVCpu, void *fpvFlushRemTbl);
 void            pgmR3PoolWriteProtectPages(PVM pVM);
+void            pgmR3PoolFlushPhysPTs(PVM pVM, RTGCPHYS GCPhysBase);
 
 #endif /* IN_RING3 */
 #if defined(VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0) || defined(IN_RC)
@@ -0,0 +1,289 @@
+/* $Id$ */
+/** @file
+ * IOM Testcase - I/O port accesses with and without the device lock.
+ *
+ * Hammers a doorbell style I/O port from all EMTs, once registered the
+ * normal way and once with IOMIOPORT_FLAGS_NO_DEV_LOCK, and reports the
+ * time per access and the contention counters of the device lock.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/iom.h>
+#include <VBox/vmm/pdmdev.h>
+#include <VBox/vmm/pdmcritsect.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/err.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/path.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Maximum number of EMTs. */
+#define TST_CPUS_MAX                8
+/** Number of accesses done by every EMT. */
+#define TST_ACCESSES                _1M
+/** The port registered the normal way. */
+#define TST_PORT_DEV_LOCK           0xe000
+/** The port registered with IOMIOPORT_FLAGS_NO_DEV_LOCK. */
+#define TST_PORT_NO_DEV_LOCK        0xe008
+/** The name of the device lock. */
+#define TST_CRITSECT_NAME           "tstIOMNoDevLock"
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The test handle. */
+static RTTEST               g_hTest;
+/** Number of EMTs. */
+static uint32_t             g_cCpus;
+/** The faked device instance owning the ports. */
+static PPDMDEVINS           g_pDevIns;
+/** The device lock. */
+static PDMCRITSECT          g_CritSect;
+/** Released once all EMTs are ready to start. */
+static RTSEMEVENTMULTI      g_hEvtStart;
+/** The doorbell register. */
+static volatile uint32_t    g_u32Doorbell;
+/** Number of doorbell writes seen by the device. */
+static volatile uint32_t    g_cDoorbellWrites;
+
+
+/**
+ * @callback_method_impl{FNIOMIOPORTOUT, The doorbell: just atomics, like the
+ *  BusLogic mailbox doorbell.}
+ */
+static DECLCALLBACK(int) tstIOMDoorbellOut(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT Port, uint32_t u32, unsigned cb)
+{
+    NOREF(pDevIns); NOREF(pvUser); NOREF(Port); NOREF(cb);
+    ASMAtomicWriteU32(&g_u32Doorbell, u32);
+    ASMAtomicIncU32(&g_cDoorbellWrites);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates the faked device and registers both ports, called on EMT(0).
+ */
+static DECLCALLBACK(int) tstIOMSetup(PVM pVM)
+{
+    g_pDevIns = (PPDMDEVINS)RTMemAllocZ(sizeof(PDMDEVINS));
+    if (!g_pDevIns)
+        return VERR_NO_MEMORY;
+    g_pDevIns->u32Version    = PDM_DEVINS_VERSION;
+    g_pDevIns->pCritSectRoR3 = &g_CritSect;
+
+    int rc = PDMR3CritSectInit(pVM, &g_CritSect, RT_SRC_POS, TST_CRITSECT_NAME);
+    if (RT_SUCCESS(rc))
+        rc = IOMR3IOPortRegisterR3(pVM, g_pDevIns, TST_PORT_DEV_LOCK, 1, NULL, tstIOMDoorbellOut, NULL,
+                                   NULL, NULL, 0 /*fFlags*/, "tstIOM-DevLock");
+    if (RT_SUCCESS(rc))
+        rc = IOMR3IOPortRegisterR3(pVM, g_pDevIns, TST_PORT_NO_DEV_LOCK, 1, NULL, tstIOMDoorbellOut, NULL,
+                                   NULL, NULL, IOMIOPORT_FLAGS_NO_DEV_LOCK, "tstIOM-NoDevLock");
+    return rc;
+}
+
+
+/**
+ * Deregisters the ports and destroys the faked device, called on EMT(0).
+ */
+static DECLCALLBACK(int) tstIOMCleanup(PVM pVM)
+{
+    IOMR3IOPortDeregister(pVM, g_pDevIns, TST_PORT_NO_DEV_LOCK, 1);
+    IOMR3IOPortDeregister(pVM, g_pDevIns, TST_PORT_DEV_LOCK, 1);
+    PDMR3CritSectDelete(&g_CritSect);
+    RTMemFree(g_pDevIns);
+    g_pDevIns = NULL;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Writes the given port TST_ACCESSES times, called on each EMT.
+ */
+static DECLCALLBACK(int) tstIOMWorker(PVM pVM, uintptr_t uPort, uint64_t *pcNsElapsed)
+{
+    PVMCPU pVCpu = VMMGetCpu(pVM);
+    AssertReturn(pVCpu, VERR_VM_THREAD_NOT_EMT);
+
+    RTSemEventMultiWait(g_hEvtStart, RT_INDEFINITE_WAIT);
+
+    uint64_t const nsStart = RTTimeNanoTS();
+    for (uint32_t i = 0; i < TST_ACCESSES; i++)
+    {
+        VBOXSTRICTRC rcStrict = IOMIOPortWrite(pVM, pVCpu, (RTIOPORT)uPort, i, sizeof(uint32_t));
+        if (rcStrict != VINF_SUCCESS)
+            return VERR_IPE_UNEXPECTED_INFO_STATUS;
+    }
+    *pcNsElapsed = RTTimeNanoTS() - nsStart;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSTAMR3ENUM, Reports a device lock counter as test value.}
+ */
+static DECLCALLBACK(int) tstIOMStatReport(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                          STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    NOREF(enmUnit); NOREF(enmVisiblity); NOREF(pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        RTTestValueF(g_hTest, ((PSTAMCOUNTER)pvSample)->c, RTTESTUNIT_OCCURRENCES, "%s %s",
+                     (const char *)pvUser, RTPathFilename(pszName));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Runs the worker on the given number of EMTs against one port.
+ */
+static void tstIOMRun(PUVM pUVM, PVM pVM, uint32_t cCpus, RTIOPORT Port, const char *pszPort)
+{
+    PVMREQ   apReqs[TST_CPUS_MAX];
+    uint64_t acNsElapsed[TST_CPUS_MAX];
+
+    RTTestISubF("%s, %u EMT(s)", pszPort, cCpus);
+    STAMR3Reset(pUVM, "/PDM/CritSects/" TST_CRITSECT_NAME "/*");
+    ASMAtomicWriteU32(&g_cDoorbellWrites, 0);
+    RTSemEventMultiReset(g_hEvtStart);
+
+    for (VMCPUID idCpu = 0; idCpu < cCpus; idCpu++)
+    {
+        acNsElapsed[idCpu] = 0;
+        int rc = VMR3ReqCallU(pUVM, idCpu, &apReqs[idCpu], 0 /*cMillies*/, VMREQFLAGS_VBOX_STATUS,
+                              (PFNRT)tstIOMWorker, 3, pVM, (uintptr_t)Port, &acNsElapsed[idCpu]);
+        RTTESTI_CHECK_MSG(rc == VERR_TIMEOUT || RT_SUCCESS(rc), ("rc=%Rrc\n", rc));
+    }
+
+    RTSemEventMultiSignal(g_hEvtStart);
+
+    uint64_t cNsMax = 0;
+    for (VMCPUID idCpu = 0; idCpu < cCpus; idCpu++)
+    {
+        int rc = VMR3ReqWait(apReqs[idCpu], RT_INDEFINITE_WAIT);
+        if (RT_SUCCESS(rc))
+            rc = apReqs[idCpu]->iStatus;
+        RTTESTI_CHECK_RC_OK(rc);
+        VMR3ReqFree(apReqs[idCpu]);
+        cNsMax = RT_MAX(cNsMax, acNsElapsed[idCpu]);
+    }
+
+    RTTESTI_CHECK(g_cDoorbellWrites == cCpus * TST_ACCESSES);
+    RTTestIValue("Wall time per access", cNsMax / TST_ACCESSES, RTTESTUNIT_NS_PER_CALL);
+    RTTestIValue("Accesses per second", (uint64_t)cCpus * TST_ACCESSES * RT_NS_1SEC / RT_MAX(cNsMax, 1),
+                 RTTESTUNIT_CALLS_PER_SEC);
+    STAMR3Enum(pUVM, "/PDM/CritSects/" TST_CRITSECT_NAME "/Contention*", tstIOMStatReport, (void *)"Device lock");
+    STAMR3Enum(pUVM, "/PDM/CritSects/" TST_CRITSECT_NAME "/Spin*", tstIOMStatReport, (void *)"Device lock");
+    STAMR3Enum(pUVM, "/PDM/CritSects/" TST_CRITSECT_NAME "/Wait-*", tstIOMStatReport, (void *)"Device lock");
+}
+
+
+static DECLCALLBACK(int) tstIOMNoDevLockConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pUVM); NOREF(pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc) && g_cCpus > 1)
+    {
+        /* SMP requires HM. */
+        PCFGMNODE pRoot = CFGMR3GetRoot(pVM);
+        CFGMR3RemoveValue(pRoot, "HMEnabled");
+        rc = CFGMR3InsertInteger(pRoot, "HMEnabled", true);
+        if (RT_SUCCESS(rc))
+        {
+            CFGMR3RemoveValue(pRoot, "NumCPUs");
+            rc = CFGMR3InsertInteger(pRoot, "NumCPUs", g_cCpus);
+        }
+    }
+    return rc;
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    NOREF(envp);
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    int rc = RTTestCreate("tstIOMNoDevLock", &g_hTest);
+    if (RT_FAILURE(rc))
+        return RTEXITCODE_INIT;
+    RTTestBanner(g_hTest);
+
+    g_cCpus = RT_MIN(RT_MAX(RTMpGetOnlineCount(), 1), TST_CPUS_MAX);
+    rc = RTSemEventMultiCreate(&g_hEvtStart);
+    RTTESTI_CHECK_RC_OK_RET(rc, RTTestSummaryAndDestroy(g_hTest));
+
+    PUVM pUVM;
+    PVM  pVM;
+    rc = VMR3Create(g_cCpus, NULL, NULL, NULL, tstIOMNoDevLockConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstIOMSetup, 1, pVM);
+        RTTESTI_CHECK_RC_OK(rc);
+        if (RT_SUCCESS(rc))
+        {
+            for (uint32_t cCpus = 1; cCpus <= g_cCpus; cCpus *= 2)
+            {
+                tstIOMRun(pUVM, pVM, cCpus, TST_PORT_DEV_LOCK, "Device lock");
+                tstIOMRun(pUVM, pVM, cCpus, TST_PORT_NO_DEV_LOCK, "IOMIOPORT_FLAGS_NO_DEV_LOCK");
+            }
+
+            STAMR3Print(pUVM, "/IOM/IOWork/NoDevLock");
+            rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstIOMCleanup, 1, pVM);
+            RTTESTI_CHECK_RC_OK(rc);
+        }
+
+        rc = VMR3PowerOff(pUVM);
+        RTTESTI_CHECK_RC_OK(rc);
+        rc = VMR3Destroy(pUVM);
+        RTTESTI_CHECK_RC_OK(rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else if (g_cCpus > 1)
+        RTTestSkipped(g_hTest, "VMR3Create with %u CPUs failed: %Rrc (HM not available?)\n", g_cCpus, rc);
+    else
+        RTTestFailed(g_hTest, "VMR3Create failed: %Rrc\n", rc);
+
+    RTSemEventMultiDestroy(g_hEvtStart);
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
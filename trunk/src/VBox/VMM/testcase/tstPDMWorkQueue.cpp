@@ -0,0 +1,384 @@
+/* $Id$ */
+/** @file
+ * PDM Work Queue Testcase.
+ *
+ * Checks that the items of a work queue are run one at a time in the order
+ * they were posted while several queues are fed from different threads and
+ * share the worker pool.
+ */
+
+/*
+ * Copyright (C) 2016 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/vmm/pdmworkqueue.h>
+#include <VBox/err.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Number of queues, more than the default number of workers so some
+ * queues have to share their home worker. */
+#define TST_QUEUES                  12
+/** Number of items posted to each queue. */
+#define TST_ITEMS_PER_QUEUE         20000
+/** Number of items each callback reposts for the chained test. */
+#define TST_CHAIN_LENGTH            10000
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * Test state of one work queue.
+ */
+typedef struct TSTQUEUE
+{
+    /** The work queue. */
+    PPDMWORKQUEUE       pQueue;
+    /** The items, posted in array order. */
+    struct TSTITEM     *paItems;
+    /** Sequence number of the next item expected in the callback. */
+    uint32_t volatile   iSeqNext;
+    /** Number of callbacks currently running for this queue. */
+    uint32_t volatile   cRunning;
+    /** Number of items run out of order. */
+    uint32_t volatile   cOutOfOrder;
+    /** Number of times two callbacks of this queue overlapped. */
+    uint32_t volatile   cOverlaps;
+} TSTQUEUE;
+/** Pointer to the test state of a work queue. */
+typedef TSTQUEUE *PTSTQUEUE;
+
+/**
+ * Test work item.
+ */
+typedef struct TSTITEM
+{
+    /** The PDM work item core, must be first. */
+    PDMWORKITEM         Core;
+    /** The queue the item belongs to. */
+    PTSTQUEUE           pTstQueue;
+    /** The sequence number of the item. */
+    uint32_t            iSeq;
+} TSTITEM;
+/** Pointer to a test work item. */
+typedef TSTITEM *PTSTITEM;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The test handle. */
+static RTTEST               g_hTest;
+/** The queues. */
+static TSTQUEUE             g_aQueues[TST_QUEUES];
+/** Number of callbacks running concurrently over all queues. */
+static uint32_t volatile    g_cRunningAll;
+/** Highest number of callbacks seen running concurrently. */
+static uint32_t volatile    g_cRunningAllMax;
+/** Number of items the chained callback still has to repost. */
+static uint32_t volatile    g_cChainLeft;
+
+
+/**
+ * Work item callback checking the order and serialisation of a queue.
+ */
+static DECLCALLBACK(void) tstWorkItemCallback(PVM pVM, PPDMWORKITEM pItem)
+{
+    PTSTITEM  pTstItem  = (PTSTITEM)pItem;
+    PTSTQUEUE pTstQueue = pTstItem->pTstQueue;
+    NOREF(pVM);
+
+    if (ASMAtomicIncU32(&pTstQueue->cRunning) != 1)
+        ASMAtomicIncU32(&pTstQueue->cOverlaps);
+
+    uint32_t cRunningAll = ASMAtomicIncU32(&g_cRunningAll);
+    uint32_t cRunningAllMax = ASMAtomicReadU32(&g_cRunningAllMax);
+    while (   cRunningAll > cRunningAllMax
+           && !ASMAtomicCmpXchgU32(&g_cRunningAllMax, cRunningAll, cRunningAllMax))
+        cRunningAllMax = ASMAtomicReadU32(&g_cRunningAllMax);
+
+    if (pTstItem->iSeq != pTstQueue->iSeqNext)
+        ASMAtomicIncU32(&pTstQueue->cOutOfOrder);
+    pTstQueue->iSeqNext = pTstItem->iSeq + 1;
+
+    /* Widen the window for overlapping callbacks a little. */
+    if (!(pTstItem->iSeq % 64))
+        RTThreadYield();
+
+    ASMAtomicDecU32(&g_cRunningAll);
+    ASMAtomicDecU32(&pTstQueue->cRunning);
+}
+
+
+/**
+ * Work item callback reposting its item until the chain is done.
+ */
+static DECLCALLBACK(void) tstWorkItemChainCallback(PVM pVM, PPDMWORKITEM pItem)
+{
+    PTSTITEM  pTstItem  = (PTSTITEM)pItem;
+    PTSTQUEUE pTstQueue = pTstItem->pTstQueue;
+    NOREF(pVM);
+
+    if (ASMAtomicIncU32(&pTstQueue->cRunning) != 1)
+        ASMAtomicIncU32(&pTstQueue->cOverlaps);
+    if (pTstItem->iSeq != pTstQueue->iSeqNext)
+        ASMAtomicIncU32(&pTstQueue->cOutOfOrder);
+    pTstQueue->iSeqNext = pTstItem->iSeq + 1;
+    ASMAtomicDecU32(&pTstQueue->cRunning);
+
+    if (ASMAtomicDecU32(&g_cChainLeft) > 0)
+    {
+        pTstItem->iSeq++;
+        int rc = PDMR3WorkQueuePost(pTstQueue->pQueue, &pTstItem->Core);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+    }
+}
+
+
+/**
+ * Creates a work queue, runs on EMT.
+ */
+static DECLCALLBACK(int) tstQueueCreate(PVM pVM, PDMWORKPRIO enmPrio, uint32_t iAffinity, PFNPDMWORKINT pfnCallback,
+                                        const char *pszName, PPDMWORKQUEUE *ppQueue)
+{
+    return PDMR3WorkQueueCreateInternal(pVM, enmPrio, iAffinity, pfnCallback, pszName, ppQueue);
+}
+
+
+/**
+ * Destroys a work queue, runs on EMT.
+ */
+static DECLCALLBACK(int) tstQueueDestroy(PPDMWORKQUEUE pQueue)
+{
+    return PDMR3WorkQueueDestroy(pQueue);
+}
+
+
+/**
+ * Thread posting all items of one queue.
+ */
+static DECLCALLBACK(int) tstPosterThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PTSTQUEUE pTstQueue = (PTSTQUEUE)pvUser;
+    NOREF(hThreadSelf);
+
+    for (uint32_t i = 0; i < TST_ITEMS_PER_QUEUE; i++)
+    {
+        int rc = PDMR3WorkQueuePost(pTstQueue->pQueue, &pTstQueue->paItems[i].Core);
+        if (RT_FAILURE(rc))
+            return rc;
+
+        /* Give the workers a chance to drain the queue every now and then. */
+        if (!(i % 1000))
+            RTThreadYield();
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Posts items to several queues from one thread per queue and checks that the
+ * items of every queue ran serialised and in order.
+ */
+static void tstOrdering(PUVM pUVM)
+{
+    RTTestSub(g_hTest, "Ordering and serialisation");
+
+    PVM pVM = VMR3GetVM(pUVM);
+    RT_ZERO(g_aQueues);
+    for (unsigned iQueue = 0; iQueue < TST_QUEUES; iQueue++)
+    {
+        PTSTQUEUE pTstQueue = &g_aQueues[iQueue];
+        char szName[32];
+        RTStrPrintf(szName, sizeof(szName), "tst%u", iQueue);
+
+        pTstQueue->paItems = (PTSTITEM)RTTestGuardedAllocTail(g_hTest, TST_ITEMS_PER_QUEUE * sizeof(TSTITEM));
+        RTTEST_CHECK_RETV(g_hTest, pTstQueue->paItems);
+        for (uint32_t i = 0; i < TST_ITEMS_PER_QUEUE; i++)
+        {
+            pTstQueue->paItems[i].pTstQueue = pTstQueue;
+            pTstQueue->paItems[i].iSeq      = i;
+        }
+
+        /* Mix the priorities and leave some queues without a home worker. */
+        PDMWORKPRIO enmPrio   = (PDMWORKPRIO)(PDMWORKPRIO_LOW + iQueue % 3);
+        uint32_t    iAffinity = iQueue % 4 == 3 ? PDMWORKQUEUE_AFFINITY_ANY : iQueue;
+        int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstQueueCreate, 6, pVM, enmPrio, iAffinity,
+                                  tstWorkItemCallback, szName, &pTstQueue->pQueue);
+        RTTEST_CHECK_RC_OK_RETV(g_hTest, rc);
+        RTTEST_CHECK(g_hTest, PDMR3WorkQueueIsIdle(pTstQueue->pQueue));
+    }
+
+    uint64_t   nsStart = RTTimeNanoTS();
+    RTTHREAD   ahThreads[TST_QUEUES];
+    for (unsigned iQueue = 0; iQueue < TST_QUEUES; iQueue++)
+    {
+        int rc = RTThreadCreateF(&ahThreads[iQueue], tstPosterThread, &g_aQueues[iQueue], 0, RTTHREADTYPE_DEFAULT,
+                                 RTTHREADFLAGS_WAITABLE, "POST%u", iQueue);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        if (RT_FAILURE(rc))
+            ahThreads[iQueue] = NIL_RTTHREAD;
+    }
+
+    for (unsigned iQueue = 0; iQueue < TST_QUEUES; iQueue++)
+    {
+        if (ahThreads[iQueue] == NIL_RTTHREAD)
+            continue;
+        int rcThread = VERR_INTERNAL_ERROR;
+        int rc = RTThreadWait(ahThreads[iQueue], RT_INDEFINITE_WAIT, &rcThread);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        RTTEST_CHECK_RC_OK(g_hTest, rcThread);
+    }
+
+    for (unsigned iQueue = 0; iQueue < TST_QUEUES; iQueue++)
+    {
+        PTSTQUEUE pTstQueue = &g_aQueues[iQueue];
+        int rc = PDMR3WorkQueueWaitIdle(pTstQueue->pQueue, 60000);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        RTTEST_CHECK(g_hTest, PDMR3WorkQueueIsIdle(pTstQueue->pQueue));
+        RTTEST_CHECK_MSG(g_hTest, pTstQueue->iSeqNext == TST_ITEMS_PER_QUEUE,
+                         (g_hTest, "queue %u: ran %u of %u items\n", iQueue, pTstQueue->iSeqNext, TST_ITEMS_PER_QUEUE));
+        RTTEST_CHECK_MSG(g_hTest, !pTstQueue->cOutOfOrder,
+                         (g_hTest, "queue %u: %u items out of order\n", iQueue, pTstQueue->cOutOfOrder));
+        RTTEST_CHECK_MSG(g_hTest, !pTstQueue->cOverlaps,
+                         (g_hTest, "queue %u: callbacks overlapped %u times\n", iQueue, pTstQueue->cOverlaps));
+    }
+    uint64_t nsElapsed = RTTimeNanoTS() - nsStart;
+
+    RTTestValue(g_hTest, "Items run", TST_QUEUES * TST_ITEMS_PER_QUEUE, RTTESTUNIT_OCCURRENCES);
+    RTTestValue(g_hTest, "Elapsed", nsElapsed, RTTESTUNIT_NS);
+    RTTestValue(g_hTest, "Max concurrent callbacks", g_cRunningAllMax, RTTESTUNIT_OCCURRENCES);
+
+    for (unsigned iQueue = 0; iQueue < TST_QUEUES; iQueue++)
+    {
+        int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstQueueDestroy, 1, g_aQueues[iQueue].pQueue);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        g_aQueues[iQueue].pQueue = NULL;
+        RTTestGuardedFree(g_hTest, g_aQueues[iQueue].paItems);
+        g_aQueues[iQueue].paItems = NULL;
+    }
+}
+
+
+/**
+ * Reposts an item from its own callback, which must neither run the item
+ * concurrently with itself nor lose it.
+ */
+static void tstRepostFromCallback(PUVM pUVM)
+{
+    RTTestSub(g_hTest, "Repost from callback");
+
+    PVM       pVM       = VMR3GetVM(pUVM);
+    PTSTQUEUE pTstQueue = &g_aQueues[0];
+    TSTITEM   Item;
+
+    RT_ZERO(*pTstQueue);
+    RT_ZERO(Item);
+    Item.pTstQueue = pTstQueue;
+    g_cChainLeft   = TST_CHAIN_LENGTH;
+
+    int rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstQueueCreate, 6, pVM, PDMWORKPRIO_NORMAL,
+                              PDMWORKQUEUE_AFFINITY_ANY, tstWorkItemChainCallback, "tstChain", &pTstQueue->pQueue);
+    RTTEST_CHECK_RC_OK_RETV(g_hTest, rc);
+
+    rc = PDMR3WorkQueuePost(pTstQueue->pQueue, &Item.Core);
+    RTTEST_CHECK_RC_OK(g_hTest, rc);
+
+    /* The queue goes idle in between when the callback reposts, so wait for the chain first. */
+    uint64_t msStart = RTTimeMilliTS();
+    while (   ASMAtomicReadU32(&g_cChainLeft)
+           && RTTimeMilliTS() - msStart < 60000)
+        RTThreadSleep(1);
+    RTTEST_CHECK(g_hTest, !ASMAtomicReadU32(&g_cChainLeft));
+
+    rc = PDMR3WorkQueueWaitIdle(pTstQueue->pQueue, 60000);
+    RTTEST_CHECK_RC_OK(g_hTest, rc);
+    RTTEST_CHECK_MSG(g_hTest, pTstQueue->iSeqNext == TST_CHAIN_LENGTH,
+                     (g_hTest, "ran %u of %u items\n", pTstQueue->iSeqNext, TST_CHAIN_LENGTH));
+    RTTEST_CHECK(g_hTest, !pTstQueue->cOutOfOrder);
+    RTTEST_CHECK(g_hTest, !pTstQueue->cOverlaps);
+
+    rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstQueueDestroy, 1, pTstQueue->pQueue);
+    RTTEST_CHECK_RC_OK(g_hTest, rc);
+    pTstQueue->pQueue = NULL;
+}
+
+
+static DECLCALLBACK(int) tstPDMWorkQueueConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pUVM); NOREF(pvUser);
+    return CFGMR3ConstructDefaultTree(pVM);
+}
+
+
+/**
+ *  Entry point.
+ */
+extern "C" DECLEXPORT(int) TrustedMain(int argc, char **argv, char **envp)
+{
+    NOREF(envp);
+    RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    int rc = RTTestCreate("tstPDMWorkQueue", &g_hTest);
+    if (RT_FAILURE(rc))
+        return RTEXITCODE_INIT;
+    RTTestBanner(g_hTest);
+
+    PUVM pUVM;
+    rc = VMR3Create(1, NULL, NULL, NULL, tstPDMWorkQueueConfigConstructor, NULL, NULL, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        tstOrdering(pUVM);
+        tstRepostFromCallback(pUVM);
+
+        STAMR3Print(pUVM, "/PDM/Work*");
+
+        rc = VMR3PowerOff(pUVM);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        rc = VMR3Destroy(pUVM);
+        RTTEST_CHECK_RC_OK(g_hTest, rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+        RTTestFailed(g_hTest, "VMR3Create failed: %Rrc\n", rc);
+
+    return RTTestSummaryAndDestroy(g_hTest);
+}
+
+
+#if !defined(VBOX_WITH_HARDENING) || !defined(RT_OS_WINDOWS)
+/**
+ * Main entry point.
+ */
+int main(int argc, char **argv, char **envp)
+{
+    return TrustedMain(argc, argv, envp);
+}
+#endif
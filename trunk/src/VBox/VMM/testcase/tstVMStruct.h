@@ -281,6 +281,9 @@
     GEN_CHECK_OFF(IEMCPU, aBounceBuffers[1]);
     GEN_CHECK_OFF(IEMCPU, aMemBbMappings);
     GEN_CHECK_OFF(IEMCPU, aMemBbMappings[1]);
+    GEN_CHECK_OFF(IEMCPU, CodeTlb);
+    GEN_CHECK_OFF(IEMCPU, CodeTlb.aEntries);
+    GEN_CHECK_OFF(IEMCPU, CodeTlb.aEntries[1]);
 
     GEN_CHECK_SIZE(IOM);
     GEN_CHECK_OFF(IOM, pTreesRC);
@@ -683,6 +686,9 @@
     GEN_CHECK_OFF(PGMCPU, pfnR0BthPrefetchPage);
     GEN_CHECK_OFF(PGMCPU, pfnR0BthVerifyAccessSyncPage);
     GEN_CHECK_OFF(PGMCPU, pfnR0BthAssertCR3);
+    GEN_CHECK_OFF(PGMCPU, pLastPhysHandlerR3);
+    GEN_CHECK_OFF(PGMCPU, pLastPhysHandlerR0);
+    GEN_CHECK_OFF(PGMCPU, pLastPhysHandlerRC);
     GEN_CHECK_OFF(PGMCPU, DisState);
     GEN_CHECK_OFF(PGMCPU, cGuestModeChanges);
 #ifdef VBOX_WITH_STATISTICS
@@ -886,6 +892,7 @@
     GEN_CHECK_OFF(PGMMMIO2RANGE, RamRange);
     GEN_CHECK_SIZE(PGMTREES);
     GEN_CHECK_OFF(PGMTREES, PhysHandlers);
+    GEN_CHECK_OFF(PGMTREES, offPhysHandlerIdx);
     GEN_CHECK_OFF(PGMTREES, HeadPhysHandlerTypes);
 #ifdef VBOX_WITH_RAW_MODE
     GEN_CHECK_OFF(PGMTREES, VirtHandlers);